@@ -23,6 +23,8 @@
 #include "datacache.h"
 #include "utlvector.h"
 #include "fmtstr.h"
+#include "tier0/icommandline.h"
+#include "datacachepolicy.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -49,6 +51,11 @@ ConVar developer( "developer", "0", FCVAR_INTERNAL_USE );
 static ConVar mem_force_flush( "mem_force_flush", "0", FCVAR_CHEAT, "Force cache flush of unlocked resources on every alloc" );
 static int g_iDontForceFlush;
 
+// Reload cost assumed for items that have never been seen reloading
+#define DC_DEFAULT_RELOAD_MS_PER_BYTE	( 1.0f / ( 1024.0f * 1024.0f ) )
+// Misses followed by an add later than this are not treated as a reload
+#define DC_MAX_RELOAD_MS				5000
+
 //-----------------------------------------------------------------------------
 // DataCacheItem_t
 //-----------------------------------------------------------------------------
@@ -75,7 +82,9 @@ CDataCacheSection::CDataCacheSection( CDataCache *pSharedCache, IDataCacheClient
 	m_mutex( pSharedCache->m_mutex ),
 	m_pSharedCache( pSharedCache ),
 	m_nFrameUnlockCounter( 0 ),
-	m_options( 0 )
+	m_options( 0 ),
+	m_pPolicy( NULL ),
+	m_flReloadMsPerByte( DC_DEFAULT_RELOAD_MS_PER_BYTE )
 {
 	memset( &m_status, 0, sizeof(m_status) );
 	AssertMsg1( strlen(pszName) <= DC_MAX_CLIENT_NAME, "Cache client name too long \"%s\"", pszName );
@@ -91,6 +100,8 @@ CDataCacheSection::CDataCacheSection( CDataCache *pSharedCache, IDataCacheClient
 
 CDataCacheSection::~CDataCacheSection()
 {
+	delete m_pPolicy;
+
 	FrameLock_t *pFrameLock;
 	while ( ( pFrameLock = m_FreeFrameLocks.Pop() ) != NULL )
 	{
@@ -217,6 +228,21 @@ bool CDataCacheSection::AddEx( DataCacheClientID_t clientId, const void *pItemDa
 
 	NoteAdd( size );
 
+	float flCost = ConsumeReloadCost( size );
+	if ( m_pPolicy )
+	{
+		AUTO_LOCK( m_mutex );
+		if ( m_pPolicy )
+		{
+			m_pPolicy->OnInsert( clientId, (uintp)hMem, size, flCost );
+		}
+	}
+
+	if ( g_DataCacheTrace.IsActive() )
+	{
+		g_DataCacheTrace.Record( 'A', GetName(), clientId, size, flCost );
+	}
+
 	OnAdd( clientId, (DataCacheHandle_t)hMem );
 
 	g_iDontForceFlush++;
@@ -319,6 +345,11 @@ DataCacheRemoveResult_t CDataCacheSection::Remove( DataCacheHandle_t handle, con
 				*pItemSize = pItem->size;
 			}
 
+			if ( g_DataCacheTrace.IsActive() )
+			{
+				g_DataCacheTrace.Record( 'R', GetName(), pItem->clientId, pItem->size );
+			}
+
 			DiscardItem( lruHandle, ( bNotify ) ? DC_REMOVED : DC_NONE );
 
 			return DC_OK;
@@ -357,8 +388,16 @@ void *CDataCacheSection::Lock( DataCacheHandle_t handle )
 			{
 				NoteLock( pItem->size );
 			}
+
+			NotePolicyAccess( pItem->clientId );
+			if ( g_DataCacheTrace.IsActive() )
+			{
+				g_DataCacheTrace.Record( 'L', GetName(), pItem->clientId, pItem->size );
+			}
 			return const_cast<void *>(pItem->pItemData);
 		}
+
+		NoteMiss( handle );
 	}
 
 	return NULL;
@@ -383,6 +422,10 @@ int CDataCacheSection::Unlock( DataCacheHandle_t handle )
 		{
 			nBytesUnlocked = AccessItem( (memhandle_t)handle )->size;
 		}
+		if ( g_DataCacheTrace.IsActive() && AccessItem( (memhandle_t)handle ) )
+		{
+			g_DataCacheTrace.Record( 'U', GetName(), AccessItem( (memhandle_t)handle )->clientId, 0 );
+		}
 		m_mutex.Unlock();
 		if ( nBytesUnlocked )
 		{
@@ -432,8 +475,15 @@ void *CDataCacheSection::Get( DataCacheHandle_t handle, bool bFrameLock )
 		DataCacheItem_t *pItem = m_LRU.GetResource_NoLock( (memhandle_t)handle );
 		if ( pItem )
 		{
+			NotePolicyAccess( pItem->clientId );
+			if ( g_DataCacheTrace.IsActive() )
+			{
+				g_DataCacheTrace.Record( 'G', GetName(), pItem->clientId, pItem->size );
+			}
 			return const_cast<void *>( pItem->pItemData );
 		}
+
+		NoteMiss( handle );
 	}
 
 	return NULL;
@@ -602,6 +652,16 @@ int CDataCacheSection::BreakLock( DataCacheHandle_t handle )
 bool CDataCacheSection::Touch( DataCacheHandle_t handle )
 {
 	m_LRU.TouchResource( (memhandle_t)handle );
+
+	if ( m_pPolicy )
+	{
+		AUTO_LOCK( m_mutex );
+		DataCacheItem_t *pItem = m_LRU.GetResource_NoLockNoLRUTouch( (memhandle_t)handle );
+		if ( pItem )
+		{
+			NotePolicyAccess( pItem->clientId );
+		}
+	}
 	return true;
 }
 
@@ -677,6 +737,13 @@ unsigned CDataCacheSection::Purge( unsigned nBytes )
 
 	AUTO_LOCK( m_mutex );
 
+	if ( m_pPolicy )
+	{
+		unsigned nBytesPurged = 0;
+		PurgeByPolicy( nBytes, 0, &nBytesPurged );
+		return nBytesPurged;
+	}
+
 	unsigned nBytesPurged = 0;
 	unsigned nBytesCurrent = 0;
 
@@ -706,6 +773,11 @@ unsigned CDataCacheSection::PurgeItems( unsigned nItems )
 {
 	AUTO_LOCK( m_mutex );
 
+	if ( m_pPolicy )
+	{
+		return PurgeByPolicy( 0, nItems, NULL );
+	}
+
 	unsigned nPurged = 0;
 
 	memhandle_t hCurrent = GetFirstUnlockedItem();
@@ -765,6 +837,15 @@ void CDataCacheSection::UpdateSize( DataCacheHandle_t handle, unsigned int nNewS
 		
 		m_LRU.NotifySizeChanged( (memhandle_t)handle, oldSize, nNewSize );
 		NoteSizeChanged( oldSize, nNewSize );
+
+		if ( m_pPolicy )
+		{
+			AUTO_LOCK( m_mutex );
+			if ( m_pPolicy )
+			{
+				m_pPolicy->OnResize( pItem->clientId, nNewSize );
+			}
+		}
 	}
 
 	m_LRU.UnlockResource( (memhandle_t)handle );
@@ -835,49 +916,57 @@ bool CDataCacheSection::DiscardItem( memhandle_t hItem, DataCacheNotificationTyp
 			NoteUnlock( pItem->size );
 		}
 
-		FrameLock_t *pFrameLock = m_ThreadFrameLock.Get();
-		if ( pFrameLock )
+		UnlinkFrameLock( pItem );
+
+		pItem->pSection = NULL; // inhibit callbacks from lower level resource system
+		m_LRU.DestroyResource( hItem );
+		return true;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Remove an item being discarded from the calling thread's frame lock list
+//-----------------------------------------------------------------------------
+void CDataCacheSection::UnlinkFrameLock( DataCacheItem_t *pItem )
+{
+	FrameLock_t *pFrameLock = m_ThreadFrameLock.Get();
+	if ( pFrameLock )
+	{
+		int iThread = pFrameLock->m_iThread;
+		if ( pItem->pNextFrameLocked[iThread] != DC_NO_NEXT_LOCKED )
 		{
-			int iThread = pFrameLock->m_iThread;
-			if ( pItem->pNextFrameLocked[iThread] != DC_NO_NEXT_LOCKED )
+			if ( pFrameLock->m_pFirst == pItem )
 			{
-				if ( pFrameLock->m_pFirst == pItem )
-				{
-					pFrameLock->m_pFirst = pItem->pNextFrameLocked[iThread];
-				}
-				else
+				pFrameLock->m_pFirst = pItem->pNextFrameLocked[iThread];
+			}
+			else
+			{
+				DataCacheItem_t *pCurrent = pFrameLock->m_pFirst;
+				while ( pCurrent )
 				{
-					DataCacheItem_t *pCurrent = pFrameLock->m_pFirst;
-					while ( pCurrent )
+					if ( pCurrent->pNextFrameLocked[iThread] == pItem )
 					{
-						if ( pCurrent->pNextFrameLocked[iThread] == pItem )
-						{
-							pCurrent->pNextFrameLocked[iThread] = pItem->pNextFrameLocked[iThread];
-							break;
-						}
-						pCurrent = pCurrent->pNextFrameLocked[iThread];
+						pCurrent->pNextFrameLocked[iThread] = pItem->pNextFrameLocked[iThread];
+						break;
 					}
+					pCurrent = pCurrent->pNextFrameLocked[iThread];
 				}
-				pItem->pNextFrameLocked[iThread] = DC_NO_NEXT_LOCKED;
 			}
-
+			pItem->pNextFrameLocked[iThread] = DC_NO_NEXT_LOCKED;
 		}
 
+	}
+
 #ifdef _DEBUG
-		for ( int i = 0; i < DC_MAX_THREADS_FRAMELOCKED; i++ )
+	for ( int i = 0; i < DC_MAX_THREADS_FRAMELOCKED; i++ )
+	{
+		if ( pItem->pNextFrameLocked[i] != DC_NO_NEXT_LOCKED )
 		{
-			if ( pItem->pNextFrameLocked[i] != DC_NO_NEXT_LOCKED )
-			{
-				DebuggerBreak(); // higher level code needs to handle better
-			}
+			DebuggerBreak(); // higher level code needs to handle better
 		}
-#endif
-
-		pItem->pSection = NULL; // inhibit callbacks from lower level resource system
-		m_LRU.DestroyResource( hItem );
-		return true;
 	}
-	return false;
+#endif
 }
 
 bool CDataCacheSection::DiscardItemData( DataCacheItem_t *pItem, DataCacheNotificationType_t type )
@@ -905,12 +994,14 @@ bool CDataCacheSection::DiscardItemData( DataCacheItem_t *pItem, DataCacheNotifi
 
 			if ( bResult )
 			{
+				NotePolicyRemove( pItem->clientId, type );
 				NoteRemove( pItem->size );
 			}
 
 			return bResult;
 		}
 
+		NotePolicyRemove( pItem->clientId, type );
 		OnRemove( pItem->clientId );
 
 		pItem->pSection = NULL;
@@ -926,156 +1017,1290 @@ bool CDataCacheSection::DiscardItemData( DataCacheItem_t *pItem, DataCacheNotifi
 
 
 //-----------------------------------------------------------------------------
-// CDataCacheSectionFastFind
+// Purpose: Reload cost measurement. A miss on a stale handle followed by an add
+//			on the same thread is taken as the client reloading the item.
 //-----------------------------------------------------------------------------
-DataCacheHandle_t CDataCacheSectionFastFind::DoFind( DataCacheClientID_t clientId ) 
-{ 
-	AUTO_LOCK( m_mutex );
-	UtlHashFastHandle_t hHash = m_Handles.Find( Hash4( &clientId ) );
-	if( hHash != m_Handles.InvalidHandle() )
-		return m_Handles[hHash];
-	return DC_INVALID_HANDLE; 
+void CDataCacheSection::NoteMiss( DataCacheHandle_t handle )
+{
+	if ( m_pPolicy || g_DataCacheTrace.IsActive() )
+	{
+		m_nThreadMissTime.Set( (int)Plat_MSTime() | 1 );
+	}
 }
 
-
-void CDataCacheSectionFastFind::OnAdd( DataCacheClientID_t clientId, DataCacheHandle_t hCacheItem ) 
+float CDataCacheSection::ConsumeReloadCost( unsigned size )
 {
-	AUTO_LOCK( m_mutex );
-	Assert( m_Handles.Find( Hash4( &clientId ) ) == m_Handles.InvalidHandle());
-	m_Handles.FastInsert( Hash4( &clientId ), hCacheItem );
+	int nMissTime = m_nThreadMissTime.Get();
+	if ( nMissTime )
+	{
+		m_nThreadMissTime.Set( 0 );
+
+		unsigned nElapsed = (unsigned)Plat_MSTime() - (unsigned)nMissTime;
+		if ( nElapsed < DC_MAX_RELOAD_MS )
+		{
+			float flCost = MAX( (float)nElapsed, 0.1f );
+			if ( size )
+			{
+				m_flReloadMsPerByte = 0.9f * m_flReloadMsPerByte + 0.1f * ( flCost / (float)size );
+			}
+			return flCost;
+		}
+	}
+	return m_flReloadMsPerByte * (float)size;
 }
 
+void CDataCacheSection::NotePolicyAccess( DataCacheClientID_t clientId )
+{
+	if ( m_pPolicy )
+	{
+		AUTO_LOCK( m_mutex );
+		if ( m_pPolicy )
+		{
+			m_pPolicy->OnAccess( clientId );
+		}
+	}
+}
 
-void CDataCacheSectionFastFind::OnRemove( DataCacheClientID_t clientId ) 
+void CDataCacheSection::NotePolicyRemove( DataCacheClientID_t clientId, DataCacheNotificationType_t type )
 {
-	AUTO_LOCK( m_mutex );
-	UtlHashFastHandle_t hHash = m_Handles.Find( Hash4( &clientId ) );
-	Assert( hHash != m_Handles.InvalidHandle());
-	if( hHash != m_Handles.InvalidHandle() )
-		return m_Handles.Remove( hHash );
+	if ( m_pPolicy )
+	{
+		AUTO_LOCK( m_mutex );
+		if ( m_pPolicy )
+		{
+			m_pPolicy->OnRemove( clientId, ( type == DC_AGE_DISCARD || type == DC_FLUSH_DISCARD ) );
+		}
+	}
 }
 
 
 //-----------------------------------------------------------------------------
-// CDataCache
+// Purpose: Eviction policy selection
 //-----------------------------------------------------------------------------
+class CLockedItemFilter : public IEvictionFilter
+{
+public:
+	CLockedItemFilter( CDataCacheLRU &LRU ) : m_LRU( LRU ) {}
 
-//-----------------------------------------------------------------------------
-// Convar callback to change data cache 
-//-----------------------------------------------------------------------------
-void DataCacheSize_f( IConVar *pConVar, const char *pOldString, float flOldValue )
+	virtual bool CanEvict( DataCacheClientID_t clientId, uintp hItem )
+	{
+		return ( m_LRU.LockCount( (memhandle_t)hItem ) == 0 );
+	}
+
+private:
+	CDataCacheLRU &m_LRU;
+};
+
+unsigned CDataCacheSection::GetPolicyCapacity()
 {
-	ConVarRef var( pConVar );
-	int nOldValue = (int)flOldValue;
-	if ( var.GetInt() != nOldValue )
+	if ( m_limits.nMaxBytes != (unsigned)-1 )
 	{
-		g_DataCache.SetSize( var.GetInt() * 1024 * 1024 );
+		return m_limits.nMaxBytes;
 	}
+	return m_pSharedCache->m_LRU.TargetSize();
 }
-ConVar datacachesize( "datacachesize", "64", FCVAR_INTERNAL_USE, "Size in MB.", true, 32, true, 512, DataCacheSize_f );
 
-//-----------------------------------------------------------------------------
-// Connect, disconnect
-//-----------------------------------------------------------------------------
-bool CDataCache::Connect( CreateInterfaceFn factory )
+void CDataCacheSection::SetEvictionPolicy( DataCacheEvictionPolicy_t type )
 {
-	if ( !BaseClass::Connect( factory ) )
-		return false;
+	AUTO_LOCK( m_mutex );
 
-	g_DataCache.SetSize( datacachesize.GetInt() * 1024 * 1024 );
-	g_pDataCache = this;
+	delete m_pPolicy;
+	m_pPolicy = NULL;
 
-	return true;
+	if ( type == DC_EVICT_LRU )
+	{
+		return;
+	}
+
+	CDataCacheEvictionPolicy *pPolicy = CDataCacheEvictionPolicy::Create( type, GetPolicyCapacity() );
+
+	// Seed with the current contents, least recently used first
+	memhandle_t hCurrent = GetFirstLockedItem();
+	while ( hCurrent != INVALID_MEMHANDLE )
+	{
+		DataCacheItem_t *pItem = AccessItem( hCurrent );
+		pPolicy->OnInsert( pItem->clientId, (uintp)hCurrent, pItem->size, m_flReloadMsPerByte * pItem->size );
+		hCurrent = GetNextItem( hCurrent );
+	}
+
+	hCurrent = GetFirstUnlockedItem();
+	while ( hCurrent != INVALID_MEMHANDLE )
+	{
+		DataCacheItem_t *pItem = AccessItem( hCurrent );
+		pPolicy->OnInsert( pItem->clientId, (uintp)hCurrent, pItem->size, m_flReloadMsPerByte * pItem->size );
+		hCurrent = GetNextItem( hCurrent );
+	}
+
+	m_pPolicy = pPolicy;
 }
 
-void CDataCache::Disconnect()
+//-----------------------------------------------------------------------------
+// Purpose: Evict policy-selected victims. Must hold the mutex. Returns number of items freed
+//-----------------------------------------------------------------------------
+unsigned CDataCacheSection::PurgeByPolicy( unsigned nBytes, unsigned nItems, unsigned *pBytesPurged )
 {
-	g_pDataCache = NULL;
-	BaseClass::Disconnect();
+	VPROF( "CDataCacheSection::PurgeByPolicy" );
+
+	m_pPolicy->SetCapacity( GetPolicyCapacity() );
+
+	CLockedItemFilter filter( m_LRU );
+	unsigned nPurged = 0;
+	unsigned nBytesPurged = 0;
+	DataCacheClientID_t clientId;
+	uintp hItem;
+
+	while ( ( nBytes > 0 || nItems > 0 ) && m_pPolicy->SelectVictim( &filter, &clientId, &hItem ) )
+	{
+		DataCacheItem_t *pItem = AccessItem( (memhandle_t)hItem );
+		if ( !pItem || pItem->pSection != this )
+		{
+			// Left the cache without the policy hearing about it
+			m_pPolicy->OnRemove( clientId, false );
+			continue;
+		}
+
+		unsigned nBytesCurrent = pItem->size;
+		if ( !DiscardItem( (memhandle_t)hItem, DC_FLUSH_DISCARD ) )
+		{
+			break;
+		}
+
+		nBytesPurged += nBytesCurrent;
+		nBytes -= min( nBytesCurrent, nBytes );
+		if ( nItems )
+		{
+			nItems--;
+		}
+		nPurged++;
+	}
+
+	if ( pBytesPurged )
+	{
+		*pBytesPurged = nBytesPurged;
+	}
+	return nPurged;
 }
 
 
 //-----------------------------------------------------------------------------
-// Init, Shutdown
+// CDataCacheSectionFastFind
 //-----------------------------------------------------------------------------
-InitReturnVal_t CDataCache::Init( void )
+DataCacheHandle_t CDataCacheSectionFastFind::DoFind( DataCacheClientID_t clientId ) 
+{ 
+	AUTO_LOCK( m_mutex );
+	UtlHashFastHandle_t hHash = m_Handles.Find( Hash4( &clientId ) );
+	if( hHash != m_Handles.InvalidHandle() )
+		return m_Handles[hHash];
+	return DC_INVALID_HANDLE; 
+}
+
+
+void CDataCacheSectionFastFind::OnAdd( DataCacheClientID_t clientId, DataCacheHandle_t hCacheItem ) 
 {
-	return BaseClass::Init();
+	AUTO_LOCK( m_mutex );
+	Assert( m_Handles.Find( Hash4( &clientId ) ) == m_Handles.InvalidHandle());
+	m_Handles.FastInsert( Hash4( &clientId ), hCacheItem );
 }
 
-void CDataCache::Shutdown( void )
+
+void CDataCacheSectionFastFind::OnRemove( DataCacheClientID_t clientId ) 
 {
-	Flush( false, false );
-	BaseClass::Shutdown();
+	AUTO_LOCK( m_mutex );
+	UtlHashFastHandle_t hHash = m_Handles.Find( Hash4( &clientId ) );
+	Assert( hHash != m_Handles.InvalidHandle());
+	if( hHash != m_Handles.InvalidHandle() )
+		return m_Handles.Remove( hHash );
 }
 
 
 //-----------------------------------------------------------------------------
-// Query interface
+// CDataCacheShardLRU
 //-----------------------------------------------------------------------------
-void *CDataCache::QueryInterface( const char *pInterfaceName )
+DataCacheItem_t *CDataCacheShardLRU::DetachResource( memhandle_t hMem )
 {
-	// Loading the datacache DLL mounts *all* interfaces
-	// This includes the backward-compatible interfaces + IStudioDataCache
-	CreateInterfaceFn factory = Sys_GetFactoryThis();	// This silly construction is necessary
-	return factory( pInterfaceName, NULL );				// to prevent the LTCG compiler from crashing.
+	AUTO_LOCK_( CDataManagerBase, *this );
+	unsigned short index = FromHandle( hMem );
+	if ( !m_memoryLists.IsValidIndex( index ) )
+	{
+		return NULL;
+	}
+
+	if ( m_memoryLists[index].lockCount )
+	{
+		BreakLock( hMem );
+	}
+	m_memoryLists.Unlink( m_lruList, index );
+	return static_cast<DataCacheItem_t *>( GetForFreeByIndex( index ) );
 }
 
 
 //-----------------------------------------------------------------------------
-// 
+// CDataCacheSectionSharded
 //-----------------------------------------------------------------------------
-CDataCache::CDataCache()
-	: m_mutex( m_LRU.AccessMutex() )
+CDataCacheSectionSharded::CDataCacheSectionSharded( CDataCache *pSharedCache, IDataCacheClient *pClient, const char *pszName, int nShards, bool bSupportFastFind )
+  : CDataCacheSection( pSharedCache, pClient, pszName ),
+	m_nShards( clamp( nShards, 1, DC_MAX_SHARDS ) ),
+	m_bFastFind( bSupportFastFind ),
+	m_iNextPurgeShard( 0 ),
+	m_nSlotsAllocated( 0 )
 {
-	memset( &m_status, 0, sizeof(m_status) );
-	m_bInFlush = false;
+	memset( m_pShards, 0, sizeof(m_pShards) );
+	memset( m_pSlotChunks, 0, sizeof(m_pSlotChunks) );
+
+	// Each shard is a separate allocation so the shard locks don't share cache lines
+	for ( int i = 0; i < m_nShards; i++ )
+	{
+		m_pShards[i] = new Shard_t;
+		m_pShards[i]->m_Handles.Init( ( bSupportFastFind ) ? 256 : 1 );
+	}
 }
 
-//-----------------------------------------------------------------------------
-// Purpose: Controls cache size.
-//-----------------------------------------------------------------------------
-void CDataCache::SetSize( int nMaxBytes )
+CDataCacheSectionSharded::~CDataCacheSectionSharded()
 {
-	m_LRU.SetTargetSize( nMaxBytes );
-	m_LRU.FlushToTargetSize();
+	Flush( false, false );
 
-	nMaxBytes /= 1024 * 1024;
+	for ( int i = 0; i < m_nShards; i++ )
+	{
+		delete m_pShards[i];
+	}
 
-	if ( datacachesize.GetInt() != nMaxBytes )
+	for ( int i = 0; i < DC_SHARD_MAX_SLOT_CHUNKS; i++ )
 	{
-		datacachesize.SetValue( nMaxBytes );
+		delete [] m_pSlotChunks[i];
 	}
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Controls cache options.
+// Purpose: Acquire a shard lock, counting how often another thread held it
 //-----------------------------------------------------------------------------
-void CDataCache::SetOptions( unsigned options )
+void CDataCacheSectionSharded::LockShard( Shard_t &shard )
 {
-	for ( int i = 0; m_Sections.Count(); i++ )
+	++shard.m_nLockAcquires;
+	if ( !shard.m_LRU.TryLock() )
 	{
-		m_Sections[i]->SetOptions( options );
+		++shard.m_nLockContended;
+		shard.m_LRU.Lock();
 	}
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Controls cache section size.
+// Purpose: Handle slots live in chunks that are never moved or freed while the
+//			section exists, so a handle can be checked against its slot serial
+//			without taking any lock.
 //-----------------------------------------------------------------------------
-void CDataCache::SetSectionLimits( const char *pszSectionName, const DataCacheLimits_t &limits )
+int CDataCacheSectionSharded::AllocSlot()
 {
-	IDataCacheSection *pSection = FindSection( pszSectionName );
+	AUTO_LOCK( m_SlotMutex );
 
-	if ( !pSection )
+	if ( m_FreeSlots.Count() )
 	{
-		DevMsg( "Cannot find requested cache section \"%s\"", pszSectionName );
-		return;
+		int iSlot = m_FreeSlots.Tail();
+		m_FreeSlots.Remove( m_FreeSlots.Count() - 1 );
+		return iSlot;
 	}
 
-	pSection->SetLimits( limits );
-}
+	// slot + 1 must fit in the low 16 bits of the handle
+	if ( m_nSlotsAllocated >= DC_SHARD_SLOTS_PER_CHUNK * DC_SHARD_MAX_SLOT_CHUNKS - 1 )
+	{
+		return -1;
+	}
+
+	int iChunk = m_nSlotsAllocated / DC_SHARD_SLOTS_PER_CHUNK;
+	if ( !m_pSlotChunks[iChunk] )
+	{
+		HandleSlot_t *pChunk = new HandleSlot_t[DC_SHARD_SLOTS_PER_CHUNK];
+		for ( int i = 0; i < DC_SHARD_SLOTS_PER_CHUNK; i++ )
+		{
+			pChunk[i].pItem = NULL;
+			pChunk[i].pItemData = NULL;
+			pChunk[i].hLRU = INVALID_MEMHANDLE;
+			pChunk[i].serial = 1;
+			pChunk[i].iShard = 0;
+		}
+		ThreadMemoryBarrier();
+		m_pSlotChunks[iChunk] = pChunk;
+	}
+
+	return m_nSlotsAllocated++;
+}
+
+void CDataCacheSectionSharded::FreeSlot( int iSlot )
+{
+	AUTO_LOCK( m_SlotMutex );
+
+	HandleSlot_t *pSlot = AccessSlot( iSlot );
+	pSlot->serial++;
+	ThreadMemoryBarrier();
+	pSlot->pItem = NULL;
+	pSlot->pItemData = NULL;
+	pSlot->hLRU = INVALID_MEMHANDLE;
+	m_FreeSlots.AddToTail( iSlot );
+}
+
+CDataCacheSectionSharded::HandleSlot_t *CDataCacheSectionSharded::GetValidSlot( DataCacheHandle_t handle )
+{
+	int iSlot = SlotFromHandle( handle );
+	if ( handle == DC_INVALID_HANDLE || iSlot < 0 || iSlot >= m_nSlotsAllocated )
+	{
+		return NULL;
+	}
+
+	HandleSlot_t *pSlot = AccessSlot( iSlot );
+	if ( pSlot->serial != (unsigned short)( (uintp)handle >> 16 ) || !pSlot->pItem )
+	{
+		return NULL;
+	}
+	return pSlot;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Lock the shard that owns a handle. Returns NULL if the handle is stale.
+//-----------------------------------------------------------------------------
+CDataCacheSectionSharded::Shard_t *CDataCacheSectionSharded::LockHandleShard( DataCacheHandle_t handle, HandleSlot_t **ppSlot )
+{
+	HandleSlot_t *pSlot = GetValidSlot( handle );
+	if ( !pSlot )
+	{
+		return NULL;
+	}
+
+	Shard_t *pShard = m_pShards[pSlot->iShard];
+	LockShard( *pShard );
+
+	// The item may have been discarded while we waited
+	if ( GetValidSlot( handle ) != pSlot )
+	{
+		UnlockShard( *pShard );
+		return NULL;
+	}
+
+	*ppSlot = pSlot;
+	return pShard;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Add an item to the cache.  Purges old items if over budget, returns false if item was already in cache.
+//-----------------------------------------------------------------------------
+bool CDataCacheSectionSharded::AddEx( DataCacheClientID_t clientId, const void *pItemData, unsigned size, unsigned flags, DataCacheHandle_t *pHandle )
+{
+	VPROF( "CDataCacheSectionSharded::Add" );
+
+	if ( mem_force_flush.GetBool() )
+	{
+		m_pSharedCache->Flush();
+	}
+
+	if ( ( m_options & DC_VALIDATE ) && Find( clientId ) )
+	{
+		Error( "Duplicate add to data cache\n" );
+		return false;
+	}
+
+	EnsureCapacity( size );
+
+	int iSlot = AllocSlot();
+	if ( iSlot == -1 )
+	{
+		Warning( "Data cache section [%s] is out of handles\n", GetName() );
+		return false;
+	}
+
+	DataCacheItemData_t itemData = 
+	{
+		pItemData,
+		size,
+		clientId,
+		this
+	};
+
+	int iShard = GetShardIndex( clientId );
+	Shard_t &shard = *m_pShards[iShard];
+	HandleSlot_t *pSlot = AccessSlot( iSlot );
+	DataCacheHandle_t hItem = (DataCacheHandle_t)(uintp)( ( (unsigned)pSlot->serial << 16 ) | ( iSlot + 1 ) );
+
+	LockShard( shard );
+
+	memhandle_t hMem = shard.m_LRU.CreateResource( itemData, true );
+	DataCacheItem_t *pItem = shard.m_LRU.GetResource_NoLockNoLRUTouch( hMem );
+
+	// Items carry the section handle, so frame lock release goes through Unlock() below
+	pItem->hLRU = (memhandle_t)hItem;
+
+	pSlot->hLRU = hMem;
+	pSlot->pItemData = pItemData;
+	pSlot->iShard = iShard;
+	ThreadMemoryBarrier();
+	pSlot->pItem = pItem;
+
+	if ( m_bFastFind )
+	{
+		Assert( shard.m_Handles.Find( Hash4( &clientId ) ) == shard.m_Handles.InvalidHandle() );
+		shard.m_Handles.FastInsert( Hash4( &clientId ), hItem );
+	}
+
+	NoteAdd( size );
+
+	UnlockShard( shard );
+
+	if ( g_DataCacheTrace.IsActive() )
+	{
+		g_DataCacheTrace.Record( 'A', GetName(), clientId, size, ConsumeReloadCost( size ) );
+	}
+
+	if ( pHandle )
+	{
+		*pHandle = hItem;
+	}
+
+	g_iDontForceFlush++;
+
+	if ( flags & DCAF_LOCK )
+	{
+		Lock( hItem );
+	}
+	// Add implies a frame lock. A no-op if not in frame lock
+	FrameLock( hItem );
+
+	g_iDontForceFlush--;
+
+	shard.m_LRU.UnlockResource( hMem );
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Only the shard the client id hashes to needs to be searched
+//-----------------------------------------------------------------------------
+DataCacheHandle_t CDataCacheSectionSharded::DoFind( DataCacheClientID_t clientId )
+{
+	Shard_t &shard = *m_pShards[GetShardIndex( clientId )];
+	DataCacheHandle_t hResult = DC_INVALID_HANDLE;
+
+	LockShard( shard );
+
+	if ( m_bFastFind )
+	{
+		UtlHashFastHandle_t hHash = shard.m_Handles.Find( Hash4( &clientId ) );
+		if ( hHash != shard.m_Handles.InvalidHandle() )
+		{
+			hResult = shard.m_Handles[hHash];
+		}
+	}
+	else
+	{
+		for ( int iList = 0; iList < 2 && hResult == DC_INVALID_HANDLE; iList++ )
+		{
+			memhandle_t hCurrent = ( iList == 0 ) ? shard.m_LRU.GetFirstUnlocked() : shard.m_LRU.GetFirstLocked();
+			while ( hCurrent != INVALID_MEMHANDLE )
+			{
+				DataCacheItem_t *pItem = shard.m_LRU.GetResource_NoLockNoLRUTouch( hCurrent );
+				if ( pItem->clientId == clientId )
+				{
+					hResult = (DataCacheHandle_t)pItem->hLRU;
+					break;
+				}
+				hCurrent = shard.m_LRU.GetNext( hCurrent );
+			}
+		}
+	}
+
+	UnlockShard( shard );
+
+	return hResult;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Unlink an item from its shard and release its handle. Must hold the
+//			shard lock. The item is destroyed later by DestroyDetachedItem().
+//-----------------------------------------------------------------------------
+bool CDataCacheSectionSharded::DetachShardItem( Shard_t &shard, DataCacheItem_t *pItem, bool bForce )
+{
+	int iSlot = SlotFromHandle( (DataCacheHandle_t)pItem->hLRU );
+	HandleSlot_t *pSlot = AccessSlot( iSlot );
+
+	int nLockCount = shard.m_LRU.LockCount( pSlot->hLRU );
+	if ( nLockCount && !bForce )
+	{
+		return false;
+	}
+
+	if ( m_bFastFind )
+	{
+		UtlHashFastHandle_t hHash = shard.m_Handles.Find( Hash4( &pItem->clientId ) );
+		Assert( hHash != shard.m_Handles.InvalidHandle() );
+		if ( hHash != shard.m_Handles.InvalidHandle() )
+		{
+			shard.m_Handles.Remove( hHash );
+		}
+	}
+
+	shard.m_LRU.DetachResource( pSlot->hLRU );
+	if ( nLockCount )
+	{
+		NoteUnlock( pItem->size );
+	}
+
+	UnlinkFrameLock( pItem );
+	FreeSlot( iSlot );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Notify the client and free a detached item, outside of any shard lock
+//-----------------------------------------------------------------------------
+void CDataCacheSectionSharded::DestroyDetachedItem( DataCacheItem_t *pItem, DataCacheNotificationType_t type )
+{
+	DiscardItemData( pItem, type );
+	pItem->pSection = NULL; // inhibit callbacks from lower level resource system
+	delete pItem;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Get an item out of the cache and remove it. No callbacks are executed.
+//-----------------------------------------------------------------------------
+DataCacheRemoveResult_t CDataCacheSectionSharded::Remove( DataCacheHandle_t handle, const void **ppItemData, unsigned *pItemSize, bool bNotify )
+{
+	VPROF( "CDataCacheSectionSharded::Remove" );
+
+	HandleSlot_t *pSlot;
+	Shard_t *pShard = LockHandleShard( handle, &pSlot );
+	if ( !pShard )
+	{
+		return DC_NOT_FOUND;
+	}
+
+	DataCacheItem_t *pItem = pSlot->pItem;
+	if ( !DetachShardItem( *pShard, pItem, false ) )
+	{
+		UnlockShard( *pShard );
+		return DC_LOCKED;
+	}
+
+	if ( g_DataCacheTrace.IsActive() )
+	{
+		g_DataCacheTrace.Record( 'R', GetName(), pItem->clientId, pItem->size );
+	}
+
+	UnlockShard( *pShard );
+
+	if ( ppItemData )
+	{
+		*ppItemData = pItem->pItemData;
+	}
+
+	if ( pItemSize )
+	{
+		*pItemSize = pItem->size;
+	}
+
+	DestroyDetachedItem( pItem, ( bNotify ) ? DC_REMOVED : DC_NONE );
+
+	return DC_OK;
+}
+
+
+//-----------------------------------------------------------------------------
+// 
+//-----------------------------------------------------------------------------
+bool CDataCacheSectionSharded::IsPresent( DataCacheHandle_t handle )
+{
+	return ( GetValidSlot( handle ) != NULL );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Lock an item in the cache, returns NULL if item is not in the cache.
+//-----------------------------------------------------------------------------
+void *CDataCacheSectionSharded::Lock( DataCacheHandle_t handle )
+{
+	VPROF( "CDataCacheSectionSharded::Lock" );
+
+	if ( mem_force_flush.GetBool() && !g_iDontForceFlush)
+		Flush();
+
+	HandleSlot_t *pSlot;
+	Shard_t *pShard = LockHandleShard( handle, &pSlot );
+	if ( !pShard )
+	{
+		NoteMiss( handle );
+		return NULL;
+	}
+
+	void *pResult = NULL;
+	int nLockCount;
+	DataCacheItem_t *pItem = pShard->m_LRU.LockResourceReturnCount( &nLockCount, pSlot->hLRU );
+	if ( pItem )
+	{
+		if ( nLockCount == 1 )
+		{
+			NoteLock( pItem->size );
+		}
+		if ( g_DataCacheTrace.IsActive() )
+		{
+			g_DataCacheTrace.Record( 'L', GetName(), pItem->clientId, pItem->size );
+		}
+		pResult = const_cast<void *>( pItem->pItemData );
+	}
+
+	UnlockShard( *pShard );
+	return pResult;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Unlock a previous lock.
+//-----------------------------------------------------------------------------
+int CDataCacheSectionSharded::Unlock( DataCacheHandle_t handle )
+{
+	VPROF( "CDataCacheSectionSharded::Unlock" );
+
+	HandleSlot_t *pSlot;
+	Shard_t *pShard = LockHandleShard( handle, &pSlot );
+	if ( !pShard )
+	{
+		AssertMsg( handle == DC_INVALID_HANDLE, "Attempted to unlock nonexistent cache entry" );
+		return 0;
+	}
+
+	unsigned nBytesUnlocked = 0;
+	int iNewLockCount = pShard->m_LRU.UnlockResource( pSlot->hLRU );
+	if ( iNewLockCount == 0 )
+	{
+		nBytesUnlocked = pSlot->pItem->size;
+	}
+	if ( g_DataCacheTrace.IsActive() )
+	{
+		g_DataCacheTrace.Record( 'U', GetName(), pSlot->pItem->clientId, 0 );
+	}
+	UnlockShard( *pShard );
+
+	if ( nBytesUnlocked )
+	{
+		NoteUnlock( nBytesUnlocked );
+		EnsureCapacity( 0 );
+	}
+	return iNewLockCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Lock every shard, in index order
+//-----------------------------------------------------------------------------
+void CDataCacheSectionSharded::LockMutex()
+{
+	g_iDontForceFlush++;
+	for ( int i = 0; i < m_nShards; i++ )
+	{
+		LockShard( *m_pShards[i] );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Unlock every shard
+//-----------------------------------------------------------------------------
+void CDataCacheSectionSharded::UnlockMutex()
+{
+	for ( int i = m_nShards - 1; i >= 0; i-- )
+	{
+		UnlockShard( *m_pShards[i] );
+	}
+	g_iDontForceFlush--;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Get without locking
+//-----------------------------------------------------------------------------
+void *CDataCacheSectionSharded::Get( DataCacheHandle_t handle, bool bFrameLock )
+{
+	VPROF( "CDataCacheSectionSharded::Get" );
+
+	if ( mem_force_flush.GetBool() && !g_iDontForceFlush)
+		Flush();
+
+	if ( handle == DC_INVALID_HANDLE )
+	{
+		return NULL;
+	}
+
+	if ( bFrameLock && IsFrameLocking() )
+		return FrameLock( handle );
+
+	HandleSlot_t *pSlot;
+	Shard_t *pShard = LockHandleShard( handle, &pSlot );
+	if ( !pShard )
+	{
+		NoteMiss( handle );
+		return NULL;
+	}
+
+	void *pResult = NULL;
+	DataCacheItem_t *pItem = pShard->m_LRU.GetResource_NoLock( pSlot->hLRU );
+	if ( pItem )
+	{
+		if ( g_DataCacheTrace.IsActive() )
+		{
+			g_DataCacheTrace.Record( 'G', GetName(), pItem->clientId, pItem->size );
+		}
+		pResult = const_cast<void *>( pItem->pItemData );
+	}
+
+	UnlockShard( *pShard );
+	return pResult;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Get without locking or touching. Resolved entirely from the slot table.
+//-----------------------------------------------------------------------------
+void *CDataCacheSectionSharded::GetNoTouch( DataCacheHandle_t handle, bool bFrameLock )
+{
+	VPROF( "CDataCacheSectionSharded::GetNoTouch" );
+
+	if ( handle == DC_INVALID_HANDLE )
+	{
+		return NULL;
+	}
+
+	if ( bFrameLock && IsFrameLocking() )
+		return FrameLock( handle );
+
+	HandleSlot_t *pSlot = GetValidSlot( handle );
+	if ( !pSlot )
+	{
+		return NULL;
+	}
+
+	const void *pItemData = pSlot->pItemData;
+	ThreadMemoryBarrier();
+
+	// Reject the result if the slot was recycled while we read it
+	if ( GetValidSlot( handle ) != pSlot )
+	{
+		return NULL;
+	}
+	return const_cast<void *>( pItemData );
+}
+
+
+//-----------------------------------------------------------------------------
+// 
+//-----------------------------------------------------------------------------
+void *CDataCacheSectionSharded::FrameLock( DataCacheHandle_t handle )
+{
+	VPROF( "CDataCacheSectionSharded::FrameLock" );
+
+	if ( mem_force_flush.GetBool() && !g_iDontForceFlush)
+		Flush();
+
+	FrameLock_t *pFrameLock = m_ThreadFrameLock.Get();
+	if ( !pFrameLock )
+	{
+		return NULL;
+	}
+
+	HandleSlot_t *pSlot;
+	Shard_t *pShard = LockHandleShard( handle, &pSlot );
+	if ( !pShard )
+	{
+		return NULL;
+	}
+
+	DataCacheItem_t *pItem = pSlot->pItem;
+	int iThread = pFrameLock->m_iThread;
+	if ( pItem->pNextFrameLocked[iThread] == DC_NO_NEXT_LOCKED )
+	{
+		pItem->pNextFrameLocked[iThread] = pFrameLock->m_pFirst;
+		pFrameLock->m_pFirst = pItem;
+
+		int nLockCount;
+		pShard->m_LRU.LockResourceReturnCount( &nLockCount, pSlot->hLRU );
+		if ( nLockCount == 1 )
+		{
+			NoteLock( pItem->size );
+		}
+		if ( g_DataCacheTrace.IsActive() )
+		{
+			g_DataCacheTrace.Record( 'L', GetName(), pItem->clientId, pItem->size );
+		}
+	}
+
+	void *pResult = const_cast<void *>( pItem->pItemData );
+	UnlockShard( *pShard );
+	return pResult;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Lock management, not for the feint of heart
+//-----------------------------------------------------------------------------
+int CDataCacheSectionSharded::GetLockCount( DataCacheHandle_t handle )
+{
+	HandleSlot_t *pSlot;
+	Shard_t *pShard = LockHandleShard( handle, &pSlot );
+	if ( !pShard )
+	{
+		return 0;
+	}
+
+	int nLockCount = pShard->m_LRU.LockCount( pSlot->hLRU );
+	UnlockShard( *pShard );
+	return nLockCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// 
+//-----------------------------------------------------------------------------
+int CDataCacheSectionSharded::BreakLock( DataCacheHandle_t handle )
+{
+	HandleSlot_t *pSlot;
+	Shard_t *pShard = LockHandleShard( handle, &pSlot );
+	if ( !pShard )
+	{
+		return 0;
+	}
+
+	int nBroken = pShard->m_LRU.BreakLock( pSlot->hLRU );
+	if ( nBroken )
+	{
+		NoteUnlock( pSlot->pItem->size );
+	}
+	UnlockShard( *pShard );
+	return nBroken;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Explicitly mark an item as "recently used"
+//-----------------------------------------------------------------------------
+bool CDataCacheSectionSharded::Touch( DataCacheHandle_t handle )
+{
+	HandleSlot_t *pSlot;
+	Shard_t *pShard = LockHandleShard( handle, &pSlot );
+	if ( pShard )
+	{
+		pShard->m_LRU.TouchResource( pSlot->hLRU );
+		UnlockShard( *pShard );
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Explicitly mark an item as "least recently used". 
+//-----------------------------------------------------------------------------
+bool CDataCacheSectionSharded::Age( DataCacheHandle_t handle )
+{
+	HandleSlot_t *pSlot;
+	Shard_t *pShard = LockHandleShard( handle, &pSlot );
+	if ( pShard )
+	{
+		pShard->m_LRU.MarkAsStale( pSlot->hLRU );
+		UnlockShard( *pShard );
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Empty the cache. Returns bytes released, will remove locked items if force specified
+//-----------------------------------------------------------------------------
+unsigned CDataCacheSectionSharded::Flush( bool bUnlockedOnly, bool bNotify )
+{
+	VPROF( "CDataCacheSectionSharded::Flush" );
+
+	DataCacheNotificationType_t notificationType = ( bNotify )? DC_FLUSH_DISCARD : DC_NONE;
+
+	unsigned nBytesFlushed = 0;
+	CUtlVector<DataCacheItem_t *> detached;
+
+	for ( int iShard = 0; iShard < m_nShards; iShard++ )
+	{
+		Shard_t &shard = *m_pShards[iShard];
+
+		LockShard( shard );
+		for ( int iList = 0; iList < ( bUnlockedOnly ? 1 : 2 ); iList++ )
+		{
+			memhandle_t hCurrent = ( iList == 0 ) ? shard.m_LRU.GetFirstUnlocked() : shard.m_LRU.GetFirstLocked();
+			while ( hCurrent != INVALID_MEMHANDLE )
+			{
+				memhandle_t hNext = shard.m_LRU.GetNext( hCurrent );
+				DataCacheItem_t *pItem = shard.m_LRU.GetResource_NoLockNoLRUTouch( hCurrent );
+				if ( DetachShardItem( shard, pItem, true ) )
+				{
+					detached.AddToTail( pItem );
+				}
+				hCurrent = hNext;
+			}
+		}
+		UnlockShard( shard );
+
+		for ( int i = 0; i < detached.Count(); i++ )
+		{
+			nBytesFlushed += detached[i]->size;
+			DestroyDetachedItem( detached[i], notificationType );
+		}
+		detached.RemoveAll();
+	}
+
+	return nBytesFlushed;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Evict the oldest unlocked item of each shard in turn, which keeps
+//			eviction close to section-wide LRU order without a global lock.
+//			Returns the number of items freed.
+//-----------------------------------------------------------------------------
+unsigned CDataCacheSectionSharded::PurgeShards( unsigned nBytes, unsigned nItems, unsigned *pBytesPurged )
+{
+	unsigned nPurged = 0;
+	unsigned nBytesPurged = 0;
+	int nIdleShards = 0;
+
+	while ( ( nBytes > 0 || nItems > 0 ) && nIdleShards < m_nShards )
+	{
+		int iShard = m_iNextPurgeShard;
+		m_iNextPurgeShard = ( iShard + 1 ) % m_nShards;
+		Shard_t &shard = *m_pShards[iShard];
+
+		DataCacheItem_t *pItem = NULL;
+		LockShard( shard );
+		memhandle_t hCurrent = shard.m_LRU.GetFirstUnlocked();
+		if ( hCurrent != INVALID_MEMHANDLE )
+		{
+			pItem = shard.m_LRU.GetResource_NoLockNoLRUTouch( hCurrent );
+			if ( !DetachShardItem( shard, pItem, false ) )
+			{
+				pItem = NULL;
+			}
+		}
+		UnlockShard( shard );
+
+		if ( !pItem )
+		{
+			nIdleShards++;
+			continue;
+		}
+		nIdleShards = 0;
+
+		unsigned nBytesCurrent = pItem->size;
+		DestroyDetachedItem( pItem, DC_FLUSH_DISCARD );
+
+		nBytesPurged += nBytesCurrent;
+		nBytes -= min( nBytesCurrent, nBytes );
+		if ( nItems )
+		{
+			nItems--;
+		}
+		nPurged++;
+	}
+
+	if ( pBytesPurged )
+	{
+		*pBytesPurged = nBytesPurged;
+	}
+	return nPurged;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Dump the oldest items to free the specified amount of memory. Returns amount actually freed
+//-----------------------------------------------------------------------------
+unsigned CDataCacheSectionSharded::Purge( unsigned nBytes )
+{
+	VPROF( "CDataCacheSectionSharded::Purge" );
+
+	unsigned nBytesPurged = 0;
+	if ( nBytes )
+	{
+		PurgeShards( nBytes, 0, &nBytesPurged );
+	}
+	return nBytesPurged;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Dump the oldest items to free the specified number of items. Returns number actually freed
+//-----------------------------------------------------------------------------
+unsigned CDataCacheSectionSharded::PurgeItems( unsigned nItems )
+{
+	if ( !nItems )
+	{
+		return 0;
+	}
+	return PurgeShards( 0, nItems, NULL );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Shards always evict in LRU order, round-robin across shards
+//-----------------------------------------------------------------------------
+void CDataCacheSectionSharded::SetEvictionPolicy( DataCacheEvictionPolicy_t type )
+{
+	if ( type != DC_EVICT_LRU )
+	{
+		Warning( "Data cache section [%s] is sharded, eviction policy %s is not supported\n", GetName(), EvictionPolicyName( type ) );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Output the state of the section, including per-shard lock contention
+//-----------------------------------------------------------------------------
+void CDataCacheSectionSharded::OutputShardItem( DataCacheItem_t *pItem, int iShard, int nLockCount )
+{
+	char name[DC_MAX_ITEM_NAME+1];
+
+	name[0] = 0;
+	m_pClient->GetItemName( pItem->clientId, pItem->pItemData, name, DC_MAX_ITEM_NAME );
+
+	Msg( "\t%16.16s : %12s : 0x%08x, 0x%p, 0x%p : %s : shard %d %s\n", 
+		Q_pretifymem( pItem->size, 2, true ), 
+		GetName(), 
+		pItem->clientId, pItem->pItemData, pItem->hLRU,
+		( name[0] ) ? name : "unknown",
+		iShard,
+		( nLockCount ) ? CFmtStr( "Locked %d", nLockCount ).operator const char*() : "" );
+}
+
+static bool DataCacheItemSizeLessFunc( DataCacheItem_t * const &pLeft, DataCacheItem_t * const &pRight )
+{
+	return pLeft->size < pRight->size;
+}
+
+void CDataCacheSectionSharded::OutputReport( DataCacheReportType_t reportType )
+{
+	if ( reportType == DC_DETAIL_REPORT || reportType == DC_DETAIL_REPORT_LRU )
+	{
+		LockMutex();
+
+		CUtlRBTree< DataCacheItem_t *, int > sortedbysize( 0, 0, DataCacheItemSizeLessFunc );
+		for ( int iShard = 0; iShard < m_nShards; iShard++ )
+		{
+			CDataCacheShardLRU &lru = m_pShards[iShard]->m_LRU;
+			for ( int iList = 0; iList < 2; iList++ )
+			{
+				memhandle_t hCurrent = ( iList == 0 ) ? lru.GetFirstLocked() : lru.GetFirstUnlocked();
+				while ( hCurrent != INVALID_MEMHANDLE )
+				{
+					DataCacheItem_t *pItem = lru.GetResource_NoLockNoLRUTouch( hCurrent );
+					if ( reportType == DC_DETAIL_REPORT )
+					{
+						sortedbysize.Insert( pItem );
+					}
+					else
+					{
+						OutputShardItem( pItem, iShard, lru.LockCount( hCurrent ) );
+					}
+					hCurrent = lru.GetNext( hCurrent );
+				}
+			}
+		}
+
+		for ( int i = sortedbysize.FirstInorder(); i != sortedbysize.InvalidIndex(); i = sortedbysize.NextInorder( i ) )
+		{
+			DataCacheItem_t *pItem = sortedbysize[i];
+			int iSlot = SlotFromHandle( (DataCacheHandle_t)pItem->hLRU );
+			HandleSlot_t *pSlot = AccessSlot( iSlot );
+			OutputShardItem( pItem, pSlot->iShard, m_pShards[pSlot->iShard]->m_LRU.LockCount( pSlot->hLRU ) );
+		}
+
+		UnlockMutex();
+	}
+
+	int sectionSize = 1;
+	if ( m_limits.nMaxBytes == (unsigned int)-1 )
+	{
+		// section unrestricted, base on total size
+		sectionSize = m_pSharedCache->m_LRU.TargetSize();
+	}
+	else if ( m_limits.nMaxBytes )
+	{
+		sectionSize = m_limits.nMaxBytes;
+	}
+	float sectionPercent = 100.0f * (float)GetNumBytes() / (float)sectionSize;
+	Msg( "Section [%s]: %i resources total %s, %.2f %% of limit (%s)\n", GetName(), GetNumItems(), Q_pretifymem( GetNumBytes(), 2, true ), sectionPercent, Q_pretifymem( sectionSize, 2, true ) );
+
+	for ( int iShard = 0; iShard < m_nShards; iShard++ )
+	{
+		Shard_t &shard = *m_pShards[iShard];
+		int nAcquires = shard.m_nLockAcquires;
+		int nContended = shard.m_nLockContended;
+		float flContended = ( nAcquires ) ? 100.0f * (float)nContended / (float)nAcquires : 0.0f;
+		Msg( "\tshard %2d: %s, %d lock acquires, %d contended (%.2f %%)\n", iShard, Q_pretifymem( shard.m_LRU.UsedSize(), 2, true ), nAcquires, nContended, flContended );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Updates the size of a specific item
+// Input  : handle - 
+//			newSize - 
+//-----------------------------------------------------------------------------
+void CDataCacheSectionSharded::UpdateSize( DataCacheHandle_t handle, unsigned int nNewSize )
+{
+	HandleSlot_t *pSlot;
+	Shard_t *pShard = LockHandleShard( handle, &pSlot );
+	if ( !pShard )
+	{
+		// If it's gone from memory, size is already irrelevant
+		return;
+	}
+
+	// Hold a lock on the item so it survives while the shard lock is released
+	memhandle_t hMem = pSlot->hLRU;
+	DataCacheItem_t *pItem = pShard->m_LRU.LockResource( hMem );
+	UnlockShard( *pShard );
+
+	unsigned oldSize = pItem->size;
+
+	if ( oldSize != nNewSize )
+	{
+		// Update the size
+		pItem->size = nNewSize;
+
+		int bytesAdded = nNewSize - oldSize;
+		// If change would grow cache size, then purge items until we have room
+		if ( bytesAdded > 0 )
+		{
+			m_pSharedCache->EnsureCapacity( bytesAdded );
+		}
+
+		pShard->m_LRU.NotifySizeChanged( hMem, oldSize, nNewSize );
+		NoteSizeChanged( oldSize, nNewSize );
+	}
+
+	pShard->m_LRU.UnlockResource( hMem );
+}
+
+
+//-----------------------------------------------------------------------------
+// CDataCache
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Convar callback to change data cache 
+//-----------------------------------------------------------------------------
+void DataCacheSize_f( IConVar *pConVar, const char *pOldString, float flOldValue )
+{
+	ConVarRef var( pConVar );
+	int nOldValue = (int)flOldValue;
+	if ( var.GetInt() != nOldValue )
+	{
+		g_DataCache.SetSize( var.GetInt() * 1024 * 1024 );
+	}
+}
+ConVar datacachesize( "datacachesize", "64", FCVAR_INTERNAL_USE, "Size in MB.", true, 32, true, 512, DataCacheSize_f );
+
+//-----------------------------------------------------------------------------
+// Connect, disconnect
+//-----------------------------------------------------------------------------
+bool CDataCache::Connect( CreateInterfaceFn factory )
+{
+	if ( !BaseClass::Connect( factory ) )
+		return false;
+
+	g_DataCache.SetSize( datacachesize.GetInt() * 1024 * 1024 );
+	g_pDataCache = this;
+
+	return true;
+}
+
+void CDataCache::Disconnect()
+{
+	g_pDataCache = NULL;
+	BaseClass::Disconnect();
+}
+
+
+//-----------------------------------------------------------------------------
+// Init, Shutdown
+//-----------------------------------------------------------------------------
+InitReturnVal_t CDataCache::Init( void )
+{
+	return BaseClass::Init();
+}
+
+void CDataCache::Shutdown( void )
+{
+	Flush( false, false );
+	BaseClass::Shutdown();
+}
+
+
+//-----------------------------------------------------------------------------
+// Query interface
+//-----------------------------------------------------------------------------
+void *CDataCache::QueryInterface( const char *pInterfaceName )
+{
+	// Loading the datacache DLL mounts *all* interfaces
+	// This includes the backward-compatible interfaces + IStudioDataCache
+	CreateInterfaceFn factory = Sys_GetFactoryThis();	// This silly construction is necessary
+	return factory( pInterfaceName, NULL );				// to prevent the LTCG compiler from crashing.
+}
+
+
+//-----------------------------------------------------------------------------
+// 
+//-----------------------------------------------------------------------------
+CDataCache::CDataCache()
+	: m_mutex( m_LRU.AccessMutex() )
+{
+	memset( &m_status, 0, sizeof(m_status) );
+	m_bInFlush = false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Controls cache size.
+//-----------------------------------------------------------------------------
+void CDataCache::SetSize( int nMaxBytes )
+{
+	m_LRU.SetTargetSize( nMaxBytes );
+	EnsureCapacity( 0 );
+
+	nMaxBytes /= 1024 * 1024;
+
+	if ( datacachesize.GetInt() != nMaxBytes )
+	{
+		datacachesize.SetValue( nMaxBytes );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Controls cache options.
+//-----------------------------------------------------------------------------
+void CDataCache::SetOptions( unsigned options )
+{
+	for ( int i = 0; m_Sections.Count(); i++ )
+	{
+		m_Sections[i]->SetOptions( options );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Controls cache section size.
+//-----------------------------------------------------------------------------
+void CDataCache::SetSectionLimits( const char *pszSectionName, const DataCacheLimits_t &limits )
+{
+	IDataCacheSection *pSection = FindSection( pszSectionName );
+
+	if ( !pSection )
+	{
+		DevMsg( "Cannot find requested cache section \"%s\"", pszSectionName );
+		return;
+	}
+
+	pSection->SetLimits( limits );
+}
 
 
 //-----------------------------------------------------------------------------
@@ -1110,13 +2335,32 @@ IDataCacheSection *CDataCache::AddSection( IDataCacheClient *pClient, const char
 		return pSection;
 	}
 
-	if ( !bSupportFastFind )
+	static int s_nShards = -1;
+	if ( s_nShards == -1 )
+	{
+		s_nShards = clamp( CommandLine()->ParmValue( "-datacacheshards", 1 ), 1, DC_MAX_SHARDS );
+	}
+
+	if ( s_nShards > 1 )
+		pSection = new CDataCacheSectionSharded( this, pClient, pszSectionName, s_nShards, bSupportFastFind );
+	else if ( !bSupportFastFind )
 		pSection = new CDataCacheSection( this, pClient, pszSectionName );
 	else
 		pSection = new CDataCacheSectionFastFind( this, pClient, pszSectionName );
 		
 	pSection->SetLimits( limits );
 
+	DataCacheEvictionPolicy_t policy;
+	const char *pszPolicy = CommandLine()->ParmValue( "-datacachepolicy", "lru" );
+	if ( !EvictionPolicyFromName( pszPolicy, &policy ) )
+	{
+		Warning( "Unknown data cache eviction policy \"%s\"\n", pszPolicy );
+	}
+	else if ( policy != DC_EVICT_LRU && !pSection->IsSharded() )
+	{
+		pSection->SetEvictionPolicy( policy );
+	}
+
 	m_Sections.AddToTail( pSection );
 	return pSection;	
 }
@@ -1164,10 +2408,67 @@ void CDataCache::EnsureCapacity( unsigned nBytes )
 {
 	VPROF( "CDataCache::EnsureCapacity" );
 
+	// Sharded sections keep their items out of the shared LRU, and policy driven
+	// sections choose their own victims, so the overall budget is enforced here
+	// before falling back to shared LRU order
+	unsigned nShardedBytes = 0;
+	bool bManaged = false;
+	for ( int i = 0; i < m_Sections.Count(); i++ )
+	{
+		if ( m_Sections[i]->IsSharded() )
+		{
+			nShardedBytes += m_Sections[i]->GetNumBytes();
+		}
+		bManaged = bManaged || m_Sections[i]->ManagesEviction();
+	}
+
+	if ( bManaged )
+	{
+		unsigned nNeeded = m_LRU.UsedSize() + nShardedBytes + nBytes;
+		if ( nNeeded > m_LRU.TargetSize() )
+		{
+			PurgeManagedSections( nNeeded - m_LRU.TargetSize() );
+		}
+	}
+
 	m_LRU.EnsureCapacity( nBytes );
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Purge sections that manage their own eviction, each in proportion
+//			to its share of the cache. Returns amount actually freed
+//-----------------------------------------------------------------------------
+unsigned CDataCache::PurgeManagedSections( unsigned nBytes )
+{
+	uint64 nTotalBytes = m_LRU.UsedSize();
+	for ( int i = 0; i < m_Sections.Count(); i++ )
+	{
+		if ( m_Sections[i]->IsSharded() )
+		{
+			nTotalBytes += m_Sections[i]->GetNumBytes();
+		}
+	}
+
+	if ( !nTotalBytes || !nBytes )
+	{
+		return 0;
+	}
+
+	unsigned nBytesPurged = 0;
+	for ( int i = 0; i < m_Sections.Count(); i++ )
+	{
+		CDataCacheSection *pSection = m_Sections[i];
+		if ( pSection->ManagesEviction() && pSection->GetNumBytes() )
+		{
+			uint64 nShare = ( (uint64)nBytes * pSection->GetNumBytes() + nTotalBytes - 1 ) / nTotalBytes;
+			nBytesPurged += pSection->Purge( (unsigned)MIN( nShare, (uint64)nBytes ) );
+		}
+	}
+	return nBytesPurged;
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Dump the oldest items to free the specified amount of memory. Returns amount actually freed
 //-----------------------------------------------------------------------------
@@ -1175,7 +2476,12 @@ unsigned CDataCache::Purge( unsigned nBytes )
 {
 	VPROF( "CDataCache::Purge" );
 
-	return m_LRU.Purge( nBytes );
+	unsigned nBytesPurged = PurgeManagedSections( nBytes );
+	if ( nBytesPurged < nBytes )
+	{
+		nBytesPurged += m_LRU.Purge( nBytes - nBytesPurged );
+	}
+	return nBytesPurged;
 }
 
 
@@ -1204,6 +2510,14 @@ unsigned CDataCache::Flush( bool bUnlockedOnly, bool bNotify )
 		result = m_LRU.FlushAll();
 	}
 
+	for ( int i = 0; i < m_Sections.Count(); i++ )
+	{
+		if ( m_Sections[i]->IsSharded() )
+		{
+			result += m_Sections[i]->Flush( bUnlockedOnly, true );
+		}
+	}
+
 	m_bInFlush = false;
 
 	return result;
@@ -1236,6 +2550,12 @@ void CDataCache::OutputReport( DataCacheReportType_t reportType, const char *psz
 			Msg( "Unknown cache section %s\n", pszSection );
 			return;
 		}
+
+		if ( pSection->IsSharded() )
+		{
+			pSection->OutputReport( reportType );
+			return;
+		}
 	}
 
 	if ( reportType == DC_DETAIL_REPORT )
@@ -1279,14 +2599,22 @@ void CDataCache::OutputReport( DataCacheReportType_t reportType, const char *psz
 		if ( !pszSection )
 		{
 			// summary for all of the sections
+			int nItems = lockedlist.Count() + lruList.Count();
 			for ( int i = 0; i < m_Sections.Count(); ++i )
 			{
 				if ( m_Sections[i]->GetName() )
 				{
 					OutputReport( DC_SUMMARY_REPORT, m_Sections[i]->GetName() );
 				}
+
+				if ( m_Sections[i]->IsSharded() )
+				{
+					nItems += m_Sections[i]->GetNumItems();
+					bytesUsed += m_Sections[i]->GetNumBytes();
+				}
 			}
-			Msg( "Summary: %i resources total %s, %.2f %% of capacity\n", lockedlist.Count() + lruList.Count(), Q_pretifymem( bytesUsed, 2, true ), percent );
+			percent = 100.0f * (float)bytesUsed / (float)bytesTotal;
+			Msg( "Summary: %i resources total %s, %.2f %% of capacity\n", nItems, Q_pretifymem( bytesUsed, 2, true ), percent );
 		}
 		else
 		{
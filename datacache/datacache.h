@@ -17,6 +17,7 @@
 #include "tier0/tslist.h"
 #include "datacache_common.h"
 #include "tier3/tier3.h"
+#include "datacachepolicy.h"
 
 
 //-----------------------------------------------------------------------------
@@ -146,7 +147,7 @@ public:
 
 	virtual unsigned Flush( bool bUnlockedOnly = true, bool bNotify = true );
 	virtual unsigned Purge( unsigned nBytes );
-	unsigned PurgeItems( unsigned nItems );
+	virtual unsigned PurgeItems( unsigned nItems );
 
 	//--------------------------------------------------------
 
@@ -154,7 +155,16 @@ public:
 
 	virtual void UpdateSize( DataCacheHandle_t handle, unsigned int nNewSize );
 
-private:
+	//--------------------------------------------------------
+
+	virtual bool IsSharded()		{ return false; }
+
+	// Non-LRU sections pick their own victims when the shared cache is over budget
+	virtual bool ManagesEviction()	{ return m_pPolicy != NULL; }
+	virtual void SetEvictionPolicy( DataCacheEvictionPolicy_t type );
+	DataCacheEvictionPolicy_t GetEvictionPolicy()	{ return ( m_pPolicy ) ? m_pPolicy->GetType() : DC_EVICT_LRU; }
+
+protected:
 	friend void DataCacheItem_t::DestroyResource();
 
 	virtual void OnAdd( DataCacheClientID_t clientId, DataCacheHandle_t hCacheItem ) {}
@@ -172,6 +182,14 @@ private:
 	void NoteLock( int size );
 	void NoteUnlock( int size );
 	void NoteSizeChanged( int oldSize, int newSize );
+	void UnlinkFrameLock( DataCacheItem_t *pItem );
+
+	void NoteMiss( DataCacheHandle_t handle );
+	float ConsumeReloadCost( unsigned size );
+	void NotePolicyAccess( DataCacheClientID_t clientId );
+	void NotePolicyRemove( DataCacheClientID_t clientId, DataCacheNotificationType_t type );
+	unsigned GetPolicyCapacity();
+	unsigned PurgeByPolicy( unsigned nBytes, unsigned nItems, unsigned *pBytesPurged );
 
 	struct FrameLock_t
 	{
@@ -192,11 +210,29 @@ private:
 	char				szName[DC_MAX_CLIENT_NAME + 1];
 	CTSSimpleList<FrameLock_t> m_FreeFrameLocks;
 
+	CDataCacheEvictionPolicy *m_pPolicy;
+	CTHREADLOCALINT		m_nThreadMissTime;
+	float				m_flReloadMsPerByte;
+
 protected:
 	CThreadFastMutex &	m_mutex;
 };
 
 
+//-----------------------------------------------------------------------------
+// CDataCacheShardLRU
+//
+// Purpose: LRU owned by one shard of a sharded section. Adds the ability to
+//			unlink an item without destroying it, so client notifications can
+//			be issued after the shard lock has been released.
+//-----------------------------------------------------------------------------
+class CDataCacheShardLRU : public CDataCacheLRU
+{
+public:
+	DataCacheItem_t *DetachResource( memhandle_t hMem );
+};
+
+
 //-----------------------------------------------------------------------------
 // CDataCacheSectionFastFind
 //
@@ -221,6 +257,104 @@ private:
 };
 
 
+//-----------------------------------------------------------------------------
+// CDataCacheSectionSharded
+//
+// Purpose: A section variant that stripes its items across several private
+//			LRUs, each with its own lock, so that threads working on different
+//			items do not serialize on the shared cache mutex. Handles index an
+//			append-only slot table so they can be validated without a lock.
+//			Enabled for all sections with -datacacheshards <n>.
+//-----------------------------------------------------------------------------
+#define DC_MAX_SHARDS				16
+#define DC_SHARD_SLOTS_PER_CHUNK	1024
+#define DC_SHARD_MAX_SLOT_CHUNKS	64
+
+class CDataCacheSectionSharded : public CDataCacheSection
+{
+public:
+	CDataCacheSectionSharded( CDataCache *pSharedCache, IDataCacheClient *pClient, const char *pszName, int nShards, bool bSupportFastFind );
+	~CDataCacheSectionSharded();
+
+	virtual bool AddEx( DataCacheClientID_t clientId, const void *pItemData, unsigned size, unsigned flags, DataCacheHandle_t *pHandle );
+	virtual DataCacheRemoveResult_t Remove( DataCacheHandle_t handle, const void **ppItemData = NULL, unsigned *pItemSize = NULL, bool bNotify = false );
+	virtual bool IsPresent( DataCacheHandle_t handle );
+
+	virtual void *Lock( DataCacheHandle_t handle );
+	virtual int Unlock( DataCacheHandle_t handle );
+	virtual void *Get( DataCacheHandle_t handle, bool bFrameLock = false );
+	virtual void *GetNoTouch( DataCacheHandle_t handle, bool bFrameLock = false );
+	virtual void LockMutex();
+	virtual void UnlockMutex();
+
+	virtual void *FrameLock( DataCacheHandle_t handle );
+
+	virtual int GetLockCount( DataCacheHandle_t handle );
+	virtual int BreakLock( DataCacheHandle_t handle );
+
+	virtual bool Touch( DataCacheHandle_t handle );
+	virtual bool Age( DataCacheHandle_t handle );
+
+	virtual unsigned Flush( bool bUnlockedOnly = true, bool bNotify = true );
+	virtual unsigned Purge( unsigned nBytes );
+	virtual unsigned PurgeItems( unsigned nItems );
+
+	virtual void OutputReport( DataCacheReportType_t reportType = DC_SUMMARY_REPORT );
+
+	virtual void UpdateSize( DataCacheHandle_t handle, unsigned int nNewSize );
+
+	virtual bool IsSharded()		{ return true; }
+	virtual bool ManagesEviction()	{ return true; }
+	virtual void SetEvictionPolicy( DataCacheEvictionPolicy_t type );
+
+private:
+	virtual DataCacheHandle_t DoFind( DataCacheClientID_t clientId );
+
+	struct HandleSlot_t
+	{
+		DataCacheItem_t *	pItem;
+		const void *		pItemData;
+		memhandle_t			hLRU;
+		unsigned short		serial;
+		unsigned short		iShard;
+	};
+
+	struct Shard_t
+	{
+		CDataCacheShardLRU	m_LRU;
+		CUtlHashFast<DataCacheHandle_t> m_Handles;
+		CInterlockedInt		m_nLockAcquires;
+		CInterlockedInt		m_nLockContended;
+	};
+
+	int GetShardIndex( DataCacheClientID_t clientId )		{ return (int)( Hash4( &clientId ) % (unsigned)m_nShards ); }
+	void LockShard( Shard_t &shard );
+	void UnlockShard( Shard_t &shard )						{ shard.m_LRU.Unlock(); }
+
+	static int SlotFromHandle( DataCacheHandle_t handle )	{ return (int)( (uintp)handle & 0xffff ) - 1; }
+	HandleSlot_t *AccessSlot( int iSlot )					{ return &m_pSlotChunks[iSlot / DC_SHARD_SLOTS_PER_CHUNK][iSlot % DC_SHARD_SLOTS_PER_CHUNK]; }
+	HandleSlot_t *GetValidSlot( DataCacheHandle_t handle );
+	Shard_t *LockHandleShard( DataCacheHandle_t handle, HandleSlot_t **ppSlot );
+	int AllocSlot();
+	void FreeSlot( int iSlot );
+
+	unsigned PurgeShards( unsigned nBytes, unsigned nItems, unsigned *pBytesPurged );
+	bool DetachShardItem( Shard_t &shard, DataCacheItem_t *pItem, bool bForce );
+	void DestroyDetachedItem( DataCacheItem_t *pItem, DataCacheNotificationType_t type );
+	void OutputShardItem( DataCacheItem_t *pItem, int iShard, int nLockCount );
+
+	Shard_t *			m_pShards[DC_MAX_SHARDS];
+	int					m_nShards;
+	bool				m_bFastFind;
+	int					m_iNextPurgeShard;
+
+	HandleSlot_t *		m_pSlotChunks[DC_SHARD_MAX_SLOT_CHUNKS];
+	int					m_nSlotsAllocated;
+	CUtlVector<int>		m_FreeSlots;
+	CThreadFastMutex	m_SlotMutex;
+};
+
+
 //-----------------------------------------------------------------------------
 // CDataCache
 //
@@ -262,6 +396,7 @@ public:
 
 	void EnsureCapacity( unsigned nBytes );
 	virtual unsigned Purge( unsigned nBytes );
+	unsigned PurgeManagedSections( unsigned nBytes );
 	virtual unsigned Flush( bool bUnlockedOnly = true, bool bNotify = true );
 
 	//--------------------------------------------------------
@@ -283,6 +418,7 @@ private:
 	//-----------------------------------------------------
 
 	friend class CDataCacheSection;
+	friend class CDataCacheSectionSharded;
 
 	//-----------------------------------------------------
 
@@ -327,22 +463,22 @@ inline DataCacheItem_t *CDataCacheSection::AccessItem( memhandle_t hCurrent )
 	return m_pSharedCache->AccessItem( hCurrent ); 
 }
 
-// Note: if status updates are moved out of a mutexed section, will need to change these to use interlocked instructions
+// Note: sharded sections update status outside of any section-wide mutex, so these are interlocked
 
 inline void CDataCacheSection::NoteSizeChanged( int oldSize, int newSize )
 {
 	int nBytes = ( newSize - oldSize );
 
-	m_status.nBytes += nBytes;
-	m_status.nBytesLocked += nBytes;
+	ThreadInterlockedExchangeAdd( &m_status.nBytes, nBytes );
+	ThreadInterlockedExchangeAdd( &m_status.nBytesLocked, nBytes );
 	ThreadInterlockedExchangeAdd( &m_pSharedCache->m_status.nBytes, nBytes );
 	ThreadInterlockedExchangeAdd( &m_pSharedCache->m_status.nBytesLocked, nBytes );
 }
 
 inline void CDataCacheSection::NoteAdd( int size )
 {
-	m_status.nBytes += size;
-	m_status.nItems++;
+	ThreadInterlockedExchangeAdd( &m_status.nBytes, size );
+	ThreadInterlockedIncrement( &m_status.nItems );
 
 	ThreadInterlockedExchangeAdd( &m_pSharedCache->m_status.nBytes, size );
 	ThreadInterlockedIncrement( &m_pSharedCache->m_status.nItems );
@@ -350,8 +486,8 @@ inline void CDataCacheSection::NoteAdd( int size )
 
 inline void CDataCacheSection::NoteRemove( int size )
 {
-	m_status.nBytes -= size;
-	m_status.nItems--;
+	ThreadInterlockedExchangeAdd( &m_status.nBytes, -size );
+	ThreadInterlockedDecrement( &m_status.nItems );
 
 	ThreadInterlockedExchangeAdd( &m_pSharedCache->m_status.nBytes, -size );
 	ThreadInterlockedDecrement( &m_pSharedCache->m_status.nItems );
@@ -359,8 +495,8 @@ inline void CDataCacheSection::NoteRemove( int size )
 
 inline void CDataCacheSection::NoteLock( int size )
 {
-	m_status.nBytesLocked += size;
-	m_status.nItemsLocked++;
+	ThreadInterlockedExchangeAdd( &m_status.nBytesLocked, size );
+	ThreadInterlockedIncrement( &m_status.nItemsLocked );
 
 	ThreadInterlockedExchangeAdd( &m_pSharedCache->m_status.nBytesLocked, size );
 	ThreadInterlockedIncrement( &m_pSharedCache->m_status.nItemsLocked );
@@ -368,8 +504,8 @@ inline void CDataCacheSection::NoteLock( int size )
 
 inline void CDataCacheSection::NoteUnlock( int size )
 {
-	m_status.nBytesLocked -= size;
-	m_status.nItemsLocked--;
+	ThreadInterlockedExchangeAdd( &m_status.nBytesLocked, -size );
+	ThreadInterlockedDecrement( &m_status.nItemsLocked );
 
 	ThreadInterlockedExchangeAdd( &m_pSharedCache->m_status.nBytesLocked, -size );
 	ThreadInterlockedDecrement( &m_pSharedCache->m_status.nItemsLocked );
@@ -0,0 +1,709 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Selectable eviction policies for data cache sections, and the
+//			Lock/Unlock trace recorder and replay used to compare them.
+//
+//===========================================================================//
+
+#include "datacachepolicy.h"
+#include "datacache.h"
+#include "convar.h"
+#include "filesystem.h"
+#include "tier2/tier2.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// Lists are scanned no further than this looking for an unlocked victim
+#define DC_EVICT_MAX_SCAN 1024
+
+
+//-----------------------------------------------------------------------------
+// Policy names
+//-----------------------------------------------------------------------------
+static const char *s_pszPolicyNames[DC_EVICT_POLICY_COUNT] =
+{
+	"lru",
+	"2q",
+	"arc",
+};
+
+const char *EvictionPolicyName( DataCacheEvictionPolicy_t type )
+{
+	if ( type < 0 || type >= DC_EVICT_POLICY_COUNT )
+		return "unknown";
+	return s_pszPolicyNames[type];
+}
+
+bool EvictionPolicyFromName( const char *pszName, DataCacheEvictionPolicy_t *pType )
+{
+	for ( int i = 0; i < DC_EVICT_POLICY_COUNT; i++ )
+	{
+		if ( !Q_stricmp( pszName, s_pszPolicyNames[i] ) )
+		{
+			*pType = (DataCacheEvictionPolicy_t)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+//-----------------------------------------------------------------------------
+// CDataCacheEvictionPolicy
+//-----------------------------------------------------------------------------
+CDataCacheEvictionPolicy::CDataCacheEvictionPolicy( unsigned nCapacity )
+  : m_Index( DefLessFunc( DataCacheClientID_t ) )
+{
+	SetCapacity( nCapacity );
+	for ( int i = 0; i < LIST_COUNT; i++ )
+	{
+		m_Lists[i] = m_Entries.CreateList();
+		m_nListBytes[i] = 0;
+	}
+}
+
+unsigned CDataCacheEvictionPolicy::GetResidentBytes()
+{
+	return m_nListBytes[LIST_RESIDENT_0] + m_nListBytes[LIST_RESIDENT_1];
+}
+
+int CDataCacheEvictionPolicy::Find( DataCacheClientID_t clientId )
+{
+	int iIndex = m_Index.Find( clientId );
+	if ( iIndex == m_Index.InvalidIndex() )
+		return m_Entries.InvalidIndex();
+	return m_Index[iIndex];
+}
+
+int CDataCacheEvictionPolicy::Link( DataCacheClientID_t clientId, uintp hItem, unsigned size, float flCost, int iList )
+{
+	int i = m_Entries.Alloc();
+	Entry_t &entry = m_Entries[i];
+	entry.clientId = clientId;
+	entry.hItem = hItem;
+	entry.size = size;
+	entry.flCost = flCost;
+	entry.iList = iList;
+
+	m_Entries.LinkToTail( m_Lists[iList], i );
+	m_nListBytes[iList] += size;
+	m_Index.Insert( clientId, i );
+	return i;
+}
+
+void CDataCacheEvictionPolicy::Move( int i, int iList )
+{
+	Entry_t &entry = m_Entries[i];
+	m_Entries.Unlink( m_Lists[entry.iList], i );
+	m_nListBytes[entry.iList] -= entry.size;
+
+	entry.iList = iList;
+	m_Entries.LinkToTail( m_Lists[iList], i );
+	m_nListBytes[iList] += entry.size;
+}
+
+void CDataCacheEvictionPolicy::Free( int i )
+{
+	Entry_t &entry = m_Entries[i];
+	m_Entries.Unlink( m_Lists[entry.iList], i );
+	m_nListBytes[entry.iList] -= entry.size;
+	m_Index.Remove( entry.clientId );
+	m_Entries.Free( i );
+}
+
+void CDataCacheEvictionPolicy::TrimGhosts( int iList, unsigned nMaxBytes )
+{
+	while ( m_nListBytes[iList] > nMaxBytes )
+	{
+		int i = m_Entries.Head( m_Lists[iList] );
+		if ( i == m_Entries.InvalidIndex() )
+			break;
+		Free( i );
+	}
+}
+
+void CDataCacheEvictionPolicy::OnResize( DataCacheClientID_t clientId, unsigned size )
+{
+	int i = Find( clientId );
+	if ( i != m_Entries.InvalidIndex() )
+	{
+		Entry_t &entry = m_Entries[i];
+		m_nListBytes[entry.iList] += size - entry.size;
+		entry.size = size;
+	}
+}
+
+bool CDataCacheEvictionPolicy::IsResident( DataCacheClientID_t clientId )
+{
+	int i = Find( clientId );
+	return ( i != m_Entries.InvalidIndex() && IsResidentList( m_Entries[i].iList ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Of the first few evictable items at the cold end of a list, pick the
+//			one that is cheapest to reload per byte it frees. Older items win ties.
+//-----------------------------------------------------------------------------
+int CDataCacheEvictionPolicy::SelectFromList( int iList, IEvictionFilter *pFilter )
+{
+	int iBest = m_Entries.InvalidIndex();
+	float flBestScore = 0;
+	int nCandidates = 0;
+	int nScanned = 0;
+
+	for ( int i = m_Entries.Head( m_Lists[iList] );
+		  i != m_Entries.InvalidIndex() && nCandidates < DC_EVICT_COST_CANDIDATES && nScanned < DC_EVICT_MAX_SCAN;
+		  i = m_Entries.Next( i ), nScanned++ )
+	{
+		Entry_t &entry = m_Entries[i];
+		if ( pFilter && !pFilter->CanEvict( entry.clientId, entry.hItem ) )
+			continue;
+
+		nCandidates++;
+		float flScore = entry.flCost / (float)MAX( entry.size, 1 );
+		if ( iBest == m_Entries.InvalidIndex() || flScore < flBestScore )
+		{
+			iBest = i;
+			flBestScore = flScore;
+		}
+	}
+	return iBest;
+}
+
+
+//-----------------------------------------------------------------------------
+// LRU: a single recency list. Used as the baseline in replays.
+//-----------------------------------------------------------------------------
+class CDataCacheEvictionLRU : public CDataCacheEvictionPolicy
+{
+public:
+	CDataCacheEvictionLRU( unsigned nCapacity ) : CDataCacheEvictionPolicy( nCapacity ) {}
+
+	virtual DataCacheEvictionPolicy_t GetType()	{ return DC_EVICT_LRU; }
+
+	virtual void OnInsert( DataCacheClientID_t clientId, uintp hItem, unsigned size, float flCost )
+	{
+		int i = Find( clientId );
+		if ( i != m_Entries.InvalidIndex() )
+		{
+			Free( i );
+		}
+		Link( clientId, hItem, size, flCost, LIST_RESIDENT_0 );
+	}
+
+	virtual void OnAccess( DataCacheClientID_t clientId )
+	{
+		int i = Find( clientId );
+		if ( i != m_Entries.InvalidIndex() )
+		{
+			Move( i, LIST_RESIDENT_0 );
+		}
+	}
+
+	virtual void OnRemove( DataCacheClientID_t clientId, bool bEvicted )
+	{
+		int i = Find( clientId );
+		if ( i != m_Entries.InvalidIndex() )
+		{
+			Free( i );
+		}
+	}
+
+	virtual bool SelectVictim( IEvictionFilter *pFilter, DataCacheClientID_t *pClientId, uintp *phItem )
+	{
+		int i = SelectFromList( LIST_RESIDENT_0, pFilter );
+		if ( i == m_Entries.InvalidIndex() )
+			return false;
+		*pClientId = m_Entries[i].clientId;
+		*phItem = m_Entries[i].hItem;
+		return true;
+	}
+};
+
+
+//-----------------------------------------------------------------------------
+// 2Q: new items wait in a FIFO (A1in). Only items that come back after being
+// evicted from it (found in the A1out ghost list) are promoted to the main LRU
+// (Am), so one-off scans like a level transition can't flush the working set.
+//-----------------------------------------------------------------------------
+class CDataCacheEviction2Q : public CDataCacheEvictionPolicy
+{
+public:
+	CDataCacheEviction2Q( unsigned nCapacity ) : CDataCacheEvictionPolicy( nCapacity ) {}
+
+	virtual DataCacheEvictionPolicy_t GetType()	{ return DC_EVICT_2Q; }
+
+	virtual void OnInsert( DataCacheClientID_t clientId, uintp hItem, unsigned size, float flCost )
+	{
+		int iList = LIST_RESIDENT_0;
+		int i = Find( clientId );
+		if ( i != m_Entries.InvalidIndex() )
+		{
+			if ( m_Entries[i].iList == LIST_GHOST_0 )
+			{
+				iList = LIST_RESIDENT_1;
+			}
+			Free( i );
+		}
+		Link( clientId, hItem, size, flCost, iList );
+	}
+
+	virtual void OnAccess( DataCacheClientID_t clientId )
+	{
+		// Hits in A1in deliberately don't reorder it
+		int i = Find( clientId );
+		if ( i != m_Entries.InvalidIndex() && m_Entries[i].iList == LIST_RESIDENT_1 )
+		{
+			Move( i, LIST_RESIDENT_1 );
+		}
+	}
+
+	virtual void OnRemove( DataCacheClientID_t clientId, bool bEvicted )
+	{
+		int i = Find( clientId );
+		if ( i == m_Entries.InvalidIndex() || !IsResidentList( m_Entries[i].iList ) )
+			return;
+
+		if ( bEvicted && m_Entries[i].iList == LIST_RESIDENT_0 )
+		{
+			Move( i, LIST_GHOST_0 );
+			TrimGhosts( LIST_GHOST_0, m_nCapacity / 2 );
+		}
+		else
+		{
+			Free( i );
+		}
+	}
+
+	virtual bool SelectVictim( IEvictionFilter *pFilter, DataCacheClientID_t *pClientId, uintp *phItem )
+	{
+		// A1in is held to a quarter of the capacity
+		bool bProbationFirst = ( m_nListBytes[LIST_RESIDENT_0] > m_nCapacity / 4 || m_Entries.Count( m_Lists[LIST_RESIDENT_1] ) == 0 );
+		int iFirst = ( bProbationFirst ) ? LIST_RESIDENT_0 : LIST_RESIDENT_1;
+		int iSecond = ( bProbationFirst ) ? LIST_RESIDENT_1 : LIST_RESIDENT_0;
+
+		int i = SelectFromList( iFirst, pFilter );
+		if ( i == m_Entries.InvalidIndex() )
+		{
+			i = SelectFromList( iSecond, pFilter );
+			if ( i == m_Entries.InvalidIndex() )
+				return false;
+		}
+		*pClientId = m_Entries[i].clientId;
+		*phItem = m_Entries[i].hItem;
+		return true;
+	}
+};
+
+
+//-----------------------------------------------------------------------------
+// ARC: resident items are split between a recency list (T1) and a frequency
+// list (T2), each with a ghost list of what it recently evicted (B1, B2). A hit
+// in a ghost list moves the T1 target size towards the list that would have
+// kept the item. Byte weighted.
+//-----------------------------------------------------------------------------
+class CDataCacheEvictionARC : public CDataCacheEvictionPolicy
+{
+public:
+	CDataCacheEvictionARC( unsigned nCapacity ) : CDataCacheEvictionPolicy( nCapacity ), m_flTarget( 0 ) {}
+
+	virtual DataCacheEvictionPolicy_t GetType()	{ return DC_EVICT_ARC; }
+
+	virtual void OnInsert( DataCacheClientID_t clientId, uintp hItem, unsigned size, float flCost )
+	{
+		int iList = LIST_RESIDENT_0;
+		int i = Find( clientId );
+		if ( i != m_Entries.InvalidIndex() )
+		{
+			float flB1 = (float)MAX( m_nListBytes[LIST_GHOST_0], 1 );
+			float flB2 = (float)MAX( m_nListBytes[LIST_GHOST_1], 1 );
+
+			if ( m_Entries[i].iList == LIST_GHOST_0 )
+			{
+				m_flTarget = MIN( m_flTarget + MAX( flB2 / flB1, 1.0f ) * size, (float)m_nCapacity );
+				iList = LIST_RESIDENT_1;
+			}
+			else if ( m_Entries[i].iList == LIST_GHOST_1 )
+			{
+				m_flTarget = MAX( m_flTarget - MAX( flB1 / flB2, 1.0f ) * size, 0.0f );
+				iList = LIST_RESIDENT_1;
+			}
+			Free( i );
+		}
+		Link( clientId, hItem, size, flCost, iList );
+		TrimArcGhosts();
+	}
+
+	virtual void OnAccess( DataCacheClientID_t clientId )
+	{
+		int i = Find( clientId );
+		if ( i != m_Entries.InvalidIndex() && IsResidentList( m_Entries[i].iList ) )
+		{
+			Move( i, LIST_RESIDENT_1 );
+		}
+	}
+
+	virtual void OnRemove( DataCacheClientID_t clientId, bool bEvicted )
+	{
+		int i = Find( clientId );
+		if ( i == m_Entries.InvalidIndex() || !IsResidentList( m_Entries[i].iList ) )
+			return;
+
+		if ( bEvicted )
+		{
+			Move( i, ( m_Entries[i].iList == LIST_RESIDENT_0 ) ? LIST_GHOST_0 : LIST_GHOST_1 );
+			TrimArcGhosts();
+		}
+		else
+		{
+			Free( i );
+		}
+	}
+
+	virtual bool SelectVictim( IEvictionFilter *pFilter, DataCacheClientID_t *pClientId, uintp *phItem )
+	{
+		bool bRecencyFirst = ( m_nListBytes[LIST_RESIDENT_0] > 0 && ( (float)m_nListBytes[LIST_RESIDENT_0] >= m_flTarget || m_Entries.Count( m_Lists[LIST_RESIDENT_1] ) == 0 ) );
+		int iFirst = ( bRecencyFirst ) ? LIST_RESIDENT_0 : LIST_RESIDENT_1;
+		int iSecond = ( bRecencyFirst ) ? LIST_RESIDENT_1 : LIST_RESIDENT_0;
+
+		int i = SelectFromList( iFirst, pFilter );
+		if ( i == m_Entries.InvalidIndex() )
+		{
+			i = SelectFromList( iSecond, pFilter );
+			if ( i == m_Entries.InvalidIndex() )
+				return false;
+		}
+		*pClientId = m_Entries[i].clientId;
+		*phItem = m_Entries[i].hItem;
+		return true;
+	}
+
+private:
+	void TrimArcGhosts()
+	{
+		// T1 + B1 <= c, and everything tracked <= 2c
+		unsigned nT1 = m_nListBytes[LIST_RESIDENT_0];
+		TrimGhosts( LIST_GHOST_0, ( m_nCapacity > nT1 ) ? m_nCapacity - nT1 : 0 );
+
+		unsigned nTracked = GetResidentBytes() + m_nListBytes[LIST_GHOST_0];
+		TrimGhosts( LIST_GHOST_1, ( 2 * m_nCapacity > nTracked ) ? 2 * m_nCapacity - nTracked : 0 );
+	}
+
+	float m_flTarget;
+};
+
+
+//-----------------------------------------------------------------------------
+// Factory
+//-----------------------------------------------------------------------------
+CDataCacheEvictionPolicy *CDataCacheEvictionPolicy::Create( DataCacheEvictionPolicy_t type, unsigned nCapacity )
+{
+	switch ( type )
+	{
+	case DC_EVICT_2Q:
+		return new CDataCacheEviction2Q( nCapacity );
+	case DC_EVICT_ARC:
+		return new CDataCacheEvictionARC( nCapacity );
+	default:
+		return new CDataCacheEvictionLRU( nCapacity );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// CDataCacheTrace
+//-----------------------------------------------------------------------------
+CDataCacheTrace g_DataCacheTrace;
+
+void CDataCacheTrace::Start()
+{
+	AUTO_LOCK( m_mutex );
+	m_Buffer.Purge();
+	m_Buffer.SetBufferType( true, false );
+	m_bActive = true;
+}
+
+bool CDataCacheTrace::Stop( const char *pszFileName )
+{
+	AUTO_LOCK( m_mutex );
+	m_bActive = false;
+	bool bResult = g_pFullFileSystem->WriteFile( pszFileName, "DEFAULT_WRITE_PATH", m_Buffer );
+	m_Buffer.Purge();
+	return bResult;
+}
+
+void CDataCacheTrace::Record( char op, const char *pszSection, DataCacheClientID_t clientId, unsigned size, float flCost )
+{
+	AUTO_LOCK( m_mutex );
+	if ( m_bActive )
+	{
+		m_Buffer.Printf( "%c %s %llx %u %.3f\n", op, pszSection, (unsigned long long)clientId, size, flCost );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Replay
+//-----------------------------------------------------------------------------
+struct ReplayEvent_t
+{
+	DataCacheClientID_t	clientId;
+	unsigned			size;
+	float				flCost;
+	char				op;
+};
+
+struct ReplaySection_t
+{
+	char					szName[DC_MAX_CLIENT_NAME + 1];
+	CUtlVector<ReplayEvent_t> events;
+};
+
+class CReplayLockFilter : public IEvictionFilter
+{
+public:
+	CReplayLockFilter( CUtlMap<DataCacheClientID_t, int, int> &locks ) : m_Locks( locks ) {}
+
+	virtual bool CanEvict( DataCacheClientID_t clientId, uintp hItem )
+	{
+		int i = m_Locks.Find( clientId );
+		return ( i == m_Locks.InvalidIndex() || m_Locks[i] <= 0 );
+	}
+
+private:
+	CUtlMap<DataCacheClientID_t, int, int> &m_Locks;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Run one section's trace through a policy at the given capacity
+//-----------------------------------------------------------------------------
+static void ReplaySection( const ReplaySection_t &section, DataCacheEvictionPolicy_t type, unsigned nCapacity )
+{
+	CDataCacheEvictionPolicy *pPolicy = CDataCacheEvictionPolicy::Create( type, nCapacity );
+	CUtlMap<DataCacheClientID_t, int, int> locks( DefLessFunc( DataCacheClientID_t ) );
+	CUtlMap<DataCacheClientID_t, float, int> seen( DefLessFunc( DataCacheClientID_t ) );
+	CReplayLockFilter filter( locks );
+
+	int nHits = 0;
+	int nMisses = 0;
+	uint64 nBytesReloaded = 0;
+	double flMsReloaded = 0;
+
+	for ( int i = 0; i < section.events.Count(); i++ )
+	{
+		const ReplayEvent_t &event = section.events[i];
+		int iLock;
+
+		switch ( event.op )
+		{
+		case 'A':
+		case 'G':
+		case 'L':
+			{
+				// Remember the latest measured reload cost of each item
+				int iSeen = seen.Find( event.clientId );
+				bool bSeen = ( iSeen != seen.InvalidIndex() );
+				if ( !bSeen )
+				{
+					iSeen = seen.Insert( event.clientId, 0.0f );
+				}
+				if ( event.op == 'A' && event.flCost > 0 )
+				{
+					seen[iSeen] = event.flCost;
+				}
+
+				if ( pPolicy->IsResident( event.clientId ) )
+				{
+					nHits++;
+					pPolicy->OnAccess( event.clientId );
+				}
+				else
+				{
+					nMisses++;
+
+					// First loads are compulsory, only misses on items seen before are reloads
+					float flCost = seen[iSeen];
+					if ( bSeen )
+					{
+						nBytesReloaded += event.size;
+						flMsReloaded += flCost;
+					}
+
+					DataCacheClientID_t victimId;
+					uintp hVictim;
+					while ( pPolicy->GetResidentBytes() + event.size > nCapacity && pPolicy->SelectVictim( &filter, &victimId, &hVictim ) )
+					{
+						pPolicy->OnRemove( victimId, true );
+					}
+					pPolicy->OnInsert( event.clientId, 0, event.size, ( flCost > 0 ) ? flCost : event.size * ( 1.0f / ( 1024.0f * 1024.0f ) ) );
+				}
+
+				if ( event.op == 'L' )
+				{
+					iLock = locks.Find( event.clientId );
+					if ( iLock == locks.InvalidIndex() )
+						locks.Insert( event.clientId, 1 );
+					else
+						locks[iLock]++;
+				}
+			}
+			break;
+
+		case 'U':
+			iLock = locks.Find( event.clientId );
+			if ( iLock != locks.InvalidIndex() && locks[iLock] > 0 )
+			{
+				locks[iLock]--;
+			}
+			break;
+
+		case 'R':
+			pPolicy->OnRemove( event.clientId, false );
+			break;
+		}
+	}
+
+	int nAccesses = nHits + nMisses;
+	float flHitRatio = ( nAccesses ) ? 100.0f * (float)nHits / (float)nAccesses : 0.0f;
+	Msg( "\t%-4s: hit ratio %6.2f %%, %d misses, %s reloaded, %.1f ms reload cost\n",
+		EvictionPolicyName( type ), flHitRatio, nMisses, Q_pretifymem( (float)nBytesReloaded, 2, true ), flMsReloaded );
+
+	delete pPolicy;
+}
+
+CON_COMMAND( datacache_trace_start, "Start recording data cache traffic for datacache_replay" )
+{
+	g_DataCacheTrace.Start();
+	Msg( "Data cache trace started\n" );
+}
+
+CON_COMMAND( datacache_trace_stop, "Stop recording data cache traffic. Usage: datacache_trace_stop [file]" )
+{
+	const char *pszFileName = ( args.ArgC() > 1 ) ? args[1] : "datacache_trace.txt";
+	if ( !g_DataCacheTrace.IsActive() )
+	{
+		Msg( "No data cache trace is being recorded\n" );
+		return;
+	}
+
+	if ( g_DataCacheTrace.Stop( pszFileName ) )
+	{
+		Msg( "Wrote data cache trace to %s\n", pszFileName );
+	}
+	else
+	{
+		Warning( "Unable to write data cache trace to %s\n", pszFileName );
+	}
+}
+
+CON_COMMAND( datacache_replay, "Replay a recorded data cache trace through each eviction policy. Usage: datacache_replay <file> [capacity MB]" )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: datacache_replay <file> [capacity MB]\n" );
+		return;
+	}
+
+	CUtlBuffer buf( 0, 0, CUtlBuffer::TEXT_BUFFER );
+	if ( !g_pFullFileSystem->ReadFile( args[1], NULL, buf ) )
+	{
+		Warning( "Unable to read data cache trace %s\n", args[1] );
+		return;
+	}
+
+	CUtlVector<ReplaySection_t *> sections;
+	char szLine[256];
+	while ( buf.GetBytesRemaining() > 0 )
+	{
+		buf.GetLine( szLine, sizeof(szLine) );
+
+		char op;
+		char szSection[DC_MAX_CLIENT_NAME + 1];
+		unsigned long long clientId;
+		unsigned size;
+		float flCost;
+		if ( sscanf( szLine, "%c %15s %llx %u %f", &op, szSection, &clientId, &size, &flCost ) != 5 )
+			continue;
+
+		ReplaySection_t *pSection = NULL;
+		for ( int i = 0; i < sections.Count(); i++ )
+		{
+			if ( !Q_stricmp( sections[i]->szName, szSection ) )
+			{
+				pSection = sections[i];
+				break;
+			}
+		}
+
+		if ( !pSection )
+		{
+			pSection = new ReplaySection_t;
+			Q_strncpy( pSection->szName, szSection, sizeof(pSection->szName) );
+			sections.AddToTail( pSection );
+		}
+
+		ReplayEvent_t &event = pSection->events[pSection->events.AddToTail()];
+		event.op = op;
+		event.clientId = (DataCacheClientID_t)clientId;
+		event.size = size;
+		event.flCost = flCost;
+	}
+
+	DataCacheLimits_t cacheLimits;
+	g_DataCache.GetStatus( NULL, &cacheLimits );
+
+	for ( int i = 0; i < sections.Count(); i++ )
+	{
+		// Sections are replayed against their own limit when they have one, otherwise the whole cache
+		unsigned nCapacity = cacheLimits.nMaxBytes;
+		if ( args.ArgC() > 2 )
+		{
+			nCapacity = (unsigned)( atof( args[2] ) * 1024 * 1024 );
+		}
+		else
+		{
+			CDataCacheSection *pLiveSection = (CDataCacheSection *)g_DataCache.FindSection( sections[i]->szName );
+			if ( pLiveSection && pLiveSection->GetLimits().nMaxBytes != (unsigned)-1 )
+			{
+				nCapacity = pLiveSection->GetLimits().nMaxBytes;
+			}
+		}
+
+		Msg( "Section [%s]: %d events, capacity %s\n", sections[i]->szName, sections[i]->events.Count(), Q_pretifymem( nCapacity, 2, true ) );
+		for ( int type = 0; type < DC_EVICT_POLICY_COUNT; type++ )
+		{
+			ReplaySection( *sections[i], (DataCacheEvictionPolicy_t)type, nCapacity );
+		}
+	}
+
+	sections.PurgeAndDeleteElements();
+}
+
+CON_COMMAND( datacache_policy, "Show or set the eviction policy of a data cache section. Usage: datacache_policy <section> [lru|2q|arc]" )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: datacache_policy <section> [lru|2q|arc]\n" );
+		return;
+	}
+
+	CDataCacheSection *pSection = (CDataCacheSection *)g_DataCache.FindSection( args[1] );
+	if ( !pSection )
+	{
+		Msg( "Unknown cache section %s\n", args[1] );
+		return;
+	}
+
+	if ( args.ArgC() > 2 )
+	{
+		DataCacheEvictionPolicy_t type;
+		if ( !EvictionPolicyFromName( args[2], &type ) )
+		{
+			Msg( "Unknown eviction policy %s\n", args[2] );
+			return;
+		}
+		pSection->SetEvictionPolicy( type );
+	}
+
+	Msg( "Section [%s]: eviction policy %s\n", pSection->GetName(), EvictionPolicyName( pSection->GetEvictionPolicy() ) );
+}
@@ -0,0 +1,149 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Selectable eviction policies for data cache sections, and the
+//			Lock/Unlock trace recorder used to compare them offline.
+//
+//===========================================================================//
+
+#ifndef DATACACHEPOLICY_H
+#define DATACACHEPOLICY_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "datacache/idatacache.h"
+#include "utlmultilist.h"
+#include "utlmap.h"
+#include "utlbuffer.h"
+
+
+//-----------------------------------------------------------------------------
+// Policy types
+//-----------------------------------------------------------------------------
+enum DataCacheEvictionPolicy_t
+{
+	DC_EVICT_LRU = 0,	// Pure recency, the shared LRU order
+	DC_EVICT_2Q,		// Probation FIFO, main LRU and a ghost list of items evicted from probation
+	DC_EVICT_ARC,		// Adaptive split between recency and frequency lists, driven by ghost hits
+
+	DC_EVICT_POLICY_COUNT
+};
+
+const char *EvictionPolicyName( DataCacheEvictionPolicy_t type );
+bool EvictionPolicyFromName( const char *pszName, DataCacheEvictionPolicy_t *pType );
+
+// Number of evictable items at the cold end of a list that compete on reload cost per byte
+#define DC_EVICT_COST_CANDIDATES 8
+
+//-----------------------------------------------------------------------------
+// Lets the owner veto eviction of items, e.g. because they are locked
+//-----------------------------------------------------------------------------
+abstract_class IEvictionFilter
+{
+public:
+	virtual bool CanEvict( DataCacheClientID_t clientId, uintp hItem ) = 0;
+};
+
+
+//-----------------------------------------------------------------------------
+// CDataCacheEvictionPolicy
+//
+// Purpose: Tracks the resident items of one section (and the recently
+//			evicted ones, for the adaptive policies) and picks victims.
+//			Byte based: capacities and list targets are in bytes, so a few
+//			large items cannot crowd out the bookkeeping of many small ones.
+//			Not thread safe, the owner serializes access.
+//-----------------------------------------------------------------------------
+class CDataCacheEvictionPolicy
+{
+public:
+	static CDataCacheEvictionPolicy *Create( DataCacheEvictionPolicy_t type, unsigned nCapacity );
+
+	CDataCacheEvictionPolicy( unsigned nCapacity );
+	virtual ~CDataCacheEvictionPolicy() {}
+
+	virtual DataCacheEvictionPolicy_t GetType() = 0;
+
+	void SetCapacity( unsigned nCapacity )		{ m_nCapacity = MAX( nCapacity, 1 ); }
+	unsigned GetCapacity()						{ return m_nCapacity; }
+	unsigned GetResidentBytes();
+
+	// An item became resident. flCost is the measured or estimated reload cost in milliseconds.
+	virtual void OnInsert( DataCacheClientID_t clientId, uintp hItem, unsigned size, float flCost ) = 0;
+	// A resident item was used
+	virtual void OnAccess( DataCacheClientID_t clientId ) = 0;
+	// A resident item left the cache. bEvicted is false for explicit removal by the client.
+	virtual void OnRemove( DataCacheClientID_t clientId, bool bEvicted ) = 0;
+	void OnResize( DataCacheClientID_t clientId, unsigned size );
+
+	// Picks the next resident item to evict. Returns false if nothing can be evicted.
+	virtual bool SelectVictim( IEvictionFilter *pFilter, DataCacheClientID_t *pClientId, uintp *phItem ) = 0;
+
+	bool IsResident( DataCacheClientID_t clientId );
+
+protected:
+	enum
+	{
+		LIST_RESIDENT_0,	// LRU: all, 2Q: A1in,  ARC: T1
+		LIST_RESIDENT_1,	//          2Q: Am,    ARC: T2
+		LIST_GHOST_0,		//          2Q: A1out, ARC: B1
+		LIST_GHOST_1,		//                     ARC: B2
+		LIST_COUNT
+	};
+
+	struct Entry_t
+	{
+		DataCacheClientID_t	clientId;
+		uintp				hItem;
+		unsigned			size;
+		float				flCost;
+		int					iList;
+	};
+
+	int Find( DataCacheClientID_t clientId );
+	int Link( DataCacheClientID_t clientId, uintp hItem, unsigned size, float flCost, int iList );
+	void Move( int i, int iList );
+	void Free( int i );
+	void TrimGhosts( int iList, unsigned nMaxBytes );
+	int SelectFromList( int iList, IEvictionFilter *pFilter );
+
+	static bool IsResidentList( int iList )		{ return iList == LIST_RESIDENT_0 || iList == LIST_RESIDENT_1; }
+
+	CUtlMultiList<Entry_t, int>				m_Entries;
+	int										m_Lists[LIST_COUNT];
+	unsigned								m_nListBytes[LIST_COUNT];
+	CUtlMap<DataCacheClientID_t, int, int>	m_Index;
+	unsigned								m_nCapacity;
+};
+
+
+//-----------------------------------------------------------------------------
+// CDataCacheTrace
+//
+// Purpose: Records cache traffic to a text file that datacache_replay can feed
+//			through each policy. One line per event:
+//				<op> <section> <clientid> <size> <reload ms>
+//			where op is A(dd), G(et), L(ock), U(nlock) or R(emove). The reload
+//			cost is only filled in for adds.
+//-----------------------------------------------------------------------------
+class CDataCacheTrace
+{
+public:
+	CDataCacheTrace() : m_bActive( false ) {}
+
+	bool IsActive()								{ return m_bActive; }
+	void Start();
+	bool Stop( const char *pszFileName );
+	void Record( char op, const char *pszSection, DataCacheClientID_t clientId, unsigned size, float flCost = 0 );
+
+private:
+	volatile bool		m_bActive;
+	CUtlBuffer			m_Buffer;
+	CThreadFastMutex	m_mutex;
+};
+
+extern CDataCacheTrace g_DataCacheTrace;
+
+
+#endif // DATACACHEPOLICY_H
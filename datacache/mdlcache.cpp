@@ -34,6 +34,8 @@
 #include "filesystem/IQueuedLoader.h"
 #include "tier1/lzmaDecoder.h"
 #include "functors.h"
+#include "mdlcachebundle.h"
+#include "mdldecodedanim.h"
 
 // XXX remove this later. (henryg)
 #if 0 && defined(_DEBUG) && defined(_WIN32) && !defined(_X360)
@@ -446,6 +448,8 @@ public:
 
 	virtual void MarkFrame();
 
+	virtual const studiodecodedanim_t *GetDecodedAnimation( const mstudioanimdesc_t &animdesc, int iSection, const mstudioanim_t *panim );
+
 	// Queued loading
 	void ProcessQueuedData( ModelParts_t *pModelParts, bool bHeaderOnly = false );
 	static void	QueuedLoaderCallback_MDL( void *pContext, void  *pContext2, const void *pData, int nSize, LoaderError_t loaderError );
@@ -534,13 +538,25 @@ private:
 	void BreakFrameLock( bool bModels = true, bool bMesh = true );
 	void RestoreFrameLock();
 
+public:
+	// Pre-baked model bundles
+	void LoadBundle( const char *pszFileName );
+	void UnloadBundle();
+	void PrintBundleStatus();
+	void BakeBundle( const char *pszFileName, const char *pszModelList );
+
 private:
+	bool ReadBundledMDL( const char *pszModelName, CUtlBuffer &buf );
+	vertexFileHeader_t *LoadBundledVertexData( studiohdr_t *pStudioHdr );
+	bool BakeBundleModel( CMDLCacheBundleBuilder &builder, const char *pszModelName );
+
 	IDataCacheSection *m_pModelCacheSection;
 	IDataCacheSection *m_pMeshCacheSection;
 	IDataCacheSection *m_pAnimBlockCacheSection;
 
 	int m_nModelCacheFrameLocks;
 	int m_nMeshCacheFrameLocks;
+	int m_nDecodedAnimFrameLocks;
 
 	CUtlDict< studiodata_t*, MDLHandle_t > m_MDLDict;
 
@@ -551,9 +567,13 @@ private:
 	CThreadFastMutex m_QueuedLoadingMutex;
 	CThreadFastMutex m_AsyncMutex;
 
+	CMDLCacheBundle m_Bundle;
+	CMDLDecodedAnimCache m_DecodedAnims;
+
 	bool m_bLostVideoMemory : 1;
 	bool m_bConnected : 1;
 	bool m_bInitialized : 1;
+	bool m_bBundleChecked : 1;
 };
 
 //-----------------------------------------------------------------------------
@@ -587,12 +607,14 @@ CMDLCache::CMDLCache() : BaseClass( false )
 	m_bLostVideoMemory = false;
 	m_bConnected = false;
 	m_bInitialized = false;
+	m_bBundleChecked = false;
 	m_pCacheNotify = NULL;
 	m_pModelCacheSection = NULL;
 	m_pMeshCacheSection = NULL;
 	m_pAnimBlockCacheSection = NULL;
 	m_nModelCacheFrameLocks = 0;
 	m_nMeshCacheFrameLocks = 0;
+	m_nDecodedAnimFrameLocks = 0;
 }
 
 
@@ -701,6 +723,8 @@ InitReturnVal_t CMDLCache::Init()
 		m_pAnimBlockCacheSection = g_pDataCache->AddSection( this, MODEL_CACHE_ANIMBLOCK_SECTION_NAME, limits );
 	}
 
+	m_DecodedAnims.Init();
+
 	if ( IsX360() )
 	{
 		// By default, source data is assumed to be non-native to the 360.
@@ -756,6 +780,11 @@ void CMDLCache::Shutdown()
 		m_pAnimBlockCacheSection = NULL;
 	}
 
+	m_DecodedAnims.Shutdown();
+
+	m_Bundle.Unload();
+	m_bBundleChecked = false;
+
 	BaseClass::Shutdown();
 }
 
@@ -2086,7 +2115,8 @@ bool CMDLCache::ReadMDLFile( MDLHandle_t handle, const char *pMDLFileName, CUtlB
 
 	MEM_ALLOC_CREDIT();
 
-	bool bOk = ReadFileNative( pFileName, "GAME", buf, 0, MDLCACHE_STUDIOHDR );
+	bool bFromBundle = ReadBundledMDL( pFileName, buf );
+	bool bOk = bFromBundle || ReadFileNative( pFileName, "GAME", buf, 0, MDLCACHE_STUDIOHDR );
 	if ( !bOk )
 	{
 		DevWarning( "Failed to load %s!\n", pMDLFileName );
@@ -2137,8 +2167,8 @@ bool CMDLCache::ReadMDLFile( MDLHandle_t handle, const char *pMDLFileName, CUtlB
 	// this is fetched when re-establishing dependent cached data (vtx/vvd)
 	pStudioHdr->SetVirtualModel( MDLHandleToVirtual( handle ) );
 
-	// Make sure all dependent files are valid
-	if ( !VerifyHeaders( pStudioHdr ) )
+	// Make sure all dependent files are valid, bundled models were checked when baked
+	if ( !bFromBundle && !VerifyHeaders( pStudioHdr ) )
 	{
 		DevWarning( "Model %s has mismatched .vvd + .vtx files!\n", pMDLFileName );
 		return false;
@@ -2407,6 +2437,7 @@ void CMDLCache::BeginLock()
 {
 	m_pModelCacheSection->BeginFrameLocking();
 	m_pMeshCacheSection->BeginFrameLocking();
+	m_DecodedAnims.BeginLock();
 }
 
 //-----------------------------------------------------------------------------
@@ -2416,6 +2447,7 @@ void CMDLCache::EndLock()
 {
 	m_pModelCacheSection->EndFrameLocking();
 	m_pMeshCacheSection->EndFrameLocking();
+	m_DecodedAnims.EndLock();
 }
 
 
@@ -2436,6 +2468,8 @@ void CMDLCache::BreakFrameLock( bool bModels, bool bMesh )
 			} while ( m_pModelCacheSection->EndFrameLocking() );
 		}
 
+		Assert( !m_nDecodedAnimFrameLocks );
+		m_nDecodedAnimFrameLocks = m_DecodedAnims.BreakLock();
 	}
 
 	if ( bMesh )
@@ -2460,6 +2494,8 @@ void CMDLCache::RestoreFrameLock()
 		m_pModelCacheSection->BeginFrameLocking();
 		m_nModelCacheFrameLocks--;
 	}
+	m_DecodedAnims.RestoreLock( m_nDecodedAnimFrameLocks );
+	m_nDecodedAnimFrameLocks = 0;
 	while ( m_nMeshCacheFrameLocks )
 	{
 		m_pMeshCacheSection->BeginFrameLocking();
@@ -3304,6 +3340,17 @@ bool CMDLCache::SetAsyncLoad( MDLCacheDataType_t type, bool bAsync )
 	return bRetVal;
 }
 
+//-----------------------------------------------------------------------------
+// Whether vertex data is cached with tangentS
+//-----------------------------------------------------------------------------
+static bool VertexDataNeedsTangentS()
+{
+	// no hardware config when baking bundles from a dedicated server, keep the superset
+	if ( !g_pMaterialSystemHardwareConfig )
+		return true;
+	return IsX360() || (g_pMaterialSystemHardwareConfig->GetDXSupportLevel() >= 80);
+}
+
 //-----------------------------------------------------------------------------
 // Cache model's specified dynamic data
 //-----------------------------------------------------------------------------
@@ -3360,7 +3407,7 @@ vertexFileHeader_t *CMDLCache::BuildAndCacheVertexData( studiohdr_t *pStudioHdr,
 		}
 	}
 
-	bool bNeedsTangentS = IsX360() || (g_pMaterialSystemHardwareConfig->GetDXSupportLevel() >= 80);
+	bool bNeedsTangentS = VertexDataNeedsTangentS();
 	int rootLOD = min( (int)pStudioHdr->rootLOD, pRawVvdHdr->numLODs - 1 );
 
 	// determine final cache footprint, possibly truncated due to lod
@@ -3409,6 +3456,14 @@ vertexFileHeader_t *CMDLCache::LoadVertexData( studiohdr_t *pStudioHdr )
 
 	intp iAsync = GetAsyncInfoIndex( handle, MDLCACHE_VERTEXES );
 
+	if ( iAsync == NO_ASYNC )
+	{
+		// already fixed up in the bundle?
+		vertexFileHeader_t *pVvdHdr = LoadBundledVertexData( pStudioHdr );
+		if ( pVvdHdr )
+			return pVvdHdr;
+	}
+
 	if ( iAsync == NO_ASYNC )
 	{
 		// load the VVD file
@@ -3459,6 +3514,248 @@ vertexFileHeader_t *CMDLCache::GetVertexData( MDLHandle_t handle )
 }
 
 
+//-----------------------------------------------------------------------------
+// Pre-baked model bundles. -mdlbundle [file] maps one on first use; the
+// studiohdr and vertex data of bundled models are copied straight into the
+// cache, skipping the flex conversion and vertex fixups.
+//-----------------------------------------------------------------------------
+void CMDLCache::LoadBundle( const char *pszFileName )
+{
+	m_bBundleChecked = true;
+	if ( !m_Bundle.Load( pszFileName, "GAME" ) )
+	{
+		Warning( "Unable to load model bundle %s\n", pszFileName );
+	}
+}
+
+void CMDLCache::UnloadBundle()
+{
+	// Cached models hold copies, so nothing refers into the bundle
+	m_Bundle.Unload();
+}
+
+void CMDLCache::PrintBundleStatus()
+{
+	m_Bundle.PrintStatus();
+}
+
+bool CMDLCache::ReadBundledMDL( const char *pszModelName, CUtlBuffer &buf )
+{
+	if ( !m_bBundleChecked )
+	{
+		m_bBundleChecked = true;
+		if ( CommandLine()->FindParm( "-mdlbundle" ) )
+		{
+			LoadBundle( CommandLine()->ParmValue( "-mdlbundle", MDLBUNDLE_DEFAULT_FILENAME ) );
+		}
+	}
+
+	const MDLBundleEntry_t *pEntry = m_Bundle.LockEntry( pszModelName );
+	if ( !pEntry )
+		return false;
+
+	buf.Put( m_Bundle.GetBlob( pEntry->mdlOffset ), pEntry->mdlSize );
+	m_Bundle.UnlockEntry();
+	m_Bundle.NoteHit();
+	return true;
+}
+
+vertexFileHeader_t *CMDLCache::LoadBundledVertexData( studiohdr_t *pStudioHdr )
+{
+	if ( !m_Bundle.IsLoaded() )
+		return NULL;
+
+	MDLHandle_t handle = VoidPtrToMDLHandle( pStudioHdr->VirtualModel() );
+	const MDLBundleEntry_t *pEntry = m_Bundle.LockEntry( GetActualModelName( handle ) );
+	if ( !pEntry )
+		return NULL;
+
+	// The baked data is only good for the configuration it was built for
+	bool bNeedsTangentS = VertexDataNeedsTangentS();
+	if ( !pEntry->vvdSize || pEntry->studioChecksum != pStudioHdr->checksum || pEntry->vvdRootLOD != pStudioHdr->rootLOD ||
+		( ( pEntry->vvdFlags & MDLBUNDLE_VVD_TANGENTS ) != 0 ) != bNeedsTangentS )
+	{
+		m_Bundle.UnlockEntry();
+		return NULL;
+	}
+
+	MdlCacheMsg( "MDLCache: Load VVD for %s from bundle\n", pStudioHdr->pszName() );
+
+	int cacheLength = pEntry->vvdSize;
+
+	MemAlloc_PushAllocDbgInfo( "Models:Vertex data", 0);
+	vertexFileHeader_t *pVvdHdr = (vertexFileHeader_t *)AllocData( MDLCACHE_VERTEXES, cacheLength );
+	MemAlloc_PopAllocDbgInfo();
+
+	GetCacheSection( MDLCACHE_VERTEXES )->BeginFrameLocking();
+
+	CacheData( &m_MDLDict[handle]->m_VertexCache, pVvdHdr, cacheLength, pStudioHdr->pszName(), MDLCACHE_VERTEXES, MakeCacheID( handle, MDLCACHE_VERTEXES) );
+
+	V_memcpy( pVvdHdr, m_Bundle.GetBlob( pEntry->vvdOffset ), cacheLength );
+	m_Bundle.UnlockEntry();
+	m_Bundle.NoteHit();
+
+	GetCacheSection( MDLCACHE_VERTEXES )->EndFrameLocking();
+
+	return pVvdHdr;
+}
+
+//-----------------------------------------------------------------------------
+// Builds the bundle entry for one model from its loose files
+//-----------------------------------------------------------------------------
+bool CMDLCache::BakeBundleModel( CMDLCacheBundleBuilder &builder, const char *pszModelName )
+{
+	char pFileName[ MAX_PATH ];
+	Q_strncpy( pFileName, pszModelName, sizeof( pFileName ) );
+	Q_FixSlashes( pFileName );
+#ifdef POSIX
+	Q_strlower( pFileName );
+#endif
+
+	CUtlBuffer mdlBuf;
+	if ( !ReadFileNative( pFileName, "GAME", mdlBuf, 0, MDLCACHE_STUDIOHDR ) || mdlBuf.TellMaxPut() < (int)sizeof( studiohdr_t ) )
+	{
+		Warning( "Bundle: unable to read %s\n", pFileName );
+		return false;
+	}
+
+	studiohdr_t *pStudioHdr = (studiohdr_t *)mdlBuf.Base();
+	if ( pStudioHdr->id != IDSTUDIOHEADER || pStudioHdr->version != STUDIO_VERSION )
+	{
+		Warning( "Bundle: %s is not a version %d .MDL file\n", pFileName, STUDIO_VERSION );
+		return false;
+	}
+
+	MDLBundleEntry_t stamps;
+	V_memset( &stamps, 0, sizeof( stamps ) );
+	stamps.studioChecksum = pStudioHdr->checksum;
+	stamps.mdlFileTime = g_pFullFileSystem->GetFileTime( pFileName, "GAME" );
+	stamps.mdlFileSize = g_pFullFileSystem->Size( pFileName, "GAME" );
+	CRC32_Init( &stamps.sourceCRC );
+	CRC32_ProcessBuffer( &stamps.sourceCRC, mdlBuf.Base(), mdlBuf.TellMaxPut() );
+
+	// what UnserializeMDL would do on every load
+	if ( ( pStudioHdr->flags & STUDIOHDR_FLAGS_FLEXES_CONVERTED ) == 0 )
+	{
+		ConvertFlexData( pStudioHdr );
+		pStudioHdr->flags |= STUDIOHDR_FLAGS_FLEXES_CONVERTED;
+	}
+	pStudioHdr->SetVirtualModel( NULL );
+
+	// and what BuildAndCacheVertexData would do, at the default root lod
+	CUtlBuffer vvdBuf;
+	CTempAllocHelper pVvdData;
+	int nVvdSize = 0;
+	if ( pStudioHdr->numbodyparts )
+	{
+		Q_SetExtension( pFileName, ".vvd", sizeof( pFileName ) );
+		if ( ReadFileNative( pFileName, "GAME", vvdBuf ) && vvdBuf.TellMaxPut() >= (int)sizeof( vertexFileHeader_t ) )
+		{
+			vertexFileHeader_t *pRawVvdHdr = (vertexFileHeader_t *)vvdBuf.Base();
+			if ( pRawVvdHdr->id == MODEL_VERTEX_FILE_ID && pRawVvdHdr->version == MODEL_VERTEX_FILE_VERSION &&
+				pRawVvdHdr->checksum == pStudioHdr->checksum && pRawVvdHdr->numLODs )
+			{
+				bool bNeedsTangentS = VertexDataNeedsTangentS();
+				nVvdSize = Studio_VertexDataSize( pRawVvdHdr, 0, bNeedsTangentS );
+				pVvdData.Alloc( nVvdSize );
+				Studio_LoadVertexes( pRawVvdHdr, (vertexFileHeader_t *)pVvdData.Get(), 0, bNeedsTangentS );
+
+				stamps.vvdFileTime = g_pFullFileSystem->GetFileTime( pFileName, "GAME" );
+				stamps.vvdFileSize = g_pFullFileSystem->Size( pFileName, "GAME" );
+				stamps.vvdRootLOD = 0;
+				stamps.vvdFlags = bNeedsTangentS ? MDLBUNDLE_VVD_TANGENTS : 0;
+				CRC32_ProcessBuffer( &stamps.sourceCRC, vvdBuf.Base(), vvdBuf.TellMaxPut() );
+			}
+			else
+			{
+				Warning( "Bundle: %s doesn't match its .mdl, baking the studiohdr only\n", pFileName );
+			}
+		}
+	}
+	CRC32_Final( &stamps.sourceCRC );
+
+	builder.AddModel( pszModelName, stamps, mdlBuf.Base(), mdlBuf.TellMaxPut(), pVvdData.Get(), nVvdSize );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Bakes the models named in a list file, one per line, or every model the
+// cache currently knows about
+//-----------------------------------------------------------------------------
+void CMDLCache::BakeBundle( const char *pszFileName, const char *pszModelList )
+{
+	if ( IsX360() )
+	{
+		Warning( "Model bundles are not supported on this platform\n" );
+		return;
+	}
+
+	CMDLCacheBundleBuilder builder;
+	int nFailed = 0;
+
+	if ( pszModelList && *pszModelList )
+	{
+		CUtlBuffer listBuf( 0, 0, CUtlBuffer::TEXT_BUFFER );
+		if ( !g_pFullFileSystem->ReadFile( pszModelList, "GAME", listBuf ) )
+		{
+			Warning( "Unable to read model list %s\n", pszModelList );
+			return;
+		}
+
+		char szLine[MAX_PATH];
+		while ( listBuf.IsValid() )
+		{
+			listBuf.GetLine( szLine, sizeof( szLine ) );
+			Q_StripPrecedingAndTrailingWhitespace( szLine );
+			if ( szLine[0] && !( szLine[0] == '/' && szLine[1] == '/' ) )
+			{
+				nFailed += BakeBundleModel( builder, szLine ) ? 0 : 1;
+			}
+		}
+	}
+	else
+	{
+		for ( MDLHandle_t i = m_MDLDict.First(); i != m_MDLDict.InvalidIndex(); i = m_MDLDict.Next( i ) )
+		{
+			// Procedural models (e.g. "?", "*1") and missing models have no loose files
+			const char *pszModelName = m_MDLDict.GetElementName( i );
+			if ( ( m_MDLDict[i]->m_nFlags & STUDIODATA_ERROR_MODEL ) || !V_stristr( pszModelName, ".mdl" ) )
+				continue;
+
+			nFailed += BakeBundleModel( builder, pszModelName ) ? 0 : 1;
+		}
+	}
+
+	if ( !builder.Write( pszFileName, "DEFAULT_WRITE_PATH" ) )
+	{
+		Warning( "Unable to write model bundle %s\n", pszFileName );
+		return;
+	}
+
+	Msg( "Wrote model bundle %s: %d models, %d failed\n", pszFileName, builder.Count(), nFailed );
+}
+
+CON_COMMAND( mdlcache_bundle_bake, "Bakes pre-converted models into a bundle for -mdlbundle. mdlcache_bundle_bake [file] [model list file]" )
+{
+	g_MDLCache.BakeBundle( ( args.ArgC() > 1 ) ? args[1] : MDLBUNDLE_DEFAULT_FILENAME, ( args.ArgC() > 2 ) ? args[2] : NULL );
+}
+
+CON_COMMAND( mdlcache_bundle_load, "Maps a model bundle. Models already in the cache are unaffected. mdlcache_bundle_load [file]" )
+{
+	g_MDLCache.LoadBundle( ( args.ArgC() > 1 ) ? args[1] : MDLBUNDLE_DEFAULT_FILENAME );
+}
+
+CON_COMMAND( mdlcache_bundle_unload, "Unmaps the model bundle" )
+{
+	g_MDLCache.UnloadBundle();
+}
+
+CON_COMMAND( mdlcache_bundle_status, "Reports model bundle usage" )
+{
+	g_MDLCache.PrintBundleStatus();
+}
+
+
 //-----------------------------------------------------------------------------
 // Allocates a cacheable item
 //-----------------------------------------------------------------------------
@@ -3956,6 +4253,14 @@ void CMDLCache::MarkFrame()
 	ProcessPendingAsyncs();
 }
 
+//-----------------------------------------------------------------------------
+// Decoded animation sections, see mdldecodedanim.h
+//-----------------------------------------------------------------------------
+const studiodecodedanim_t *CMDLCache::GetDecodedAnimation( const mstudioanimdesc_t &animdesc, int iSection, const mstudioanim_t *panim )
+{
+	return m_DecodedAnims.Get( animdesc, iSection, panim );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: bind studiohdr_t support functions to the mdlcacher
 //-----------------------------------------------------------------------------
@@ -0,0 +1,470 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Pre-baked model bundles, see mdlcachebundle.h
+//
+//===========================================================================//
+
+#include "mdlcachebundle.h"
+#include "filesystem.h"
+#include "convar.h"
+#include "tier1/strtools.h"
+#include "tier2/tier2.h"
+
+#ifdef POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar mod_bundle_checkfiles( "mod_bundle_checkfiles", "1", 0, "Check the model bundle's content CRC when it is loaded, and the .mdl/.vvd files against it before using an entry. 1: size and time, plus a CRC of the files where they have no time (packed files). 2: always compare the CRC." );
+
+
+//-----------------------------------------------------------------------------
+// Names are stored lowercase with forward slashes
+//-----------------------------------------------------------------------------
+void CMDLCacheBundle::NormalizeName( const char *pszModelName, char *pszOut, int nMaxLength )
+{
+	Q_strncpy( pszOut, pszModelName, nMaxLength );
+	Q_strlower( pszOut );
+	for ( char *p = pszOut; *p; p++ )
+	{
+		if ( *p == '\\' )
+		{
+			*p = '/';
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Constructor, destructor
+//-----------------------------------------------------------------------------
+CMDLCacheBundle::CMDLCacheBundle() :
+	m_pBase( NULL ),
+	m_nSize( 0 ),
+	m_bMapped( false ),
+	m_pHeader( NULL ),
+	m_pEntries( NULL ),
+	m_nLoadCount( 0 )
+{
+}
+
+CMDLCacheBundle::~CMDLCacheBundle()
+{
+	Unload();
+}
+
+
+//-----------------------------------------------------------------------------
+// Maps the bundle, sanity checks the directory and, unless file checks are
+// off, the content CRC. With the checks off blobs are not touched, so only
+// the pages of models that actually get loaded are ever read in.
+//-----------------------------------------------------------------------------
+bool CMDLCacheBundle::Load( const char *pszFileName, const char *pszPathID )
+{
+	Unload();
+
+	AUTO_LOCK( m_mutex );
+
+	const byte *pBase = NULL;
+	int nSize = 0;
+	bool bMapped = false;
+
+#ifdef POSIX
+	char szFullPath[MAX_PATH];
+	if ( g_pFullFileSystem->RelativePathToFullPath( pszFileName, pszPathID, szFullPath, sizeof( szFullPath ) ) )
+	{
+		int fd = open( szFullPath, O_RDONLY );
+		if ( fd >= 0 )
+		{
+			struct stat st;
+			if ( fstat( fd, &st ) == 0 && st.st_size > 0 && st.st_size < INT_MAX )
+			{
+				void *pMap = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+				if ( pMap != MAP_FAILED )
+				{
+					pBase = (const byte *)pMap;
+					nSize = (int)st.st_size;
+					bMapped = true;
+				}
+			}
+			close( fd );
+		}
+	}
+#endif
+
+	if ( !pBase )
+	{
+		CUtlBuffer buf;
+		if ( !g_pFullFileSystem->ReadFile( pszFileName, pszPathID, buf ) )
+			return false;
+
+		nSize = buf.TellMaxPut();
+		byte *pCopy = (byte *)malloc( nSize );
+		V_memcpy( pCopy, buf.Base(), nSize );
+		pBase = pCopy;
+	}
+
+	const MDLBundleHeader_t *pHeader = (const MDLBundleHeader_t *)pBase;
+	bool bValid = nSize >= (int)sizeof( MDLBundleHeader_t ) &&
+		pHeader->id == MDLBUNDLE_ID &&
+		pHeader->version == MDLBUNDLE_VERSION &&
+		pHeader->numEntries >= 0 &&
+		pHeader->entryOffset >= (int)sizeof( MDLBundleHeader_t ) &&
+		pHeader->entryOffset + pHeader->numEntries * (int)sizeof( MDLBundleEntry_t ) <= nSize &&
+		pHeader->stringOffset <= nSize &&
+		pHeader->blobOffset <= nSize;
+
+	const MDLBundleEntry_t *pEntries = (const MDLBundleEntry_t *)( pBase + ( bValid ? pHeader->entryOffset : 0 ) );
+	for ( int i = 0; bValid && i < pHeader->numEntries; i++ )
+	{
+		const MDLBundleEntry_t &entry = pEntries[i];
+		bValid = entry.nameOffset >= pHeader->stringOffset && entry.nameOffset < pHeader->blobOffset &&
+			entry.mdlOffset >= pHeader->blobOffset && entry.mdlSize > 0 && entry.mdlOffset + entry.mdlSize <= nSize &&
+			entry.vvdSize >= 0 && ( entry.vvdSize == 0 || ( entry.vvdOffset >= pHeader->blobOffset && entry.vvdOffset + entry.vvdSize <= nSize ) );
+	}
+
+	// A bundle cut short or changed after the bake can still have a sane directory
+	CRC32_t contentCRC = 0;
+	if ( bValid && mod_bundle_checkfiles.GetBool() )
+	{
+		contentCRC = CRC32_ProcessSingleBuffer( pBase + sizeof( MDLBundleHeader_t ), nSize - sizeof( MDLBundleHeader_t ) );
+	}
+	bool bIntact = !bValid || !mod_bundle_checkfiles.GetBool() || contentCRC == pHeader->contentCRC;
+
+	if ( !bValid || !bIntact )
+	{
+		if ( !bValid )
+		{
+			Warning( "Model bundle %s is not a valid version %d bundle, ignoring it\n", pszFileName, MDLBUNDLE_VERSION );
+		}
+		else
+		{
+			Warning( "Model bundle %s is damaged (content crc %08x, expected %08x), ignoring it\n", pszFileName, contentCRC, pHeader->contentCRC );
+		}
+#ifdef POSIX
+		if ( bMapped )
+		{
+			munmap( (void *)pBase, nSize );
+		}
+		else
+#endif
+		{
+			free( (void *)pBase );
+		}
+		return false;
+	}
+
+	m_pBase = pBase;
+	m_nSize = nSize;
+	m_bMapped = bMapped;
+	m_pHeader = pHeader;
+	m_pEntries = pEntries;
+	m_EntryState.SetCount( pHeader->numEntries );
+	V_memset( m_EntryState.Base(), ENTRY_UNCHECKED, m_EntryState.Count() );
+	m_FileName = pszFileName;
+	m_nHits = m_nMisses = m_nStale = 0;
+	++m_nLoadCount;
+
+	DevMsg( "Model bundle %s: %d models, %d KB%s\n", pszFileName, pHeader->numEntries, nSize / 1024, bMapped ? ", mapped" : "" );
+	return true;
+}
+
+void CMDLCacheBundle::Unload()
+{
+	AUTO_LOCK( m_mutex );
+
+	if ( !m_pBase )
+		return;
+
+#ifdef POSIX
+	if ( m_bMapped )
+	{
+		munmap( (void *)m_pBase, m_nSize );
+	}
+	else
+#endif
+	{
+		free( (void *)m_pBase );
+	}
+
+	m_pBase = NULL;
+	m_nSize = 0;
+	m_bMapped = false;
+	m_pHeader = NULL;
+	m_pEntries = NULL;
+	m_EntryState.Purge();
+	m_FileName.Clear();
+	++m_nLoadCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// Binary search on the name CRC, then a string compare to rule out collisions
+//-----------------------------------------------------------------------------
+int CMDLCacheBundle::Find( const char *pszName, CRC32_t nameCRC )
+{
+	int nLow = 0;
+	int nHigh = m_pHeader->numEntries - 1;
+	while ( nLow <= nHigh )
+	{
+		int nMid = ( nLow + nHigh ) / 2;
+		if ( m_pEntries[nMid].nameCRC < nameCRC )
+		{
+			nLow = nMid + 1;
+		}
+		else
+		{
+			nHigh = nMid - 1;
+		}
+	}
+
+	for ( int i = nLow; i < m_pHeader->numEntries && m_pEntries[i].nameCRC == nameCRC; i++ )
+	{
+		const char *pszEntryName = (const char *)( m_pBase + m_pEntries[i].nameOffset );
+		if ( !V_strncmp( pszEntryName, pszName, m_pHeader->blobOffset - m_pEntries[i].nameOffset ) )
+			return i;
+	}
+
+	return -1;
+}
+
+
+//-----------------------------------------------------------------------------
+// An entry is current if the files it was built from haven't changed.  Files
+// in a pack or VPK report no time, so for those only the CRC tells. Only
+// looks at its arguments, callers run it without the bundle locked.
+//-----------------------------------------------------------------------------
+bool CMDLCacheBundle::IsEntryCurrent( const MDLBundleEntry_t &entry, const char *pszModelName )
+{
+	if ( !mod_bundle_checkfiles.GetBool() )
+		return true;
+
+	char szFileName[MAX_PATH];
+	Q_strncpy( szFileName, pszModelName, sizeof( szFileName ) );
+
+	bool bCheckCRC = mod_bundle_checkfiles.GetInt() >= 2;
+	int64 mdlFileTime = (int64)g_pFullFileSystem->GetFileTime( szFileName, "GAME" );
+	if ( mdlFileTime != entry.mdlFileTime ||
+		(int)g_pFullFileSystem->Size( szFileName, "GAME" ) != entry.mdlFileSize )
+		return false;
+	if ( !mdlFileTime )
+	{
+		bCheckCRC = true;
+	}
+
+	if ( entry.vvdSize )
+	{
+		Q_SetExtension( szFileName, ".vvd", sizeof( szFileName ) );
+		int64 vvdFileTime = (int64)g_pFullFileSystem->GetFileTime( szFileName, "GAME" );
+		if ( vvdFileTime != entry.vvdFileTime ||
+			(int)g_pFullFileSystem->Size( szFileName, "GAME" ) != entry.vvdFileSize )
+			return false;
+		if ( !vvdFileTime )
+		{
+			bCheckCRC = true;
+		}
+	}
+
+	if ( !bCheckCRC )
+		return true;
+
+	// Same order as the bake: the .mdl, then the .vvd if it was baked
+	CRC32_t sourceCRC;
+	CRC32_Init( &sourceCRC );
+	CUtlBuffer buf;
+	Q_SetExtension( szFileName, ".mdl", sizeof( szFileName ) );
+	if ( !g_pFullFileSystem->ReadFile( szFileName, "GAME", buf ) )
+		return false;
+	CRC32_ProcessBuffer( &sourceCRC, buf.Base(), buf.TellMaxPut() );
+	if ( entry.vvdSize )
+	{
+		buf.Purge();
+		Q_SetExtension( szFileName, ".vvd", sizeof( szFileName ) );
+		if ( !g_pFullFileSystem->ReadFile( szFileName, "GAME", buf ) )
+			return false;
+		CRC32_ProcessBuffer( &sourceCRC, buf.Base(), buf.TellMaxPut() );
+	}
+	CRC32_Final( &sourceCRC );
+
+	return sourceCRC == entry.sourceCRC;
+}
+
+
+//-----------------------------------------------------------------------------
+// Lookup
+//-----------------------------------------------------------------------------
+const MDLBundleEntry_t *CMDLCacheBundle::LockEntry( const char *pszModelName )
+{
+	if ( !m_pBase )
+		return NULL;
+
+	char szName[MAX_PATH];
+	NormalizeName( pszModelName, szName, sizeof( szName ) );
+	CRC32_t nameCRC = CRC32_ProcessSingleBuffer( szName, V_strlen( szName ) );
+
+	m_mutex.Lock();
+
+	int i = m_pBase ? Find( szName, nameCRC ) : -1;
+	if ( i < 0 )
+	{
+		m_mutex.Unlock();
+		++m_nMisses;
+		return NULL;
+	}
+
+	// Stamps are checked once per entry per load of the bundle, and the result,
+	// CRC comparison included, kept in the entry state. The check can read the
+	// source files, so it runs unlocked on a copy of the entry; if the bundle
+	// was reloaded meanwhile the index is meaningless and the model is loaded
+	// from disk this time.
+	if ( m_EntryState[i] == ENTRY_UNCHECKED )
+	{
+		MDLBundleEntry_t entry = m_pEntries[i];
+		int nLoadCount = m_nLoadCount;
+		m_mutex.Unlock();
+
+		bool bCurrent = IsEntryCurrent( entry, szName );
+
+		m_mutex.Lock();
+		if ( m_nLoadCount != nLoadCount )
+		{
+			m_mutex.Unlock();
+			++m_nMisses;
+			return NULL;
+		}
+
+		if ( m_EntryState[i] == ENTRY_UNCHECKED )
+		{
+			m_EntryState[i] = bCurrent ? ENTRY_VALID : ENTRY_STALE;
+			if ( !bCurrent )
+			{
+				++m_nStale;
+				DevMsg( "Model bundle entry for %s is out of date, loading from disk\n", szName );
+			}
+		}
+	}
+
+	if ( m_EntryState[i] != ENTRY_VALID )
+	{
+		m_mutex.Unlock();
+		return NULL;
+	}
+
+	return &m_pEntries[i];
+}
+
+void CMDLCacheBundle::UnlockEntry()
+{
+	m_mutex.Unlock();
+}
+
+
+//-----------------------------------------------------------------------------
+// Reporting
+//-----------------------------------------------------------------------------
+void CMDLCacheBundle::PrintStatus()
+{
+	AUTO_LOCK( m_mutex );
+
+	if ( !m_pBase )
+	{
+		Msg( "No model bundle loaded\n" );
+		return;
+	}
+
+	Msg( "Model bundle %s: %d models, %d KB%s, content crc %08x\n", m_FileName.Get(), m_pHeader->numEntries,
+		m_nSize / 1024, m_bMapped ? " (mapped)" : "", m_pHeader->contentCRC );
+	Msg( "  %d hits, %d not in bundle, %d out of date\n", (int)m_nHits, (int)m_nMisses, (int)m_nStale );
+}
+
+
+//-----------------------------------------------------------------------------
+// Builder
+//-----------------------------------------------------------------------------
+static void PadBuffer( CUtlBuffer &buf, int nPut )
+{
+	// Zero fill rather than seek, so the file and its CRC are deterministic
+	while ( buf.TellPut() < nPut )
+	{
+		buf.PutUnsignedChar( 0 );
+	}
+}
+
+void CMDLCacheBundleBuilder::AddModel( const char *pszModelName, const MDLBundleEntry_t &stamps,
+	const void *pMdlData, int nMdlSize, const void *pVvdData, int nVvdSize )
+{
+	char szName[MAX_PATH];
+	CMDLCacheBundle::NormalizeName( pszModelName, szName, sizeof( szName ) );
+
+	MDLBundleEntry_t &entry = m_Entries[ m_Entries.AddToTail( stamps ) ];
+	entry.nameCRC = CRC32_ProcessSingleBuffer( szName, V_strlen( szName ) );
+	entry.unused = 0;
+
+	// Offsets are relative to the string table and blob area until Write
+	entry.nameOffset = m_Strings.TellPut();
+	m_Strings.PutString( szName );
+
+	PadBuffer( m_Blobs, AlignValue( m_Blobs.TellPut(), MDLBUNDLE_BLOB_ALIGN ) );
+	entry.mdlOffset = m_Blobs.TellPut();
+	entry.mdlSize = nMdlSize;
+	m_Blobs.Put( pMdlData, nMdlSize );
+
+	entry.vvdOffset = 0;
+	entry.vvdSize = 0;
+	if ( pVvdData && nVvdSize > 0 )
+	{
+		PadBuffer( m_Blobs, AlignValue( m_Blobs.TellPut(), MDLBUNDLE_BLOB_ALIGN ) );
+		entry.vvdOffset = m_Blobs.TellPut();
+		entry.vvdSize = nVvdSize;
+		m_Blobs.Put( pVvdData, nVvdSize );
+	}
+}
+
+static int __cdecl EntryNameCompare( const MDLBundleEntry_t *pLeft, const MDLBundleEntry_t *pRight )
+{
+	if ( pLeft->nameCRC != pRight->nameCRC )
+		return ( pLeft->nameCRC < pRight->nameCRC ) ? -1 : 1;
+	return 0;
+}
+
+bool CMDLCacheBundleBuilder::Write( const char *pszFileName, const char *pszPathID )
+{
+	m_Entries.Sort( EntryNameCompare );
+
+	MDLBundleHeader_t header;
+	V_memset( &header, 0, sizeof( header ) );
+	header.id = MDLBUNDLE_ID;
+	header.version = MDLBUNDLE_VERSION;
+	header.numEntries = m_Entries.Count();
+	header.entryOffset = sizeof( MDLBundleHeader_t );
+	header.stringOffset = header.entryOffset + m_Entries.Count() * sizeof( MDLBundleEntry_t );
+	header.blobOffset = AlignValue( header.stringOffset + m_Strings.TellPut(), MDLBUNDLE_BLOB_ALIGN );
+
+	for ( int i = 0; i < m_Entries.Count(); i++ )
+	{
+		m_Entries[i].nameOffset += header.stringOffset;
+		m_Entries[i].mdlOffset += header.blobOffset;
+		if ( m_Entries[i].vvdSize )
+		{
+			m_Entries[i].vvdOffset += header.blobOffset;
+		}
+	}
+
+	CUtlBuffer buf;
+	buf.Put( &header, sizeof( header ) );
+	buf.Put( m_Entries.Base(), m_Entries.Count() * sizeof( MDLBundleEntry_t ) );
+	buf.Put( m_Strings.Base(), m_Strings.TellPut() );
+	PadBuffer( buf, header.blobOffset );
+	buf.Put( m_Blobs.Base(), m_Blobs.TellPut() );
+
+	// The content hash identifies the bake, it is what status reports
+	MDLBundleHeader_t *pHeader = (MDLBundleHeader_t *)buf.Base();
+	pHeader->contentCRC = CRC32_ProcessSingleBuffer( (byte *)buf.Base() + sizeof( header ), buf.TellPut() - sizeof( header ) );
+
+	return g_pFullFileSystem->WriteFile( pszFileName, pszPathID, buf );
+}
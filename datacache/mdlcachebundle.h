@@ -0,0 +1,155 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Pre-baked model bundles. A bundle holds, per model, the studiohdr
+//			with flexes already converted and the vertex data after the root
+//			LOD / tangent fixup, so the model cache can copy them straight in
+//			instead of redoing that work on every load.
+//
+//===========================================================================//
+
+#ifndef MDLCACHEBUNDLE_H
+#define MDLCACHEBUNDLE_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/threadtools.h"
+#include "tier1/checksum_crc.h"
+#include "utlvector.h"
+#include "utlbuffer.h"
+#include "utlstring.h"
+
+
+//-----------------------------------------------------------------------------
+// File format
+//
+//	MDLBundleHeader_t
+//	MDLBundleEntry_t[numEntries], sorted by nameCRC
+//	string table
+//	blobs, each 32 byte aligned
+//-----------------------------------------------------------------------------
+#define MDLBUNDLE_ID				(('B'<<24)+('L'<<16)+('D'<<8)+'M')	// little-endian "MDLB"
+#define MDLBUNDLE_VERSION			1
+#define MDLBUNDLE_BLOB_ALIGN		32
+
+#define MDLBUNDLE_DEFAULT_FILENAME	"models.mdlbundle"
+
+enum
+{
+	MDLBUNDLE_VVD_TANGENTS	= 0x0001,	// Vertex data was built with tangentS
+};
+
+struct MDLBundleHeader_t
+{
+	int			id;
+	int			version;
+	int			numEntries;
+	int			entryOffset;
+	int			stringOffset;
+	int			blobOffset;
+	CRC32_t		contentCRC;		// Of everything after the header
+	int			unused;
+};
+
+struct MDLBundleEntry_t
+{
+	CRC32_t		nameCRC;		// Of the normalized .mdl path
+	int			nameOffset;		// Into the string table
+	CRC32_t		sourceCRC;		// Of the raw .mdl and .vvd the blobs were built from
+	int			studioChecksum;
+
+	int64		mdlFileTime;	// Source file stamps, checked before an entry is used
+	int64		vvdFileTime;
+	int			mdlFileSize;
+	int			vvdFileSize;
+
+	int			mdlOffset;		// Relative to the start of the file
+	int			mdlSize;
+	int			vvdOffset;
+	int			vvdSize;		// 0 if the model has no vertex data
+	short		vvdRootLOD;
+	short		vvdFlags;		// MDLBUNDLE_VVD_xxx
+	int			unused;
+};
+
+
+//-----------------------------------------------------------------------------
+// CMDLCacheBundle
+//
+// Purpose: Read side. The file is mapped (or read, where mapping is not
+//			available) once; lookups are a binary search on the name CRC.
+//			Entries whose source files changed since the bake are ignored.
+//-----------------------------------------------------------------------------
+class CMDLCacheBundle
+{
+public:
+	CMDLCacheBundle();
+	~CMDLCacheBundle();
+
+	bool Load( const char *pszFileName, const char *pszPathID );
+	void Unload();
+	bool IsLoaded()								{ return m_pBase != NULL; }
+
+	// Returns the entry for the model with the bundle locked, or NULL (unlocked)
+	// if the model is not in the bundle or is out of date. Call UnlockEntry when
+	// done with the entry and its blobs.
+	const MDLBundleEntry_t *LockEntry( const char *pszModelName );
+	void UnlockEntry();
+	const void *GetBlob( int nOffset )			{ return m_pBase + nOffset; }
+
+	void NoteHit()								{ ++m_nHits; }
+	void PrintStatus();
+
+	static void NormalizeName( const char *pszModelName, char *pszOut, int nMaxLength );
+
+private:
+	enum
+	{
+		ENTRY_UNCHECKED,
+		ENTRY_VALID,
+		ENTRY_STALE,
+	};
+
+	int Find( const char *pszName, CRC32_t nameCRC );
+	static bool IsEntryCurrent( const MDLBundleEntry_t &entry, const char *pszModelName );
+
+	const byte					*m_pBase;
+	int							m_nSize;
+	bool						m_bMapped;
+	const MDLBundleHeader_t		*m_pHeader;
+	const MDLBundleEntry_t		*m_pEntries;
+	CUtlVector<unsigned char>	m_EntryState;
+	CUtlString					m_FileName;
+	CThreadFastMutex			m_mutex;
+	int							m_nLoadCount;	// Bumped by Load and Unload, under m_mutex
+
+	CInterlockedInt				m_nHits;
+	CInterlockedInt				m_nMisses;
+	CInterlockedInt				m_nStale;
+};
+
+
+//-----------------------------------------------------------------------------
+// CMDLCacheBundleBuilder
+//
+// Purpose: Write side, used by the bake command.
+//-----------------------------------------------------------------------------
+class CMDLCacheBundleBuilder
+{
+public:
+	// pVvdData may be NULL for models without vertex data
+	void AddModel( const char *pszModelName, const MDLBundleEntry_t &stamps,
+		const void *pMdlData, int nMdlSize, const void *pVvdData, int nVvdSize );
+	bool Write( const char *pszFileName, const char *pszPathID );
+
+	int Count()									{ return m_Entries.Count(); }
+
+private:
+	CUtlVector<MDLBundleEntry_t>	m_Entries;
+	CUtlBuffer						m_Strings;
+	CUtlBuffer						m_Blobs;
+};
+
+
+#endif // MDLCACHEBUNDLE_H
@@ -0,0 +1,290 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Decoded animation sections, see mdldecodedanim.h
+//
+//===========================================================================//
+
+#include "mdldecodedanim.h"
+#include "studio.h"
+#include "convar.h"
+#include "tier1/strtools.h"
+#include "tier3/tier3.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static CMDLDecodedAnimCache *s_pDecodedAnimCache;
+
+static void DecodedAnimBudgetChanged( IConVar *pConVar, const char *pOldValue, float flOldValue );
+static ConVar mod_decoded_anim_budget( "mod_decoded_anim_budget", "8", 0, "Memory in MB for per-frame animation tables used by bone setup, 0 disables them.", true, 0, false, 0, DecodedAnimBudgetChanged );
+
+static void DecodedAnimBudgetChanged( IConVar *pConVar, const char *pOldValue, float flOldValue )
+{
+	if ( s_pDecodedAnimCache )
+	{
+		s_pDecodedAnimCache->SetBudget( mod_decoded_anim_budget.GetInt() );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Init/Shutdown
+//-----------------------------------------------------------------------------
+CMDLDecodedAnimCache::CMDLDecodedAnimCache()
+{
+	m_pSection = NULL;
+}
+
+void CMDLDecodedAnimCache::Init()
+{
+	if ( !m_pSection )
+	{
+		m_pSection = g_pDataCache->AddSection( this, MODEL_CACHE_DECODEDANIM_SECTION_NAME, DataCacheLimits_t(), true );
+		s_pDecodedAnimCache = this;
+		SetBudget( mod_decoded_anim_budget.GetInt() );
+	}
+}
+
+void CMDLDecodedAnimCache::Shutdown()
+{
+	if ( m_pSection )
+	{
+		s_pDecodedAnimCache = NULL;
+		g_pDataCache->RemoveSection( MODEL_CACHE_DECODEDANIM_SECTION_NAME );
+		m_pSection = NULL;
+	}
+}
+
+void CMDLDecodedAnimCache::SetBudget( int nMegabytes )
+{
+	if ( !m_pSection )
+		return;
+
+	if ( nMegabytes <= 0 )
+	{
+		// Get() stops handing sections out, whatever is still locked goes at the end of the frame
+		m_pSection->Flush();
+		return;
+	}
+
+	DataCacheLimits_t limits( (unsigned)nMegabytes * 1024 * 1024, (unsigned)-1, 0, 0 );
+	m_pSection->SetLimits( limits );
+}
+
+void CMDLDecodedAnimCache::Flush()
+{
+	if ( m_pSection )
+	{
+		m_pSection->Flush();
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Frame locking
+//-----------------------------------------------------------------------------
+void CMDLDecodedAnimCache::BeginLock()
+{
+	if ( m_pSection )
+	{
+		m_pSection->BeginFrameLocking();
+	}
+}
+
+void CMDLDecodedAnimCache::EndLock()
+{
+	if ( m_pSection )
+	{
+		m_pSection->EndFrameLocking();
+	}
+}
+
+int CMDLDecodedAnimCache::BreakLock()
+{
+	int nLocks = 0;
+	if ( m_pSection && m_pSection->IsFrameLocking() )
+	{
+		do
+		{
+			nLocks++;
+		} while ( m_pSection->EndFrameLocking() );
+	}
+	return nLocks;
+}
+
+void CMDLDecodedAnimCache::RestoreLock( int nLocks )
+{
+	while ( nLocks-- > 0 )
+	{
+		m_pSection->BeginFrameLocking();
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Lookup
+//-----------------------------------------------------------------------------
+static DataCacheClientID_t DecodedAnimID( int checksum, int iAnim, int iSection )
+{
+	uint64 key = ( (uint64)(uint32)checksum << 32 ) | ( (uint32)( iAnim & 0xFFFF ) << 16 ) | (uint32)( iSection & 0xFFFF );
+	if ( sizeof( DataCacheClientID_t ) < sizeof( uint64 ) )
+	{
+		// Collisions are caught by the fields Find compares
+		key ^= key >> 32;
+	}
+	return (DataCacheClientID_t)key;
+}
+
+//-----------------------------------------------------------------------------
+// The section CRC is taken once, when the table is built. A lookup passing
+// the section it was built from is a hit; one at another address (the anim
+// block was reloaded) is only checked with bLocked, under m_BuildMutex, which
+// also repoints the table when the data is the same.
+//-----------------------------------------------------------------------------
+const studiodecodedanim_t *CMDLDecodedAnimCache::Find( DataCacheClientID_t id, int checksum, int iAnim, int iSection, const mstudioanim_t *panim, bool bLocked )
+{
+	DataCacheHandle_t hDecoded = m_pSection->Find( id );
+	if ( hDecoded == DC_INVALID_HANDLE )
+		return NULL;
+
+	studiodecodedanim_t *pDecoded = (studiodecodedanim_t *)m_pSection->Get( hDecoded, true );
+	if ( !pDecoded )
+		return NULL;
+
+	// Another section sharing the id, or the same one reloaded with different data
+	bool bStale = pDecoded->checksum != checksum || pDecoded->anim != iAnim || pDecoded->section != iSection;
+	if ( !bStale && pDecoded->source != panim )
+	{
+		if ( !bLocked )
+			return NULL;
+
+		bStale = ( pDecoded->sourcecrc != Studio_AnimSectionCRC( panim ) );
+		if ( !bStale )
+		{
+			pDecoded->source = panim;
+		}
+	}
+
+	if ( bStale )
+	{
+		if ( bLocked )
+		{
+			const void *pItemData;
+			if ( m_pSection->Remove( hDecoded, &pItemData ) == DC_OK )
+			{
+				Studio_FreeDecodedAnimation( (studiodecodedanim_t *)pItemData );
+			}
+		}
+		return NULL;
+	}
+
+	return pDecoded;
+}
+
+const studiodecodedanim_t *CMDLDecodedAnimCache::Get( const mstudioanimdesc_t &animdesc, int iSection, const mstudioanim_t *panim )
+{
+	if ( !m_pSection || !panim || mod_decoded_anim_budget.GetInt() <= 0 || !m_pSection->IsFrameLocking() )
+		return NULL;
+
+	const studiohdr_t *pStudioHdr = animdesc.pStudiohdr();
+	int checksum = pStudioHdr->checksum;
+	int iAnim = &animdesc - pStudioHdr->pLocalAnimdesc( 0 );
+	DataCacheClientID_t id = DecodedAnimID( checksum, iAnim, iSection );
+
+	const studiodecodedanim_t *pDecoded = Find( id, checksum, iAnim, iSection, panim, false );
+	if ( pDecoded )
+	{
+		++m_nHits;
+		return pDecoded;
+	}
+
+	AUTO_LOCK( m_BuildMutex );
+
+	// Another thread may have built it while this one waited
+	pDecoded = Find( id, checksum, iAnim, iSection, panim, true );
+	if ( pDecoded )
+	{
+		++m_nHits;
+		return pDecoded;
+	}
+
+	// A stale entry that couldn't be removed still holds the id
+	if ( m_pSection->Find( id ) != DC_INVALID_HANDLE )
+		return NULL;
+
+	double flStart = Plat_FloatTime();
+	studiodecodedanim_t *pNew = Studio_DecodeAnimation( animdesc, iSection, panim );
+	if ( !pNew )
+		return NULL;
+
+	DataCacheHandle_t hDecoded;
+	if ( !m_pSection->Add( id, pNew, pNew->size, &hDecoded ) )
+	{
+		Studio_FreeDecodedAnimation( pNew );
+		return NULL;
+	}
+
+	++m_nBuilds;
+	m_nBuildMicroseconds += (int)( ( Plat_FloatTime() - flStart ) * 1000000.0 );
+
+	// NULL if it didn't fit in the budget and was evicted right away
+	return (const studiodecodedanim_t *)m_pSection->Get( hDecoded, true );
+}
+
+
+//-----------------------------------------------------------------------------
+// IDataCacheClient
+//-----------------------------------------------------------------------------
+bool CMDLDecodedAnimCache::HandleCacheNotification( const DataCacheNotification_t &notification )
+{
+	switch ( notification.type )
+	{
+	case DC_AGE_DISCARD:
+	case DC_FLUSH_DISCARD:
+	case DC_REMOVED:
+		Studio_FreeDecodedAnimation( (studiodecodedanim_t *)notification.pItemData );
+		return true;
+	}
+
+	return CDefaultDataCacheClient::HandleCacheNotification( notification );
+}
+
+bool CMDLDecodedAnimCache::GetItemName( DataCacheClientID_t clientId, const void *pItem, char *pDest, unsigned nMaxLen )
+{
+	const studiodecodedanim_t *pDecoded = (const studiodecodedanim_t *)pItem;
+	Q_snprintf( pDest, nMaxLen, "decoded anim %08x:%d:%d - %d bones, %d frames", pDecoded->checksum, pDecoded->anim, pDecoded->section, pDecoded->numbones, pDecoded->numframes );
+	return true;
+}
+
+void CMDLDecodedAnimCache::PrintStatus()
+{
+	if ( !m_pSection )
+	{
+		Msg( "Decoded animation cache not initialized\n" );
+		return;
+	}
+
+	DataCacheStatus_t status;
+	DataCacheLimits_t limits;
+	m_pSection->GetStatus( &status, &limits );
+
+	int nBuilds = m_nBuilds;
+	Msg( "Decoded animations: %u sections, %u KB of %u KB\n", status.nItems, status.nBytes / 1024, limits.nMaxBytes / 1024 );
+	Msg( "  %d hits, %d built (%.1f us each)\n", (int)m_nHits, nBuilds, nBuilds ? (float)m_nBuildMicroseconds / nBuilds : 0.0f );
+}
+
+CON_COMMAND( mdlcache_decodedanim_status, "Reports the size and use of the decoded animation cache" )
+{
+	if ( s_pDecodedAnimCache )
+	{
+		s_pDecodedAnimCache->PrintStatus();
+	}
+}
+
+CON_COMMAND( mdlcache_decodedanim_flush, "Frees every unlocked decoded animation section" )
+{
+	if ( s_pDecodedAnimCache )
+	{
+		s_pDecodedAnimCache->Flush();
+	}
+}
@@ -0,0 +1,74 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Decoded animation sections. Bone setup asks the model cache for
+//			per-frame tables of the sections it evaluates (studiodecodedanim_t)
+//			so frame lookups don't walk the run-length spans of every track.
+//
+//===========================================================================//
+
+#ifndef MDLDECODEDANIM_H
+#define MDLDECODEDANIM_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "datacache/idatacache.h"
+#include "tier0/threadtools.h"
+
+struct mstudioanimdesc_t;
+struct mstudioanim_t;
+struct studiodecodedanim_t;
+
+#define MODEL_CACHE_DECODEDANIM_SECTION_NAME	"DecodedAnim"
+
+
+//-----------------------------------------------------------------------------
+// CMDLDecodedAnimCache
+//
+// Purpose: Owns the data cache section holding the decoded sections, keyed
+//			by the checksum of the owning model, the animation and the
+//			section. Entries also record a checksum of the source section,
+//			so a model reloaded with different data is rebuilt rather than
+//			read from the old table. Nothing has to be flushed when models
+//			unload; stale entries simply age out.
+//-----------------------------------------------------------------------------
+class CMDLDecodedAnimCache : public CDefaultDataCacheClient
+{
+public:
+	CMDLDecodedAnimCache();
+
+	void Init();
+	void Shutdown();
+
+	// Returns the decoded section, building it if needed. The result is frame
+	// locked, so only callers inside BeginLock/EndLock get one.
+	const studiodecodedanim_t *Get( const mstudioanimdesc_t &animdesc, int iSection, const mstudioanim_t *panim );
+
+	// Frame locking follows the model data section, see CMDLCache::BeginLock
+	void BeginLock();
+	void EndLock();
+	int BreakLock();
+	void RestoreLock( int nLocks );
+
+	void SetBudget( int nMegabytes );
+	void Flush();
+	void PrintStatus();
+
+	// Inherited from IDataCacheClient
+	virtual bool HandleCacheNotification( const DataCacheNotification_t &notification );
+	virtual bool GetItemName( DataCacheClientID_t clientId, const void *pItem, char *pDest, unsigned nMaxLen );
+
+private:
+	const studiodecodedanim_t *Find( DataCacheClientID_t id, int checksum, int iAnim, int iSection, const mstudioanim_t *panim, bool bLocked );
+
+	IDataCacheSection	*m_pSection;
+	CThreadFastMutex	m_BuildMutex;
+
+	CInterlockedInt		m_nHits;
+	CInterlockedInt		m_nBuilds;
+	CInterlockedInt		m_nBuildMicroseconds;
+};
+
+
+#endif // MDLDECODEDANIM_H
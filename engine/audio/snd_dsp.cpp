@@ -14,6 +14,16 @@
 #include "iprediction.h"
 #include "common.h"		// for parsing routines
 #include "vstdlib/random.h"
+#include "voice_wavefile.h"
+
+#if defined( __arm__ ) || defined( __aarch64__ )
+#include "sse2neon.h"
+#define DSP_BLOCK_SIMD
+#elif !defined( _X360 ) && !defined( _PS3 )
+#include <emmintrin.h>
+#define DSP_BLOCK_SIMD
+#endif
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -707,6 +717,163 @@ typedef void (*prc_Mod_t) (void *pdata, float v);				// modulation function for
 #define OP_RIGHT			1		// batch process right channel in place
 #define OP_LEFT_DUPLICATE	2		// batch process left channel in place, duplicate to right channel
 
+/////////////////////////////////
+// Block processing
+/////////////////////////////////
+
+// Processors with a batch GetNextN run a paintbuffer channel in blocks of up to
+// DSP_BLOCK_SIZE samples: the channel is copied into an int span, the processor runs
+// over the whole span with its type switch and params hoisted out of the sample loop,
+// and the span is copied back. Delays run as long contiguous stretches of the delay
+// line, 4 samples at a time with SSE2 where the taps allow. The block routines do the
+// same integer math in the same order as the per sample routines, so their output is
+// bit exact. dsp_block 0 runs the per sample routines instead.
+
+#define DSP_BLOCK_SIZE		256
+
+ConVar dsp_block( "dsp_block", "1", 0, "Process batch dsp presets in blocks. 0 - process per sample (reference path)." );
+
+typedef void (*prc_Block_t) ( void *pdata, int *pspan, int count );	// process a span of one channel in place
+
+// run pfnBlock over one channel of pbuffer, one span at a time
+
+inline void DSP_ProcessBlocks( prc_Block_t pfnBlock, void *pdata, portable_samplepair_t *pbuffer, int SampleCount, int op )
+{
+	int span[DSP_BLOCK_SIZE];
+
+	for ( int i = 0; i < SampleCount; i += DSP_BLOCK_SIZE )
+	{
+		portable_samplepair_t *pb = pbuffer + i;
+		int count = min( SampleCount - i, DSP_BLOCK_SIZE );
+		int k;
+
+		if ( op == OP_RIGHT )
+		{
+			for ( k = 0; k < count; k++ )
+				span[k] = pb[k].right;
+		}
+		else
+		{
+			for ( k = 0; k < count; k++ )
+				span[k] = pb[k].left;
+		}
+
+		pfnBlock( pdata, span, count );
+
+		switch ( op )
+		{
+		default:
+		case OP_LEFT:
+			for ( k = 0; k < count; k++ )
+				pb[k].left = span[k];
+			break;
+		case OP_RIGHT:
+			for ( k = 0; k < count; k++ )
+				pb[k].right = span[k];
+			break;
+		case OP_LEFT_DUPLICATE:
+			for ( k = 0; k < count; k++ )
+				pb[k].left = pb[k].right = span[k];
+			break;
+		}
+	}
+}
+
+// address GetDly reads tap tdelay from
+
+inline int *GetDlyPtr ( int dlysize, int *psamps, int *psamp, int tdelay )
+{
+	int *pout = psamp + tdelay;
+
+	if ( pout <= (psamps + dlysize) )
+		return pout;
+	else
+		return pout - dlysize - 1;
+}
+
+// Number of samples, up to count, that can be run from the delay pointer psamp with a
+// tap at pD without wrapping the pointer or the tap. The delay line runs backwards, so
+// sample k of the run writes psamp[-k] and reads pD[-k]. The run is also no longer than
+// tdelay, so it never reads a sample it wrote itself. A tap of 0 reads each sample
+// before it is written.
+
+inline int DlyBlockRun ( int *psamps, int *psamp, int *pD, int tdelay, int count )
+{
+	int n = min( count, (int)(psamp - psamps) + 1 );
+
+	n = min( n, (int)(pD - psamps) + 1 );
+
+	if ( tdelay > 0 )
+		n = min( n, tdelay );
+
+	return n;
+}
+
+// move the delay pointer back n samples, n <= distance to the wrap
+
+inline void DlyBlockUpdate ( int dlysize, int *psamps, int **ppsamp, int n )
+{
+	(*ppsamp) -= n;
+	DlyPtrReverse ( dlysize, psamps, ppsamp );
+}
+
+// IIRFilter_Update_Order1 over a span in place. The early out in IIRFilter_Update_Order1
+// returns what the full update would, so it is left out here.
+
+inline void IIRFilter_Update_Order1_Block ( int *denom, int *numer, int *psamp, int *pspan, int count )
+{
+	int a1 = denom[1];
+	int b0 = numer[0];
+	int b1 = numer[1];
+	int w1 = psamp[1];
+
+	if ( count <= 0 )
+		return;
+
+	for ( int k = 0; k < count; k++ )
+	{
+		int w0 = pspan[k] - (( a1 * w1 ) >> PBITS);
+
+		pspan[k] = ( ( b1 * w1 ) + ( b0 * w0 ) ) >> PBITS;
+		w1 = w0;
+	}
+
+	psamp[0] = psamp[1] = w1;
+}
+
+#if defined( DSP_BLOCK_SIMD )
+
+// low 32 bits of a * b in each lane, as int * int - SSE2 has no pmulld
+
+inline __m128i DSP_MulLo4( __m128i a, __m128i b )
+{
+	__m128i even = _mm_mul_epu32( a, b );
+	__m128i odd = _mm_mul_epu32( _mm_srli_epi64( a, 32 ), _mm_srli_epi64( b, 32 ) );
+
+	return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0, 0, 2, 0 ) ), _mm_shuffle_epi32( odd, _MM_SHUFFLE( 0, 0, 2, 0 ) ) );
+}
+
+// ( gain * x ) >> PBITS in each lane
+
+inline __m128i DSP_Gain4( __m128i gain, __m128i x )
+{
+	return _mm_srai_epi32( DSP_MulLo4( gain, x ), PBITS );
+}
+
+// 4 samples of a delay line run, in time order: p[0], p[-1], p[-2], p[-3]
+
+inline __m128i DlyLoad4( const int *p )
+{
+	return _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *)(p - 3) ), _MM_SHUFFLE( 0, 1, 2, 3 ) );
+}
+
+inline void DlyStore4( int *p, __m128i x )
+{
+	_mm_storeu_si128( (__m128i *)(p - 3), _mm_shuffle_epi32( x, _MM_SHUFFLE( 0, 1, 2, 3 ) ) );
+}
+
+#endif // DSP_BLOCK_SIMD
+
 #define PRC_NULL			0		// pass through - must be 0
 #define PRC_DLY				1		// simple feedback reverb
 #define PRC_RVA				2		// parallel reverbs
@@ -1092,6 +1259,26 @@ inline int FLT_GetNext ( flt_t *pf, int  x )
 	}
 }
 
+// block version of FLT_GetNext - each series section runs over the whole span in turn
+
+inline void FLT_GetNextBlock ( flt_t *pf, int *pspan, int count )
+{
+	IIRFilter_Update_Order1_Block( pf->a, pf->b, pf->w, pspan, count );
+
+	// FLT_GetNext runs only the first section for any N outside 1..3
+
+	if ( pf->N < 1 || pf->N > 3 )
+		return;
+
+	IIRFilter_Update_Order1_Block( pf->pf1->a, pf->pf1->b, pf->pf1->w, pspan, count );
+
+	if ( pf->N >= 2 )
+		IIRFilter_Update_Order1_Block( pf->pf2->a, pf->pf2->b, pf->pf2->w, pspan, count );
+
+	if ( pf->N >= 3 )
+		IIRFilter_Update_Order1_Block( pf->pf3->a, pf->pf3->b, pf->pf3->w, pspan, count );
+}
+
 // batch version for performance
 
 inline void FLT_GetNextN( flt_t *pflt, portable_samplepair_t *pbuffer, int SampleCount, int op )
@@ -1099,6 +1286,12 @@ inline void FLT_GetNextN( flt_t *pflt, portable_samplepair_t *pbuffer, int Sampl
 	int count = SampleCount;
 	portable_samplepair_t *pb = pbuffer;
 	
+	if ( dsp_block.GetBool() )
+	{
+		DSP_ProcessBlocks( (prc_Block_t)FLT_GetNextBlock, pflt, pbuffer, SampleCount, op );
+		return;
+	}
+
 	switch (op)
 	{
 	default:
@@ -1712,16 +1905,355 @@ inline int DLY_GetNextXfade ( dly_t *pdly, int x )
 	}		
 }
 
+// Block versions of the delay routines. Each runs count <= DSP_BLOCK_SIZE samples from
+// pin to pout, which may be the same span. Every contiguous run of the delay line is
+// done 4 samples at a time where it can be, feedback filters run as a separate pass
+// over the run since a run never reads its own output.
+
+// ( gain * x ) >> PBITS over a span in place
+
+inline void DSP_GainBlock ( int *pspan, int gain, int count )
+{
+	int k = 0;
+
+#if defined( DSP_BLOCK_SIMD )
+	__m128i gain4 = _mm_set1_epi32( gain );
+
+	for ( ; k + 4 <= count; k += 4 )
+		_mm_storeu_si128( (__m128i *)(pspan + k), DSP_Gain4( gain4, _mm_loadu_si128( (const __m128i *)(pspan + k) ) ) );
+#endif
+
+	for ( ; k < count; k++ )
+		pspan[k] = (pspan[k] * gain) >> PBITS;
+}
+
+// ReverbSimple
+
+inline void ReverbSimple_Block ( dly_t *pdly, const int *pin, int *pout, int count )
+{
+	int D = pdly->D;
+	int t = pdly->t;
+	int *w = pdly->w;
+	int fbgain = pdly->a;
+	int outgain = pdly->b;
+
+	while ( count > 0 )
+	{
+		int *p = pdly->p;
+		int *pD = GetDlyPtr( D, w, p, t );
+		int n = DlyBlockRun( w, p, pD, t, count );
+		int k = 0;
+
+#if defined( DSP_BLOCK_SIMD )
+		__m128i fbgain4 = _mm_set1_epi32( fbgain );
+		__m128i outgain4 = _mm_set1_epi32( outgain );
+
+		for ( ; k + 4 <= n; k += 4 )
+		{
+			__m128i out = _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(pin + k) ), DSP_Gain4( fbgain4, DlyLoad4( pD - k ) ) );
+
+			DlyStore4( p - k, out );
+			_mm_storeu_si128( (__m128i *)(pout + k), DSP_Gain4( outgain4, out ) );
+		}
+#endif
+
+		for ( ; k < n; k++ )
+		{
+			int out = pin[k] + (( fbgain * pD[-k] ) >> PBITS);
+
+			p[-k] = out;
+			pout[k] = (out * outgain) >> PBITS;
+		}
+
+		DlyBlockUpdate( D, w, &pdly->p, n );
+
+		pin += n;
+		pout += n;
+		count -= n;
+	}
+}
+
+// DelayAllpass
+
+inline void DelayAllpass_Block ( dly_t *pdly, const int *pin, int *pout, int count )
+{
+	int D = pdly->D;
+	int t = pdly->t;
+	int *w = pdly->w;
+	int fbgain = pdly->a;
+	int outgain = pdly->b;
+
+	while ( count > 0 )
+	{
+		int *p = pdly->p;
+		int *pD = GetDlyPtr( D, w, p, t );
+		int n = DlyBlockRun( w, p, pD, t, count );
+		int k = 0;
+
+#if defined( DSP_BLOCK_SIMD )
+		__m128i fbgain4 = _mm_set1_epi32( fbgain );
+		__m128i nfbgain4 = _mm_set1_epi32( -fbgain );
+		__m128i outgain4 = _mm_set1_epi32( outgain );
+
+		for ( ; k + 4 <= n; k += 4 )
+		{
+			__m128i sD = DlyLoad4( pD - k );
+			__m128i s0 = _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(pin + k) ), DSP_Gain4( fbgain4, sD ) );
+			__m128i out = _mm_add_epi32( DSP_Gain4( nfbgain4, s0 ), sD );
+
+			DlyStore4( p - k, s0 );
+			_mm_storeu_si128( (__m128i *)(pout + k), DSP_Gain4( outgain4, out ) );
+		}
+#endif
+
+		for ( ; k < n; k++ )
+		{
+			int sD = pD[-k];
+			int s0 = pin[k] + (( fbgain * sD ) >> PBITS);
+			int out = ( ( -fbgain * s0 ) >> PBITS ) + sD;
+
+			p[-k] = s0;
+			pout[k] = (out * outgain) >> PBITS;
+		}
+
+		DlyBlockUpdate( D, w, &pdly->p, n );
+
+		pin += n;
+		pout += n;
+		count -= n;
+	}
+}
+
+// DelayLinear
+
+inline void DelayLinear_Block ( dly_t *pdly, const int *pin, int *pout, int count )
+{
+	int D = pdly->D;
+	int t = pdly->t;
+	int *w = pdly->w;
+
+	while ( count > 0 )
+	{
+		int *p = pdly->p;
+		int *pD = GetDlyPtr( D, w, p, t );
+		int n = DlyBlockRun( w, p, pD, t, count );
+		int k = 0;
+
+#if defined( DSP_BLOCK_SIMD )
+		for ( ; k + 4 <= n; k += 4 )
+		{
+			__m128i sD = DlyLoad4( pD - k );
+
+			DlyStore4( p - k, _mm_loadu_si128( (const __m128i *)(pin + k) ) );
+			_mm_storeu_si128( (__m128i *)(pout + k), sD );
+		}
+#endif
+
+		for ( ; k < n; k++ )
+		{
+			int sD = pD[-k];
+
+			p[-k] = pin[k];
+			pout[k] = sD;
+		}
+
+		DlyBlockUpdate( D, w, &pdly->p, n );
+
+		pin += n;
+		pout += n;
+		count -= n;
+	}
+}
+
+// DelayLinear_lowpass - the filter and gain are on the delay output, outside the delay line
+
+inline void DelayLinear_lowpass_Block ( dly_t *pdly, const int *pin, int *pout, int count )
+{
+	DelayLinear_Block( pdly, pin, pout, count );
+	IIRFilter_Update_Order1_Block( pdly->pflt->a, pdly->pflt->b, pdly->pflt->w, pout, count );
+	DSP_GainBlock( pout, pdly->b, count );
+}
+
+// DelayLowpass
+
+inline void DelayLowpass_Block ( dly_t *pdly, const int *pin, int *pout, int count )
+{
+	int D = pdly->D;
+	int t = pdly->t;
+	int *w = pdly->w;
+	int outgain = pdly->b;
+	flt_t *pflt = pdly->pflt;
+	int filt[DSP_BLOCK_SIZE];
+
+	Assert( count <= DSP_BLOCK_SIZE );
+
+	while ( count > 0 )
+	{
+		int *p = pdly->p;
+		int *pD = GetDlyPtr( D, w, p, t );
+		int n = DlyBlockRun( w, p, pD, t, count );
+		int k;
+
+		// filter the delay output for the whole run
+
+		for ( k = 0; k < n; k++ )
+			filt[k] = pD[-k];
+
+		IIRFilter_Update_Order1_Block( pflt->a, pflt->b, pflt->w, filt, n );
+
+		k = 0;
+
+#if defined( DSP_BLOCK_SIMD )
+		__m128i outgain4 = _mm_set1_epi32( outgain );
+
+		for ( ; k + 4 <= n; k += 4 )
+		{
+			__m128i out = _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(pin + k) ), _mm_loadu_si128( (const __m128i *)(filt + k) ) );
+
+			DlyStore4( p - k, out );
+			_mm_storeu_si128( (__m128i *)(pout + k), DSP_Gain4( outgain4, out ) );
+		}
+#endif
+
+		for ( ; k < n; k++ )
+		{
+			int out = pin[k] + filt[k];
+
+			p[-k] = out;
+			pout[k] = (out * outgain) >> PBITS;
+		}
+
+		DlyBlockUpdate( D, w, &pdly->p, n );
+
+		pin += n;
+		pout += n;
+		count -= n;
+	}
+}
+
+// ReverbSimple_multitap and DelayLowpass_multitap. The feedback tap is t3, through the
+// filter if pflt is set.
+
+inline void DelayMultitap_Block ( dly_t *pdly, flt_t *pflt, const int *pin, int *pout, int count )
+{
+	int D = pdly->D;
+	int *w = pdly->w;
+	int fbgain = pdly->a;
+	int outgain = pdly->b;
+	int fb[DSP_BLOCK_SIZE];
+
+	Assert( count <= DSP_BLOCK_SIZE );
+
+	while ( count > 0 )
+	{
+		int *p = pdly->p;
+		int *pD0 = GetDlyPtr( D, w, p, pdly->t );
+		int *pD1 = GetDlyPtr( D, w, p, pdly->t1 );
+		int *pD2 = GetDlyPtr( D, w, p, pdly->t2 );
+		int *pD3 = GetDlyPtr( D, w, p, pdly->t3 );
+		int n = DlyBlockRun( w, p, pD0, pdly->t, count );
+		int k;
+
+		n = DlyBlockRun( w, p, pD1, pdly->t1, n );
+		n = DlyBlockRun( w, p, pD2, pdly->t2, n );
+		n = DlyBlockRun( w, p, pD3, pdly->t3, n );
+
+		// feedback into the delay line for the whole run
+
+		if ( pflt )
+		{
+			for ( k = 0; k < n; k++ )
+				fb[k] = pD3[-k];
+
+			IIRFilter_Update_Order1_Block( pflt->a, pflt->b, pflt->w, fb, n );
+		}
+		else
+		{
+			for ( k = 0; k < n; k++ )
+				fb[k] = (pD3[-k] * fbgain) >> PBITS;
+		}
+
+		k = 0;
+
+#if defined( DSP_BLOCK_SIMD )
+		__m128i outgain4 = _mm_set1_epi32( outgain );
+
+		for ( ; k + 4 <= n; k += 4 )
+		{
+			__m128i in = _mm_loadu_si128( (const __m128i *)(pin + k) );
+			__m128i sum = _mm_add_epi32( _mm_add_epi32( DlyLoad4( pD0 - k ), DlyLoad4( pD1 - k ) ), _mm_add_epi32( DlyLoad4( pD2 - k ), DlyLoad4( pD3 - k ) ) );
+
+			DlyStore4( p - k, _mm_add_epi32( in, _mm_loadu_si128( (const __m128i *)(fb + k) ) ) );
+			_mm_storeu_si128( (__m128i *)(pout + k), DSP_Gain4( outgain4, _mm_add_epi32( sum, in ) ) );
+		}
+#endif
+
+		for ( ; k < n; k++ )
+		{
+			int in = pin[k];
+			int sum = pD0[-k] + pD1[-k] + pD2[-k] + pD3[-k];
+
+			p[-k] = in + fb[k];
+			pout[k] = ((sum + in) * outgain) >> PBITS;
+		}
+
+		DlyBlockUpdate( D, w, &pdly->p, n );
+
+		pin += n;
+		pout += n;
+		count -= n;
+	}
+}
+
+// block version of DLY_GetNext
+
+inline void DLY_ProcessBlock ( dly_t *pdly, const int *pin, int *pout, int count )
+{
+	switch (pdly->type)
+	{
+	default:
+	case DLY_PLAIN:
+		ReverbSimple_Block( pdly, pin, pout, count );
+		return;
+	case DLY_ALLPASS:
+		DelayAllpass_Block( pdly, pin, pout, count );
+		return;
+	case DLY_LOWPASS:
+		DelayLowpass_Block( pdly, pin, pout, count );
+		return;
+	case DLY_LINEAR:
+		DelayLinear_Block( pdly, pin, pout, count );
+		return;
+	case DLY_FLINEAR:
+		DelayLinear_lowpass_Block( pdly, pin, pout, count );
+		return;
+	case DLY_PLAIN_4TAP:
+		DelayMultitap_Block( pdly, NULL, pin, pout, count );
+		return;
+	case DLY_LOWPASS_4TAP:
+		DelayMultitap_Block( pdly, pdly->pflt, pin, pout, count );
+		return;
+	}
+}
+
+inline void DLY_GetNextBlock ( dly_t *pdly, int *pspan, int count )
+{
+	DLY_ProcessBlock( pdly, pspan, pspan, count );
+}
+
 // batch version for performance
-// UNDONE: a) unwind this more - pb increments by 2 to avoid pb->left or pb->right deref.
-// UNDONE: b) all filter and delay params are dereferenced outside of DLY_GetNext and passed as register values
-// UNDONE: c) pull case statement in dly_getnext out, so loop directly calls the inline dly_*() routine.
 
 inline void DLY_GetNextN( dly_t *pdly, portable_samplepair_t *pbuffer, int SampleCount, int op )
 {
 	int count = SampleCount;
 	portable_samplepair_t *pb = pbuffer;
 	
+	if ( dsp_block.GetBool() )
+	{
+		DSP_ProcessBlocks( (prc_Block_t)DLY_GetNextBlock, pdly, pbuffer, SampleCount, op );
+		return;
+	}
+
 	switch (op)
 	{
 	default:
@@ -2546,14 +3078,63 @@ inline int RVA_GetNext( rva_t *prva, int x )
 }
 
 
+// block version of RVA_GetNext - each parallel delay runs over the whole span,
+// the outputs are summed in the same order
+
+inline void RVA_GetNextBlock( rva_t *prva, int *pspan, int count )
+{
+	int y[DSP_BLOCK_SIZE];
+	int dly[DSP_BLOCK_SIZE];
+	int m = prva->m;
+	int i, k;
+
+	Assert( count <= DSP_BLOCK_SIZE );
+
+	if ( prva->fmoddly || m < 1 )
+	{
+		// mod delays change their taps every sample, run them per sample
+
+		for ( k = 0; k < count; k++ )
+			pspan[k] = RVA_GetNext( prva, pspan[k] );
+		return;
+	}
+
+	DLY_ProcessBlock( prva->pdlys[0], pspan, y, count );
+
+	for ( i = 1; i < m; i++ )
+	{
+		DLY_ProcessBlock( prva->pdlys[i], pspan, dly, count );
+
+		k = 0;
+
+#if defined( DSP_BLOCK_SIMD )
+		for ( ; k + 4 <= count; k += 4 )
+			_mm_storeu_si128( (__m128i *)(y + k), _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(y + k) ), _mm_loadu_si128( (const __m128i *)(dly + k) ) ) );
+#endif
+
+		for ( ; k < count; k++ )
+			y[k] += dly[k];
+	}
+
+	Q_memcpy( pspan, y, count * sizeof( int ) );
+
+	if ( !prva->fparallel && prva->pflt )
+		FLT_GetNextBlock( prva->pflt, pspan, count );
+}
+
 // batch version for performance
-// UNDONE: unwind RVA_GetNextN so that it directly calls DLY_GetNextN or MDY_GetNextN
 
 inline void RVA_GetNextN( rva_t *prva, portable_samplepair_t *pbuffer, int SampleCount, int op )
 {
 	int count = SampleCount;
 	portable_samplepair_t *pb = pbuffer;
 	
+	if ( dsp_block.GetBool() )
+	{
+		DSP_ProcessBlocks( (prc_Block_t)RVA_GetNextBlock, prva, pbuffer, SampleCount, op );
+		return;
+	}
+
 	switch (op)
 	{
 	default:
@@ -3051,6 +3632,14 @@ inline int DFR_GetNext( dfr_t *pdfr, int x )
 	return y;
 }
 
+// block version of DFR_GetNext - the allpass delays run over the whole span in series
+
+inline void DFR_GetNextBlock( dfr_t *pdfr, int *pspan, int count )
+{
+	for ( int i = 0; i < pdfr->n; i++ )
+		DelayAllpass_Block( pdfr->pdlys[i], pspan, pspan, count );
+}
+
 // batch version for performance
 
 inline void DFR_GetNextN( dfr_t *pdfr, portable_samplepair_t *pbuffer, int SampleCount, int op )
@@ -3058,6 +3647,12 @@ inline void DFR_GetNextN( dfr_t *pdfr, portable_samplepair_t *pbuffer, int Sampl
 	int count = SampleCount;
 	portable_samplepair_t *pb = pbuffer;
 	
+	if ( dsp_block.GetBool() )
+	{
+		DSP_ProcessBlocks( (prc_Block_t)DFR_GetNextBlock, pdfr, pbuffer, SampleCount, op );
+		return;
+	}
+
 	switch (op)
 	{
 	default:
@@ -8793,6 +9388,172 @@ void DSP_Process( int idsp, portable_samplepair_t *pbfront, portable_samplepair_
 
 }
 
+//-----------------------------------------------------------------------------
+// Block processing test: renders a fixed test signal through each batch preset
+// twice, once per sample (dsp_block 0) and once in blocks (dsp_block 1), writes both
+// renders to .wav and compares them sample for sample. The presets are run directly,
+// mono in and duplicated out as for dsp_room, so no sound device or server is needed.
+//-----------------------------------------------------------------------------
+
+#define DSP_BLOCKTEST_SAMPLES	(SOUND_DMA_SPEED * 4)		// 4 seconds of test signal
+
+// deterministic test signal - clicks, noise bursts and a rising square wave
+
+static void DSP_BlockTestSignal( int *pbuf, int count )
+{
+	unsigned int seed = 0x12345678;
+	int period = 200;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		int x = 0;
+		int pos = i % (SOUND_DMA_SPEED / 2);
+
+		seed = seed * 1664525 + 1013904223;
+
+		if ( pos == 0 )
+			x = 24000;											// click every half second
+		else if ( pos < SOUND_DMA_SPEED / 20 )
+			x = ( (int)(seed >> 16) - 32768 ) / 4;				// noise burst after each click
+		else
+			x = ( (i / period) & 1 ) ? 3000 : -3000;			// square wave, pitch rises over time
+
+		if ( (i % 1000) == 0 && period > 20 )
+			period--;
+
+		pbuf[i] = x;
+	}
+}
+
+// render the test signal through preset ipset, fills pout with 16 bit stereo
+
+static bool DSP_BlockTestRender( int ipset, const int *psignal, short *pout, bool bBlock )
+{
+	static const int s_chunks[] = { 1, 37, 512, 255, 1024, 3, 256, 4, 900, 129 };	// odd paint sizes to move the block edges around
+	portable_samplepair_t buf[1024];
+
+	pset_t *ppset = PSET_Alloc( ipset );
+
+	if ( !ppset )
+		return false;
+
+	// both renders see the same random modulation
+
+	RandomSeed( ipset );
+	dsp_block.SetValue( bBlock ? 1 : 0 );
+
+	for ( int i = 0, ichunk = 0; i < DSP_BLOCKTEST_SAMPLES; ichunk++ )
+	{
+		int count = min( s_chunks[ichunk % ARRAYSIZE( s_chunks )], DSP_BLOCKTEST_SAMPLES - i );
+		int k;
+
+		for ( k = 0; k < count; k++ )
+			buf[k].left = buf[k].right = psignal[i + k];
+
+		PSET_GetNextN( ppset, buf, count, OP_LEFT_DUPLICATE );
+
+		for ( k = 0; k < count; k++ )
+		{
+			pout[(i + k) * 2] = clamp( buf[k].left, -32768, 32767 );
+			pout[(i + k) * 2 + 1] = clamp( buf[k].right, -32768, 32767 );
+		}
+
+		i += count;
+	}
+
+	PSET_Free( ppset );
+	return true;
+}
+
+CON_COMMAND( dsp_blocktest, "Render each batch dsp preset per sample and in blocks to .wav and compare. Usage: dsp_blocktest [preset...]" )
+{
+	CUtlVector<int> presets;
+
+	if ( args.ArgC() > 1 )
+	{
+		for ( int i = 1; i < args.ArgC(); i++ )
+			presets.AddToTail( atoi( args[i] ) );
+	}
+	else
+	{
+		for ( int i = 1; i < g_cpsettemplates; i++ )
+			presets.AddToTail( i );
+	}
+
+	int *psignal = new int[DSP_BLOCKTEST_SAMPLES];
+	short *pref = new short[DSP_BLOCKTEST_SAMPLES * 2];
+	short *pblock = new short[DSP_BLOCKTEST_SAMPLES * 2];
+	int nBlockSave = dsp_block.GetInt();
+	int nFailed = 0;
+	int nTested = 0;
+
+	DSP_BlockTestSignal( psignal, DSP_BLOCKTEST_SAMPLES );
+
+	for ( int i = 0; i < presets.Count(); i++ )
+	{
+		int ipset = presets[i];
+
+		if ( ipset <= 0 || ipset >= g_cpsettemplates || !g_psettemplates[ipset].fused )
+			continue;
+
+		if ( !FBatchPreset( &g_psettemplates[ipset] ) )
+		{
+			Msg( "dsp_blocktest: preset %d has no batch path, skipped\n", ipset );
+			continue;
+		}
+
+		if ( !DSP_BlockTestRender( ipset, psignal, pref, false ) || !DSP_BlockTestRender( ipset, psignal, pblock, true ) )
+		{
+			Warning( "dsp_blocktest: couldn't allocate preset %d\n", ipset );
+			continue;
+		}
+
+		int nDiffs = 0;
+		int nMaxDiff = 0;
+
+		for ( int k = 0; k < DSP_BLOCKTEST_SAMPLES * 2; k++ )
+		{
+			int diff = abs( pref[k] - pblock[k] );
+
+			if ( diff )
+			{
+				nDiffs++;
+				nMaxDiff = max( nMaxDiff, diff );
+			}
+		}
+
+		char szRef[MAX_PATH];
+		char szBlock[MAX_PATH];
+
+		Q_snprintf( szRef, sizeof( szRef ), "dsp_blocktest_%03d_ref.wav", ipset );
+		Q_snprintf( szBlock, sizeof( szBlock ), "dsp_blocktest_%03d_block.wav", ipset );
+		WriteWaveFile( szRef, (const char *)pref, DSP_BLOCKTEST_SAMPLES * 2 * sizeof( short ), 16, 2, SOUND_DMA_SPEED );
+		WriteWaveFile( szBlock, (const char *)pblock, DSP_BLOCKTEST_SAMPLES * 2 * sizeof( short ), 16, 2, SOUND_DMA_SPEED );
+
+		nTested++;
+
+		// the block path is bit exact, any difference is a failure
+
+		if ( nDiffs )
+		{
+			nFailed++;
+			Warning( "dsp_blocktest: preset %d FAILED, %d samples differ, max difference %d\n", ipset, nDiffs, nMaxDiff );
+		}
+		else
+		{
+			Msg( "dsp_blocktest: preset %d ok\n", ipset );
+		}
+	}
+
+	dsp_block.SetValue( nBlockSave );
+
+	delete [] psignal;
+	delete [] pref;
+	delete [] pblock;
+
+	Msg( "dsp_blocktest: %d presets tested, %d failed\n", nTested, nFailed );
+}
+
 // DSP helpers
 
 // free all dsp processors 
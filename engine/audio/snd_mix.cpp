@@ -23,6 +23,14 @@
 #undef id386
 #endif
 
+#if defined( __arm__ ) || defined( __aarch64__ )
+#include "sse2neon.h"
+#define SND_MIX_SIMD
+#elif !defined( _X360 ) && !defined( _PS3 )
+#include <emmintrin.h>
+#define SND_MIX_SIMD
+#endif
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -643,6 +651,7 @@ void S_Interpolate2xCubic( portable_samplepair_t *pbuffer, portable_samplepair_t
 	portable_samplepair_t *psamp2;
 	portable_samplepair_t *psamp3;
 	int outpos = 0;
+	portable_samplepair_t temp[PAINTBUFFER_SIZE];
 
 	Assert (upCount <= PAINTBUFFER_SIZE);
 
@@ -662,7 +671,7 @@ void S_Interpolate2xCubic( portable_samplepair_t *pbuffer, portable_samplepair_t
 
 		// write out original sample to interpolation buffer
 
-		g_temppaintbuffer[outpos++] = *psamp1;
+		temp[outpos++] = *psamp1;
 
 		// get all left samples for interpolation window
 
@@ -679,7 +688,7 @@ void S_Interpolate2xCubic( portable_samplepair_t *pbuffer, portable_samplepair_t
 		
 		// write out interpolated sample
 
-		g_temppaintbuffer[outpos].left = a/8 + b/4 + c/2 + x0;
+		temp[outpos].left = a/8 + b/4 + c/2 + x0;
 		
 		// get all right samples for window
 
@@ -695,9 +704,9 @@ void S_Interpolate2xCubic( portable_samplepair_t *pbuffer, portable_samplepair_t
 		c = (x1 - xm1) / 2;
 		
 		// write out interpolated sample, increment output counter
-		g_temppaintbuffer[outpos++].right = a/8 + b/4 + c/2 + x0;
+		temp[outpos++].right = a/8 + b/4 + c/2 + x0;
 
-		Assert( outpos <= TEMP_COPY_BUFFER_SIZE );
+		Assert( outpos <= PAINTBUFFER_SIZE );
 	}
 	
 	Assert(cfltmem >= 3);
@@ -708,10 +717,10 @@ void S_Interpolate2xCubic( portable_samplepair_t *pbuffer, portable_samplepair_t
 	pfiltermem[1] = pbuffer[upCount - 3];
 	pfiltermem[2] = pbuffer[upCount - 1];
 
-	// copy temppaintbuffer back into paintbuffer
+	// copy temp back into paintbuffer
 
 	for (i = 0; i < upCount; i++)
-		pbuffer[i] = g_temppaintbuffer[i];
+		pbuffer[i] = temp[i];
 }
 
 // pass forward over passed in buffer and linearly interpolate all odd samples
@@ -820,6 +829,133 @@ void S_Interpolate2xLinear_2( int count, portable_samplepair_t *pbuffer, portabl
 }
  
 
+//-----------------------------------------------------------------------------
+// SIMD mixing: the 8 and 16 bit mixers below and the 2x upsamplers have SSE2
+// versions. They do the same integer math as the scalar routines, so their
+// output is bit exact.
+// snd_mixbench mixes 128 channels through each path and compares them.
+//-----------------------------------------------------------------------------
+
+ConVar snd_mix_simd( "snd_mix_simd", "1", 0, "Mix channels and upsample with SSE2. 0 - scalar mixers (reference path)." );
+
+#if defined( SND_MIX_SIMD )
+
+// signed int division by 1 << shift, rounding toward zero like the scalar '/'
+
+inline __m128i S_DivPow2SIMD( __m128i x, int shift )
+{
+	__m128i bias = _mm_srli_epi32( _mm_srai_epi32( x, 31 ), 32 - shift );
+	return _mm_srai_epi32( _mm_add_epi32( x, bias ), shift );
+}
+
+// cubic interpolation of the two sample pairs halfway between pwin[1..2] and pwin[2..3], see S_Interpolate2xCubic
+
+inline __m128i S_Cubic2xSIMD( const portable_samplepair_t *pwin, __m128i &x0 )
+{
+	__m128i xm1 = _mm_loadu_si128( (const __m128i *)&pwin[0] );
+	__m128i x1 = _mm_loadu_si128( (const __m128i *)&pwin[2] );
+	__m128i x2 = _mm_loadu_si128( (const __m128i *)&pwin[3] );
+	x0 = _mm_loadu_si128( (const __m128i *)&pwin[1] );
+
+	__m128i d = _mm_sub_epi32( x0, x1 );
+	__m128i a = _mm_add_epi32( _mm_sub_epi32( _mm_add_epi32( d, _mm_slli_epi32( d, 1 ) ), xm1 ), x2 );		// 3 * (x0-x1) - xm1 + x2
+	__m128i b = _mm_add_epi32( _mm_add_epi32( x0, _mm_slli_epi32( x0, 2 ) ), x2 );						// 5*x0 + x2
+	b = _mm_sub_epi32( _mm_add_epi32( _mm_slli_epi32( x1, 1 ), xm1 ), S_DivPow2SIMD( b, 1 ) );
+	__m128i c = S_DivPow2SIMD( _mm_sub_epi32( x1, xm1 ), 1 );
+	a = S_DivPow2SIMD( a, 1 );
+
+	__m128i y = _mm_add_epi32( S_DivPow2SIMD( a, 3 ), S_DivPow2SIMD( b, 2 ) );
+	return _mm_add_epi32( _mm_add_epi32( y, S_DivPow2SIMD( c, 1 ) ), x0 );
+}
+
+// S_Interpolate2xCubic on a buffer that has not been doubled yet: reads the count
+// samples in pbuffer and the filter memory directly, writes count*2 samples back.
+
+void S_Upsample2xCubicSIMD( portable_samplepair_t *pbuffer, portable_samplepair_t *pfiltermem, int count )
+{
+	// sample window for the first outputs: 3 filter memory samples, then the buffer.
+	// output i interpolates window[i..i+3], from output 4 on the window is pbuffer[i-3...]
+
+	portable_samplepair_t head[8];
+	portable_samplepair_t temp[PAINTBUFFER_SIZE];
+	int i;
+
+	Assert( count >= 5 && count * 2 <= PAINTBUFFER_SIZE );
+
+	for ( i = 0; i < 3; i++ )
+		head[i] = pfiltermem[i];
+	for ( i = 0; i < 5; i++ )
+		head[i + 3] = pbuffer[i];
+
+	for ( i = 0; i + 1 < count; i += 2 )
+	{
+		__m128i x0;
+		__m128i y = S_Cubic2xSIMD( i < 4 ? &head[i] : &pbuffer[i - 3], x0 );
+
+		_mm_storeu_si128( (__m128i *)&temp[i * 2], _mm_unpacklo_epi64( x0, y ) );
+		_mm_storeu_si128( (__m128i *)&temp[i * 2 + 2], _mm_unpackhi_epi64( x0, y ) );
+	}
+
+	if ( i < count )
+	{
+		// last odd sample: a window of 2 would read one past the buffer, so run the pair
+		// ending on it and keep the second output
+
+		__m128i x0;
+		__m128i y = S_Cubic2xSIMD( &pbuffer[i - 4], x0 );
+
+		_mm_storeu_si128( (__m128i *)&temp[i * 2], _mm_unpackhi_epi64( x0, y ) );
+	}
+
+	// save last 3 samples
+
+	pfiltermem[0] = pbuffer[count - 3];
+	pfiltermem[1] = pbuffer[count - 2];
+	pfiltermem[2] = pbuffer[count - 1];
+
+	memcpy( pbuffer, temp, count * 2 * sizeof( portable_samplepair_t ) );
+}
+
+// S_Interpolate2xLinear_2, two input samples at a time
+
+void S_Upsample2xLinearSIMD( int count, portable_samplepair_t *pbuffer, portable_samplepair_t *pfiltermem )
+{
+	portable_samplepair_t first = pbuffer[0];
+	portable_samplepair_t last = pbuffer[count - 1];
+	int j;
+
+	// backward, in place: input j lands at 2j+1 and the average of j-1 and j at 2j.
+	// the writes for j are above every input a later iteration reads.
+
+	for ( j = count - 2; j >= 1; j -= 2 )
+	{
+		__m128i a = _mm_loadu_si128( (const __m128i *)&pbuffer[j - 1] );
+		__m128i b = _mm_loadu_si128( (const __m128i *)&pbuffer[j] );
+		__m128i avg = _mm_srai_epi32( _mm_add_epi32( a, b ), 1 );
+
+		_mm_storeu_si128( (__m128i *)&pbuffer[j * 2], _mm_unpacklo_epi64( avg, b ) );
+		_mm_storeu_si128( (__m128i *)&pbuffer[j * 2 + 2], _mm_unpackhi_epi64( avg, b ) );
+	}
+
+	// j is 0 or -1 here: finish input 1 if it is left, input 0 averages with the filter memory
+
+	if ( j == 0 )
+	{
+		portable_samplepair_t x = pbuffer[1];
+
+		pbuffer[3] = x;
+		pbuffer[2].left = ( first.left + x.left ) >> 1;
+		pbuffer[2].right = ( first.right + x.right ) >> 1;
+	}
+
+	pbuffer[1] = first;
+	pbuffer[0].left = ( pfiltermem->left + first.left ) >> 1;
+	pbuffer[0].right = ( pfiltermem->right + first.right ) >> 1;
+	*pfiltermem = last;
+}
+
+#endif // SND_MIX_SIMD
+
 // upsample by 2x, optionally using interpolation
 // count: how many samples to upsample. will become count*2 samples in buffer, in place.
 // pbuffer: buffer to upsample into (in place)
@@ -833,9 +969,25 @@ void S_MixBufferUpsample2x( int count, portable_samplepair_t *pbuffer, portable_
 	// NOTE: Has been proven equivalent by comparing output.
 	if ( filtertype == FILTERTYPE_LINEAR )
 	{
+#if defined( SND_MIX_SIMD )
+		if ( snd_mix_simd.GetInt() )
+		{
+			S_Upsample2xLinearSIMD( count, pbuffer, pfiltermem );
+			return;
+		}
+#endif
 		S_Interpolate2xLinear_2( count, pbuffer, pfiltermem, cfltmem );
 		return;
 	}
+
+#if defined( SND_MIX_SIMD )
+	if ( filtertype == FILTERTYPE_CUBIC && count >= 5 && snd_mix_simd.GetInt() )
+	{
+		S_Upsample2xCubicSIMD( pbuffer, pfiltermem, count );
+		return;
+	}
+#endif
+
 	int i, j, upCount = count<<1;
 	
 	// reverse through buffer, duplicating contents for 'count' samples
@@ -2673,6 +2825,203 @@ bool MIX_ScaleChannelVolume( paintbuffer_t *ppaint, channel_t *pChannel, int vol
 }
 
 
+//===============================================================================
+// SIMD mixing routines
+//===============================================================================
+
+#if defined( SND_MIX_SIMD )
+
+// The SIMD mixers run in two passes over chunks of SND_SIMD_FRAMES output samples.
+// The source is first resampled into 16 bit frames (8 bit samples scaled up by 256),
+// then an SSE2 kernel multiplies the frames by the channel volumes and adds them to
+// the paintbuffer. 8 bit volumes are quantized as snd_scaletable does, so
+// ((vol * (x << 8)) >> 8) is exactly the table's x * vol.
+
+#define SND_SIMD_FRAMES		256
+
+// pOutput[i] += ( volume * pFrames[i] ) >> 8, mono frames go to both sides.
+// _mm_madd_epi16 multiplies each sample by (vol, 0), volumes must fit in 15 bits.
+
+static void SND_MixFramesSSE2( portable_samplepair_t *pOutput, int vol0, int vol1, const short *pFrames, int nChannels, int count )
+{
+	__m128i vol = _mm_set_epi16( 0, vol1, 0, vol0, 0, vol1, 0, vol0 );
+	int *pOut = &pOutput[0].left;
+	int i = 0;
+
+	if ( nChannels == 1 )
+	{
+		for ( ; i + 8 <= count; i += 8 )
+		{
+			__m128i x = _mm_loadu_si128( (const __m128i *)&pFrames[i] );
+			__m128i xx[2] = { _mm_unpacklo_epi16( x, x ), _mm_unpackhi_epi16( x, x ) };		// x0 x0 x1 x1 ...
+
+			for ( int k = 0; k < 2; k++ )
+			{
+				int *p = pOut + ( i + k * 4 ) * 2;
+				__m128i lo = _mm_srai_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( xx[k], xx[k] ), vol ), 8 );
+				__m128i hi = _mm_srai_epi32( _mm_madd_epi16( _mm_unpackhi_epi16( xx[k], xx[k] ), vol ), 8 );
+
+				_mm_storeu_si128( (__m128i *)p, _mm_add_epi32( _mm_loadu_si128( (const __m128i *)p ), lo ) );
+				_mm_storeu_si128( (__m128i *)( p + 4 ), _mm_add_epi32( _mm_loadu_si128( (const __m128i *)( p + 4 ) ), hi ) );
+			}
+		}
+
+		for ( ; i < count; i++ )
+		{
+			pOutput[i].left += ( vol0 * pFrames[i] ) >> 8;
+			pOutput[i].right += ( vol1 * pFrames[i] ) >> 8;
+		}
+	}
+	else
+	{
+		for ( ; i + 4 <= count; i += 4 )
+		{
+			int *p = pOut + i * 2;
+			__m128i x = _mm_loadu_si128( (const __m128i *)&pFrames[i * 2] );		// l0 r0 l1 r1 ...
+			__m128i lo = _mm_srai_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( x, x ), vol ), 8 );
+			__m128i hi = _mm_srai_epi32( _mm_madd_epi16( _mm_unpackhi_epi16( x, x ), vol ), 8 );
+
+			_mm_storeu_si128( (__m128i *)p, _mm_add_epi32( _mm_loadu_si128( (const __m128i *)p ), lo ) );
+			_mm_storeu_si128( (__m128i *)( p + 4 ), _mm_add_epi32( _mm_loadu_si128( (const __m128i *)( p + 4 ) ), hi ) );
+		}
+
+		for ( ; i < count; i++ )
+		{
+			pOutput[i].left += ( vol0 * pFrames[i * 2] ) >> 8;
+			pOutput[i].right += ( vol1 * pFrames[i * 2 + 1] ) >> 8;
+		}
+	}
+}
+
+// 8 bit samples widened to 16 bit frames, x << 8
+
+static void SND_Widen8SSE2( short *pOut, const byte *pData, int count )
+{
+	int i = 0;
+
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		__m128i x = _mm_loadu_si128( (const __m128i *)&pData[i] );
+
+		_mm_storeu_si128( (__m128i *)&pOut[i], _mm_unpacklo_epi8( _mm_setzero_si128(), x ) );
+		_mm_storeu_si128( (__m128i *)&pOut[i + 8], _mm_unpackhi_epi8( _mm_setzero_si128(), x ) );
+	}
+
+	for ( ; i < count; i++ )
+		pOut[i] = (short)( (signed char)pData[i] * 256 );
+}
+
+inline int SND_SIMDSample( const byte *pData, int i )	{ return (signed char)pData[i]; }
+inline int SND_SIMDSample( const short *pData, int i )	{ return pData[i]; }
+
+// frames for a chunk mixed at the native rate: 16 bit data is mixed in place
+
+inline const short *SND_SIMDNativeFrames( short *pFrames, const byte *pData, int count )
+{
+	SND_Widen8SSE2( pFrames, pData, count );
+	return pFrames;
+}
+
+inline const short *SND_SIMDNativeFrames( short *, const short *pData, int )
+{
+	return pData;
+}
+
+// Resamples count frames of pData into pFrames, 16 bit. The scalar mixers step through
+// the source one fraction at a time, here each frame's position is worked out from
+// pos, the fixed point position of the first one, so the frames don't wait on each
+// other. Same positions, same interpolation math.
+
+template< typename T, int nChannels, bool bInterp >
+static void SND_ResampleFrames( short *pFrames, const T *pData, int64 pos, int rate, int count )
+{
+	const int nBits = bInterp ? FIX_BITS14 : FIX_BITS;
+	const int nScale = ( sizeof( T ) == 1 ) ? 256 : 1;
+
+	for ( int k = 0; k < count; k++, pos += rate )
+	{
+		const T *pSample = pData + (int)( pos >> nBits ) * nChannels;
+		int frac = (int)( pos & FIX_MASK14 );
+
+		for ( int c = 0; c < nChannels; c++ )
+		{
+			int x = SND_SIMDSample( pSample, c );
+
+			if ( bInterp )
+				x += ( ( SND_SIMDSample( pSample, c + nChannels ) - x ) * frac ) >> 14;
+
+			pFrames[k * nChannels + c] = (short)( x * nScale );
+		}
+	}
+}
+
+// Mixes outCount samples of pData to pOutput with the SIMD kernel, with the same
+// source positions as the scalar mixers. Returns false if it can't take these
+// volumes or positions, the caller then mixes them itself.
+
+template< typename T >
+static bool SND_MixSIMD( portable_samplepair_t *pOutput, const int *volume, const T *pData, int nChannels, int inputOffset, fixedint rateScaleFix, bool bInterp, int outCount )
+{
+	int vol0 = volume[0];
+	int vol1 = volume[1];
+
+	if ( sizeof( T ) == 1 )
+	{
+		vol0 = ( vol0 >> SND_SCALE_SHIFT ) << SND_SCALE_SHIFT;
+		vol1 = ( vol1 >> SND_SCALE_SHIFT ) << SND_SCALE_SHIFT;
+	}
+
+	if ( (unsigned)vol0 > 0x7fff || (unsigned)vol1 > 0x7fff )
+		return false;
+
+	// the mono mixers ignore inputOffset at the native rate, the stereo ones step by
+	// whole samples as long as it is a fraction
+
+	bool bNative = !bInterp && rateScaleFix == FIX(1) && ( nChannels == 1 || (fixedint)inputOffset < (fixedint)FIX(1) );
+
+	// the scalar stepping matches pos >> FIX_BITS while the offset is a fraction and the
+	// fixed point sum stays positive
+
+	if ( !bNative && ( (fixedint)inputOffset >= (fixedint)FIX(1) || rateScaleFix >= (fixedint)FIX(7) ) )
+		return false;
+
+	int64 pos = bInterp ? FIX_28TO14( inputOffset ) : inputOffset;
+	int rate = bInterp ? FIX_28TO14( rateScaleFix ) : rateScaleFix;
+	short frames[SND_SIMD_FRAMES * 2];
+
+	for ( int i = 0; i < outCount; i += SND_SIMD_FRAMES, pos += (int64)rate * SND_SIMD_FRAMES )
+	{
+		int count = min( outCount - i, SND_SIMD_FRAMES );
+		const short *pFrames = frames;
+
+		if ( bNative )
+			pFrames = SND_SIMDNativeFrames( frames, pData + i * nChannels, count * nChannels );
+		else if ( nChannels == 1 && bInterp )
+			SND_ResampleFrames< T, 1, true >( frames, pData, pos, rate, count );
+		else if ( nChannels == 1 )
+			SND_ResampleFrames< T, 1, false >( frames, pData, pos, rate, count );
+		else if ( bInterp )
+			SND_ResampleFrames< T, 2, true >( frames, pData, pos, rate, count );
+		else
+			SND_ResampleFrames< T, 2, false >( frames, pData, pos, rate, count );
+
+		SND_MixFramesSSE2( pOutput + i, vol0, vol1, pFrames, nChannels, count );
+	}
+
+	return true;
+}
+
+// mixes with the SIMD kernels and returns from the calling mixer if snd_mix_simd is on
+#define SND_TRY_MIX_SIMD( pOutput, volume, pData, nChannels, inputOffset, rateScaleFix, bInterp, outCount ) \
+	if ( snd_mix_simd.GetInt() && SND_MixSIMD( pOutput, volume, pData, nChannels, inputOffset, rateScaleFix, bInterp, outCount ) ) \
+		return
+
+#else
+
+#define SND_TRY_MIX_SIMD( pOutput, volume, pData, nChannels, inputOffset, rateScaleFix, bInterp, outCount )
+
+#endif // SND_MIX_SIMD
+
 //===============================================================================
 // Low level mixing routines
 //===============================================================================
@@ -2768,6 +3117,8 @@ void SND_InitScaletable (void)
 
 void SND_PaintChannelFrom8(portable_samplepair_t *pOutput, int *volume, byte *pData8, int count)
 {
+	SND_TRY_MIX_SIMD( pOutput, volume, pData8, 1, 0, FIX(1), false, count );
+
 #if	!id386
 	int 	data;
 	int		*lscale, *rscale;
@@ -3473,6 +3824,8 @@ void SW_Mix8Mono( portable_samplepair_t *pOutput, int *volume, byte *pData, int
 		return;
 	}
 
+	SND_TRY_MIX_SIMD( pOutput, volume, pData, 1, inputOffset, rateScaleFix, false, outCount );
+
 	int sampleIndex = 0;
 	fixedint sampleFrac = inputOffset;
 	int		*lscale, *rscale;
@@ -3495,6 +3848,8 @@ void SW_Mix8Mono( portable_samplepair_t *pOutput, int *volume, byte *pData, int
 // pData buffer, ensuring we can always provide 'outCount' samples.
 void SW_Mix8Mono_Interp( portable_samplepair_t *pOutput, int *volume, byte *pData, int inputOffset, fixedint rateScaleFix, int outCount)
 {
+	SND_TRY_MIX_SIMD( pOutput, volume, pData, 1, inputOffset, rateScaleFix, true, outCount );
+
 	fixedint sampleIndex = 0;
 	fixedint rateScaleFix14 = FIX_28TO14(rateScaleFix);		// convert 28 bit fixed point to 14 bit fixed point
 	fixedint sampleFrac14   = FIX_28TO14(inputOffset);
@@ -3527,6 +3882,8 @@ void SW_Mix8Mono_Interp( portable_samplepair_t *pOutput, int *volume, byte *pDat
 
 void SW_Mix8Stereo( portable_samplepair_t *pOutput, int *volume, byte *pData, int inputOffset, fixedint rateScaleFix, int outCount )
 {
+	SND_TRY_MIX_SIMD( pOutput, volume, pData, 2, inputOffset, rateScaleFix, false, outCount );
+
 	int sampleIndex = 0;
 	fixedint sampleFrac = inputOffset;
 	int		*lscale, *rscale;
@@ -3550,6 +3907,8 @@ void SW_Mix8Stereo( portable_samplepair_t *pOutput, int *volume, byte *pData, in
 // pData buffer, ensuring we can always provide 'outCount' samples.
 void SW_Mix8Stereo_Interp( portable_samplepair_t *pOutput, int *volume, byte *pData, int inputOffset, fixedint rateScaleFix, int outCount)
 {
+	SND_TRY_MIX_SIMD( pOutput, volume, pData, 2, inputOffset, rateScaleFix, true, outCount );
+
 	fixedint sampleIndex = 0;
 	fixedint rateScaleFix14 = FIX_28TO14(rateScaleFix);		// convert 28 bit fixed point to 14 bit fixed point
 	fixedint sampleFrac14   = FIX_28TO14(inputOffset);
@@ -3749,6 +4108,8 @@ END:
 
 void SW_Mix16Mono( portable_samplepair_t *pOutput, int *volume, short *pData, int inputOffset, fixedint rateScaleFix, int outCount )
 {
+	SND_TRY_MIX_SIMD( pOutput, volume, pData, 1, inputOffset, rateScaleFix, false, outCount );
+
 	if ( rateScaleFix == FIX(1) )
 	{
 		SW_Mix16Mono_NoShift( pOutput, volume, pData, outCount );
@@ -3764,6 +4125,8 @@ void SW_Mix16Mono( portable_samplepair_t *pOutput, int *volume, short *pData, in
 
 void SW_Mix16Mono_Interp( portable_samplepair_t *pOutput, int *volume, short *pData, int inputOffset, fixedint rateScaleFix, int outCount  )
 {
+	SND_TRY_MIX_SIMD( pOutput, volume, pData, 1, inputOffset, rateScaleFix, true, outCount );
+
 	fixedint sampleIndex = 0;
 	fixedint rateScaleFix14 = FIX_28TO14(rateScaleFix);		// convert 28 bit fixed point to 14 bit fixed point
 	fixedint sampleFrac14   = FIX_28TO14(inputOffset);
@@ -3788,6 +4151,8 @@ void SW_Mix16Mono_Interp( portable_samplepair_t *pOutput, int *volume, short *pD
 
 void SW_Mix16Stereo( portable_samplepair_t *pOutput, int *volume, short *pData, int inputOffset, fixedint rateScaleFix, int outCount )
 {
+	SND_TRY_MIX_SIMD( pOutput, volume, pData, 2, inputOffset, rateScaleFix, false, outCount );
+
 	int sampleIndex = 0;
 	fixedint sampleFrac = inputOffset;
 
@@ -3807,6 +4172,8 @@ void SW_Mix16Stereo( portable_samplepair_t *pOutput, int *volume, short *pData,
 
 void SW_Mix16Stereo_Interp( portable_samplepair_t *pOutput, int *volume, short *pData, int inputOffset, fixedint rateScaleFix, int outCount  )
 {
+	SND_TRY_MIX_SIMD( pOutput, volume, pData, 2, inputOffset, rateScaleFix, true, outCount );
+
 	fixedint sampleIndex = 0;
 	fixedint rateScaleFix14 = FIX_28TO14(rateScaleFix);		// convert 28 bit fixed point to 14 bit fixed point
 	fixedint sampleFrac14   = FIX_28TO14(inputOffset);
@@ -3951,6 +4318,221 @@ void Mix16StereoWavtype( channel_t *pChannel, portable_samplepair_t *pOutput, in
 }
 
 
+//-----------------------------------------------------------------------------
+// Mixing benchmark: mixes SND_MIXBENCH_CHANNELS synthetic channels, 8 and 16 bit
+// mono and stereo sources at a spread of pitches, into a paintbuffer through each
+// snd_mix_simd path and compares the results, then does the same for the 2x
+// upsamplers. The mixers are called directly, so no sound device is needed.
+//-----------------------------------------------------------------------------
+
+#define SND_MIXBENCH_CHANNELS	128
+#define SND_MIXBENCH_SAMPLES	( PAINTBUFFER_SIZE * 4 + 16 )		// per channel side, covers pitch 2.0 plus the interpolators' lookahead
+
+struct mixbench_channel_t
+{
+	bool		b8Bit;
+	bool		bStereo;
+	bool		bInterp;
+	fixedint	rateScaleFix;
+	int			inputOffset;
+	int			volume[2];
+	byte		*pData;
+};
+
+static void SND_MixBenchChannel( mixbench_channel_t &ch, portable_samplepair_t *pOutput, int outCount )
+{
+	if ( ch.b8Bit )
+	{
+		if ( ch.bStereo )
+		{
+			if ( ch.bInterp )
+				SW_Mix8Stereo_Interp( pOutput, ch.volume, ch.pData, ch.inputOffset, ch.rateScaleFix, outCount );
+			else
+				SW_Mix8Stereo( pOutput, ch.volume, ch.pData, ch.inputOffset, ch.rateScaleFix, outCount );
+		}
+		else
+		{
+			if ( ch.bInterp )
+				SW_Mix8Mono_Interp( pOutput, ch.volume, ch.pData, ch.inputOffset, ch.rateScaleFix, outCount );
+			else
+				SW_Mix8Mono( pOutput, ch.volume, ch.pData, ch.inputOffset, ch.rateScaleFix, outCount );
+		}
+	}
+	else
+	{
+		short *pData = (short *)ch.pData;
+
+		if ( ch.bStereo )
+		{
+			if ( ch.bInterp )
+				SW_Mix16Stereo_Interp( pOutput, ch.volume, pData, ch.inputOffset, ch.rateScaleFix, outCount );
+			else
+				SW_Mix16Stereo( pOutput, ch.volume, pData, ch.inputOffset, ch.rateScaleFix, outCount );
+		}
+		else
+		{
+			if ( ch.bInterp )
+				SW_Mix16Mono_Interp( pOutput, ch.volume, pData, ch.inputOffset, ch.rateScaleFix, outCount );
+			else
+				SW_Mix16Mono( pOutput, ch.volume, pData, ch.inputOffset, ch.rateScaleFix, outCount );
+		}
+	}
+}
+
+// mixes every channel into pOutput nPasses times, returns the time taken
+
+static double SND_MixBenchRender( CUtlVector< mixbench_channel_t > &channels, portable_samplepair_t *pOutput, int nPasses )
+{
+	double flStart = Plat_FloatTime();
+
+	for ( int pass = 0; pass < nPasses; pass++ )
+	{
+		Q_memset( pOutput, 0, PAINTBUFFER_SIZE * sizeof( portable_samplepair_t ) );
+
+		for ( int i = 0; i < channels.Count(); i++ )
+			SND_MixBenchChannel( channels[i], pOutput, PAINTBUFFER_SIZE );
+	}
+
+	return Plat_FloatTime() - flStart;
+}
+
+// upsamples a copy of pInput count samples at a time, nPasses times with the same filter memory
+
+static double SND_MixBenchUpsample( const portable_samplepair_t *pInput, portable_samplepair_t *pOutput, int filtertype, int nPasses )
+{
+	const int count = PAINTBUFFER_SIZE / 2;
+	portable_samplepair_t fltmem[CPAINTFILTERMEM];
+	double flTime = 0;
+
+	Q_memset( fltmem, 0, sizeof( fltmem ) );
+
+	for ( int pass = 0; pass < nPasses; pass++ )
+	{
+		Q_memcpy( pOutput, pInput + ( pass & 1 ) * count, count * sizeof( portable_samplepair_t ) );
+
+		double flStart = Plat_FloatTime();
+		S_MixBufferUpsample2x( count, pOutput, fltmem, CPAINTFILTERMEM, filtertype );
+		flTime += Plat_FloatTime() - flStart;
+	}
+
+	return flTime;
+}
+
+// puts snd_mix_simd back the way it was when the benchmark leaves its scope
+
+class CMixBenchModeRestore
+{
+public:
+	CMixBenchModeRestore() : m_nMode( snd_mix_simd.GetInt() ) {}
+	~CMixBenchModeRestore() { snd_mix_simd.SetValue( m_nMode ); }
+
+private:
+	int m_nMode;
+};
+
+static int SND_MixBenchDiffs( const portable_samplepair_t *pRef, const portable_samplepair_t *pTest, int count )
+{
+	int nDiffs = 0;
+
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( pRef[i].left != pTest[i].left || pRef[i].right != pTest[i].right )
+			nDiffs++;
+	}
+
+	return nDiffs;
+}
+
+CON_COMMAND( snd_mixbench, "Mix 128 synthetic channels through each snd_mix_simd path, time and compare them. Usage: snd_mixbench [passes]" )
+{
+	static const float s_pitches[] = { 1.0f, 1.0f, 0.5f, 0.75f, 0.9f, 1.25f, 1.5f, 2.0f };
+	static const char *s_modes[] = { "scalar", "SSE2" };
+
+	int nPasses = args.ArgC() > 1 ? max( atoi( args[1] ), 1 ) : 200;
+	int nModes = 1;
+
+#if defined( SND_MIX_SIMD )
+	nModes = 2;
+#endif
+
+	// channels, cycling through the source formats and pitches
+
+	CUtlVector< mixbench_channel_t > channels;
+	unsigned int seed = 0x2468ace1;
+
+	for ( int i = 0; i < SND_MIXBENCH_CHANNELS; i++ )
+	{
+		mixbench_channel_t ch;
+		float pitch = s_pitches[( i / 4 ) % ARRAYSIZE( s_pitches )];
+
+		ch.b8Bit = ( i & 1 ) != 0;
+		ch.bStereo = ( i & 2 ) != 0;
+		ch.bInterp = pitch != 1.0f && ( i & 32 ) != 0;
+		ch.rateScaleFix = FIX_FLOAT( pitch );
+		ch.inputOffset = pitch != 1.0f ? FIX_FLOAT( ( i % 7 ) / 7.0f ) : 0;
+
+		int nBytes = SND_MIXBENCH_SAMPLES * ( ch.bStereo ? 2 : 1 ) * ( ch.b8Bit ? 1 : 2 );
+		ch.pData = new byte[nBytes];
+
+		for ( int k = 0; k < nBytes; k++ )
+		{
+			seed = seed * 1664525 + 1013904223;
+			ch.pData[k] = (byte)( seed >> 24 );
+		}
+
+		seed = seed * 1664525 + 1013904223;
+		ch.volume[0] = ( seed >> 16 ) & 255;
+		ch.volume[1] = ( seed >> 24 ) & 255;
+
+		channels.AddToTail( ch );
+	}
+
+	portable_samplepair_t *pOutput[2];
+	portable_samplepair_t *pUpsampled[2];
+	double flMix[2], flLinear[2], flCubic[2];
+
+	{
+		CMixBenchModeRestore restoreMode;
+
+		for ( int mode = 0; mode < nModes; mode++ )
+		{
+			pOutput[mode] = new portable_samplepair_t[PAINTBUFFER_MEM_SIZE];
+			pUpsampled[mode] = new portable_samplepair_t[PAINTBUFFER_MEM_SIZE * 2];
+			Q_memset( pUpsampled[mode], 0, PAINTBUFFER_MEM_SIZE * 2 * sizeof( portable_samplepair_t ) );
+
+			snd_mix_simd.SetValue( mode );
+			flMix[mode] = SND_MixBenchRender( channels, pOutput[mode], nPasses );
+			flLinear[mode] = SND_MixBenchUpsample( pOutput[mode], pUpsampled[mode], FILTERTYPE_LINEAR, nPasses );
+			flCubic[mode] = SND_MixBenchUpsample( pOutput[mode], pUpsampled[mode] + PAINTBUFFER_MEM_SIZE, FILTERTYPE_CUBIC, nPasses );
+		}
+	}
+
+	Msg( "snd_mixbench: %d channels, %d samples, %d passes\n", SND_MIXBENCH_CHANNELS, PAINTBUFFER_SIZE, nPasses );
+
+	for ( int mode = 0; mode < nModes; mode++ )
+	{
+		int nDiffs = SND_MixBenchDiffs( pOutput[0], pOutput[mode], PAINTBUFFER_SIZE );
+		nDiffs += SND_MixBenchDiffs( pUpsampled[0], pUpsampled[mode], PAINTBUFFER_MEM_SIZE * 2 );
+
+		Msg( "  %-6s  mix %8.3f ms/pass (%.2fx)  upsample linear %6.3f ms  cubic %6.3f ms  %s\n", s_modes[mode],
+			flMix[mode] * 1000.0 / nPasses, flMix[0] / max( flMix[mode], 1e-9 ),
+			flLinear[mode] * 1000.0 / nPasses, flCubic[mode] * 1000.0 / nPasses,
+			nDiffs ? "DIFFERS from scalar" : "matches scalar" );
+
+		if ( nDiffs )
+			Warning( "snd_mixbench: %s output differs from scalar in %d samples\n", s_modes[mode], nDiffs );
+	}
+
+	for ( int mode = 0; mode < nModes; mode++ )
+	{
+		delete [] pOutput[mode];
+		delete [] pUpsampled[mode];
+	}
+
+	for ( int i = 0; i < channels.Count(); i++ )
+		delete [] channels[i].pData;
+}
+
 //===============================================================================
 // Client entity mouth movement code.  Set entity mouthopen variable, based
 // on the sound envelope of the voice channel playing.
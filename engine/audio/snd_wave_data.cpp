@@ -34,6 +34,14 @@ extern double realtime;
 // UNDONE: Allocate this in cache instead?
 #define SINGLE_BUFFER_SIZE 16384
 
+// PC read-ahead implementation for large streaming waves
+// the ring keeps this many buffers in flight ahead of the mixer, so a refill finds its data resident
+// instead of blocking the mixer on file i/o (~1.5s of 44kHz 16 bit stereo audio at these sizes)
+#define PC_STREAM_BUFFER_COUNT	4
+#define PC_STREAM_BUFFER_SIZE	( 64 * 1024 )
+
+#define MAX_STREAM_BUFFER_COUNT	MAX( STREAM_BUFFER_COUNT, PC_STREAM_BUFFER_COUNT )
+
 // Force a small cache for debugging cache issues.
 // #define FORCE_SMALL_MEMORY_CACHE_SIZE	( 6 * 1024 * 1024 )
 
@@ -46,6 +54,28 @@ ConVar snd_async_spew_blocking( "snd_async_spew_blocking", "1", 0, "Spew message
 ConVar snd_async_spew( "snd_async_spew", "0", 0, "Spew all async sound reads, including success" );
 ConVar snd_async_fullyasync( "snd_async_fullyasync", "0", 0, "All playback is fully async (sound doesn't play until data arrives)." );
 ConVar snd_async_stream_spew( "snd_async_stream_spew", "0", 0, "Spew streaming info ( 0=Off, 1=streams, 2=buffers" );
+ConVar snd_async_stream_readahead( "snd_async_stream_readahead", "1", 0, "Stream large waves through a ring of async read-ahead buffers instead of one whole file read (PC only)." );
+
+//-----------------------------------------------------------------------------
+// Purpose: Streaming refill counters, see snd_async_stream_stats
+//-----------------------------------------------------------------------------
+struct streamstats_t
+{
+	int		m_nRefills;			// mixer buffer refills served from async loaded data
+	int		m_nReadAheads;		// read-ahead buffer loads started
+	int		m_nStalls;			// refills that found their data not yet arrived
+	int		m_nSkips;			// refills outside the read-ahead window
+	float	m_flStallTime;		// time refills spent blocked on file i/o
+	float	m_flMaxStallTime;
+};
+static streamstats_t g_StreamStats;
+
+static void SndStreamStall( float flBlockTime )
+{
+	g_StreamStats.m_nStalls++;
+	g_StreamStats.m_flStallTime += flBlockTime;
+	g_StreamStats.m_flMaxStallTime = MAX( g_StreamStats.m_flMaxStallTime, flBlockTime );
+}
 
 static bool SndAsyncSpewBlocking()
 {
@@ -62,7 +92,7 @@ void MaybeReportMissingWav( char const *wav );
 //-----------------------------------------------------------------------------
 struct asyncwaveparams_t
 {
-	asyncwaveparams_t() : bPrefetch( false ), bCanBeQueued( false ) {}
+	asyncwaveparams_t() : bPrefetch( false ), bCanBeQueued( false ), bPartialRead( false ) {}
 
 	FileNameHandle_t	hFilename;	// handle to sound item name (i.e. not with sound\ prefix)
 	int					datasize;
@@ -70,6 +100,7 @@ struct asyncwaveparams_t
 	int					alignment;
 	bool				bPrefetch;
 	bool				bCanBeQueued;
+	bool				bPartialRead;	// read only the requested range, streaming buffers are a window into the file
 };
 
 //-----------------------------------------------------------------------------
@@ -117,6 +148,7 @@ public:
 	unsigned int		m_bLoaded : 1;
 	unsigned int		m_bMissing : 1;
 	unsigned int		m_bPostProcessed : 1;
+	unsigned int		m_bPartialRead : 1;
 };
 
 //-----------------------------------------------------------------------------
@@ -135,6 +167,7 @@ CAsyncWaveData::CAsyncWaveData() :
 	m_start( 0.0 ),
 	m_arrival( 0.0 ),
 	m_bPostProcessed( false ),
+	m_bPartialRead( false ),
 	m_hFileNameHandle( 0 )
 {
 }
@@ -342,7 +375,7 @@ void CAsyncWaveData::OnAsyncCompleted( const FileAsyncRequest_t *asyncFilePtr, i
 
 			// Take over ptr
 			m_pAlloc = ( byte * )asyncFilePtr->pData;
-			if ( SndAlignReads() )
+			if ( SndAlignReads() && !m_bPartialRead )
 			{
 				m_async.nOffset = ( m_async.nBytes - m_nDataSize );
 				m_async.nBytes -= m_async.nOffset;
@@ -554,7 +587,8 @@ void CAsyncWaveData::SetAsyncPriority( int priority )
 //-----------------------------------------------------------------------------
 void CAsyncWaveData::StartAsyncLoading( const asyncwaveparams_t& params )
 {
-	Assert( IsX360() || ( IsPC() && !m_bLoaded ) );
+	// only streaming buffers are restarted on the pc
+	Assert( IsX360() || ( IsPC() && ( !m_bLoaded || params.bPartialRead ) ) );
 
 	// expected to be relative to the sound\ dir
 	m_hFileNameHandle = params.hFilename;
@@ -570,10 +604,32 @@ void CAsyncWaveData::StartAsyncLoading( const asyncwaveparams_t& params )
 		nPriority = 0;
 	}
 
+	if ( !IsX360() && m_hAsyncControl )
+	{
+		// a recycled buffer can still have its previous read in flight, which would hand
+		// over its data after the buffer is freed below. this object stays alive, so unlike
+		// DestroyResource it can abort, but it must wait out a read that already started.
+		if ( !m_bLoaded && !m_bMissing )
+		{
+			int errStatus = g_pFileSystem->AsyncAbort( m_hAsyncControl );
+			if ( errStatus != FSASYNC_ERR_UNKNOWNID )
+			{
+				g_pFileSystem->AsyncFinish( m_hAsyncControl, true );
+			}
+		}
+		g_pFileSystem->AsyncRelease( m_hAsyncControl );
+		m_hAsyncControl = NULL;
+	}
+
 	if ( !IsX360() )
 	{
+		// a restarted buffer drops its previous data, the async layer allocates the next read
+		g_pFileSystem->FreeOptimalReadBuffer( m_pAlloc );
+		m_pAlloc = NULL;
+		m_pvData = NULL;
+
 		m_async.pData = NULL;
-		if ( SndAlignReads() )
+		if ( SndAlignReads() && !params.bPartialRead )
 		{
 			m_async.nOffset = 0;
 			m_async.nBytes = params.seekpos + params.datasize;
@@ -607,6 +663,7 @@ void CAsyncWaveData::StartAsyncLoading( const asyncwaveparams_t& params )
 	m_arrival = 0;
 	m_nReadSize = 0;
 	m_bPostProcessed = false;
+	m_bPartialRead = params.bPartialRead;
 
 	// The async layer creates a copy of this string, ok to send a local reference
 	m_async.pszFilename	= szFilename;
@@ -755,14 +812,14 @@ private:
 	struct StreamedEntry_t
 	{
 		FileNameHandle_t	m_hName;
-		memhandle_t			m_hWaveData[STREAM_BUFFER_COUNT];
+		memhandle_t			m_hWaveData[MAX_STREAM_BUFFER_COUNT];
 		int					m_Front;			// buffer index, forever incrementing
 		int					m_NextStartPos;		// predicted offset if mixing linearly
 		int					m_DataSize;			// length of the data set in bytes
 		int					m_DataStart;		// file offset where data set starts
 		int					m_LoopStart;		// offset in data set where loop starts
 		int					m_BufferSize;		// size of the buffer in bytes
-		int					m_numBuffers;		// number of buffers (1 or 2) to march through
+		int					m_numBuffers;		// number of buffers (1 to MAX_STREAM_BUFFER_COUNT) to march through
 		int					m_SectorSize;		// size of sector on stream device
 		bool				m_bSinglePlay;		// hint to keep same buffers
 	};
@@ -775,6 +832,7 @@ private:
 	CUtlRBTree< CacheEntry_t, int >	m_CacheHandles;
 
 	memhandle_t				FindOrCreateBuffer( asyncwaveparams_t &params, bool bFind );		
+	int						CopyStreamedDataIntoMemory( StreamHandle_t hStream, void *pBuffer, int bufferSize, int copyStartPos, int bytesToCopy, bool bCanRestart );
 	bool					m_bInitialized;
 	bool					m_bQueueCacheUnlocks;
 	CUtlVector<memhandle_t> m_unlockQueue;
@@ -966,7 +1024,7 @@ StreamHandle_t CAsyncWavDataCache::OpenStreamedLoad( char const *pFileName, int
 	asyncwaveparams_t		params;
 	int						i;
 
-	Assert( numBuffers > 0 && numBuffers <= STREAM_BUFFER_COUNT );
+	Assert( numBuffers > 0 && numBuffers <= MAX_STREAM_BUFFER_COUNT );
 
 	// queued load mandates one buffer
 	Assert( !( flags & STREAMED_QUEUEDLOAD ) || numBuffers == 1 );
@@ -995,11 +1053,13 @@ StreamHandle_t CAsyncWavDataCache::OpenStreamedLoad( char const *pFileName, int
 	params.datasize = bufferSize;
 	params.alignment = streamedEntry.m_SectorSize;
 	params.bCanBeQueued = ( flags & STREAMED_QUEUEDLOAD ) != 0;
+	params.bPartialRead = true;
 	for ( i=0; i<numBuffers; ++i )
 	{
 		params.seekpos = dataStart + startPos + i * bufferSize;
 		streamedEntry.m_hWaveData[i] = FindOrCreateBuffer( params, bFindBuffer );
 	}
+	g_StreamStats.m_nReadAheads += numBuffers;
 
 	// get a unique handle for each stream request
 	hStream = m_StreamedHandles.AddToTail( streamedEntry );
@@ -1148,10 +1208,22 @@ bool CAsyncWavDataCache::CopyDataIntoMemory( memhandle_t& handle, char const *fi
 		}
 	}
 
+	g_StreamStats.m_nRefills++;
+
 	// Cache entry exists, but if filesize == 0 then the file itself wasn't on disk...
 	if ( data->m_nDataSize != 0 )
 	{
-		bret = data->BlockingCopyData( buffer, bufsize, copystartpos, bytestocopy );
+		if ( !data->m_bLoaded )
+		{
+			// the whole file read hasn't arrived (or was evicted and restarted), the refill blocks on it
+			float st = ( float )Plat_FloatTime();
+			bret = data->BlockingCopyData( buffer, bufsize, copystartpos, bytestocopy );
+			SndStreamStall( ( float )Plat_FloatTime() - st );
+		}
+		else
+		{
+			bret = data->BlockingCopyData( buffer, bufsize, copystartpos, bytestocopy );
+		}
 	}
 
 	*pbPostProcessed = data->GetPostProcessed();
@@ -1163,9 +1235,20 @@ bool CAsyncWavDataCache::CopyDataIntoMemory( memhandle_t& handle, char const *fi
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Copy from streaming buffers into target memory, never blocks.
+// Purpose: Copy from streaming buffers into target memory, never blocks on the 360.
+// The pc blocks on the front buffer rather than return an empty refill.
 //-----------------------------------------------------------------------------
 int CAsyncWavDataCache::CopyStreamedDataIntoMemory( int hStream, void *pBuffer, int bufferSize, int copyStartPos, int bytesToCopy )
+{
+	g_StreamStats.m_nRefills++;
+	return CopyStreamedDataIntoMemory( hStream, pBuffer, bufferSize, copyStartPos, bytesToCopy, true );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: bCanRestart allows one retry after the buffers were restarted at the
+//			caller's read location (pc only, the 360 lets the stream stutter)
+//-----------------------------------------------------------------------------
+int CAsyncWavDataCache::CopyStreamedDataIntoMemory( int hStream, void *pBuffer, int bufferSize, int copyStartPos, int bytesToCopy, bool bCanRestart )
 {
 	VPROF( "CAsyncWavDataCache::CopyStreamedDataIntoMemory" );
 
@@ -1173,7 +1256,7 @@ int CAsyncWavDataCache::CopyStreamedDataIntoMemory( int hStream, void *pBuffer,
 	int					count;
 	int					i;
 	int					which;
-	CAsyncWaveData		*pWaveData[STREAM_BUFFER_COUNT];
+	CAsyncWaveData		*pWaveData[MAX_STREAM_BUFFER_COUNT];
 	CAsyncWaveData		*pFront;
 	asyncwaveparams_t	params;
 	int					nextStartPos;
@@ -1182,6 +1265,9 @@ int CAsyncWavDataCache::CopyStreamedDataIntoMemory( int hStream, void *pBuffer,
 	int					index;
 	bool				bWaiting;
 	bool				bCompleted;
+	bool				bBlocked;
+	bool				bRestarted;
+	int					requestPos;
 	StreamedEntry_t		&streamedEntry = m_StreamedHandles[hStream];
 	
 	if ( copyStartPos >= streamedEntry.m_DataStart + streamedEntry.m_DataSize )
@@ -1201,6 +1287,9 @@ int CAsyncWavDataCache::CopyStreamedDataIntoMemory( int hStream, void *pBuffer,
 	bEndOfFile = 0;
 	actualCopied = 0;
 	bWaiting = false;
+	bBlocked = false;
+	bRestarted = false;
+	requestPos = copyStartPos;
 	while ( 1 )
 	{
 		// try to satisfy from the front
@@ -1241,19 +1330,20 @@ int CAsyncWavDataCache::CopyStreamedDataIntoMemory( int hStream, void *pBuffer,
 		{
 			if ( bufferPos >= 0 && bufferPos < pFront->m_nReadSize )
 			{
-				count = bytesToCopy;
-				if ( bufferPos + bytesToCopy > pFront->m_nReadSize )
+				count = bytesToCopy - actualCopied;
+				if ( bufferPos + count > pFront->m_nReadSize )
 				{
 					// clamp requested to actual available
 					count = pFront->m_nReadSize - bufferPos;
 				}
-				if ( bufferPos + count > bufferSize )
+				if ( actualCopied + count > bufferSize )
 				{
 					// clamp requested to caller's buffer dimension
-					count = bufferSize - bufferPos;
+					count = bufferSize - actualCopied;
 				}
 
-				Q_memcpy( pBuffer, (char *)pFront->m_pvData + bufferPos, count );
+				// a request can span buffers, append behind what the previous buffer provided
+				Q_memcpy( (char *)pBuffer + actualCopied, (char *)pFront->m_pvData + bufferPos, count );
 		
 				// advance past consumed bytes
 				actualCopied += count;
@@ -1267,9 +1357,36 @@ int CAsyncWavDataCache::CopyStreamedDataIntoMemory( int hStream, void *pBuffer,
 			MaybeReportMissingWav( pFront->GetFileName() );
 			break;
 		}
+		else if ( IsPC() && ( bufferPos < 0 || bufferPos >= pFront->m_async.nBytes ) )
+		{
+			// still loading, but not the range the caller wants (it skipped), pass it by
+			// without waiting on it
+		}
+		else if ( IsPC() && !actualCopied && !bBlocked && pFront->m_hAsyncControl )
+		{
+			// the mixer caught up with the read-ahead (or skipped) and has nothing to play
+			// an empty refill would end the sound, so wait for the front buffer
+			float st = ( float )Plat_FloatTime();
+			g_pFileSystem->AsyncFinish( pFront->m_hAsyncControl, true );
+			float ed = ( float )Plat_FloatTime();
+
+			SndStreamStall( ed - st );
+			if ( SndAsyncSpewBlocking() )
+			{
+				Warning( "%f Stream:  Async I/O Force %s (%8.2f msec)\n", realtime, pFront->GetFileName(), 1000.0f * ( ed - st ) );
+			}
+
+			// re-examine the front buffer, once
+			bBlocked = true;
+			continue;
+		}
 		else
 		{
 			// data not available
+			if ( !actualCopied && !bBlocked )
+			{
+				g_StreamStats.m_nStalls++;
+			}
 			bWaiting = true;
 			break;
 		}
@@ -1279,6 +1396,7 @@ int CAsyncWavDataCache::CopyStreamedDataIntoMemory( int hStream, void *pBuffer,
 		{
 			// move to next buffer
 			index++;
+			bBlocked = false;
 			if ( index - streamedEntry.m_Front >= streamedEntry.m_numBuffers )
 			{
 				// out of buffers
@@ -1302,9 +1420,18 @@ int CAsyncWavDataCache::CopyStreamedDataIntoMemory( int hStream, void *pBuffer,
 			{
 				// couldn't return any data because the buffers aren't in the right location
 				// oh no! caller must be skipping
-				// due to latency the next buffer position has to start one full buffer ahead of the caller's desired read location
-				// hopefully only 1 buffer will stutter
-				nextStartPos = copyStartPos - streamedEntry.m_DataStart + streamedEntry.m_BufferSize;
+				if ( IsPC() )
+				{
+					// the pc would rather block than stutter, restart the buffers at the caller's desired read location
+					nextStartPos = copyStartPos - streamedEntry.m_DataStart;
+					bRestarted = true;
+				}
+				else
+				{
+					// due to latency the next buffer position has to start one full buffer ahead of the caller's desired read location
+					// hopefully only 1 buffer will stutter
+					nextStartPos = copyStartPos - streamedEntry.m_DataStart + streamedEntry.m_BufferSize;
+				}
 
 				// advance past, ready for next possible iteration
 				copyStartPos += streamedEntry.m_BufferSize;
@@ -1342,6 +1469,7 @@ int CAsyncWavDataCache::CopyStreamedDataIntoMemory( int hStream, void *pBuffer,
 			params.seekpos = streamedEntry.m_DataStart + nextStartPos;
 			params.datasize = streamedEntry.m_DataSize - nextStartPos;
 			params.alignment = streamedEntry.m_SectorSize;
+			params.bPartialRead = true;
 			if ( params.datasize > streamedEntry.m_BufferSize )
 			{
 				// clamp to buffer size
@@ -1367,6 +1495,17 @@ int CAsyncWavDataCache::CopyStreamedDataIntoMemory( int hStream, void *pBuffer,
 			}
 
 			streamedEntry.m_Front++;
+			g_StreamStats.m_nReadAheads++;
+		}
+
+		if ( bRestarted )
+		{
+			g_StreamStats.m_nSkips++;
+			if ( bCanRestart )
+			{
+				// the buffers now start at the caller's read location, try again (blocks on the new front buffer)
+				return CopyStreamedDataIntoMemory( hStream, pBuffer, bufferSize, requestPos, bytesToCopy, false );
+			}
 		}
 
 		if ( bWaiting )
@@ -1794,6 +1933,101 @@ CON_COMMAND( snd_async_showmem, "Show async memory stats" )
 	g_AsyncWaveDataCache.SpewMemoryUsage( 1 );
 }
 
+CON_COMMAND( snd_async_stream_stats, "Show streaming refill stats, 'snd_async_stream_stats reset' clears them" )
+{
+	if ( args.ArgC() >= 2 && !Q_stricmp( args[1], "reset" ) )
+	{
+		Q_memset( &g_StreamStats, 0, sizeof( g_StreamStats ) );
+		return;
+	}
+
+	Msg( "Stream refills:  %d\n", g_StreamStats.m_nRefills );
+	Msg( "Read-aheads:     %d\n", g_StreamStats.m_nReadAheads );
+	Msg( "Skips:           %d\n", g_StreamStats.m_nSkips );
+	Msg( "Stalls:          %d (%.2f%%)\n", g_StreamStats.m_nStalls, g_StreamStats.m_nRefills ? 100.0f * g_StreamStats.m_nStalls / g_StreamStats.m_nRefills : 0.0f );
+	Msg( "Blocked:         %.2f msec total, %.2f msec worst\n", 1000.0f * g_StreamStats.m_flStallTime, 1000.0f * g_StreamStats.m_flMaxStallTime );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Streams a file through the read-ahead ring the way the mixer refills,
+//  with odd sized reads and periodic skips, and checks every byte against a
+//  plain read of the file. Needs the null device (-nosound), so nothing else
+//  is driving the streams while it runs.
+//-----------------------------------------------------------------------------
+static int SndStreamTestPass( const char *pFileName, const CUtlBuffer &file, streamFlags_t flags, int nSkipInterval )
+{
+	const int nReadSize = 4099;
+	const int nFileSize = file.TellPut();
+	char buffer[nReadSize];
+	int nErrors = 0;
+
+	StreamHandle_t hStream = wavedatacache->OpenStreamedLoad( pFileName, nFileSize, 0, 0, -1, PC_STREAM_BUFFER_SIZE, PC_STREAM_BUFFER_COUNT, flags );
+
+	int nPos = 0;
+	for ( int nRefill = 1; nPos < nFileSize; nRefill++ )
+	{
+		int nCopied = wavedatacache->CopyStreamedDataIntoMemory( hStream, buffer, sizeof( buffer ), nPos, MIN( nReadSize, nFileSize - nPos ) );
+		if ( nCopied <= 0 )
+		{
+			Warning( "snd_async_stream_test: no data at %d of %d\n", nPos, nFileSize );
+			nErrors++;
+			break;
+		}
+
+		if ( Q_memcmp( buffer, (const char *)file.Base() + nPos, nCopied ) )
+		{
+			Warning( "snd_async_stream_test: data differs at %d, %d bytes\n", nPos, nCopied );
+			nErrors++;
+		}
+
+		nPos += nCopied;
+		if ( nSkipInterval && !( nRefill % nSkipInterval ) )
+		{
+			// jump past the read-ahead window, like a seek
+			nPos += PC_STREAM_BUFFER_COUNT * PC_STREAM_BUFFER_SIZE + 1234;
+		}
+	}
+
+	wavedatacache->CloseStreamedLoad( hStream );
+	return nErrors;
+}
+
+CON_COMMAND( snd_async_stream_test, "Stream a sound file through the read-ahead buffers and check it against the file, with the null sound device (-nosound). Usage: snd_async_stream_test <file>" )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: snd_async_stream_test <file relative to sound/>\n" );
+		return;
+	}
+
+	if ( IsX360() || g_AudioDevice != Audio_GetNullDevice() )
+	{
+		Warning( "snd_async_stream_test: needs the null sound device, run with -nosound\n" );
+		return;
+	}
+
+	char szFilename[MAX_PATH];
+	Q_snprintf( szFilename, sizeof( szFilename ), "sound/%s", args[1] );
+
+	CUtlBuffer file;
+	if ( !g_pFileSystem->ReadFile( szFilename, "GAME", file ) )
+	{
+		Warning( "snd_async_stream_test: can't read %s\n", szFilename );
+		return;
+	}
+
+	Q_memset( &g_StreamStats, 0, sizeof( g_StreamStats ) );
+
+	int nErrors = 0;
+	nErrors += SndStreamTestPass( args[1], file, STREAMED_SINGLEPLAY, 0 );
+	nErrors += SndStreamTestPass( args[1], file, STREAMED_SINGLEPLAY, 7 );
+	nErrors += SndStreamTestPass( args[1], file, 0, 0 );
+	nErrors += SndStreamTestPass( args[1], file, 0, 7 );
+
+	Msg( "snd_async_stream_test: %s, %d bytes, %s\n", szFilename, file.TellPut(), nErrors ? "FAILED" : "passed" );
+	Msg( "Stream refills:  %d, skips %d, stalls %d, %.2f msec worst\n", g_StreamStats.m_nRefills, g_StreamStats.m_nSkips, g_StreamStats.m_nStalls, 1000.0f * g_StreamStats.m_flMaxStallTime );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : *pFileName - 
@@ -1811,6 +2045,26 @@ void PrefetchDataStream( const char *pFileName, int dataOffset, int dataSize )
 	wavedatacache->PrefetchCache( pFileName, dataSize, dataOffset );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Streams that are unlikely to replay soon don't keep their buffers
+//-----------------------------------------------------------------------------
+static bool IsSinglePlayStream( const char *pFileName, CAudioSource &source )
+{
+	if ( !Q_strnicmp( pFileName, "music", 5 ) && ( pFileName[5] == '\\' || pFileName[5] == '/') )
+	{
+		// music discards and cycles its buffers
+		return true;
+	}
+
+	if ( !Q_strnicmp( pFileName, "vo", 2 ) && ( pFileName[2] == '\\' || pFileName[2] == '/' ) && !source.IsSentenceWord() )
+	{
+		// vo discards and cycles its buffers, except for sentence sources, which do recur
+		return true;
+	}
+
+	return false;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: This is an instance of a stream.
 //			This contains the file handle and streaming buffer
@@ -1918,8 +2172,6 @@ CWaveDataStreamAsync::CWaveDataStreamAsync
 
 	if ( IsPC() )
 	{
-		m_hCache = wavedatacache->AsyncLoadCache( GetFileName(), m_dataSize, m_dataStart );
-
 		// size of a sample
 		m_sampleSize = source.SampleSize();
 		// size in samples of the buffer
@@ -1928,6 +2180,30 @@ CWaveDataStreamAsync::CWaveDataStreamAsync
 		m_waveSize = fileSize / m_sampleSize;
 
 		m_AudioCacheHandle.Get( CAudioSource::AUDIO_SOURCE_WAV, m_pSfx->IsPrecachedSound(), m_pSfx, &m_nCachedDataSize );
+
+		if ( snd_async_stream_readahead.GetBool() && m_dataSize > PC_STREAM_BUFFER_COUNT * PC_STREAM_BUFFER_SIZE )
+		{
+			// a large wave streams through a ring of read-ahead buffers
+			// rather than waiting on (and holding the cache with) one read of the whole file
+			streamFlags_t flags = 0;
+			if ( IsSinglePlayStream( pFileName, source ) )
+			{
+				flags |= STREAMED_SINGLEPLAY;
+			}
+
+			int loopStart = -1;
+			if ( source.IsLooped() )
+			{
+				int loopBlock;
+				loopStart = m_pStreamSource->GetLoopingInfo( &loopBlock, NULL, NULL ) * m_sampleSize;
+			}
+
+			m_hStream = wavedatacache->OpenStreamedLoad( pFileName, m_dataSize, m_dataStart, startOffset, loopStart, PC_STREAM_BUFFER_SIZE, PC_STREAM_BUFFER_COUNT, flags );
+		}
+		else
+		{
+			m_hCache = wavedatacache->AsyncLoadCache( GetFileName(), m_dataSize, m_dataStart );
+		}
 	}
 	
 	if ( IsX360() )
@@ -1939,14 +2215,8 @@ CWaveDataStreamAsync::CWaveDataStreamAsync
 
 		streamFlags_t flags = STREAMED_FROMDVD;
 
-		if ( !Q_strnicmp( pFileName, "music", 5 ) && ( pFileName[5] == '\\' || pFileName[5] == '/') )
+		if ( IsSinglePlayStream( pFileName, source ) )
 		{
-			// music discards and cycles its buffers
-			flags |= STREAMED_SINGLEPLAY;
-		}
-		else if ( !Q_strnicmp( pFileName, "vo", 2 ) && ( pFileName[2] == '\\' || pFileName[2] == '/' ) && !source.IsSentenceWord() )
-		{
-			// vo discards and cycles its buffers, except for sentence sources, which do recur
 			flags |= STREAMED_SINGLEPLAY;
 		}
 
@@ -1981,7 +2251,7 @@ CWaveDataStreamAsync::CWaveDataStreamAsync
 		bufferSize = AlignValue( bufferSize, XBOX_DVD_SECTORSIZE );
 
 		// use double buffering
-		int numBuffers = 2;
+		int numBuffers = STREAM_BUFFER_COUNT;
 
 		if ( m_dataSize <= STREAM_BUFFER_DATASIZE || m_dataSize <= numBuffers*bufferSize )
 		{
@@ -2029,16 +2299,14 @@ CWaveDataStreamAsync::CWaveDataStreamAsync
 //-----------------------------------------------------------------------------
 CWaveDataStreamAsync::~CWaveDataStreamAsync( void ) 
 {
-	if ( IsPC() && m_source.IsPlayOnce() && m_source.CanDelete() )
+	if ( IsPC() && m_hCache && m_source.IsPlayOnce() && m_source.CanDelete() )
 	{
 		m_source.SetPlayOnce( false ); // in case it gets used again
 		wavedatacache->Unload( m_hCache );
 	}
 
-	if ( IsX360() )
-	{
-		wavedatacache->CloseStreamedLoad( m_hStream ); 
-	}
+	// pc streams only have a stream handle when reading ahead
+	wavedatacache->CloseStreamedLoad( m_hStream ); 
 
 	delete [] m_buffer;
 }
@@ -2077,6 +2345,11 @@ bool CWaveDataStreamAsync::IsReadyToMix()
 			return true;
 		}
 
+		if ( m_hStream != INVALID_STREAM_HANDLE )
+		{
+			return wavedatacache->IsStreamedDataReady( m_hStream );
+		}
+
 		bool bCacheValid;
 		bool bLoaded = wavedatacache->IsDataLoadCompleted( m_hCache, &bCacheValid );
 		if ( !bCacheValid )
@@ -2211,8 +2484,28 @@ int CWaveDataStreamAsync::ReadSourceData( void **pData, int sampleIndex, int sam
 				}
 			}
 
+			if ( !startupCacheUsed && m_hStream != INVALID_STREAM_HANDLE )
+			{
+				// request available data from the read-ahead buffers, drives the buffering
+				// (will only block if the mixer has caught up with the reads)
+				m_bufferCount = wavedatacache->CopyStreamedDataIntoMemory( 
+									m_hStream, 
+									m_buffer, 
+									SINGLE_BUFFER_SIZE,
+									seekpos, 
+									m_bufferCount * m_sampleSize );
+				// convert to number of samples in the buffer
+				m_bufferCount /= m_sampleSize;
+				if ( m_bufferCount <= 0 )
+				{
+					return 0;
+				}
+
+				// do any conversion the source needs (mixer will decode/decompress)
+				m_pStreamSource->UpdateSamples( m_buffer, m_bufferCount );
+			}
 			// Not in startup cache, grab data from async cache loader (will block if data hasn't arrived yet)
-			if ( !startupCacheUsed )
+			else if ( !startupCacheUsed )
 			{
 				bool postprocessed = false;
 				
@@ -2223,7 +2516,7 @@ int CWaveDataStreamAsync::ReadSourceData( void **pData, int sampleIndex, int sam
 					m_dataSize, 
 					m_dataStart,
 					m_buffer, 
-					sizeof( m_buffer ),
+					SINGLE_BUFFER_SIZE,
 					seekpos, 
 					m_bufferCount * m_sampleSize,
 					&postprocessed ) )
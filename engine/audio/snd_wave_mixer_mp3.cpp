@@ -9,6 +9,8 @@
 #include "audio_pch.h"
 #include "snd_mp3_source.h"
 #include "snd_wave_mixer_mp3.h"
+#include "datacache/idatacache.h"
+#include "utlmap.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -16,6 +18,185 @@
 #ifndef DEDICATED  // have to test this because VPC is forcing us to compile this file.
 
 extern IVAudio *vaudio;
+extern IDataCache *g_pDataCache;
+
+ConVar snd_mp3_decodecache( "snd_mp3_decodecache", "1", 0, "Replay short MP3 sounds from a cache of their decoded samples." );
+ConVar snd_mp3_decodecache_maxsound( "snd_mp3_decodecache_maxsound", "524288", 0, "Largest decoded MP3 sound (in bytes) kept by the decode cache." );
+
+#define MP3_DECODE_CACHE_SIZE	( 8 * 1024 * 1024 )
+
+//-----------------------------------------------------------------------------
+// Purpose: Decoded samples of a whole memory MP3
+//-----------------------------------------------------------------------------
+struct mp3decodeparams_t
+{
+	FileNameHandle_t	hFilename;
+	const char			*pSamples;
+	int					nBytes;
+	int					nChannels;
+	int					nRate;
+};
+
+class CDecodedMP3
+{
+public:
+	// APIS required by CManagedDataCacheClient
+	void DestroyResource()									{ delete this; }
+	CDecodedMP3 *GetData()									{ return this; }
+	unsigned int Size()										{ return sizeof( *this ) + m_Samples.Count(); }
+
+	static CDecodedMP3 *CreateResource( const mp3decodeparams_t &params );
+	static unsigned int EstimatedSize( const mp3decodeparams_t &params )	{ return sizeof( CDecodedMP3 ) + params.nBytes; }
+
+	FileNameHandle_t	m_hFilename;
+	CUtlVector<char>	m_Samples;		// 16 bit, m_nChannels interleaved
+	int					m_nChannels;
+	int					m_nRate;
+};
+
+CDecodedMP3 *CDecodedMP3::CreateResource( const mp3decodeparams_t &params )
+{
+	CDecodedMP3 *pDecoded = new CDecodedMP3;
+	pDecoded->m_hFilename = params.hFilename;
+	pDecoded->m_Samples.CopyArray( params.pSamples, params.nBytes );
+	pDecoded->m_nChannels = params.nChannels;
+	pDecoded->m_nRate = params.nRate;
+	return pDecoded;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: LRU of decoded MP3s by filename. Sounds that replay often (weapons,
+//			impacts, ui) are decoded by the first mixer to play them through,
+//			later mixers lock the entry and play its samples without a decoder.
+//-----------------------------------------------------------------------------
+class CMP3DecodeCache : public CManagedDataCacheClient<CDecodedMP3, mp3decodeparams_t>
+{
+public:
+	CMP3DecodeCache() : m_Handles( 0, 0, DefLessFunc( FileNameHandle_t ) ), m_nHits( 0 ), m_nMisses( 0 ), m_nAdds( 0 ) {}
+
+	void Init()
+	{
+		CCacheClientBaseClass::Init( g_pDataCache, "DecodedMP3", DataCacheLimits_t( MP3_DECODE_CACHE_SIZE ) );
+	}
+
+	void Shutdown()
+	{
+		if ( GetCacheSection() )
+		{
+			CacheFlush();
+		}
+		CCacheClientBaseClass::Shutdown();
+		m_Handles.RemoveAll();
+	}
+
+	// The locked entry for the file, or NULL
+	CDecodedMP3 *Lock( FileNameHandle_t hFilename, memhandle_t *pHandle )
+	{
+		if ( !GetCacheSection() )
+			return NULL;
+
+		AUTO_LOCK( m_Mutex );
+
+		CDecodedMP3 *pDecoded = NULL;
+		unsigned short i = m_Handles.Find( hFilename );
+		if ( i != m_Handles.InvalidIndex() )
+		{
+			pDecoded = CacheLock( m_Handles[i] );
+			if ( pDecoded )
+			{
+				*pHandle = m_Handles[i];
+			}
+			else
+			{
+				// discarded by the lru
+				m_Handles.RemoveAt( i );
+			}
+		}
+
+		if ( pDecoded )
+		{
+			m_nHits++;
+		}
+		else
+		{
+			m_nMisses++;
+		}
+		return pDecoded;
+	}
+
+	void Unlock( memhandle_t handle )
+	{
+		CacheUnlock( handle );
+	}
+
+	void Add( const mp3decodeparams_t &params )
+	{
+		if ( !GetCacheSection() )
+			return;
+
+		AUTO_LOCK( m_Mutex );
+
+		// several mixers can decode the same sound at once, the first one in wins
+		unsigned short i = m_Handles.Find( params.hFilename );
+		if ( i != m_Handles.InvalidIndex() && CacheGetNoTouch( m_Handles[i] ) )
+			return;
+
+		memhandle_t handle = CacheCreate( params );
+		if ( i != m_Handles.InvalidIndex() )
+		{
+			m_Handles[i] = handle;
+		}
+		else
+		{
+			m_Handles.Insert( params.hFilename, handle );
+		}
+		m_nAdds++;
+	}
+
+	void SpewStats()
+	{
+		DataCacheStatus_t status;
+		if ( GetCacheSection() )
+		{
+			GetCacheSection()->GetStatus( &status );
+		}
+		else
+		{
+			Q_memset( &status, 0, sizeof( status ) );
+		}
+
+		int nLookups = m_nHits + m_nMisses;
+		Msg( "MP3 decode cache: %d sounds, %.2f MB\n", status.nItems, status.nBytes / ( 1024.0f * 1024.0f ) );
+		Msg( "Hits:    %d (%.2f%%)\n", m_nHits, nLookups ? 100.0f * m_nHits / nLookups : 0.0f );
+		Msg( "Misses:  %d\n", m_nMisses );
+		Msg( "Adds:    %d\n", m_nAdds );
+	}
+
+private:
+	CThreadFastMutex							m_Mutex;
+	CUtlMap< FileNameHandle_t, memhandle_t >	m_Handles;
+	int											m_nHits;
+	int											m_nMisses;
+	int											m_nAdds;
+};
+
+static CMP3DecodeCache g_MP3DecodeCache;
+
+void MP3DecodeCache_Init()
+{
+	g_MP3DecodeCache.Init();
+}
+
+void MP3DecodeCache_Shutdown()
+{
+	g_MP3DecodeCache.Shutdown();
+}
+
+CON_COMMAND( snd_mp3_decodecache_stats, "Show MP3 decode cache stats" )
+{
+	g_MP3DecodeCache.SpewStats();
+}
+
 
 CAudioMixerWaveMP3::CAudioMixerWaveMP3( IWaveData *data ) : CAudioMixerWave( data ) 
 {
@@ -27,16 +208,91 @@ CAudioMixerWaveMP3::CAudioMixerWaveMP3( IWaveData *data ) : CAudioMixerWave( dat
 	m_pStream = NULL;
 	m_bStreamInit = false;
 	m_channelCount = 0;
+	m_pDecoded = NULL;
+	m_hDecoded = 0;
+	m_hDecodedName = 0;
+	m_bRecordDecode = false;
+
+	// memory mp3s are short enough to replay from their decoded samples
+	CAudioSource &source = m_pData->Source();
+	if ( snd_mp3_decodecache.GetBool() && !source.IsStreaming() )
+	{
+		m_hDecodedName = g_pFileSystem->FindOrAddFileName( source.GetFileName() );
+		m_pDecoded = g_MP3DecodeCache.Lock( m_hDecodedName, &m_hDecoded );
+		if ( m_pDecoded )
+		{
+			m_channelCount = m_pDecoded->m_nChannels;
+			m_sampleCount = m_pDecoded->m_Samples.Count();
+		}
+		else
+		{
+			// decode it this time, keeping the output for the next mixer
+			m_bRecordDecode = true;
+		}
+	}
 }
 
 
 CAudioMixerWaveMP3::~CAudioMixerWaveMP3( void )
 {
+	ReleaseDecoded();
+
 	if ( m_pStream )
 		delete m_pStream;
 }
 
 
+void CAudioMixerWaveMP3::ReleaseDecoded()
+{
+	if ( m_pDecoded )
+	{
+		g_MP3DecodeCache.Unlock( m_hDecoded );
+		m_pDecoded = NULL;
+		m_hDecoded = 0;
+		m_sampleCount = 0;
+		m_samplePosition = 0;
+	}
+
+	m_bRecordDecode = false;
+	m_DecodeRecording.Purge();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Keeps each decoded block, the whole sound goes into the decode cache
+//			when the decoder reaches the end of the file
+//-----------------------------------------------------------------------------
+void CAudioMixerWaveMP3::RecordDecodedBlock()
+{
+	if ( m_sampleCount > 0 )
+	{
+		if ( m_DecodeRecording.Count() + m_sampleCount > snd_mp3_decodecache_maxsound.GetInt() )
+		{
+			// too long to be worth caching
+			ReleaseDecoded();
+			return;
+		}
+
+		m_DecodeRecording.AddMultipleToTail( m_sampleCount, m_samples );
+		return;
+	}
+
+	// end of stream, only a sound decoded from its first to its last byte is cached
+	if ( m_DecodeRecording.Count() && m_pStream && m_offset + m_headerOffset >= m_pData->Source().SampleCount() )
+	{
+		mp3decodeparams_t params;
+		params.hFilename = m_hDecodedName;
+		params.pSamples = m_DecodeRecording.Base();
+		params.nBytes = m_DecodeRecording.Count();
+		params.nChannels = m_pStream->GetOutputChannels();
+		params.nRate = m_pStream->GetOutputRate();
+		g_MP3DecodeCache.Add( params );
+	}
+
+	ReleaseDecoded();
+}
+
+
 void CAudioMixerWaveMP3::Mix( IAudioDevice *pDevice, channel_t *pChannel, void *pData, int outputOffset, int inputOffset, fixedint fracRate, int outCount, int timecompress )
 {
 	Assert( IsReadyToMix() );
@@ -132,6 +388,12 @@ bool CAudioMixerWaveMP3::DecodeBlock()
 
 	m_sampleCount = pStream->Decode( m_samples, sizeof(m_samples) );
 	m_samplePosition = 0;
+
+	if ( m_bRecordDecode )
+	{
+		RecordDecodedBlock();
+	}
+
 	return m_sampleCount > 0;
 }
 
@@ -175,21 +437,34 @@ int CAudioMixerWaveMP3::GetOutputData( void **pData, int sampleCount, char copyB
 {
 	if ( m_samplePosition >= m_sampleCount )
 	{
-		if ( !DecodeBlock() )
+		// a cached sound is decoded in full, there are no more blocks
+		if ( m_pDecoded || !DecodeBlock() )
 			return 0;
 	}
 
-	IAudioStream *pStream = GetStream();
-	if ( !pStream )
+	char *pSamples;
+	int sampleSize;
+	if ( m_pDecoded )
 	{
-		// Needed for channel count, and with a failed stream init we probably should fail to return data anyway.
-		return 0;
+		pSamples = m_pDecoded->m_Samples.Base();
+		sampleSize = m_pDecoded->m_nChannels * 2;
+	}
+	else
+	{
+		IAudioStream *pStream = GetStream();
+		if ( !pStream )
+		{
+			// Needed for channel count, and with a failed stream init we probably should fail to return data anyway.
+			return 0;
+		}
+
+		pSamples = m_samples;
+		sampleSize = pStream->GetOutputChannels() * 2;
 	}
 
 	if ( m_samplePosition < m_sampleCount )
 	{
-		int sampleSize = pStream->GetOutputChannels() * 2;
-		*pData = (void *)(m_samples + m_samplePosition);
+		*pData = (void *)(pSamples + m_samplePosition);
 		int available = m_sampleCount - m_samplePosition;
 		int bytesRequired = sampleCount * sampleSize;
 		if ( available > bytesRequired )
@@ -226,6 +501,37 @@ void CAudioMixerWaveMP3::SetSampleStart( int newPosition )
 	// UNDONE: Implement this?
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: A cached sound plays from its start after a restore. The saved
+//			positions are decoder positions, which only a decoder can seek to.
+//-----------------------------------------------------------------------------
+int CAudioMixerWaveMP3::GetPositionForSave()
+{
+	if ( m_pDecoded )
+		return 0;
+
+	return GetStream() ? GetStream()->GetPosition() : 0;
+}
+
+void CAudioMixerWaveMP3::SetPositionFromSaved( int position )
+{
+	// play the rest of the sound through the decoder, and don't cache a partial decode
+	ReleaseDecoded();
+
+	if ( GetStream() )
+	{
+		GetStream()->SetPosition( position );
+	}
+}
+
+int CAudioMixerWaveMP3::GetStreamOutputRate()
+{
+	if ( m_pDecoded )
+		return m_pDecoded->m_nRate;
+
+	return GetStream() ? GetStream()->GetOutputRate() : 0;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : delaySamples - 
@@ -235,4 +541,14 @@ void CAudioMixerWaveMP3::SetStartupDelaySamples( int delaySamples )
 	m_delaySamples = delaySamples;
 }
 
+#else
+
+void MP3DecodeCache_Init()
+{
+}
+
+void MP3DecodeCache_Shutdown()
+{
+}
+
 #endif
@@ -12,6 +12,8 @@
 
 static const int MP3_BUFFER_SIZE = 16384;
 
+class CDecodedMP3;
+
 class CAudioMixerWaveMP3 : public CAudioMixerWave, public IAudioStreamEvent
 {
 public:
@@ -25,8 +27,8 @@ public:
 	// UNDONE: This doesn't quite work with MP3 - we need a MP3 position, not a sample position
 	void SetSampleStart( int newPosition );
 
-	int GetPositionForSave() { return GetStream() ? GetStream()->GetPosition() : 0; }
-	void SetPositionFromSaved(int position) { if ( GetStream() ) GetStream()->SetPosition(position); }
+	int GetPositionForSave();
+	void SetPositionFromSaved( int position );
 
 	// IAudioStreamEvent
 	virtual int StreamRequestData( void *pBuffer, int bytesRequested, int offset );
@@ -34,12 +36,14 @@ public:
 	virtual void SetStartupDelaySamples( int delaySamples );
 	virtual int GetMixSampleSize() { return CalcSampleSize( 16, m_channelCount ); }
 
-	virtual int GetStreamOutputRate() { return GetStream() ? GetStream()->GetOutputRate() : 0; }
+	virtual int GetStreamOutputRate();
 
 private:
 	IAudioStream			*GetStream();
 	bool					DecodeBlock( void );
 	void					GetID3HeaderOffset();
+	void					RecordDecodedBlock();
+	void					ReleaseDecoded();
 
 	// Lazily initialized, use GetStream
 	IAudioStream			*m_pStream;
@@ -52,8 +56,19 @@ private:
 	int						m_offset;
 	int						m_delaySamples;
 	int						m_headerOffset;
+
+	// Playing from (or recording into) the decode cache
+	CDecodedMP3				*m_pDecoded;
+	memhandle_t				m_hDecoded;
+	FileNameHandle_t		m_hDecodedName;
+	bool					m_bRecordDecode;
+	CUtlVector<char>		m_DecodeRecording;
 };
 
 CAudioMixerWaveMP3 *CreateMP3Mixer( IWaveData *data );
 
+// Decoded sample cache for short MP3s, lives in its own datacache section
+void MP3DecodeCache_Init();
+void MP3DecodeCache_Shutdown();
+
 #endif // SND_WAVE_MIXER_MP3_H
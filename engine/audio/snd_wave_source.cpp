@@ -8,6 +8,7 @@
 
 #include "audio_pch.h"
 #include "snd_mp3_source.h"
+#include "snd_wave_mixer_mp3.h"
 #include "utlsymbol.h"
 #include "checksum_crc.h"
 #include "host.h"
@@ -2372,6 +2373,8 @@ bool CAudioSourceCache::Init( unsigned int memSize )
 		return false;
 	}
 
+	MP3DecodeCache_Init();
+
 	if ( IsX360() )
 	{
 		// 360 doesn't use audio source caches
@@ -2467,6 +2470,7 @@ void CAudioSourceCache::Shutdown()
 	CheckSaveDirtyCaches();
 	m_vecCaches.PurgeAndDeleteElements();
 
+	MP3DecodeCache_Shutdown();
 	wavedatacache->Shutdown();
 }
 
@@ -261,7 +261,7 @@ DECLARE_TIER3_INTERFACE( IBik, g_pBIK );
 #define DMEMAKEFILE_UTILS_INTERFACE_VERSION		"VDmeMakeFileUtils001"
 DECLARE_TIER3_INTERFACE( IDmeMakefileUtils, g_pDmeMakefileUtils );
 
-#define VPHYSICS_COLLISION_INTERFACE_VERSION	"VPhysicsCollision007"
+#define VPHYSICS_COLLISION_INTERFACE_VERSION	"VPhysicsCollision008"
 DECLARE_TIER3_INTERFACE( IPhysicsCollision, g_pPhysicsCollision );
 
 #define SOUNDEMITTERSYSTEM_INTERFACE_VERSION	"VSoundEmitter003"
@@ -55,6 +55,10 @@
 #if !defined( _X360 )
 #include "xbox/xboxstubs.h"
 #endif
+#if defined( LINUX )
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -77,6 +81,9 @@
 #define PROGRESS_PREPURGE			0.22f
 #define PROGRESS_IO					0.25f	// up to 1.0
 
+// read-ahead fallback reads through a scratch buffer of this size
+#define READAHEAD_SCRATCH_SIZE		( 1024*1024 )
+
 struct FileJob_t
 {
 	FileJob_t()
@@ -101,6 +108,12 @@ struct FileJob_t
 	LoaderError_t			m_LoaderError;
 	unsigned int			m_ThreadId;
 
+	// resolved on disk location, for read-ahead planning
+	FileNameHandle_t		m_hPhysicalFilename;
+	int64					m_nPhysicalOffset;
+	int						m_nPhysicalSize;
+	ResourcePreload_t		m_ResourceType;
+
 	unsigned int			m_bFinished : 1;
 	unsigned int			m_bFreeTargetAfterIO : 1;
 	unsigned int			m_bFileExists : 1;
@@ -188,6 +201,7 @@ private:
 	void								GetJobRequests();
 	void								PurgeUnreferencedResources();
 	void								AddResourceToTable( const char *pFilename );
+	void								PlanReadAhead( const CUtlVector< FileJob_t* > &fileJobs );
 
 	bool								m_bStarted;
 	bool								m_bActive;
@@ -270,6 +284,37 @@ static int				g_nHighIOSuspensionMark;
 static int				g_nLowIOSuspensionMark;
 
 ConVar loader_spew_info( "loader_spew_info", "0", 0, "0:Off, 1:Timing, 2:Completions, 3:Late Completions, 4:Purges, -1:All " );
+ConVar loader_readahead( "loader_readahead", "0", 0, "Plan queued I/O by physical file and offset, and prefetch coalesced spans ahead of the async reads" );
+ConVar loader_readahead_gap( "loader_readahead_gap", "262144", 0, "Largest hole (bytes) bridged when coalescing read-ahead spans" );
+ConVar loader_readahead_span( "loader_readahead_span", "8388608", 0, "Largest single read-ahead span (bytes)" );
+ConVar loader_stall_ms( "loader_stall_ms", "30", 0, "A single async read blocking longer than this (ms) counts as a stall" );
+
+// per resource type i/o accounting, reported by SpewInfo
+struct LoaderIOStats_t
+{
+	int				m_nJobs;
+	int				m_nStalls;
+	int64			m_nBytes;
+	unsigned int	m_nBlockedTime;
+	unsigned int	m_FirstSubmitTime;
+	unsigned int	m_LastFinishTime;
+};
+static LoaderIOStats_t	g_IOStats[RESOURCEPRELOAD_COUNT];
+static CThreadFastMutex	g_IOStatsMutex;
+static unsigned int		g_LastIOFinishTime;
+
+// read-ahead accounting
+static CInterlockedInt	g_nReadAheadSpans;
+static CInterlockedInt	g_nReadAheadJobs;
+static int64			g_nReadAheadBytes;
+static float			g_flReadAheadTime;
+
+struct ReadAheadSpan_t
+{
+	FileNameHandle_t	m_hFilename;
+	int64				m_nStart;
+	int64				m_nEnd;
+};
 
 // Kyle says: this is here only to change the DLL size to force clients to update! This should be removed
 //			  by whoever sees this comment after we've shipped a DLL using it!
@@ -419,6 +464,169 @@ void CQueuedLoader::BuildMaterialResources( IResourcePreload *pLoader, ResourceL
 	*pBuildTime = Plat_FloatTime() - t0;
 }
 
+//-----------------------------------------------------------------------------
+// Classify a job by its file for i/o accounting. Only approximates the loader
+// that requested it, a model loader requests its .vvd, .vtx, etc as well.
+//-----------------------------------------------------------------------------
+static ResourcePreload_t GetResourceTypeForJob( const char *pFilename, bool bAnonymous )
+{
+	if ( bAnonymous )
+	{
+		return RESOURCEPRELOAD_ANONYMOUS;
+	}
+
+	const char *pExt = V_GetFileExtension( pFilename );
+	if ( !pExt )
+	{
+		return RESOURCEPRELOAD_UNKNOWN;
+	}
+
+	if ( !V_stricmp( pExt, "wav" ) || !V_stricmp( pExt, "mp3" ) )
+	{
+		return RESOURCEPRELOAD_SOUND;
+	}
+	else if ( !V_stricmp( pExt, "vtf" ) )
+	{
+		return ( V_stristr( pFilename, "maps" ) && V_stristr( pFilename, "materials" ) ) ? RESOURCEPRELOAD_CUBEMAP : RESOURCEPRELOAD_MATERIAL;
+	}
+	else if ( !V_stricmp( pExt, "vmt" ) )
+	{
+		return RESOURCEPRELOAD_MATERIAL;
+	}
+	else if ( !V_stricmp( pExt, "mdl" ) || !V_stricmp( pExt, "vvd" ) || !V_stricmp( pExt, "vtx" ) || 
+			!V_stricmp( pExt, "phy" ) || !V_stricmp( pExt, "ani" ) || !V_stricmp( pExt, "bsp" ) )
+	{
+		return RESOURCEPRELOAD_MODEL;
+	}
+	else if ( !V_stricmp( pExt, "vhv" ) )
+	{
+		return RESOURCEPRELOAD_STATICPROPLIGHTING;
+	}
+
+	return RESOURCEPRELOAD_UNKNOWN;
+}
+
+static void ResetIOStats()
+{
+	AUTO_LOCK( g_IOStatsMutex );
+	V_memset( g_IOStats, 0, sizeof( g_IOStats ) );
+	g_LastIOFinishTime = 0;
+	g_nReadAheadSpans = 0;
+	g_nReadAheadJobs = 0;
+	g_nReadAheadBytes = 0;
+	g_flReadAheadTime = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Called from I/O thread on each completion. The async reads are serviced one
+// at a time, so the time spent blocked in a read is measured from the later of
+// its submission or the previous completion.
+//-----------------------------------------------------------------------------
+static void RecordIOCompletion( FileJob_t *pFileJob, int numReadBytes )
+{
+	unsigned int finishTime = Plat_MSTime();
+
+	AUTO_LOCK( g_IOStatsMutex );
+	unsigned int startTime = MAX( pFileJob->m_SubmitTime, g_LastIOFinishTime );
+	unsigned int blockedTime = finishTime - MIN( startTime, finishTime );
+	g_LastIOFinishTime = finishTime;
+
+	LoaderIOStats_t &stats = g_IOStats[pFileJob->m_ResourceType];
+	if ( !stats.m_nJobs || pFileJob->m_SubmitTime < stats.m_FirstSubmitTime )
+	{
+		stats.m_FirstSubmitTime = pFileJob->m_SubmitTime;
+	}
+	stats.m_LastFinishTime = MAX( stats.m_LastFinishTime, finishTime );
+	stats.m_nJobs++;
+	stats.m_nBytes += numReadBytes;
+	stats.m_nBlockedTime += blockedTime;
+	if ( blockedTime > (unsigned int)loader_stall_ms.GetInt() )
+	{
+		stats.m_nStalls++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Worker job, pulls the planned spans into the OS file cache ahead of the 
+// async reads that consume them.
+//-----------------------------------------------------------------------------
+static void ReadAheadJob( CUtlVector< ReadAheadSpan_t > *pPlan )
+{
+	float t0 = Plat_FloatTime();
+	int64 nBytes = 0;
+
+#if !defined( LINUX )
+	void *pScratch = malloc( READAHEAD_SCRATCH_SIZE );
+#endif
+
+	char szFilename[MAX_PATH];
+	for ( int i = 0; i < pPlan->Count(); i++ )
+	{
+		const ReadAheadSpan_t &span = pPlan->Element( i );
+		g_QueuedLoader.GetFilename( span.m_hFilename, szFilename, sizeof( szFilename ) );
+		int64 nLength = span.m_nEnd - span.m_nStart;
+
+#if defined( LINUX )
+		int fd = open( szFilename, O_RDONLY );
+		if ( fd == -1 )
+		{
+			continue;
+		}
+		// readahead blocks until the span is in the page cache, fadvise only hints
+		if ( readahead( fd, span.m_nStart, nLength ) != 0 )
+		{
+			posix_fadvise( fd, span.m_nStart, nLength, POSIX_FADV_WILLNEED );
+		}
+		close( fd );
+		nBytes += nLength;
+#else
+		// no kernel read-ahead, one large read warms the os cache the same way
+		FileHandle_t hFile = g_pFullFileSystem->Open( szFilename, "rb" );
+		if ( !hFile )
+		{
+			continue;
+		}
+		g_pFullFileSystem->Seek( hFile, (int)span.m_nStart, FILESYSTEM_SEEK_HEAD );
+		while ( nLength > 0 )
+		{
+			int nRead = g_pFullFileSystem->Read( pScratch, (int)MIN( nLength, (int64)READAHEAD_SCRATCH_SIZE ), hFile );
+			if ( nRead <= 0 )
+			{
+				break;
+			}
+			nLength -= nRead;
+			nBytes += nRead;
+		}
+		g_pFullFileSystem->Close( hFile );
+#endif
+	}
+
+#if !defined( LINUX )
+	free( pScratch );
+#endif
+
+	{
+		AUTO_LOCK( g_IOStatsMutex );
+		g_nReadAheadBytes += nBytes;
+		g_flReadAheadTime += Plat_FloatTime() - t0;
+	}
+
+	delete pPlan;
+}
+
+static int __cdecl ReadAheadSpanCompare( const ReadAheadSpan_t *pLHS, const ReadAheadSpan_t *pRHS )
+{
+	if ( pLHS->m_hFilename != pRHS->m_hFilename )
+	{
+		return ( pLHS->m_hFilename < pRHS->m_hFilename ) ? -1 : 1;
+	}
+	if ( pLHS->m_nStart != pRHS->m_nStart )
+	{
+		return ( pLHS->m_nStart < pRHS->m_nStart ) ? -1 : 1;
+	}
+	return 0;
+}
+
 //-----------------------------------------------------------------------------
 // Called by multiple worker threads.  Throttle the I/O to ensure too many
 // buffers don't flood the work queue. Anonymous I/O is allowed to grow unbounded.
@@ -584,6 +792,8 @@ void IOAsyncCallback( const FileAsyncRequest_t &asyncRequest, int numReadBytes,
 		loaderError = LOADERERROR_READING;
 	}
 
+	RecordIOCompletion( pFileJob, numReadBytes );
+
 	// track how much i/o data is in flight, consumption will decrement
 	if ( !pFileJob->m_pCallback )
 	{
@@ -746,26 +956,49 @@ bool CQueuedLoader::CFileJobsLessFunc::Less( FileJob_t* const &pFileJobLHS, File
 		return ( pFileJobLHS->m_Priority > pFileJobRHS->m_Priority );
 	}
 
-	if ( pFileJobLHS->m_hFilename == pFileJobRHS->m_hFilename )
+	// read-ahead planned jobs sort by the file holding the data (vpk chunk) and its offset on disk,
+	// everything else by its own file (zip) and offset
+	bool bPhysicalLHS = pFileJobLHS->m_hPhysicalFilename != NULL;
+	bool bPhysicalRHS = pFileJobRHS->m_hPhysicalFilename != NULL;
+	if ( bPhysicalLHS != bPhysicalRHS )
 	{
-		// same file (zip), sort by offset
-		return pFileJobLHS->m_nStartOffset < pFileJobRHS->m_nStartOffset;
+		return bPhysicalLHS;
 	}
 
-	char szFilenameLHS[MAX_PATH];
-	char szFilenameRHS[MAX_PATH];
-	g_QueuedLoader.GetFilename( pFileJobLHS->m_hFilename, szFilenameLHS, sizeof( szFilenameLHS ) );
-	g_QueuedLoader.GetFilename( pFileJobRHS->m_hFilename, szFilenameRHS, sizeof( szFilenameRHS ) );
+	FileNameHandle_t hFilenameLHS = bPhysicalLHS ? pFileJobLHS->m_hPhysicalFilename : pFileJobLHS->m_hFilename;
+	FileNameHandle_t hFilenameRHS = bPhysicalRHS ? pFileJobRHS->m_hPhysicalFilename : pFileJobRHS->m_hFilename;
+	if ( hFilenameLHS != hFilenameRHS )
+	{
+		char szFilenameLHS[MAX_PATH];
+		char szFilenameRHS[MAX_PATH];
+		g_QueuedLoader.GetFilename( hFilenameLHS, szFilenameLHS, sizeof( szFilenameLHS ) );
+		g_QueuedLoader.GetFilename( hFilenameRHS, szFilenameRHS, sizeof( szFilenameRHS ) );
 
-	// resolve filename to match disk layout of zips
-	int layoutLHS = GetLayoutOrderForFilename( szFilenameLHS );
-	int layoutRHS = GetLayoutOrderForFilename( szFilenameRHS );
-	if ( layoutLHS != layoutRHS )
+		// resolve filename to match disk layout of zips
+		int layoutLHS = GetLayoutOrderForFilename( szFilenameLHS );
+		int layoutRHS = GetLayoutOrderForFilename( szFilenameRHS );
+		if ( layoutLHS != layoutRHS )
+		{
+			return layoutLHS < layoutRHS;
+		}
+
+		int nCompare = Q_stricmp( szFilenameLHS, szFilenameRHS );
+		if ( nCompare )
+		{
+			return nCompare < 0;
+		}
+	}
+
+	// same file, sort by offset
+	int64 nOffsetLHS = ( bPhysicalLHS ? pFileJobLHS->m_nPhysicalOffset : 0 ) + pFileJobLHS->m_nStartOffset;
+	int64 nOffsetRHS = ( bPhysicalRHS ? pFileJobRHS->m_nPhysicalOffset : 0 ) + pFileJobRHS->m_nStartOffset;
+	if ( nOffsetLHS != nOffsetRHS )
 	{
-		return layoutLHS < layoutRHS;
+		return nOffsetLHS < nOffsetRHS;
 	}
 
-	return CaselessStringLessThan( szFilenameLHS, szFilenameRHS );
+	// keep the ordering strict for jobs that read the same data
+	return pFileJobLHS < pFileJobRHS;
 }
 
 //-----------------------------------------------------------------------------
@@ -810,6 +1043,11 @@ void CQueuedLoader::SubmitPendingJobs()
 	}
 	sortedFiles.RedoSort();
 
+	if ( loader_readahead.GetBool() )
+	{
+		PlanReadAhead( sortedFiles );
+	}
+
 	FileAsyncRequest_t asyncRequest;
 	asyncRequest.pfnCallback = IOAsyncCallback;
 
@@ -869,6 +1107,75 @@ void CQueuedLoader::SubmitPendingJobs()
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Coalesce the physical extents of the jobs about to be submitted into large
+// spans and hand them to a worker to prefetch ahead of the async reads.
+//-----------------------------------------------------------------------------
+void CQueuedLoader::PlanReadAhead( const CUtlVector< FileJob_t* > &fileJobs )
+{
+	CUtlVector< ReadAheadSpan_t > *pPlan = new CUtlVector< ReadAheadSpan_t >( 0, fileJobs.Count() );
+	for ( int i = 0; i < fileJobs.Count(); i++ )
+	{
+		FileJob_t *pFileJob = fileJobs[i];
+		if ( !pFileJob->m_bFileExists || !pFileJob->m_hPhysicalFilename )
+		{
+			continue;
+		}
+
+		int nBytes = pFileJob->m_nBytesToRead ? pFileJob->m_nBytesToRead : pFileJob->m_nPhysicalSize - (int)pFileJob->m_nStartOffset;
+		if ( nBytes <= 0 )
+		{
+			continue;
+		}
+
+		ReadAheadSpan_t &span = pPlan->Element( pPlan->AddToTail() );
+		span.m_hFilename = pFileJob->m_hPhysicalFilename;
+		span.m_nStart = pFileJob->m_nPhysicalOffset + pFileJob->m_nStartOffset;
+		span.m_nEnd = span.m_nStart + nBytes;
+	}
+
+	int nJobs = pPlan->Count();
+	if ( !nJobs )
+	{
+		delete pPlan;
+		return;
+	}
+
+	// merge neighbors, bridging small holes, up to the span limit
+	pPlan->Sort( ReadAheadSpanCompare );
+	int64 nMaxGap = loader_readahead_gap.GetInt();
+	int64 nMaxSpan = loader_readahead_span.GetInt();
+	int64 nTotalBytes = 0;
+	int nSpans = 0;
+	for ( int i = 0; i < pPlan->Count(); i++ )
+	{
+		const ReadAheadSpan_t &next = pPlan->Element( i );
+		if ( nSpans )
+		{
+			ReadAheadSpan_t &span = pPlan->Element( nSpans - 1 );
+			if ( span.m_hFilename == next.m_hFilename && next.m_nStart <= span.m_nEnd + nMaxGap && MAX( span.m_nEnd, next.m_nEnd ) - span.m_nStart <= nMaxSpan )
+			{
+				nTotalBytes += MAX( span.m_nEnd, next.m_nEnd ) - span.m_nEnd;
+				span.m_nEnd = MAX( span.m_nEnd, next.m_nEnd );
+				continue;
+			}
+		}
+		pPlan->Element( nSpans++ ) = next;
+		nTotalBytes += next.m_nEnd - next.m_nStart;
+	}
+	pPlan->SetCountNonDestructively( nSpans );
+
+	g_nReadAheadSpans += nSpans;
+	g_nReadAheadJobs += nJobs;
+
+	if ( GetSpewDetail() & LOADER_DETAIL_TIMING )
+	{
+		Msg( "QueuedLoader: Read-ahead %d jobs as %d spans, %.2f MB\n", nJobs, nSpans, (float)nTotalBytes / ( 1024.0f * 1024.0f ) );
+	}
+
+	g_pThreadPool->QueueCall( ReadAheadJob, pPlan )->Release();
+}
+
 //-----------------------------------------------------------------------------
 // Add to queue
 //-----------------------------------------------------------------------------
@@ -950,6 +1257,21 @@ bool CQueuedLoader::AddJob( const LoaderJob_t *pLoaderJob )
 	pFileJob->m_nBytesToRead = pLoaderJob->m_nBytesToRead;
 	pFileJob->m_nStartOffset = pLoaderJob->m_nStartOffset;
 	pFileJob->m_Priority = bFileIsFromBSP ? LOADERPRIORITY_DURINGPRELOAD : pLoaderJob->m_Priority;
+	pFileJob->m_ResourceType = GetResourceTypeForJob( pFullPath, pLoaderJob->m_pCallback == NULL );
+
+	if ( bExists && loader_readahead.GetBool() )
+	{
+		// resolve the vpk chunk (or loose file) and offset on disk, allows the sort to linearize physical reads
+		char szPhysicalPath[MAX_PATH];
+		int64 nPhysicalOffset;
+		int nPhysicalSize;
+		if ( BaseFileSystem()->ResolvePhysicalFileLocation( pFullPath, szPhysicalPath, sizeof( szPhysicalPath ), nPhysicalOffset, nPhysicalSize ) )
+		{
+			pFileJob->m_hPhysicalFilename = m_Filenames.FindOrAddFileName( szPhysicalPath );
+			pFileJob->m_nPhysicalOffset = nPhysicalOffset;
+			pFileJob->m_nPhysicalSize = nPhysicalSize;
+		}
+	}
 
 	if ( pLoaderJob->m_pTargetData )
 	{
@@ -1295,6 +1617,40 @@ void CQueuedLoader::SpewInfo()
 	{
 		Msg( "Queuing Duration: %dms\n", m_EndTime - m_StartTime );
 	}
+
+	Msg( "I/O By Type: (stall > %dms)\n", loader_stall_ms.GetInt() );
+	{
+		AUTO_LOCK( g_IOStatsMutex );
+		for ( int i = 0; i < RESOURCEPRELOAD_COUNT; i++ )
+		{
+			const LoaderIOStats_t &stats = g_IOStats[i];
+			if ( !stats.m_nJobs )
+			{
+				continue;
+			}
+
+			float flMB = (float)stats.m_nBytes / ( 1024.0f * 1024.0f );
+			unsigned int duration = MAX( stats.m_LastFinishTime - stats.m_FirstSubmitTime, 1u );
+			Msg( "  %-12s Jobs:%5d Size:%8.2f MB Rate:%7.2f MB/s Blocked:%6dms Stalls:%d\n", 
+				g_ResourceLoaderNames[i],
+				stats.m_nJobs,
+				flMB,
+				flMB * 1000.0f / (float)duration,
+				stats.m_nBlockedTime,
+				stats.m_nStalls );
+		}
+
+		if ( g_nReadAheadSpans )
+		{
+			float flMB = (float)g_nReadAheadBytes / ( 1024.0f * 1024.0f );
+			Msg( "Read-Ahead: %d Jobs in %d Spans, %.2f MB in %.2f seconds (%.2f MB/s)\n", 
+				(int)g_nReadAheadJobs, 
+				(int)g_nReadAheadSpans, 
+				flMB, 
+				g_flReadAheadTime, 
+				g_flReadAheadTime > 0 ? flMB / g_flReadAheadTime : 0.0f );
+		}
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -1682,6 +2038,7 @@ bool CQueuedLoader::BeginMapLoading( const char *pMapName, bool bLoadForHDR, boo
 	g_nAnonymousIOMemory = 0;
 	g_nIOMemoryPeak = 0;
 	g_nAnonymousIOMemoryPeak = 0;
+	ResetIOStats();
 
 	m_bSameMap = bOptimizeMapReload && ( V_stricmp( pMapName, m_szMapNameToCompareSame ) == 0 );
 	if ( m_bSameMap )
@@ -1902,6 +2259,7 @@ void CQueuedLoader::DynamicLoadMapResource( const char *pFilename, DynamicResour
 	m_pDynamicContext2 = pContext2;
 
 	CleanQueue();
+	ResetIOStats();
 	AddResourceToTable( m_DynamicFileName );
 
 	// run the distributed precache loaders, generating a batch of i/o requests
@@ -4491,6 +4491,57 @@ const char *CBaseFileSystem::RelativePathToFullPath( const char *pFileName, cons
 	return NULL;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Resolves a full path to the physical file and range on disk that holds
+//			its data. Used by the queued loader to plan read-ahead.
+//-----------------------------------------------------------------------------
+bool CBaseFileSystem::ResolvePhysicalFileLocation( const char *pFullPath, OUT_Z_CAP(maxLenInChars) char *pDest, int maxLenInChars, int64 &nOffset, int &nSize )
+{
+	nOffset = 0;
+	nSize = 0;
+
+	char szFixedPath[MAX_PATH];
+	V_strncpy( szFixedPath, pFullPath, sizeof( szFixedPath ) );
+	V_FixSlashes( szFixedPath );
+
+#ifdef SUPPORT_PACKED_STORE
+	{
+		AUTO_LOCK( m_SearchPathsMutex );
+		for ( int i = 0; i < m_SearchPaths.Count(); i++ )
+		{
+			CPackedStore *pVPK = m_SearchPaths[i].GetPackedStore();
+			if ( !pVPK )
+				continue;
+
+			char szVPKName[MAX_PATH];
+			V_strncpy( szVPKName, pVPK->FullPathName(), sizeof( szVPKName ) );
+			V_FixSlashes( szVPKName );
+
+			// encoded as <vpk full path><slash><relative name>
+			int nLen = V_strlen( szVPKName );
+			if ( V_strnicmp( szFixedPath, szVPKName, nLen ) || szFixedPath[nLen] != CORRECT_PATH_SEPARATOR )
+				continue;
+
+			CPackedStoreFileHandle vpkHandle = pVPK->OpenFile( szFixedPath + nLen + 1 );
+			if ( !vpkHandle )
+				return false;
+
+			pVPK->GetDataFileLocation( vpkHandle, pDest, maxLenInChars, nOffset, nSize );
+			return true;
+		}
+	}
+#endif
+
+	// loose file, zip packed entries don't exist on disk under their encoded name and fail here
+	struct _stat buf;
+	if ( FS_stat( szFixedPath, &buf ) == -1 || ( buf.st_mode & _S_IFDIR ) )
+		return false;
+
+	V_strncpy( pDest, szFixedPath, maxLenInChars );
+	nSize = buf.st_size;
+	return true;
+}
+
 const char *CBaseFileSystem::GetLocalPath( const char *pFileName, OUT_Z_CAP(maxLenInChars) char *pDest, int maxLenInChars )
 {
 	CHECK_DOUBLE_SLASHES( pFileName );
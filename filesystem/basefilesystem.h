@@ -408,6 +408,10 @@ public:
 	// can be filtered to restrict path types and can provide info about resolved path
 	virtual const char			*RelativePathToFullPath( const char *pFileName, const char *pPathID, OUT_Z_CAP(maxLenInChars) char *pDest, int maxLenInChars, PathTypeFilter_t pathFilter = FILTER_NONE, PathTypeQuery_t *pPathType = NULL );
 
+	// resolves a full path (as returned by RelativePathToFullPath) to the physical file and byte range holding its data
+	// VPK entries resolve to their chunk file, loose files to themselves, zip packed entries are not resolved
+	bool						ResolvePhysicalFileLocation( const char *pFullPath, OUT_Z_CAP(maxLenInChars) char *pDest, int maxLenInChars, int64 &nOffset, int &nSize );
+
 	// Returns the search path, each path is separated by ;s. Returns the length of the string returned
 	virtual int					GetSearchPath( const char *pathID, bool bGetPackFiles, OUT_Z_CAP(maxLenInChars) char *pDest, int maxLenInChars );
 
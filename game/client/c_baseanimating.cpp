@@ -2644,6 +2644,57 @@ CMouthInfo *C_BaseAnimating::GetMouth( void )
 	return &m_mouth;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Times the scalar and SIMD bone setup paths on one model
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( anim_simd_bench, "Time the scalar and SIMD bone setup paths on a model. Usage: anim_simd_bench <model> [iterations]", FCVAR_CHEAT )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: anim_simd_bench <model> [iterations]\n" );
+		return;
+	}
+
+	MDLCACHE_CRITICAL_SECTION();
+	const model_t *pModel = modelinfo->FindOrLoadModel( args[1] );
+	studiohdr_t *pStudioModel = pModel ? modelinfo->GetStudiomodel( pModel ) : NULL;
+	if ( !pStudioModel )
+	{
+		Warning( "anim_simd_bench: couldn't load %s\n", args[1] );
+		return;
+	}
+
+	int nIterations = ( args.ArgC() >= 3 ) ? atoi( args[2] ) : 100;
+	CStudioHdr studioHdr( pStudioModel, mdlcache );
+	Studio_BenchmarkBoneSetup( &studioHdr, MAX( nIterations, 1 ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times walking the compressed animation tracks of a model against
+//			the decoded tables kept by the model cache
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( anim_decode_bench, "Time animation decode with and without the decoded animation cache. Usage: anim_decode_bench <model> [iterations]", FCVAR_CHEAT )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: anim_decode_bench <model> [iterations]\n" );
+		return;
+	}
+
+	MDLCACHE_CRITICAL_SECTION();
+	const model_t *pModel = modelinfo->FindOrLoadModel( args[1] );
+	studiohdr_t *pStudioModel = pModel ? modelinfo->GetStudiomodel( pModel ) : NULL;
+	if ( !pStudioModel )
+	{
+		Warning( "anim_decode_bench: couldn't load %s\n", args[1] );
+		return;
+	}
+
+	int nIterations = ( args.ArgC() >= 3 ) ? atoi( args[2] ) : 100;
+	CStudioHdr studioHdr( pStudioModel, mdlcache );
+	Studio_BenchmarkAnimDecode( &studioHdr, MAX( nIterations, 1 ) );
+}
+
 #ifdef DEBUG_BONE_SETUP_THREADING
 ConVar cl_warn_thread_contested_bone_setup("cl_warn_thread_contested_bone_setup", "0" );
 #endif
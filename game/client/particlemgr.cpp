@@ -1807,6 +1807,9 @@ void CParticleMgr::UpdateNewEffects( float flTimeDelta )
 
 	g_pParticleSystemMgr->SetLastSimulationTime( gpGlobals->curtime );
 
+	// Also covers the children and the render batch lists the library runs on the job pool
+	g_pParticleSystemMgr->EnableParallelSimulation( r_threaded_particles.GetBool() );
+
 	int nParticleActiveParticlesCount = 0;
 	int nParticleStatsTriggerCount = cl_particle_stats_trigger_count.GetInt();
 
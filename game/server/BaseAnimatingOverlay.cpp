@@ -434,6 +434,28 @@ void CAnimationLayer::DispatchAnimEvents( CBaseAnimating *eventHandler, CBaseAni
 
 
 
+void CBaseAnimatingOverlay::AccumulateBonePoseCRC( CRC32_t &crc )
+{
+	BaseClass::AccumulateBonePoseCRC( crc );
+
+	for ( int i = 0; i < m_AnimOverlay.Count(); i++ )
+	{
+		CAnimationLayer &layer = m_AnimOverlay[i];
+		if ( !layer.IsActive() )
+			continue;
+
+		int sequence = layer.m_nSequence;
+		int order = layer.m_nOrder;
+		float cycle = layer.m_flCycle;
+		float weight = layer.m_flWeight;
+
+		CRC32_ProcessBuffer( &crc, &sequence, sizeof( sequence ) );
+		CRC32_ProcessBuffer( &crc, &order, sizeof( order ) );
+		CRC32_ProcessBuffer( &crc, &cycle, sizeof( cycle ) );
+		CRC32_ProcessBuffer( &crc, &weight, sizeof( weight ) );
+	}
+}
+
 void CBaseAnimatingOverlay::GetSkeleton( CStudioHdr *pStudioHdr, Vector pos[], Quaternion q[], int boneMask )
 {
 	if(!pStudioHdr)
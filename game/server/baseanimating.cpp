@@ -27,11 +27,17 @@
 #include "datacache/idatacache.h"
 #include "smoke_trail.h"
 #include "props.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 ConVar ai_sequence_debug( "ai_sequence_debug", "0" );
+ConVar sv_threaded_bone_setup( "sv_threaded_bone_setup", "0", 0, "At the start of each tick, set up in parallel the bones of entities whose bones were used in the last one. Entities that move or animate before their bones are next used set them up again." );
+
+// Entities whose bone cache was asked for since the last CBaseAnimating::ThreadedBoneSetup
+static CUtlVector<CBaseAnimating *> g_BoneSetupQueue;
+static bool g_bInThreadedBoneSetup;
 
 class CIKSaveRestoreOps : public CClassPtrSaveRestoreOps
 {
@@ -288,10 +294,17 @@ CBaseAnimating::CBaseAnimating()
 	m_fadeMaxDist = 0;
 	m_flFadeScale = 0.0f;
 	m_fBoneCacheFlags = 0;
+	m_bBoneSetupQueued = false;
+	m_bBoneCachePrebuilt = false;
+	m_nPrebuiltBonePoseCRC = 0;
 }
 
 CBaseAnimating::~CBaseAnimating()
 {
+	if ( m_bBoneSetupQueued )
+	{
+		g_BoneSetupQueue.FindAndFastRemove( this );
+	}
 	Studio_DestroyBoneCache( m_boneCacheHandle );
 	delete m_pIk;
 	UnlockStudioHdr();
@@ -2587,6 +2600,24 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 	CStudioHdr *pStudioHdr = GetModelPtr( );
 	Assert(pStudioHdr);
 
+	// Whatever needs bones now will likely need them next tick too
+	if ( !g_bInThreadedBoneSetup && !m_bBoneSetupQueued && sv_threaded_bone_setup.GetBool() )
+	{
+		m_bBoneSetupQueued = true;
+		g_BoneSetupQueue.AddToTail( this );
+	}
+
+	// ThreadedBoneSetup runs before thinks and physics, anything that moved
+	// or animated since then has to be rebuilt from the current pose
+	if ( m_bBoneCachePrebuilt )
+	{
+		m_bBoneCachePrebuilt = false;
+		if ( ComputeBonePoseCRC() != m_nPrebuiltBonePoseCRC )
+		{
+			InvalidateBoneCache();
+		}
+	}
+
 	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
 	int boneMask = BONE_USED_BY_HITBOX | BONE_USED_BY_ATTACHMENT;
 
@@ -2640,6 +2671,196 @@ void CBaseAnimating::InvalidateBoneCache( void )
 	Studio_InvalidateBoneCache( m_boneCacheHandle );
 }
 
+static void SetupBonesOnBaseAnimating( CBaseAnimating *&pBaseAnimating )
+{
+	pBaseAnimating->GetBoneCache();
+}
+
+static void PreThreadedBoneSetup()
+{
+	mdlcache->BeginLock();
+}
+
+static void PostThreadedBoneSetup()
+{
+	mdlcache->EndLock();
+}
+
+static void RunThreadedBoneSetup( CUtlVector<CBaseAnimating *> &entities )
+{
+	g_bInThreadedBoneSetup = true;
+	ParallelProcess( "CBaseAnimating::ThreadedBoneSetup", entities.Base(), entities.Count(), &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+	g_bInThreadedBoneSetup = false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The bone setup phase. Called once per tick before entities think;
+//			the queue holds everything whose bones were used (hitbox traces,
+//			attachments, lag compensation) in the last tick, and their caches
+//			are built for the new curtime in parallel. Bones built at the
+//			current time survive StudioFrameAdvance, so this tick's lookups hit
+//			as long as the pose they were built from is still current; the
+//			first lookup checks that and rebuilds the ones that changed.
+//-----------------------------------------------------------------------------
+void CBaseAnimating::ThreadedBoneSetup()
+{
+	VPROF_BUDGET( "CBaseAnimating::ThreadedBoneSetup", VPROF_BUDGETGROUP_SERVER_ANIM );
+
+	if ( sv_threaded_bone_setup.GetBool() && g_BoneSetupQueue.Count() > 1 )
+	{
+		// IK solving traces against the world and bone merging reads the
+		// parent's cache, leave those to be set up on demand
+		CUtlVector<CBaseAnimating *> entities;
+		entities.EnsureCapacity( g_BoneSetupQueue.Count() );
+		for ( int i = 0; i < g_BoneSetupQueue.Count(); i++ )
+		{
+			CBaseAnimating *pAnimating = g_BoneSetupQueue[i];
+			if ( !pAnimating->m_pIk && !pAnimating->GetMoveParent() && !pAnimating->IsMarkedForDeletion() )
+			{
+				entities.AddToTail( pAnimating );
+			}
+		}
+
+		if ( entities.Count() > 1 )
+		{
+			RunThreadedBoneSetup( entities );
+
+			for ( int i = 0; i < entities.Count(); i++ )
+			{
+				entities[i]->m_bBoneCachePrebuilt = true;
+				entities[i]->m_nPrebuiltBonePoseCRC = entities[i]->ComputeBonePoseCRC();
+			}
+		}
+	}
+
+	for ( int i = 0; i < g_BoneSetupQueue.Count(); i++ )
+	{
+		g_BoneSetupQueue[i]->m_bBoneSetupQueued = false;
+	}
+	g_BoneSetupQueue.RemoveAll();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Checksum of the inputs to SetupBones
+//-----------------------------------------------------------------------------
+void CBaseAnimating::AccumulateBonePoseCRC( CRC32_t &crc )
+{
+	int sequence = GetSequence();
+	float cycle = GetCycle();
+	float scale = GetModelScale();
+	Vector origin = GetAbsOrigin();
+	QAngle angles = GetAbsAngles();
+
+	CRC32_ProcessBuffer( &crc, &sequence, sizeof( sequence ) );
+	CRC32_ProcessBuffer( &crc, &cycle, sizeof( cycle ) );
+	CRC32_ProcessBuffer( &crc, &scale, sizeof( scale ) );
+	CRC32_ProcessBuffer( &crc, &origin, sizeof( origin ) );
+	CRC32_ProcessBuffer( &crc, &angles, sizeof( angles ) );
+	CRC32_ProcessBuffer( &crc, m_flPoseParameter.Base(), sizeof( float ) * NUM_POSEPAREMETERS );
+	CRC32_ProcessBuffer( &crc, m_flEncodedController.Base(), sizeof( float ) * NUM_BONECTRLS );
+}
+
+CRC32_t CBaseAnimating::ComputeBonePoseCRC()
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	AccumulateBonePoseCRC( crc );
+	CRC32_Final( &crc );
+	return crc;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Spawns a crowd of animated props and times setting up all their
+//			bones one after another against the parallel bone setup phase.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( sv_bone_setup_benchmark, "Time serial vs. threaded bone setup. Usage: sv_bone_setup_benchmark <player model> <npc model> [players] [npcs] [iterations]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() < 3 )
+	{
+		Msg( "Usage: sv_bone_setup_benchmark <player model> <npc model> [players] [npcs] [iterations]\n" );
+		Msg( "Both models must already be precached by the map.\n" );
+		return;
+	}
+
+	const char *pszModel[2] = { args[1], args[2] };
+	int nCount[2];
+	nCount[0] = ( args.ArgC() >= 4 ) ? atoi( args[3] ) : 64;
+	nCount[1] = ( args.ArgC() >= 5 ) ? atoi( args[4] ) : 200;
+	int nIterations = ( args.ArgC() >= 6 ) ? MAX( atoi( args[5] ), 1 ) : 20;
+
+	for ( int i = 0; i < 2; i++ )
+	{
+		if ( modelinfo->GetModelIndex( pszModel[i] ) < 0 )
+		{
+			Warning( "sv_bone_setup_benchmark: %s is not precached\n", pszModel[i] );
+			return;
+		}
+	}
+
+	MDLCACHE_CRITICAL_SECTION();
+
+	CUtlVector<CBaseAnimating *> entities;
+	for ( int iType = 0; iType < 2; iType++ )
+	{
+		for ( int i = 0; i < nCount[iType]; i++ )
+		{
+			CBaseAnimating *pProp = dynamic_cast< CBaseAnimating * >( CreateEntityByName( "prop_dynamic_override" ) );
+			if ( !pProp )
+				continue;
+
+			pProp->SetModelName( AllocPooledString( pszModel[iType] ) );
+			pProp->SetAbsOrigin( Vector( ( entities.Count() % 16 ) * 64.0f, ( entities.Count() / 16 ) * 64.0f, 0.0f ) );
+			DispatchSpawn( pProp );
+
+			CStudioHdr *pStudioHdr = pProp->GetModelPtr();
+			if ( pStudioHdr && pStudioHdr->GetNumSeq() > 0 )
+			{
+				pProp->ResetSequence( RandomInt( 0, pStudioHdr->GetNumSeq() - 1 ) );
+				pProp->SetCycle( RandomFloat( 0.0f, 1.0f ) );
+			}
+			entities.AddToTail( pProp );
+		}
+	}
+
+	double flSerial = 0.0, flThreaded = 0.0;
+	for ( int iIteration = 0; iIteration < nIterations; iIteration++ )
+	{
+		for ( int i = 0; i < entities.Count(); i++ )
+		{
+			entities[i]->InvalidateBoneCache();
+		}
+
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < entities.Count(); i++ )
+		{
+			entities[i]->GetBoneCache();
+		}
+		flSerial += Plat_FloatTime() - flStart;
+
+		for ( int i = 0; i < entities.Count(); i++ )
+		{
+			entities[i]->InvalidateBoneCache();
+		}
+
+		flStart = Plat_FloatTime();
+		RunThreadedBoneSetup( entities );
+		flThreaded += Plat_FloatTime() - flStart;
+	}
+
+	Msg( "%d players (%s) + %d npcs (%s), %d iterations, %d threads\n", nCount[0], pszModel[0], nCount[1], pszModel[1],
+		nIterations, g_pThreadPool ? g_pThreadPool->NumThreads() : 0 );
+	Msg( "  serial   %.3f ms per phase\n", flSerial * 1000.0 / nIterations );
+	Msg( "  threaded %.3f ms per phase (%.2fx)\n", flThreaded * 1000.0 / nIterations, flThreaded > 0.0 ? flSerial / flThreaded : 0.0 );
+
+	for ( int i = 0; i < entities.Count(); i++ )
+	{
+		UTIL_Remove( entities[i] );
+	}
+}
+
 bool CBaseAnimating::TestCollision( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr )
 {
 	// Return a special case for scaled physics objects
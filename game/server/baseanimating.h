@@ -15,6 +15,7 @@
 #include "studio.h"
 #include "datacache/idatacache.h"
 #include "tier0/threadtools.h"
+#include "checksum_crc.h"
 
 
 struct animevent_t;
@@ -258,6 +259,10 @@ public:
 	class CBoneCache *GetBoneCache( void );
 	void InvalidateBoneCache();
 	void InvalidateBoneCacheIfOlderThan( float deltaTime );
+	// Refreshes, on the job pool, the bone caches of the entities whose bones were used since the last call
+	static void ThreadedBoneSetup();
+	// Feeds in everything the bones are set up from, so a pose that changed since ThreadedBoneSetup can be told apart
+	virtual void AccumulateBonePoseCRC( CRC32_t &crc );
 	virtual int DrawDebugTextOverlays( void );
 	
 	// See note in code re: bandwidth usage!!!
@@ -420,6 +425,11 @@ private:
 	CStudioHdr			*m_pStudioHdr;
 	CThreadFastMutex	m_StudioHdrInitLock;
 	CThreadFastMutex	m_BoneSetupMutex;
+	bool				m_bBoneSetupQueued;		// In the queue for the next ThreadedBoneSetup, not saved
+	bool				m_bBoneCachePrebuilt;	// ThreadedBoneSetup built the cache and nothing has looked it up yet, not saved
+	CRC32_t				m_nPrebuiltBonePoseCRC;	// The pose ThreadedBoneSetup built it from
+
+	CRC32_t				ComputeBonePoseCRC();
 
 // FIXME: necessary so that cyclers can hack m_bSequenceFinished
 friend class CFlexCycler;
@@ -1209,6 +1209,12 @@ void CServerGameDLL::GameFrame( bool simulating )
 	//  outside of server frameloop (e.g., in response to concommand)
 	gEntList.CleanupDeleteList();
 
+	// before anything thinks, set up the bones that were asked for last tick so this tick's lookups hit
+	if ( simulating )
+	{
+		CBaseAnimating::ThreadedBoneSetup();
+	}
+
 	IGameSystem::FrameUpdatePreEntityThinkAllSystems();
 	GameStartFrame();
 
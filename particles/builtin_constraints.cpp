@@ -427,6 +427,14 @@ END_PARTICLE_OPERATOR_UNPACK( C_OP_PlanarConstraint )
 
 
 
+CInterlockedInt g_nParticleCollisionTraces;
+
+static void CollisionTraceLine( Vector const &vecStart, Vector const &vecEnd, int nMask, int nCollisionGroup, CBaseTrace *pTrace )
+{
+	++g_nParticleCollisionTraces;
+	g_pParticleSystemMgr->Query()->TraceLine( vecStart, vecEnd, nMask, NULL, nCollisionGroup, pTrace );
+}
+
 static Vector s_OrientationRelativeTraceVectors[] = {
 	Vector( 0, .1962, .784929 ),
 	Vector( -.1962, 0, .784929 ),
@@ -438,7 +446,7 @@ void CWorldCollideContextData::SetBaseTrace(  int nIndex, Vector const &rayStart
 {
 	CBaseTrace tr;
 	Vector rayEnd = rayStart + traceDir;
-	g_pParticleSystemMgr->Query()->TraceLine( rayStart, rayEnd, MASK_SOLID, NULL, nCollisionGroup, &tr );
+	CollisionTraceLine( rayStart, rayEnd, MASK_SOLID, nCollisionGroup, &tr );
 	if ( tr.fraction < 1.0 )
 	{
 		m_bPlaneActive[nIndex] = true;
@@ -533,6 +541,98 @@ void CWorldCollideContextData::CalculatePlanes( CParticleCollection *pParticles,
 	}
 }
 
+void CWorldCollideContextData::BeginGridFrame( float flCellSize )
+{
+	if ( m_pGridCells && ( m_flGridCellSize == flCellSize ) && ( m_nGridCellsUsed < COLLISION_GRID_SLOTS * 3 / 4 ) )
+		return;
+
+	if ( !m_pGridCells )
+	{
+		m_pGridCells = reinterpret_cast<CollisionGridCell_t *>
+			( MemAlloc_AllocAligned( COLLISION_GRID_SLOTS * sizeof( CollisionGridCell_t ), 16 ) );
+	}
+	for( int i = 0; i < COLLISION_GRID_SLOTS; i++ )
+	{
+		m_pGridCells[i].m_flSampleTime = -1.0f;
+	}
+	m_nGridCellsUsed = 0;
+	m_flGridCellSize = flCellSize;
+}
+
+void CWorldCollideContextData::PurgeGrid()
+{
+	if ( m_pGridCells )
+	{
+		MemAlloc_FreeAligned( m_pGridCells );
+		m_pGridCells = NULL;
+	}
+}
+
+static Vector s_GridTraceDirections[COLLISION_GRID_MAX_CELL_PLANES] = {
+	Vector( 1, 0, 0 ),
+	Vector( -1, 0, 0 ),
+	Vector( 0, 1, 0 ),
+	Vector( 0, -1, 0 ),
+	Vector( 0, 0, 1 ),
+	Vector( 0, 0, -1 ),
+};
+
+static void SampleGridCell( CollisionGridCell_t *pCell, Vector const &vecStart, float flTraceLength,
+							float flCurTime, int nCollisionGroup, int nMask )
+{
+	pCell->m_flSampleTime = flCurTime;
+	pCell->m_nPlanes = 0;
+	for( int i = 0; i < COLLISION_GRID_MAX_CELL_PLANES; i++ )
+	{
+		Vector vecEnd = vecStart + flTraceLength * s_GridTraceDirections[i];
+		CBaseTrace tr;
+		CollisionTraceLine( vecStart, vecEnd, nMask, nCollisionGroup, &tr );
+		if ( ( tr.fraction < 1.0 ) && !tr.startsolid )
+		{
+			Vector vecHit = vecStart + tr.fraction * ( vecEnd - vecStart );
+			vecHit.CopyToArray( pCell->m_flPointOnPlane[pCell->m_nPlanes] );
+			tr.plane.normal.CopyToArray( pCell->m_flPlaneNormal[pCell->m_nPlanes] );
+			pCell->m_nPlanes++;
+		}
+	}
+}
+
+CollisionGridCell_t *CWorldCollideContextData::GetGridCell( Vector const &vecPnt, float flCurTime, float flRefreshTime,
+															int nCollisionGroup, int nMask )
+{
+	int nCoords[3];
+	for( int i = 0; i < 3; i++ )
+	{
+		nCoords[i] = (int)floor( vecPnt[i] / m_flGridCellSize );
+	}
+	uint32 nHash = ( (uint32)nCoords[0] * 73856093u ) ^ ( (uint32)nCoords[1] * 19349663u ) ^ ( (uint32)nCoords[2] * 83492791u );
+
+	// traces reach into the next cells, for particles moving out of this one
+	float flTraceLength = 2.0f * m_flGridCellSize;
+	for( int i = 0; i < COLLISION_GRID_SLOTS; i++ )
+	{
+		CollisionGridCell_t *pCell = &m_pGridCells[( nHash + i ) & ( COLLISION_GRID_SLOTS - 1 )];
+		if ( pCell->m_flSampleTime < 0.0f )
+		{
+			pCell->m_nCoords[0] = nCoords[0];
+			pCell->m_nCoords[1] = nCoords[1];
+			pCell->m_nCoords[2] = nCoords[2];
+			SampleGridCell( pCell, vecPnt, flTraceLength, flCurTime, nCollisionGroup, nMask );
+			m_nGridCellsUsed++;
+			return pCell;
+		}
+		if ( ( pCell->m_nCoords[0] == nCoords[0] ) && ( pCell->m_nCoords[1] == nCoords[1] ) && ( pCell->m_nCoords[2] == nCoords[2] ) )
+		{
+			if ( flCurTime - pCell->m_flSampleTime > flRefreshTime )
+			{
+				SampleGridCell( pCell, vecPnt, flTraceLength, flCurTime, nCollisionGroup, nMask );
+			}
+			return pCell;
+		}
+	}
+	return NULL;
+}
+
 class C_OP_WorldCollideConstraint : public CParticleOperatorInstance
 {
 	DECLARE_PARTICLE_OPERATOR( C_OP_WorldCollideConstraint );
@@ -656,6 +756,8 @@ class C_OP_WorldTraceConstraint : public CParticleOperatorInstance
 	float m_flRadiusScale;
 	float m_flCpMovementTolerance;
 	float m_flTraceTolerance;
+	float m_flGridCellSize;
+	float m_flGridRefreshTime;
 
 	bool m_bKillonContact;
 
@@ -664,6 +766,12 @@ class C_OP_WorldTraceConstraint : public CParticleOperatorInstance
 		return ( m_flBounceAmount != 0. ) || ( m_flSlideAmount != 0. );
 	}
 
+	// the collision cache is the parent's when there is one
+	virtual bool WritesParentData( void ) const
+	{
+		return true;
+	}
+
 	void InitializeContextData( CParticleCollection *pParticles,
 								void *pContext ) const
 	{
@@ -689,6 +797,7 @@ class C_OP_WorldTraceConstraint : public CParticleOperatorInstance
 void C_OP_WorldTraceConstraint::InitParams( CParticleSystemDefinition *pDef, CDmxElement *pElement )
 {
 	m_nCollisionGroupNumber = g_pParticleSystemMgr->Query()->GetCollisionGroupFromName( m_CollisionGroupName );
+	m_flGridCellSize = max( 1.0f, m_flGridCellSize );
 }
 
 
@@ -760,8 +869,7 @@ static void WorldIntersectTNew( FourVectors const *pStartPnt, FourVectors const
 						Vector end = start + delta * traceScale;
 
 						CBaseTrace tr;
-						g_pParticleSystemMgr->Query()->TraceLine( start, end,
-																  nMask, NULL, nCollisionGroup, &tr );
+						CollisionTraceLine( start, end, nMask, nCollisionGroup, &tr );
 		
 						if ( tr.fraction < 1.0 )
 						{
@@ -869,8 +977,7 @@ static void WorldIntersectT( FourVectors const *pStartPnt, FourVectors const *pE
 			Assert( end.IsValid() );
 
 			CBaseTrace tr;
-			g_pParticleSystemMgr->Query()->TraceLine( start, end,
-													  nMask, NULL, nCollisionGroup, &tr );
+			CollisionTraceLine( start, end, nMask, nCollisionGroup, &tr );
 		
 			SubFloat( pISectData->m_ISectT, i ) = tr.fraction;
 			if ( tr.startsolid )
@@ -888,6 +995,95 @@ static void WorldIntersectT( FourVectors const *pStartPnt, FourVectors const *pE
 	}
 }
 
+// Particles sharing a cell are tested together against the cell's planes, the way
+// WorldIntersectT tests them against the whole plane set.
+static void WorldIntersectTGrid( FourVectors const *pStartPnt, FourVectors const *pEndPnt,
+								 int nCollisionGroup, int nMask, ISectData_t *pISectData,
+								 CWorldCollideContextData *pCtx, fltx4 const &fl4ParticleValidMask,
+								 float flCurTime, float flRefreshTime )
+{
+	pISectData->m_ISectT = Four_Twos;
+	pISectData->m_ISectNormal.x = Four_Zeros;
+	pISectData->m_ISectNormal.y = Four_Zeros;
+	pISectData->m_ISectNormal.z = Four_Zeros;
+
+	CollisionGridCell_t *pCells[4];
+	int nValidMask = TestSignSIMD( fl4ParticleValidMask );
+	for( int i = 0; i < 4; i++ )
+	{
+		pCells[i] = NULL;
+		if ( !( nValidMask & ( 1 << i ) ) )
+			continue;
+		pCells[i] = pCtx->GetGridCell( pStartPnt->Vec( i ), flCurTime, flRefreshTime, nCollisionGroup, nMask );
+		if ( !pCells[i] )
+		{
+			// the table is full, trace this one
+			Vector start = pStartPnt->Vec( i );
+			Vector end = pEndPnt->Vec( i );
+			CBaseTrace tr;
+			CollisionTraceLine( start, end, nMask, nCollisionGroup, &tr );
+			if ( ( tr.fraction < 1.0 ) && !tr.startsolid )
+			{
+				SubFloat( pISectData->m_ISectT, i ) = tr.fraction;
+				SubFloat( pISectData->m_ISectNormal.x, i ) = tr.plane.normal.x;
+				SubFloat( pISectData->m_ISectNormal.y, i ) = tr.plane.normal.y;
+				SubFloat( pISectData->m_ISectNormal.z, i ) = tr.plane.normal.z;
+			}
+		}
+	}
+
+	for( int i = 0; i < 4; i++ )
+	{
+		CollisionGridCell_t *pCell = pCells[i];
+		if ( !pCell )
+			continue;
+
+		fltx4 fl4CellMask = LoadAlignedIntSIMD( g_SIMD_ComponentMask[i] );
+		for( int j = i + 1; j < 4; j++ )
+		{
+			if ( pCells[j] == pCell )
+			{
+				fl4CellMask = OrSIMD( fl4CellMask, LoadAlignedIntSIMD( g_SIMD_ComponentMask[j] ) );
+				pCells[j] = NULL;
+			}
+		}
+
+		for( int nPlane = 0; nPlane < pCell->m_nPlanes; nPlane++ )
+		{
+			FourVectors v4PointOnPlane, v4PlaneNormal;
+			float const *pPoint = pCell->m_flPointOnPlane[nPlane];
+			float const *pNormal = pCell->m_flPlaneNormal[nPlane];
+			v4PointOnPlane.DuplicateVector( Vector( pPoint[0], pPoint[1], pPoint[2] ) );
+			v4PlaneNormal.DuplicateVector( Vector( pNormal[0], pNormal[1], pNormal[2] ) );
+
+			FourVectors v4StartD = *pStartPnt;
+			FourVectors v4EndD = *pEndPnt;
+			v4StartD -= v4PointOnPlane;
+			v4EndD -= v4PointOnPlane;
+			fltx4 fl4StartDist = v4StartD * v4PlaneNormal;
+			fltx4 fl4EndDist = v4EndD * v4PlaneNormal;
+			fltx4 fl4CrossMask = AndSIMD( CmpGeSIMD( fl4StartDist, Four_Zeros ), CmpLtSIMD( fl4EndDist, Four_Zeros ) );
+			fl4CrossMask = AndSIMD( fl4CrossMask, fl4CellMask );
+			if ( IsAnyNegative( fl4CrossMask ) )
+			{
+#ifdef FP_EXCEPTIONS_ENABLED
+				fl4EndDist = AddSIMD( fl4EndDist, AndNotSIMD( fl4CrossMask, Four_Ones ) );
+#endif
+				fltx4 fl4T = DivSIMD( fl4StartDist, SubSIMD( fl4StartDist, fl4EndDist ) );
+				fl4CrossMask = AndSIMD( fl4CrossMask, CmpLtSIMD( fl4T, pISectData->m_ISectT ) );
+				if ( IsAnyNegative( fl4CrossMask ) )
+				{
+					pISectData->m_ISectT = MaskedAssign( fl4CrossMask, fl4T, pISectData->m_ISectT );
+					pISectData->m_ISectNormal.x = MaskedAssign( fl4CrossMask, v4PlaneNormal.x, pISectData->m_ISectNormal.x );
+					pISectData->m_ISectNormal.y = MaskedAssign( fl4CrossMask, v4PlaneNormal.y, pISectData->m_ISectNormal.y );
+					pISectData->m_ISectNormal.z = MaskedAssign( fl4CrossMask, v4PlaneNormal.z, pISectData->m_ISectNormal.z );
+				}
+			}
+		}
+	}
+	pISectData->m_LeftOverT = MaxSIMD( Four_Zeros, SubSIMD( Four_Ones, pISectData->m_ISectT ) );
+}
+
 bool C_OP_WorldTraceConstraint::EnforceConstraint( int nStartBlock,
 												   int nNumBlocks,
 												   CParticleCollection *pParticles,
@@ -958,18 +1154,23 @@ template<bool bKillonContact, bool bCached> bool C_OP_WorldTraceConstraint::Enfo
 	CWorldCollideContextData *pCtx = NULL;
 	if ( ( m_nCollisionMode == COLLISION_MODE_PER_FRAME_PLANESET ) ||
 		 ( m_nCollisionMode == COLLISION_MODE_USE_NEAREST_TRACE ) ||
-		 ( m_nCollisionMode == COLLISION_MODE_INITIAL_TRACE_DOWN ) )
+		 ( m_nCollisionMode == COLLISION_MODE_INITIAL_TRACE_DOWN ) ||
+		 ( m_nCollisionMode == COLLISION_MODE_VOXEL_GRID ) )
 	{
 		if ( ! *ppCtx )
 		{
 			*ppCtx = new CWorldCollideContextData;
+			(*ppCtx)->m_pGridCells = NULL;
 			(*ppCtx)->m_nActivePlanes = 0;
 			(*ppCtx)->m_flLastUpdateTime = -1.0;
 		}
 		pCtx = *ppCtx;
 		if ( pCtx->m_flLastUpdateTime != pParticles->m_flCurTime )
 		{
-			pCtx->CalculatePlanes( pParticles, m_nCollisionMode, m_nCollisionGroupNumber, &m_vecCpOffset, m_flCpMovementTolerance );
+			if ( m_nCollisionMode == COLLISION_MODE_VOXEL_GRID )
+				pCtx->BeginGridFrame( m_flGridCellSize );
+			else
+				pCtx->CalculatePlanes( pParticles, m_nCollisionMode, m_nCollisionGroupNumber, &m_vecCpOffset, m_flCpMovementTolerance );
 			pCtx->m_flLastUpdateTime = pParticles->m_flCurTime;
 		}
 	}
@@ -1006,16 +1207,17 @@ template<bool bKillonContact, bool bCached> bool C_OP_WorldTraceConstraint::Enfo
 		
 		ISectData_t iData;
 		
+		fltx4 fl4TailMask;
+		if ( nNumBlocks > 1 )
+			fl4TailMask = LoadAlignedIntSIMD( g_SIMD_AllOnesMask );
+		else
+			fl4TailMask = LoadAlignedIntSIMD( g_SIMD_SkipTailMask[nNumValidParticlesInLastChunk] );
+
 		if ( bCached )
-		{
-			fltx4 fl4TailMask;
-			if ( nNumBlocks > 1 )
-				fl4TailMask = LoadAlignedIntSIMD( g_SIMD_AllOnesMask );
-			else
-				fl4TailMask = LoadAlignedIntSIMD( g_SIMD_SkipTailMask[nNumValidParticlesInLastChunk] );
-			
 			WorldIntersectTNew( pPrevXYZ, &endPnt, m_nCollisionGroupNumber, nMask, &iData, m_nCollisionMode, pCtx, fl4TailMask, flTol );
-		}
+		else if ( m_nCollisionMode == COLLISION_MODE_VOXEL_GRID )
+			WorldIntersectTGrid( pPrevXYZ, &endPnt, m_nCollisionGroupNumber, nMask, &iData, pCtx, fl4TailMask,
+								 pParticles->m_flCurTime, m_flGridRefreshTime );
 		else
 			WorldIntersectT( pPrevXYZ, &endPnt, m_nCollisionGroupNumber, nMask, &iData, pCtx );
 
@@ -1095,6 +1297,8 @@ BEGIN_PARTICLE_OPERATOR_UNPACK( C_OP_WorldTraceConstraint )
 	DMXELEMENT_UNPACK_FIELD( "control point movement distance tolerance", "5", float, m_flCpMovementTolerance )
 	DMXELEMENT_UNPACK_FIELD( "kill particle on collision", "0", bool, m_bKillonContact )
 	DMXELEMENT_UNPACK_FIELD( "trace accuracy tolerance", "24", float, m_flTraceTolerance )
+	DMXELEMENT_UNPACK_FIELD( "collision grid cell size", "64", float, m_flGridCellSize )
+	DMXELEMENT_UNPACK_FIELD( "collision grid refresh time", "0", float, m_flGridRefreshTime )
 END_PARTICLE_OPERATOR_UNPACK( C_OP_WorldTraceConstraint )
 
 void AddBuiltInParticleConstraints( void )
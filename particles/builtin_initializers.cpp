@@ -4279,6 +4279,12 @@ class C_INIT_LifespanFromVelocity : public CParticleOperatorInstance
 
 	bool InitMultipleOverride ( void ) { return true; }
 
+	// the collision cache is the parent's when there is one
+	bool WritesParentData( void ) const
+	{
+		return true;
+	}
+
 	void InitParams( CParticleSystemDefinition *pDef, CDmxElement *pElement )
 	{
 		m_nCollisionGroupNumber = g_pParticleSystemMgr->Query()->GetCollisionGroupFromName( m_CollisionGroupName );
@@ -4321,6 +4327,7 @@ void C_INIT_LifespanFromVelocity::InitNewParticlesScalar(
 	if ( ! *ppCtx )
 	{
 		*ppCtx = new CWorldCollideContextData;
+		(*ppCtx)->m_pGridCells = NULL;
 		(*ppCtx)->m_nActivePlanes = 0;
 		(*ppCtx)->m_nActivePlanes = 0;
 		(*ppCtx)->m_nNumFixedPlanes = 0;
@@ -4452,6 +4459,7 @@ void C_INIT_LifespanFromVelocity::InitNewParticlesBlock( CParticleCollection *pP
 		if ( ! *ppCtx )
 		{
 			*ppCtx = new CWorldCollideContextData;
+			(*ppCtx)->m_pGridCells = NULL;
 			(*ppCtx)->m_nActivePlanes = 0;
 			(*ppCtx)->m_nActivePlanes = 0;
 			(*ppCtx)->m_nNumFixedPlanes = 0;
@@ -4610,6 +4618,12 @@ class C_INIT_CreateFromPlaneCache : public CParticleOperatorInstance
 		return sizeof( CWorldCollideContextData );
 	}
 
+	// allocates the parent's collision cache if it has none yet
+	bool WritesParentData( void ) const
+	{
+		return true;
+	}
+
 	void InitNewParticlesScalar( CParticleCollection *pParticles, int start_p,
 		int nParticleCount, int nAttributeWriteMask,
 		void *pContext) const;
@@ -4648,6 +4662,7 @@ void C_INIT_CreateFromPlaneCache::InitNewParticlesScalar(
 	if ( ! *ppCtx )
 	{
 		*ppCtx = new CWorldCollideContextData;
+		(*ppCtx)->m_pGridCells = NULL;
 		(*ppCtx)->m_nActivePlanes = 0;
 		(*ppCtx)->m_nNumFixedPlanes = 0;
 		FourVectors fvEmpty;
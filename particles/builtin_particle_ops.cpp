@@ -15,6 +15,7 @@
 #include "studio.h"
 #include "bspflags.h"
 #include "tier0/vprof.h"
+#include "particles_simd8.h"
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -106,6 +107,32 @@ static void CHECKSYSTEM( CParticleCollection *pParticles )
 #endif
 #endif
 
+#if PARTICLES_AVX2
+// The integration loop of C_OP_BasicMovement, 8 wide. Returns the blocks it did.
+static AVX2_FUNCTION int BasicMovementX8( fltx4 *pPrevXYZ, size_t nPrevStride, const fltx4 *pXYZ, size_t nXYZStride,
+										  const fltx4 *pAcc, size_t nAccStride, const fltx4 &fl4AdjDt, const fltx4 &fl4DtSquared, int nBlocks )
+{
+	fltx8 adj_dt = ReplicateX8( fl4AdjDt );
+	fltx8 DtSquared = ReplicateX8( fl4DtSquared );
+
+	int nPairs = nBlocks / 2;
+	for ( int i = 0; i < nPairs; i++ )
+	{
+		for ( int nComponent = 0; nComponent < 3; nComponent++ )
+		{
+			fltx8 accFactor = MulX8( LoadX8( pAcc + nComponent, nAccStride ), DtSquared );
+			fltx8 xyz = LoadX8( pXYZ + nComponent, nXYZStride );
+			fltx8 prev_xyz = LoadX8( pPrevXYZ + nComponent, nPrevStride );
+			StoreX8( pPrevXYZ + nComponent, nPrevStride, AddX8( xyz, AddX8( accFactor, MulX8( adj_dt, SubX8( xyz, prev_xyz ) ) ) ) );
+		}
+		pPrevXYZ += 2 * nPrevStride;
+		pXYZ += 2 * nXYZStride;
+		pAcc += 2 * nAccStride;
+	}
+	return nPairs * 2;
+}
+#endif
+
 void C_OP_BasicMovement::Operate( CParticleCollection *pParticles, float flStrength, void *pContext ) const
 {
 	C4VAttributeWriteIterator prev_xyz( PARTICLE_ATTRIBUTE_PREV_XYZ, pParticles );
@@ -168,7 +195,20 @@ void C_OP_BasicMovement::Operate( CParticleCollection *pParticles, float flStren
 	fltx4 DtSquared = ReplicateX4( pParticles->m_flDt * pParticles->m_flDt );
 	int ctr = pParticles->m_nPaddedActiveParticles;
 	FourVectors *pAccIn = PerParticleForceAccumulator;
-	do
+#if PARTICLES_AVX2
+	if ( g_pParticleSystemMgr->IsWideSIMDEnabled() )
+	{
+		size_t nPrevStride, nXYZStride;
+		fltx4 *pPrevXYZ = pParticles->GetM128AttributePtrForWrite( PARTICLE_ATTRIBUTE_PREV_XYZ, &nPrevStride );
+		const fltx4 *pXYZ = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_XYZ, &nXYZStride );
+		int nDone = BasicMovementX8( pPrevXYZ, nPrevStride, pXYZ, nXYZStride, (const fltx4 *)pAccIn, 3 * nForceStride, adj_dt, DtSquared, ctr );
+		prev_xyz += nDone;
+		xyz += nDone;
+		pAccIn += nDone * nForceStride;
+		ctr -= nDone;
+	}
+#endif
+	for ( ; ctr > 0; --ctr )
 	{
 		accFactorX = MulSIMD( pAccIn->x, DtSquared );
 		accFactorY = MulSIMD( pAccIn->y, DtSquared );
@@ -185,7 +225,7 @@ void C_OP_BasicMovement::Operate( CParticleCollection *pParticles, float flStren
 		++prev_xyz;
 		++xyz;
 		pAccIn += nForceStride;
-	} while (--ctr);
+	}
 
 	CHECKSYSTEM( pParticles );
 	pParticles->SwapPosAndPrevPos();
@@ -332,6 +372,72 @@ void C_OP_FadeAndKill::InitParams( CParticleSystemDefinition *pDef, CDmxElement
 	}
 }
 
+#if PARTICLES_AVX2
+// C_OP_FadeAndKill 8 wide, takes the operator's times and alphas in the same order. Returns the particles it did.
+static AVX2_FUNCTION int FadeAndKillX8( CParticleCollection *pParticles,
+	float flStartFadeInTime, float flEndFadeInTime, float flStartFadeOutTime, float flEndFadeOutTime,
+	float flStartAlpha, float flEndAlpha, const fltx4 &fl4OOFadeInDuration, const fltx4 &fl4OOFadeOutDuration )
+{
+	size_t nCreationTimeStride, nLifeDurationStride, nInitialAlphaStride, nAlphaStride;
+	const fltx4 *pCreationTime = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_CREATION_TIME, &nCreationTimeStride );
+	const fltx4 *pLifeDuration = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_LIFE_DURATION, &nLifeDurationStride );
+	const fltx4 *pInitialAlpha = pParticles->GetInitialM128AttributePtr( PARTICLE_ATTRIBUTE_ALPHA, &nInitialAlphaStride );
+	fltx4 *pAlpha = pParticles->GetM128AttributePtrForWrite( PARTICLE_ATTRIBUTE_ALPHA, &nAlphaStride );
+
+	fltx8 fl8StartFadeInTime = ReplicateX8( flStartFadeInTime );
+	fltx8 fl8StartFadeOutTime = ReplicateX8( flStartFadeOutTime );
+	fltx8 fl8EndFadeInTime = ReplicateX8( flEndFadeInTime );
+	fltx8 fl8EndFadeOutTime = ReplicateX8( flEndFadeOutTime );
+	fltx8 fl8EndAlpha = ReplicateX8( flEndAlpha );
+	fltx8 fl8StartAlpha = ReplicateX8( flStartAlpha );
+	fltx8 fl8OOFadeInDuration = ReplicateX8( fl4OOFadeInDuration );
+	fltx8 fl8OOFadeOutDuration = ReplicateX8( fl4OOFadeOutDuration );
+	fltx8 fl8CurTime = ReplicateX8( pParticles->m_fl4CurTime );
+
+	int nLimit = ( pParticles->m_nPaddedActiveParticles & ~1 ) << 2;
+	for ( int i = 0; i < nLimit; i += 8 )
+	{
+		fltx8 fl8Age = SubX8( fl8CurTime, LoadX8( pCreationTime, nCreationTimeStride ) );
+		fltx8 fl8ParticleLifeTime = LoadX8( pLifeDuration, nLifeDurationStride );
+		fltx8 fl8KillMask = CmpGeX8( fl8Age, fl8ParticleLifeTime );
+		fl8Age = MulX8( fl8Age, ReciprocalEstX8( fl8ParticleLifeTime ) );
+		fltx8 fl8FadingInMask = AndNotX8( fl8KillMask,
+			AndX8( CmpLeX8( fl8StartFadeInTime, fl8Age ), CmpGtX8( fl8EndFadeInTime, fl8Age ) ) );
+		fltx8 fl8FadingOutMask = AndNotX8( fl8KillMask,
+			AndX8( CmpLeX8( fl8StartFadeOutTime, fl8Age ), CmpGtX8( fl8EndFadeOutTime, fl8Age ) ) );
+		if ( IsAnyNegativeX8( OrX8( fl8FadingInMask, fl8FadingOutMask ) ) )
+		{
+			fltx8 fl8InitialAlpha = LoadX8( pInitialAlpha, nInitialAlphaStride );
+			fltx8 fl8Alpha = LoadX8( pAlpha, nAlphaStride );
+			if ( IsAnyNegativeX8( fl8FadingInMask ) )
+			{
+				fltx8 fl8Goal = MulX8( fl8InitialAlpha, fl8StartAlpha );
+				fltx8 fl8NewAlpha = SimpleSplineRemapValWithDeltasClampedX8( fl8Age, fl8StartFadeInTime, fl8OOFadeInDuration,
+					fl8Goal, SubX8( fl8InitialAlpha, fl8Goal ) );
+				fl8Alpha = MaskedAssignX8( fl8FadingInMask, fl8NewAlpha, fl8Alpha );
+			}
+			if ( IsAnyNegativeX8( fl8FadingOutMask ) )
+			{
+				fltx8 fl8Goal = MulX8( fl8InitialAlpha, fl8EndAlpha );
+				fltx8 fl8NewAlpha = SimpleSplineRemapValWithDeltasClampedX8( fl8Age, fl8StartFadeOutTime, fl8OOFadeOutDuration,
+					fl8InitialAlpha, SubX8( fl8Goal, fl8InitialAlpha ) );
+				fl8Alpha = MaskedAssignX8( fl8FadingOutMask, fl8NewAlpha, fl8Alpha );
+			}
+			StoreX8( pAlpha, nAlphaStride, fl8Alpha );
+		}
+		if ( IsAnyNegativeX8( fl8KillMask ) )
+		{
+			KillParticlesX8( pParticles, i, TestSignX8( fl8KillMask ) );
+		}
+		pCreationTime += 2 * nCreationTimeStride;
+		pLifeDuration += 2 * nLifeDurationStride;
+		pInitialAlpha += 2 * nInitialAlphaStride;
+		pAlpha += 2 * nAlphaStride;
+	}
+	return nLimit;
+}
+#endif
+
 void C_OP_FadeAndKill::Operate( CParticleCollection *pParticles, float flStrength,  void *pContext ) const
 {
 	CM128AttributeIterator pCreationTime( PARTICLE_ATTRIBUTE_CREATION_TIME, pParticles );
@@ -355,7 +461,19 @@ void C_OP_FadeAndKill::Operate( CParticleCollection *pParticles, float flStrengt
 	fltx4 fl4FadeOutDuration = ReplicateX4( m_flEndFadeOutTime - m_flStartFadeOutTime );
 	fltx4 fl4OOFadeOutDuration = ReciprocalEstSIMD( fl4FadeOutDuration );
 
-	for ( int i = 0; i < nLimit; i+= 4 )
+	int i = 0;
+#if PARTICLES_AVX2
+	if ( g_pParticleSystemMgr->IsWideSIMDEnabled() )
+	{
+		i = FadeAndKillX8( pParticles, m_flStartFadeInTime, m_flEndFadeInTime, m_flStartFadeOutTime, m_flEndFadeOutTime,
+			m_flStartAlpha, m_flEndAlpha, fl4OOFadeInDuration, fl4OOFadeOutDuration );
+		pCreationTime += i / 4;
+		pLifeDuration += i / 4;
+		pInitialAlpha += i / 4;
+		pAlpha += i / 4;
+	}
+#endif
+	for ( ; i < nLimit; i+= 4 )
 	{
 		fltx4 fl4Age = SubSIMD( fl4CurTime, *pCreationTime );
 		fltx4 fl4ParticleLifeTime = *pLifeDuration;
@@ -1183,6 +1301,35 @@ BEGIN_PARTICLE_OPERATOR_UNPACK( C_OP_Decay )
 END_PARTICLE_OPERATOR_UNPACK( C_OP_Decay )
 
 
+#if PARTICLES_AVX2
+// C_OP_Decay 8 wide. Returns the particles it did.
+static AVX2_FUNCTION int DecayX8( CParticleCollection *pParticles, const fltx4 &fl4CurTime )
+{
+	size_t nCreationTimeStride, nLifeDurationStride;
+	const fltx4 *pCreationTime = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_CREATION_TIME, &nCreationTimeStride );
+	const fltx4 *pLifeDuration = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_LIFE_DURATION, &nLifeDurationStride );
+
+	fltx8 fl8CurTime = ReplicateX8( fl4CurTime );
+	fltx8 fl8Zeros = _mm256_setzero_ps();
+
+	int nLimit = ( pParticles->m_nPaddedActiveParticles & ~1 ) << 2;
+	for ( int i = 0; i < nLimit; i += 8 )
+	{
+		fltx8 fl8LifeDuration = LoadX8( pLifeDuration, nLifeDurationStride );
+		fltx8 fl8KillMask = CmpLeX8( fl8LifeDuration, fl8Zeros );
+		fltx8 fl8Age = SubX8( fl8CurTime, LoadX8( pCreationTime, nCreationTimeStride ) );
+		fl8KillMask = OrX8( fl8KillMask, CmpGeX8( fl8Age, fl8LifeDuration ) );
+		if ( IsAnyNegativeX8( fl8KillMask ) )
+		{
+			KillParticlesX8( pParticles, i, TestSignX8( fl8KillMask ) );
+		}
+		pCreationTime += 2 * nCreationTimeStride;
+		pLifeDuration += 2 * nLifeDurationStride;
+	}
+	return nLimit;
+}
+#endif
+
 void C_OP_Decay::Operate( CParticleCollection *pParticles, float flStrength,  void *pContext ) const
 {
 	fltx4 fl4CurTime = pParticles->m_fl4CurTime;
@@ -1192,7 +1339,16 @@ void C_OP_Decay::Operate( CParticleCollection *pParticles, float flStrength,  vo
 
 	int nLimit = pParticles->m_nPaddedActiveParticles << 2;
 
-	for ( int i = 0; i < nLimit; i+= 4 )
+	int i = 0;
+#if PARTICLES_AVX2
+	if ( g_pParticleSystemMgr->IsWideSIMDEnabled() )
+	{
+		i = DecayX8( pParticles, fl4CurTime );
+		pCreationTime += i / 4;
+		pLifeDuration += i / 4;
+	}
+#endif
+	for ( ; i < nLimit; i+= 4 )
 	{
 		fltx4 fl4LifeDuration = *pLifeDuration;
 		
@@ -1615,6 +1771,54 @@ BEGIN_PARTICLE_OPERATOR_UNPACK( C_OP_InterpolateRadius )
 	DMXELEMENT_UNPACK_FIELD( "scale_bias", "0.5", float, m_flBias )
 END_PARTICLE_OPERATOR_UNPACK( C_OP_InterpolateRadius )
 
+#if PARTICLES_AVX2
+// The ease and no bias cases of C_OP_InterpolateRadius 8 wide. Returns the blocks it did.
+static AVX2_FUNCTION int InterpolateRadiusX8( CParticleCollection *pParticles, bool bEaseInAndOut,
+	const fltx4 &fl4StartTime, const fltx4 &fl4EndTime, const fltx4 &fl4OOTimeWidth,
+	const fltx4 &fl4StartScale, const fltx4 &fl4ScaleWidth )
+{
+	size_t nCreationTimeStride, nLifeDurationStride, nRadiusStride, nInitialRadiusStride;
+	const fltx4 *pCreationTime = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_CREATION_TIME, &nCreationTimeStride );
+	const fltx4 *pLifeDuration = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_LIFE_DURATION, &nLifeDurationStride );
+	fltx4 *pRadius = pParticles->GetM128AttributePtrForWrite( PARTICLE_ATTRIBUTE_RADIUS, &nRadiusStride );
+	const fltx4 *pInitialRadius = pParticles->GetInitialM128AttributePtr( PARTICLE_ATTRIBUTE_RADIUS, &nInitialRadiusStride );
+
+	fltx8 fl8StartTime = ReplicateX8( fl4StartTime );
+	fltx8 fl8EndTime = ReplicateX8( fl4EndTime );
+	fltx8 fl8OOTimeWidth = ReplicateX8( fl4OOTimeWidth );
+	fltx8 fl8StartScale = ReplicateX8( fl4StartScale );
+	fltx8 fl8ScaleWidth = ReplicateX8( fl4ScaleWidth );
+	fltx8 fl8CurTime = ReplicateX8( pParticles->m_fl4CurTime );
+	fltx8 fl8Zeros = _mm256_setzero_ps();
+
+	int nBlocks = pParticles->m_nPaddedActiveParticles & ~1;
+	for ( int i = 0; i < nBlocks; i += 2 )
+	{
+		fltx8 fl8LifeDuration = LoadX8( pLifeDuration, nLifeDurationStride );
+		fltx8 fl8GoodMask = CmpGtX8( fl8LifeDuration, fl8Zeros );
+		fltx8 fl8LifeTime = MulX8( SubX8( fl8CurTime, LoadX8( pCreationTime, nCreationTimeStride ) ), ReciprocalEstX8( fl8LifeDuration ) );
+		fl8GoodMask = AndX8( fl8GoodMask, CmpGeX8( fl8LifeTime, fl8StartTime ) );
+		fl8GoodMask = AndX8( fl8GoodMask, CmpLtX8( fl8LifeTime, fl8EndTime ) );
+		if ( IsAnyNegativeX8( fl8GoodMask ) )
+		{
+			fltx8 fl8FadeWindow = MulX8( SubX8( fl8LifeTime, fl8StartTime ), fl8OOTimeWidth );
+			if ( bEaseInAndOut )
+			{
+				fl8FadeWindow = SimpleSplineX8( fl8FadeWindow );
+			}
+			fl8FadeWindow = AddX8( fl8StartScale, MulX8( fl8FadeWindow, fl8ScaleWidth ) );
+			StoreX8( pRadius, nRadiusStride, MaskedAssignX8( fl8GoodMask,
+				MulX8( LoadX8( pInitialRadius, nInitialRadiusStride ), fl8FadeWindow ), LoadX8( pRadius, nRadiusStride ) ) );
+		}
+		pCreationTime += 2 * nCreationTimeStride;
+		pLifeDuration += 2 * nLifeDurationStride;
+		pRadius += 2 * nRadiusStride;
+		pInitialRadius += 2 * nInitialRadiusStride;
+	}
+	return nBlocks;
+}
+#endif
+
 void C_OP_InterpolateRadius::Operate( CParticleCollection *pParticles, float flStrength,  void *pContext ) const
 {
 	if ( m_flEndTime <= m_flStartTime )
@@ -1635,9 +1839,22 @@ void C_OP_InterpolateRadius::Operate( CParticleCollection *pParticles, float flS
 
 	int nCtr = pParticles->m_nPaddedActiveParticles;
 
+#if PARTICLES_AVX2
+	if ( g_pParticleSystemMgr->IsWideSIMDEnabled() && ( m_bEaseInAndOut || m_flBias == 0.5f ) )
+	{
+		int nDone = InterpolateRadiusX8( pParticles, m_bEaseInAndOut, fl4StartTime, fl4EndTime, fl4OOTimeWidth,
+			fl4StartScale, fl4ScaleWidth );
+		pCreationTime += nDone;
+		pLifeDuration += nDone;
+		pRadius += nDone;
+		pInitialRadius += nDone;
+		nCtr -= nDone;
+	}
+#endif
+
 	if ( m_bEaseInAndOut )
 	{
-		do 
+		for ( ; nCtr > 0; --nCtr )
 		{
 			fltx4 fl4LifeDuration = *pLifeDuration;
 			fltx4 fl4GoodMask = CmpGtSIMD( fl4LifeDuration, Four_Zeros );
@@ -1656,13 +1873,13 @@ void C_OP_InterpolateRadius::Operate( CParticleCollection *pParticles, float flS
 			++pLifeDuration;
 			++pRadius;
 			++pInitialRadius;
-		} while (--nCtr );
+		}
 	}
 	else
 	{
 		if ( m_flBias == 0.5f )        // no bias case
 		{
-			do 
+			for ( ; nCtr > 0; --nCtr )
 			{
 				fltx4 fl4LifeDuration = *pLifeDuration;
 				fltx4 fl4GoodMask = CmpGtSIMD( fl4LifeDuration, Four_Zeros );
@@ -1679,7 +1896,7 @@ void C_OP_InterpolateRadius::Operate( CParticleCollection *pParticles, float flS
 				++pLifeDuration;
 				++pRadius;
 				++pInitialRadius;
-			} while (--nCtr );
+			}
 		}
 		else
 		{
@@ -1756,6 +1973,57 @@ class C_OP_ColorInterpolate : public CParticleOperatorInstance
 
 
 
+#if PARTICLES_AVX2
+// C_OP_ColorInterpolate 8 wide. Returns the blocks it did.
+static AVX2_FUNCTION int ColorInterpolateX8( CParticleCollection *pParticles, bool bEaseInOut,
+	const fltx4 &ooInRange, const fltx4 &lowRange, const fltx4 &targetR, const fltx4 &targetG, const fltx4 &targetB )
+{
+	size_t nColorStride, nInitialColorStride, nCreationTimeStride, nLifeDurationStride;
+	fltx4 *pColor = pParticles->GetM128AttributePtrForWrite( PARTICLE_ATTRIBUTE_TINT_RGB, &nColorStride );
+	const fltx4 *pInitialColor = pParticles->GetInitialM128AttributePtr( PARTICLE_ATTRIBUTE_TINT_RGB, &nInitialColorStride );
+	const fltx4 *pCreationTime = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_CREATION_TIME, &nCreationTimeStride );
+	const fltx4 *pLifeDuration = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_LIFE_DURATION, &nLifeDurationStride );
+
+	fltx8 fl8OOInRange = ReplicateX8( ooInRange );
+	fltx8 fl8LowRange = ReplicateX8( lowRange );
+	fltx8 fl8Target[3] = { ReplicateX8( targetR ), ReplicateX8( targetG ), ReplicateX8( targetB ) };
+	fltx8 fl8CurTime = ReplicateX8( pParticles->m_fl4CurTime );
+	fltx8 fl8Zeros = _mm256_setzero_ps();
+	fltx8 fl8Ones = ReplicateX8( 1.0f );
+
+	int nBlocks = pParticles->m_nPaddedActiveParticles & ~1;
+	for ( int i = 0; i < nBlocks; i += 2 )
+	{
+		fltx8 fl8LifeDuration = LoadX8( pLifeDuration, nLifeDurationStride );
+		fltx8 goodMask = CmpGtX8( fl8LifeDuration, fl8Zeros );
+		if ( IsAnyNegativeX8( goodMask ) )
+		{
+			fltx8 flLifeTime = DivX8( SubX8( fl8CurTime, LoadX8( pCreationTime, nCreationTimeStride ) ), fl8LifeDuration );
+
+			fltx8 T = MulX8( SubX8( flLifeTime, fl8LowRange ), fl8OOInRange );
+			T = MinX8( fl8Ones, MaxX8( fl8Zeros, T ) );
+			if ( bEaseInOut )
+			{
+				T = SimpleSplineX8( T );
+			}
+
+			// x, y and z are the first three fltx4s of each block
+			for ( int nComp = 0; nComp < 3; nComp++ )
+			{
+				fltx8 fl8Initial = LoadX8( pInitialColor + nComp, nInitialColorStride );
+				fltx8 fl8New = AddX8( fl8Initial, MulX8( T, SubX8( fl8Target[nComp], fl8Initial ) ) );
+				StoreX8( pColor + nComp, nColorStride, MaskedAssignX8( goodMask, fl8New, LoadX8( pColor + nComp, nColorStride ) ) );
+			}
+		}
+		pColor += 2 * nColorStride;
+		pInitialColor += 2 * nInitialColorStride;
+		pCreationTime += 2 * nCreationTimeStride;
+		pLifeDuration += 2 * nLifeDurationStride;
+	}
+	return nBlocks;
+}
+#endif
+
 void C_OP_ColorInterpolate::Operate( CParticleCollection *pParticles, float flStrength,  void *pContext ) const
 {
 	C4VAttributeWriteIterator pColor( PARTICLE_ATTRIBUTE_TINT_RGB, pParticles );
@@ -1776,9 +2044,21 @@ void C_OP_ColorInterpolate::Operate( CParticleCollection *pParticles, float flSt
 
 	int nCtr = pParticles->m_nPaddedActiveParticles;
 
+#if PARTICLES_AVX2
+	if ( g_pParticleSystemMgr->IsWideSIMDEnabled() )
+	{
+		int nDone = ColorInterpolateX8( pParticles, m_bEaseInOut, ooInRange, lowRange, targetR, targetG, targetB );
+		pColor += nDone;
+		pCreationTime += nDone;
+		pLifeDuration += nDone;
+		pInitialColor += nDone;
+		nCtr -= nDone;
+	}
+#endif
+
 	if ( m_bEaseInOut )
 	{
-		do 
+		for ( ; nCtr > 0; --nCtr )
 		{
 			fltx4 goodMask = CmpGtSIMD( *pLifeDuration, Four_Zeros );
 			if ( IsAnyNegative( goodMask ) )
@@ -1797,11 +2077,11 @@ void C_OP_ColorInterpolate::Operate( CParticleCollection *pParticles, float flSt
 			++pLifeDuration;
 			++pInitialColor;
 
-		} while( --nCtr );
+		}
 	}
 	else
 	{
-		do 
+		for ( ; nCtr > 0; --nCtr )
 		{
 			fltx4 goodMask = CmpGtSIMD( *pLifeDuration, Four_Zeros );
 			if ( IsAnyNegative( goodMask ) )
@@ -1820,7 +2100,7 @@ void C_OP_ColorInterpolate::Operate( CParticleCollection *pParticles, float flSt
 			++pLifeDuration;
 			++pInitialColor;
 
-		} while( --nCtr );
+		}
 	}
 }
 
@@ -19,12 +19,14 @@
 #include "materialsystem/itexture.h"
 #include "materialsystem/imesh.h"
 #include "tier0/vprof.h"
+#include "vstdlib/jobthread.h"
 #include "tier1/KeyValues.h"
 #include "tier1/lzmaDecoder.h"
 #include "random_floats.h"
 #include "vtf/vtf.h"
 #include "studio.h"
 #include "particles_internal.h"
+#include "particles_simd8.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -904,11 +906,13 @@ CParticleCollection::CParticleCollection( )
 	m_MaxBounds.Init();
 	m_bBoundsValid = false;
 
-	memset( m_ControlPoints, 0, sizeof(m_ControlPoints) );
-
 	// align all control point orientations with the global world
 	for( int i=0; i < MAX_PARTICLE_CONTROL_POINTS; i++ )
 	{
+		m_ControlPoints[i].m_Position.Init();
+		m_ControlPoints[i].m_PrevPosition.Init();
+		m_ControlPoints[i].m_pObject = NULL;
+		m_ControlPoints[i].m_nParent = 0;
 		m_ControlPoints[i].m_ForwardVector.Init( 0, 1, 0 );
 		m_ControlPoints[i].m_UpVector.Init( 0, 0, 1 );
 		m_ControlPoints[i].m_RightVector.Init( 1, 0, 0 );
@@ -938,6 +942,7 @@ CParticleCollection::CParticleCollection( )
 	m_bDormant = false;
 	m_bEmissionStopped = false;
 	m_bRequiresOrderInvariance = false;
+	m_bWritesParentData = false;
 	m_nSimulatedFrames = 0;
 
 	m_nNumParticlesToKill = 0;
@@ -977,6 +982,7 @@ CParticleCollection::~CParticleCollection( void )
 	{
 		if ( m_pCollisionCacheData[i] )
 		{
+			m_pCollisionCacheData[i]->PurgeGrid();
 			delete m_pCollisionCacheData[i];
 		}
 	}
@@ -1095,6 +1101,9 @@ void CParticleCollection::Init( CParticleSystemDefinition *pDef, float flDelay,
 		}
 	}
 
+	// only depends on the definition, the parent needs it even for children without a material
+	m_bWritesParentData = ComputeWritesParentData();
+
 	if ( !IsValid() )
 		return;
 
@@ -1243,7 +1252,9 @@ void CParticleCollection::InitStorage( CParticleSystemDefinition *pDef )
 	Assert( pDef->m_nMaxParticles < 65536 );
 
 	m_nMaxAllowedParticles = min ( MAX_PARTICLES_IN_A_SYSTEM, pDef->m_nMaxParticles );
-	m_nAllocatedParticles = 4 + 4 * ( ( m_nMaxAllowedParticles + 3 ) / 4 );						    
+
+	// Whole pairs of blocks, so every attribute starts on a 32 byte boundary for the 8 wide operators
+	m_nAllocatedParticles = 8 + 8 * ( ( m_nMaxAllowedParticles + 7 ) / 8 );
 
 	int nConstantMemorySize = 3 * 4 * MAX_PARTICLE_ATTRIBUTES * sizeof(float) + 16;
 						 
@@ -1285,21 +1296,21 @@ void CParticleCollection::InitStorage( CParticleSystemDefinition *pDef )
 	}
 
 	// Gotta allocate a couple extra floats to account for 
-	int nAllocationSize = m_nAllocatedParticles * sz * sizeof(float) + 16;
+	int nAllocationSize = m_nAllocatedParticles * sz * sizeof(float) + 32;
 	m_pParticleMemory = new unsigned char[ nAllocationSize ];
 	memset( m_pParticleMemory, 0, nAllocationSize );
 
 	// Allocate space for the initial attributes
 	if ( nInitialAttributeSize != 0 )
 	{
-		int nInitialAllocationSize = m_nAllocatedParticles * nInitialAttributeSize * sizeof(float) + 16;
+		int nInitialAllocationSize = m_nAllocatedParticles * nInitialAttributeSize * sizeof(float) + 32;
 		m_pParticleInitialMemory = new unsigned char[ nInitialAllocationSize ];
 		memset( m_pParticleInitialMemory, 0, nInitialAllocationSize );
 	}
 
-	// Align allocation to 16-byte boundaries
-	float *pMem = (float*)( (size_t)( m_pParticleMemory + 15 ) & ~0xF );
-	float *pInitialMem = (float*)( (size_t)( m_pParticleInitialMemory + 15 ) & ~0xF );
+	// Align allocation to 32-byte boundaries
+	float *pMem = (float*)( (size_t)( m_pParticleMemory + 31 ) & ~0x1F );
+	float *pInitialMem = (float*)( (size_t)( m_pParticleInitialMemory + 31 ) & ~0x1F );
 
 	// Point each attribute to memory associated with that attribute
 	for( int bit = 0; bit < MAX_PARTICLE_ATTRIBUTES; bit++ )
@@ -1558,6 +1569,28 @@ bool CParticleCollection::ComputeRequiresOrderInvariance()
 	return false;
 }
 
+//-----------------------------------------------------------------------------
+// Does any operator of this system write to its parent's data? Children get
+// initialized before m_pParent is set, so this only looks at the definition.
+//-----------------------------------------------------------------------------
+bool CParticleCollection::ComputeWritesParentData()
+{
+	CUtlVector<CParticleOperatorInstance *> *olists[] = {
+		&m_pDef->m_Operators, &m_pDef->m_Initializers, &m_pDef->m_Emitters,
+		&m_pDef->m_ForceGenerators, &m_pDef->m_Constraints
+	};
+	for( int i = 0; i < NELEMS( olists ); i++ )
+	{
+		for( int j = 0; j < olists[i]->Count(); j++ )
+		{
+			if ( (*olists[i])[j]->WritesParentData() )
+				return true;
+		}
+	}
+
+	return false;
+}
+
 //-----------------------------------------------------------------------------
 // Renderer iteration
 //-----------------------------------------------------------------------------
@@ -1917,6 +1950,20 @@ void CParticleCollection::SimulateFirstFrame( )
 }
 
 
+//-----------------------------------------------------------------------------
+// Simulates a collection as a job pool item
+//-----------------------------------------------------------------------------
+struct ParticleSimulateJob_t
+{
+	CParticleCollection *m_pParticles;
+	float m_flDt;
+	bool m_bUpdateBboxOnly;
+};
+
+static void SimulateParticleJob( ParticleSimulateJob_t &job )
+{
+	job.m_pParticles->Simulate( job.m_flDt, job.m_bUpdateBboxOnly );
+}
 
 void CParticleCollection::Simulate( float dt, bool updateBboxOnly )
 {
@@ -2096,12 +2143,43 @@ void CParticleCollection::Simulate( float dt, bool updateBboxOnly )
 #endif
 	}
 
-	// let children simulate
+	// let children simulate. they only read from the parent, so unless one of them
+	// writes to it they can all run at the same time, each with its own kill list
+	int nChildren = 0;
+	bool bChildrenWriteParent = false;
 	for (CParticleCollection *i = m_Children.m_pHead; i; i = i->m_pNext)
 	{
-		LoanKillListTo(i);								// re-use the allocated kill list for the children
-		i->Simulate(dt, updateBboxOnly);
-		i->m_pParticleKillList = NULL;
+		++nChildren;
+		bChildrenWriteParent |= i->m_bWritesParentData;
+	}
+
+	if ( nChildren > 1 && !bChildrenWriteParent && g_pParticleSystemMgr->IsParallelSimulationEnabled() )
+	{
+		if (bAttachedKillList)
+		{
+			g_pParticleSystemMgr->DetachKillList(this);
+			bAttachedKillList = false;
+		}
+
+		ParticleSimulateJob_t *pJobs = (ParticleSimulateJob_t *)stackalloc( nChildren * sizeof( ParticleSimulateJob_t ) );
+		int nJob = 0;
+		for (CParticleCollection *i = m_Children.m_pHead; i; i = i->m_pNext)
+		{
+			pJobs[nJob].m_pParticles = i;
+			pJobs[nJob].m_flDt = dt;
+			pJobs[nJob].m_bUpdateBboxOnly = updateBboxOnly;
+			++nJob;
+		}
+		ParallelProcess( "CParticleCollection::Simulate children", pJobs, nChildren, SimulateParticleJob );
+	}
+	else
+	{
+		for (CParticleCollection *i = m_Children.m_pHead; i; i = i->m_pNext)
+		{
+			LoanKillListTo(i);								// re-use the allocated kill list for the children
+			i->Simulate(dt, updateBboxOnly);
+			i->m_pParticleKillList = NULL;
+		}
 	}
 
 	if (bAttachedKillList)
@@ -2109,7 +2187,8 @@ void CParticleCollection::Simulate( float dt, bool updateBboxOnly )
 
 	UpdatePrevControlPoints(dt);
 
-	// Bloat the bounding box by bounds around the control point
+	// Bloat the bounding box by bounds around the control point. This also merges
+	// the children's bounds, in order, once they have all finished.
 	BloatBoundsUsingControlPoint();
 
 }
@@ -2654,7 +2733,8 @@ void CParticleCollection::MoveParticle( int nInitialIndex, int nNewIndex )
 #define THREADED_PARTICLES 1
 
 #if THREADED_PARTICLES
-#define MAX_SIMULTANEOUS_KILL_LISTS 16
+// one for each collection simulating at the same time. buffers are allocated as they're first needed
+#define MAX_SIMULTANEOUS_KILL_LISTS 64
 static volatile int g_nKillBufferInUse[MAX_SIMULTANEOUS_KILL_LISTS];
 static int32 *g_pKillBuffers[MAX_SIMULTANEOUS_KILL_LISTS];
 
@@ -2914,6 +2994,8 @@ CParticleSystemMgr::CParticleSystemMgr()
 	m_bDidInit = false;
 	m_bUsingDefaultQuery = true;
 	m_bShouldLoadSheets = true;
+	m_bParallelSimulation = true;
+	m_bWideSIMD = false;
 	m_pParticleSystemDictionary = NULL;
 	m_nNumFramesMeasured = 0;
 	m_flLastSimulationTime = 0.0f;
@@ -2972,6 +3054,7 @@ bool CParticleSystemMgr::Init( IParticleSystemQuery *pQuery )
 		}
 
 		SeedRandSIMD( 12345678 );
+		EnableWideSIMD( true );
 		m_bDidInit = true;
 	}
 
@@ -3226,6 +3309,190 @@ float CParticleSystemMgr::GetLastSimulationTime() const
 	return m_flLastSimulationTime;
 }
 
+
+//-----------------------------------------------------------------------------
+// Simulates independent collections, see CParticleCollection::Simulate for children
+//-----------------------------------------------------------------------------
+void CParticleSystemMgr::SimulateCollections( CParticleCollection **ppParticles, int nCount, float flDt, bool bUpdateBboxOnly )
+{
+	if ( nCount <= 0 )
+		return;
+
+	VPROF_BUDGET( "CParticleSystemMgr::SimulateCollections", VPROF_BUDGETGROUP_PARTICLE_SIMULATION );
+
+	if ( !m_bParallelSimulation || nCount == 1 )
+	{
+		for ( int i = 0; i < nCount; i++ )
+		{
+			ppParticles[i]->Simulate( flDt, bUpdateBboxOnly );
+		}
+		return;
+	}
+
+	CUtlVector< ParticleSimulateJob_t > jobs( 0, nCount );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		ParticleSimulateJob_t &job = jobs[jobs.AddToTail()];
+		job.m_pParticles = ppParticles[i];
+		job.m_flDt = flDt;
+		job.m_bUpdateBboxOnly = bUpdateBboxOnly;
+	}
+	ParallelProcess( "CParticleSystemMgr::SimulateCollections", jobs.Base(), nCount, SimulateParticleJob );
+}
+
+void CParticleSystemMgr::EnableParallelSimulation( bool bEnable )
+{
+	m_bParallelSimulation = bEnable;
+}
+
+bool CParticleSystemMgr::IsParallelSimulationEnabled() const
+{
+	return m_bParallelSimulation;
+}
+
+int CParticleSystemMgr::GetCollisionTraceCount() const
+{
+	return g_nParticleCollisionTraces;
+}
+
+void CParticleSystemMgr::ResetCollisionTraceCount()
+{
+	g_nParticleCollisionTraces = 0;
+}
+
+void CParticleSystemMgr::EnableWideSIMD( bool bEnable )
+{
+#if PARTICLES_AVX2
+	m_bWideSIMD = bEnable && GetCPUInformation()->m_bAVX2;
+#else
+	m_bWideSIMD = false;
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+// Operator benchmark
+//-----------------------------------------------------------------------------
+static void SaveParticles( float * const *ppAttributes, const int *pnFloats, const uint8 *pContext, int nContextBytes, CUtlVector< uint8 > &buf )
+{
+	buf.RemoveAll();
+	for ( int i = 0; i < MAX_PARTICLE_ATTRIBUTES; i++ )
+	{
+		buf.AddMultipleToTail( pnFloats[i] * sizeof( float ), (const uint8 *)ppAttributes[i] );
+	}
+	buf.AddMultipleToTail( nContextBytes, pContext );
+}
+
+static void RestoreParticles( float * const *ppAttributes, const int *pnFloats, uint8 *pContext, int nContextBytes, const CUtlVector< uint8 > &buf )
+{
+	const uint8 *pData = buf.Base();
+	for ( int i = 0; i < MAX_PARTICLE_ATTRIBUTES; i++ )
+	{
+		memcpy( ppAttributes[i], pData, pnFloats[i] * sizeof( float ) );
+		pData += pnFloats[i] * sizeof( float );
+	}
+	memcpy( pContext, pData, nContextBytes );
+}
+
+void CParticleSystemMgr::BenchmarkOperators( CParticleCollection *pParticles, int nIterations, CUtlVector< OperatorTiming_t > &timings )
+{
+	timings.RemoveAll();
+	CParticleSystemDefinition *pDef = pParticles->m_pDef;
+	if ( !pDef || !pParticles->m_nActiveParticles || pParticles->HasAttachedKillList() )
+		return;
+
+	// Every per-particle attribute, and the operator contexts. Operators swap the
+	// position pointers, so those are put back too.
+	float *pAttributes[MAX_PARTICLE_ATTRIBUTES];
+	int nFloats[MAX_PARTICLE_ATTRIBUTES];
+	int nCompareFloats[MAX_PARTICLE_ATTRIBUTES];
+	for ( int i = 0; i < MAX_PARTICLE_ATTRIBUTES; i++ )
+	{
+		pAttributes[i] = pParticles->m_pParticleAttributes[i];
+		nFloats[i] = pParticles->m_nParticleFloatStrides[i] * pParticles->m_nAllocatedParticles / 4;
+		nCompareFloats[i] = pParticles->m_nParticleFloatStrides[i] * pParticles->m_nPaddedActiveParticles;
+	}
+	uint8 *pContext = pParticles->m_pOperatorContextData;
+	int nContextBytes = pDef->m_nContextDataSize;
+
+	CUtlVector< uint8 > start, narrow, wide;
+	CUtlVector< int > narrowKills;
+	SaveParticles( pAttributes, nFloats, pContext, nContextBytes, start );
+
+	bool bWideSIMD = m_bWideSIMD;
+	AttachKillList( pParticles );
+
+	for ( int i = 0; i < pDef->m_Operators.Count(); i++ )
+	{
+		CParticleOperatorInstance *pOp = pDef->m_Operators[i];
+		void *pOpContext = pContext + pDef->m_nOperatorsCtxOffsets[i];
+
+		OperatorTiming_t &timing = timings[timings.AddToTail()];
+		timing.m_pName = pOp->GetDefinition()->GetName();
+		timing.m_flNarrowTime = timing.m_flWideTime = 0.0f;
+		timing.m_nMismatches = 0;
+
+		for ( int nPass = 0; nPass < 2; nPass++ )
+		{
+			EnableWideSIMD( nPass == 1 );
+			bool bWide = ( nPass == 1 );
+			if ( bWide && !m_bWideSIMD )
+				break;
+
+			// the same random numbers both times
+			SeedRandSIMD( 12345678 );
+			pParticles->m_nNumParticlesToKill = 0;
+			pOp->Operate( pParticles, 1.0f, pOpContext );
+			SaveParticles( pParticles->m_pParticleAttributes, nFloats, pContext, nContextBytes, bWide ? wide : narrow );
+			if ( !bWide )
+			{
+				narrowKills.CopyArray( pParticles->m_pParticleKillList, pParticles->m_nNumParticlesToKill );
+			}
+			else if ( narrowKills.Count() != pParticles->m_nNumParticlesToKill ||
+				memcmp( narrowKills.Base(), pParticles->m_pParticleKillList, narrowKills.Count() * sizeof( int ) ) )
+			{
+				timing.m_nMismatches++;
+			}
+
+			float flTime = 0.0f;
+			for ( int nIteration = 0; nIteration < nIterations; nIteration++ )
+			{
+				memcpy( pParticles->m_pParticleAttributes, pAttributes, sizeof( pAttributes ) );
+				RestoreParticles( pAttributes, nFloats, pContext, nContextBytes, start );
+				pParticles->m_nNumParticlesToKill = 0;
+
+				float flStart = Plat_FloatTime();
+				pOp->Operate( pParticles, 1.0f, pOpContext );
+				flTime += Plat_FloatTime() - flStart;
+			}
+			( bWide ? timing.m_flWideTime : timing.m_flNarrowTime ) = flTime;
+
+			memcpy( pParticles->m_pParticleAttributes, pAttributes, sizeof( pAttributes ) );
+			RestoreParticles( pAttributes, nFloats, pContext, nContextBytes, start );
+
+			if ( !bWide )
+				continue;
+
+			// count the values that differ, in the particles that are alive
+			const float *pNarrow = (const float *)narrow.Base();
+			const float *pWide = (const float *)wide.Base();
+			for ( int nAttr = 0; nAttr < MAX_PARTICLE_ATTRIBUTES; nAttr++ )
+			{
+				for ( int j = 0; j < nCompareFloats[nAttr]; j++ )
+				{
+					timing.m_nMismatches += ( *(const uint32 *)&pNarrow[j] != *(const uint32 *)&pWide[j] );
+				}
+				pNarrow += nFloats[nAttr];
+				pWide += nFloats[nAttr];
+			}
+		}
+	}
+
+	pParticles->m_nNumParticlesToKill = 0;
+	DetachKillList( pParticles );
+	m_bWideSIMD = bWideSIMD;
+}
+
 bool CParticleSystemMgr::Debug_FrameWarningNeededTestAndReset()
 {
 	bool bTemp = m_bFrameWarningNeeded;
@@ -3623,13 +3890,14 @@ void CParticleSystemMgr::AddToRenderCache( CParticleCollection *pParticles )
 }
 
 
-void CParticleSystemMgr::BuildBatchList( int iRenderCache, IMatRenderContext *pRenderContext, CUtlVector< Batch_t >& batches )
+void CParticleSystemMgr::BuildBatchList( BatchList_t &batchList )
 {
+	CUtlVector< Batch_t > &batches = batchList.m_Batches;
 	batches.RemoveAll();
 
-	IMaterial *pMaterial = m_RenderCache[iRenderCache].m_pMaterial;
-	int nMaxVertices = pRenderContext->GetMaxVerticesToRender( pMaterial );
-	int nMaxIndices = pRenderContext->GetMaxIndicesToRender();
+	int iRenderCache = batchList.m_iRenderCache;
+	int nMaxVertices = batchList.m_nMaxVertices;
+	int nMaxIndices = batchList.m_nMaxIndices;
 
 	int nRemainingVertices = nMaxVertices;
 	int nRemainingIndices = nMaxIndices;
@@ -3689,7 +3957,7 @@ void CParticleSystemMgr::BuildBatchList( int iRenderCache, IMatRenderContext *pR
 
 	if ( pBatch->m_nVertCount <= 0 || pBatch->m_nIndexCount <= 0 ) 
 	{
-		batches.FastRemove( batches.Count() - 1 );
+		batches.RemoveMultipleFromTail( 1 );
 	}
 }
 
@@ -3761,18 +4029,44 @@ void CParticleSystemMgr::DrawRenderCache( bool bShadowDepth )
 	pRenderContext->PushMatrix();
 	pRenderContext->LoadIdentity();
 
-	CUtlVector< Batch_t > batches( 0, 8 );
-
+	// Batch lists only ask the renderers how much they'll draw, so they're built on
+	// the job pool. The render context is only used here, on this thread.
+	int nBatchLists = 0;
 	for ( int iRenderCache = 0; iRenderCache < nRenderCacheCount; ++iRenderCache )
 	{
-		int nCacheCount = m_RenderCache[iRenderCache].m_ParticleCollections.Count();
-		if ( nCacheCount == 0 )
+		if ( m_RenderCache[iRenderCache].m_ParticleCollections.Count() == 0 )
 			continue;
 
+		if ( nBatchLists == m_BatchLists.Count() )
+		{
+			m_BatchLists.AddToTail();
+		}
+		BatchList_t &batchList = m_BatchLists[nBatchLists++];
+		batchList.m_iRenderCache = iRenderCache;
+		batchList.m_nMaxVertices = pRenderContext->GetMaxVerticesToRender( m_RenderCache[iRenderCache].m_pMaterial );
+		batchList.m_nMaxIndices = pRenderContext->GetMaxIndicesToRender();
+	}
+
+	if ( m_bParallelSimulation && nBatchLists > 1 )
+	{
+		ParallelProcess( "CParticleSystemMgr::BuildBatchList", m_BatchLists.Base(), nBatchLists, this, &CParticleSystemMgr::BuildBatchList );
+	}
+	else
+	{
+		for ( int i = 0; i < nBatchLists; ++i )
+		{
+			BuildBatchList( m_BatchLists[i] );
+		}
+	}
+
+	for ( int iBatchList = 0; iBatchList < nBatchLists; ++iBatchList )
+	{
+		int iRenderCache = m_BatchLists[iBatchList].m_iRenderCache;
+		const CUtlVector< Batch_t > &batches = m_BatchLists[iBatchList].m_Batches;
+
 		// FIXME: When rendering shadow depth, do it all in 1 batch
 		IMaterial *pMaterial = bShadowDepth ? m_pShadowDepthMaterial : m_RenderCache[iRenderCache].m_pMaterial;
 
-		BuildBatchList( iRenderCache, pRenderContext, batches );
 		int nBatchCount = batches.Count();
 		if ( nBatchCount == 0 )
 			continue;
@@ -15,6 +15,7 @@
 #include "tier1/UtlStringMap.h"
 #include "tier1/utlbuffer.h"
 #include "tier2/fileutils.h"
+#include "tier0/threadtools.h"
 
 #define MAX_WORLD_PLANAR_CONSTRAINTS ( 26 + 5 + 10 )
 
@@ -22,6 +23,27 @@
 #define COLLISION_MODE_PER_FRAME_PLANESET 1
 #define COLLISION_MODE_INITIAL_TRACE_DOWN 2
 #define COLLISION_MODE_USE_NEAREST_TRACE 3
+#define COLLISION_MODE_VOXEL_GRID 4
+
+// COLLISION_MODE_VOXEL_GRID hashes world space cells into a fixed table. Each cell
+// keeps the planes found by tracing along the axes from the first particle in it,
+// and every particle in the cell collides with those instead of tracing.
+#define COLLISION_GRID_SLOTS 512								// power of 2
+#define COLLISION_GRID_MAX_CELL_PLANES 6
+
+struct CollisionGridCell_t
+{
+	int m_nCoords[3];
+	float m_flSampleTime;									// < 0 for an empty slot
+	int m_nPlanes;
+	// plain floats, so the table can be allocated and cleared as raw memory
+	float m_flPointOnPlane[COLLISION_GRID_MAX_CELL_PLANES][3];
+	float m_flPlaneNormal[COLLISION_GRID_MAX_CELL_PLANES][3];
+};
+
+// World traces issued by the collision constraints, see CParticleSystemMgr::GetCollisionTraceCount.
+// Interlocked, since collections simulate on the job pool threads.
+extern CInterlockedInt g_nParticleCollisionTraces;
 
 struct CWorldCollideContextData
 {
@@ -45,6 +67,23 @@ struct CWorldCollideContextData
 
 	void CalculatePlanes( CParticleCollection *pParticles, int nCollisionMode, int nCollisionGroupNumber,
 						  Vector const *pCpOffset = NULL, float flMovementTolerance = 0.  );
+
+	// COLLISION_MODE_VOXEL_GRID
+	// COLLISION_GRID_SLOTS cells, allocated by the first BeginGridFrame. NULL the pointer
+	// after new, and call PurgeGrid before delete.
+	CollisionGridCell_t *m_pGridCells;
+	int m_nGridCellsUsed;
+	float m_flGridCellSize;
+
+	// Empties the table when the cell size changes or it is getting full. Call once a frame,
+	// so cells found earlier in the frame stay put.
+	void BeginGridFrame( float flCellSize );
+	void PurgeGrid();
+
+	// The cell around vecPnt, sampled from vecPnt if it is new or older than flRefreshTime.
+	// NULL when the table is full.
+	CollisionGridCell_t *GetGridCell( Vector const &vecPnt, float flCurTime, float flRefreshTime,
+									  int nCollisionGroup, int nMask );
 };
 
 #endif // PARTICLES_INTERNAL_H	
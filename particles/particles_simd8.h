@@ -0,0 +1,116 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 8 wide AVX2 helpers for the particle operators. Attributes are
+//			stored in blocks of 4 particles, so 8 particles are two blocks
+//			of an attribute, one stride apart. Every helper does the same
+//			operation on each lane as its fltx4 version, so the 8 wide
+//			operators write exactly what the 4 wide ones do.
+//
+//===========================================================================//
+
+#ifndef PARTICLES_SIMD8_H
+#define PARTICLES_SIMD8_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "mathlib/ssemath.h"
+
+#if !defined( _X360 ) && !defined( _PS3 ) && !defined( __arm__ ) && !defined( __aarch64__ )
+#define PARTICLES_AVX2 1
+#include <immintrin.h>
+
+#ifdef COMPILER_GCC
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#else
+#define AVX2_FUNCTION
+#endif
+
+typedef __m256 fltx8;
+
+// Two blocks of an attribute. Constant attributes have a stride of 0 and read the same block twice.
+static AVX2_FUNCTION FORCEINLINE fltx8 LoadX8( const fltx4 *pBlock, size_t nStride )
+{
+	return _mm256_insertf128_ps( _mm256_castps128_ps256( pBlock[0] ), pBlock[nStride], 1 );
+}
+
+static AVX2_FUNCTION FORCEINLINE void StoreX8( fltx4 *pBlock, size_t nStride, const fltx8 &a )
+{
+	pBlock[0] = _mm256_castps256_ps128( a );
+	pBlock[nStride] = _mm256_extractf128_ps( a, 1 );
+}
+
+static AVX2_FUNCTION FORCEINLINE fltx8 ReplicateX8( float flValue )
+{
+	return _mm256_set1_ps( flValue );
+}
+
+static AVX2_FUNCTION FORCEINLINE fltx8 ReplicateX8( const fltx4 &a )
+{
+	return _mm256_insertf128_ps( _mm256_castps128_ps256( a ), a, 1 );
+}
+
+static AVX2_FUNCTION FORCEINLINE fltx8 AddX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_add_ps( a, b ); }
+static AVX2_FUNCTION FORCEINLINE fltx8 SubX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_sub_ps( a, b ); }
+static AVX2_FUNCTION FORCEINLINE fltx8 MulX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_mul_ps( a, b ); }
+static AVX2_FUNCTION FORCEINLINE fltx8 DivX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_div_ps( a, b ); }
+static AVX2_FUNCTION FORCEINLINE fltx8 MinX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_min_ps( a, b ); }
+static AVX2_FUNCTION FORCEINLINE fltx8 MaxX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_max_ps( a, b ); }
+static AVX2_FUNCTION FORCEINLINE fltx8 AndX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_and_ps( a, b ); }
+static AVX2_FUNCTION FORCEINLINE fltx8 AndNotX8( const fltx8 &a, const fltx8 &b )	{ return _mm256_andnot_ps( a, b ); }	// ~a & b
+static AVX2_FUNCTION FORCEINLINE fltx8 OrX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_or_ps( a, b ); }
+
+// _mm256_rcp_ps has the same precision as _mm_rcp_ps
+static AVX2_FUNCTION FORCEINLINE fltx8 ReciprocalEstX8( const fltx8 &a )				{ return _mm256_rcp_ps( a ); }
+
+static AVX2_FUNCTION FORCEINLINE fltx8 CmpGtX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_cmp_ps( a, b, _CMP_GT_OS ); }
+static AVX2_FUNCTION FORCEINLINE fltx8 CmpGeX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_cmp_ps( a, b, _CMP_GE_OS ); }
+static AVX2_FUNCTION FORCEINLINE fltx8 CmpLtX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_cmp_ps( a, b, _CMP_LT_OS ); }
+static AVX2_FUNCTION FORCEINLINE fltx8 CmpLeX8( const fltx8 &a, const fltx8 &b )		{ return _mm256_cmp_ps( a, b, _CMP_LE_OS ); }
+
+static AVX2_FUNCTION FORCEINLINE fltx8 MaskedAssignX8( const fltx8 &mask, const fltx8 &newValue, const fltx8 &oldValue )
+{
+	return OrX8( AndX8( mask, newValue ), AndNotX8( mask, oldValue ) );
+}
+
+static AVX2_FUNCTION FORCEINLINE int TestSignX8( const fltx8 &a )
+{
+	return _mm256_movemask_ps( a );
+}
+
+static AVX2_FUNCTION FORCEINLINE bool IsAnyNegativeX8( const fltx8 &a )
+{
+	return TestSignX8( a ) != 0;
+}
+
+// see SimpleSpline in ssemath.h
+static AVX2_FUNCTION FORCEINLINE fltx8 SimpleSplineX8( const fltx8 &value )
+{
+	fltx8 valueDoubled = MulX8( value, ReplicateX8( 2.0f ) );
+	fltx8 valueSquared = MulX8( value, value );
+	return SubX8( MulX8( ReplicateX8( 3.0f ), valueSquared ), MulX8( valueDoubled, valueSquared ) );
+}
+
+// see SimpleSplineRemapValWithDeltasClamped in ssemath.h
+static AVX2_FUNCTION FORCEINLINE fltx8 SimpleSplineRemapValWithDeltasClampedX8( const fltx8 &val,
+	const fltx8 &A, const fltx8 &OneOverBMinusA, const fltx8 &C, const fltx8 &DMinusC )
+{
+	fltx8 cVal = MulX8( SubX8( val, A ), OneOverBMinusA );
+	cVal = MinX8( ReplicateX8( 1.0f ), MaxX8( _mm256_setzero_ps(), cVal ) );
+	return AddX8( C, MulX8( DMinusC, SimpleSplineX8( cVal ) ) );
+}
+
+// Adds the lanes set in nMask to the kill list, in order. nFirst is the particle in lane 0.
+FORCEINLINE void KillParticlesX8( CParticleCollection *pParticles, int nFirst, int nMask )
+{
+	for ( int i = 0; nMask; i++, nMask >>= 1 )
+	{
+		if ( nMask & 1 )
+			pParticles->KillParticle( nFirst + i );
+	}
+}
+
+#endif
+
+#endif // PARTICLES_SIMD8_H
@@ -22,6 +22,7 @@
 #include "tier0/tslist.h"
 #include "vphysics_interface.h"
 #include "mathlib/compressed_vector.h"
+#include "datacache/imdlcache.h"
 
 #ifdef CLIENT_DLL
 	#include "posedebugger.h"
@@ -214,31 +215,104 @@ short *CBoneCache::CachedToStudio()
 	return (short *)( (char *)(this+1) + m_cachedToStudioOffset );
 }
 
+//-----------------------------------------------------------------------------
+// The shared bone cache is split into stripes, each with its own lock and LRU,
+// so entities setting up bones on different threads don't serialize on one
+// mutex. The stripes split the 128KB budget of the single cache between them.
+// The stripe is kept in bits 13-15 of the handle, which leaves the data manager
+// 8191 items per stripe; a stripe's memory budget keeps it far below that.
+//-----------------------------------------------------------------------------
+#define BONECACHE_STRIPE_BITS		3
+#define BONECACHE_STRIPES			( 1 << BONECACHE_STRIPE_BITS )
+#define BONECACHE_STRIPE_SHIFT		( 16 - BONECACHE_STRIPE_BITS )
+#define BONECACHE_STRIPE_MASK		( ( BONECACHE_STRIPES - 1 ) << BONECACHE_STRIPE_SHIFT )
+
+typedef CDataManager<CBoneCache, bonecacheparams_t, CBoneCache *, CThreadFastMutex> CBoneCacheStripe;
+
+class CStudioBoneCache
+{
+public:
+	CStudioBoneCache()
+	{
+		for ( int i = 0; i < BONECACHE_STRIPES; i++ )
+		{
+			m_Stripes[i].SetTargetSize( ( 128 * 1024L ) / BONECACHE_STRIPES );
+		}
+	}
+
+	CBoneCache *Get( memhandle_t hHandle )
+	{
+		CBoneCacheStripe &stripe = m_Stripes[ StripeFromHandle( hHandle ) ];
+		AUTO_LOCK( stripe.AccessMutex() );
+		return stripe.GetResource_NoLock( InnerHandle( hHandle ) );
+	}
+
+	memhandle_t Create( bonecacheparams_t &params )
+	{
+		unsigned int iStripe = NextStripe();
+		CBoneCacheStripe &stripe = m_Stripes[iStripe];
+		AUTO_LOCK( stripe.AccessMutex() );
+		memhandle_t hInner = stripe.CreateResource( params );
+		unsigned int nInner = (unsigned int)(uintp)hInner;
+		if ( nInner & BONECACHE_STRIPE_MASK )
+		{
+			AssertMsg( 0, "Bone cache stripe overflow\n" );
+			stripe.DestroyResource( hInner );
+			return 0;
+		}
+		return (memhandle_t)(uintp)( nInner | ( iStripe << BONECACHE_STRIPE_SHIFT ) );
+	}
+
+	void Destroy( memhandle_t hHandle )
+	{
+		CBoneCacheStripe &stripe = m_Stripes[ StripeFromHandle( hHandle ) ];
+		AUTO_LOCK( stripe.AccessMutex() );
+		stripe.DestroyResource( InnerHandle( hHandle ) );
+	}
+
+private:
+	// New caches go to the stripes round robin, which spreads them evenly over the
+	// budget and puts caches created at the same time on different threads apart
+	unsigned int NextStripe()
+	{
+		return (unsigned int)( ++m_nNextStripe ) % BONECACHE_STRIPES;
+	}
+
+	static unsigned int StripeFromHandle( memhandle_t hHandle )
+	{
+		return ( (unsigned int)(uintp)hHandle & BONECACHE_STRIPE_MASK ) >> BONECACHE_STRIPE_SHIFT;
+	}
+
+	static memhandle_t InnerHandle( memhandle_t hHandle )
+	{
+		return (memhandle_t)(uintp)( (unsigned int)(uintp)hHandle & ~BONECACHE_STRIPE_MASK );
+	}
+
+	CBoneCacheStripe		m_Stripes[BONECACHE_STRIPES];
+	CInterlockedInt			m_nNextStripe;
+};
+
 // Construct a singleton
-static CDataManager<CBoneCache, bonecacheparams_t, CBoneCache *, CThreadFastMutex> g_StudioBoneCache( 128 * 1024L );
+static CStudioBoneCache g_StudioBoneCache;
 
 CBoneCache *Studio_GetBoneCache( memhandle_t cacheHandle )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
-	return g_StudioBoneCache.GetResource_NoLock( cacheHandle );
+	return g_StudioBoneCache.Get( cacheHandle );
 }
 
 memhandle_t Studio_CreateBoneCache( bonecacheparams_t &params )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
-	return g_StudioBoneCache.CreateResource( params );
+	return g_StudioBoneCache.Create( params );
 }
 
 void Studio_DestroyBoneCache( memhandle_t cacheHandle )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
-	g_StudioBoneCache.DestroyResource( cacheHandle );
+	g_StudioBoneCache.Destroy( cacheHandle );
 }
 
 void Studio_InvalidateBoneCache( memhandle_t cacheHandle )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
-	CBoneCache *pCache = g_StudioBoneCache.GetResource_NoLock( cacheHandle );
+	CBoneCache *pCache = g_StudioBoneCache.Get( cacheHandle );
 	if ( pCache )
 	{
 		pCache->m_timeValid = -1.0f;
@@ -370,13 +444,103 @@ void ExtractAnimValue( int frame, mstudioanimvalue_t *panimvalue, float scale, f
 	}
 }
 
+
+//-----------------------------------------------------------------------------
+// Decoded animation sections
+//
+// The model cache can expand a section's tracks to one value per frame (see
+// studiodecodedanim_t), which turns the span walk above into an index. The
+// tables hold the same quantized values, so the results are bit identical;
+// frames a table doesn't cover go back to the walk.
+//-----------------------------------------------------------------------------
+static ConVar anim_decoded_cache( "anim_decoded_cache", "1", 0, "Look animation frames up in per-frame tables from the model cache instead of decoding the compressed tracks." );
+
+// Set by Studio_BenchmarkAnimDecode to force one path, -1 follows anim_decoded_cache
+static int s_nForceDecodedAnims = -1;
+
+static const studiodecodedanim_t *GetDecodedAnimation( const CStudioHdr *pStudioHdr, const mstudioanimdesc_t &animdesc, int iSection, const mstudioanim_t *panim )
+{
+	bool bUseDecoded = ( s_nForceDecodedAnims >= 0 ) ? ( s_nForceDecodedAnims != 0 ) : anim_decoded_cache.GetBool();
+	IMDLCache *pMDLCache = pStudioHdr->GetMDLCache();
+	if ( !bUseDecoded || !pMDLCache || !panim )
+		return NULL;
+
+	return pMDLCache->GetDecodedAnimation( animdesc, iSection, panim );
+}
+
+static FORCEINLINE void ExtractAnimValue( int frame, const studiodecodedanim_t *pDecoded, const studiodecodedtrack_t *pTrack, mstudioanimvalue_t *panimvalue, float scale, float &v1, float &v2 )
+{
+	if ( pTrack )
+	{
+		// the blend value past the last frame is read from whatever follows the track, leave that to the walk
+		switch ( pTrack->type )
+		{
+		case STUDIO_DECODED_NONE:
+			v1 = v2 = 0;
+			return;
+
+		case STUDIO_DECODED_CONST:
+			if ( frame < pDecoded->numframes - 1 )
+			{
+				v1 = v2 = pDecoded->pValues()[pTrack->valueindex] * scale;
+				return;
+			}
+			break;
+
+		case STUDIO_DECODED_TABLE:
+			if ( frame < pDecoded->numframes - 1 )
+			{
+				const short *pValues = pDecoded->pValues() + pTrack->valueindex + frame;
+				v1 = pValues[0] * scale;
+				v2 = pValues[1] * scale;
+				return;
+			}
+			break;
+		}
+	}
+
+	ExtractAnimValue( frame, panimvalue, scale, v1, v2 );
+}
+
+static FORCEINLINE void ExtractAnimValue( int frame, const studiodecodedanim_t *pDecoded, const studiodecodedtrack_t *pTrack, mstudioanimvalue_t *panimvalue, float scale, float &v1 )
+{
+	if ( pTrack )
+	{
+		switch ( pTrack->type )
+		{
+		case STUDIO_DECODED_NONE:
+			v1 = 0;
+			return;
+
+		case STUDIO_DECODED_CONST:
+			if ( frame < pDecoded->numframes )
+			{
+				v1 = pDecoded->pValues()[pTrack->valueindex] * scale;
+				return;
+			}
+			break;
+
+		case STUDIO_DECODED_TABLE:
+			if ( frame < pDecoded->numframes )
+			{
+				v1 = pDecoded->pValues()[pTrack->valueindex + frame] * scale;
+				return;
+			}
+			break;
+		}
+	}
+
+	ExtractAnimValue( frame, panimvalue, scale, v1 );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: return a sub frame rotation for a single bone
 //-----------------------------------------------------------------------------
 void CalcBoneQuaternion( int frame, float s, 
 						const Quaternion &baseQuat, const RadianEuler &baseRot, const Vector &baseRotScale, 
 						int iBaseFlags, const Quaternion &baseAlignment, 
-						const mstudioanim_t *panim, Quaternion &q )
+						const mstudioanim_t *panim, Quaternion &q,
+						const studiodecodedanim_t *pDecoded = NULL, const studiodecodedtrack_t *pTracks = NULL )
 {
 	if ( panim->flags & STUDIO_ANIM_RAWROT )
 	{
@@ -416,9 +580,9 @@ void CalcBoneQuaternion( int frame, float s,
 		QuaternionAligned	q1, q2;
 		RadianEuler			angle1, angle2;
 
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 0 ), baseRotScale.x, angle1.x, angle2.x );
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 1 ), baseRotScale.y, angle1.y, angle2.y );
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 2 ), baseRotScale.z, angle1.z, angle2.z );
+		ExtractAnimValue( frame, pDecoded, pTracks ? &pTracks[0] : NULL, pValuesPtr->pAnimvalue( 0 ), baseRotScale.x, angle1.x, angle2.x );
+		ExtractAnimValue( frame, pDecoded, pTracks ? &pTracks[1] : NULL, pValuesPtr->pAnimvalue( 1 ), baseRotScale.y, angle1.y, angle2.y );
+		ExtractAnimValue( frame, pDecoded, pTracks ? &pTracks[2] : NULL, pValuesPtr->pAnimvalue( 2 ), baseRotScale.z, angle1.z, angle2.z );
 
 		if (!(panim->flags & STUDIO_ANIM_DELTA))
 		{
@@ -455,9 +619,9 @@ void CalcBoneQuaternion( int frame, float s,
 	{
 		RadianEuler			angle;
 
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 0 ), baseRotScale.x, angle.x );
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 1 ), baseRotScale.y, angle.y );
-		ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 2 ), baseRotScale.z, angle.z );
+		ExtractAnimValue( frame, pDecoded, pTracks ? &pTracks[0] : NULL, pValuesPtr->pAnimvalue( 0 ), baseRotScale.x, angle.x );
+		ExtractAnimValue( frame, pDecoded, pTracks ? &pTracks[1] : NULL, pValuesPtr->pAnimvalue( 1 ), baseRotScale.y, angle.y );
+		ExtractAnimValue( frame, pDecoded, pTracks ? &pTracks[2] : NULL, pValuesPtr->pAnimvalue( 2 ), baseRotScale.z, angle.z );
 
 		if (!(panim->flags & STUDIO_ANIM_DELTA))
 		{
@@ -482,15 +646,16 @@ void CalcBoneQuaternion( int frame, float s,
 inline void CalcBoneQuaternion( int frame, float s, 
 						const mstudiobone_t *pBone,
 						const mstudiolinearbone_t *pLinearBones,
-						const mstudioanim_t *panim, Quaternion &q )
+						const mstudioanim_t *panim, Quaternion &q,
+						const studiodecodedanim_t *pDecoded = NULL, const studiodecodedtrack_t *pTracks = NULL )
 {
 	if (pLinearBones)
 	{
-		CalcBoneQuaternion( frame, s, pLinearBones->quat(panim->bone), pLinearBones->rot(panim->bone), pLinearBones->rotscale(panim->bone), pLinearBones->flags(panim->bone), pLinearBones->qalignment(panim->bone), panim, q );
+		CalcBoneQuaternion( frame, s, pLinearBones->quat(panim->bone), pLinearBones->rot(panim->bone), pLinearBones->rotscale(panim->bone), pLinearBones->flags(panim->bone), pLinearBones->qalignment(panim->bone), panim, q, pDecoded, pTracks );
 	}
 	else
 	{
-		CalcBoneQuaternion( frame, s, pBone->quat, pBone->rot, pBone->rotscale, pBone->flags, pBone->qAlignment, panim, q );
+		CalcBoneQuaternion( frame, s, pBone->quat, pBone->rot, pBone->rotscale, pBone->flags, pBone->qAlignment, panim, q, pDecoded, pTracks );
 	}
 }
 
@@ -503,7 +668,8 @@ inline void CalcBoneQuaternion( int frame, float s,
 //-----------------------------------------------------------------------------
 void CalcBonePosition(	int frame, float s,
 						const Vector &basePos, const Vector &baseBoneScale, 
-						const mstudioanim_t *panim, Vector &pos	)
+						const mstudioanim_t *panim, Vector &pos,
+						const studiodecodedanim_t *pDecoded = NULL, const studiodecodedtrack_t *pTracks = NULL )
 {
 	if (panim->flags & STUDIO_ANIM_RAWPOS)
 	{
@@ -533,7 +699,7 @@ void CalcBonePosition(	int frame, float s,
 		float v1, v2;
 		for (j = 0; j < 3; j++)
 		{
-			ExtractAnimValue( frame, pPosV->pAnimvalue( j ), baseBoneScale[j], v1, v2 );
+			ExtractAnimValue( frame, pDecoded, pTracks ? &pTracks[3+j] : NULL, pPosV->pAnimvalue( j ), baseBoneScale[j], v1, v2 );
 			pos[j] = v1 * (1.0 - s) + v2 * s;
 		}
 	}
@@ -541,7 +707,7 @@ void CalcBonePosition(	int frame, float s,
 	{
 		for (j = 0; j < 3; j++)
 		{
-			ExtractAnimValue( frame, pPosV->pAnimvalue( j ), baseBoneScale[j], pos[j] );
+			ExtractAnimValue( frame, pDecoded, pTracks ? &pTracks[3+j] : NULL, pPosV->pAnimvalue( j ), baseBoneScale[j], pos[j] );
 		}
 	}
 
@@ -559,15 +725,591 @@ void CalcBonePosition(	int frame, float s,
 inline void CalcBonePosition( int frame, float s, 
 						const mstudiobone_t *pBone,
 						const mstudiolinearbone_t *pLinearBones,
-						const mstudioanim_t *panim, Vector &pos )
+						const mstudioanim_t *panim, Vector &pos,
+						const studiodecodedanim_t *pDecoded = NULL, const studiodecodedtrack_t *pTracks = NULL )
 {
 	if (pLinearBones)
 	{
-		CalcBonePosition( frame, s, pLinearBones->pos(panim->bone), pLinearBones->posscale(panim->bone), panim, pos );
+		CalcBonePosition( frame, s, pLinearBones->pos(panim->bone), pLinearBones->posscale(panim->bone), panim, pos, pDecoded, pTracks );
+	}
+	else
+	{
+		CalcBonePosition( frame, s, pBone->pos, pBone->posscale, panim, pos, pDecoded, pTracks );
+	}
+}
+
+
+
+//-----------------------------------------------------------------------------
+// SIMD bone kernels
+//
+// The pose arrays stay one Quaternion / Vector per bone, since everything
+// downstream reads them that way. The kernels load four bones at a time and
+// transpose them so each fltx4 holds one component of four bones, then
+// transpose back on store. Only the lanes of bones that are actually being
+// written are stored, so the results differ from the scalar code by float
+// rounding only. anim_simd_validate runs both and reports where they disagree.
+//-----------------------------------------------------------------------------
+static ConVar anim_simd( "anim_simd", "0", 0, "Use the four-wide SIMD bone kernels for animation decode, blending and bone matrices." );
+static ConVar anim_simd_validate( "anim_simd_validate", "0", 0, "Run the scalar bone code alongside the SIMD kernels and report bones that differ." );
+static ConVar anim_simd_tolerance( "anim_simd_tolerance", "0.001", 0, "Largest per-component difference anim_simd_validate accepts." );
+
+// Set by Studio_BenchmarkBoneSetup to force one path, -1 follows anim_simd
+static int s_nForceSIMDBones = -1;
+
+static inline bool UseSIMDBones()
+{
+	return ( s_nForceSIMDBones >= 0 ) ? ( s_nForceSIMDBones != 0 ) : anim_simd.GetBool();
+}
+
+static inline bool ValidateSIMDBones()
+{
+	return s_nForceSIMDBones < 0 && anim_simd_validate.GetBool();
+}
+
+static float BoneQuaternionError( const Quaternion &a, const Quaternion &b )
+{
+	return MAX( MAX( fabs( a.x - b.x ), fabs( a.y - b.y ) ), MAX( fabs( a.z - b.z ), fabs( a.w - b.w ) ) );
+}
+
+static float BonePositionError( const Vector &a, const Vector &b )
+{
+	return MAX( fabs( a.x - b.x ), MAX( fabs( a.y - b.y ), fabs( a.z - b.z ) ) );
+}
+
+static void ReportSIMDBoneMismatch( const char *pszStage, const CStudioHdr *pStudioHdr, int iBone, float flError )
+{
+	Warning( "anim_simd_validate: %s differs on %s bone %d (%s) by %f\n", pszStage, pStudioHdr->pszName(), iBone,
+		pStudioHdr->pBone( iBone )->pszName(), flError );
+}
+
+// Compares a whole pose, either array of positions may be NULL
+static void CompareSIMDBones( const char *pszStage, const CStudioHdr *pStudioHdr, 
+	const Quaternion *qSIMD, const Vector *posSIMD, const Quaternion *qScalar, const Vector *posScalar, const float *pWeight )
+{
+	float flTolerance = anim_simd_tolerance.GetFloat();
+	for ( int i = 0; i < pStudioHdr->numbones(); i++ )
+	{
+		if ( pWeight[i] <= 0.0f )
+			continue;
+
+		float flError = BoneQuaternionError( qSIMD[i], qScalar[i] );
+		if ( posSIMD && posScalar )
+		{
+			flError = MAX( flError, BonePositionError( posSIMD[i], posScalar[i] ) );
+		}
+		if ( flError > flTolerance )
+		{
+			ReportSIMDBoneMismatch( pszStage, pStudioHdr, i, flError );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Four quaternions, one component per fltx4
+//-----------------------------------------------------------------------------
+struct FourQuaternions
+{
+	fltx4 x, y, z, w;
+
+	FORCEINLINE void LoadAndSwizzle( const Quaternion &a, const Quaternion &b, const Quaternion &c, const Quaternion &d )
+	{
+		x = LoadUnalignedSIMD( a.Base() );
+		y = LoadUnalignedSIMD( b.Base() );
+		z = LoadUnalignedSIMD( c.Base() );
+		w = LoadUnalignedSIMD( d.Base() );
+		TransposeSIMD( x, y, z, w );
+	}
+
+	// Writes back the lanes set in nLaneMask (bit n = lane n)
+	FORCEINLINE void SwizzleAndStore( Quaternion &a, Quaternion &b, Quaternion &c, Quaternion &d, int nLaneMask ) const
+	{
+		fltx4 ta = x, tb = y, tc = z, td = w;
+		TransposeSIMD( ta, tb, tc, td );
+		if ( nLaneMask & 1 )
+			StoreUnalignedSIMD( a.Base(), ta );
+		if ( nLaneMask & 2 )
+			StoreUnalignedSIMD( b.Base(), tb );
+		if ( nLaneMask & 4 )
+			StoreUnalignedSIMD( c.Base(), tc );
+		if ( nLaneMask & 8 )
+			StoreUnalignedSIMD( d.Base(), td );
+	}
+};
+
+static FORCEINLINE void StoreFourVectors( const FourVectors &v, Vector &a, Vector &b, Vector &c, Vector &d, int nLaneMask )
+{
+	if ( nLaneMask & 1 )
+		a.Init( v.X( 0 ), v.Y( 0 ), v.Z( 0 ) );
+	if ( nLaneMask & 2 )
+		b.Init( v.X( 1 ), v.Y( 1 ), v.Z( 1 ) );
+	if ( nLaneMask & 4 )
+		c.Init( v.X( 2 ), v.Y( 2 ), v.Z( 2 ) );
+	if ( nLaneMask & 8 )
+		d.Init( v.X( 3 ), v.Y( 3 ), v.Z( 3 ) );
+}
+
+static FORCEINLINE fltx4 QuaternionDotSoA( const FourQuaternions &p, const FourQuaternions &q )
+{
+	return AddSIMD( AddSIMD( MulSIMD( p.x, q.x ), MulSIMD( p.y, q.y ) ), AddSIMD( MulSIMD( p.z, q.z ), MulSIMD( p.w, q.w ) ) );
+}
+
+//-----------------------------------------------------------------------------
+// The following mirror QuaternionAlign, QuaternionNormalize, QuaternionBlendNoAlign,
+// QuaternionSlerpNoAlign, QuaternionScale, QuaternionMult and AngleQuaternion,
+// including their special cases, lane by lane.
+//-----------------------------------------------------------------------------
+
+// Flips q where it is more than 90 degrees from p, in the lanes set in allowMask
+static FORCEINLINE void QuaternionAlignSoA( const FourQuaternions &p, FourQuaternions &q, const fltx4 &allowMask )
+{
+	fltx4 dx = SubSIMD( p.x, q.x ), dy = SubSIMD( p.y, q.y ), dz = SubSIMD( p.z, q.z ), dw = SubSIMD( p.w, q.w );
+	fltx4 sx = AddSIMD( p.x, q.x ), sy = AddSIMD( p.y, q.y ), sz = AddSIMD( p.z, q.z ), sw = AddSIMD( p.w, q.w );
+	fltx4 a = AddSIMD( AddSIMD( MulSIMD( dx, dx ), MulSIMD( dy, dy ) ), AddSIMD( MulSIMD( dz, dz ), MulSIMD( dw, dw ) ) );
+	fltx4 b = AddSIMD( AddSIMD( MulSIMD( sx, sx ), MulSIMD( sy, sy ) ), AddSIMD( MulSIMD( sz, sz ), MulSIMD( sw, sw ) ) );
+	fltx4 flip = AndSIMD( allowMask, CmpGtSIMD( a, b ) );
+	q.x = MaskedAssign( flip, NegSIMD( q.x ), q.x );
+	q.y = MaskedAssign( flip, NegSIMD( q.y ), q.y );
+	q.z = MaskedAssign( flip, NegSIMD( q.z ), q.z );
+	q.w = MaskedAssign( flip, NegSIMD( q.w ), q.w );
+}
+
+static FORCEINLINE void QuaternionNormalizeSoA( FourQuaternions &q )
+{
+	fltx4 radius = QuaternionDotSoA( q, q );
+	fltx4 iradius = MaskedAssign( CmpGtSIMD( radius, Four_Zeros ), DivSIMD( Four_Ones, SqrtSIMD( radius ) ), Four_Ones );
+	q.x = MulSIMD( q.x, iradius );
+	q.y = MulSIMD( q.y, iradius );
+	q.z = MulSIMD( q.z, iradius );
+	q.w = MulSIMD( q.w, iradius );
+}
+
+static FORCEINLINE void QuaternionBlendNoAlignSoA( const FourQuaternions &p, const FourQuaternions &q, const fltx4 &t, FourQuaternions &qt )
+{
+	fltx4 sclp = SubSIMD( Four_Ones, t );
+	qt.x = AddSIMD( MulSIMD( sclp, p.x ), MulSIMD( t, q.x ) );
+	qt.y = AddSIMD( MulSIMD( sclp, p.y ), MulSIMD( t, q.y ) );
+	qt.z = AddSIMD( MulSIMD( sclp, p.z ), MulSIMD( t, q.z ) );
+	qt.w = AddSIMD( MulSIMD( sclp, p.w ), MulSIMD( t, q.w ) );
+	QuaternionNormalizeSoA( qt );
+}
+
+static FORCEINLINE void QuaternionSlerpNoAlignSoA( const FourQuaternions &p, const FourQuaternions &q, const fltx4 &t, FourQuaternions &qt )
+{
+	static const fltx4 vecThreshold = ReplicateX4( 0.000001f );
+	static const fltx4 vecHalfPi = ReplicateX4( 0.5f * M_PI );
+
+	fltx4 cosom = QuaternionDotSoA( p, q );
+	fltx4 oneMinusT = SubSIMD( Four_Ones, t );
+
+	// Same branches as the scalar code: nearly identical lerps, nearly opposite rotates
+	// through a perpendicular quaternion, everything else slerps
+	fltx4 bLerp = CmpLeSIMD( SubSIMD( Four_Ones, cosom ), vecThreshold );
+	fltx4 bOpposite = CmpLeSIMD( AddSIMD( Four_Ones, cosom ), vecThreshold );
+	fltx4 bSlerp = AndNotSIMD( OrSIMD( bLerp, bOpposite ), LoadAlignedSIMD( g_SIMD_AllOnesMask ) );
+
+	fltx4 sclp = oneMinusT;
+	fltx4 sclq = t;
+	if ( !IsAllZeros( bSlerp ) )
+	{
+		// The other lanes get a harmless angle, so they don't divide by a zero sine
+		fltx4 omega = ArcCosSIMD( MaskedAssign( bSlerp, cosom, Four_Zeros ) );
+		fltx4 sinom = SinSIMD( omega );
+		sclp = MaskedAssign( bSlerp, DivSIMD( SinSIMD( MulSIMD( oneMinusT, omega ) ), sinom ), sclp );
+		sclq = MaskedAssign( bSlerp, DivSIMD( SinSIMD( MulSIMD( t, omega ) ), sinom ), sclq );
+	}
+
+	qt.x = AddSIMD( MulSIMD( sclp, p.x ), MulSIMD( sclq, q.x ) );
+	qt.y = AddSIMD( MulSIMD( sclp, p.y ), MulSIMD( sclq, q.y ) );
+	qt.z = AddSIMD( MulSIMD( sclp, p.z ), MulSIMD( sclq, q.z ) );
+	qt.w = AddSIMD( MulSIMD( sclp, p.w ), MulSIMD( sclq, q.w ) );
+
+	if ( !IsAllZeros( bOpposite ) )
+	{
+		fltx4 sclpPerp = SinSIMD( MulSIMD( oneMinusT, vecHalfPi ) );
+		fltx4 sclqPerp = SinSIMD( MulSIMD( t, vecHalfPi ) );
+		qt.x = MaskedAssign( bOpposite, AddSIMD( MulSIMD( sclpPerp, p.x ), MulSIMD( sclqPerp, NegSIMD( q.y ) ) ), qt.x );
+		qt.y = MaskedAssign( bOpposite, AddSIMD( MulSIMD( sclpPerp, p.y ), MulSIMD( sclqPerp, q.x ) ), qt.y );
+		qt.z = MaskedAssign( bOpposite, AddSIMD( MulSIMD( sclpPerp, p.z ), MulSIMD( sclqPerp, NegSIMD( q.w ) ) ), qt.z );
+		qt.w = MaskedAssign( bOpposite, q.z, qt.w );
+	}
+}
+
+static FORCEINLINE void QuaternionScaleSoA( const FourQuaternions &p, const fltx4 &t, FourQuaternions &q )
+{
+	fltx4 sinom = SqrtSIMD( AddSIMD( AddSIMD( MulSIMD( p.x, p.x ), MulSIMD( p.y, p.y ) ), MulSIMD( p.z, p.z ) ) );
+	sinom = MinSIMD( sinom, Four_Ones );
+
+	fltx4 sinsom = SinSIMD( MulSIMD( ArcSinSIMD( sinom ), t ) );
+	fltx4 scale = DivSIMD( sinsom, AddSIMD( sinom, Four_Epsilons ) );
+	q.x = MulSIMD( p.x, scale );
+	q.y = MulSIMD( p.y, scale );
+	q.z = MulSIMD( p.z, scale );
+
+	// rescale rotation, keeping its sign
+	fltx4 r = SqrtSIMD( MaxSIMD( SubSIMD( Four_Ones, MulSIMD( sinsom, sinsom ) ), Four_Zeros ) );
+	q.w = MaskedAssign( CmpLtSIMD( p.w, Four_Zeros ), NegSIMD( r ), r );
+}
+
+static FORCEINLINE void QuaternionMultSoA( const FourQuaternions &p, const FourQuaternions &q, FourQuaternions &qt )
+{
+	FourQuaternions q2 = q;
+	QuaternionAlignSoA( p, q2, LoadAlignedSIMD( g_SIMD_AllOnesMask ) );
+
+	qt.x = AddSIMD( SubSIMD( AddSIMD( MulSIMD( p.x, q2.w ), MulSIMD( p.y, q2.z ) ), MulSIMD( p.z, q2.y ) ), MulSIMD( p.w, q2.x ) );
+	qt.y = AddSIMD( AddSIMD( SubSIMD( MulSIMD( p.y, q2.w ), MulSIMD( p.x, q2.z ) ), MulSIMD( p.z, q2.x ) ), MulSIMD( p.w, q2.y ) );
+	qt.z = AddSIMD( AddSIMD( SubSIMD( MulSIMD( p.x, q2.y ), MulSIMD( p.y, q2.x ) ), MulSIMD( p.z, q2.w ) ), MulSIMD( p.w, q2.z ) );
+	qt.w = SubSIMD( SubSIMD( SubSIMD( MulSIMD( p.w, q2.w ), MulSIMD( p.x, q2.x ) ), MulSIMD( p.y, q2.y ) ), MulSIMD( p.z, q2.z ) );
+}
+
+// x, y, z are the RadianEuler components of four bones
+static FORCEINLINE void AngleQuaternionSoA( const fltx4 &x, const fltx4 &y, const fltx4 &z, FourQuaternions &q )
+{
+	fltx4 sr, sp, sy, cr, cp, cy;
+	SinCosSIMD( sy, cy, MulSIMD( z, Four_PointFives ) );
+	SinCosSIMD( sp, cp, MulSIMD( y, Four_PointFives ) );
+	SinCosSIMD( sr, cr, MulSIMD( x, Four_PointFives ) );
+
+	fltx4 srXcp = MulSIMD( sr, cp ), crXsp = MulSIMD( cr, sp );
+	q.x = SubSIMD( MulSIMD( srXcp, cy ), MulSIMD( crXsp, sy ) );
+	q.y = AddSIMD( MulSIMD( crXsp, cy ), MulSIMD( srXcp, sy ) );
+
+	fltx4 crXcp = MulSIMD( cr, cp ), srXsp = MulSIMD( sr, sp );
+	q.z = SubSIMD( MulSIMD( crXcp, sy ), MulSIMD( srXsp, cy ) );
+	q.w = AddSIMD( MulSIMD( crXcp, cy ), MulSIMD( srXsp, sy ) );
+}
+
+// Writes the local matrices of four bones
+static FORCEINLINE void QuaternionMatrixSoA( const FourQuaternions &q, const FourVectors &pos, matrix3x4_t &a, matrix3x4_t &b, matrix3x4_t &c, matrix3x4_t &d )
+{
+	fltx4 x2 = AddSIMD( q.x, q.x ), y2 = AddSIMD( q.y, q.y ), z2 = AddSIMD( q.z, q.z );
+	fltx4 xx = MulSIMD( q.x, x2 ), xy = MulSIMD( q.x, y2 ), xz = MulSIMD( q.x, z2 );
+	fltx4 yy = MulSIMD( q.y, y2 ), yz = MulSIMD( q.y, z2 ), zz = MulSIMD( q.z, z2 );
+	fltx4 wx = MulSIMD( q.w, x2 ), wy = MulSIMD( q.w, y2 ), wz = MulSIMD( q.w, z2 );
+
+	// Each fltx4 below is one matrix element of four bones; transposing a row
+	// of them gives that row of each bone's matrix.
+	fltx4 r0c0 = SubSIMD( SubSIMD( Four_Ones, yy ), zz ), r0c1 = SubSIMD( xy, wz ), r0c2 = AddSIMD( xz, wy ), r0c3 = pos.x;
+	fltx4 r1c0 = AddSIMD( xy, wz ), r1c1 = SubSIMD( SubSIMD( Four_Ones, xx ), zz ), r1c2 = SubSIMD( yz, wx ), r1c3 = pos.y;
+	fltx4 r2c0 = SubSIMD( xz, wy ), r2c1 = AddSIMD( yz, wx ), r2c2 = SubSIMD( SubSIMD( Four_Ones, xx ), yy ), r2c3 = pos.z;
+
+	TransposeSIMD( r0c0, r0c1, r0c2, r0c3 );
+	StoreUnalignedSIMD( a[0], r0c0 );
+	StoreUnalignedSIMD( b[0], r0c1 );
+	StoreUnalignedSIMD( c[0], r0c2 );
+	StoreUnalignedSIMD( d[0], r0c3 );
+
+	TransposeSIMD( r1c0, r1c1, r1c2, r1c3 );
+	StoreUnalignedSIMD( a[1], r1c0 );
+	StoreUnalignedSIMD( b[1], r1c1 );
+	StoreUnalignedSIMD( c[1], r1c2 );
+	StoreUnalignedSIMD( d[1], r1c3 );
+
+	TransposeSIMD( r2c0, r2c1, r2c2, r2c3 );
+	StoreUnalignedSIMD( a[2], r2c0 );
+	StoreUnalignedSIMD( b[2], r2c1 );
+	StoreUnalignedSIMD( c[2], r2c2 );
+	StoreUnalignedSIMD( d[2], r2c3 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects the animated rotations of one CalcAnimation pass so the
+//			euler to quaternion conversion and sub-frame blend run four bones
+//			at a time. The run length decode of the anim value streams has a
+//			data dependent walk per channel and stays scalar; its output is
+//			kept in SoA form so the math after it needs no transpose.
+//-----------------------------------------------------------------------------
+class CBoneRotationBatch
+{
+public:
+	CBoneRotationBatch( int frame, float s, const mstudiolinearbone_t *pLinearBones, const studiodecodedanim_t *pDecoded ) :
+		m_nCount( 0 ), m_iFrame( frame ), m_flS( s ), m_pLinearBones( pLinearBones ), m_pDecoded( pDecoded ) {}
+
+	// Returns false if the rotation isn't animated and should go through CalcBoneQuaternion
+	bool Add( const mstudiobone_t *pBone, const mstudioanim_t *panim, int iBone, const studiodecodedtrack_t *pTracks );
+	void Flush( const CStudioHdr *pStudioHdr, Quaternion *q );
+
+private:
+	int							m_nCount;
+	int							m_iFrame;
+	float						m_flS;
+	const mstudiolinearbone_t	*m_pLinearBones;
+	const studiodecodedanim_t	*m_pDecoded;
+
+	const mstudiobone_t			*m_pBone[MAXSTUDIOBONES];
+	const mstudioanim_t			*m_pAnim[MAXSTUDIOBONES];
+	short						m_iBone[MAXSTUDIOBONES];
+
+	// euler angles at this frame and the next, padded to a multiple of four
+	ALIGN16 float				m_flAngle1[3][MAXSTUDIOBONES] ALIGN16_POST;
+	ALIGN16 float				m_flAngle2[3][MAXSTUDIOBONES] ALIGN16_POST;
+};
+
+bool CBoneRotationBatch::Add( const mstudiobone_t *pBone, const mstudioanim_t *panim, int iBone, const studiodecodedtrack_t *pTracks )
+{
+	if ( ( panim->flags & ( STUDIO_ANIM_RAWROT | STUDIO_ANIM_RAWROT2 ) ) || !( panim->flags & STUDIO_ANIM_ANIMROT ) )
+		return false;
+
+	RadianEuler baseRot;
+	Vector baseRotScale;
+	if ( m_pLinearBones )
+	{
+		baseRot = m_pLinearBones->rot( panim->bone );
+		baseRotScale = m_pLinearBones->rotscale( panim->bone );
 	}
 	else
 	{
-		CalcBonePosition( frame, s, pBone->pos, pBone->posscale, panim, pos );
+		baseRot = pBone->rot;
+		baseRotScale = pBone->rotscale;
+	}
+
+	int n = m_nCount++;
+	mstudioanim_valueptr_t *pValuesPtr = panim->pRotV();
+	for ( int j = 0; j < 3; j++ )
+	{
+		if ( m_flS > 0.001f )
+		{
+			ExtractAnimValue( m_iFrame, m_pDecoded, pTracks ? &pTracks[j] : NULL, pValuesPtr->pAnimvalue( j ), baseRotScale[j], m_flAngle1[j][n], m_flAngle2[j][n] );
+		}
+		else
+		{
+			ExtractAnimValue( m_iFrame, m_pDecoded, pTracks ? &pTracks[j] : NULL, pValuesPtr->pAnimvalue( j ), baseRotScale[j], m_flAngle1[j][n] );
+			m_flAngle2[j][n] = m_flAngle1[j][n];
+		}
+
+		if ( !( panim->flags & STUDIO_ANIM_DELTA ) )
+		{
+			m_flAngle1[j][n] += baseRot[j];
+			m_flAngle2[j][n] += baseRot[j];
+		}
+	}
+
+	m_pBone[n] = pBone;
+	m_pAnim[n] = panim;
+	m_iBone[n] = iBone;
+	return true;
+}
+
+void CBoneRotationBatch::Flush( const CStudioHdr *pStudioHdr, Quaternion *q )
+{
+	if ( !m_nCount )
+		return;
+
+	// pad the last group
+	for ( int n = m_nCount; n & 3; n++ )
+	{
+		for ( int j = 0; j < 3; j++ )
+		{
+			m_flAngle1[j][n] = m_flAngle2[j][n] = 0.0f;
+		}
+	}
+
+	fltx4 s = ReplicateX4( m_flS );
+	fltx4 allOnes = LoadAlignedSIMD( g_SIMD_AllOnesMask );
+	Quaternion tmp[4];
+	for ( int i = 0; i < m_nCount; i += 4 )
+	{
+		fltx4 x1 = LoadAlignedSIMD( &m_flAngle1[0][i] ), y1 = LoadAlignedSIMD( &m_flAngle1[1][i] ), z1 = LoadAlignedSIMD( &m_flAngle1[2][i] );
+		fltx4 x2 = LoadAlignedSIMD( &m_flAngle2[0][i] ), y2 = LoadAlignedSIMD( &m_flAngle2[1][i] ), z2 = LoadAlignedSIMD( &m_flAngle2[2][i] );
+
+		FourQuaternions q1, q2, result;
+		AngleQuaternionSoA( x1, y1, z1, q1 );
+		AngleQuaternionSoA( x2, y2, z2, q2 );
+
+		// QuaternionBlend where the two frames differ
+		QuaternionAlignSoA( q1, q2, allOnes );
+		QuaternionBlendNoAlignSoA( q1, q2, s, result );
+		fltx4 same = AndSIMD( AndSIMD( CmpEqSIMD( x1, x2 ), CmpEqSIMD( y1, y2 ) ), CmpEqSIMD( z1, z2 ) );
+		result.x = MaskedAssign( same, q1.x, result.x );
+		result.y = MaskedAssign( same, q1.y, result.y );
+		result.z = MaskedAssign( same, q1.z, result.z );
+		result.w = MaskedAssign( same, q1.w, result.w );
+
+		result.SwizzleAndStore( tmp[0], tmp[1], tmp[2], tmp[3], 0xf );
+		int nLanes = MIN( m_nCount - i, 4 );
+		for ( int k = 0; k < nLanes; k++ )
+		{
+			q[ m_iBone[i + k] ] = tmp[k];
+		}
+	}
+
+	// align to unified bone
+	for ( int n = 0; n < m_nCount; n++ )
+	{
+		const mstudioanim_t *panim = m_pAnim[n];
+		if ( panim->flags & STUDIO_ANIM_DELTA )
+			continue;
+
+		int iBaseFlags = m_pLinearBones ? m_pLinearBones->flags( panim->bone ) : m_pBone[n]->flags;
+		if ( iBaseFlags & BONE_FIXED_ALIGNMENT )
+		{
+			Quaternion &qBone = q[ m_iBone[n] ];
+			QuaternionAlign( m_pLinearBones ? m_pLinearBones->qalignment( panim->bone ) : m_pBone[n]->qAlignment, qBone, qBone );
+		}
+	}
+
+	if ( ValidateSIMDBones() )
+	{
+		float flTolerance = anim_simd_tolerance.GetFloat();
+		for ( int n = 0; n < m_nCount; n++ )
+		{
+			Quaternion qScalar;
+			CalcBoneQuaternion( m_iFrame, m_flS, m_pBone[n], m_pLinearBones, m_pAnim[n], qScalar );
+			float flError = BoneQuaternionError( q[ m_iBone[n] ], qScalar );
+			if ( flError > flTolerance )
+			{
+				ReportSIMDBoneMismatch( "CalcAnimation", pStudioHdr, m_iBone[n], flError );
+			}
+		}
+	}
+
+	m_nCount = 0;
+}
+
+
+enum BoneBlendOp_t
+{
+	BONEBLEND_SLERP,		// QuaternionSlerp, as SlerpBones
+	BONEBLEND_BLEND,		// QuaternionBlend, as BlendBones
+	BONEBLEND_DELTA_SM,		// QuaternionSM, STUDIO_DELTA sequences
+	BONEBLEND_DELTA_MA,		// QuaternionMA, STUDIO_DELTA | STUDIO_POST sequences
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: SIMD version of the per-bone loops of SlerpBones and BlendBones.
+//			pS2 holds the weight of q2/pos2 for each bone, bones with a weight
+//			<= 0 are left untouched. Returns the first bone not handled; the
+//			caller finishes the rest with the scalar loop.
+//-----------------------------------------------------------------------------
+static int BlendBonesSIMD( const CStudioHdr *pStudioHdr, BoneBlendOp_t op,
+	Quaternion *q1, Vector *pos1, const Quaternion *q2, const Vector *pos2, const float *pS2, int nBoneCount )
+{
+	// FourVectors reads a full fltx4 from each Vector, so the last bone is
+	// always left to the scalar loop to stay inside the arrays
+	int i;
+	for ( i = 0; i + 4 < nBoneCount; i += 4 )
+	{
+		fltx4 s2 = LoadUnalignedSIMD( pS2 + i );
+		int nLanes = TestSignSIMD( CmpGtSIMD( s2, Four_Zeros ) );
+		if ( !nLanes )
+			continue;
+
+		fltx4 s1 = SubSIMD( Four_Ones, s2 );
+
+		FourQuaternions qa, qb, qt;
+		qa.LoadAndSwizzle( q1[i], q1[i+1], q1[i+2], q1[i+3] );
+		qb.LoadAndSwizzle( q2[i], q2[i+1], q2[i+2], q2[i+3] );
+
+		FourVectors pa, pb;
+		pa.LoadAndSwizzle( pos1[i], pos1[i+1], pos1[i+2], pos1[i+3] );
+		pb.LoadAndSwizzle( pos2[i], pos2[i+1], pos2[i+2], pos2[i+3] );
+
+		switch ( op )
+		{
+		case BONEBLEND_SLERP:
+		case BONEBLEND_BLEND:
+			{
+				ALIGN16 float flAlign[4] ALIGN16_POST;
+				for ( int k = 0; k < 4; k++ )
+				{
+					flAlign[k] = ( pStudioHdr->boneFlags( i + k ) & BONE_FIXED_ALIGNMENT ) ? 0.0f : 1.0f;
+				}
+				QuaternionAlignSoA( qb, qa, CmpGtSIMD( LoadAlignedSIMD( flAlign ), Four_Zeros ) );
+
+				if ( op == BONEBLEND_SLERP )
+				{
+					QuaternionSlerpNoAlignSoA( qb, qa, s1, qt );
+				}
+				else
+				{
+					QuaternionBlendNoAlignSoA( qb, qa, s1, qt );
+				}
+
+				pa.x = AddSIMD( MulSIMD( pa.x, s1 ), MulSIMD( pb.x, s2 ) );
+				pa.y = AddSIMD( MulSIMD( pa.y, s1 ), MulSIMD( pb.y, s2 ) );
+				pa.z = AddSIMD( MulSIMD( pa.z, s1 ), MulSIMD( pb.z, s2 ) );
+			}
+			break;
+
+		case BONEBLEND_DELTA_SM:
+		case BONEBLEND_DELTA_MA:
+			{
+				FourQuaternions scaled;
+				QuaternionScaleSoA( qb, s2, scaled );
+				if ( op == BONEBLEND_DELTA_SM )
+				{
+					QuaternionMultSoA( scaled, qa, qt );
+				}
+				else
+				{
+					QuaternionMultSoA( qa, scaled, qt );
+				}
+				QuaternionNormalizeSoA( qt );
+
+				pa.x = AddSIMD( pa.x, MulSIMD( pb.x, s2 ) );
+				pa.y = AddSIMD( pa.y, MulSIMD( pb.y, s2 ) );
+				pa.z = AddSIMD( pa.z, MulSIMD( pb.z, s2 ) );
+			}
+			break;
+		}
+
+		qt.SwizzleAndStore( q1[i], q1[i+1], q1[i+2], q1[i+3], nLanes );
+		StoreFourVectors( pa, pos1[i], pos1[i+1], pos1[i+2], pos1[i+3], nLanes );
+	}
+	return i;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Bone local matrices for every bone in the mask, four at a time
+//-----------------------------------------------------------------------------
+static void BuildLocalMatricesSIMD( const CStudioHdr *pStudioHdr, const Vector pos[], const Quaternion q[], int boneMask, matrix3x4_t *pLocal )
+{
+	int nBoneCount = pStudioHdr->numbones();
+
+	// as in BlendBonesSIMD, the last bone goes through the scalar path
+	int i;
+	for ( i = 0; i + 4 < nBoneCount; i += 4 )
+	{
+		FourQuaternions q4;
+		q4.LoadAndSwizzle( q[i], q[i+1], q[i+2], q[i+3] );
+		FourVectors pos4;
+		pos4.LoadAndSwizzle( pos[i], pos[i+1], pos[i+2], pos[i+3] );
+		QuaternionMatrixSoA( q4, pos4, pLocal[i], pLocal[i+1], pLocal[i+2], pLocal[i+3] );
+	}
+	for ( ; i < nBoneCount; i++ )
+	{
+		if ( pStudioHdr->boneFlags( i ) & boneMask )
+		{
+			QuaternionMatrix( q[i], pos[i], pLocal[i] );
+		}
+	}
+
+	if ( ValidateSIMDBones() )
+	{
+		float flTolerance = anim_simd_tolerance.GetFloat();
+		for ( i = 0; i < nBoneCount; i++ )
+		{
+			if ( !( pStudioHdr->boneFlags( i ) & boneMask ) )
+				continue;
+
+			matrix3x4_t scalar;
+			QuaternionMatrix( q[i], pos[i], scalar );
+			float flError = 0.0f;
+			for ( int r = 0; r < 3; r++ )
+			{
+				for ( int c = 0; c < 4; c++ )
+				{
+					flError = MAX( flError, fabs( scalar[r][c] - pLocal[i][r][c] ) );
+				}
+			}
+			if ( flError > flTolerance )
+			{
+				ReportSIMDBoneMismatch( "QuaternionMatrix", pStudioHdr, i, flError );
+			}
+		}
 	}
 }
 
@@ -930,7 +1672,8 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 
 	int iLocalFrame = iFrame;
 	float flStall;
-	panim = animdesc.pAnim( &iLocalFrame, flStall );
+	int iSection;
+	panim = animdesc.pAnim( &iLocalFrame, flStall, &iSection );
 
 	float *pweight = seqdesc.pBoneweight( 0 );
 	pbone = pStudioHdr->pBone( 0 );
@@ -971,6 +1714,12 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 		return;
 	}
 
+	const studiodecodedanim_t *pDecoded = GetDecodedAnimation( pStudioHdr, animdesc, iSection, panim );
+	int iDecodedBone = 0;
+
+	CBoneRotationBatch rotBatch( iLocalFrame, s, pAnimLinearBones, pDecoded );
+	CBoneRotationBatch *pRotBatch = UseSIMDBones() ? &rotBatch : NULL;
+
 	// FIXME: change encoding so that bone -1 is never the case
 	while (panim && panim->bone < 255)
 	{
@@ -981,14 +1730,25 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 
 			if (k >= 0 && pweight[k] > 0.0f)
 			{
-				CalcBoneQuaternion( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, q[j] );
-				CalcBonePosition  ( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, pos[j] );
+				// bones past the table walk the compressed tracks
+				const studiodecodedtrack_t *pTracks = ( pDecoded && iDecodedBone < pDecoded->numbones ) ? pDecoded->pTrack( iDecodedBone, 0 ) : NULL;
+				if ( !pRotBatch || !pRotBatch->Add( &pAnimbone[panim->bone], panim, j, pTracks ) )
+				{
+					CalcBoneQuaternion( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, q[j], pDecoded, pTracks );
+				}
+				CalcBonePosition  ( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, pos[j], pDecoded, pTracks );
 #ifdef STUDIO_ENABLE_PERF_COUNTERS
 				pStudioHdr->m_nPerfAnimatedBones++;
 #endif
 			}
 		}
 		panim = panim->pNext();
+		iDecodedBone++;
+	}
+
+	if ( pRotBatch )
+	{
+		pRotBatch->Flush( pStudioHdr, q );
 	}
 
 	// cross fade in previous zeroframe data
@@ -1071,7 +1831,8 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 
 	int iLocalFrame = iFrame;
 	float flStall;
-	mstudioanim_t *panim = animdesc.pAnim( &iLocalFrame, flStall );
+	int iSection;
+	mstudioanim_t *panim = animdesc.pAnim( &iLocalFrame, flStall, &iSection );
 
 	float *pweight = seqdesc.pBoneweight( 0 );
 
@@ -1102,6 +1863,12 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		return;
 	}
 
+	const studiodecodedanim_t *pDecoded = GetDecodedAnimation( pStudioHdr, animdesc, iSection, panim );
+	int iDecodedBone = 0;
+
+	CBoneRotationBatch rotBatch( iLocalFrame, s, pLinearBones, pDecoded );
+	CBoneRotationBatch *pRotBatch = UseSIMDBones() ? &rotBatch : NULL;
+
 	// BUGBUG: the sequence, the anim, and the model can have all different bone mappings.
 	for (int i = 0; i < pStudioHdr->numbones(); i++, pbone++, pweight++)
 	{
@@ -1109,14 +1876,20 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		{
 			if (*pweight > 0 && (pStudioHdr->boneFlags(i) & boneMask))
 			{
-				CalcBoneQuaternion( iLocalFrame, s, pbone, pLinearBones, panim, q[i] );
-				CalcBonePosition  ( iLocalFrame, s, pbone, pLinearBones, panim, pos[i] );
+				// bones past the table walk the compressed tracks
+				const studiodecodedtrack_t *pTracks = ( pDecoded && iDecodedBone < pDecoded->numbones ) ? pDecoded->pTrack( iDecodedBone, 0 ) : NULL;
+				if ( !pRotBatch || !pRotBatch->Add( pbone, panim, i, pTracks ) )
+				{
+					CalcBoneQuaternion( iLocalFrame, s, pbone, pLinearBones, panim, q[i], pDecoded, pTracks );
+				}
+				CalcBonePosition  ( iLocalFrame, s, pbone, pLinearBones, panim, pos[i], pDecoded, pTracks );
 #ifdef STUDIO_ENABLE_PERF_COUNTERS
 				pStudioHdr->m_nPerfAnimatedBones++;
 				pStudioHdr->m_nPerfUsedBones++;
 #endif
 			}
 			panim = panim->pNext();
+			iDecodedBone++;
 		}
 		else if (*pweight > 0 && (pStudioHdr->boneFlags(i) & boneMask))
 		{
@@ -1136,6 +1909,11 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		}
 	}
 
+	if ( pRotBatch )
+	{
+		pRotBatch->Flush( pStudioHdr, q );
+	}
+
 	// cross fade in previous zeroframe data
 	if (flStall > 0.0f)
 	{
@@ -1335,45 +2113,152 @@ void WorldSpaceSlerp(
 			pos1[i] = pos2[i];
 			q1[i] = q2[i];
 		}
-		else if (s2 > 0.0)
+		else if (s2 > 0.0)
+		{
+			Quaternion srcQ, destQ;
+			Vector srcPos, destPos;
+			Quaternion targetQ;
+			Vector targetPos;
+			Vector tmp;
+
+			BuildBoneChain( pStudioHdr, rootXform, pos1, q1, i, destBoneToWorld, destBoneComputed );
+			BuildBoneChain( pStudioHdr, rootXform, pos2, q2, i, srcBoneToWorld, srcBoneComputed );
+
+			MatrixAngles( destBoneToWorld[i], destQ, destPos );
+			MatrixAngles( srcBoneToWorld[i], srcQ, srcPos );
+
+			QuaternionSlerp( destQ, srcQ, s2, targetQ );
+			AngleMatrix( targetQ, destPos, targetBoneToWorld[i] );
+
+			// back solve
+			if (n == -1)
+			{
+				MatrixAngles( targetBoneToWorld[i], q1[i], tmp );
+			}
+			else
+			{
+				matrix3x4_t worldToBone;
+				MatrixInvert( targetBoneToWorld[n], worldToBone );
+
+				matrix3x4_t local;
+				ConcatTransforms( worldToBone, targetBoneToWorld[i], local );
+				MatrixAngles( local, q1[i], tmp );
+
+				// blend bone lengths (local space)
+				pos1[i] = Lerp( s2, pos1[i], pos2[i] );
+			}
+		}
+	}
+	g_MatrixPool.Free( srcBoneToWorld );
+	g_MatrixPool.Free( destBoneToWorld );
+	g_MatrixPool.Free( targetBoneToWorld );
+}
+
+
+
+//-----------------------------------------------------------------------------
+// Purpose: scalar per-bone loop of SlerpBones, from bone iFirst on
+//-----------------------------------------------------------------------------
+static void SlerpBonesScalar( 
+	const CStudioHdr *pStudioHdr,
+	int flags,
+	Quaternion q1[MAXSTUDIOBONES], 
+	Vector pos1[MAXSTUDIOBONES], 
+	const QuaternionAligned q2[MAXSTUDIOBONES], 
+	const Vector pos2[MAXSTUDIOBONES], 
+	const float *pS2,
+	int iFirst,
+	int nBoneCount )
+{
+	int i;
+	float s1, s2;
+	if ( flags & STUDIO_DELTA )
+	{
+		for ( i = iFirst; i < nBoneCount; i++ )
+		{
+			s2 = pS2[i];
+			if ( s2 <= 0.0f )
+				continue;
+
+			if ( flags & STUDIO_POST )
+			{
+#ifndef _X360
+				QuaternionMA( q1[i], s2, q2[i], q1[i] );
+#else
+				fltx4 q1simd = LoadUnalignedSIMD( q1[i].Base() );
+				fltx4 q2simd = LoadAlignedSIMD( q2[i] );
+				fltx4 result = QuaternionMASIMD( q1simd, s2, q2simd );
+				StoreUnalignedSIMD( q1[i].Base(), result );
+#endif
+				// FIXME: are these correct?
+				pos1[i][0] = pos1[i][0] + pos2[i][0] * s2;
+				pos1[i][1] = pos1[i][1] + pos2[i][1] * s2;
+				pos1[i][2] = pos1[i][2] + pos2[i][2] * s2;
+			}
+			else
+			{
+#ifndef _X360
+				QuaternionSM( s2, q2[i], q1[i], q1[i] );
+#else
+				fltx4 q1simd = LoadUnalignedSIMD( q1[i].Base() );
+				fltx4 q2simd = LoadAlignedSIMD( q2[i] );
+				fltx4 result = QuaternionSMSIMD( s2, q2simd, q1simd );
+				StoreUnalignedSIMD( q1[i].Base(), result );
+#endif
+
+				// FIXME: are these correct?
+				pos1[i][0] = pos1[i][0] + pos2[i][0] * s2;
+				pos1[i][1] = pos1[i][1] + pos2[i][1] * s2;
+				pos1[i][2] = pos1[i][2] + pos2[i][2] * s2;
+			}
+		}
+		return;
+	}
+
+	QuaternionAligned q3;
+	for (i = iFirst; i < nBoneCount; i++)
+	{
+		s2 = pS2[i];
+		if ( s2 <= 0.0f )
+			continue;
+
+		s1 = 1.0 - s2;
+
+#ifdef _X360
+		fltx4  q1simd, q2simd, result;
+		q1simd = LoadUnalignedSIMD( q1[i].Base() );
+		q2simd = LoadAlignedSIMD( q2[i] );
+#endif
+		if ( pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT )
+		{
+#ifndef _X360
+			QuaternionSlerpNoAlign( q2[i], q1[i], s1, q3 );
+#else
+			result = QuaternionSlerpNoAlignSIMD( q2simd, q1simd, s1 );
+#endif
+		}
+		else
 		{
-			Quaternion srcQ, destQ;
-			Vector srcPos, destPos;
-			Quaternion targetQ;
-			Vector targetPos;
-			Vector tmp;
-
-			BuildBoneChain( pStudioHdr, rootXform, pos1, q1, i, destBoneToWorld, destBoneComputed );
-			BuildBoneChain( pStudioHdr, rootXform, pos2, q2, i, srcBoneToWorld, srcBoneComputed );
-
-			MatrixAngles( destBoneToWorld[i], destQ, destPos );
-			MatrixAngles( srcBoneToWorld[i], srcQ, srcPos );
-
-			QuaternionSlerp( destQ, srcQ, s2, targetQ );
-			AngleMatrix( targetQ, destPos, targetBoneToWorld[i] );
-
-			// back solve
-			if (n == -1)
-			{
-				MatrixAngles( targetBoneToWorld[i], q1[i], tmp );
-			}
-			else
-			{
-				matrix3x4_t worldToBone;
-				MatrixInvert( targetBoneToWorld[n], worldToBone );
+#ifndef _X360
+			QuaternionSlerp( q2[i], q1[i], s1, q3 );
+#else
+			result = QuaternionSlerpSIMD( q2simd, q1simd, s1 );
+#endif
+		}
 
-				matrix3x4_t local;
-				ConcatTransforms( worldToBone, targetBoneToWorld[i], local );
-				MatrixAngles( local, q1[i], tmp );
+#ifndef _X360
+		q1[i][0] = q3[0];
+		q1[i][1] = q3[1];
+		q1[i][2] = q3[2];
+		q1[i][3] = q3[3];
+#else
+		StoreUnalignedSIMD( q1[i].Base(), result );
+#endif
 
-				// blend bone lengths (local space)
-				pos1[i] = Lerp( s2, pos1[i], pos2[i] );
-			}
-		}
+		pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
+		pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
+		pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
 	}
-	g_MatrixPool.Free( srcBoneToWorld );
-	g_MatrixPool.Free( destBoneToWorld );
-	g_MatrixPool.Free( targetBoneToWorld );
 }
 
 
@@ -1443,90 +2328,73 @@ void SlerpBones(
 		}
 	}
 
-	float s1, s2;
-	if ( seqdesc.flags & STUDIO_DELTA )
+	bool bSIMD = UseSIMDBones();
+	Quaternion *qValidate = NULL;
+	Vector *posValidate = NULL;
+	if ( bSIMD && ValidateSIMDBones() )
 	{
-		for ( i = 0; i < nBoneCount; i++ )
-		{
-			s2 = pS2[i];
-			if ( s2 <= 0.0f )
-				continue;
-
-			if ( seqdesc.flags & STUDIO_POST )
-			{
-#ifndef _X360
-				QuaternionMA( q1[i], s2, q2[i], q1[i] );
-#else
-				fltx4 q1simd = LoadUnalignedSIMD( q1[i].Base() );
-				fltx4 q2simd = LoadAlignedSIMD( q2[i] );
-				fltx4 result = QuaternionMASIMD( q1simd, s2, q2simd );
-				StoreUnalignedSIMD( q1[i].Base(), result );
-#endif
-				// FIXME: are these correct?
-				pos1[i][0] = pos1[i][0] + pos2[i][0] * s2;
-				pos1[i][1] = pos1[i][1] + pos2[i][1] * s2;
-				pos1[i][2] = pos1[i][2] + pos2[i][2] * s2;
-			}
-			else
-			{
-#ifndef _X360
-				QuaternionSM( s2, q2[i], q1[i], q1[i] );
-#else
-				fltx4 q1simd = LoadUnalignedSIMD( q1[i].Base() );
-				fltx4 q2simd = LoadAlignedSIMD( q2[i] );
-				fltx4 result = QuaternionSMSIMD( s2, q2simd, q1simd );
-				StoreUnalignedSIMD( q1[i].Base(), result );
-#endif
+		qValidate = g_QaternionPool.Alloc();
+		posValidate = g_VectorPool.Alloc();
+		memcpy( qValidate, q1, nBoneCount * sizeof(Quaternion) );
+		memcpy( posValidate, pos1, nBoneCount * sizeof(Vector) );
+	}
 
-				// FIXME: are these correct?
-				pos1[i][0] = pos1[i][0] + pos2[i][0] * s2;
-				pos1[i][1] = pos1[i][1] + pos2[i][1] * s2;
-				pos1[i][2] = pos1[i][2] + pos2[i][2] * s2;
-			}
+	int iFirst = 0;
+	if ( bSIMD )
+	{
+		BoneBlendOp_t op = BONEBLEND_SLERP;
+		if ( seqdesc.flags & STUDIO_DELTA )
+		{
+			op = ( seqdesc.flags & STUDIO_POST ) ? BONEBLEND_DELTA_MA : BONEBLEND_DELTA_SM;
 		}
-		return;
+		iFirst = BlendBonesSIMD( pStudioHdr, op, q1, pos1, q2, pos2, pS2, nBoneCount );
 	}
+	SlerpBonesScalar( pStudioHdr, seqdesc.flags, q1, pos1, q2, pos2, pS2, iFirst, nBoneCount );
 
-	QuaternionAligned q3;
-	for (i = 0; i < nBoneCount; i++)
+	if ( qValidate )
 	{
-		s2 = pS2[i];
+		SlerpBonesScalar( pStudioHdr, seqdesc.flags, qValidate, posValidate, q2, pos2, pS2, 0, nBoneCount );
+		CompareSIMDBones( "SlerpBones", pStudioHdr, q1, pos1, qValidate, posValidate, pS2 );
+		g_QaternionPool.Free( qValidate );
+		g_VectorPool.Free( posValidate );
+	}
+}
+
+
+
+//-----------------------------------------------------------------------------
+// Purpose: scalar per-bone loop of BlendBones, from bone iFirst on
+//-----------------------------------------------------------------------------
+static void BlendBonesScalar( 
+	const CStudioHdr *pStudioHdr,
+	Quaternion q1[MAXSTUDIOBONES], 
+	Vector pos1[MAXSTUDIOBONES], 
+	const Quaternion q2[MAXSTUDIOBONES], 
+	const Vector pos2[MAXSTUDIOBONES], 
+	const float *pS2,
+	int iFirst,
+	int nBoneCount )
+{
+	Quaternion q3;
+	for (int i = iFirst; i < nBoneCount; i++)
+	{
+		float s2 = pS2[i];
 		if ( s2 <= 0.0f )
 			continue;
 
-		s1 = 1.0 - s2;
-
-#ifdef _X360
-		fltx4  q1simd, q2simd, result;
-		q1simd = LoadUnalignedSIMD( q1[i].Base() );
-		q2simd = LoadAlignedSIMD( q2[i] );
-#endif
-		if ( pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT )
+		float s1 = 1.0 - s2;
+		if (pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT)
 		{
-#ifndef _X360
-			QuaternionSlerpNoAlign( q2[i], q1[i], s1, q3 );
-#else
-			result = QuaternionSlerpNoAlignSIMD( q2simd, q1simd, s1 );
-#endif
+			QuaternionBlendNoAlign( q2[i], q1[i], s1, q3 );
 		}
 		else
 		{
-#ifndef _X360
-			QuaternionSlerp( q2[i], q1[i], s1, q3 );
-#else
-			result = QuaternionSlerpSIMD( q2simd, q1simd, s1 );
-#endif
+			QuaternionBlend( q2[i], q1[i], s1, q3 );
 		}
-
-#ifndef _X360
 		q1[i][0] = q3[0];
 		q1[i][1] = q3[1];
 		q1[i][2] = q3[2];
 		q1[i][3] = q3[3];
-#else
-		StoreUnalignedSIMD( q1[i].Base(), result );
-#endif
-
 		pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
 		pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
 		pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
@@ -1552,7 +2420,6 @@ void BlendBones(
 	int boneMask )
 {
 	int			i, j;
-	Quaternion		q3;
 
 	virtualmodel_t *pVModel = pStudioHdr->GetVirtualModel();
 	const virtualgroup_t *pSeqGroup = NULL;
@@ -1596,13 +2463,16 @@ void BlendBones(
 	}
 
 	float s2 = s;
-	float s1 = 1.0 - s2;
 
-	for (i = 0; i < pStudioHdr->numbones(); i++)
+	// Build weightlist for all bones
+	int nBoneCount = pStudioHdr->numbones();
+	float *pS2 = (float*)stackalloc( nBoneCount * sizeof(float) );
+	for (i = 0; i < nBoneCount; i++)
 	{
 		// skip unused bones
 		if (!(pStudioHdr->boneFlags(i) & boneMask))
 		{
+			pS2[i] = 0.0f;
 			continue;
 		}
 
@@ -1615,24 +2485,35 @@ void BlendBones(
 			j = i;
 		}
 
-		if (j >= 0 && seqdesc.weight( j ) > 0.0)
+		pS2[i] = (j >= 0 && seqdesc.weight( j ) > 0.0) ? s2 : 0.0f;
+	}
+
+	Quaternion *qValidate = NULL;
+	Vector *posValidate = NULL;
+	if ( UseSIMDBones() )
+	{
+		if ( ValidateSIMDBones() )
 		{
-			if (pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT)
-			{
-				QuaternionBlendNoAlign( q2[i], q1[i], s1, q3 );
-			}
-			else
-			{
-				QuaternionBlend( q2[i], q1[i], s1, q3 );
-			}
-			q1[i][0] = q3[0];
-			q1[i][1] = q3[1];
-			q1[i][2] = q3[2];
-			q1[i][3] = q3[3];
-			pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
-			pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
-			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
+			qValidate = g_QaternionPool.Alloc();
+			posValidate = g_VectorPool.Alloc();
+			memcpy( qValidate, q1, nBoneCount * sizeof(Quaternion) );
+			memcpy( posValidate, pos1, nBoneCount * sizeof(Vector) );
 		}
+
+		int iFirst = BlendBonesSIMD( pStudioHdr, BONEBLEND_BLEND, q1, pos1, q2, pos2, pS2, nBoneCount );
+		BlendBonesScalar( pStudioHdr, q1, pos1, q2, pos2, pS2, iFirst, nBoneCount );
+	}
+	else
+	{
+		BlendBonesScalar( pStudioHdr, q1, pos1, q2, pos2, pS2, 0, nBoneCount );
+	}
+
+	if ( qValidate )
+	{
+		BlendBonesScalar( pStudioHdr, qValidate, posValidate, q2, pos2, pS2, 0, nBoneCount );
+		CompareSIMDBones( "BlendBones", pStudioHdr, q1, pos1, qValidate, posValidate, pS2 );
+		g_QaternionPool.Free( qValidate );
+		g_VectorPool.Free( posValidate );
 	}
 }
 
@@ -4573,23 +5454,241 @@ void Studio_BuildMatrices(
 		VectorScale( rotationmatrix[2], flScale, rotationmatrix[2] );
 	}
 
+	// When building every bone, make all the local matrices up front four at a time
+	matrix3x4_t *pLocal = NULL;
+	if ( iBone == -1 && UseSIMDBones() )
+	{
+		pLocal = g_MatrixPool.Alloc();
+		BuildLocalMatricesSIMD( pStudioHdr, pos, q, boneMask, pLocal );
+	}
+
 	for (j = chainlength - 1; j >= 0; j--)
 	{
 		i = chain[j];
 		if (pStudioHdr->boneFlags(i) & boneMask)
 		{
-			QuaternionMatrix( q[i], pos[i], bonematrix );
+			const matrix3x4_t *pBoneMatrix = &bonematrix;
+			if ( pLocal )
+			{
+				pBoneMatrix = &pLocal[i];
+			}
+			else
+			{
+				QuaternionMatrix( q[i], pos[i], bonematrix );
+			}
 
 			if (pStudioHdr->boneParent(i) == -1) 
 			{
-				ConcatTransforms (rotationmatrix, bonematrix, bonetoworld[i]);
+				ConcatTransforms (rotationmatrix, *pBoneMatrix, bonetoworld[i]);
 			} 
 			else 
 			{
-				ConcatTransforms (bonetoworld[pStudioHdr->boneParent(i)], bonematrix, bonetoworld[i]);
+				ConcatTransforms (bonetoworld[pStudioHdr->boneParent(i)], *pBoneMatrix, bonetoworld[i]);
+			}
+		}
+	}
+
+	if ( pLocal )
+	{
+		g_MatrixPool.Free( pLocal );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Times the scalar and SIMD bone paths on one model. Every sequence
+//			is posed at a spread of cycles and turned into bone-to-world
+//			matrices; the two paths are then compared pose by pose.
+//-----------------------------------------------------------------------------
+void Studio_BenchmarkBoneSetup( const CStudioHdr *pStudioHdr, int nIterations )
+{
+	int nSequences = pStudioHdr->GetNumSeq();
+	if ( !nSequences || nIterations <= 0 )
+	{
+		Msg( "%s: nothing to time\n", pStudioHdr->pszName() );
+		return;
+	}
+
+	float flPoseParameter[MAXSTUDIOPOSEPARAM];
+	Studio_CalcDefaultPoseParameters( pStudioHdr, flPoseParameter, MAXSTUDIOPOSEPARAM );
+
+	Vector *pos[2] = { g_VectorPool.Alloc(), g_VectorPool.Alloc() };
+	Quaternion *q[2] = { g_QaternionPool.Alloc(), g_QaternionPool.Alloc() };
+	matrix3x4_t *pBoneToWorld[2] = { g_MatrixPool.Alloc(), g_MatrixPool.Alloc() };
+
+	const int nCycles = 8;
+	double flTime[2];
+	for ( int nPath = 0; nPath < 2; nPath++ )
+	{
+		s_nForceSIMDBones = nPath;
+		CBoneSetup boneSetup( pStudioHdr, BONE_USED_BY_ANYTHING, flPoseParameter );
+
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < nIterations; i++ )
+		{
+			float flCycle = (float)( i % nCycles ) / nCycles;
+			for ( int iSeq = 0; iSeq < nSequences; iSeq++ )
+			{
+				boneSetup.InitPose( pos[nPath], q[nPath] );
+				boneSetup.AccumulatePose( pos[nPath], q[nPath], iSeq, flCycle, 1.0f, 0.0f, NULL );
+				Studio_BuildMatrices( pStudioHdr, vec3_angle, vec3_origin, pos[nPath], q[nPath], -1, 1.0f, pBoneToWorld[nPath], BONE_USED_BY_ANYTHING );
+			}
+		}
+		flTime[nPath] = Plat_FloatTime() - flStart;
+	}
+
+	// Largest difference between the two paths over every sequence, in model space
+	float flMaxError = 0.0f;
+	int iWorstSeq = 0;
+	for ( int iSeq = 0; iSeq < nSequences; iSeq++ )
+	{
+		for ( int nPath = 0; nPath < 2; nPath++ )
+		{
+			s_nForceSIMDBones = nPath;
+			CBoneSetup boneSetup( pStudioHdr, BONE_USED_BY_ANYTHING, flPoseParameter );
+			boneSetup.InitPose( pos[nPath], q[nPath] );
+			boneSetup.AccumulatePose( pos[nPath], q[nPath], iSeq, 0.37f, 1.0f, 0.0f, NULL );
+			Studio_BuildMatrices( pStudioHdr, vec3_angle, vec3_origin, pos[nPath], q[nPath], -1, 1.0f, pBoneToWorld[nPath], BONE_USED_BY_ANYTHING );
+		}
+
+		for ( int i = 0; i < pStudioHdr->numbones(); i++ )
+		{
+			if ( !( pStudioHdr->boneFlags( i ) & BONE_USED_BY_ANYTHING ) )
+				continue;
+
+			for ( int r = 0; r < 3; r++ )
+			{
+				for ( int c = 0; c < 4; c++ )
+				{
+					float flError = fabs( pBoneToWorld[0][i][r][c] - pBoneToWorld[1][i][r][c] );
+					if ( flError > flMaxError )
+					{
+						flMaxError = flError;
+						iWorstSeq = iSeq;
+					}
+				}
+			}
+		}
+	}
+	s_nForceSIMDBones = -1;
+
+	int nSetups = nIterations * nSequences;
+	Msg( "%s: %d bones, %d sequences, %d setups per path\n", pStudioHdr->pszName(), pStudioHdr->numbones(), nSequences, nSetups );
+	Msg( "  scalar %.2f us/setup, simd %.2f us/setup (%.2fx)\n", 
+		flTime[0] * 1e6 / nSetups, flTime[1] * 1e6 / nSetups, flTime[1] > 0 ? flTime[0] / flTime[1] : 0.0 );
+	Msg( "  max bone-to-world difference %f (sequence %s)\n", flMaxError, ((CStudioHdr *)pStudioHdr)->pSeqdesc( iWorstSeq ).pszLabel() );
+
+	for ( int nPath = 0; nPath < 2; nPath++ )
+	{
+		g_VectorPool.Free( pos[nPath] );
+		g_QaternionPool.Free( q[nPath] );
+		g_MatrixPool.Free( pBoneToWorld[nPath] );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Times decoding every sequence of a model by walking the compressed
+//			tracks against looking frames up in the decoded tables. The
+//			cycles step by the golden ratio so long sequences get sampled
+//			all along their length. Must run inside an mdlcache lock.
+//-----------------------------------------------------------------------------
+void Studio_BenchmarkAnimDecode( const CStudioHdr *pStudioHdr, int nIterations )
+{
+	int nSequences = pStudioHdr->GetNumSeq();
+	if ( !nSequences || nIterations <= 0 )
+	{
+		Msg( "%s: nothing to time\n", pStudioHdr->pszName() );
+		return;
+	}
+
+	if ( !pStudioHdr->GetMDLCache() )
+	{
+		Msg( "%s: not bound to the model cache, no decoded tables\n", pStudioHdr->pszName() );
+		return;
+	}
+
+	float flPoseParameter[MAXSTUDIOPOSEPARAM];
+	Studio_CalcDefaultPoseParameters( pStudioHdr, flPoseParameter, MAXSTUDIOPOSEPARAM );
+
+	Vector *pos[2] = { g_VectorPool.Alloc(), g_VectorPool.Alloc() };
+	Quaternion *q[2] = { g_QaternionPool.Alloc(), g_QaternionPool.Alloc() };
+
+	// Build the tables up front, this times lookups only
+	s_nForceDecodedAnims = 1;
+	double flStart = Plat_FloatTime();
+	{
+		CBoneSetup boneSetup( pStudioHdr, BONE_USED_BY_ANYTHING, flPoseParameter );
+		for ( int iSeq = 0; iSeq < nSequences; iSeq++ )
+		{
+			for ( int i = 0; i <= 64; i++ )
+			{
+				boneSetup.InitPose( pos[1], q[1] );
+				boneSetup.AccumulatePose( pos[1], q[1], iSeq, i / 64.0f, 1.0f, 0.0f, NULL );
+			}
+		}
+	}
+	double flWarmup = Plat_FloatTime() - flStart;
+
+	double flTime[2];
+	for ( int nPath = 0; nPath < 2; nPath++ )
+	{
+		s_nForceDecodedAnims = nPath;
+		CBoneSetup boneSetup( pStudioHdr, BONE_USED_BY_ANYTHING, flPoseParameter );
+
+		flStart = Plat_FloatTime();
+		for ( int i = 0; i < nIterations; i++ )
+		{
+			float flCycle = fmod( i * 0.618034f, 1.0f );
+			for ( int iSeq = 0; iSeq < nSequences; iSeq++ )
+			{
+				boneSetup.InitPose( pos[nPath], q[nPath] );
+				boneSetup.AccumulatePose( pos[nPath], q[nPath], iSeq, flCycle, 1.0f, 0.0f, NULL );
+			}
+		}
+		flTime[nPath] = Plat_FloatTime() - flStart;
+	}
+
+	// Both paths read the same quantized values, so the poses should match exactly
+	int nMismatches = 0;
+	for ( int iSeq = 0; iSeq < nSequences; iSeq++ )
+	{
+		for ( int i = 0; i < 16; i++ )
+		{
+			for ( int nPath = 0; nPath < 2; nPath++ )
+			{
+				s_nForceDecodedAnims = nPath;
+				CBoneSetup boneSetup( pStudioHdr, BONE_USED_BY_ANYTHING, flPoseParameter );
+				boneSetup.InitPose( pos[nPath], q[nPath] );
+				boneSetup.AccumulatePose( pos[nPath], q[nPath], iSeq, ( i + 0.37f ) / 16.0f, 1.0f, 0.0f, NULL );
+			}
+
+			for ( int iBone = 0; iBone < pStudioHdr->numbones(); iBone++ )
+			{
+				if ( ( pStudioHdr->boneFlags( iBone ) & BONE_USED_BY_ANYTHING ) &&
+					 ( BonePositionError( pos[0][iBone], pos[1][iBone] ) != 0.0f || BoneQuaternionError( q[0][iBone], q[1][iBone] ) != 0.0f ) )
+				{
+					nMismatches++;
+				}
 			}
 		}
 	}
+	s_nForceDecodedAnims = -1;
+
+	int nPoses = nIterations * nSequences;
+	Msg( "%s: %d bones, %d sequences, %d poses per path\n", pStudioHdr->pszName(), pStudioHdr->numbones(), nSequences, nPoses );
+	Msg( "  walk %.2f us/pose, decoded %.2f us/pose (%.2fx), first pass with table builds %.2f ms\n",
+		flTime[0] * 1e6 / nPoses, flTime[1] * 1e6 / nPoses, flTime[1] > 0 ? flTime[0] / flTime[1] : 0.0, flWarmup * 1000.0 );
+	if ( nMismatches )
+	{
+		Warning( "  %d bone poses differ between the paths\n", nMismatches );
+	}
+
+	for ( int nPath = 0; nPath < 2; nPath++ )
+	{
+		g_VectorPool.Free( pos[nPath] );
+		g_QaternionPool.Free( q[nPath] );
+	}
 }
 
 
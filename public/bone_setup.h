@@ -331,6 +331,12 @@ void Studio_BuildMatrices(
 	int boneMask
 	);
 
+// Times the scalar and SIMD bone setup paths on a model and prints the results
+void Studio_BenchmarkBoneSetup( const CStudioHdr *pStudioHdr, int nIterations );
+
+// Times walking the compressed animation tracks against the decoded tables from the model cache
+void Studio_BenchmarkAnimDecode( const CStudioHdr *pStudioHdr, int nIterations );
+
 
 // Get a bone->bone relative transform
 void Studio_CalcBoneToBoneTransform( const CStudioHdr *pStudioHdr, int inputBoneIndex, int outputBoneIndex, matrix3x4_t &matrixOut );
@@ -29,6 +29,9 @@ struct studiohwdata_t;
 struct vcollide_t;
 struct virtualmodel_t;
 struct vertexFileHeader_t;
+struct mstudioanimdesc_t;
+struct mstudioanim_t;
+struct studiodecodedanim_t;
 
 namespace OptimizedModel
 {
@@ -266,6 +269,12 @@ public:
 	virtual void ResetErrorModelStatus( MDLHandle_t handle ) = 0;
 
 	virtual void MarkFrame() = 0;
+
+	// Per-frame tables of section iSection of animdesc, panim and iSection as
+	// returned by mstudioanimdesc_t::pAnim(). Built on first use and kept in
+	// their own data cache section. Only valid between BeginLock and EndLock;
+	// NULL if the cache is off or the caller isn't locked.
+	virtual const studiodecodedanim_t *GetDecodedAnimation( const mstudioanimdesc_t &animdesc, int iSection, const mstudioanim_t *panim ) = 0;
 };
 
 
@@ -366,6 +366,33 @@ public:
 	void AddToRenderCache( CParticleCollection *pParticles );
 	void DrawRenderCache( bool bShadowDepth );
 
+	// Simulates collections on the job pool, each with its children after it. Children
+	// of one parent are simulated at the same time too unless one of them writes to the
+	// parent. With parallel simulation off everything runs in order on this thread.
+	void SimulateCollections( CParticleCollection **ppParticles, int nCount, float flDt, bool bUpdateBboxOnly = false );
+	void EnableParallelSimulation( bool bEnable );
+	bool IsParallelSimulationEnabled() const;
+
+	// The hottest operators have 8 wide AVX2 paths, used by default when the CPU has AVX2
+	void EnableWideSIMD( bool bEnable );
+	bool IsWideSIMDEnabled() const { return m_bWideSIMD; }
+
+	// World traces issued by the collision constraints, to compare their collision modes
+	int GetCollisionTraceCount() const;
+	void ResetCollisionTraceCount();
+
+	// Times each operator of a simulated collection 4 and 8 wide, starting from the same
+	// particles every time, and counts the attribute values and kills the two disagree on.
+	// The collection's particles are left as they were.
+	struct OperatorTiming_t
+	{
+		const char *m_pName;
+		float m_flNarrowTime;		// seconds for all the iterations
+		float m_flWideTime;
+		int m_nMismatches;
+	};
+	void BenchmarkOperators( CParticleCollection *pParticles, int nIterations, CUtlVector< OperatorTiming_t > &timings );
+
 	IParticleSystemQuery *Query( void ) { return m_pQuery; }
 
 	// return the particle field name
@@ -426,6 +453,14 @@ private:
 		CUtlVector< BatchStep_t > m_BatchStep; 
 	};
 
+	struct BatchList_t
+	{
+		int m_iRenderCache;
+		int m_nMaxVertices;
+		int m_nMaxIndices;
+		CUtlVector< Batch_t > m_Batches;
+	};
+
 	// Unserialization-related methods
 	bool ReadParticleDefinitions( CUtlBuffer &buf, const char *pFileName, bool bPrecache, bool bDecommitTempMemory );
 	void AddParticleSystem( CDmxElement *pParticleSystem );
@@ -437,7 +472,7 @@ private:
 	bool WriteParticleConfigFile( CDmxElement *pParticleSystem, CUtlBuffer &buf, bool bPreventNameBasedLookup );
 
 	// Builds a list of batches to render
-	void BuildBatchList( int iRenderCache, IMatRenderContext *pRenderContext, CUtlVector< Batch_t >& batches );
+	void BuildBatchList( BatchList_t &batchList );
 
 	// Known operators
 	CUtlVector<IParticleOperatorDefinition *> m_ParticleOperators[PARTICLE_FUNCTION_COUNT];
@@ -461,12 +496,15 @@ private:
 	DmObjectId_t m_VisualizedOperatorId;
 	IParticleSystemQuery *m_pQuery;
 	CUtlVector< RenderCache_t > m_RenderCache;
+	CUtlVector< BatchList_t > m_BatchLists;
 	IMaterial *m_pShadowDepthMaterial;
 	float m_flLastSimulationTime;
 
 	bool m_bDidInit;
 	bool m_bUsingDefaultQuery;
 	bool m_bShouldLoadSheets;
+	bool m_bParallelSimulation;
+	bool m_bWideSIMD;
 
 	int m_nNumFramesMeasured;
 
@@ -727,6 +765,14 @@ public:
 		return false;
 	}
 
+	// Does this operator write to data its collection shares with its parent, such as
+	// the parent's world collision cache? Siblings are only simulated at the same time
+	// on the job pool when none of them do.
+	virtual bool WritesParentData( void ) const
+	{
+		return false;
+	}
+
 	// Called when the SFM wants to skip forward in time
 	virtual void SkipToTime( float flTime, CParticleCollection *pParticles, void *pContext ) const {}
 
@@ -1019,7 +1065,7 @@ struct CParticleSIMDTransformation
 	}
 };
 
-#define NUM_COLLISION_CACHE_MODES 4
+#define NUM_COLLISION_CACHE_MODES 5
 
 //-----------------------------------------------------------------------------
 //
@@ -1263,6 +1309,7 @@ private:
 	bool ComputeIsTwoPass();
 	bool ComputeIsBatchable();
 	bool ComputeRequiresOrderInvariance();
+	bool ComputeWritesParentData();
 
 	void LabelTextureUsage( void );
 
@@ -1285,6 +1332,7 @@ public:
 	bool m_bDormant;
 	bool m_bEmissionStopped;
 	bool m_bRequiresOrderInvariance;
+	bool m_bWritesParentData;
 
 	int m_LocalLightingCP;
 	Color m_LocalLighting;
@@ -120,7 +120,7 @@ struct CacheOptimizedTriangle
 	void ChangeIntoIntersectionFormat(void);				// change information storage format for
 	                                                        // computing intersections.
 
-	int ClassifyAgainstAxisSplit(int split_plane, float split_value); // PLANECHECK_xxx below
+	int ClassifyAgainstAxisSplit(int split_plane, float split_value) const; // PLANECHECK_xxx below
 	
 };
 
@@ -217,9 +217,11 @@ public:
 };
 
 
-#define RTE_FLAGS_FAST_TREE_GENERATION 1
+#define RTE_FLAGS_FAST_TREE_GENERATION 1					// binned split search. different tree, same hits
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_COLORS 2				// saves memory if not needed
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_MATERIALS 4
+#define RTE_FLAGS_SERIAL_TREE_GENERATION 8					// build the tree on the calling thread only
+#define RTE_FLAGS_DISABLE_WIDE_TRAVERSAL 16					// Trace8Rays always traces 4 at a time
 
 enum RayTraceLightingMode_t {
 	DIRECT_LIGHTING,										// just dot product lighting
@@ -232,9 +234,10 @@ class RayStream
 {
 	friend class RayTracingEnvironment;
 
-	RayTracingSingleResult *PendingStreamOutputs[8][4];
+	// rays are sorted by direction sign into 8 buckets, each flushed 8 rays at a time
+	RayTracingSingleResult *PendingStreamOutputs[8][8];
 	int n_in_stream[8];
-	FourRays PendingRays[8];
+	FourRays PendingRays[8][2];
 
 public:
 	RayStream(void)
@@ -310,6 +313,18 @@ public:
 					RayTracingResult *rslt_out,
 					int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
 
+	// fire 8 rays (two packets of 4) through the scene. Each packet must pass Check(). When
+	// both packets share one direction sign mask and the cpu has AVX2, they are traversed
+	// together 8 wide, otherwise this is two Trace4Rays calls. Hits closer than TMax are the
+	// same either way. The transparent triangle callback only works on 4 rays, so passing
+	// one always takes the 4 wide path.
+	void Trace8Rays(const FourRays rays[2], const fltx4 TMin[2], const fltx4 TMax[2],
+					RayTracingResult rslt_out[2],
+					int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
+
+	// true if this cpu (and build) can run the 8 wide traversal
+	static bool WideTraversalAvailable(void);
+
 	// compute virtual light sources to model inter-reflection
 	void ComputeVirtualLightSources(void);
 
@@ -352,6 +367,10 @@ public:
 		
 	void RefineNode(int node_number,int32 const *tri_list,int ntris,
 						 Vector MinBound,Vector MaxBound, int depth);
+
+	// 8 wide traversal, see Trace8Rays. both packets must have DirectionSignMask.
+	void Trace8RaysWide(const FourRays rays[2], const fltx4 TMin[2], const fltx4 TMax[2],
+						int DirectionSignMask, RayTracingResult rslt_out[2], int32 skip_id);
 	
 	void CalculateTriangleListBounds(int32 const *tris,int ntris,
 									 Vector &minout, Vector &maxout);
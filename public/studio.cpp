@@ -10,6 +10,7 @@
 #include "datacache/idatacache.h"
 #include "datacache/imdlcache.h"
 #include "convar.h"
+#include "checksum_crc.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -72,6 +73,12 @@ mstudioanim_t *mstudioanimdesc_t::pAnim( int *piFrame ) const
 }
 
 mstudioanim_t *mstudioanimdesc_t::pAnim( int *piFrame, float &flStall ) const
+{
+	int section;
+	return pAnim( piFrame, flStall, &section );
+}
+
+mstudioanim_t *mstudioanimdesc_t::pAnim( int *piFrame, float &flStall, int *piSection ) const
 {
 	mstudioanim_t *panim = NULL;
 
@@ -97,6 +104,8 @@ mstudioanim_t *mstudioanimdesc_t::pAnim( int *piFrame, float &flStall ) const
 		index = pSection( section )->animindex;
 	}
 
+	*piSection = section;
+
 	if (block == -1)
 	{
 		// model needs to be recompiled
@@ -135,6 +144,7 @@ mstudioanim_t *mstudioanimdesc_t::pAnim( int *piFrame, float &flStall ) const
 			{
 				// set it to the last frame in the last valid section
 				*piFrame = sectionframes - 1;
+				*piSection = section;
 				break;
 			}
 		}
@@ -174,6 +184,181 @@ mstudioanim_t *mstudioanimdesc_t::pAnim( int *piFrame, float &flStall ) const
 	return panim;
 }
 
+
+//-----------------------------------------------------------------------------
+// Purpose: number of frames studiomdl stored in a section, as returned by
+//			pAnim(). The separately stored last frame of long anims counts
+//			as a section of one frame.
+//-----------------------------------------------------------------------------
+int Studio_AnimSectionFrames( const mstudioanimdesc_t &animdesc, int section )
+{
+	if (animdesc.sectionframes == 0)
+		return animdesc.numframes;
+
+	int iStartFrame = MIN( section * animdesc.sectionframes, animdesc.numframes - 1 );
+	int iEndFrame = MIN( (section + 1) * animdesc.sectionframes, animdesc.numframes - 1 );
+	return iEndFrame - iStartFrame + 1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: expands one run-length track into pValues[nFrames], returning the
+//			STUDIO_DECODED_ type. Tracks whose lookups wouldn't match
+//			ExtractAnimValue() exactly are left as STUDIO_DECODED_RLE.
+//-----------------------------------------------------------------------------
+static int DecodeAnimTrack( const mstudioanimvalue_t *panimvalue, int nFrames, short *pValues )
+{
+	if (!panimvalue)
+		return STUDIO_DECODED_NONE;
+
+	// ExtractAnimValue() treats a leading single frame span as constant for blends
+	bool bSingleSpan = ( panimvalue->num.total == 1 && panimvalue->num.valid == 1 );
+
+	int k = 0;
+	for (int i = 0; i < nFrames; i++, k++)
+	{
+		while (panimvalue->num.total <= k)
+		{
+			k -= panimvalue->num.total;
+
+			// blending across spans reads the first value of the next span
+			if (panimvalue[panimvalue->num.valid + 1].num.valid == 0)
+				return STUDIO_DECODED_RLE;
+
+			panimvalue += panimvalue->num.valid + 1;
+			if (panimvalue->num.total == 0)
+				return STUDIO_DECODED_RLE;
+		}
+
+		if (panimvalue->num.valid > k)
+		{
+			pValues[i] = panimvalue[k+1].value;
+		}
+		else
+		{
+			pValues[i] = panimvalue[panimvalue->num.valid].value;
+		}
+	}
+
+	for (int i = 1; i < nFrames; i++)
+	{
+		if (pValues[i] != pValues[0])
+			return bSingleSpan ? STUDIO_DECODED_RLE : STUDIO_DECODED_TABLE;
+	}
+	return STUDIO_DECODED_CONST;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: expands every animated track of a section. Constant tracks keep a
+//			single value, so the block is usually only a few times the size
+//			of the source data.
+//-----------------------------------------------------------------------------
+studiodecodedanim_t *Studio_DecodeAnimation( const mstudioanimdesc_t &animdesc, int iSection, const mstudioanim_t *panim )
+{
+	int nFrames = Studio_AnimSectionFrames( animdesc, iSection );
+	if (!panim || nFrames <= 0)
+		return NULL;
+
+	int nBones = 0;
+	for (const mstudioanim_t *p = panim; p && p->bone < 255; p = p->pNext())
+	{
+		nBones++;
+	}
+
+	CUtlVector< studiodecodedtrack_t > tracks;
+	CUtlVector< short > values;
+	tracks.SetCount( nBones * 6 );
+
+	short *pScratch = (short *)stackalloc( nFrames * sizeof( short ) );
+	int iTrack = 0;
+	for (const mstudioanim_t *p = panim; iTrack < nBones * 6; p = p->pNext())
+	{
+		for (int j = 0; j < 6; j++, iTrack++)
+		{
+			const mstudioanimvalue_t *panimvalue = NULL;
+			if (j < 3 && (p->flags & STUDIO_ANIM_ANIMROT))
+			{
+				panimvalue = p->pRotV()->pAnimvalue( j );
+			}
+			else if (j >= 3 && (p->flags & STUDIO_ANIM_ANIMPOS))
+			{
+				panimvalue = p->pPosV()->pAnimvalue( j - 3 );
+			}
+
+			studiodecodedtrack_t &track = tracks[iTrack];
+			track.type = DecodeAnimTrack( panimvalue, nFrames, pScratch );
+			track.unused = 0;
+			track.valueindex = values.Count();
+			if (track.type == STUDIO_DECODED_CONST)
+			{
+				values.AddToTail( pScratch[0] );
+			}
+			else if (track.type == STUDIO_DECODED_TABLE)
+			{
+				values.AddMultipleToTail( nFrames, pScratch );
+			}
+		}
+	}
+
+	int size = sizeof( studiodecodedanim_t ) + tracks.Count() * sizeof( studiodecodedtrack_t ) + values.Count() * sizeof( short );
+	studiodecodedanim_t *pDecoded = (studiodecodedanim_t *)malloc( size );
+	pDecoded->checksum = animdesc.pStudiohdr()->checksum;
+	pDecoded->anim = &animdesc - animdesc.pStudiohdr()->pLocalAnimdesc( 0 );
+	pDecoded->section = iSection;
+	pDecoded->sourcecrc = Studio_AnimSectionCRC( panim );
+	pDecoded->source = panim;
+	pDecoded->numframes = nFrames;
+	pDecoded->numbones = nBones;
+	pDecoded->size = size;
+	V_memcpy( (void *)pDecoded->pTrack( 0, 0 ), tracks.Base(), tracks.Count() * sizeof( studiodecodedtrack_t ) );
+	V_memcpy( (void *)pDecoded->pValues(), values.Base(), values.Count() * sizeof( short ) );
+	return pDecoded;
+}
+
+void Studio_FreeDecodedAnimation( studiodecodedanim_t *pDecoded )
+{
+	free( pDecoded );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: checksums what a decoded table depends on without reading every
+//			value: each bone's header, its track offsets and the first span
+//			header of each track.
+//-----------------------------------------------------------------------------
+unsigned int Studio_AnimSectionCRC( const mstudioanim_t *panim )
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	for (const mstudioanim_t *p = panim; p && p->bone < 255; p = p->pNext())
+	{
+		byte header[4] = { p->bone, p->flags, (byte)( p->nextoffset & 0xFF ), (byte)( ( p->nextoffset >> 8 ) & 0xFF ) };
+		CRC32_ProcessBuffer( &crc, header, sizeof( header ) );
+
+		const mstudioanim_valueptr_t *pValuePtrs[2] = {
+			( p->flags & STUDIO_ANIM_ANIMROT ) ? p->pRotV() : NULL,
+			( p->flags & STUDIO_ANIM_ANIMPOS ) ? p->pPosV() : NULL };
+		for (int i = 0; i < 2; i++)
+		{
+			if (!pValuePtrs[i])
+				continue;
+
+			CRC32_ProcessBuffer( &crc, pValuePtrs[i]->offset, sizeof( pValuePtrs[i]->offset ) );
+			for (int j = 0; j < 3; j++)
+			{
+				const mstudioanimvalue_t *panimvalue = pValuePtrs[i]->pAnimvalue( j );
+				if (panimvalue)
+				{
+					CRC32_ProcessBuffer( &crc, panimvalue, 2 * sizeof( mstudioanimvalue_t ) );
+				}
+			}
+		}
+	}
+	CRC32_Final( &crc );
+	return crc;
+}
+
 mstudioikrule_t *mstudioanimdesc_t::pIKRule( int i ) const
 {
 	if (ikruleindex)
@@ -729,6 +914,7 @@ CStudioHdr::CStudioHdr( const studiohdr_t *pStudioHdr, IMDLCache *mdlcache )
 void CStudioHdr::Init( const studiohdr_t *pStudioHdr, IMDLCache *mdlcache )
 {
 	m_pStudioHdr = pStudioHdr;
+	m_pMDLCache = mdlcache;
 
 	m_pVModel = NULL;
 	m_pStudioHdrCache.RemoveAll();
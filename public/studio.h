@@ -747,6 +747,7 @@ struct mstudioanimdesc_t
 	int					animblock;
 	int					animindex;	 // non-zero when anim data isn't in sections
 	mstudioanim_t *pAnimBlock( int block, int index ) const; // returns pointer to a specific anim block (local or external)
+	mstudioanim_t *pAnim( int *piFrame, float &flStall, int *piSection ) const; // returns pointer to data, new frame index and the section it came from
 	mstudioanim_t *pAnim( int *piFrame, float &flStall ) const; // returns pointer to data and new frame index
 	mstudioanim_t *pAnim( int *piFrame ) const; // returns pointer to data and new frame index
 
@@ -775,6 +776,50 @@ private:
 	mstudioanimdesc_t(const mstudioanimdesc_t& vOther);
 };
 
+// number of local frames that can be asked for in a section, as returned by pAnim()
+int Studio_AnimSectionFrames( const mstudioanimdesc_t &animdesc, int iSection );
+
+
+//-----------------------------------------------------------------------------
+// Decoded animation sections. Runtime only, never saved: the run-length
+// value tracks of one section expanded to a value per frame, so a frame
+// lookup is an index instead of a walk over the spans. Built by the model
+// cache on demand, see IMDLCache::GetDecodedAnimation.
+//-----------------------------------------------------------------------------
+#define STUDIO_DECODED_NONE		0	// no track, the value is always 0
+#define STUDIO_DECODED_CONST	1	// the same value on every frame
+#define STUDIO_DECODED_TABLE	2	// one value per frame, plus the blend value past the last one
+#define STUDIO_DECODED_RLE		3	// couldn't be expanded, walk the source track
+
+struct studiodecodedtrack_t
+{
+	short				type;
+	short				unused;
+	int					valueindex;
+};
+
+struct studiodecodedanim_t
+{
+	int					checksum;	// of the model owning the animation
+	int					anim;		// local animdesc index in that model
+	int					section;	// as returned by pAnim(), 0 when not split
+	unsigned int		sourcecrc;	// Studio_AnimSectionCRC of the section it was built from
+	const mstudioanim_t	*source;	// where that section was, lookups passing the same one skip the CRC
+	int					numframes;
+	int					numbones;	// bones in the section, in source order
+	int					size;		// of the whole block
+
+	// six per bone, rotation x y z then position x y z
+	inline const studiodecodedtrack_t *pTrack( int iBone, int iComponent ) const { return (const studiodecodedtrack_t *)(this + 1) + iBone * 6 + iComponent; }
+	inline const short	*pValues( void ) const { return (const short *)( (const studiodecodedtrack_t *)(this + 1) + numbones * 6 ); }
+};
+
+// Expands section iSection of animdesc starting at panim. Free with Studio_FreeDecodedAnimation.
+studiodecodedanim_t *Studio_DecodeAnimation( const mstudioanimdesc_t &animdesc, int iSection, const mstudioanim_t *panim );
+// Cheap checksum of a section's bone list and track layout, to tell a reloaded section from the one a table was built from
+unsigned int Studio_AnimSectionCRC( const mstudioanim_t *panim );
+void Studio_FreeDecodedAnimation( studiodecodedanim_t *pDecoded );
+
 struct mstudioikrule_t;
 
 struct mstudioautolayer_t
@@ -2458,6 +2503,7 @@ public:
 	inline bool IsReadyForAccess( void ) const { return (m_pStudioHdr != NULL); };
 	inline virtualmodel_t		*GetVirtualModel( void ) const { return m_pVModel; };
 	inline const studiohdr_t	*GetRenderHdr( void ) const { return m_pStudioHdr; };
+	inline IMDLCache			*GetMDLCache( void ) const { return m_pMDLCache; };
 	const studiohdr_t *pSeqStudioHdr( int sequence );
 	const studiohdr_t *pAnimStudioHdr( int animation );
 
@@ -2472,6 +2518,7 @@ private:
 	mutable int			m_nFrameUnlockCounter;
 	int	*				m_pFrameUnlockCounter;
 	CThreadFastMutex	m_FrameUnlockCounterMutex;
+	IMDLCache			*m_pMDLCache;
 
 public:
 	inline int			numbones( void ) const { return m_pStudioHdr->numbones; };
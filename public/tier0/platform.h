@@ -1302,7 +1302,8 @@ struct CPUInformation
 		 m_bSSSE3 : 1,
 		 m_bSSE4a : 1,
 		 m_bSSE41 : 1,
-		 m_bSSE42 : 1;
+		 m_bSSE42 : 1,
+		 m_bAVX2 : 1;	// Is AVX2 supported and enabled by the OS?
 
 	int64 m_Speed;						// In cycles per second.
 
@@ -130,7 +130,7 @@ public:
 	virtual void AddTextOverlayRGB(const Vector& origin, int line_offset, float duration, float r, float g, float b, float alpha, PRINTF_FORMAT_STRING const char *format, ...) = 0;
 };
 
-#define VPHYSICS_INTERFACE_VERSION	"VPhysics031"
+#define VPHYSICS_INTERFACE_VERSION	"VPhysics032"
 
 abstract_class IPhysics : public IAppSystem
 {
@@ -173,8 +173,19 @@ struct truncatedcone_t
 	float	theta;		// cone angle (degrees)
 };
 
+// IPhysicsCollision::ReadStat() ids for the collision models loaded from .phy data.
+// Solids unserialized from the same bytes share one converted copy.
+enum
+{
+	VCOLLIDE_STAT_LOADED_SOLIDS = 200,	// solids unserialized so far
+	VCOLLIDE_STAT_SHARED_SOLIDS,		// how many of those reused an already converted solid
+	VCOLLIDE_STAT_LOAD_USEC,			// total time spent in VCollideLoad(), in microseconds
+	VCOLLIDE_STAT_RESIDENT_BYTES,		// converted solids in memory, including unused ones kept for the next load
+	VCOLLIDE_STAT_SAVED_BYTES,			// memory the loaded solids would need on top of that without sharing
+};
+
 
-#define VPHYSICS_COLLISION_INTERFACE_VERSION	"VPhysicsCollision007"
+#define VPHYSICS_COLLISION_INTERFACE_VERSION	"VPhysicsCollision008"
 
 abstract_class IPhysicsCollision
 {
@@ -298,6 +309,10 @@ public:
 	// dumps info about the collide to Msg()
 	virtual void			OutputDebugInfo( const CPhysCollide *pCollide ) = 0;
 	virtual unsigned int	ReadStat( int statID ) = 0;
+
+	// Trace many AABBs against one collide. pTraces[i] is what TraceBox would return for pRays[i]
+	// (to within the sweep epsilon); the rays share the setup and the walk of the collide's ledge tree.
+	virtual void			TraceBoxBatch( const Ray_t *pRays, int rayCount, unsigned int contentsMask, IConvexInfo *pConvexInfo, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *pTraces ) = 0;
 };
 
 // this can be used to post-process a collision model
@@ -657,6 +672,11 @@ public:
 
 	virtual void EnableConstraintNotify( bool bEnable ) = 0;
 	virtual void DebugCheckContacts(void) = 0;
+
+	// With at least this many awake objects, the per-tick friction scrape runs on the job pool in batches
+	// of 32 objects. Only that pass is threaded, the simulation step is not. 0 (the default) is always serial.
+	virtual void SetMinParallelFrictionObjects( int count ) = 0;
+	virtual int GetMinParallelFrictionObjects() const = 0;
 };
 
 enum callbackflags
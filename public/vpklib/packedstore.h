@@ -28,6 +28,9 @@
 
 const int k_nVPKDefaultChunkSize = 200 * 1024 * 1024;
 
+// Chunk files are hashed in fractions of this size
+const int k_nVPKFileFractionSize = 0x00100000; // 1 MB
+
 class CPackedStore;
 
 
@@ -329,6 +332,13 @@ public:
 	/// Re-hash a single chunk file.  Don't forget to rehash the metadata afterwords!
 	void HashChunkFile( int iChunkFileIndex );
 
+	/// Replace the hashes of a chunk file with ones computed elsewhere, e.g. while it was
+	/// being written.  Don't forget to rehash the metadata afterwords!
+	void SetChunkHashes( int iChunkFileIndex, const CUtlVector<ChunkHashFraction_t> &vecFractions );
+
+	/// Returns true if we have hashes for the chunk file and they all match the given ones
+	bool ChunkHashesMatch( int iChunkFileIndex, const CUtlVector<ChunkHashFraction_t> &vecFractions );
+
 	bool HashEntirePackFile( CPackedStoreFileHandle &handle, int64 &nFileSize, int nFileFraction, int nFractionSize, FileHash_t &fileHash );
 	void ComputeDirectoryHash( MD5Value_t &md5Directory );
 	void ComputeChunkHash( MD5Value_t &md5ChunkHashes );
@@ -342,6 +352,10 @@ public:
 	void GetPackFileName( CPackedStoreFileHandle &handle, char *pchFileNameOut, int cchFileNameOut ) const;
 	void GetDataFileName( char *pchFileNameOut, int cchFileNameOut, int nFileNumber ) const;
 
+	/// Resolve the data file, byte offset and size that back an open handle's chunk data.
+	/// Preload bytes stored in the directory are not included.
+	void GetDataFileLocation( const CPackedStoreFileHandle &handle, char *pchFileNameOut, int cchFileNameOut, int64 &nOffsetOut, int &nSizeOut ) const;
+
 	char const *BaseName( void )
 	{
 		return m_pszFileBaseName;
@@ -436,6 +450,14 @@ private:
 
 	FileHandleTracker_t &GetFileHandle( int nFileNumber );
 
+	// Hash a chunk file through its own file handle, so several can be hashed at once
+	struct ChunkHashJob_t
+	{
+		int m_iChunkFileIndex;
+		CUtlVector<ChunkHashFraction_t> m_vecFractions;
+	};
+	void ComputeChunkFileHashes( ChunkHashJob_t &job );
+
 	void CloseWriteHandle( void );
 
 	// For cache-ing directory and contents data
@@ -448,6 +470,58 @@ private:
 	friend class CPackedStoreReadCache;
 };
 
+
+//-----------------------------------------------------------------------------
+// Streams data into a chunk file.  Fraction hashes are computed as the data
+// goes by, while the previous fraction is written out on the thread pool, so
+// the chunk never has to be read back to hash it.
+//
+// With bKeepIfUnchanged the data goes to a temp file first, and the existing
+// chunk file is left untouched if its hashes show the content is the same.
+//-----------------------------------------------------------------------------
+class CPackedStoreChunkWriter
+{
+public:
+	CPackedStoreChunkWriter( CPackedStore *pStore, int iChunkFileIndex, bool bKeepIfUnchanged = false );
+	~CPackedStoreChunkWriter();
+
+	bool Open();
+	bool Write( const void *pData, int nBytes );
+
+	/// Flush, hash and hand the hashes to the store.  Returns false on a write error
+	bool Close();
+
+	/// Bytes accepted so far, including any still buffered
+	int64 BytesWritten() const { return m_nBytesWritten + m_nFill; }
+
+	/// After Close, true if the existing chunk file had the same content and was kept
+	bool WasUnchanged() const { return m_bUnchanged; }
+
+private:
+	void FlushBuffer( bool bFinal );
+	void WriteBuffer( int iBuffer );
+	bool WaitForWrite();
+
+	CPackedStore *m_pStore;
+	int m_iChunkFileIndex;
+	bool m_bKeepIfUnchanged;
+	bool m_bUnchanged;
+	bool m_bWriteError;
+	char m_szFileName[MAX_PATH];
+	char m_szWriteFileName[MAX_PATH];
+	FileHandle_t m_hFile;
+
+	// Double buffered, one being filled while the other is written
+	CUtlVector<uint8> m_Buffer[2];
+	int m_iFillBuffer;
+	int m_nFill;
+	int m_nWriteSize;
+	class CJob *m_pWriteJob;
+
+	int64 m_nBytesWritten;
+	CUtlVector<ChunkHashFraction_t> m_vecFractions;
+};
+
 FORCEINLINE int CPackedStoreFileHandle::Read( void *pOutData, int nNumBytes )
 {
 	return m_pOwner->ReadData( *this, pOutData, nNumBytes );
@@ -5,6 +5,7 @@
 #include <filesystem_tools.h>
 #include <cmdlib.h>
 #include <stdio.h>
+#include "vstdlib/jobthread.h"
 
 static bool SameSign(float a, float b)
 {
@@ -235,7 +236,7 @@ void CacheOptimizedTriangle::ChangeIntoIntersectionFormat(void)
 
 int n_intersection_calculations=0;
 
-int CacheOptimizedTriangle::ClassifyAgainstAxisSplit(int split_plane, float split_value)
+int CacheOptimizedTriangle::ClassifyAgainstAxisSplit(int split_plane, float split_value) const
 {
 	// classify a triangle against an axis-aligned plane
 	float minc=Vertex(0)[split_plane];
@@ -595,6 +596,295 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 }
 
 
+//-----------------------------------------------------------------------------
+// 8 wide traversal
+//
+// Trace8RaysWide is Trace4Rays on two packets at once, using 8 float AVX
+// registers. Every lane does the same operations in the same order as
+// Trace4Rays, so a triangle hit is computed bit for bit the same way. The only
+// difference is that the pair can visit leaves neither packet would visit
+// alone. That can add hits beyond a ray's TMax, which callers already ignore.
+//-----------------------------------------------------------------------------
+#if !defined( _X360 ) && !defined( _PS3 ) && !defined( __arm__ ) && !defined( __aarch64__ )
+#define RAYTRACE_AVX2 1
+#include <immintrin.h>
+
+#ifdef COMPILER_GCC
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#else
+#define AVX2_FUNCTION
+#endif
+
+typedef __m256 fltx8;
+
+struct NodeToVisit8 {
+	CacheOptimizedKDNode const *node;
+	fltx8 TMin;
+	fltx8 TMax;
+};
+
+static AVX2_FUNCTION FORCEINLINE fltx8 CombineX8( const fltx4 &lo, const fltx4 &hi )
+{
+	return _mm256_insertf128_ps( _mm256_castps128_ps256( lo ), hi, 1 );
+}
+
+static AVX2_FUNCTION FORCEINLINE bool IsAnyNegativeX8( const fltx8 &a )
+{
+	return _mm256_movemask_ps( a ) != 0;
+}
+
+static AVX2_FUNCTION FORCEINLINE fltx8 SelectX8( const fltx8 &old, const fltx8 &val, const fltx8 &mask )
+{
+	return _mm256_or_ps( _mm256_and_ps( val, mask ), _mm256_andnot_ps( mask, old ) );
+}
+
+static AVX2_FUNCTION void StoreResultsX8( const fltx8 &HitIds, const fltx8 &HitDistance,
+										  const fltx8 *normal, RayTracingResult rslt_out[2] )
+{
+	StoreAlignedSIMD( (float *) rslt_out[0].HitIds, _mm256_castps256_ps128( HitIds ) );
+	StoreAlignedSIMD( (float *) rslt_out[1].HitIds, _mm256_extractf128_ps( HitIds, 1 ) );
+	rslt_out[0].HitDistance = _mm256_castps256_ps128( HitDistance );
+	rslt_out[1].HitDistance = _mm256_extractf128_ps( HitDistance, 1 );
+	for( int c = 0; c < 3; c++ )
+	{
+		rslt_out[0].surface_normal[c] = _mm256_castps256_ps128( normal[c] );
+		rslt_out[1].surface_normal[c] = _mm256_extractf128_ps( normal[c], 1 );
+	}
+}
+
+AVX2_FUNCTION void RayTracingEnvironment::Trace8RaysWide(const FourRays rays[2], const fltx4 TMin4[2],
+														 const fltx4 TMax4[2], int DirectionSignMask,
+														 RayTracingResult rslt_out[2], int32 skip_id)
+{
+	rays[0].Check();
+	rays[1].Check();
+
+	FourVectors OneOverRayDir4[2];
+	OneOverRayDir4[0]=rays[0].direction;
+	OneOverRayDir4[0].MakeReciprocalSaturate();
+	OneOverRayDir4[1]=rays[1].direction;
+	OneOverRayDir4[1].MakeReciprocalSaturate();
+
+	fltx8 origin[3],direction[3],OneOverRayDir[3];
+	for(int c=0;c<3;c++)
+	{
+		origin[c]=CombineX8(rays[0].origin[c],rays[1].origin[c]);
+		direction[c]=CombineX8(rays[0].direction[c],rays[1].direction[c]);
+		OneOverRayDir[c]=CombineX8(OneOverRayDir4[0][c],OneOverRayDir4[1][c]);
+	}
+	fltx8 TMin=CombineX8(TMin4[0],TMin4[1]);
+	fltx8 TMax=CombineX8(TMax4[0],TMax4[1]);
+
+	const fltx8 Epsilons=_mm256_set1_ps( (float) 1.0e-10 );
+	const fltx8 NegativeEpsilons=_mm256_set1_ps( (float) -1.0e-10 );
+	const fltx8 Zeros=Epsilons;								// same as FourZeros
+	const fltx8 Ones=_mm256_set1_ps( 1.0f );
+
+	fltx8 HitIds=_mm256_castsi256_ps( _mm256_set1_epi32( -1 ) );
+	fltx8 HitDistance=_mm256_set1_ps( (float) 1.0e23 );
+	fltx8 surface_normal[3];
+	surface_normal[0]=surface_normal[1]=surface_normal[2]=_mm256_setzero_ps();
+
+	// now, clip rays against bounding box
+	for(int c=0;c<3;c++)
+	{
+		fltx8 isect_min_t=
+			_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(m_MinBound[c]),origin[c]),OneOverRayDir[c]);
+		fltx8 isect_max_t=
+			_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(m_MaxBound[c]),origin[c]),OneOverRayDir[c]);
+		TMin=_mm256_max_ps(TMin,_mm256_min_ps(isect_min_t,isect_max_t));
+		TMax=_mm256_min_ps(TMax,_mm256_max_ps(isect_min_t,isect_max_t));
+	}
+	fltx8 active=_mm256_cmp_ps(TMin,TMax,_CMP_LE_OQ);		// mask of which rays are active
+	if (! IsAnyNegativeX8(active) )
+	{
+		StoreResultsX8(HitIds,HitDistance,surface_normal,rslt_out);
+		_mm256_zeroupper();
+		return;												// missed bounding box
+	}
+
+	int32 mailboxids[MAILBOX_HASH_SIZE];					// used to avoid redundant triangle tests
+	memset(mailboxids,0xff,sizeof(mailboxids));
+
+	int front_idx[3],back_idx[3];
+	for(int c=0;c<3;c++)
+	{
+		back_idx[c]=(DirectionSignMask & (1<<c)) ? 0 : 1;
+		front_idx[c]=1-back_idx[c];
+	}
+
+	NodeToVisit8 NodeQueue[MAX_NODE_STACK_LEN];
+	CacheOptimizedKDNode const *CurNode=&(OptimizedKDTree[0]);
+	NodeToVisit8 *stack_ptr=&NodeQueue[MAX_NODE_STACK_LEN];
+	while(1)
+	{
+		while (CurNode->NodeType() != KDNODE_STATE_LEAF)		// traverse until next leaf
+		{
+			int split_plane_number=CurNode->NodeType();
+			CacheOptimizedKDNode const *FrontChild=&(OptimizedKDTree[CurNode->LeftChild()]);
+
+			fltx8 dist_to_sep_plane=						// dist=(split-org)/dir
+				_mm256_mul_ps(
+					_mm256_sub_ps(_mm256_set1_ps(CurNode->SplittingPlaneValue),
+								  origin[split_plane_number]),OneOverRayDir[split_plane_number]);
+			active=_mm256_cmp_ps(TMin,TMax,_CMP_LE_OQ);
+
+			fltx8 hits_front=_mm256_and_ps(active,_mm256_cmp_ps(dist_to_sep_plane,TMin,_CMP_GE_OQ));
+			if (! IsAnyNegativeX8(hits_front))
+			{
+				// missed the front. only traverse back
+				CurNode=FrontChild+back_idx[split_plane_number];
+				TMin=_mm256_max_ps(TMin, dist_to_sep_plane);
+			}
+			else
+			{
+				fltx8 hits_back=_mm256_and_ps(active,_mm256_cmp_ps(dist_to_sep_plane,TMax,_CMP_LE_OQ));
+				if (! IsAnyNegativeX8(hits_back) )
+				{
+					// missed the back - only need to traverse front node
+					CurNode=FrontChild+front_idx[split_plane_number];
+					TMax=_mm256_min_ps(TMax, dist_to_sep_plane);
+				}
+				else
+				{
+					// must push far, traverse near
+					assert(stack_ptr>NodeQueue);
+					--stack_ptr;
+					stack_ptr->node=FrontChild+back_idx[split_plane_number];
+					stack_ptr->TMin=_mm256_max_ps(TMin,dist_to_sep_plane);
+					stack_ptr->TMax=TMax;
+					CurNode=FrontChild+front_idx[split_plane_number];
+					TMax=_mm256_min_ps(TMax,dist_to_sep_plane);
+				}
+			}
+		}
+		// hit a leaf! must do intersection check
+		int ntris=CurNode->NumberOfTrianglesInLeaf();
+		if (ntris)
+		{
+			int32 const *tlist=&(TriangleIndexList[CurNode->TriangleIndexStart()]);
+			do
+			{
+				int tnum=*(tlist++);
+				int mbox_slot=tnum & (MAILBOX_HASH_SIZE-1);
+				TriIntersectData_t const *tri = &( OptimizedTriangleList[tnum].m_Data.m_IntersectData );
+				if ( ( mailboxids[mbox_slot] != tnum ) && ( tri->m_nTriangleID != skip_id ) )
+				{
+					n_intersection_calculations++;
+					mailboxids[mbox_slot] = tnum;
+
+					fltx8 N[3];
+					N[0] = _mm256_set1_ps( tri->m_flNx );
+					N[1] = _mm256_set1_ps( tri->m_flNy );
+					N[2] = _mm256_set1_ps( tri->m_flNz );
+
+					fltx8 DDotN = _mm256_mul_ps( direction[0], N[0] );
+					DDotN = _mm256_add_ps( _mm256_mul_ps( direction[1], N[1] ), DDotN );
+					DDotN = _mm256_add_ps( _mm256_mul_ps( direction[2], N[2] ), DDotN );
+					// mask off zero or near zero (ray parallel to surface)
+					fltx8 did_hit = _mm256_or_ps( _mm256_cmp_ps( DDotN, Epsilons, _CMP_GT_OQ ),
+												  _mm256_cmp_ps( DDotN, NegativeEpsilons, _CMP_LT_OQ ) );
+
+					fltx8 ODotN = _mm256_mul_ps( origin[0], N[0] );
+					ODotN = _mm256_add_ps( _mm256_mul_ps( origin[1], N[1] ), ODotN );
+					ODotN = _mm256_add_ps( _mm256_mul_ps( origin[2], N[2] ), ODotN );
+					fltx8 numerator = _mm256_sub_ps( _mm256_set1_ps( tri->m_flD ), ODotN );
+
+					fltx8 isect_t = _mm256_div_ps( numerator, DDotN );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, Zeros, _CMP_GT_OQ ) );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, HitDistance, _CMP_LT_OQ ) );
+
+					if ( ! IsAnyNegativeX8( did_hit ) )
+						continue;
+
+					// now, check 3 edges
+					fltx8 hitc1 = _mm256_add_ps( origin[tri->m_nCoordSelect0],
+												 _mm256_mul_ps( isect_t, direction[tri->m_nCoordSelect0] ) );
+					fltx8 hitc2 = _mm256_add_ps( origin[tri->m_nCoordSelect1],
+												 _mm256_mul_ps( isect_t, direction[tri->m_nCoordSelect1] ) );
+
+					fltx8 B0 = _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[0] ), hitc1 );
+					B0 = _mm256_add_ps( B0, _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[1] ), hitc2 ) );
+					B0 = _mm256_add_ps( B0, _mm256_set1_ps( tri->m_ProjectedEdgeEquations[2] ) );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B0, Zeros, _CMP_GE_OQ ) );
+
+					fltx8 B1 = _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[3] ), hitc1 );
+					B1 = _mm256_add_ps( B1, _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[4] ), hitc2 ) );
+					B1 = _mm256_add_ps( B1, _mm256_set1_ps( tri->m_ProjectedEdgeEquations[5] ) );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B1, Zeros, _CMP_GE_OQ ) );
+
+					fltx8 B2 = _mm256_add_ps( B1, B0 );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B2, Ones, _CMP_LE_OQ ) );
+
+					if ( ! IsAnyNegativeX8( did_hit ) )
+						continue;
+
+					// now, set the hit_id and closest_hit fields for any enabled rays
+					HitIds = SelectX8( HitIds, _mm256_castsi256_ps( _mm256_set1_epi32( tnum ) ), did_hit );
+					HitDistance = SelectX8( HitDistance, isect_t, did_hit );
+					for( int c = 0; c < 3; c++ )
+						surface_normal[c] = SelectX8( surface_normal[c], N[c], did_hit );
+				}
+			} while (--ntris);
+			// now, check if all rays have terminated
+			fltx8 raydone=_mm256_cmp_ps(TMax,HitDistance,_CMP_LE_OQ);
+			if (! IsAnyNegativeX8(raydone))
+				break;
+		}
+
+		if (stack_ptr==&NodeQueue[MAX_NODE_STACK_LEN])
+			break;
+		// pop stack!
+		CurNode=stack_ptr->node;
+		TMin=stack_ptr->TMin;
+		TMax=stack_ptr->TMax;
+		stack_ptr++;
+	}
+
+	StoreResultsX8(HitIds,HitDistance,surface_normal,rslt_out);
+	_mm256_zeroupper();
+}
+
+bool RayTracingEnvironment::WideTraversalAvailable(void)
+{
+	static bool s_bAVX2 = GetCPUInformation()->m_bAVX2;
+	return s_bAVX2;
+}
+
+#else
+
+void RayTracingEnvironment::Trace8RaysWide(const FourRays rays[2], const fltx4 TMin[2], const fltx4 TMax[2],
+										   int DirectionSignMask, RayTracingResult rslt_out[2], int32 skip_id)
+{
+	Trace4Rays(rays[0],TMin[0],TMax[0],DirectionSignMask,&rslt_out[0],skip_id);
+	Trace4Rays(rays[1],TMin[1],TMax[1],DirectionSignMask,&rslt_out[1],skip_id);
+}
+
+bool RayTracingEnvironment::WideTraversalAvailable(void)
+{
+	return false;
+}
+
+#endif
+
+void RayTracingEnvironment::Trace8Rays(const FourRays rays[2], const fltx4 TMin[2], const fltx4 TMax[2],
+									   RayTracingResult rslt_out[2],
+									   int32 skip_id, ITransparentTriangleCallback *pCallback)
+{
+	if ( !pCallback && !( Flags & RTE_FLAGS_DISABLE_WIDE_TRAVERSAL ) && WideTraversalAvailable() )
+	{
+		int msk=rays[0].CalculateDirectionSignMask();
+		if ( ( msk!=-1 ) && ( msk==rays[1].CalculateDirectionSignMask() ) )
+		{
+			Trace8RaysWide(rays,TMin,TMax,msk,rslt_out,skip_id);
+			return;
+		}
+	}
+	Trace4Rays(rays[0],TMin[0],TMax[0],&rslt_out[0],skip_id,pCallback);
+	Trace4Rays(rays[1],TMin[1],TMax[1],&rslt_out[1],skip_id,pCallback);
+}
+
+
 int RayTracingEnvironment::MakeLeafNode(int first_tri, int last_tri)
 {
 	CacheOptimizedKDNode ret;
@@ -651,6 +941,25 @@ void RayTracingEnvironment::CalculateTriangleListBounds(int32 const *tris,int nt
 #define COST_OF_INTERSECTION 167							// approximate #operations
 
 
+static float CostOfSplit(int split_plane, Vector const &MinBound, Vector const &MaxBound,
+						 float split_value, int nleft, int nright, int nboth)
+{
+	// now, perform surface area/cost check to determine whether this split was worth it
+	Vector LeftMins=MinBound;
+	Vector LeftMaxes=MaxBound;
+	Vector RightMins=MinBound;
+	Vector RightMaxes=MaxBound;
+	LeftMaxes[split_plane]=split_value;
+	RightMins[split_plane]=split_value;
+	float SA_L=BoxSurfaceArea(LeftMins,LeftMaxes);
+	float SA_R=BoxSurfaceArea(RightMins,RightMaxes);
+	float ISA=1.0/BoxSurfaceArea(MinBound,MaxBound);
+	float cost_of_split=COST_OF_TRAVERSAL+COST_OF_INTERSECTION*(nboth+
+		(SA_L*ISA*(nleft))+(SA_R*ISA*(nright)));
+	return cost_of_split;
+}
+
+
 float RayTracingEnvironment::CalculateCostsOfSplit(
 	int split_plane,int32 const *tri_list,int ntris,
 	Vector MinBound,Vector MaxBound, float &split_value,
@@ -701,19 +1010,7 @@ float RayTracingEnvironment::CalculateCostsOfSplit(
 	if (nright && (nboth==0) && (nleft==0))
 		split_value=min_coord;
 
-	// now, perform surface area/cost check to determine whether this split was worth it
-	Vector LeftMins=MinBound;
-	Vector LeftMaxes=MaxBound;
-	Vector RightMins=MinBound;
-	Vector RightMaxes=MaxBound;
-	LeftMaxes[split_plane]=split_value;
-	RightMins[split_plane]=split_value;
-	float SA_L=BoxSurfaceArea(LeftMins,LeftMaxes);
-	float SA_R=BoxSurfaceArea(RightMins,RightMaxes);
-	float ISA=1.0/BoxSurfaceArea(MinBound,MaxBound);
-	float cost_of_split=COST_OF_TRAVERSAL+COST_OF_INTERSECTION*(nboth+
-		(SA_L*ISA*(nleft))+(SA_R*ISA*(nright)));
-	return cost_of_split;
+	return CostOfSplit(split_plane,MinBound,MaxBound,split_value,nleft,nright,nboth);
 }
 
 
@@ -872,6 +1169,418 @@ void RayTracingEnvironment::RefineNode(int node_number,int32 const *tri_list,int
 }
 
 
+//-----------------------------------------------------------------------------
+// Parallel tree build
+//
+// CKDTreeBuilder builds the same tree as RefineNode: same split candidates, same tie
+// breaking and the same triangle order in every node. It keeps the triangle
+// classifications in per-node arrays instead of m_nTmpData0/1, so nodes can be refined
+// at the same time. Near the root, where nodes are big, the split candidates are
+// costed on the job pool. Each node below m_nSubtreeJobTris becomes one job that
+// builds its whole subtree into private arrays; those are spliced into
+// OptimizedKDTree afterwards. Only the node numbering differs from the serial build.
+//
+// With RTE_FLAGS_FAST_TREE_GENERATION the candidates are instead the boundaries of
+// KDTREE_SAH_BINS equal bins along each axis, all counted in one pass over the
+// triangles (binned SAH).
+//-----------------------------------------------------------------------------
+#define KDTREE_SAH_BINS 32
+#define KDTREE_PARALLEL_SPLIT_MIN_TRIS 4096					// cost candidates on the job pool
+#define KDTREE_SUBTREE_JOB_MIN_TRIS 1024					// smallest subtree given its own job
+
+struct KDSplitCandidate_t
+{
+	int m_nAxis;
+	float m_flTrialValue;									// triangles are classified here
+	float m_flSplitValue;									// trial value after growing an empty side
+	float m_flCost;
+	int m_nLeft, m_nRight, m_nBoth;
+};
+
+// costs the exact candidates of one node, see CalculateCostsOfSplit
+class CKDSplitCoster
+{
+public:
+	CKDSplitCoster( RayTracingEnvironment const &env, int32 const *tri_list, int ntris,
+					Vector const &MinBound, Vector const &MaxBound )
+		: m_Env( env ), m_pTriangles( tri_list ), m_nTriangles( ntris ),
+		  m_MinBound( MinBound ), m_MaxBound( MaxBound )
+	{
+	}
+
+	void CostCandidate( KDSplitCandidate_t &candidate );
+
+private:
+	RayTracingEnvironment const &m_Env;
+	int32 const *m_pTriangles;
+	int m_nTriangles;
+	Vector m_MinBound, m_MaxBound;
+};
+
+class CKDTreeBuilder
+{
+public:
+	CKDTreeBuilder( RayTracingEnvironment &env, bool bBinned );
+
+	// refines node 0 of OptimizedKDTree, which has to be there already
+	void Build( int32 const *tri_list, int ntris, Vector const &MinBound, Vector const &MaxBound );
+
+private:
+	struct SubtreeJob_t
+	{
+		int m_nNode;										// node in OptimizedKDTree replaced by the root
+		int m_nDepth;
+		Vector m_MinBound, m_MaxBound;
+		CUtlVector<int32> m_Triangles;
+		CUtlVector<CacheOptimizedKDNode> m_Nodes;			// m_Nodes[0] is the root
+		CUtlVector<int32> m_TriangleIndexList;
+	};
+
+	void RefineNode( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &tri_indices,
+					 int node_number, int32 const *tri_list, int ntris,
+					 Vector MinBound, Vector MaxBound, int depth, bool bTopLevel );
+	void MakeLeaf( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &tri_indices,
+				   int node_number, int32 const *tri_list, int ntris,
+				   Vector const &MinBound, Vector const &MaxBound );
+	void FindBestSplit( int32 const *tri_list, int ntris, Vector const &MinBound,
+						Vector const &MaxBound, bool bParallel, KDSplitCandidate_t &best );
+	void CostBinnedSplits( int32 const *tri_list, int ntris, Vector const &MinBound,
+						   Vector const &MaxBound, int axis, KDSplitCandidate_t *pCandidates );
+	void BuildSubtree( SubtreeJob_t *&pJob );
+	void SpliceSubtree( SubtreeJob_t const &job );
+
+	RayTracingEnvironment &m_Env;
+	bool m_bBinned;
+	int m_nSubtreeJobTris;
+	CUtlVector<SubtreeJob_t *> m_SubtreeJobs;
+};
+
+CKDTreeBuilder::CKDTreeBuilder( RayTracingEnvironment &env, bool bBinned ) : m_Env( env )
+{
+	m_bBinned = bBinned;
+	m_nSubtreeJobTris = 0;
+}
+
+void CKDTreeBuilder::Build( int32 const *tri_list, int ntris, Vector const &MinBound, Vector const &MaxBound )
+{
+	int nThreads = g_pThreadPool ? g_pThreadPool->NumThreads() : 0;
+	// without pool threads everything runs here, and splitting the work only costs memory
+	if ( nThreads )
+		m_nSubtreeJobTris = max( KDTREE_SUBTREE_JOB_MIN_TRIS, ntris / ( 8 * ( nThreads + 1 ) ) );
+
+	RefineNode( m_Env.OptimizedKDTree, m_Env.TriangleIndexList, 0, tri_list, ntris,
+				MinBound, MaxBound, 0, true );
+
+	if ( m_SubtreeJobs.Count() )
+	{
+		// hand out the biggest subtrees first, but splice them in the order they were found
+		CUtlVector<SubtreeJob_t *> jobs;
+		jobs.AddVectorToTail( m_SubtreeJobs );
+		for ( int i = 1; i < jobs.Count(); i++ )
+		{
+			SubtreeJob_t *pJob = jobs[i];
+			int j = i;
+			for ( ; j > 0 && jobs[j - 1]->m_Triangles.Count() < pJob->m_Triangles.Count(); j-- )
+				jobs[j] = jobs[j - 1];
+			jobs[j] = pJob;
+		}
+		ParallelProcess( "CKDTreeBuilder::BuildSubtree", jobs.Base(), jobs.Count(), this, &CKDTreeBuilder::BuildSubtree );
+
+		for ( int i = 0; i < m_SubtreeJobs.Count(); i++ )
+		{
+			SpliceSubtree( *m_SubtreeJobs[i] );
+			delete m_SubtreeJobs[i];
+		}
+		m_SubtreeJobs.Purge();
+	}
+}
+
+void CKDTreeBuilder::BuildSubtree( SubtreeJob_t *&pJob )
+{
+	CacheOptimizedKDNode root;
+	pJob->m_Nodes.AddToTail( root );
+	RefineNode( pJob->m_Nodes, pJob->m_TriangleIndexList, 0, pJob->m_Triangles.Base(),
+				pJob->m_Triangles.Count(), pJob->m_MinBound, pJob->m_MaxBound, pJob->m_nDepth, false );
+}
+
+void CKDTreeBuilder::SpliceSubtree( SubtreeJob_t const &job )
+{
+	// job node n>0 lands at first_node+n-1, triangle index i at first_index+i
+	int first_node = m_Env.OptimizedKDTree.Count();
+	int first_index = m_Env.TriangleIndexList.Count();
+	m_Env.OptimizedKDTree.EnsureCapacity( first_node + job.m_Nodes.Count() - 1 );
+	for ( int n = 0; n < job.m_Nodes.Count(); n++ )
+	{
+		CacheOptimizedKDNode node = job.m_Nodes[n];
+		if ( node.NodeType() == KDNODE_STATE_LEAF )
+			node.Children += first_index << 2;
+		else
+			node.Children += ( first_node - 1 ) << 2;
+		if ( n == 0 )
+			m_Env.OptimizedKDTree[job.m_nNode] = node;
+		else
+			m_Env.OptimizedKDTree.AddToTail( node );
+	}
+	m_Env.TriangleIndexList.AddVectorToTail( job.m_TriangleIndexList );
+}
+
+void CKDTreeBuilder::MakeLeaf( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &tri_indices,
+							   int node_number, int32 const *tri_list, int ntris,
+							   Vector const &MinBound, Vector const &MaxBound )
+{
+	nodes[node_number].Children=KDNODE_STATE_LEAF+(tri_indices.Count()<<2);
+	nodes[node_number].SetNumberOfTrianglesInLeafNode(ntris);
+#ifdef DEBUG_RAYTRACE
+	nodes[node_number].vecMins = MinBound;
+	nodes[node_number].vecMaxs = MaxBound;
+#endif
+	tri_indices.AddMultipleToTail( ntris, tri_list );
+}
+
+void CKDSplitCoster::CostCandidate( KDSplitCandidate_t &candidate )
+{
+	// same counts and cost as CalculateCostsOfSplit, without labelling the triangles
+	int axis=candidate.m_nAxis;
+	float split_value=candidate.m_flTrialValue;
+	int nleft=0,nright=0,nboth=0;
+	float min_coord=1.0e23,max_coord=-1.0e23;
+	for(int t=0;t<m_nTriangles;t++)
+	{
+		CacheOptimizedTriangle const &tri=m_Env.OptimizedTriangleList[m_pTriangles[t]];
+		for(int v=0;v<3;v++)
+		{
+			min_coord = min( min_coord, tri.Vertex(v)[axis] );
+			max_coord = max( max_coord, tri.Vertex(v)[axis] );
+		}
+		switch(tri.ClassifyAgainstAxisSplit(axis,split_value))
+		{
+			case PLANECHECK_NEGATIVE:
+				nleft++;
+				break;
+			case PLANECHECK_POSITIVE:
+				nright++;
+				break;
+			case PLANECHECK_STRADDLING:
+				nboth++;
+				break;
+		}
+	}
+	if (nleft && (nboth==0) && (nright==0))
+		split_value=max_coord;
+	if (nright && (nboth==0) && (nleft==0))
+		split_value=min_coord;
+
+	candidate.m_flSplitValue=split_value;
+	candidate.m_nLeft=nleft;
+	candidate.m_nRight=nright;
+	candidate.m_nBoth=nboth;
+	candidate.m_flCost=CostOfSplit(axis,m_MinBound,m_MaxBound,split_value,nleft,nright,nboth);
+}
+
+void CKDTreeBuilder::CostBinnedSplits( int32 const *tri_list, int ntris, Vector const &MinBound,
+									   Vector const &MaxBound, int axis, KDSplitCandidate_t *pCandidates )
+{
+	const int nSplits = KDTREE_SAH_BINS - 1;
+	float split_values[nSplits];
+	for ( int s = 0; s < nSplits; s++ )
+		split_values[s] = MinBound[axis] + ( MaxBound[axis] - MinBound[axis] ) * ( s + 1 ) * ( 1.0f / KDTREE_SAH_BINS );
+
+	// a triangle is positive of splits [0,nbelow) where nbelow counts the splits <= its
+	// minimum, and negative of the splits from there on that are >= its maximum
+	int positive_until[KDTREE_SAH_BINS + 1];
+	int negative_from[KDTREE_SAH_BINS + 1];
+	memset( positive_until, 0, sizeof( positive_until ) );
+	memset( negative_from, 0, sizeof( negative_from ) );
+	float min_coord=1.0e23,max_coord=-1.0e23;
+	for ( int t = 0; t < ntris; t++ )
+	{
+		CacheOptimizedTriangle const &tri=m_Env.OptimizedTriangleList[tri_list[t]];
+		float minc = tri.Vertex(0)[axis];
+		float maxc = minc;
+		for(int v=1;v<3;v++)
+		{
+			minc=min(minc,tri.Vertex(v)[axis]);
+			maxc=max(maxc,tri.Vertex(v)[axis]);
+		}
+		min_coord = min( min_coord, minc );
+		max_coord = max( max_coord, maxc );
+
+		int nbelow = 0;
+		while ( nbelow < nSplits && split_values[nbelow] <= minc )
+			nbelow++;
+		int nunder = nbelow;
+		while ( nunder < nSplits && split_values[nunder] < maxc )
+			nunder++;
+		positive_until[nbelow]++;
+		negative_from[nunder]++;
+	}
+
+	int nright = ntris - positive_until[0];
+	int nleft = 0;
+	for ( int s = 0; s < nSplits; s++ )
+	{
+		nleft += negative_from[s];
+		KDSplitCandidate_t &candidate = pCandidates[s];
+		candidate.m_nAxis = axis;
+		candidate.m_flTrialValue = split_values[s];
+		candidate.m_flSplitValue = split_values[s];
+		candidate.m_nLeft = nleft;
+		candidate.m_nRight = nright;
+		candidate.m_nBoth = ntris - nleft - nright;
+		if (nleft && (candidate.m_nBoth==0) && (nright==0))
+			candidate.m_flSplitValue=max_coord;
+		if (nright && (candidate.m_nBoth==0) && (nleft==0))
+			candidate.m_flSplitValue=min_coord;
+		candidate.m_flCost = CostOfSplit( axis, MinBound, MaxBound, candidate.m_flSplitValue,
+										  nleft, nright, candidate.m_nBoth );
+		nright -= positive_until[s + 1];
+	}
+}
+
+void CKDTreeBuilder::FindBestSplit( int32 const *tri_list, int ntris, Vector const &MinBound,
+									Vector const &MaxBound, bool bParallel, KDSplitCandidate_t &best )
+{
+	CUtlVectorFixedGrowable<KDSplitCandidate_t, 128> candidates;
+	if ( m_bBinned )
+	{
+		candidates.SetCount( 3 * ( KDTREE_SAH_BINS - 1 ) );
+		for ( int axis = 0; axis < 3; axis++ )
+			CostBinnedSplits( tri_list, ntris, MinBound, MaxBound, axis, &candidates[axis * ( KDTREE_SAH_BINS - 1 )] );
+	}
+	else
+	{
+		// the candidates RefineNode tries, in the same order
+		int tri_skip=1+(ntris/10);
+		for(int axis=0;axis<3;axis++)
+		{
+			KDSplitCandidate_t &mid = candidates[candidates.AddToTail()];
+			mid.m_nAxis=axis;
+			mid.m_flTrialValue=0.5*(MinBound[axis]+MaxBound[axis]);
+			for(int ts=tri_skip-1;ts<ntris;ts+=tri_skip)
+			{
+				CacheOptimizedTriangle const &tri=m_Env.OptimizedTriangleList[tri_list[ts]];
+				for(int tv=0;tv<3;tv++)
+				{
+					float trial_splitvalue = tri.Vertex(tv)[axis];
+					if ((trial_splitvalue>MaxBound[axis]) || (trial_splitvalue<MinBound[axis]))
+						continue;
+					KDSplitCandidate_t &candidate = candidates[candidates.AddToTail()];
+					candidate.m_nAxis=axis;
+					candidate.m_flTrialValue=trial_splitvalue;
+				}
+			}
+		}
+
+		CKDSplitCoster coster( m_Env, tri_list, ntris, MinBound, MaxBound );
+		if ( bParallel )
+		{
+			ParallelProcess( "CKDSplitCoster::CostCandidate", candidates.Base(), candidates.Count(), &coster, &CKDSplitCoster::CostCandidate );
+		}
+		else
+		{
+			for ( int i = 0; i < candidates.Count(); i++ )
+				coster.CostCandidate( candidates[i] );
+		}
+	}
+
+	best.m_flCost=1.0e23;
+	best.m_nAxis=0;
+	best.m_flTrialValue=best.m_flSplitValue=0;
+	best.m_nLeft=best.m_nRight=best.m_nBoth=0;
+	for ( int i = 0; i < candidates.Count(); i++ )
+	{
+		if ( candidates[i].m_flCost < best.m_flCost )
+			best = candidates[i];
+	}
+}
+
+void CKDTreeBuilder::RefineNode( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &tri_indices,
+								 int node_number, int32 const *tri_list, int ntris,
+								 Vector MinBound, Vector MaxBound, int depth, bool bTopLevel )
+{
+	if ( bTopLevel && ntris <= m_nSubtreeJobTris )
+	{
+		SubtreeJob_t *pJob = new SubtreeJob_t;
+		pJob->m_nNode = node_number;
+		pJob->m_nDepth = depth;
+		pJob->m_MinBound = MinBound;
+		pJob->m_MaxBound = MaxBound;
+		pJob->m_Triangles.CopyArray( tri_list, ntris );
+		m_SubtreeJobs.AddToTail( pJob );
+		return;
+	}
+
+	if (ntris<3)											// never split empty lists
+	{
+		MakeLeaf( nodes, tri_indices, node_number, tri_list, ntris, MinBound, MaxBound );
+		return;
+	}
+
+	KDSplitCandidate_t best;
+	FindBestSplit( tri_list, ntris, MinBound, MaxBound,
+				   bTopLevel && ( ntris >= KDTREE_PARALLEL_SPLIT_MIN_TRIS ), best );
+
+	float cost_of_no_split=COST_OF_INTERSECTION*ntris;
+	if ( (cost_of_no_split<=best.m_flCost) || NEVER_SPLIT || (depth>MAX_TREE_DEPTH))
+	{
+		MakeLeaf( nodes, tri_indices, node_number, tri_list, ntris, MinBound, MaxBound );
+		return;
+	}
+
+	// same layout as RefineNode: left in order, then straddling, then right reversed
+	int split_plane=best.m_nAxis;
+	int32 *new_triangle_list=new int32[ntris];
+	int n_left_output=0;
+	int n_both_output=0;
+	int n_right_output=0;
+	for(int t=0;t<ntris;t++)
+	{
+		CacheOptimizedTriangle const &tri=m_Env.OptimizedTriangleList[tri_list[t]];
+		switch( tri.ClassifyAgainstAxisSplit( split_plane, best.m_flTrialValue ) )
+		{
+			case PLANECHECK_NEGATIVE:
+				new_triangle_list[n_left_output++]=tri_list[t];
+				break;
+			case PLANECHECK_POSITIVE:
+				n_right_output++;
+				new_triangle_list[ntris-n_right_output]=tri_list[t];
+				break;
+			case PLANECHECK_STRADDLING:
+				new_triangle_list[best.m_nLeft+n_both_output]=tri_list[t];
+				n_both_output++;
+				break;
+		}
+	}
+	Assert( n_left_output == best.m_nLeft && n_right_output == best.m_nRight && n_both_output == best.m_nBoth );
+
+	Vector LeftMins=MinBound;
+	Vector LeftMaxes=MaxBound;
+	Vector RightMins=MinBound;
+	Vector RightMaxes=MaxBound;
+	LeftMaxes[split_plane]=best.m_flSplitValue;
+	RightMins[split_plane]=best.m_flSplitValue;
+
+	int left_child=nodes.Count();
+	int right_child=left_child+1;
+	nodes[node_number].Children=split_plane+(left_child<<2);
+	nodes[node_number].SplittingPlaneValue=best.m_flSplitValue;
+#ifdef DEBUG_RAYTRACE
+	nodes[node_number].vecMins = MinBound;
+	nodes[node_number].vecMaxs = MaxBound;
+#endif
+	CacheOptimizedKDNode newnode;
+	nodes.AddToTail(newnode);
+	nodes.AddToTail(newnode);
+	if ( (ntris<20) && ((best.m_nLeft==0) || (best.m_nRight==0)) )
+		depth+=100;
+	RefineNode(nodes,tri_indices,left_child,new_triangle_list,best.m_nLeft+best.m_nBoth,
+			   LeftMins,LeftMaxes,depth+1,bTopLevel);
+	RefineNode(nodes,tri_indices,right_child,new_triangle_list+best.m_nLeft,best.m_nRight+best.m_nBoth,
+			   RightMins,RightMaxes,depth+1,bTopLevel);
+	delete[] new_triangle_list;
+}
+
+
 void RayTracingEnvironment::SetupAccelerationStructure(void)
 {
 	CacheOptimizedKDNode root;
@@ -881,7 +1590,13 @@ void RayTracingEnvironment::SetupAccelerationStructure(void)
 		root_triangle_list[t]=t;
 	CalculateTriangleListBounds(root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,
 								m_MaxBound);
-	RefineNode(0,root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,m_MaxBound,0);
+	if ( Flags & RTE_FLAGS_SERIAL_TREE_GENERATION )
+		RefineNode(0,root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,m_MaxBound,0);
+	else
+	{
+		CKDTreeBuilder builder( *this, ( Flags & RTE_FLAGS_FAST_TREE_GENERATION ) != 0 );
+		builder.Build( root_triangle_list, OptimizedTriangleList.Count(), m_MinBound, m_MaxBound );
+	}
 	delete[] root_triangle_list;
 
 	// now, convert all triangles to "intersection format"
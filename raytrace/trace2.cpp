@@ -307,21 +307,37 @@ inline void RayTracingEnvironment::FlushStreamEntry(RayStream &s,int msk)
 {
 	assert(msk>=0);
 	assert(msk<8);
-	fltx4 tmax=s.PendingRays[msk].direction.length();
-	fltx4 scl=ReciprocalSaturateSIMD(tmax);
-	s.PendingRays[msk].direction*=scl;					// normalize
-	RayTracingResult tmpresult;
-	Trace4Rays(s.PendingRays[msk],Four_Zeros,tmax,msk,&tmpresult);
+	// FinishRayStream pads a partial bucket to a whole packet
+	int npackets=(s.n_in_stream[msk]+3)>>2;
+	assert(npackets==1 || npackets==2);
+	fltx4 tmin[2]={Four_Zeros,Four_Zeros};
+	fltx4 tmax[2];
+	for(int p=0;p<npackets;p++)
+	{
+		tmax[p]=s.PendingRays[msk][p].direction.length();
+		fltx4 scl=ReciprocalSaturateSIMD(tmax[p]);
+		s.PendingRays[msk][p].direction*=scl;			// normalize
+	}
+	RayTracingResult tmpresults[2];
+	if ((npackets==2) && !(Flags & RTE_FLAGS_DISABLE_WIDE_TRAVERSAL) && WideTraversalAvailable())
+		Trace8RaysWide(s.PendingRays[msk],tmin,tmax,msk,tmpresults,-1);
+	else
+	{
+		for(int p=0;p<npackets;p++)
+			Trace4Rays(s.PendingRays[msk][p],Four_Zeros,tmax[p],msk,&tmpresults[p]);
+	}
 	// now, write out results
-	for(int r=0;r<4;r++)
+	for(int r=0;r<4*npackets;r++)
 	{
+		int p=r>>2;
+		int l=r&3;
 		RayTracingSingleResult *out=s.PendingStreamOutputs[msk][r];
-		out->ray_length=SubFloat( tmax, r );
-		out->surface_normal.x=tmpresult.surface_normal.X(r);
-		out->surface_normal.y=tmpresult.surface_normal.Y(r);
-		out->surface_normal.z=tmpresult.surface_normal.Z(r);
-		out->HitID=tmpresult.HitIds[r];
-		out->HitDistance=SubFloat( tmpresult.HitDistance, r );
+		out->ray_length=SubFloat( tmax[p], l );
+		out->surface_normal.x=tmpresults[p].surface_normal.X(l);
+		out->surface_normal.y=tmpresults[p].surface_normal.Y(l);
+		out->surface_normal.z=tmpresults[p].surface_normal.Z(l);
+		out->HitID=tmpresults[p].HitIds[l];
+		out->HitDistance=SubFloat( tmpresults[p].HitDistance, l );
 	}
 	s.n_in_stream[msk]=0;
 }
@@ -336,20 +352,21 @@ void RayTracingEnvironment::AddToRayStream(RayStream &s,
 	assert(msk>=0);
 	assert(msk<8);
 	int pos=s.n_in_stream[msk];
-	assert(pos<4);
-	s.PendingRays[msk].origin.X(pos)=start.x;
-	s.PendingRays[msk].origin.Y(pos)=start.y;
-	s.PendingRays[msk].origin.Z(pos)=start.z;
-	s.PendingRays[msk].direction.X(pos)=delta.x;
-	s.PendingRays[msk].direction.Y(pos)=delta.y;
-	s.PendingRays[msk].direction.Z(pos)=delta.z;
+	assert(pos<8);
+	FourRays &rays=s.PendingRays[msk][pos>>2];
+	int l=pos&3;
+	rays.origin.X(l)=start.x;
+	rays.origin.Y(l)=start.y;
+	rays.origin.Z(l)=start.z;
+	rays.direction.X(l)=delta.x;
+	rays.direction.Y(l)=delta.y;
+	rays.direction.Z(l)=delta.z;
 	s.PendingStreamOutputs[msk][pos]=rslt_out;
-	if (pos==3)
+	s.n_in_stream[msk]++;
+	if (pos==7)
 	{
 		FlushStreamEntry(s,msk);
 	}
-	else
-		s.n_in_stream[msk]++;
 }
 
 void RayTracingEnvironment::FinishRayStream(RayStream &s)
@@ -359,15 +376,18 @@ void RayTracingEnvironment::FinishRayStream(RayStream &s)
 		int cnt=s.n_in_stream[msk];
 		if (cnt)
 		{
-			// fill in unfilled entries with dups of first
-			for(int c=cnt;c<4;c++)
+			// fill in unfilled entries of the last packet with dups of first
+			FourRays &first=s.PendingRays[msk][0];
+			FourRays &last=s.PendingRays[msk][(cnt-1)>>2];
+			for(int c=cnt;c&3;c++)
 			{
-				s.PendingRays[msk].origin.X(c) = s.PendingRays[msk].origin.X(0);
-				s.PendingRays[msk].origin.Y(c) = s.PendingRays[msk].origin.Y(0);
-				s.PendingRays[msk].origin.Z(c) = s.PendingRays[msk].origin.Z(0);
-				s.PendingRays[msk].direction.X(c) = s.PendingRays[msk].direction.X(0);
-				s.PendingRays[msk].direction.Y(c) = s.PendingRays[msk].direction.Y(0);
-				s.PendingRays[msk].direction.Z(c) = s.PendingRays[msk].direction.Z(0);
+				int l=c&3;
+				last.origin.X(l) = first.origin.X(0);
+				last.origin.Y(l) = first.origin.Y(0);
+				last.origin.Z(l) = first.origin.Z(0);
+				last.direction.X(l) = first.direction.X(0);
+				last.direction.Y(l) = first.direction.Y(0);
+				last.direction.Z(l) = first.direction.Z(0);
 				s.PendingStreamOutputs[msk][c]=s.PendingStreamOutputs[msk][0];
 			}
 			FlushStreamEntry(s,msk);
@@ -33,19 +33,9 @@ void RayTracingEnvironment::AddBSPFace(int id,dface_t const &face)
 {
 	if (face.dispinfo!=-1)									// displacements must be dealt with elsewhere
 		return;
-	texinfo_t *tx =(face.texinfo>=0)?&(texinfo[face.texinfo]):0;
+// 	texinfo_t *tx =(face.texinfo>=0)?&(texinfo[face.texinfo]):0;
 // 	if (tx && (tx->flags & (SURF_SKY|SURF_NODRAW)))
 // 		return;
-	if (tx)
-	{
-		printf("id %d flags=%x\n",id,tx->flags);
-	}
-	printf("side: ");
-	for(int v=0;v<face.numedges;v++)
-	{
-		printf("(%f %f %f) ",XYZ(VertCoord(face,v)));
-	}
-	printf("\n");
 	int ntris=face.numedges-2;
 	for(int tri=0;tri<ntris;tri++)
 	{
@@ -118,8 +108,7 @@ void RayTracingEnvironment::InitializeFromLoadedBSP(void)
 // 	}
 	for(int c=0;c<numfaces;c++)
 	{
-//		dface_t const &f=dfaces[c];
-		AddBSPFace(c,dorigfaces[c]);
+		AddBSPFace(c,dfaces[c]);
 	}
 
 //	AddTriangle(1234,Vector(51,145,-700),Vector(71,165,-700),Vector(51,165,-700),colors[5]);
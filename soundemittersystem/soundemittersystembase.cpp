@@ -17,6 +17,7 @@
 #include "checksum_crc.h"
 #include "SoundEmitterSystem/isoundemittersystembase.h"
 #include "ifilelist.h"
+#include "tier0/icommandline.h"
 
 #include <time.h>
 
@@ -28,6 +29,12 @@
 
 static IFileSystem* filesystem = 0;
 
+struct ManifestScriptFile_t
+{
+	CUtlString	name;
+	bool		preload;
+};
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -174,6 +181,23 @@ static void AccumulateFileNameAndTimestampIntoChecksum( CRC32_t *crc, char const
 	CRC32_ProcessBuffer( crc, filename, Q_strlen( filename ) );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Helper for checksuming what the script files and manifest hold, to
+//  key the compiled scripts on. File times are 0 for files in VPKs and pack
+//  files, so they can't tell whether the compiled scripts are stale.
+// Input  : *crc - 
+//			*filename - 
+//-----------------------------------------------------------------------------
+static void AccumulateFileNameAndContentsIntoChecksum( CRC32_t *crc, char const *filename )
+{
+	CUtlBuffer buf;
+	if ( filesystem->ReadFile( filename, "GAME", buf ) )
+	{
+		CRC32_ProcessBuffer( crc, buf.Base(), buf.TellPut() );
+	}
+	CRC32_ProcessBuffer( crc, filename, Q_strlen( filename ) );
+}
+
 
 //-----------------------------------------------------------------------------
 // Purpose: 
@@ -188,6 +212,8 @@ bool CSoundEmitterSystemBase::InternalModInit()
 	}
 	*/
 
+	double flStartTime = Plat_FloatTime();
+
 	LoadGlobalActors();
 
 	m_uManifestPlusScriptChecksum = 0u;
@@ -195,6 +221,10 @@ bool CSoundEmitterSystemBase::InternalModInit()
 	CRC32_t crc;
 	CRC32_Init( &crc );
 
+	// The checksum decides whether the compiled scripts can be used, so the
+	// whole list is gathered before any of the files are loaded
+	CUtlVector< ManifestScriptFile_t > scriptFiles;
+
 	KeyValues *manifest = new KeyValues( MANIFEST_FILE );
 	if ( filesystem->LoadKeyValues( *manifest, IFileSystem::TYPE_SOUNDEMITTER, MANIFEST_FILE, "GAME" ) )
 	{
@@ -207,7 +237,9 @@ bool CSoundEmitterSystemBase::InternalModInit()
 				AccumulateFileNameAndTimestampIntoChecksum( &crc, sub->GetString() );
 
 				// Add and always precache
-				AddSoundsFromFile( sub->GetString(), false );
+				ManifestScriptFile_t &file = scriptFiles[ scriptFiles.AddToTail() ];
+				file.name = sub->GetString();
+				file.preload = false;
 				continue;
 			}
 			else if ( !Q_stricmp( sub->GetName(), "preload_file" ) )
@@ -215,7 +247,9 @@ bool CSoundEmitterSystemBase::InternalModInit()
 				AccumulateFileNameAndTimestampIntoChecksum( &crc, sub->GetString() );
 
 				// Add and always precache
-				AddSoundsFromFile( sub->GetString(), true );
+				ManifestScriptFile_t &file = scriptFiles[ scriptFiles.AddToTail() ];
+				file.name = sub->GetString();
+				file.preload = true;
 				continue;
 			}
 			else if ( !Q_stricmp( sub->GetName(), "faceposer_file" ) )
@@ -238,9 +272,42 @@ bool CSoundEmitterSystemBase::InternalModInit()
 
 	m_uManifestPlusScriptChecksum =( unsigned int )crc;
 
+	// The compiled scripts are only written when asked for, with -writesoundscriptcache.
+	// They are keyed on the bytes of the manifest and scripts, not on their times.
+	bool bUseCache = !IsX360() && !CommandLine()->CheckParm( "-nosoundscriptcache" );
+	bool bWriteCache = bUseCache && CommandLine()->CheckParm( "-writesoundscriptcache" );
+	unsigned int uContentsChecksum = 0u;
+	if ( bUseCache )
+	{
+		CRC32_t contentsCRC;
+		CRC32_Init( &contentsCRC );
+		AccumulateFileNameAndContentsIntoChecksum( &contentsCRC, MANIFEST_FILE );
+		for ( int i = 0; i < scriptFiles.Count(); i++ )
+		{
+			AccumulateFileNameAndContentsIntoChecksum( &contentsCRC, scriptFiles[ i ].name.Get() );
+		}
+		CRC32_Final( &contentsCRC );
+		uContentsChecksum = ( unsigned int )contentsCRC;
+	}
+
+	bool bFromCache = bUseCache && !bWriteCache && AddSoundsFromCache( uContentsChecksum );
+	if ( !bFromCache )
+	{
+		for ( int i = 0; i < scriptFiles.Count(); i++ )
+		{
+			AddSoundsFromFile( scriptFiles[ i ].name.Get(), scriptFiles[ i ].preload );
+		}
+
+		if ( bWriteCache )
+		{
+			WriteSoundsToCache( uContentsChecksum );
+		}
+	}
+
 // Only print total once, on server
 #if !defined( CLIENT_DLL ) && !defined( FACEPOSER )
-	DevMsg( 1, "CSoundEmitterSystem:  Registered %i sounds\n", m_Sounds.Count() );
+	DevMsg( 1, "CSoundEmitterSystem:  Registered %i sounds from %s in %.1f ms\n", m_Sounds.Count(),
+		bFromCache ? "compiled scripts" : "script files", ( Plat_FloatTime() - flStartTime ) * 1000.0 );
 #endif
 
 	return true;
@@ -286,6 +353,9 @@ void CSoundEmitterSystemBase::InternalModShutdown()
 	m_SavedOverrides.Purge();
 	m_Waves.RemoveAll();
 	m_ActorGenders.Purge();
+
+	m_ScriptCache.Unload();
+	m_CacheHandles.Purge();
 }
 
 
@@ -309,8 +379,20 @@ int	CSoundEmitterSystemBase::GetSoundIndex( const char *pName ) const
 	if ( !pName )
 		return -1;
 
-	CSoundEntry search;
-	search.m_Name = pName;
+	// Names from the compiled scripts resolve with a single probe. The handle is
+	// checked against the live entry, so sounds renamed, removed or added since
+	// the scripts were loaded fall through to the table.
+	if ( m_ScriptCache.IsLoaded() )
+	{
+		int nEntry = m_ScriptCache.FindCandidate( pName );
+		if ( nEntry >= 0 )
+		{
+			UtlHashHandle_t h = m_CacheHandles[ nEntry ];
+			if ( m_Sounds.IsValidHandle( h ) && !Q_stricmp( m_Sounds[ h ]->m_Name.Get(), pName ) )
+				return h;
+		}
+	}
+
 	UtlHashHandle_t idx = m_Sounds.Find( pName );
 	if ( idx == m_Sounds.InvalidHandle() )
 		return -1;
@@ -358,25 +440,21 @@ void CSoundEmitterSystemBase::EnsureAvailableSlotsForGender( SoundFile *pSoundna
 		return;
 	}
 
-	CUtlVector< int > slots;
-
 	bool needsreset = false;
 	for ( i = 0; i < c; i++ )
 	{
 		if ( pSoundnames[ i ].gender != gender )
 			continue;
 
+		// Something is still available for the gender, nothing to reset
+		if ( pSoundnames[ i ].available )
+			return;
+
 		// There was at least one match for the gender
 		needsreset = true;
-
-		// This sound is unavailable
-		if ( !pSoundnames[ i ].available )
-			continue;
-
-		slots.AddToTail( i );
 	}
 
-	if ( slots.Count() == 0 && needsreset )
+	if ( needsreset )
 	{
 		// Reset all slots for the specified gender!!!
 		for ( i = 0; i < c; i++ )
@@ -390,7 +468,8 @@ void CSoundEmitterSystemBase::EnsureAvailableSlotsForGender( SoundFile *pSoundna
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: 
+// Purpose: Runs for every emitted sound, so the available slots are counted
+//  and walked again rather than collected into a list.
 // Input  : gender - 
 //			soundnames - 
 //-----------------------------------------------------------------------------
@@ -404,21 +483,28 @@ int	CSoundEmitterSystemBase::FindBestSoundForGender( SoundFile *pSoundnames, int
 		return -1;
 	}
 
-	CUtlVector< int > slots;
-
+	int slots = 0;
 	for ( int i = 0; i < c; i++ )
 	{
 		if ( pSoundnames[ i ].gender == gender &&
 			 pSoundnames[ i ].available )
 		{
-			slots.AddToTail( i );
+			++slots;
 		}
 	}
 
-	if ( slots.Count() >= 1 )
+	if ( slots >= 1 )
 	{
-		int idx = slots[ randomStream->RandomInt( 0, slots.Count() - 1 ) ];
-		return idx;
+		int pick = randomStream->RandomInt( 0, slots - 1 );
+		for ( int i = 0; i < c; i++ )
+		{
+			if ( pSoundnames[ i ].gender == gender &&
+				 pSoundnames[ i ].available &&
+				 pick-- == 0 )
+			{
+				return i;
+			}
+		}
 	}
 
 	int idx = randomStream->RandomInt( 0, c - 1 );
@@ -951,6 +1037,183 @@ void CSoundEmitterSystemBase::AddSoundsFromFile( const char *filename, bool bPre
 	Assert( scriptindex >= 0 );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Fills in the sounds from the compiled scripts, if they were built
+//  from the current manifest and script files.
+// Input  : checksum - of the manifest and script file names and contents
+//-----------------------------------------------------------------------------
+bool CSoundEmitterSystemBase::AddSoundsFromCache( unsigned int checksum )
+{
+	if ( !m_ScriptCache.Load( filesystem, SOUNDSCRIPTCACHE_FILENAME, "MOD", checksum ) )
+		return false;
+
+	Assert( m_Sounds.Count() == 0 && m_SoundKeyValues.Count() == 0 );
+
+	int i;
+	for ( i = 0; i < m_ScriptCache.GetScriptCount(); i++ )
+	{
+		CSoundScriptFile sf;
+		sf.hFilename = filesystem->FindOrAddFileName( m_ScriptCache.GetScriptName( i ) );
+		sf.dirty = false;
+		m_SoundKeyValues.AddToTail( sf );
+	}
+
+	// Each wave goes in the symbol table once, the entries refer to it by index
+	CUtlVector< CUtlSymbol > waves;
+	waves.SetCount( m_ScriptCache.GetWaveCount() );
+	for ( i = 0; i < waves.Count(); i++ )
+	{
+		waves[ i ] = m_Waves.AddString( m_ScriptCache.GetWaveName( i ) );
+	}
+
+	m_CacheHandles.SetCount( m_ScriptCache.GetEntryCount() );
+	for ( i = 0; i < m_ScriptCache.GetEntryCount(); i++ )
+	{
+		const SoundScriptCacheEntry_t &entry = m_ScriptCache.GetEntry( i );
+
+		MEM_ALLOC_CREDIT();
+
+		CSoundEntry *pEntry = new CSoundEntry;
+		pEntry->m_Name = m_ScriptCache.GetEntryName( i );
+		pEntry->m_bRemoved			= false;
+		pEntry->m_nScriptFileIndex	= entry.scriptIndex;
+		pEntry->m_bIsOverride		= false;
+
+		CSoundParametersInternal &params = pEntry->m_SoundParams;
+		params.SetChannel( entry.channel );
+		params.SetVolume( entry.volumeStart, entry.volumeRange );
+		params.SetPitch( entry.pitchStart, entry.pitchRange );
+		params.SetSoundLevel( entry.soundLevelStart, entry.soundLevelRange );
+		params.SetDelayMsec( entry.delayMsec );
+		params.SetOnlyPlayToOwner( ( entry.flags & SOUNDSCRIPTCACHE_PLAY_TO_OWNER_ONLY ) != 0 );
+		params.SetUsesGenderToken( ( entry.flags & SOUNDSCRIPTCACHE_USES_GENDER_TOKEN ) != 0 );
+		params.SetShouldPreload( ( entry.flags & SOUNDSCRIPTCACHE_PRELOAD ) != 0 );
+
+		int count = entry.numSoundNames + entry.numConvertedNames;
+		for ( int j = 0; j < count; j++ )
+		{
+			const SoundScriptCacheSoundFile_t &soundFile = m_ScriptCache.GetSoundFile( entry.firstSoundFile + j );
+
+			SoundFile e;
+			e.symbol = waves[ soundFile.wave ];
+			e.gender = soundFile.gender;
+			if ( j < entry.numSoundNames )
+			{
+				params.AddSoundName( e );
+			}
+			else
+			{
+				params.AddConvertedName( e );
+			}
+		}
+
+		m_CacheHandles[ i ] = m_Sounds.Insert( pEntry );
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Compiles the sounds just parsed from the script files, then loads
+//  the result for GetSoundIndex.
+// Input  : checksum - of the manifest and script file names and contents
+//-----------------------------------------------------------------------------
+void CSoundEmitterSystemBase::WriteSoundsToCache( unsigned int checksum )
+{
+	CSoundScriptCacheBuilder builder;
+
+	int i;
+	for ( i = 0; i < m_SoundKeyValues.Count(); i++ )
+	{
+		builder.AddScript( GetSoundScriptName( i ) );
+	}
+
+	// Symbol -> index of the wave in the cache, waves are numbered as they are first used
+	CUtlVector< int > waveIndices;
+
+	for ( UtlHashHandle_t h = m_Sounds.FirstHandle(); h != m_Sounds.InvalidHandle(); h = m_Sounds.NextHandle( h ) )
+	{
+		const CSoundEntry *pEntry = m_Sounds[ h ];
+		const CSoundParametersInternal &params = pEntry->m_SoundParams;
+
+		SoundScriptCacheEntry_t entry;
+		V_memset( &entry, 0, sizeof( entry ) );
+		entry.scriptIndex		= pEntry->m_nScriptFileIndex;
+		entry.channel			= params.GetChannel();
+		entry.volumeStart		= params.GetVolume().start;
+		entry.volumeRange		= params.GetVolume().range;
+		entry.soundLevelStart	= params.GetSoundLevel().start;
+		entry.soundLevelRange	= params.GetSoundLevel().range;
+		entry.pitchStart		= params.GetPitch().start;
+		entry.pitchRange		= params.GetPitch().range;
+		entry.delayMsec			= params.GetDelayMsec();
+		entry.flags				= ( params.OnlyPlayToOwner() ? SOUNDSCRIPTCACHE_PLAY_TO_OWNER_ONLY : 0 ) |
+								  ( params.UsesGenderToken() ? SOUNDSCRIPTCACHE_USES_GENDER_TOKEN : 0 ) |
+								  ( params.ShouldPreload() ? SOUNDSCRIPTCACHE_PRELOAD : 0 );
+		entry.numSoundNames		= params.NumSoundNames();
+		entry.numConvertedNames	= params.NumConvertedNames();
+		entry.firstSoundFile	= -1;
+
+		int count = entry.numSoundNames + entry.numConvertedNames;
+		for ( int j = 0; j < count; j++ )
+		{
+			const SoundFile &e = ( j < entry.numSoundNames ) ? params.GetSoundNames()[ j ] : params.GetConvertedNames()[ j - entry.numSoundNames ];
+
+			UtlSymId_t sym = e.symbol;
+			while ( waveIndices.Count() <= sym )
+			{
+				waveIndices.AddToTail( -1 );
+			}
+			if ( waveIndices[ sym ] < 0 )
+			{
+				waveIndices[ sym ] = builder.AddWave( m_Waves.String( e.symbol ) );
+			}
+
+			int soundFile = builder.AddSoundFile( waveIndices[ sym ], e.gender );
+			if ( entry.firstSoundFile < 0 )
+			{
+				entry.firstSoundFile = soundFile;
+			}
+		}
+		entry.firstSoundFile = MAX( entry.firstSoundFile, 0 );
+
+		builder.AddEntry( pEntry->m_Name.Get(), entry );
+	}
+
+	if ( !builder.Write( filesystem, SOUNDSCRIPTCACHE_FILENAME, "MOD", checksum ) )
+	{
+		DevMsg( "CSoundEmitterSystem:  Unable to write %s\n", SOUNDSCRIPTCACHE_FILENAME );
+		return;
+	}
+
+	// The entries were written in handle order
+	if ( m_ScriptCache.Load( filesystem, SOUNDSCRIPTCACHE_FILENAME, "MOD", checksum ) )
+	{
+		m_CacheHandles.SetCount( m_ScriptCache.GetEntryCount() );
+		i = 0;
+		for ( UtlHashHandle_t h = m_Sounds.FirstHandle(); h != m_Sounds.InvalidHandle(); h = m_Sounds.NextHandle( h ) )
+		{
+			m_CacheHandles[ i++ ] = h;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Points the compiled entry of a sound that was put back in the table
+//  at its new handle.
+//-----------------------------------------------------------------------------
+void CSoundEmitterSystemBase::UpdateCacheHandle( UtlHashHandle_t handle )
+{
+	if ( !m_ScriptCache.IsLoaded() )
+		return;
+
+	int nEntry = m_ScriptCache.Find( m_Sounds[ handle ]->m_Name.Get() );
+	if ( nEntry >= 0 )
+	{
+		m_CacheHandles[ nEntry ] = handle;
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Reload a sound emitter file (used to refresh files after sv_pure is turned on)
 //-----------------------------------------------------------------------------
@@ -1185,7 +1448,7 @@ bool CSoundEmitterSystemBase::AddSound( const char *soundname, const char *scrip
 	pEntry->m_nScriptFileIndex	= i;
 	pEntry->m_SoundParams.CopyFrom( params );
 
-	m_Sounds.Insert( pEntry );
+	UpdateCacheHandle( m_Sounds.Insert( pEntry ) );
 
 	m_SoundKeyValues[ i ].dirty = true;
 
@@ -1470,7 +1733,7 @@ void CSoundEmitterSystemBase::RenameSound( const char *soundname, const char *ne
 	m_Sounds.Remove( pEntry );
 	pEntry->m_Name = newname;
 	// Re-insert in new spot
-	m_Sounds.Insert( pEntry );
+	UpdateCacheHandle( m_Sounds.Insert( pEntry ) );
 
 	// Mark associated script as dirty
 	m_SoundKeyValues[ pEntry->m_nScriptFileIndex ].dirty = true;
@@ -1653,7 +1916,7 @@ void CSoundEmitterSystemBase::ClearSoundOverrides()
 	for ( i = 0; i < m_SavedOverrides.Count(); ++i )
 	{
 		CSoundEntry *entry = m_SavedOverrides[ i ];
-		m_Sounds.Insert( entry );
+		UpdateCacheHandle( m_Sounds.Insert( entry ) );
 	}
 
 	m_SavedOverrides.Purge();
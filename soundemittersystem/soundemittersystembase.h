@@ -17,6 +17,7 @@
 #include "UtlSortVector.h"
 #include <tier1/utlstring.h>
 #include <tier1/utlhashtable.h>
+#include "soundscriptcache.h"
 
 soundlevel_t TextToSoundLevel( const char *key );
 
@@ -149,6 +150,10 @@ private:
 
 	void AddSoundsFromFile( const char *filename, bool bPreload, bool bIsOverride = false, bool bRefresh = false );
 
+	bool AddSoundsFromCache( unsigned int checksum );
+	void WriteSoundsToCache( unsigned int checksum );
+	void UpdateCacheHandle( UtlHashHandle_t handle );
+
 	bool		InitSoundInternalParameters( const char *soundname, KeyValues *kv, CSoundParametersInternal& params );
 
 	void LoadGlobalActors();
@@ -178,6 +183,10 @@ private:
 	unsigned int		m_uManifestPlusScriptChecksum;
 
 	CUtlSymbolTable		m_Waves;
+
+	// Compiled scripts, kept loaded for the perfect hash in GetSoundIndex
+	CSoundScriptCache				m_ScriptCache;
+	CUtlVector< UtlHashHandle_t >	m_CacheHandles;		// m_Sounds handle of each cache entry
 };
 
 #endif // SOUNDEMITTERSYSTEMBASE_H
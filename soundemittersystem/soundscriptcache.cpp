@@ -0,0 +1,515 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compiled sound scripts, see soundscriptcache.h
+//
+//===========================================================================//
+
+#include "soundscriptcache.h"
+#include "filesystem.h"
+#include "tier1/strtools.h"
+#include "tier1/generichash.h"
+
+#ifdef POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// Seeds tried per bucket before the table is rebuilt with more slots
+#define SOUNDSCRIPTCACHE_MAX_SEED	( 1 << 16 )
+
+
+//-----------------------------------------------------------------------------
+// Perfect hash. A name goes to bucket hash % numBuckets, and each bucket has
+// a seed that scatters its names into free slots. A lookup is one string
+// hash and one compare against the only name that can be in its slot.
+//-----------------------------------------------------------------------------
+static inline unsigned int SoundScriptCache_Slot( unsigned int nHash, uint32 nSeed, int nSlots )
+{
+	unsigned int h = nHash ^ nSeed;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h % (unsigned int)nSlots;
+}
+
+struct PerfectHashBucket_t
+{
+	int		bucket;
+	int		first;		// Into the sorted key list
+	int		count;
+};
+
+struct PerfectHashKey_t
+{
+	unsigned int	hash;
+	int				entry;
+};
+
+static int __cdecl PerfectHashKeyCompare( const PerfectHashKey_t *pLeft, const PerfectHashKey_t *pRight )
+{
+	if ( pLeft->hash != pRight->hash )
+		return ( pLeft->hash < pRight->hash ) ? -1 : 1;
+	return pLeft->entry - pRight->entry;
+}
+
+static int __cdecl PerfectHashBucketCompare( const PerfectHashBucket_t *pLeft, const PerfectHashBucket_t *pRight )
+{
+	if ( pLeft->count != pRight->count )
+		return pRight->count - pLeft->count;
+	return pLeft->bucket - pRight->bucket;
+}
+
+//-----------------------------------------------------------------------------
+// Names whose hashes collide can't be told apart by any seed; only the first
+// of them goes in the table and the rest are left to the caller's fallback.
+//-----------------------------------------------------------------------------
+static void BuildPerfectHash( const CUtlVector<unsigned int> &hashes, CUtlVector<uint32> &buckets, CUtlVector<int> &slots )
+{
+	CUtlVector<PerfectHashKey_t> keys;
+	for ( int i = 0; i < hashes.Count(); i++ )
+	{
+		PerfectHashKey_t key = { hashes[i], i };
+		keys.AddToTail( key );
+	}
+	keys.Sort( PerfectHashKeyCompare );
+
+	int nUnique = 0;
+	for ( int i = 0; i < keys.Count(); i++ )
+	{
+		if ( i == 0 || keys[i].hash != keys[nUnique - 1].hash )
+		{
+			keys[nUnique++] = keys[i];
+		}
+	}
+	keys.SetCountNonDestructively( nUnique );
+
+	int nBuckets = MAX( 1, nUnique / 4 );
+	int nSlots = MAX( 1, nUnique + nUnique / 4 );
+
+	CUtlVector<int> slotEntries;
+	CUtlVector<unsigned int> candidates;
+	for ( ;; )
+	{
+		// Group the keys by bucket, biggest buckets get placed first
+		CUtlVector<PerfectHashKey_t> sorted;
+		sorted.SetCount( nUnique );
+		CUtlVector<PerfectHashBucket_t> order;
+		order.SetCount( nBuckets );
+		for ( int b = 0; b < nBuckets; b++ )
+		{
+			order[b].bucket = b;
+			order[b].count = 0;
+		}
+		for ( int i = 0; i < nUnique; i++ )
+		{
+			order[ keys[i].hash % nBuckets ].count++;
+		}
+		int nFirst = 0;
+		for ( int b = 0; b < nBuckets; b++ )
+		{
+			order[b].first = nFirst;
+			nFirst += order[b].count;
+			order[b].count = 0;
+		}
+		for ( int i = 0; i < nUnique; i++ )
+		{
+			PerfectHashBucket_t &bucket = order[ keys[i].hash % nBuckets ];
+			sorted[ bucket.first + bucket.count++ ] = keys[i];
+		}
+		order.Sort( PerfectHashBucketCompare );
+
+		buckets.SetCount( nBuckets );
+		V_memset( buckets.Base(), 0, nBuckets * sizeof( uint32 ) );
+		slotEntries.SetCount( nSlots );
+		for ( int s = 0; s < nSlots; s++ )
+		{
+			slotEntries[s] = -1;
+		}
+
+		bool bPlaced = true;
+		for ( int b = 0; b < nBuckets && bPlaced && order[b].count; b++ )
+		{
+			const PerfectHashBucket_t &bucket = order[b];
+			candidates.SetCount( bucket.count );
+
+			bPlaced = false;
+			for ( uint32 nSeed = 0; nSeed < SOUNDSCRIPTCACHE_MAX_SEED && !bPlaced; nSeed++ )
+			{
+				bPlaced = true;
+				for ( int k = 0; k < bucket.count && bPlaced; k++ )
+				{
+					unsigned int nSlot = SoundScriptCache_Slot( sorted[ bucket.first + k ].hash, nSeed, nSlots );
+					bPlaced = ( slotEntries[nSlot] < 0 );
+					for ( int j = 0; j < k && bPlaced; j++ )
+					{
+						bPlaced = ( candidates[j] != nSlot );
+					}
+					candidates[k] = nSlot;
+				}
+
+				if ( bPlaced )
+				{
+					buckets[ bucket.bucket ] = nSeed;
+					for ( int k = 0; k < bucket.count; k++ )
+					{
+						slotEntries[ candidates[k] ] = sorted[ bucket.first + k ].entry;
+					}
+				}
+			}
+		}
+
+		if ( bPlaced )
+			break;
+
+		nSlots += nSlots / 8 + 1;
+	}
+
+	slots.Swap( slotEntries );
+}
+
+
+//-----------------------------------------------------------------------------
+// Constructor, destructor
+//-----------------------------------------------------------------------------
+CSoundScriptCache::CSoundScriptCache() :
+	m_pBase( NULL ),
+	m_nSize( 0 ),
+	m_bMapped( false ),
+	m_pHeader( NULL ),
+	m_pScripts( NULL ),
+	m_pWaves( NULL ),
+	m_pEntries( NULL ),
+	m_pSoundFiles( NULL ),
+	m_pBuckets( NULL ),
+	m_pSlots( NULL )
+{
+}
+
+CSoundScriptCache::~CSoundScriptCache()
+{
+	Unload();
+}
+
+
+//-----------------------------------------------------------------------------
+// Every offset and index is checked here, so lookups don't have to
+//-----------------------------------------------------------------------------
+static bool IsRangeValid( int nOffset, int nCount, int nElementSize, int nSize )
+{
+	return nOffset >= (int)sizeof( SoundScriptCacheHeader_t ) && nCount >= 0 &&
+		nOffset <= nSize && (int64)nCount * nElementSize <= nSize - nOffset;
+}
+
+static bool IsCacheValid( const byte *pBase, int nSize, unsigned int nManifestChecksum )
+{
+	const SoundScriptCacheHeader_t *pHeader = (const SoundScriptCacheHeader_t *)pBase;
+	if ( nSize < (int)sizeof( SoundScriptCacheHeader_t ) ||
+		pHeader->id != SOUNDSCRIPTCACHE_ID ||
+		pHeader->version != SOUNDSCRIPTCACHE_VERSION ||
+		pHeader->manifestChecksum != nManifestChecksum )
+		return false;
+
+	if ( !IsRangeValid( pHeader->scriptOffset, pHeader->numScripts, sizeof( int ), nSize ) ||
+		!IsRangeValid( pHeader->waveOffset, pHeader->numWaves, sizeof( int ), nSize ) ||
+		!IsRangeValid( pHeader->entryOffset, pHeader->numEntries, sizeof( SoundScriptCacheEntry_t ), nSize ) ||
+		!IsRangeValid( pHeader->soundFileOffset, pHeader->numSoundFiles, sizeof( SoundScriptCacheSoundFile_t ), nSize ) ||
+		!IsRangeValid( pHeader->bucketOffset, pHeader->numBuckets, sizeof( uint32 ), nSize ) ||
+		!IsRangeValid( pHeader->slotOffset, pHeader->numSlots, sizeof( int ), nSize ) ||
+		!IsRangeValid( pHeader->stringOffset, pHeader->stringSize, 1, nSize ) ||
+		pHeader->numBuckets <= 0 || pHeader->numSlots <= 0 ||
+		( pHeader->stringSize > 0 && pBase[ pHeader->stringOffset + pHeader->stringSize - 1 ] != 0 ) )
+		return false;
+
+	CRC32_t crc = CRC32_ProcessSingleBuffer( pBase + sizeof( SoundScriptCacheHeader_t ), nSize - sizeof( SoundScriptCacheHeader_t ) );
+	if ( crc != pHeader->contentCRC )
+		return false;
+
+	int nStringEnd = pHeader->stringOffset + pHeader->stringSize;
+	const int *pScripts = (const int *)( pBase + pHeader->scriptOffset );
+	for ( int i = 0; i < pHeader->numScripts; i++ )
+	{
+		if ( pScripts[i] < pHeader->stringOffset || pScripts[i] >= nStringEnd )
+			return false;
+	}
+
+	const int *pWaves = (const int *)( pBase + pHeader->waveOffset );
+	for ( int i = 0; i < pHeader->numWaves; i++ )
+	{
+		if ( pWaves[i] < pHeader->stringOffset || pWaves[i] >= nStringEnd )
+			return false;
+	}
+
+	const SoundScriptCacheEntry_t *pEntries = (const SoundScriptCacheEntry_t *)( pBase + pHeader->entryOffset );
+	for ( int i = 0; i < pHeader->numEntries; i++ )
+	{
+		const SoundScriptCacheEntry_t &entry = pEntries[i];
+		if ( entry.nameOffset < pHeader->stringOffset || entry.nameOffset >= nStringEnd ||
+			entry.scriptIndex >= pHeader->numScripts ||
+			entry.firstSoundFile < 0 ||
+			entry.firstSoundFile + entry.numSoundNames + entry.numConvertedNames > pHeader->numSoundFiles )
+			return false;
+	}
+
+	const SoundScriptCacheSoundFile_t *pSoundFiles = (const SoundScriptCacheSoundFile_t *)( pBase + pHeader->soundFileOffset );
+	for ( int i = 0; i < pHeader->numSoundFiles; i++ )
+	{
+		if ( pSoundFiles[i].wave < 0 || pSoundFiles[i].wave >= pHeader->numWaves )
+			return false;
+	}
+
+	const int *pSlots = (const int *)( pBase + pHeader->slotOffset );
+	for ( int i = 0; i < pHeader->numSlots; i++ )
+	{
+		if ( pSlots[i] < -1 || pSlots[i] >= pHeader->numEntries )
+			return false;
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Maps the cache and checks it was built from the current scripts
+//-----------------------------------------------------------------------------
+bool CSoundScriptCache::Load( IFileSystem *pFileSystem, const char *pszFileName, const char *pszPathID, unsigned int nManifestChecksum )
+{
+	Unload();
+
+	const byte *pBase = NULL;
+	int nSize = 0;
+	bool bMapped = false;
+
+#ifdef POSIX
+	char szFullPath[MAX_PATH];
+	if ( pFileSystem->RelativePathToFullPath( pszFileName, pszPathID, szFullPath, sizeof( szFullPath ) ) )
+	{
+		int fd = open( szFullPath, O_RDONLY );
+		if ( fd >= 0 )
+		{
+			struct stat st;
+			if ( fstat( fd, &st ) == 0 && st.st_size > 0 && st.st_size < INT_MAX )
+			{
+				void *pMap = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+				if ( pMap != MAP_FAILED )
+				{
+					pBase = (const byte *)pMap;
+					nSize = (int)st.st_size;
+					bMapped = true;
+				}
+			}
+			close( fd );
+		}
+	}
+#endif
+
+	if ( !pBase )
+	{
+		CUtlBuffer buf;
+		if ( !pFileSystem->ReadFile( pszFileName, pszPathID, buf ) )
+			return false;
+
+		nSize = buf.TellMaxPut();
+		byte *pCopy = (byte *)malloc( nSize );
+		V_memcpy( pCopy, buf.Base(), nSize );
+		pBase = pCopy;
+	}
+
+	if ( !IsCacheValid( pBase, nSize, nManifestChecksum ) )
+	{
+#ifdef POSIX
+		if ( bMapped )
+		{
+			munmap( (void *)pBase, nSize );
+		}
+		else
+#endif
+		{
+			free( (void *)pBase );
+		}
+		return false;
+	}
+
+	m_pBase = pBase;
+	m_nSize = nSize;
+	m_bMapped = bMapped;
+	m_pHeader = (const SoundScriptCacheHeader_t *)pBase;
+	m_pScripts = (const int *)( pBase + m_pHeader->scriptOffset );
+	m_pWaves = (const int *)( pBase + m_pHeader->waveOffset );
+	m_pEntries = (const SoundScriptCacheEntry_t *)( pBase + m_pHeader->entryOffset );
+	m_pSoundFiles = (const SoundScriptCacheSoundFile_t *)( pBase + m_pHeader->soundFileOffset );
+	m_pBuckets = (const uint32 *)( pBase + m_pHeader->bucketOffset );
+	m_pSlots = (const int *)( pBase + m_pHeader->slotOffset );
+	return true;
+}
+
+void CSoundScriptCache::Unload()
+{
+	if ( !m_pBase )
+		return;
+
+#ifdef POSIX
+	if ( m_bMapped )
+	{
+		munmap( (void *)m_pBase, m_nSize );
+	}
+	else
+#endif
+	{
+		free( (void *)m_pBase );
+	}
+
+	m_pBase = NULL;
+	m_nSize = 0;
+	m_bMapped = false;
+	m_pHeader = NULL;
+	m_pScripts = NULL;
+	m_pWaves = NULL;
+	m_pEntries = NULL;
+	m_pSoundFiles = NULL;
+	m_pBuckets = NULL;
+	m_pSlots = NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// Lookups
+//-----------------------------------------------------------------------------
+int CSoundScriptCache::FindCandidate( const char *pszName ) const
+{
+	unsigned int nHash = HashStringCaselessConventional( pszName );
+	uint32 nSeed = m_pBuckets[ nHash % (unsigned int)m_pHeader->numBuckets ];
+	return m_pSlots[ SoundScriptCache_Slot( nHash, nSeed, m_pHeader->numSlots ) ];
+}
+
+int CSoundScriptCache::Find( const char *pszName ) const
+{
+	int nEntry = FindCandidate( pszName );
+	if ( nEntry < 0 || Q_stricmp( GetEntryName( nEntry ), pszName ) )
+		return -1;
+	return nEntry;
+}
+
+
+//-----------------------------------------------------------------------------
+// Builder
+//-----------------------------------------------------------------------------
+int CSoundScriptCacheBuilder::AddString( const char *pszString )
+{
+	// Offsets are relative to the string table until Write
+	int nOffset = m_Strings.TellPut();
+	m_Strings.PutString( pszString );
+	return nOffset;
+}
+
+int CSoundScriptCacheBuilder::AddScript( const char *pszScriptName )
+{
+	return m_Scripts.AddToTail( AddString( pszScriptName ) );
+}
+
+int CSoundScriptCacheBuilder::AddWave( const char *pszWaveName )
+{
+	return m_Waves.AddToTail( AddString( pszWaveName ) );
+}
+
+int CSoundScriptCacheBuilder::AddSoundFile( int nWave, int nGender )
+{
+	SoundScriptCacheSoundFile_t soundFile;
+	V_memset( &soundFile, 0, sizeof( soundFile ) );
+	soundFile.wave = nWave;
+	soundFile.gender = nGender;
+	return m_SoundFiles.AddToTail( soundFile );
+}
+
+int CSoundScriptCacheBuilder::AddEntry( const char *pszSoundName, const SoundScriptCacheEntry_t &entry )
+{
+	int i = m_Entries.AddToTail( entry );
+	m_Entries[i].nameOffset = AddString( pszSoundName );
+	m_Entries[i].unused = 0;
+	return i;
+}
+
+bool CSoundScriptCacheBuilder::Write( IFileSystem *pFileSystem, const char *pszFileName, const char *pszPathID, unsigned int nManifestChecksum )
+{
+	CUtlVector<unsigned int> hashes;
+	hashes.SetCount( m_Entries.Count() );
+	for ( int i = 0; i < m_Entries.Count(); i++ )
+	{
+		hashes[i] = HashStringCaselessConventional( (const char *)m_Strings.Base() + m_Entries[i].nameOffset );
+	}
+
+	CUtlVector<uint32> buckets;
+	CUtlVector<int> slots;
+	BuildPerfectHash( hashes, buckets, slots );
+
+	SoundScriptCacheHeader_t header;
+	V_memset( &header, 0, sizeof( header ) );
+	header.id = SOUNDSCRIPTCACHE_ID;
+	header.version = SOUNDSCRIPTCACHE_VERSION;
+	header.manifestChecksum = nManifestChecksum;
+	header.numScripts = m_Scripts.Count();
+	header.scriptOffset = sizeof( SoundScriptCacheHeader_t );
+	header.numWaves = m_Waves.Count();
+	header.waveOffset = header.scriptOffset + header.numScripts * sizeof( int );
+	header.numEntries = m_Entries.Count();
+	header.entryOffset = header.waveOffset + header.numWaves * sizeof( int );
+	header.numSoundFiles = m_SoundFiles.Count();
+	header.soundFileOffset = header.entryOffset + header.numEntries * sizeof( SoundScriptCacheEntry_t );
+	header.numBuckets = buckets.Count();
+	header.bucketOffset = header.soundFileOffset + header.numSoundFiles * sizeof( SoundScriptCacheSoundFile_t );
+	header.numSlots = slots.Count();
+	header.slotOffset = header.bucketOffset + header.numBuckets * sizeof( uint32 );
+	header.stringOffset = header.slotOffset + header.numSlots * sizeof( int );
+	header.stringSize = m_Strings.TellPut();
+
+	for ( int i = 0; i < m_Scripts.Count(); i++ )
+	{
+		m_Scripts[i] += header.stringOffset;
+	}
+	for ( int i = 0; i < m_Waves.Count(); i++ )
+	{
+		m_Waves[i] += header.stringOffset;
+	}
+	for ( int i = 0; i < m_Entries.Count(); i++ )
+	{
+		m_Entries[i].nameOffset += header.stringOffset;
+	}
+
+	CUtlBuffer buf;
+	buf.Put( &header, sizeof( header ) );
+	buf.Put( m_Scripts.Base(), m_Scripts.Count() * sizeof( int ) );
+	buf.Put( m_Waves.Base(), m_Waves.Count() * sizeof( int ) );
+	buf.Put( m_Entries.Base(), m_Entries.Count() * sizeof( SoundScriptCacheEntry_t ) );
+	buf.Put( m_SoundFiles.Base(), m_SoundFiles.Count() * sizeof( SoundScriptCacheSoundFile_t ) );
+	buf.Put( buckets.Base(), buckets.Count() * sizeof( uint32 ) );
+	buf.Put( slots.Base(), slots.Count() * sizeof( int ) );
+	buf.Put( m_Strings.Base(), m_Strings.TellPut() );
+
+	SoundScriptCacheHeader_t *pHeader = (SoundScriptCacheHeader_t *)buf.Base();
+	pHeader->contentCRC = CRC32_ProcessSingleBuffer( (byte *)buf.Base() + sizeof( header ), buf.TellPut() - sizeof( header ) );
+
+	// Written next to the old file and renamed over it, so another process
+	// that still has the old one mapped keeps reading the old contents
+	char szTempName[MAX_PATH];
+	Q_snprintf( szTempName, sizeof( szTempName ), "%s.tmp", pszFileName );
+	if ( !pFileSystem->WriteFile( szTempName, pszPathID, buf ) )
+		return false;
+
+	if ( !pFileSystem->RenameFile( szTempName, pszFileName, pszPathID ) )
+	{
+		pFileSystem->RemoveFile( pszFileName, pszPathID );
+		if ( !pFileSystem->RenameFile( szTempName, pszFileName, pszPathID ) )
+		{
+			pFileSystem->RemoveFile( szTempName, pszPathID );
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,172 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compiled sound scripts. The cache holds every entry of the
+//			manifest's script files with its parameters already parsed and
+//			its wave names already pooled, plus a perfect hash over the
+//			entry names, so the sound emitter system can skip KeyValues
+//			parsing at startup and resolve names with a single probe.
+//
+//===========================================================================//
+
+#ifndef SOUNDSCRIPTCACHE_H
+#define SOUNDSCRIPTCACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/checksum_crc.h"
+#include "utlvector.h"
+#include "utlbuffer.h"
+
+class IFileSystem;
+
+
+//-----------------------------------------------------------------------------
+// File format
+//
+//	SoundScriptCacheHeader_t
+//	string offsets of the script files[numScripts]
+//	string offsets of the wave names[numWaves]
+//	SoundScriptCacheEntry_t[numEntries]
+//	SoundScriptCacheSoundFile_t[numSoundFiles]
+//	perfect hash seeds[numBuckets]
+//	perfect hash slots[numSlots], entry index or -1
+//	string table
+//-----------------------------------------------------------------------------
+#define SOUNDSCRIPTCACHE_ID				(('C'<<24)+('S'<<16)+('S'<<8)+'G')	// little-endian "GSSC"
+#define SOUNDSCRIPTCACHE_VERSION		2
+
+#define SOUNDSCRIPTCACHE_FILENAME		"scripts/game_sounds_manifest.cache"
+
+enum
+{
+	SOUNDSCRIPTCACHE_PLAY_TO_OWNER_ONLY	= 0x0001,
+	SOUNDSCRIPTCACHE_USES_GENDER_TOKEN	= 0x0002,
+	SOUNDSCRIPTCACHE_PRELOAD			= 0x0004,
+};
+
+struct SoundScriptCacheHeader_t
+{
+	int				id;
+	int				version;
+	unsigned int	manifestChecksum;	// CRC of the manifest and script names and contents it was built from
+	CRC32_t			contentCRC;			// Of everything after the header
+
+	int				numScripts;
+	int				scriptOffset;
+	int				numWaves;
+	int				waveOffset;
+	int				numEntries;
+	int				entryOffset;
+	int				numSoundFiles;
+	int				soundFileOffset;
+	int				numBuckets;
+	int				bucketOffset;
+	int				numSlots;
+	int				slotOffset;
+	int				stringOffset;
+	int				stringSize;
+};
+
+struct SoundScriptCacheEntry_t
+{
+	int				nameOffset;			// Into the string table
+	uint16			scriptIndex;
+	uint16			channel;
+	float			volumeStart;
+	float			volumeRange;
+	uint16			soundLevelStart;
+	uint16			soundLevelRange;
+	uint8			pitchStart;
+	uint8			pitchRange;
+	uint16			delayMsec;
+	uint16			flags;				// SOUNDSCRIPTCACHE_xxx
+	uint16			numSoundNames;
+	uint16			numConvertedNames;
+	uint16			unused;
+	int				firstSoundFile;		// The sound names, followed by the converted names
+};
+
+struct SoundScriptCacheSoundFile_t
+{
+	int				wave;				// Index of the wave name
+	byte			gender;
+	byte			unused[3];
+};
+
+
+//-----------------------------------------------------------------------------
+// CSoundScriptCache
+//
+// Purpose: Read side. The file is mapped (or read, where mapping is not
+//			available) and stays loaded for name lookups until Unload.
+//-----------------------------------------------------------------------------
+class CSoundScriptCache
+{
+public:
+	CSoundScriptCache();
+	~CSoundScriptCache();
+
+	// Fails if the file is missing, damaged or was built from other scripts
+	bool Load( IFileSystem *pFileSystem, const char *pszFileName, const char *pszPathID, unsigned int nManifestChecksum );
+	void Unload();
+	bool IsLoaded() const										{ return m_pBase != NULL; }
+
+	int GetScriptCount() const									{ return m_pHeader->numScripts; }
+	const char *GetScriptName( int i ) const					{ return GetString( m_pScripts[i] ); }
+	int GetWaveCount() const									{ return m_pHeader->numWaves; }
+	const char *GetWaveName( int i ) const						{ return GetString( m_pWaves[i] ); }
+	int GetEntryCount() const									{ return m_pHeader->numEntries; }
+	const SoundScriptCacheEntry_t &GetEntry( int i ) const		{ return m_pEntries[i]; }
+	const char *GetEntryName( int i ) const						{ return GetString( m_pEntries[i].nameOffset ); }
+	const SoundScriptCacheSoundFile_t &GetSoundFile( int i ) const	{ return m_pSoundFiles[i]; }
+
+	// The only entry pszName can be, or -1. The caller compares the names.
+	int FindCandidate( const char *pszName ) const;
+	// The entry named pszName (case insensitive), or -1
+	int Find( const char *pszName ) const;
+
+private:
+	const char *GetString( int nOffset ) const					{ return (const char *)m_pBase + nOffset; }
+
+	const byte						*m_pBase;
+	int								m_nSize;
+	bool							m_bMapped;
+	const SoundScriptCacheHeader_t	*m_pHeader;
+	const int						*m_pScripts;
+	const int						*m_pWaves;
+	const SoundScriptCacheEntry_t	*m_pEntries;
+	const SoundScriptCacheSoundFile_t *m_pSoundFiles;
+	const uint32					*m_pBuckets;
+	const int						*m_pSlots;
+};
+
+
+//-----------------------------------------------------------------------------
+// CSoundScriptCacheBuilder
+//
+// Purpose: Write side. Indices are handed out in the order things are added.
+//-----------------------------------------------------------------------------
+class CSoundScriptCacheBuilder
+{
+public:
+	int AddScript( const char *pszScriptName );
+	int AddWave( const char *pszWaveName );
+	int AddSoundFile( int nWave, int nGender );
+	// The entry's nameOffset is filled in here, everything else by the caller
+	int AddEntry( const char *pszSoundName, const SoundScriptCacheEntry_t &entry );
+
+	bool Write( IFileSystem *pFileSystem, const char *pszFileName, const char *pszPathID, unsigned int nManifestChecksum );
+
+private:
+	int AddString( const char *pszString );
+
+	CUtlVector<int>							m_Scripts;
+	CUtlVector<int>							m_Waves;
+	CUtlVector<SoundScriptCacheEntry_t>		m_Entries;
+	CUtlVector<SoundScriptCacheSoundFile_t>	m_SoundFiles;
+	CUtlBuffer								m_Strings;
+};
+
+
+#endif // SOUNDSCRIPTCACHE_H
@@ -271,6 +271,66 @@ bool CheckSSE4aTechnology( void )
 }
 
 
+bool CheckAVX2Technology( void )
+{
+#if defined( _X360 ) || defined( _PS3 ) || defined(__SANITIZE_ADDRESS__) || defined (__arm__) || defined (__aarch64__)
+	return false;
+#else
+	uint32 eax,ebx,edx,ecx;
+	if( !cpuid(1,eax,ebx,ecx,edx) )
+		return false;
+
+	// AVX needs OSXSAVE (bit 27) and AVX (bit 28), and the OS has to
+	// save the sse and ymm state on context switches (XCR0 bits 1 and 2)
+	if ( ( ecx & ( 1 << 27 ) ) == 0 || ( ecx & ( 1 << 28 ) ) == 0 )
+		return false;
+
+	uint32 xcr0;
+#if defined(GNUC)
+	uint32 xcr0_hi;
+	asm( "xgetbv" : "=a" (xcr0), "=d" (xcr0_hi) : "c" (0) );
+#else
+	xcr0 = (uint32)_xgetbv( 0 );
+#endif
+	if ( ( xcr0 & 6 ) != 6 )
+		return false;
+
+	if ( !cpuid(0,eax,ebx,ecx,edx) || eax < 7 )
+		return false;
+
+	// leaf 7 needs sub-leaf 0 in ecx, which cpuid() leaves alone
+#if defined(GNUC)
+#if defined(PLATFORM_64BITS)
+	asm("mov %%rbx, %%rsi\n\t"
+		"cpuid\n\t"
+		"xchg %%rsi, %%rbx"
+		: "=a" (eax),
+		"=S" (ebx),
+		"=c" (ecx),
+		"=d" (edx)
+		: "a" (7), "c" (0)
+		);
+#else
+	asm("mov %%ebx, %%esi\n\t"
+		"cpuid\n\t"
+		"xchg %%esi, %%ebx"
+		: "=a" (eax),
+		"=S" (ebx),
+		"=c" (ecx),
+		"=d" (edx)
+		: "a" (7), "c" (0)
+		);
+#endif
+#else
+	int pCPUInfo[4];
+	__cpuidex( pCPUInfo, 7, 0 );
+	ebx = pCPUInfo[1];
+#endif
+
+	return ( ebx & ( 1 << 5 ) ) != 0;	// bit 5 of EBX
+#endif
+}
+
 static bool Check3DNowTechnology(void)
 {
 #if defined( _X360 ) || defined( _PS3 ) || defined (__arm__) || defined(__SANITIZE_ADDRESS__) || (defined(PLATFORM_BSD) && defined(COMPILER_CLANG))
@@ -607,6 +667,7 @@ const CPUInformation* GetCPUInformation()
 	pi.m_bSSE4a        = CheckSSE4aTechnology();
 	pi.m_bSSE41        = CheckSSE41Technology();
 	pi.m_bSSE42        = CheckSSE42Technology();
+	pi.m_bAVX2         = CheckAVX2Technology();
 	pi.m_b3DNow        = Check3DNowTechnology();
 	pi.m_szProcessorID = (tchar*)GetProcessorVendorId();
 	pi.m_bHT		   = HTSupported();
@@ -0,0 +1,893 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Distributed compiles over local sockets, see distwork.h
+//
+//=============================================================================//
+
+#include "cmdlib.h"
+#include "threads.h"
+#include "pacifier.h"
+#include "distwork.h"
+#include "tier0/platform.h"
+#include "tier1/strtools.h"
+#include "utlvector.h"
+
+#ifdef POSIX
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+
+bool g_bDistWork = false;
+bool g_bDistWorkMaster = false;
+
+
+#ifdef POSIX
+
+// The VMPI library has it on Windows
+IWorkUnitDistributorCallbacks *g_pDistributeWorkCallbacks = NULL;
+
+
+// Packets. Each one goes out as its length followed by its type and data.
+enum
+{
+	DIST_HELLO,			// worker -> coordinator
+	DIST_WELCOME,		// int worker ID
+	DIST_REQUEST,		// int stage, int threads
+	DIST_WORK,			// int stage, int count, uint64 units[count]
+	DIST_RESULT,		// int stage, uint64 unit, results
+	DIST_DONE,			// int stage
+	DIST_BLOB,			// data
+	DIST_QUIT
+};
+
+// How long the coordinator waits for the workers it started to connect.
+#define DIST_CONNECT_TIMEOUT	60.0
+
+// A unit whose workers died this many times stops the compile.
+#define DIST_MAX_ATTEMPTS		3
+
+// At the end of a stage idle workers also get the units still out on other
+// workers, up to this many copies. The first result wins.
+#define DIST_MAX_COPIES			2
+
+
+struct DistWorker_t
+{
+	int		m_Socket;
+	int		m_ID;
+	bool	m_bWaiting;		// sent a request and has no units
+	bool	m_bBusy;		// still on units of a stage that is over, not reading
+	int		m_nThreads;
+	int		m_nBlobsSent;
+	CUtlVector<uint64>	m_Units;
+};
+
+struct DistWorkUnit_t
+{
+	unsigned char	m_nCopies;	// workers holding it
+	unsigned char	m_nAttempts;	// workers that died holding it
+	bool			m_bDone;
+};
+
+
+static char		s_szAddress[MAX_PATH];
+static int		s_ListenSocket = -1;
+static int		s_Socket = -1;			// worker: connection to the coordinator
+static int		s_iWorkerID = -1;
+static int		s_iStage = 0;
+static int		s_nNextWorkerID = 0;
+static bool		s_bUnixSocket = true;
+
+static CUtlVector<DistWorker_t*>	s_Workers;
+static CUtlVector<pid_t>			s_Children;
+static CUtlVector<MessageBuffer*>	s_Blobs;	// coordinator: sent so far, worker: not read yet
+
+// Coordinator stage state
+static CUtlVector<DistWorkUnit_t>	s_WorkUnits;
+static CUtlVector<uint64>			s_RetryUnits;
+static uint64		s_iNextWorkUnit;
+static uint64		s_nWorkUnitsDone;
+
+// Worker stage state, read by the threads
+static ProcessWorkUnitFn	s_ProcessFn;
+static uint64				*s_pThreadUnits;
+static MessageBuffer		*s_pThreadResults;
+
+
+//-----------------------------------------------------------------------------
+// Sockets
+//-----------------------------------------------------------------------------
+static bool SendAll( int sock, void const *pData, int nBytes )
+{
+	char const *p = (char const *)pData;
+	while ( nBytes > 0 )
+	{
+		int n = send( sock, p, nBytes, MSG_NOSIGNAL );
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return false;
+		p += n;
+		nBytes -= n;
+	}
+	return true;
+}
+
+static bool RecvAll( int sock, void *pData, int nBytes )
+{
+	char *p = (char *)pData;
+	while ( nBytes > 0 )
+	{
+		int n = recv( sock, p, nBytes, 0 );
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return false;
+		p += n;
+		nBytes -= n;
+	}
+	return true;
+}
+
+static bool SendPacket( int sock, void const *pHeader, int nHeader, void const *pData = NULL, int nData = 0 )
+{
+	int nLen = nHeader + nData;
+	return SendAll( sock, &nLen, sizeof( nLen ) ) &&
+		SendAll( sock, pHeader, nHeader ) &&
+		( nData == 0 || SendAll( sock, pData, nData ) );
+}
+
+static bool RecvPacket( int sock, MessageBuffer *pBuf )
+{
+	int nLen;
+	if ( !RecvAll( sock, &nLen, sizeof( nLen ) ) || nLen < 1 )
+		return false;
+
+	pBuf->setLen( nLen );
+	pBuf->setOffset( 1 );
+	return RecvAll( sock, pBuf->data, nLen );
+}
+
+static bool SendInts( int sock, char cType, int a, int b = 0, int nInts = 1 )
+{
+	char header[1 + 2*sizeof( int )];
+	header[0] = cType;
+	memcpy( &header[1], &a, sizeof( a ) );
+	memcpy( &header[1 + sizeof( a )], &b, sizeof( b ) );
+	return SendPacket( sock, header, 1 + nInts * sizeof( int ) );
+}
+
+
+// The address is a Unix socket path, or host:port for TCP
+static bool ParseTCPAddress( char const *pAddress, char *pHost, int nHostLen, char *pPort, int nPortLen )
+{
+	char const *pColon = strrchr( pAddress, ':' );
+	if ( !pColon || pAddress[0] == '/' )
+		return false;
+
+	V_strncpy( pHost, pAddress, MIN( nHostLen, pColon - pAddress + 1 ) );
+	V_strncpy( pPort, pColon + 1, nPortLen );
+	return true;
+}
+
+static int OpenSocket( char const *pAddress, bool bListen )
+{
+	char host[256], port[32];
+	if ( !ParseTCPAddress( pAddress, host, sizeof( host ), port, sizeof( port ) ) )
+	{
+		sockaddr_un addr;
+		memset( &addr, 0, sizeof( addr ) );
+		addr.sun_family = AF_UNIX;
+		V_strncpy( addr.sun_path, pAddress, sizeof( addr.sun_path ) );
+
+		int sock = socket( AF_UNIX, SOCK_STREAM, 0 );
+		if ( sock < 0 )
+			return -1;
+
+		if ( bListen )
+		{
+			unlink( pAddress );
+			if ( bind( sock, (sockaddr*)&addr, sizeof( addr ) ) == 0 && listen( sock, 64 ) == 0 )
+				return sock;
+		}
+		else if ( connect( sock, (sockaddr*)&addr, sizeof( addr ) ) == 0 )
+		{
+			return sock;
+		}
+
+		close( sock );
+		return -1;
+	}
+
+	s_bUnixSocket = false;
+
+	addrinfo hints, *pResult;
+	memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = bListen ? AI_PASSIVE : 0;
+	if ( getaddrinfo( host[0] ? host : NULL, port, &hints, &pResult ) != 0 )
+		return -1;
+
+	int sock = -1;
+	for ( addrinfo *p = pResult; p; p = p->ai_next )
+	{
+		sock = socket( p->ai_family, p->ai_socktype, p->ai_protocol );
+		if ( sock < 0 )
+			continue;
+
+		int one = 1;
+		setsockopt( sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+		if ( bListen )
+		{
+			setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+			if ( bind( sock, p->ai_addr, p->ai_addrlen ) == 0 && listen( sock, 64 ) == 0 )
+				break;
+		}
+		else if ( connect( sock, p->ai_addr, p->ai_addrlen ) == 0 )
+		{
+			break;
+		}
+
+		close( sock );
+		sock = -1;
+	}
+
+	freeaddrinfo( pResult );
+	return sock;
+}
+
+
+//-----------------------------------------------------------------------------
+// Coordinator
+//-----------------------------------------------------------------------------
+
+// Catches a worker up on the broadcasts it hasn't been sent yet
+static bool SendPendingBlobs( DistWorker_t *pWorker )
+{
+	char cType = DIST_BLOB;
+	for ( ; pWorker->m_nBlobsSent < s_Blobs.Count(); pWorker->m_nBlobsSent++ )
+	{
+		MessageBuffer *pBlob = s_Blobs[pWorker->m_nBlobsSent];
+		if ( !SendPacket( pWorker->m_Socket, &cType, 1, pBlob->data, pBlob->getLen() ) )
+			return false;
+	}
+	return true;
+}
+
+static void StartWorkers( int nWorkers, int argc, char **argv )
+{
+	// Split the cores between the workers unless -threads says otherwise
+	char threads[16];
+	bool bThreads = false;
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( !V_stricmp( argv[i], "-threads" ) )
+			bThreads = true;
+	}
+	V_snprintf( threads, sizeof( threads ), "%d", MAX( 1, (int)sysconf( _SC_NPROCESSORS_ONLN ) / MAX( nWorkers, 1 ) ) );
+
+	CUtlVector<char*> args;
+	args.AddToTail( argv[0] );
+	args.AddToTail( (char*)"-distworker" );
+	args.AddToTail( s_szAddress );
+	if ( !bThreads )
+	{
+		args.AddToTail( (char*)"-threads" );
+		args.AddToTail( threads );
+	}
+	for ( int i = 1; i < argc; i++ )
+	{
+		args.AddToTail( argv[i] );
+	}
+	args.AddToTail( NULL );
+
+	fflush( stdout );
+	for ( int i = 0; i < nWorkers; i++ )
+	{
+		pid_t pid = fork();
+		if ( pid < 0 )
+			Error( "DistWork: can't start worker %d (%s)", i, strerror( errno ) );
+
+		if ( pid == 0 )
+		{
+			close( s_ListenSocket );
+			execv( "/proc/self/exe", args.Base() );
+			_exit( 1 );
+		}
+		s_Children.AddToTail( pid );
+	}
+}
+
+static void AcceptWorker()
+{
+	int sock = accept( s_ListenSocket, NULL, NULL );
+	if ( sock < 0 )
+		return;
+
+	MessageBuffer mb;
+	if ( !RecvPacket( sock, &mb ) || mb.data[0] != DIST_HELLO )
+	{
+		close( sock );
+		return;
+	}
+
+	DistWorker_t *pWorker = new DistWorker_t;
+	pWorker->m_Socket = sock;
+	pWorker->m_ID = s_nNextWorkerID++;
+	pWorker->m_bWaiting = false;
+	pWorker->m_bBusy = false;
+	pWorker->m_nThreads = 1;
+	pWorker->m_nBlobsSent = 0;
+
+	// A worker that comes in late gets everything sent to the others so far
+	if ( !SendInts( sock, DIST_WELCOME, pWorker->m_ID ) || !SendPendingBlobs( pWorker ) )
+	{
+		close( sock );
+		delete pWorker;
+		return;
+	}
+
+	s_Workers.AddToTail( pWorker );
+	qprintf( "DistWork: worker %d connected\n", pWorker->m_ID );
+}
+
+static void DropWorker( int iWorker, char const *pReason )
+{
+	DistWorker_t *pWorker = s_Workers[iWorker];
+	Warning( "\nDistWork: lost worker %d (%s), %d work units go to the others\n", pWorker->m_ID, pReason, pWorker->m_Units.Count() );
+
+	// Put its units back to be handed out again
+	for ( int i = 0; i < pWorker->m_Units.Count(); i++ )
+	{
+		uint64 iUnit = pWorker->m_Units[i];
+		DistWorkUnit_t &unit = s_WorkUnits[iUnit];
+		--unit.m_nCopies;
+		if ( unit.m_bDone )
+			continue;
+
+		if ( ++unit.m_nAttempts >= DIST_MAX_ATTEMPTS )
+			Error( "DistWork: work unit %llu failed on %d workers", iUnit, DIST_MAX_ATTEMPTS );
+
+		if ( unit.m_nCopies == 0 )
+			s_RetryUnits.AddToTail( iUnit );
+	}
+
+	close( pWorker->m_Socket );
+	delete pWorker;
+	s_Workers.Remove( iWorker );
+
+	if ( s_Workers.Count() == 0 )
+		Error( "DistWork: all workers are gone" );
+}
+
+// Picks the next units for a waiting worker. Returns false if it has to keep waiting.
+static bool AssignWork( DistWorker_t *pWorker )
+{
+	int nMax = pWorker->m_nThreads;
+	while ( pWorker->m_Units.Count() < nMax && s_RetryUnits.Count() )
+	{
+		uint64 iUnit = s_RetryUnits.Tail();
+		s_RetryUnits.RemoveMultipleFromTail( 1 );
+		if ( !s_WorkUnits[iUnit].m_bDone )
+			pWorker->m_Units.AddToTail( iUnit );
+	}
+
+	while ( pWorker->m_Units.Count() < nMax && s_iNextWorkUnit < (uint64)s_WorkUnits.Count() )
+	{
+		pWorker->m_Units.AddToTail( s_iNextWorkUnit++ );
+	}
+
+	// Nothing left to hand out, so help with the units still being worked on
+	if ( pWorker->m_Units.Count() == 0 )
+	{
+		for ( int nCopies = 1; nCopies < DIST_MAX_COPIES && pWorker->m_Units.Count() < nMax; nCopies++ )
+		{
+			for ( int i = 0; i < s_WorkUnits.Count() && pWorker->m_Units.Count() < nMax; i++ )
+			{
+				if ( !s_WorkUnits[i].m_bDone && s_WorkUnits[i].m_nCopies == nCopies )
+					pWorker->m_Units.AddToTail( i );
+			}
+		}
+	}
+
+	if ( pWorker->m_Units.Count() == 0 )
+		return false;
+
+	MessageBuffer mb;
+	char cType = DIST_WORK;
+	int nUnits = pWorker->m_Units.Count();
+	mb.write( &cType, 1 );
+	mb.write( &s_iStage, sizeof( s_iStage ) );
+	mb.write( &nUnits, sizeof( nUnits ) );
+	mb.write( pWorker->m_Units.Base(), nUnits * sizeof( uint64 ) );
+	for ( int i = 0; i < nUnits; i++ )
+	{
+		++s_WorkUnits[pWorker->m_Units[i]].m_nCopies;
+	}
+
+	pWorker->m_bWaiting = false;
+	return SendPacket( pWorker->m_Socket, mb.data, mb.getLen() );
+}
+
+static void HandleResult( DistWorker_t *pWorker, MessageBuffer *pBuf, ReceiveWorkUnitFn receiveFn )
+{
+	int iStage;
+	uint64 iUnit;
+	if ( pBuf->read( &iStage, sizeof( iStage ) ) < 0 || pBuf->read( &iUnit, sizeof( iUnit ) ) < 0 )
+		Error( "DistWork: bad result from worker %d", pWorker->m_ID );
+
+	if ( iStage != s_iStage || iUnit >= (uint64)s_WorkUnits.Count() )
+		return;
+
+	int iHeld = pWorker->m_Units.Find( iUnit );
+	if ( iHeld != pWorker->m_Units.InvalidIndex() )
+	{
+		pWorker->m_Units.FastRemove( iHeld );
+		--s_WorkUnits[iUnit].m_nCopies;
+	}
+
+	if ( s_WorkUnits[iUnit].m_bDone )
+		return;
+
+	s_WorkUnits[iUnit].m_bDone = true;
+	++s_nWorkUnitsDone;
+	receiveFn( iUnit, pBuf, pWorker->m_ID );
+}
+
+// Returns false if the worker has to be dropped
+static bool HandlePacket( int iWorker, ReceiveWorkUnitFn receiveFn )
+{
+	DistWorker_t *pWorker = s_Workers[iWorker];
+
+	MessageBuffer mb;
+	if ( !RecvPacket( pWorker->m_Socket, &mb ) )
+		return false;
+
+	switch ( mb.data[0] )
+	{
+		case DIST_REQUEST:
+		{
+			int iStage;
+			mb.read( &iStage, sizeof( iStage ) );
+			mb.read( &pWorker->m_nThreads, sizeof( pWorker->m_nThreads ) );
+			pWorker->m_nThreads = MAX( 1, pWorker->m_nThreads );
+
+			// It's reading again, give it what was broadcast while it was busy
+			pWorker->m_bBusy = false;
+			if ( !SendPendingBlobs( pWorker ) )
+				return false;
+
+			// It's catching up on stages that are over
+			if ( iStage != s_iStage )
+				return SendInts( pWorker->m_Socket, DIST_DONE, iStage );
+
+			// Units it was given and didn't send back go to the others
+			for ( int i = 0; i < pWorker->m_Units.Count(); i++ )
+			{
+				DistWorkUnit_t &unit = s_WorkUnits[pWorker->m_Units[i]];
+				if ( --unit.m_nCopies == 0 && !unit.m_bDone )
+					s_RetryUnits.AddToTail( pWorker->m_Units[i] );
+			}
+			pWorker->m_Units.RemoveAll();
+			pWorker->m_bWaiting = true;
+			return true;
+		}
+
+		case DIST_RESULT:
+			HandleResult( pWorker, &mb, receiveFn );
+			return true;
+
+		default:
+			Error( "DistWork: unknown packet %d from worker %d", mb.data[0], pWorker->m_ID );
+			return false;
+	}
+}
+
+static double RunMaster( uint64 nWorkUnits, ReceiveWorkUnitFn receiveFn )
+{
+	double flStart = Plat_FloatTime();
+
+	s_WorkUnits.SetCount( nWorkUnits );
+	memset( s_WorkUnits.Base(), 0, nWorkUnits * sizeof( DistWorkUnit_t ) );
+	s_RetryUnits.RemoveAll();
+	s_iNextWorkUnit = 0;
+	s_nWorkUnitsDone = 0;
+
+	bool bStopped = false;
+	double flLastUpdate = flStart;
+	CUtlVector<pollfd> fds;
+	while ( 1 )
+	{
+		// Hand out work to everyone waiting
+		for ( int i = s_Workers.Count(); --i >= 0; )
+		{
+			if ( s_Workers[i]->m_bWaiting && !bStopped && !AssignWork( s_Workers[i] ) && !s_Workers[i]->m_bWaiting )
+				DropWorker( i, "send failed" );
+		}
+
+		// Done when every unit is in, without waiting on the speculative copies
+		if ( s_nWorkUnitsDone == nWorkUnits || bStopped )
+			break;
+
+		fds.RemoveAll();
+		for ( int i = 0; i < s_Workers.Count(); i++ )
+		{
+			pollfd fd = { s_Workers[i]->m_Socket, POLLIN, 0 };
+			fds.AddToTail( fd );
+		}
+		pollfd listenFd = { s_ListenSocket, POLLIN, 0 };
+		fds.AddToTail( listenFd );
+
+		int nReady = poll( fds.Base(), fds.Count(), 200 );
+		if ( nReady < 0 && errno != EINTR )
+			Error( "DistWork: poll failed (%s)", strerror( errno ) );
+
+		if ( nReady > 0 )
+		{
+			for ( int i = s_Workers.Count(); --i >= 0; )
+			{
+				if ( fds[i].revents & ( POLLIN | POLLHUP | POLLERR ) )
+				{
+					if ( !HandlePacket( i, receiveFn ) )
+						DropWorker( i, "disconnected" );
+				}
+			}
+
+			if ( fds.Tail().revents & POLLIN )
+				AcceptWorker();
+		}
+
+		if ( nWorkUnits )
+			UpdatePacifier( (float)s_nWorkUnitsDone / nWorkUnits );
+
+		double flNow = Plat_FloatTime();
+		if ( flNow - flLastUpdate > 0.2 )
+		{
+			flLastUpdate = flNow;
+			if ( g_pDistributeWorkCallbacks && g_pDistributeWorkCallbacks->Update() )
+				bStopped = true;
+		}
+	}
+
+	// Workers still on copies send results nobody reads, and may block doing
+	// so. Broadcasts to them wait until they ask for work again.
+	for ( int i = 0; i < s_Workers.Count(); i++ )
+	{
+		if ( s_Workers[i]->m_Units.Count() )
+		{
+			s_Workers[i]->m_bBusy = true;
+			s_Workers[i]->m_Units.RemoveAll();
+		}
+	}
+
+	// The rest are told when they ask
+	for ( int i = s_Workers.Count(); --i >= 0; )
+	{
+		if ( !s_Workers[i]->m_bWaiting )
+			continue;
+
+		s_Workers[i]->m_bWaiting = false;
+		if ( !SendInts( s_Workers[i]->m_Socket, DIST_DONE, s_iStage ) )
+			DropWorker( i, "send failed" );
+	}
+
+	s_WorkUnits.Purge();
+	s_RetryUnits.Purge();
+	return Plat_FloatTime() - flStart;
+}
+
+
+//-----------------------------------------------------------------------------
+// Worker
+//-----------------------------------------------------------------------------
+
+// Reads packets until one of the given type. Blobs are kept for DistWork_Broadcast.
+static void WaitForPacket( MessageBuffer *pBuf, char cType1, char cType2 )
+{
+	while ( 1 )
+	{
+		if ( !RecvPacket( s_Socket, pBuf ) )
+			Error( "DistWork: lost the coordinator" );
+
+		char cType = pBuf->data[0];
+		if ( cType == cType1 || cType == cType2 )
+			return;
+
+		if ( cType == DIST_QUIT )
+		{
+			CmdLib_Exit( 0 );
+		}
+		else if ( cType == DIST_BLOB )
+		{
+			MessageBuffer *pBlob = new MessageBuffer( pBuf->getLen() );
+			pBlob->write( pBuf->data + 1, pBuf->getLen() - 1 );
+			s_Blobs.AddToTail( pBlob );
+		}
+	}
+}
+
+static void ProcessWorkUnit_Thread( int iThread, int iUnit )
+{
+	s_ProcessFn( iThread, s_pThreadUnits[iUnit], &s_pThreadResults[iUnit] );
+}
+
+static double RunWorker( ProcessWorkUnitFn processFn )
+{
+	double flStart = Plat_FloatTime();
+
+	s_ProcessFn = processFn;
+	CUtlVector<uint64> units;
+	MessageBuffer mb;
+	while ( 1 )
+	{
+		if ( !SendInts( s_Socket, DIST_REQUEST, s_iStage, numthreads, 2 ) )
+			Error( "DistWork: lost the coordinator" );
+
+		WaitForPacket( &mb, DIST_WORK, DIST_DONE );
+
+		int iStage;
+		mb.read( &iStage, sizeof( iStage ) );
+		if ( mb.data[0] == DIST_DONE )
+		{
+			if ( iStage == s_iStage )
+				break;
+			continue;
+		}
+
+		int nUnits;
+		mb.read( &nUnits, sizeof( nUnits ) );
+		units.SetCount( nUnits );
+		mb.read( units.Base(), nUnits * sizeof( uint64 ) );
+
+		MessageBuffer *results = new MessageBuffer[nUnits];
+		s_pThreadUnits = units.Base();
+		s_pThreadResults = results;
+		RunThreadsOnIndividual( nUnits, false, ProcessWorkUnit_Thread );
+
+		for ( int i = 0; i < nUnits; i++ )
+		{
+			char header[1 + sizeof( int ) + sizeof( uint64 )];
+			header[0] = DIST_RESULT;
+			memcpy( &header[1], &s_iStage, sizeof( int ) );
+			memcpy( &header[1 + sizeof( int )], &units[i], sizeof( uint64 ) );
+			if ( !SendPacket( s_Socket, header, sizeof( header ), results[i].data, results[i].getLen() ) )
+				Error( "DistWork: lost the coordinator" );
+		}
+		delete [] results;
+	}
+
+	return Plat_FloatTime() - flStart;
+}
+
+
+//-----------------------------------------------------------------------------
+// Interface
+//-----------------------------------------------------------------------------
+bool DistWork_Init( int &argc, char **&argv )
+{
+	int nWorkers = -1;
+	char const *pAddress = NULL;
+	char const *pWorkerAddress = NULL;
+
+	int nArgs = 0;
+	char **ppArgs = new char*[argc + 1];
+	for ( int i = 0; i < argc; i++ )
+	{
+		if ( !V_stricmp( argv[i], "-dist" ) && i+1 < argc )
+		{
+			nWorkers = atoi( argv[++i] );
+		}
+		else if ( !V_stricmp( argv[i], "-distaddr" ) && i+1 < argc )
+		{
+			pAddress = argv[++i];
+		}
+		else if ( !V_stricmp( argv[i], "-distworker" ) && i+1 < argc )
+		{
+			pWorkerAddress = argv[++i];
+		}
+		else
+		{
+			ppArgs[nArgs++] = argv[i];
+		}
+	}
+	ppArgs[nArgs] = NULL;
+
+	if ( nWorkers < 0 && !pWorkerAddress )
+	{
+		delete [] ppArgs;
+		return false;
+	}
+
+	argc = nArgs;
+	argv = ppArgs;
+	g_bDistWork = true;
+	signal( SIGPIPE, SIG_IGN );
+
+	if ( pWorkerAddress )
+	{
+		V_strncpy( s_szAddress, pWorkerAddress, sizeof( s_szAddress ) );
+		s_Socket = OpenSocket( s_szAddress, false );
+		if ( s_Socket < 0 )
+			Error( "DistWork: can't connect to %s (%s)", s_szAddress, strerror( errno ) );
+
+		char cType = DIST_HELLO;
+		MessageBuffer mb;
+		if ( !SendPacket( s_Socket, &cType, 1 ) )
+			Error( "DistWork: lost the coordinator" );
+		WaitForPacket( &mb, DIST_WELCOME, DIST_WELCOME );
+		mb.read( &s_iWorkerID, sizeof( s_iWorkerID ) );
+		return true;
+	}
+
+	g_bDistWorkMaster = true;
+	if ( pAddress )
+		V_strncpy( s_szAddress, pAddress, sizeof( s_szAddress ) );
+	else
+		V_snprintf( s_szAddress, sizeof( s_szAddress ), "/tmp/distwork_%d.sock", (int)getpid() );
+
+	s_ListenSocket = OpenSocket( s_szAddress, true );
+	if ( s_ListenSocket < 0 )
+		Error( "DistWork: can't listen on %s (%s)", s_szAddress, strerror( errno ) );
+
+	Msg( "DistWork: coordinator on %s, starting %d workers\n", s_szAddress, nWorkers );
+	StartWorkers( nWorkers, argc, argv );
+
+	// -dist 0 waits for workers started by hand with -distworker
+	double flStart = Plat_FloatTime();
+	while ( s_Workers.Count() < MAX( nWorkers, 1 ) )
+	{
+		pollfd fd = { s_ListenSocket, POLLIN, 0 };
+		if ( poll( &fd, 1, 200 ) > 0 )
+		{
+			AcceptWorker();
+		}
+		else if ( nWorkers > 0 && Plat_FloatTime() - flStart > DIST_CONNECT_TIMEOUT )
+		{
+			if ( s_Workers.Count() == 0 )
+				Error( "DistWork: no workers connected" );
+			Warning( "DistWork: only %d of %d workers connected\n", s_Workers.Count(), nWorkers );
+			break;
+		}
+	}
+
+	return true;
+}
+
+void DistWork_Term()
+{
+	if ( !g_bDistWork )
+		return;
+
+	if ( g_bDistWorkMaster )
+	{
+		char cType = DIST_QUIT;
+		for ( int i = 0; i < s_Workers.Count(); i++ )
+		{
+			SendPacket( s_Workers[i]->m_Socket, &cType, 1 );
+			close( s_Workers[i]->m_Socket );
+			delete s_Workers[i];
+		}
+		s_Workers.Purge();
+
+		for ( int i = 0; i < s_Children.Count(); i++ )
+		{
+			waitpid( s_Children[i], NULL, 0 );
+		}
+		s_Children.Purge();
+
+		close( s_ListenSocket );
+		s_ListenSocket = -1;
+		if ( s_bUnixSocket )
+			unlink( s_szAddress );
+	}
+	else
+	{
+		close( s_Socket );
+		s_Socket = -1;
+	}
+
+	s_Blobs.PurgeAndDeleteElements();
+	g_bDistWork = false;
+	g_bDistWorkMaster = false;
+}
+
+int DistWork_GetWorkerCount()
+{
+	return s_Workers.Count();
+}
+
+int DistWork_GetWorkerID()
+{
+	return s_iWorkerID;
+}
+
+double DistWork_Run( uint64 nWorkUnits, ProcessWorkUnitFn processFn, ReceiveWorkUnitFn receiveFn )
+{
+	++s_iStage;
+	if ( g_bDistWorkMaster )
+		return RunMaster( nWorkUnits, receiveFn );
+	return RunWorker( processFn );
+}
+
+void DistWork_Broadcast( MessageBuffer *pBuf )
+{
+	if ( g_bDistWorkMaster )
+	{
+		MessageBuffer *pBlob = new MessageBuffer( pBuf->getLen() );
+		pBlob->write( pBuf->data, pBuf->getLen() );
+		s_Blobs.AddToTail( pBlob );
+
+		// Busy workers get it when they ask for work again
+		for ( int i = s_Workers.Count(); --i >= 0; )
+		{
+			if ( !s_Workers[i]->m_bBusy && !SendPendingBlobs( s_Workers[i] ) )
+				DropWorker( i, "send failed" );
+		}
+		return;
+	}
+
+	if ( s_Blobs.Count() == 0 )
+	{
+		MessageBuffer mb;
+		WaitForPacket( &mb, DIST_BLOB, DIST_BLOB );
+		pBuf->setLen( 0 );
+		pBuf->write( mb.data + 1, mb.getLen() - 1 );
+	}
+	else
+	{
+		pBuf->setLen( 0 );
+		pBuf->write( s_Blobs[0]->data, s_Blobs[0]->getLen() );
+		delete s_Blobs[0];
+		s_Blobs.Remove( 0 );
+	}
+	pBuf->setOffset( 0 );
+}
+
+#else // POSIX
+
+bool DistWork_Init( int &argc, char **&argv )
+{
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( !V_stricmp( argv[i], "-dist" ) || !V_stricmp( argv[i], "-distworker" ) )
+			Error( "%s is only supported on Linux, use -mpi", argv[i] );
+	}
+	return false;
+}
+
+void DistWork_Term()
+{
+}
+
+int DistWork_GetWorkerCount()
+{
+	return 0;
+}
+
+int DistWork_GetWorkerID()
+{
+	return -1;
+}
+
+double DistWork_Run( uint64 nWorkUnits, ProcessWorkUnitFn processFn, ReceiveWorkUnitFn receiveFn )
+{
+	Error( "DistWork_Run: not supported on this platform" );
+	return 0;
+}
+
+void DistWork_Broadcast( MessageBuffer *pBuf )
+{
+	Error( "DistWork_Broadcast: not supported on this platform" );
+}
+
+#endif // POSIX
@@ -0,0 +1,49 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Distributed compiles over local sockets, without the VMPI service.
+//
+//			The coordinator listens on a Unix socket (or TCP with -distaddr
+//			host:port) and starts -dist <n> worker processes with its own
+//			command line plus -distworker <address>. Both sides run the same
+//			tool up to each distributed stage. There the coordinator hands
+//			out work units as workers ask for them and merges their results,
+//			and hands the units of a worker that died to the others. A stage
+//			ends when every unit is done and every worker is waiting.
+//
+//=============================================================================//
+
+#ifndef DISTWORK_H
+#define DISTWORK_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+#include "vmpi_distribute_work.h"
+
+
+// Set when -dist or -distworker is on the command line.
+extern bool g_bDistWork;
+extern bool g_bDistWorkMaster;	// This is the coordinator.
+
+
+// Reads and strips -dist <workers>, -distaddr <address> and -distworker <address>.
+// The coordinator starts its workers and waits for them to connect. Returns false
+// if none of them are on the command line.
+bool DistWork_Init( int &argc, char **&argv );
+void DistWork_Term();
+
+// Number of workers connected to the coordinator, this worker's ID on a worker.
+int DistWork_GetWorkerCount();
+int DistWork_GetWorkerID();
+
+// Same contract as DistributeWork. Workers call processFn for the units they are
+// handed, the coordinator calls receiveFn once for each unit, with iWorker set to
+// the worker's ID. Returns the time the stage took.
+double DistWork_Run( uint64 nWorkUnits, ProcessWorkUnitFn processFn, ReceiveWorkUnitFn receiveFn );
+
+// The coordinator sends pBuf to every worker. Workers wait for it and get it in pBuf.
+void DistWork_Broadcast( MessageBuffer *pBuf );
+
+
+#endif // DISTWORK_H
@@ -0,0 +1,543 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Particle simulation benchmark. Loads .pcf files and simulates
+//			many instances of their systems without rendering, once in
+//			order on the main thread and once on the job pool, and reports
+//			the time each took. With -ops it times each operator of each
+//			system 4 and 8 wide instead. With -floor the world is a floor
+//			plane, and it also reports the collision traces and the
+//			particles that fell through. -test checks that children which
+//			share their parent's collision cache are simulated in order.
+//
+//=============================================================================//
+
+#include "appframework/tier3app.h"
+#include "appframework/IAppSystem.h"
+#include "dmxloader/dmxelement.h"
+#include "dmxloader/dmxloader.h"
+#include "filesystem.h"
+#include "icommandline.h"
+#include "mathlib/mathlib.h"
+#include "tier1/tier1.h"
+#include "tier2/tier2.h"
+#include "tier3/tier3.h"
+#include "materialsystem/imaterialsystem.h"
+#include "particles/particles.h"
+#include "vstdlib/jobthread.h"
+#include "vstdlib/iprocessutils.h"
+
+// Last include
+#include "tier0/memdbgon.h"
+
+
+static int g_nSystems = 256;
+static int g_nFrames = 300;
+static float g_flFrameTime = 1.0f / 60.0f;
+static bool g_bFloor = false;
+static float g_flFloor = -64.0f;
+
+#define BENCH_SPACING 256.0f
+#define BENCH_OP_ITERATIONS 1000
+
+
+//-----------------------------------------------------------------------------
+// A world that is only a floor, for the collision constraints
+//-----------------------------------------------------------------------------
+class CFloorParticleSystemQuery : public CBaseAppSystem< IParticleSystemQuery >
+{
+public:
+	virtual void GetLightingAtPoint( const Vector& vecOrigin, Color &tint )
+	{
+		tint.SetColor( 255, 255, 255, 255 );
+	}
+
+	virtual void TraceLine( const Vector& vecAbsStart, const Vector& vecAbsEnd, unsigned int mask,
+							const class IHandleEntity *ignore, int collisionGroup, CBaseTrace *ptr )
+	{
+		ptr->startpos = vecAbsStart;
+		ptr->endpos = vecAbsEnd;
+		ptr->fraction = 1.0f;
+		ptr->contents = 0;
+		ptr->dispFlags = 0;
+		ptr->allsolid = ptr->startsolid = ( vecAbsStart.z < g_flFloor );
+		ptr->plane.normal.Init( 0.0f, 0.0f, 1.0f );
+		ptr->plane.dist = g_flFloor;
+		if ( ptr->startsolid )
+		{
+			ptr->fraction = 0.0f;
+			ptr->endpos = vecAbsStart;
+		}
+		else if ( vecAbsEnd.z < g_flFloor )
+		{
+			ptr->fraction = ( vecAbsStart.z - g_flFloor ) / ( vecAbsStart.z - vecAbsEnd.z );
+			VectorLerp( vecAbsStart, vecAbsEnd, ptr->fraction, ptr->endpos );
+		}
+	}
+
+	virtual void GetRandomPointsOnControllingObjectHitBox( CParticleCollection *pParticles, int nControlPointNumber,
+		int nNumPtsOut, float flBBoxScale, int nNumTrysToGetAPointInsideTheModel, Vector *pPntsOut,
+		Vector vecDirectionBias, Vector *pHitBoxRelativeCoordOut, int *pHitBoxIndexOut )
+	{
+		for ( int i = 0; i < nNumPtsOut; ++i )
+		{
+			pPntsOut[i].Init();
+		}
+	}
+
+	virtual float GetPixelVisibility( int *pQueryHandle, const Vector &vecOrigin, float flScale ) { return 0.0f; }
+};
+
+static CFloorParticleSystemQuery s_FloorQuery;
+
+
+//-----------------------------------------------------------------------------
+// The application object
+//-----------------------------------------------------------------------------
+class CParticleBenchApp : public CTier3SteamApp
+{
+	typedef CTier3SteamApp BaseClass;
+
+public:
+	// Methods of IApplication
+	virtual bool Create();
+	virtual bool PreInit();
+	virtual int Startup();
+	virtual int Main();
+	virtual void Shutdown();
+	virtual void PostShutdown();
+	virtual void Destroy() {}
+
+private:
+	void PrintHelp();
+	float Simulate( CUtlVector< const char * > &systems, bool bParallel, int &nParticles, int &nUnderFloor );
+	void BenchmarkOperators( CUtlVector< const char * > &systems, int nIterations );
+	int TestChildrenWritingParent();
+};
+
+DEFINE_CONSOLE_STEAM_APPLICATION_OBJECT( CParticleBenchApp );
+
+
+bool CParticleBenchApp::Create()
+{
+	AppSystemInfo_t appSystems[] =
+	{
+		{ "vstdlib.dll",			PROCESS_UTILS_INTERFACE_VERSION },
+		{ "materialsystem.dll",		MATERIAL_SYSTEM_INTERFACE_VERSION },
+
+		{ "", "" }	// Required to terminate the list
+	};
+
+	if ( !AddSystems( appSystems ) )
+		return false;
+
+	IMaterialSystem *pMaterialSystem = (IMaterialSystem*)FindSystem( MATERIAL_SYSTEM_INTERFACE_VERSION );
+	if ( !pMaterialSystem )
+	{
+		Warning( "Create: Unable to connect to material system interface!\n" );
+		return false;
+	}
+
+	// Nothing is drawn, the materials only need to load
+	pMaterialSystem->SetShaderAPI( "shaderapiempty.dll" );
+	return true;
+}
+
+bool CParticleBenchApp::PreInit()
+{
+	MathLib_Init( 2.2f, 2.2f, 0.0f, 2.0f, false, false, false, false );
+
+	if ( !BaseClass::PreInit() )
+		return false;
+
+	CreateInterfaceFn factory = GetFactory();
+	ConnectTier1Libraries( &factory, 1 );
+	ConnectTier2Libraries( &factory, 1 );
+	ConnectTier3Libraries( &factory, 1 );
+
+	if ( !g_pFullFileSystem || !g_pMaterialSystem )
+	{
+		Warning( "particlebench is missing a required interface!\n" );
+		return false;
+	}
+
+	SetupSearchPaths( NULL, false, true );
+	return true;
+}
+
+int CParticleBenchApp::Startup()
+{
+	if ( BaseClass::Startup() < 0 )
+		return -1;
+
+	g_pMaterialSystem->ModInit();
+	return 0;
+}
+
+void CParticleBenchApp::Shutdown()
+{
+	g_pMaterialSystem->ModShutdown();
+	BaseClass::Shutdown();
+}
+
+void CParticleBenchApp::PostShutdown()
+{
+	DisconnectTier3Libraries();
+	DisconnectTier2Libraries();
+	DisconnectTier1Libraries();
+	BaseClass::PostShutdown();
+}
+
+void CParticleBenchApp::PrintHelp()
+{
+	Msg( "usage: particlebench [-threads n] [-systems n] [-frames n] [-ops [n]] [-floor z] file.pcf [file.pcf ...]\n" );
+	Msg( "       particlebench [-threads n] -test\n" );
+	Msg( "   -threads n : job pool threads next to the main one\n" );
+	Msg( "   -systems n : particle systems simulated at once (default %d)\n", g_nSystems );
+	Msg( "   -frames n  : frames simulated, at %.0f per second (default %d)\n", 1.0f / g_flFrameTime, g_nFrames );
+	Msg( "   -ops n     : time each operator n times (default %d) 4 and 8 wide, after -frames frames\n", BENCH_OP_ITERATIONS );
+	Msg( "   -floor z   : collide with a floor at height z (systems are at 0), count traces and particles under it\n" );
+	Msg( "   -test      : check that two children colliding through their parent's cache don't simulate at once\n" );
+}
+
+
+//-----------------------------------------------------------------------------
+// Simulation
+//-----------------------------------------------------------------------------
+static int CountParticles( CParticleCollection *pParticles, int &nUnderFloor )
+{
+	int nCount = pParticles->m_nActiveParticles;
+	for ( int i = 0; i < pParticles->m_nActiveParticles; i++ )
+	{
+		const float *pXYZ = pParticles->GetFloatAttributePtr( PARTICLE_ATTRIBUTE_XYZ, i );
+		nUnderFloor += ( pXYZ[8] < g_flFloor );
+	}
+	for ( CParticleCollection *i = pParticles->m_Children.m_pHead; i; i = i->m_pNext )
+	{
+		nCount += CountParticles( i, nUnderFloor );
+	}
+	return nCount;
+}
+
+// Simulates g_nSystems systems, taking turns through the loaded ones
+float CParticleBenchApp::Simulate( CUtlVector< const char * > &systems, bool bParallel, int &nParticles, int &nUnderFloor )
+{
+	g_pParticleSystemMgr->EnableParallelSimulation( bParallel );
+
+	// same seeds and places both times
+	int nSide = (int)ceil( sqrt( (float)g_nSystems ) );
+	CUtlVector< CParticleCollection * > collections;
+	for ( int i = 0; i < g_nSystems; i++ )
+	{
+		CParticleCollection *pParticles = g_pParticleSystemMgr->CreateParticleCollection( systems[i % systems.Count()], 0.0f, i );
+		if ( !pParticles )
+			continue;
+
+		Vector vecOrigin( ( i % nSide ) * BENCH_SPACING, ( i / nSide ) * BENCH_SPACING, 0.0f );
+		for ( int nPoint = 0; nPoint < 2; nPoint++ )
+		{
+			pParticles->SetControlPoint( nPoint, vecOrigin );
+		}
+		collections.AddToTail( pParticles );
+	}
+
+	float flStart = Plat_FloatTime();
+	for ( int nFrame = 0; nFrame < g_nFrames; nFrame++ )
+	{
+		g_pParticleSystemMgr->SimulateCollections( collections.Base(), collections.Count(), g_flFrameTime );
+	}
+	float flTime = Plat_FloatTime() - flStart;
+
+	nParticles = nUnderFloor = 0;
+	for ( int i = 0; i < collections.Count(); i++ )
+	{
+		nParticles += CountParticles( collections[i], nUnderFloor );
+		delete collections[i];
+	}
+	return flTime;
+}
+
+
+// Simulates each system on its own for g_nFrames, then times its operators
+void CParticleBenchApp::BenchmarkOperators( CUtlVector< const char * > &systems, int nIterations )
+{
+	Msg( "%-40s %6s %10s %10s %8s %10s\n", "operator", "count", "4 wide ms", "8 wide ms", "speedup", "mismatches" );
+
+	CUtlVector< CParticleSystemMgr::OperatorTiming_t > timings;
+	for ( int i = 0; i < systems.Count(); i++ )
+	{
+		CParticleCollection *pParticles = g_pParticleSystemMgr->CreateParticleCollection( systems[i], 0.0f, i );
+		if ( !pParticles )
+			continue;
+
+		for ( int nPoint = 0; nPoint < 2; nPoint++ )
+		{
+			pParticles->SetControlPoint( nPoint, vec3_origin );
+		}
+		for ( int nFrame = 0; nFrame < g_nFrames; nFrame++ )
+		{
+			pParticles->Simulate( g_flFrameTime, false );
+		}
+
+		g_pParticleSystemMgr->BenchmarkOperators( pParticles, nIterations, timings );
+		if ( timings.Count() )
+		{
+			Msg( "%s:\n", systems[i] );
+		}
+		for ( int j = 0; j < timings.Count(); j++ )
+		{
+			const CParticleSystemMgr::OperatorTiming_t &timing = timings[j];
+			if ( timing.m_flWideTime > 0.0f )
+			{
+				Msg( "  %-38s %6d %10.3f %10.3f %7.2fx %10d\n", timing.m_pName, pParticles->m_nActiveParticles,
+					timing.m_flNarrowTime * 1000.0f, timing.m_flWideTime * 1000.0f,
+					timing.m_flNarrowTime / timing.m_flWideTime, timing.m_nMismatches );
+			}
+			else
+			{
+				Msg( "  %-38s %6d %10.3f %10s\n", timing.m_pName, pParticles->m_nActiveParticles,
+					timing.m_flNarrowTime * 1000.0f, "n/a" );
+			}
+		}
+		delete pParticles;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Self test
+//-----------------------------------------------------------------------------
+static CDmxElement *AddTestOperator( CDmxElement *pSystem, const char *pListName, const char *pFunctionName )
+{
+	CDmxElementModifyScope modify( pSystem );
+	CDmxElement *pOperator = CreateDmxElement( "DmeParticleOperator" );
+	pOperator->SetValue( "name", pFunctionName );
+	pOperator->SetValue( "functionName", pFunctionName );
+	pSystem->AddAttribute( pListName )->GetArrayForEdit<CDmxElement*>().AddToTail( pOperator );
+	return pOperator;
+}
+
+static CDmxElement *CreateTestSystem( const char *pName )
+{
+	CDmxElement *pSystem = CreateDmxElement( "DmeParticleSystemDefinition" );
+	pSystem->SetValue( "name", pName );
+	return pSystem;
+}
+
+static void AddTestChild( CDmxElement *pParent, CDmxElement *pChild )
+{
+	CDmxElementModifyScope modify( pParent );
+	CDmxElement *pChildRef = CreateDmxElement( "DmeParticleChild" );
+	pChildRef->SetValue( "name", pChild->GetName() );
+	pChildRef->SetValue( "child", pChild );
+	pParent->AddAttribute( "children" )->GetArrayForEdit<CDmxElement*>().AddToTail( pChildRef );
+}
+
+// A parent with two children that both collide through the parent's collision cache. The children
+// must be flagged as writing to their parent, which keeps them off the job pool, and share one cache.
+int CParticleBenchApp::TestChildrenWritingParent()
+{
+	CUtlBuffer buf;
+	{
+		DECLARE_DMX_CONTEXT();
+		CDmxElement *pParent = CreateTestSystem( "particlebench_test_parent" );
+		const char *pChildNames[] = { "particlebench_test_child_a", "particlebench_test_child_b" };
+		for ( int i = 0; i < ARRAYSIZE( pChildNames ); i++ )
+		{
+			CDmxElement *pChild = CreateTestSystem( pChildNames[i] );
+			AddTestOperator( pChild, "emitters", "emit_continuously" );
+			AddTestOperator( pChild, "initializers", "Position Within Sphere Random" );
+			AddTestOperator( pChild, "initializers", "Velocity Random" );
+			AddTestOperator( pChild, "operators", "Movement Basic" );
+			// the voxel grid mode, whose cache the parent keeps
+			CDmxElement *pCollision = AddTestOperator( pChild, "constraints", "Collision via traces" );
+			pCollision->SetValue( "collision mode", 4 );
+			AddTestChild( pParent, pChild );
+		}
+		if ( !SerializeDMX( buf, pParent ) )
+		{
+			Warning( "test: unable to write the test systems\n" );
+			return -1;
+		}
+		CleanupDMX( pParent );
+	}
+
+	if ( !g_pParticleSystemMgr->ReadParticleConfigFile( buf, true ) )
+	{
+		Warning( "test: unable to read the test systems\n" );
+		return -1;
+	}
+
+	g_pParticleSystemMgr->EnableParallelSimulation( true );
+	CParticleCollection *pParticles = g_pParticleSystemMgr->CreateParticleCollection( "particlebench_test_parent", 0.0f, 1 );
+	if ( !pParticles )
+	{
+		Warning( "test: unable to create the test system\n" );
+		return -1;
+	}
+	for ( int nPoint = 0; nPoint < 2; nPoint++ )
+	{
+		pParticles->SetControlPoint( nPoint, vec3_origin );
+	}
+
+	int nFailures = 0;
+	int nChildren = 0;
+	for ( CParticleCollection *i = pParticles->m_Children.m_pHead; i; i = i->m_pNext )
+	{
+		++nChildren;
+		if ( !i->m_bWritesParentData )
+		{
+			Warning( "test: child %s isn't flagged as writing its parent's data\n", i->m_pDef->GetName() );
+			++nFailures;
+		}
+	}
+	if ( nChildren != 2 )
+	{
+		Warning( "test: expected 2 children, got %d\n", nChildren );
+		++nFailures;
+	}
+
+	for ( int nFrame = 0; nFrame < g_nFrames; nFrame++ )
+	{
+		pParticles->Simulate( g_flFrameTime, false );
+	}
+
+	int nCaches = 0;
+	for ( int i = 0; i < NUM_COLLISION_CACHE_MODES; i++ )
+	{
+		nCaches += ( pParticles->m_pCollisionCacheData[i] != NULL );
+		for ( CParticleCollection *pChild = pParticles->m_Children.m_pHead; pChild; pChild = pChild->m_pNext )
+		{
+			if ( pChild->m_pCollisionCacheData[i] )
+			{
+				Warning( "test: child %s has its own collision cache\n", pChild->m_pDef->GetName() );
+				++nFailures;
+			}
+		}
+	}
+	if ( nCaches != 1 )
+	{
+		Warning( "test: expected the parent to have 1 collision cache, it has %d\n", nCaches );
+		++nFailures;
+	}
+
+	int nUnderFloor = 0;
+	int nCount = CountParticles( pParticles, nUnderFloor );
+	delete pParticles;
+
+	Msg( "test: %d children, %d particles after %d frames, %s\n", nChildren, nCount, g_nFrames, nFailures ? "FAILED" : "passed" );
+	return nFailures ? -1 : 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Main
+//-----------------------------------------------------------------------------
+int CParticleBenchApp::Main()
+{
+	// files on the command line can be anywhere
+	g_pFullFileSystem->AddSearchPath( "", "LOCAL", PATH_ADD_TO_HEAD );
+
+	if ( CommandLine()->FindParm( "-help" ) )
+	{
+		PrintHelp();
+		return 0;
+	}
+
+	int nThreads = CommandLine()->ParmValue( "-threads", -1 );
+	g_nSystems = max( 1, CommandLine()->ParmValue( "-systems", g_nSystems ) );
+	g_nFrames = max( 1, CommandLine()->ParmValue( "-frames", g_nFrames ) );
+
+	g_bFloor = ( CommandLine()->FindParm( "-floor" ) != 0 );
+	g_flFloor = CommandLine()->ParmValue( "-floor", g_flFloor );
+	bool bTest = ( CommandLine()->FindParm( "-test" ) != 0 );
+
+	g_pParticleSystemMgr->Init( ( g_bFloor || bTest ) ? &s_FloorQuery : NULL );
+	g_pParticleSystemMgr->AddBuiltinSimulationOperators();
+	g_pParticleSystemMgr->AddBuiltinRenderingOperators();
+
+	if ( bTest )
+	{
+		if ( nThreads != 0 )
+		{
+			ThreadPoolStartParams_t startParams;
+			if ( nThreads > 0 )
+				startParams.nThreads = nThreads;
+			g_pThreadPool->Start( startParams, "ParticleBench" );
+		}
+		int nResult = TestChildrenWritingParent();
+		if ( nThreads != 0 )
+		{
+			g_pThreadPool->Stop();
+		}
+		return nResult;
+	}
+
+	for ( int i = 1; i < CommandLine()->ParmCount(); i++ )
+	{
+		const char *pFileName = CommandLine()->GetParm( i );
+		const char *pExtension = Q_GetFileExtension( pFileName );
+		if ( !pExtension || Q_stricmp( pExtension, "pcf" ) )
+			continue;
+
+		if ( !g_pParticleSystemMgr->ReadParticleConfigFile( pFileName, true ) )
+		{
+			Warning( "Unable to read %s\n", pFileName );
+		}
+	}
+
+	CUtlVector< const char * > systems;
+	for ( int i = 0; i < g_pParticleSystemMgr->GetParticleSystemCount(); i++ )
+	{
+		systems.AddToTail( g_pParticleSystemMgr->GetParticleSystemNameFromIndex( i ) );
+	}
+
+	if ( systems.Count() == 0 )
+	{
+		Warning( "No particle systems loaded\n\n" );
+		PrintHelp();
+		return -1;
+	}
+
+	if ( CommandLine()->FindParm( "-ops" ) )
+	{
+		if ( !g_pParticleSystemMgr->IsWideSIMDEnabled() )
+		{
+			Msg( "No AVX2, operators only run 4 wide\n" );
+		}
+		// -ops can be followed straight by a file name
+		int nIterations = CommandLine()->ParmValue( "-ops", BENCH_OP_ITERATIONS );
+		BenchmarkOperators( systems, nIterations > 0 ? nIterations : BENCH_OP_ITERATIONS );
+		return 0;
+	}
+
+	if ( nThreads != 0 )
+	{
+		ThreadPoolStartParams_t startParams;
+		if ( nThreads > 0 )
+			startParams.nThreads = nThreads;
+		g_pThreadPool->Start( startParams, "ParticleBench" );
+	}
+	Msg( "%d particle system definitions, %d systems, %d frames, %d pool threads\n",
+		systems.Count(), g_nSystems, g_nFrames, g_pThreadPool->NumThreads() );
+
+	int nSerialParticles, nParallelParticles, nSerialUnderFloor, nParallelUnderFloor;
+	g_pParticleSystemMgr->ResetCollisionTraceCount();
+	float flSerial = Simulate( systems, false, nSerialParticles, nSerialUnderFloor );
+	int nTraces = g_pParticleSystemMgr->GetCollisionTraceCount();
+	float flParallel = Simulate( systems, true, nParallelParticles, nParallelUnderFloor );
+
+	Msg( "in order: %7.3f seconds, %d particles at the end\n", flSerial, nSerialParticles );
+	Msg( "job pool: %7.3f seconds, %d particles at the end, %.2fx\n", flParallel, nParallelParticles,
+		flParallel > 0.0f ? flSerial / flParallel : 0.0f );
+	if ( g_bFloor )
+	{
+		Msg( "collision: %d traces, %.1f a frame, %d particles under the floor at the end\n",
+			nTraces, (float)nTraces / g_nFrames, nSerialUnderFloor );
+	}
+
+	if ( nThreads != 0 )
+	{
+		g_pThreadPool->Stop();
+	}
+	return 0;
+}
@@ -0,0 +1,332 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Ray-trace throughput benchmark. Builds the ray tracing tree of a
+//			synthetic scene and of any .bsp files given, serially, on the job
+//			pool and with binned splits, then streams the same rays through
+//			each tree 4 and 8 wide and checks that every hit agrees.
+//
+//=============================================================================//
+
+#include "mathlib/mathlib.h"
+#include "bsplib.h"
+#include "raytrace.h"
+#include "tier0/icommandline.h"
+#include "vstdlib/jobthread.h"
+#include "vstdlib/random.h"
+#include "tier2/tier2.h"
+#include "filesystem_tools.h"
+#include "tools_minidump.h"
+#include "cmdlib.h"
+
+static int g_nRays = 1000000;
+static int g_nSyntheticTriangles = 500000;
+
+#define SYNTHETIC_SCENE_SIZE 8192.0f
+
+
+//-----------------------------------------------------------------------------
+// Scenes
+//-----------------------------------------------------------------------------
+static void AddSyntheticScene( RayTracingEnvironment &env )
+{
+	// boxes and loose triangles scattered through a cube, roughly the mix of
+	// brushes and detail a map has
+	RandomSeed( 1 );
+	float flHalf = SYNTHETIC_SCENE_SIZE * 0.5f;
+	int id = 0;
+	while ( id < g_nSyntheticTriangles )
+	{
+		Vector center( RandomFloat( -flHalf, flHalf ), RandomFloat( -flHalf, flHalf ), RandomFloat( -flHalf, flHalf ) );
+		if ( RandomInt( 0, 3 ) == 0 )
+		{
+			Vector size( RandomFloat( 8, 512 ), RandomFloat( 8, 512 ), RandomFloat( 8, 128 ) );
+			env.AddAxisAlignedRectangularSolid( id, center - size, center + size, Vector( 1, 1, 1 ) );
+			id += 12;
+		}
+		else
+		{
+			Vector v[3];
+			for ( int i = 0; i < 3; i++ )
+			{
+				v[i] = center + Vector( RandomFloat( -64, 64 ), RandomFloat( -64, 64 ), RandomFloat( -64, 64 ) );
+			}
+			env.AddTriangle( id++, v[0], v[1], v[2], Vector( 1, 1, 1 ) );
+		}
+	}
+}
+
+static void AddScene( RayTracingEnvironment &env, const char *pBSPName )
+{
+	if ( pBSPName )
+	{
+		// LoadBSPFile already ran, see main
+		env.InitializeFromLoadedBSP();
+	}
+	else
+	{
+		AddSyntheticScene( env );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Rays
+//-----------------------------------------------------------------------------
+struct BenchRay_t
+{
+	Vector m_vecStart;
+	Vector m_vecEnd;
+};
+
+static void MakeRays( RayTracingEnvironment const &env, bool bClustered, CUtlVector<BenchRay_t> &rays )
+{
+	RandomSeed( bClustered ? 3 : 2 );
+	rays.SetCount( g_nRays );
+
+	Vector vecSize = env.m_MaxBound - env.m_MinBound;
+	float flLength = vecSize.Length() * 0.5f;
+	Vector vecOrigin;
+	for ( int i = 0; i < g_nRays; i++ )
+	{
+		Vector vecStart( RandomFloat( env.m_MinBound.x, env.m_MaxBound.x ),
+						 RandomFloat( env.m_MinBound.y, env.m_MaxBound.y ),
+						 RandomFloat( env.m_MinBound.z, env.m_MaxBound.z ) );
+		if ( !bClustered )
+		{
+			// one point to another, like the visibility rays between patches
+			rays[i].m_vecStart = vecStart;
+			rays[i].m_vecEnd.Init( RandomFloat( env.m_MinBound.x, env.m_MaxBound.x ),
+								   RandomFloat( env.m_MinBound.y, env.m_MaxBound.y ),
+								   RandomFloat( env.m_MinBound.z, env.m_MaxBound.z ) );
+			continue;
+		}
+
+		// runs of 64 rays from one point in all directions, like the sky and
+		// indirect samples of a single luxel
+		if ( ( i & 63 ) == 0 )
+		{
+			vecOrigin = vecStart;
+		}
+		Vector vecDir( RandomFloat( -1, 1 ), RandomFloat( -1, 1 ), RandomFloat( -1, 1 ) );
+		VectorNormalize( vecDir );
+		rays[i].m_vecStart = vecOrigin;
+		rays[i].m_vecEnd = vecOrigin + vecDir * flLength;
+	}
+}
+
+static float TraceRays( RayTracingEnvironment &env, CUtlVector<BenchRay_t> const &rays, RayTracingSingleResult *pResults )
+{
+	RayStream stream;
+	float flStart = Plat_FloatTime();
+	for ( int i = 0; i < rays.Count(); i++ )
+	{
+		env.AddToRayStream( stream, rays[i].m_vecStart, rays[i].m_vecEnd, &pResults[i] );
+	}
+	env.FinishRayStream( stream );
+	return Plat_FloatTime() - flStart;
+}
+
+static int CountMismatches( RayTracingSingleResult const *pReference, RayTracingSingleResult const *pResults, int nRays )
+{
+	// hits beyond the end of a ray don't count, nor does which of two triangles
+	// at exactly the same distance was hit
+	int nMismatches = 0;
+	for ( int i = 0; i < nRays; i++ )
+	{
+		RayTracingSingleResult const &ref = pReference[i];
+		RayTracingSingleResult const &res = pResults[i];
+		bool bRefHit = ( ref.HitID != -1 ) && ( ref.HitDistance < ref.ray_length );
+		bool bHit = ( res.HitID != -1 ) && ( res.HitDistance < res.ray_length );
+		if ( bRefHit != bHit )
+		{
+			nMismatches++;
+		}
+		else if ( bHit && ( ref.HitID != res.HitID ) && ( ref.HitDistance != res.HitDistance ) )
+		{
+			nMismatches++;
+		}
+	}
+	return nMismatches;
+}
+
+
+//-----------------------------------------------------------------------------
+// Trees
+//-----------------------------------------------------------------------------
+static bool SameTree( RayTracingEnvironment const &a, int nNodeA, RayTracingEnvironment const &b, int nNodeB )
+{
+	CacheOptimizedKDNode const &nodeA = a.OptimizedKDTree[nNodeA];
+	CacheOptimizedKDNode const &nodeB = b.OptimizedKDTree[nNodeB];
+	if ( nodeA.NodeType() != nodeB.NodeType() )
+		return false;
+
+	if ( nodeA.NodeType() == KDNODE_STATE_LEAF )
+	{
+		int nTris = nodeA.NumberOfTrianglesInLeaf();
+		if ( nTris != nodeB.NumberOfTrianglesInLeaf() )
+			return false;
+		for ( int i = 0; i < nTris; i++ )
+		{
+			if ( a.TriangleIndexList[nodeA.TriangleIndexStart() + i] != b.TriangleIndexList[nodeB.TriangleIndexStart() + i] )
+				return false;
+		}
+		return true;
+	}
+
+	if ( nodeA.SplittingPlaneValue != nodeB.SplittingPlaneValue )
+		return false;
+
+	return SameTree( a, nodeA.LeftChild(), b, nodeB.LeftChild() ) &&
+		SameTree( a, nodeA.RightChild(), b, nodeB.RightChild() );
+}
+
+static float BuildTree( RayTracingEnvironment &env, const char *pBSPName, uint32 nFlags, const char *pDescription )
+{
+	env.Flags = nFlags;
+	AddScene( env, pBSPName );
+	float flStart = Plat_FloatTime();
+	env.SetupAccelerationStructure();
+	float flTime = Plat_FloatTime() - flStart;
+	printf( "  %-18s %7.2f s  %8d nodes\n", pDescription, flTime, env.OptimizedKDTree.Count() );
+	return flTime;
+}
+
+
+//-----------------------------------------------------------------------------
+// Runs every configuration on one scene
+//-----------------------------------------------------------------------------
+static void BenchmarkScene( const char *pBSPName )
+{
+	RayTracingEnvironment *pSerial = new RayTracingEnvironment;
+	RayTracingEnvironment *pParallel = new RayTracingEnvironment;
+	RayTracingEnvironment *pBinned = new RayTracingEnvironment;
+
+	printf( "scene %s\n", pBSPName ? pBSPName : "synthetic" );
+	float flSerial = BuildTree( *pSerial, pBSPName, RTE_FLAGS_SERIAL_TREE_GENERATION, "serial build" );
+	float flParallel = BuildTree( *pParallel, pBSPName, 0, "parallel build" );
+	BuildTree( *pBinned, pBSPName, RTE_FLAGS_FAST_TREE_GENERATION, "binned build" );
+	int nTriangles = pSerial->OptimizedTriangleList.Count();
+	printf( "  %d triangles, parallel build %.1fx, tree %s the serial one\n", nTriangles,
+			flParallel > 0.0f ? flSerial / flParallel : 0.0f,
+			SameTree( *pSerial, 0, *pParallel, 0 ) ? "matches" : "DIFFERS FROM" );
+
+	if ( !nTriangles )
+	{
+		delete pSerial;
+		delete pParallel;
+		delete pBinned;
+		return;
+	}
+
+	RayTracingSingleResult *pReference = new RayTracingSingleResult[g_nRays];
+	RayTracingSingleResult *pResults = new RayTracingSingleResult[g_nRays];
+	CUtlVector<BenchRay_t> rays;
+	for ( int nRaySet = 0; nRaySet < 2; nRaySet++ )
+	{
+		bool bClustered = ( nRaySet == 1 );
+		MakeRays( *pSerial, bClustered, rays );
+		printf( "  %d %s rays\n", g_nRays, bClustered ? "clustered" : "scattered" );
+
+		pSerial->Flags |= RTE_FLAGS_DISABLE_WIDE_TRAVERSAL;
+		float flTime = TraceRays( *pSerial, rays, pReference );
+		printf( "    4 wide              %7.3f Mrays/s\n", g_nRays / flTime * 1.0e-6f );
+
+		if ( RayTracingEnvironment::WideTraversalAvailable() )
+		{
+			pParallel->Flags &= ~RTE_FLAGS_DISABLE_WIDE_TRAVERSAL;
+			flTime = TraceRays( *pParallel, rays, pResults );
+			printf( "    8 wide              %7.3f Mrays/s, %d mismatches\n", g_nRays / flTime * 1.0e-6f,
+					CountMismatches( pReference, pResults, g_nRays ) );
+		}
+
+		pBinned->Flags |= RTE_FLAGS_DISABLE_WIDE_TRAVERSAL;
+		flTime = TraceRays( *pBinned, rays, pResults );
+		printf( "    4 wide, binned tree %7.3f Mrays/s, %d mismatches\n", g_nRays / flTime * 1.0e-6f,
+				CountMismatches( pReference, pResults, g_nRays ) );
+
+		if ( RayTracingEnvironment::WideTraversalAvailable() )
+		{
+			pBinned->Flags &= ~RTE_FLAGS_DISABLE_WIDE_TRAVERSAL;
+			flTime = TraceRays( *pBinned, rays, pResults );
+			printf( "    8 wide, binned tree %7.3f Mrays/s, %d mismatches\n", g_nRays / flTime * 1.0e-6f,
+					CountMismatches( pReference, pResults, g_nRays ) );
+		}
+	}
+
+	delete[] pReference;
+	delete[] pResults;
+	delete pSerial;
+	delete pParallel;
+	delete pBinned;
+}
+
+
+int main( int argc, char **argv )
+{
+	SetupDefaultToolsMinidumpHandler();
+
+	CommandLine()->CreateCmdLine( argc, argv );
+	InitCommandLineProgram( argc, argv );
+	g_pFileSystem = g_pFullFileSystem;
+
+	MathLib_Init( 2.2f, 2.2f, 0.0f, 2.0f, false, false, false, false );
+
+	int nThreads = -1;
+	int i;
+	for ( i = 1; i < argc; i++ )
+	{
+		if ( !Q_stricmp( argv[i], "-threads" ) && i + 1 < argc )
+		{
+			nThreads = atoi( argv[++i] );
+		}
+		else if ( !Q_stricmp( argv[i], "-rays" ) && i + 1 < argc )
+		{
+			g_nRays = max( 8, atoi( argv[++i] ) );
+		}
+		else if ( !Q_stricmp( argv[i], "-tris" ) && i + 1 < argc )
+		{
+			g_nSyntheticTriangles = max( 12, atoi( argv[++i] ) );
+		}
+		else if ( argv[i][0] == '-' )
+		{
+			printf( "usage: raytracebench [-threads n] [-rays n] [-tris n] [bspfile ...]\n" );
+			printf( "   -threads n : job pool threads next to the main one for the parallel builds\n" );
+			printf( "   -rays n    : rays traced per ray set (default %d)\n", g_nRays );
+			printf( "   -tris n    : triangles in the synthetic scene (default %d)\n", g_nSyntheticTriangles );
+			Error( "Incorrect syntax." );
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if ( nThreads != 0 )
+	{
+		ThreadPoolStartParams_t startParams;
+		if ( nThreads > 0 )
+			startParams.nThreads = nThreads;
+		g_pThreadPool->Start( startParams, "RayTraceBench" );
+	}
+	printf( "%d pool threads, 8 wide traversal %s\n", g_pThreadPool->NumThreads(),
+			RayTracingEnvironment::WideTraversalAvailable() ? "available" : "not available" );
+
+	BenchmarkScene( NULL );
+
+	for ( ; i < argc; i++ )
+	{
+		char source[MAX_PATH];
+		Q_strncpy( source, argv[i], sizeof( source ) );
+		Q_DefaultExtension( source, ".bsp", sizeof( source ) );
+		Q_strncpy( source, ExpandPath( source ), sizeof( source ) );
+		LoadBSPFile( source );
+		BenchmarkScene( source );
+		UnloadBSPFile();
+	}
+
+	if ( nThreads != 0 )
+	{
+		g_pThreadPool->Stop();
+	}
+	return 0;
+}
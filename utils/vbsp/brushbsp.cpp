@@ -9,10 +9,21 @@
 #include "vbsp.h"
 
 
-int		c_nodes;
-int		c_nonvis;
+int32	c_nodes;
+int32	c_nonvis;
 int		c_active_brushes;
 
+// A subtree queued by BrushBSP to be built on the threads
+struct bspsubtree_t
+{
+	node_t		*node;
+	bspbrush_t	*brushes;
+	int			numbrushes;
+};
+
+static CUtlVector<bspsubtree_t>	s_Subtrees;
+static bool		s_bDeferSubtrees;
+
 // if a brush just barely pokes onto the other side,
 // let it slide by without chopping
 #define	PLANESIDE_EPSILON	0.001
@@ -310,17 +321,15 @@ AllocNode
 */
 node_t *AllocNode (void)
 {
-	static int s_NodeCount = 0;
+	static int32 s_NodeCount = 0;
 
 	node_t	*node;
 
 	node = (node_t*)malloc(sizeof(*node));
 	memset (node, 0, sizeof(*node));
-	node->id = s_NodeCount;
+	node->id = ThreadInterlockedIncrement (&s_NodeCount) - 1;
 	node->diskId = -1;
 
-	s_NodeCount++;
-
 	return node;
 }
 
@@ -332,7 +341,7 @@ AllocBrush
 */
 bspbrush_t *AllocBrush (int numsides)
 {
-	static int s_BrushId = 0;
+	static int32 s_BrushId = 0;
 
 	bspbrush_t	*bb;
 	int			c;
@@ -340,7 +349,7 @@ bspbrush_t *AllocBrush (int numsides)
 	c = (int)&(((bspbrush_t *)0)->sides[numsides]);
 	bb = (bspbrush_t*)malloc(c);
 	memset (bb, 0, c);
-	bb->id = s_BrushId++;
+	bb->id = ThreadInterlockedIncrement (&s_BrushId) - 1;
 	if (numthreads == 1)
 		c_active_brushes++;
 	return bb;
@@ -977,8 +986,7 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 		{
 			if (pass > 0)
 			{
-				if (numthreads == 1)
-					c_nonvis++;
+				ThreadInterlockedIncrement (&c_nonvis);
 			}
 			break;
 		}
@@ -1326,20 +1334,19 @@ void SplitBrushList (bspbrush_t *brushes,
 
 /*
 ================
-BuildTree_r
+SplitNode
+
+Picks the plane for a node and splits its brushes and volume between two
+new children. Returns false and makes the node a leaf if nothing splits it.
 ================
 */
-
-
-node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
+static bool SplitNode (node_t *node, bspbrush_t *brushes, bspbrush_t **children)
 {
 	node_t		*newnode;
 	side_t		*bestside;
 	int			i;
-	bspbrush_t	*children[2];
 
-	if (numthreads == 1)
-		c_nodes++;
+	ThreadInterlockedIncrement (&c_nodes);
 
 	// find the best plane to use as a splitter
 	bestside = SelectSplitSide (brushes, node);
@@ -1350,7 +1357,7 @@ node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
 		node->side = NULL;
 		node->planenum = -1;
 		LeafNode (node, brushes);
-		return node;
+		return false;
 	}
 			 
 	// this is a splitplane node
@@ -1371,6 +1378,23 @@ node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
 	SplitBrush (node->volume, node->planenum, &node->children[0]->volume,
 		&node->children[1]->volume);
 
+	return true;
+}
+
+
+/*
+================
+BuildTree_r
+================
+*/
+node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
+{
+	bspbrush_t	*children[2];
+	int			i;
+
+	if (!SplitNode (node, brushes, children))
+		return node;
+
 	// recursively process children
 	for (i=0 ; i<2 ; i++)
 	{
@@ -1379,6 +1403,110 @@ node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
 
 	return node;
 }
+
+
+/*
+================
+BuildTreeTop_r
+
+Splits the first levels of the tree and queues the subtrees below them.
+Nothing a subtree does reads or writes outside of its own nodes and
+brushes, so they can be built in any order on any thread.
+================
+*/
+static void BuildTreeTop_r (node_t *node, bspbrush_t *brushes, int depth)
+{
+	bspbrush_t	*children[2];
+	int			i;
+
+	if (depth == 0)
+	{
+		bspsubtree_t subtree;
+		subtree.node = node;
+		subtree.brushes = brushes;
+		subtree.numbrushes = CountBrushList (brushes);
+
+		ThreadLock ();
+		s_Subtrees.AddToTail (subtree);
+		ThreadUnlock ();
+		return;
+	}
+
+	if (!SplitNode (node, brushes, children))
+		return;
+
+	for (i=0 ; i<2 ; i++)
+	{
+		BuildTreeTop_r (node->children[i], children[i], depth - 1);
+	}
+}
+
+
+static int SubtreeDepth (void)
+{
+	// a few subtrees per thread so the small ones fill in behind the big ones
+	int depth = 0;
+	while ((1 << depth) < numthreads * 4)
+		depth++;
+	return depth;
+}
+
+
+static int __cdecl CompareSubtrees (const void *a, const void *b)
+{
+	return ((bspsubtree_t const *)b)->numbrushes - ((bspsubtree_t const *)a)->numbrushes;
+}
+
+
+static void BuildSubtree_Thread (int threadnum, int subtree)
+{
+	BuildTree_r (s_Subtrees[subtree].node, s_Subtrees[subtree].brushes);
+}
+
+
+static void BuildSubtrees (qboolean showpacifier)
+{
+	// largest first, they finish last
+	qsort (s_Subtrees.Base(), s_Subtrees.Count(), sizeof(bspsubtree_t), CompareSubtrees);
+	RunThreadsOnIndividual (s_Subtrees.Count(), showpacifier, BuildSubtree_Thread);
+	s_Subtrees.Purge ();
+}
+
+
+/*
+================
+BeginDeferredSubtrees
+
+Until EndDeferredSubtrees, BrushBSP only splits the top of each tree and
+queues the rest, so it can be called from the threads.
+================
+*/
+void BeginDeferredSubtrees (void)
+{
+	s_bDeferSubtrees = true;
+	c_nodes = 0;
+	c_nonvis = 0;
+}
+
+
+/*
+================
+EndDeferredSubtrees
+
+Builds every subtree queued since BeginDeferredSubtrees
+================
+*/
+void EndDeferredSubtrees (void)
+{
+	s_bDeferSubtrees = false;
+
+	qprintf ("%5i subtrees\n", s_Subtrees.Count());
+	BuildSubtrees (!verbose);
+
+	qprintf ("%5i visible nodes\n", c_nodes/2 - c_nonvis);
+	qprintf ("%5i nonvis nodes\n", c_nonvis);
+	qprintf ("%5i leafs\n", (c_nodes+1)/2);
+}
 	  
 
 //===========================================================
@@ -1439,15 +1567,29 @@ tree_t *BrushBSP (bspbrush_t *brushlist, Vector& mins, Vector& maxs)
 	qprintf ("%5i visible faces\n", c_faces);
 	qprintf ("%5i nonvisible faces\n", c_nonvisfaces);
 
-	c_nodes = 0;
-	c_nonvis = 0;
 	node = AllocNode ();
 
 	node->volume = BrushFromBounds (mins, maxs);
 
 	tree->headnode = node;
 
-	node = BuildTree_r (node, brushlist);
+	if (s_bDeferSubtrees)
+	{
+		BuildTreeTop_r (node, brushlist, SubtreeDepth ());
+		return tree;
+	}
+
+	c_nodes = 0;
+	c_nonvis = 0;
+	if (numthreads == 1)
+	{
+		BuildTree_r (node, brushlist);
+	}
+	else
+	{
+		BuildTreeTop_r (node, brushlist, SubtreeDepth ());
+		BuildSubtrees (false);
+	}
 	qprintf ("%5i visible nodes\n", c_nodes/2 - c_nonvis);
 	qprintf ("%5i nonvis nodes\n", c_nonvis);
 	qprintf ("%5i leafs\n", (c_nodes+1)/2);
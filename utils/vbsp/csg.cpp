@@ -377,6 +377,27 @@ void FixupAreaportalWaterBrushes( bspbrush_t *pList )
 }
 
 
+//-----------------------------------------------------------------------------
+// True if FixupAreaportalWaterBrushes on pList might change pAreaportal's map
+// brush. Same tests, without the exact intersection.
+//-----------------------------------------------------------------------------
+bool AreaportalMayTouchWater( bspbrush_t *pAreaportal, bspbrush_t *pList )
+{
+	for ( bspbrush_t *pWater = pList; pWater; pWater = pWater->next )
+	{
+		if ( pWater->original->contents & CONTENTS_AREAPORTAL )
+			continue;
+
+		if ( !(pWater->original->contents & MASK_SPLITAREAPORTAL) )
+			continue;
+
+		if ( !BrushesDisjoint( pAreaportal, pWater ) )
+			return true;
+	}
+	return false;
+}
+
+
 //-----------------------------------------------------------------------------
 // MakeBspBrushList 
 //-----------------------------------------------------------------------------
@@ -18,6 +18,7 @@ void PrintBrushContentsToString( int contents, char *pOut, int nMaxChars );
 void PrintBrushContents( int contents );
 
 void FixupAreaportalWaterBrushes( bspbrush_t *pList );
+bool AreaportalMayTouchWater( bspbrush_t *pAreaportal, bspbrush_t *pList );
 
 bspbrush_t *MakeBspBrushList (int startbrush, int endbrush,
 		const Vector& clipmins, const Vector& clipmaxs, int detailScreen);
@@ -7,7 +7,7 @@
 //=============================================================================//
 #include "vbsp.h"
 
-extern	int	c_nodes;
+extern	int32	c_nodes;
 
 void RemovePortalFromNode (portal_t *portal, node_t *l);
 
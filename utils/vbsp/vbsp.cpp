@@ -148,33 +148,98 @@ node_t	*BlockTree (int xl, int yl, int xh, int yh)
 
 /*
 ============
-ProcessBlock_Thread
+MakeBlockBrushes
+
+Everything about a block that adds planes or changes the map brushes.
+It runs for the blocks in order so the planes are numbered the same no
+matter how many threads chop and split the blocks.
 
+The areaportal water fixup changes map brushes other blocks chop and
+split with. Before it might touch an areaportal a pending block shares,
+the pending blocks are finished, so every block sees the contents it
+did when each block was finished before the next one was started.
 ============
 */
 int			brush_start, brush_end;
-void ProcessBlock_Thread (int threadnum, int blocknum)
-{
-	int		xblock, yblock;
-	Vector		mins, maxs;
-	bspbrush_t	*brushes;
-	tree_t		*tree;
-	node_t		*node;
+bspbrush_t	*block_brushes[BLOCKS_SPACE+2][BLOCKS_SPACE+2];
+static CUtlVector<int>	pending_blocks;			// made, not yet chopped and split
+static CUtlVector<bool>	pending_areaportals;	// by map brush, in a pending block's list
 
+void ProcessPendingBlocks (void);
+
+static void BlockBounds (int blocknum, int &xblock, int &yblock, Vector &mins, Vector &maxs)
+{
 	yblock = block_yl + blocknum / (block_xh-block_xl+1);
 	xblock = block_xl + blocknum % (block_xh-block_xl+1);
 
-	qprintf ("############### block %2i,%2i ###############\n", xblock, yblock);
-
 	mins[0] = xblock*BLOCKS_SIZE;
 	mins[1] = yblock*BLOCKS_SIZE;
 	mins[2] = MIN_COORD_INTEGER;
 	maxs[0] = (xblock+1)*BLOCKS_SIZE;
 	maxs[1] = (yblock+1)*BLOCKS_SIZE;
 	maxs[2] = MAX_COORD_INTEGER;
+}
+
+void MakeBlockBrushes (int blocknum)
+{
+	int		xblock, yblock;
+	Vector		mins, maxs;
+	bspbrush_t	*brushes;
+
+	BlockBounds (blocknum, xblock, yblock, mins, maxs);
 
 	// the makelist and chopbrushes could be cached between the passes...
 	brushes = MakeBspBrushList (brush_start, brush_end, mins, maxs, NO_DETAIL);
+	if (brushes)
+	{
+		bool		flush = false;
+		bspbrush_t	*b;
+
+		for (b = brushes ; b && !flush ; b = b->next)
+		{
+			if ((b->original->contents & CONTENTS_AREAPORTAL) && pending_areaportals[b->original - g_MainMap->mapbrushes])
+				flush = AreaportalMayTouchWater (b, brushes);
+		}
+		if (flush)
+			ProcessPendingBlocks ();
+
+		FixupAreaportalWaterBrushes( brushes );
+
+		// add the planes of the head node volume BrushBSP will make
+		FreeBrush (BrushFromBounds (mins, maxs));
+
+		for (b = brushes ; b ; b = b->next)
+		{
+			if (b->original->contents & CONTENTS_AREAPORTAL)
+				pending_areaportals[b->original - g_MainMap->mapbrushes] = true;
+		}
+	}
+
+	block_brushes[xblock+BLOCKX_OFFSET][yblock+BLOCKY_OFFSET] = brushes;
+	pending_blocks.AddToTail (blocknum);
+}
+
+
+/*
+============
+ProcessBlock_Thread
+
+============
+*/
+void ProcessBlock_Thread (int threadnum, int blocknum)
+{
+	int		xblock, yblock;
+	Vector		mins, maxs;
+	bspbrush_t	*brushes;
+	tree_t		*tree;
+	node_t		*node;
+
+	BlockBounds (blocknum, xblock, yblock, mins, maxs);
+
+	qprintf ("############### block %2i,%2i ###############\n", xblock, yblock);
+
+	brushes = block_brushes[xblock+BLOCKX_OFFSET][yblock+BLOCKY_OFFSET];
+	block_brushes[xblock+BLOCKX_OFFSET][yblock+BLOCKY_OFFSET] = NULL;
 	if (!brushes)
 	{
 		node = AllocNode ();
@@ -184,7 +249,6 @@ void ProcessBlock_Thread (int threadnum, int blocknum)
 		return;
 	}    
 
-	FixupAreaportalWaterBrushes( brushes );
 	if (!nocsg)
 		brushes = ChopBrushes (brushes);
 
@@ -193,6 +257,33 @@ void ProcessBlock_Thread (int threadnum, int blocknum)
 	block_nodes[xblock+BLOCKX_OFFSET][yblock+BLOCKY_OFFSET] = tree->headnode;
 }
 
+static void ProcessPendingBlock_Thread (int threadnum, int index)
+{
+	ProcessBlock_Thread (threadnum, pending_blocks[index]);
+}
+
+
+/*
+============
+ProcessPendingBlocks
+
+Chops and splits the blocks made since the last call, then builds the
+subtrees below the first splits of all of them together.
+============
+*/
+void ProcessPendingBlocks (void)
+{
+	if (!pending_blocks.Count())
+		return;
+
+	BeginDeferredSubtrees ();
+	RunThreadsOnIndividual (pending_blocks.Count(), !verbose, ProcessPendingBlock_Thread);
+	EndDeferredSubtrees ();
+
+	pending_blocks.RemoveAll ();
+	memset (pending_areaportals.Base(), 0, pending_areaportals.Count() * sizeof(bool));
+}
+
 
 /*
 ============
@@ -208,6 +299,7 @@ void ProcessWorldModel (void)
 	qboolean	leaked;
 	int	optimize;
 	int			start;
+	int			numblocks;
 
 	e = &entities[entity_num];
 
@@ -257,8 +349,14 @@ void ProcessWorldModel (void)
 	{
 		qprintf ("--------------------------------------------\n");
 
-		RunThreadsOnIndividual ((block_xh-block_xl+1)*(block_yh-block_yl+1),
-			!verbose, ProcessBlock_Thread);
+		numblocks = (block_xh-block_xl+1)*(block_yh-block_yl+1);
+		pending_areaportals.SetCount (g_MainMap->nummapbrushes);
+		memset (pending_areaportals.Base(), 0, pending_areaportals.Count() * sizeof(bool));
+		for (int i = 0; i < numblocks; i++)
+		{
+			MakeBlockBrushes (i);
+		}
+		ProcessPendingBlocks ();
 
 		//
 		// build the division tree
@@ -1277,7 +1375,6 @@ int RunVBSP( int argc, char **argv )
 	}
 
 	ThreadSetDefault ();
-	numthreads = 1;		// multiple threads aren't helping...
 
 	// Setup the logfile.
 	char logFile[512];
@@ -481,7 +481,10 @@ void BoundBrush (bspbrush_t *brush);
 void FreeBrushList (bspbrush_t *brushes);
 node_t	*PointInLeaf (node_t *node, Vector& point);
 
+bspbrush_t *BrushFromBounds (Vector& mins, Vector& maxs);
 tree_t *BrushBSP (bspbrush_t *brushlist, Vector& mins, Vector& maxs);
+void BeginDeferredSubtrees (void);
+void EndDeferredSubtrees (void);
 
 #define	PSIDE_FRONT			1
 #define	PSIDE_BACK			2
@@ -0,0 +1,135 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Runs a coordinator and local worker processes through a few
+//			distributed stages and checks every result came back once.
+//
+//			distwork_test -dist <workers> [-units <n>] [-kill]
+//
+//			-kill makes worker 0 exit halfway through the first stage so its
+//			units have to be redone by the others.
+//
+//=============================================================================//
+
+#include "cmdlib.h"
+#include "threads.h"
+#include "distwork.h"
+#include "tier1/strtools.h"
+#include "utlvector.h"
+#include "tier0/icommandline.h"
+
+#ifdef POSIX
+#include <unistd.h>
+#endif
+
+
+static int		g_nUnits = 5000;
+static bool		g_bKill = false;
+static int		g_nProcessed = 0;
+static unsigned int		g_Seed;				// broadcast to the workers between the stages
+
+static CUtlVector<unsigned int>	g_Results;
+static CUtlVector<int>			g_ResultCounts;
+
+
+static unsigned int WorkUnitValue( uint64 iWorkUnit, unsigned int seed )
+{
+	unsigned int x = (unsigned int)iWorkUnit * 2654435761u + seed;
+	for ( int i = 0; i < 1000; i++ )
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+	}
+	return x;
+}
+
+
+static void ProcessWorkUnit( int iThread, uint64 iWorkUnit, MessageBuffer *pBuf )
+{
+	if ( g_bKill && DistWork_GetWorkerID() == 0 && ThreadInterlockedIncrement( &g_nProcessed ) == g_nUnits / 8 )
+	{
+		// Die without a word, like a crashed worker
+		_exit( 1 );
+	}
+
+	unsigned int value = WorkUnitValue( iWorkUnit, g_Seed );
+	pBuf->write( &value, sizeof( value ) );
+}
+
+static void ReceiveWorkUnit( uint64 iWorkUnit, MessageBuffer *pBuf, int iWorker )
+{
+	unsigned int value;
+	if ( pBuf->read( &value, sizeof( value ) ) < 0 )
+		Error( "work unit %llu from worker %d has no result", iWorkUnit, iWorker );
+
+	g_Results[iWorkUnit] = value;
+	++g_ResultCounts[iWorkUnit];
+}
+
+
+static int CheckStage( char const *pName )
+{
+	int nErrors = 0;
+	for ( int i = 0; i < g_nUnits; i++ )
+	{
+		if ( g_ResultCounts[i] != 1 || g_Results[i] != WorkUnitValue( i, g_Seed ) )
+			++nErrors;
+	}
+
+	Msg( "%s: %d work units, %d errors\n", pName, g_nUnits, nErrors );
+	return nErrors;
+}
+
+
+int main( int argc, char **argv )
+{
+	CommandLine()->CreateCmdLine( argc, argv );
+	InstallSpewFunction();
+
+	if ( !DistWork_Init( argc, argv ) )
+	{
+		Msg( "distwork_test -dist <workers> [-units <n>] [-kill]\n" );
+		return 1;
+	}
+
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( !V_stricmp( argv[i], "-units" ) && i+1 < argc )
+			g_nUnits = atoi( argv[++i] );
+		else if ( !V_stricmp( argv[i], "-kill" ) )
+			g_bKill = true;
+		else if ( !V_stricmp( argv[i], "-threads" ) && i+1 < argc )
+			numthreads = atoi( argv[++i] );
+	}
+	ThreadSetDefault();
+
+	g_Results.SetCount( g_nUnits );
+	g_ResultCounts.SetCount( g_nUnits );
+
+	int nErrors = 0;
+	for ( int iStage = 0; iStage < 2; iStage++ )
+	{
+		// The second stage depends on data every worker gets from the coordinator
+		MessageBuffer mb;
+		if ( g_bDistWorkMaster )
+		{
+			g_Seed = iStage * 0x9e3779b9;
+			mb.write( &g_Seed, sizeof( g_Seed ) );
+		}
+		DistWork_Broadcast( &mb );
+		mb.read( &g_Seed, sizeof( g_Seed ) );
+
+		memset( g_ResultCounts.Base(), 0, g_nUnits * sizeof( int ) );
+		double elapsed = DistWork_Run( g_nUnits, ProcessWorkUnit, ReceiveWorkUnit );
+
+		if ( g_bDistWorkMaster )
+		{
+			char name[32];
+			V_snprintf( name, sizeof( name ), "stage %d (%.2fs, %d workers)", iStage, elapsed, DistWork_GetWorkerCount() );
+			nErrors += CheckStage( name );
+		}
+	}
+
+	DistWork_Term();
+	return nErrors ? 1 : 0;
+}
@@ -16,6 +16,7 @@
 #include "tier2/fileutils.h"
 #include "tier1/utldict.h"
 #include "tier1/utlbuffer.h"
+#include "vstdlib/jobthread.h"
 #ifdef VPK_ENABLE_SIGNING
 #include "crypto.h"
 #endif
@@ -28,6 +29,26 @@ const int k_nVPKDefaultChunkAlign = 1;
 static int s_iChunkAlign = k_nVPKDefaultChunkAlign;
 static CUtlString s_sPrivateKeyFile;
 static CUtlString s_sPublicKeyFile;
+static int s_nThreads = -1;
+
+// Build throughput, reported when a build command finishes
+static double s_flBuildStartTime;
+static int64 s_nBuildBytesIn;
+static int64 s_nBuildBytesWritten;
+static int s_nBuildChunksWritten;
+static int s_nBuildChunksUnchanged;
+
+static void PrintBuildSummary()
+{
+	double flElapsed = MAX( Plat_FloatTime() - s_flBuildStartTime, 0.001 );
+	printf( "Build took %.2f seconds.  Read %.1f MB (%.1f MB/s), wrote %.1f MB in %d chunk files",
+		flElapsed,
+		s_nBuildBytesIn / ( 1024.0 * 1024.0 ), s_nBuildBytesIn / ( 1024.0 * 1024.0 ) / flElapsed,
+		s_nBuildBytesWritten / ( 1024.0 * 1024.0 ), s_nBuildChunksWritten );
+	if ( s_nBuildChunksUnchanged )
+		printf( " (%d had the same content and were kept)", s_nBuildChunksUnchanged );
+	printf( ".\n" );
+}
 
 static void PrintArgSummaryAndExit( int iReturnCode = 1 )
 {
@@ -99,6 +120,10 @@ static void PrintArgSummaryAndExit( int iReturnCode = 1 )
 		"         that will be compared to determine if the file contents has changed\n"
 		"         between builds.\n"
 		"         This option implies -M\n" );
+	printf(
+		"  -j <threads>\n"
+		"         Number of worker threads used to hash and write chunk files.\n"
+		"         Default is one per core, 0 does everything on the main thread.\n" );
 	printf(
 		"  -c <size>\n"
 		"         Use specified chunk size (in MB).  Default is %d.\n", k_nVPKDefaultChunkSize / ( 1024 * 1024 ) );
@@ -167,6 +192,7 @@ static void AddFileToPack( CPackedStore &mypack, char const *pSrcName, int nPrel
 	int fileSize = f.Size();
 	uint8 *pData = new uint8[fileSize];
 	f.MustRead( pData, fileSize );
+	s_nBuildBytesIn += fileSize;
 
 	ePackedStoreAddResultCode rslt = mypack.AddFile( pDestName, Min( fileSize, nPreloadSize ), pData, fileSize, s_bMakeMultiChunk );
 
@@ -824,9 +850,11 @@ void VPKBuilder::BuildSteamPipeFriendlyFromInputKeys()
 			continue;
 		}
 
-		// Create the output file.
-		FileHandle_t fChunkWrite = g_pFullFileSystem->Open( szDataFilename, "wb" );
-		if ( !fChunkWrite )
+		// Create the output file.  Chunk hashes are computed as the data is
+		// streamed out, and a chunk that comes out byte for byte the same as the
+		// one already on disk is left alone.
+		CPackedStoreChunkWriter chunkWriter( &m_packfile, idxChunk, bIncremental );
+		if ( !chunkWriter.Open() )
 			Error( "Can't create %s\n", szDataFilename );
 
 		// Scan input files in order.
@@ -846,7 +874,8 @@ void VPKBuilder::BuildSteamPipeFriendlyFromInputKeys()
 			{
 				Error( "Error reading %s", bf->m_sNameOnDisk.String() );
 			}
-			Assert( iOffsetInChunk == g_pFullFileSystem->Tell( fChunkWrite ) );
+			s_nBuildBytesIn += buf.TellPut();
+			Assert( iOffsetInChunk == chunkWriter.BytesWritten() );
 
 			// Calculate the CRC
 			f->m_crc = CRC32_ProcessSingleBuffer( buf.Base(), f->m_iTotalSize );
@@ -861,29 +890,32 @@ void VPKBuilder::BuildSteamPipeFriendlyFromInputKeys()
 
 			// Write the data
 			int nBytesToWrite = f->GetSizeInChunkFile();
-			int nBytesWritten = g_pFullFileSystem->Write( (byte*)buf.Base() + f->m_iPreloadSize, nBytesToWrite, fChunkWrite );
-			if ( nBytesWritten != nBytesToWrite )
+			if ( !chunkWriter.Write( (byte*)buf.Base() + f->m_iPreloadSize, nBytesToWrite ) )
 				Error( "Error writing %s", szDataFilename );
 			iOffsetInChunk += nBytesToWrite;
-			Assert( iOffsetInChunk == g_pFullFileSystem->Tell( fChunkWrite ) );
 
 			// Align
 			Assert( s_iChunkAlign > 0 );
 			while ( iOffsetInChunk % s_iChunkAlign )
 			{
 				unsigned char zero = 0;
-				g_pFullFileSystem->Write( &zero, 1, fChunkWrite );
+				chunkWriter.Write( &zero, 1 );
 				++iOffsetInChunk;
 			}
 
 			// Let's clear this pointer just for grins
 			f->m_pPreloadData = NULL;
 		}
-		g_pFullFileSystem->Close( fChunkWrite );
-
-		// While we know the data is sitting in the OS file cache,
-		// let's immediately re-calc the chunk hashes
-		m_packfile.HashChunkFile( idxChunk );
+		// Flushes the data and hands the chunk hashes to the pack file
+		if ( !chunkWriter.Close() )
+			Error( "Error writing %s", szDataFilename );
+		s_nBuildBytesWritten += chunkWriter.BytesWritten();
+		++s_nBuildChunksWritten;
+		if ( chunkWriter.WasUnchanged() )
+		{
+			printf( "%s has the same content as before, keeping the existing file.\n", pszShortDataFilename );
+			++s_nBuildChunksUnchanged;
+		}
 
 		// We'll need to re-save the directory
 		bNeedToWriteDir = true;
@@ -1981,6 +2013,23 @@ int main(int argc, char **argv)
 			}
 			break;
 
+			case 'j':
+			{
+				nCurArg++;
+				if ( nCurArg >= argc )
+				{
+					fprintf( stderr, "Expected argument after %s\n", argv[nCurArg-1] );
+					exit( 1 );
+				}
+				s_nThreads = V_atoi( argv[nCurArg] );
+				if ( s_nThreads < 0 || s_nThreads > TP_MAX_POOL_THREADS )
+				{
+					fprintf( stderr, "Invalid thread count %s\n", argv[nCurArg] );
+					exit( 1 );
+				}
+			}
+			break;
+
 			case 'K':
 				nCurArg++;
 				if ( nCurArg >= argc )
@@ -2015,6 +2064,16 @@ int main(int argc, char **argv)
 		Error( "No command specified.  Try 'vpk -?' for info.\n" );
 	}
 
+	// Chunk files are hashed and written on the job pool
+	if ( s_nThreads != 0 )
+	{
+		ThreadPoolStartParams_t startParams;
+		if ( s_nThreads > 0 )
+			startParams.nThreads = s_nThreads;
+		g_pThreadPool->Start( startParams, "VPK" );
+	}
+	s_flBuildStartTime = Plat_FloatTime();
+
 	const char *pszCommand = argv[1];
 	if ( V_stricmp( pszCommand, "l" ) == 0 )
 	{
@@ -2065,6 +2124,7 @@ int main(int argc, char **argv)
 		}
 		mypack.HashEverything();
 		mypack.Write();
+		PrintBuildSummary();
 	}
 	else if ( V_strcmp( pszCommand, "k" ) == 0 )
 	{
@@ -2081,6 +2141,7 @@ int main(int argc, char **argv)
 		VPKBuilder builder( mypack );
 		builder.LoadInputKeys( argv[3] );
 		builder.BuildFromInputKeys();
+		PrintBuildSummary();
 	}
 	else if ( V_strcmp( pszCommand, "x" ) == 0 )
 	{
@@ -2213,5 +2274,6 @@ int main(int argc, char **argv)
 		Error( "Unknown command '%s'.  Try 'vpk -?' for info.\n", pszCommand );
 	}
 
+	g_pThreadPool->Stop();
 	return 0;
 }
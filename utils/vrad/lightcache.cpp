@@ -0,0 +1,760 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Lighting cache for relighting a map after its lights change
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "lightmap.h"
+#include "lightcache.h"
+#include "transfermatrix.h"
+#include "gamebspfile.h"
+#include "tier1/strtools.h"
+#include "vmpi.h"
+
+extern float	luxeldensity;
+extern float	minchop;
+extern qboolean	texscale;
+extern int		total_transfer;
+extern int		max_transfer;
+
+
+CVRadLightingCache *LightingCache()
+{
+	static CVRadLightingCache s_LightingCache;
+	return &s_LightingCache;
+}
+
+
+//-----------------------------------------------------------------------------
+// Hashes
+//-----------------------------------------------------------------------------
+template<class T>
+static inline void HashValue( CRC32_t &crc, T const &value )
+{
+	CRC32_ProcessBuffer( &crc, &value, sizeof( value ) );
+}
+
+static inline void HashString( CRC32_t &crc, char const *pString )
+{
+	CRC32_ProcessBuffer( &crc, pString, Q_strlen( pString ) + 1 );
+}
+
+// Everything in the bsp that the samples, direct lighting and transfers depend
+// on, leaving out the lights and whatever vrad itself writes back
+static CRC32_t ComputeGeometryHash()
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	CRC32_ProcessBuffer( &crc, dplanes, numplanes * sizeof( dplanes[0] ) );
+	CRC32_ProcessBuffer( &crc, dvertexes, numvertexes * sizeof( dvertexes[0] ) );
+	CRC32_ProcessBuffer( &crc, dedges, numedges * sizeof( dedges[0] ) );
+	CRC32_ProcessBuffer( &crc, dsurfedges, numsurfedges * sizeof( dsurfedges[0] ) );
+	CRC32_ProcessBuffer( &crc, dnodes, numnodes * sizeof( dnodes[0] ) );
+	CRC32_ProcessBuffer( &crc, dleafs, numleafs * sizeof( dleafs[0] ) );
+	CRC32_ProcessBuffer( &crc, dleaffaces, numleaffaces * sizeof( dleaffaces[0] ) );
+	CRC32_ProcessBuffer( &crc, dleafbrushes, numleafbrushes * sizeof( dleafbrushes[0] ) );
+	CRC32_ProcessBuffer( &crc, dbrushes, numbrushes * sizeof( dbrushes[0] ) );
+	CRC32_ProcessBuffer( &crc, dbrushsides, numbrushsides * sizeof( dbrushsides[0] ) );
+	CRC32_ProcessBuffer( &crc, dmodels, nummodels * sizeof( dmodels[0] ) );
+	CRC32_ProcessBuffer( &crc, texinfo.Base(), texinfo.Count() * sizeof( texinfo_t ) );
+	CRC32_ProcessBuffer( &crc, dtexdata, numtexdata * sizeof( dtexdata[0] ) );
+	CRC32_ProcessBuffer( &crc, g_TexDataStringData.Base(), g_TexDataStringData.Count() );
+	CRC32_ProcessBuffer( &crc, g_TexDataStringTable.Base(), g_TexDataStringTable.Count() * sizeof( int ) );
+	CRC32_ProcessBuffer( &crc, g_dispinfo.Base(), g_dispinfo.Count() * sizeof( ddispinfo_t ) );
+	CRC32_ProcessBuffer( &crc, g_DispVerts.Base(), g_DispVerts.Count() * sizeof( CDispVert ) );
+	CRC32_ProcessBuffer( &crc, g_DispTris.Base(), g_DispTris.Count() * sizeof( CDispTri ) );
+	CRC32_ProcessBuffer( &crc, dvisdata, visdatasize );
+
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		dface_t face = g_pFaces[i];
+		memset( face.styles, 0, sizeof( face.styles ) );
+		face.lightofs = 0;
+		HashValue( crc, face );
+	}
+
+	for ( int i = 0; i < num_entities; i++ )
+	{
+		entity_t *e = &entities[i];
+		if ( !Q_strncmp( ValueForKey( e, "classname" ), "light", 5 ) )
+			continue;
+
+		for ( epair_t *ep = e->epairs; ep; ep = ep->next )
+		{
+			HashString( crc, ep->key );
+			HashString( crc, ep->value );
+		}
+	}
+
+	// static props can cast shadows
+	GameLumpHandle_t hStaticProps = g_GameLumps.GetGameLumpHandle( GAMELUMP_STATIC_PROPS );
+	if ( hStaticProps != g_GameLumps.InvalidGameLump() )
+	{
+		CRC32_ProcessBuffer( &crc, g_GameLumps.GetGameLump( hStaticProps ), g_GameLumps.GameLumpSize( hStaticProps ) );
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+// Command line options that change the samples, direct lighting or patches
+static CRC32_t ComputeSettingsHash()
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	HashValue( crc, sizeof( sample_t ) );
+	HashValue( crc, g_bHDR );
+	HashValue( crc, do_extra );
+	HashValue( crc, extrapasses );
+	HashValue( crc, do_fast );
+	HashValue( crc, do_centersamples );
+	HashValue( crc, smoothing_threshold );
+	HashValue( crc, luxeldensity );
+	HashValue( crc, texscale );
+	HashValue( crc, maxchop );
+	HashValue( crc, minchop );
+	HashValue( crc, dispchop );
+	HashValue( crc, g_MaxDispPatchRadius );
+	HashValue( crc, g_flSkySampleScale );
+	HashValue( crc, g_SunAngularExtent );
+	HashValue( crc, indirect_sun );
+	HashValue( crc, g_bLargeDispSampleRadius );
+	HashValue( crc, g_flMaxDispSampleSize );
+	HashValue( crc, g_bStaticPropPolys );
+	HashValue( crc, g_bTextureShadows );
+	HashValue( crc, g_bDisablePropSelfShadowing );
+	HashValue( crc, g_bNoSkyRecurse );
+	HashValue( crc, lightscale );
+	HashValue( crc, dlight_threshold );
+	HashValue( crc, g_bQuantizeTransfers );	// the saved transfers are stored the way they were built
+
+	for ( int i = 0; i < g_NonShadowCastingMaterialStrings.Count(); i++ )
+	{
+		HashString( crc, g_NonShadowCastingMaterialStrings[i] );
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+static CRC32_t HashDirectLight( directlight_t const *dl )
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	HashValue( crc, dl->light );
+	HashValue( crc, dl->facenum );
+	HashValue( crc, dl->texdata );
+	HashValue( crc, dl->snormal );
+	HashValue( crc, dl->tnormal );
+	HashValue( crc, dl->sscale );
+	HashValue( crc, dl->tscale );
+	HashValue( crc, dl->soffset );
+	HashValue( crc, dl->toffset );
+	HashValue( crc, dl->m_flStartFadeDistance );
+	HashValue( crc, dl->m_flEndFadeDistance );
+	HashValue( crc, dl->m_flCapDist );
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+//-----------------------------------------------------------------------------
+// Init/Term
+//-----------------------------------------------------------------------------
+CVRadLightingCache::CVRadLightingCache()
+{
+	m_szFilename[0] = 0;
+	m_bActive = false;
+	m_bLoaded = false;
+	m_nPVSBytes = 0;
+	m_nTransferOffset = -1;
+	m_nTransferSize = 0;
+	m_flFullDirectTime = 0.0f;
+	m_flFullTransferTime = 0.0f;
+	m_nChangedLights = 0;
+	m_flDirectTime = 0.0f;
+	m_flTransferTime = 0.0f;
+	m_bTransfersBuilt = false;
+	m_bTransfersRestored = false;
+}
+
+CVRadLightingCache::~CVRadLightingCache()
+{
+	Term();
+}
+
+void CVRadLightingCache::Term()
+{
+	for ( int i = 0; i < m_Faces.Count(); i++ )
+	{
+		delete m_Faces[i].m_pRecord;
+	}
+	m_Faces.Purge();
+	m_CachedLights.Purge();
+	m_LightHashes.Purge();
+	m_File.Purge();
+
+	m_bActive = false;
+	m_bLoaded = false;
+	m_nTransferOffset = -1;
+	m_nTransferSize = 0;
+	m_flFullDirectTime = 0.0f;
+	m_flFullTransferTime = 0.0f;
+	m_nChangedLights = 0;
+	m_flDirectTime = 0.0f;
+	m_flTransferTime = 0.0f;
+	m_bTransfersBuilt = false;
+	m_bTransfersRestored = false;
+}
+
+void CVRadLightingCache::ResetFaces()
+{
+	m_Faces.SetCount( numfaces );
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		m_Faces[i].m_nOffset = -1;
+		m_Faces[i].m_nSize = 0;
+		m_Faces[i].m_bDirty = false;
+		m_Faces[i].m_pRecord = NULL;
+	}
+}
+
+void CVRadLightingCache::Init( char const *pBSPFilename )
+{
+	Term();
+
+	if ( g_bUseMPI || g_pIncremental || g_bDumpPatches )
+	{
+		Warning( "Lighting cache: not used with -mpi or -dump\n" );
+		return;
+	}
+
+	Q_StripExtension( pBSPFilename, m_szFilename, sizeof( m_szFilename ) );
+	Q_strncat( m_szFilename, g_bHDR ? "_hdr.vrc" : ".vrc", sizeof( m_szFilename ), COPY_ALL_CHARACTERS );
+
+	m_GeometryHash = ComputeGeometryHash();
+	m_SettingsHash = ComputeSettingsHash();
+	m_nPVSBytes = ( dvis->numclusters / 8 ) + 1;
+
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		m_LightHashes.AddToTail( HashDirectLight( dl ) );
+	}
+
+	ResetFaces();
+	m_bActive = true;
+
+	m_bLoaded = Load();
+	if ( m_bLoaded )
+	{
+		FindDirtyFaces();
+	}
+	else
+	{
+		ResetFaces();
+		m_CachedLights.Purge();
+		m_File.Purge();
+		m_nTransferOffset = -1;
+		m_nTransferSize = 0;
+		m_flFullDirectTime = 0.0f;
+		m_flFullTransferTime = 0.0f;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Loading
+//-----------------------------------------------------------------------------
+bool CVRadLightingCache::Load()
+{
+	if ( !g_pFileSystem->FileExists( m_szFilename ) )
+	{
+		Msg( "Lighting cache: no %s yet, lighting every face\n", m_szFilename );
+		return false;
+	}
+
+	if ( !g_pFileSystem->ReadFile( m_szFilename, NULL, m_File ) )
+	{
+		Warning( "Lighting cache: can't read %s, lighting every face\n", m_szFilename );
+		return false;
+	}
+
+	if ( m_File.GetInt() != LIGHTCACHE_VERSION )
+	{
+		Msg( "Lighting cache: %s is from another version of vrad, lighting every face\n", m_szFilename );
+		return false;
+	}
+
+	CRC32_t geometryHash = m_File.GetUnsignedInt();
+	CRC32_t settingsHash = m_File.GetUnsignedInt();
+	int nFaces = m_File.GetInt();
+	int nPatches = m_File.GetInt();
+	int nClusters = m_File.GetInt();
+	if ( geometryHash != m_GeometryHash || nFaces != numfaces || nPatches != g_Patches.Count() || nClusters != dvis->numclusters )
+	{
+		Msg( "Lighting cache: the geometry changed since %s was written, lighting every face\n", m_szFilename );
+		return false;
+	}
+	if ( settingsHash != m_SettingsHash )
+	{
+		Msg( "Lighting cache: the lighting options changed since %s was written, lighting every face\n", m_szFilename );
+		return false;
+	}
+
+	m_flFullDirectTime = m_File.GetFloat();
+	m_flFullTransferTime = m_File.GetFloat();
+
+	int nLights = m_File.GetInt();
+	if ( nLights < 0 || nLights > m_File.TellMaxPut() / m_nPVSBytes )
+	{
+		Warning( "Lighting cache: %s is damaged, lighting every face\n", m_szFilename );
+		return false;
+	}
+	m_CachedLights.SetCount( nLights );
+	for ( int i = 0; i < nLights; i++ )
+	{
+		m_CachedLights[i].m_Hash = m_File.GetUnsignedInt();
+		m_CachedLights[i].m_nPVSOffset = m_File.TellGet();
+		m_CachedLights[i].m_bMatched = false;
+		m_File.SeekGet( CUtlBuffer::SEEK_CURRENT, m_nPVSBytes );
+	}
+
+	int nTransferPatches = m_File.GetInt();
+	if ( nTransferPatches )
+	{
+		m_nTransferOffset = m_File.TellGet();
+		for ( int i = 0; i < nTransferPatches && m_File.IsValid(); i++ )
+		{
+			int nTransfers = m_File.GetInt();
+			m_File.SeekGet( CUtlBuffer::SEEK_CURRENT, nTransfers * sizeof( transfer_t ) );
+		}
+		m_nTransferSize = m_File.TellGet() - m_nTransferOffset;
+	}
+
+	for ( int i = 0; i < numfaces && m_File.IsValid(); i++ )
+	{
+		int nSize = m_File.GetInt();
+		if ( nSize )
+		{
+			m_Faces[i].m_nOffset = m_File.TellGet();
+			m_Faces[i].m_nSize = nSize;
+			m_File.SeekGet( CUtlBuffer::SEEK_CURRENT, nSize );
+		}
+	}
+
+	if ( !m_File.IsValid() || m_File.TellGet() != m_File.TellPut() ||
+		( nTransferPatches && nTransferPatches != g_Patches.Count() ) )
+	{
+		Warning( "Lighting cache: %s is damaged, lighting every face\n", m_szFilename );
+		return false;
+	}
+
+	return true;
+}
+
+static int __cdecl CompareCachedLights( const void *a, const void *b )
+{
+	CRC32_t hashA = *(CRC32_t const *)a;
+	CRC32_t hashB = *(CRC32_t const *)b;
+	return ( hashA < hashB ) ? -1 : ( hashA > hashB ) ? 1 : 0;
+}
+
+void CVRadLightingCache::FindDirtyFaces()
+{
+	// Pair up the lights of both compiles by their hash. The ones left over
+	// were added, removed or changed, and only reach the clusters in their PVS.
+	qsort( m_CachedLights.Base(), m_CachedLights.Count(), sizeof( CachedLight_t ), CompareCachedLights );
+
+	CUtlVector<byte> changedPVS;
+	changedPVS.SetCount( m_nPVSBytes );
+	memset( changedPVS.Base(), 0, m_nPVSBytes );
+
+	m_nChangedLights = 0;
+	int iLight = 0;
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next, iLight++ )
+	{
+		CRC32_t hash = m_LightHashes[iLight];
+
+		int nLow = 0;
+		int nHigh = m_CachedLights.Count();
+		while ( nLow < nHigh )
+		{
+			int nMid = ( nLow + nHigh ) / 2;
+			if ( m_CachedLights[nMid].m_Hash < hash )
+				nLow = nMid + 1;
+			else
+				nHigh = nMid;
+		}
+
+		for ( ; nLow < m_CachedLights.Count() && m_CachedLights[nLow].m_Hash == hash; nLow++ )
+		{
+			if ( !m_CachedLights[nLow].m_bMatched )
+				break;
+		}
+
+		if ( nLow < m_CachedLights.Count() && m_CachedLights[nLow].m_Hash == hash )
+		{
+			m_CachedLights[nLow].m_bMatched = true;
+			continue;
+		}
+
+		++m_nChangedLights;
+		for ( int i = 0; i < m_nPVSBytes; i++ )
+		{
+			changedPVS[i] |= dl->pvs ? dl->pvs[i] : 0xFF;
+		}
+	}
+
+	for ( int iCached = 0; iCached < m_CachedLights.Count(); iCached++ )
+	{
+		if ( m_CachedLights[iCached].m_bMatched )
+			continue;
+
+		++m_nChangedLights;
+		byte const *pPVS = (byte const *)m_File.Base() + m_CachedLights[iCached].m_nPVSOffset;
+		for ( int i = 0; i < m_nPVSBytes; i++ )
+		{
+			changedPVS[i] |= pPVS[i];
+		}
+	}
+
+	if ( !m_nChangedLights )
+		return;
+
+	for ( int facenum = 0; facenum < numfaces; facenum++ )
+	{
+		CachedFace_t &face = m_Faces[facenum];
+		if ( face.m_nOffset < 0 )
+			continue;
+
+		CUtlBuffer record( (byte const *)m_File.Base() + face.m_nOffset, face.m_nSize, CUtlBuffer::READ_ONLY );
+		int nClusters = record.GetInt();
+		if ( nClusters < 0 )
+		{
+			face.m_bDirty = true;
+			continue;
+		}
+
+		for ( int i = 0; i < nClusters; i++ )
+		{
+			if ( PVSCheck( changedPVS.Base(), record.GetInt() ) )
+			{
+				face.m_bDirty = true;
+				break;
+			}
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Faces
+//
+// A record holds the clusters the samples fell in, the styles, the samples,
+// the direct lighting of each style and bump and the luxels, as laid out in
+// facelight_t.
+//-----------------------------------------------------------------------------
+#define FACERECORD_LUXELS			0x1
+#define FACERECORD_LUXEL_NORMALS	0x2
+
+bool CVRadLightingCache::RestoreFace( int facenum )
+{
+	if ( !m_bActive )
+		return false;
+
+	CachedFace_t &face = m_Faces[facenum];
+	if ( face.m_nOffset < 0 || face.m_bDirty )
+		return false;
+
+	CUtlBuffer record( (byte const *)m_File.Base() + face.m_nOffset, face.m_nSize, CUtlBuffer::READ_ONLY );
+	int nClusters = record.GetInt();
+	if ( nClusters > 0 )
+	{
+		record.SeekGet( CUtlBuffer::SEEK_CURRENT, nClusters * sizeof( int ) );
+	}
+
+	dface_t *f = &g_pFaces[facenum];
+	facelight_t *fl = &facelight[facenum];
+
+	record.Get( f->styles, sizeof( f->styles ) );
+	int nNormals = record.GetInt();
+	fl->numsamples = record.GetInt();
+	fl->numluxels = record.GetInt();
+	fl->worldAreaPerLuxel = record.GetFloat();
+	int nFlags = record.GetUnsignedChar();
+
+	fl->sample = ( sample_t* )calloc( fl->numsamples, sizeof( sample_t ) );
+	record.Get( fl->sample, fl->numsamples * sizeof( sample_t ) );
+	for ( int i = 0; i < fl->numsamples; i++ )
+	{
+		fl->sample[i].w = NULL;
+	}
+
+	for ( int k = 0; k < MAXLIGHTMAPS && f->styles[k] != 255; k++ )
+	{
+		for ( int n = 0; n < nNormals; n++ )
+		{
+			fl->light[k][n] = ( LightingValue_t* )calloc( fl->numsamples, sizeof( LightingValue_t ) );
+			record.Get( fl->light[k][n], fl->numsamples * sizeof( LightingValue_t ) );
+		}
+	}
+
+	if ( nFlags & FACERECORD_LUXELS )
+	{
+		fl->luxel = ( Vector* )calloc( fl->numluxels, sizeof( Vector ) );
+		record.Get( fl->luxel, fl->numluxels * sizeof( Vector ) );
+	}
+
+	if ( nFlags & FACERECORD_LUXEL_NORMALS )
+	{
+		fl->luxelNormals = ( Vector* )calloc( fl->numluxels, sizeof( Vector ) );
+		record.Get( fl->luxelNormals, fl->numluxels * sizeof( Vector ) );
+	}
+
+	if ( !record.IsValid() )
+	{
+		Error( "Lighting cache: face %d in %s is damaged, delete the file and compile again\n", facenum, m_szFilename );
+	}
+
+	return true;
+}
+
+void CVRadLightingCache::StoreFace( int facenum, SSE_SampleInfo_t const &info )
+{
+	if ( !m_bActive )
+		return;
+
+	dface_t *f = &g_pFaces[facenum];
+	facelight_t *fl = &facelight[facenum];
+
+	CUtlBuffer *pRecord = new CUtlBuffer;
+
+	if ( info.m_NumFaceClusters > MAX_FACE_CLUSTERS )
+	{
+		pRecord->PutInt( -1 );
+	}
+	else
+	{
+		pRecord->PutInt( info.m_NumFaceClusters );
+		for ( int i = 0; i < info.m_NumFaceClusters; i++ )
+		{
+			pRecord->PutInt( info.m_FaceClusters[i] );
+		}
+	}
+
+	pRecord->Put( f->styles, sizeof( f->styles ) );
+	pRecord->PutInt( info.m_NormalCount );
+	pRecord->PutInt( fl->numsamples );
+	pRecord->PutInt( fl->numluxels );
+	pRecord->PutFloat( fl->worldAreaPerLuxel );
+	pRecord->PutUnsignedChar( ( fl->luxel ? FACERECORD_LUXELS : 0 ) | ( fl->luxelNormals ? FACERECORD_LUXEL_NORMALS : 0 ) );
+
+	for ( int i = 0; i < fl->numsamples; i++ )
+	{
+		sample_t sample = fl->sample[i];
+		sample.w = NULL;
+		pRecord->Put( &sample, sizeof( sample ) );
+	}
+
+	for ( int k = 0; k < MAXLIGHTMAPS && f->styles[k] != 255; k++ )
+	{
+		for ( int n = 0; n < info.m_NormalCount; n++ )
+		{
+			pRecord->Put( fl->light[k][n], fl->numsamples * sizeof( LightingValue_t ) );
+		}
+	}
+
+	if ( fl->luxel )
+	{
+		pRecord->Put( fl->luxel, fl->numluxels * sizeof( Vector ) );
+	}
+
+	if ( fl->luxelNormals )
+	{
+		pRecord->Put( fl->luxelNormals, fl->numluxels * sizeof( Vector ) );
+	}
+
+	delete m_Faces[facenum].m_pRecord;
+	m_Faces[facenum].m_pRecord = pRecord;
+}
+
+
+//-----------------------------------------------------------------------------
+// Transfers
+//-----------------------------------------------------------------------------
+bool CVRadLightingCache::RestoreTransfers()
+{
+	if ( !m_bActive || m_nTransferOffset < 0 )
+		return false;
+
+	CUtlBuffer transfers( (byte const *)m_File.Base() + m_nTransferOffset, m_nTransferSize, CUtlBuffer::READ_ONLY );
+	for ( int i = 0; i < g_Patches.Count(); i++ )
+	{
+		CPatch *patch = &g_Patches[i];
+		patch->numtransfers = transfers.GetInt();
+		if ( !patch->numtransfers )
+			continue;
+
+		patch->transfers = ( transfer_t* )calloc( patch->numtransfers, sizeof( transfer_t ) );
+		if ( !patch->transfers )
+			Error( "Memory allocation failure" );
+		transfers.Get( patch->transfers, patch->numtransfers * sizeof( transfer_t ) );
+
+		total_transfer += patch->numtransfers;
+		max_transfer = max( max_transfer, patch->numtransfers );
+	}
+
+	Msg( "transfers %d, max %d (from %s)\n", total_transfer, max_transfer, m_szFilename );
+
+	m_bTransfersRestored = true;
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Timing
+//-----------------------------------------------------------------------------
+void CVRadLightingCache::SetDirectLightingTime( float flSeconds )
+{
+	m_flDirectTime = flSeconds;
+}
+
+void CVRadLightingCache::SetTransferTime( float flSeconds )
+{
+	m_flTransferTime = flSeconds;
+	m_bTransfersBuilt = true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Saving
+//-----------------------------------------------------------------------------
+void CVRadLightingCache::Save()
+{
+	if ( !m_bActive )
+		return;
+
+	int nRelit = 0;
+	int nRestored = 0;
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		if ( m_Faces[i].m_pRecord )
+		{
+			++nRelit;
+		}
+		else if ( m_Faces[i].m_nOffset >= 0 && !m_Faces[i].m_bDirty )
+		{
+			++nRestored;
+		}
+	}
+
+	// Stages that ran on the whole map are what later compiles compare against
+	if ( !nRestored )
+	{
+		m_flFullDirectTime = m_flDirectTime;
+	}
+	if ( m_bTransfersBuilt )
+	{
+		m_flFullTransferTime = m_flTransferTime;
+	}
+
+	CUtlBuffer buf;
+	buf.PutInt( LIGHTCACHE_VERSION );
+	buf.PutUnsignedInt( m_GeometryHash );
+	buf.PutUnsignedInt( m_SettingsHash );
+	buf.PutInt( numfaces );
+	buf.PutInt( g_Patches.Count() );
+	buf.PutInt( dvis->numclusters );
+	buf.PutFloat( m_flFullDirectTime );
+	buf.PutFloat( m_flFullTransferTime );
+
+	buf.PutInt( m_LightHashes.Count() );
+	int iLight = 0;
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next, iLight++ )
+	{
+		buf.PutUnsignedInt( m_LightHashes[iLight] );
+		if ( dl->pvs )
+		{
+			buf.Put( dl->pvs, m_nPVSBytes );
+		}
+		else
+		{
+			for ( int i = 0; i < m_nPVSBytes; i++ )
+			{
+				buf.PutUnsignedChar( 0xFF );
+			}
+		}
+	}
+
+	CTransferMatrix const *pMatrix = TransferMatrix();
+	if ( pMatrix->IsBuilt() )
+	{
+		CUtlVector<float> scratch;
+		buf.PutInt( g_Patches.Count() );
+		for ( int i = 0; i < g_Patches.Count(); i++ )
+		{
+			int nTransfers = pMatrix->RowCount( i );
+			int const *pPatches = pMatrix->RowPatches( i );
+			float const *pTransfers = nTransfers ? pMatrix->RowTransfers( i, scratch ) : NULL;
+
+			buf.PutInt( nTransfers );
+			for ( int j = 0; j < nTransfers; j++ )
+			{
+				buf.PutInt( pPatches[j] );
+				buf.PutFloat( pTransfers[j] );
+			}
+		}
+	}
+	else if ( m_nTransferOffset >= 0 )
+	{
+		// -bounce 0 this time, keep the transfers for the next compile
+		buf.PutInt( g_Patches.Count() );
+		buf.Put( (byte const *)m_File.Base() + m_nTransferOffset, m_nTransferSize );
+	}
+	else
+	{
+		buf.PutInt( 0 );
+	}
+
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		CachedFace_t &face = m_Faces[i];
+		if ( face.m_pRecord )
+		{
+			buf.PutInt( face.m_pRecord->TellPut() );
+			buf.Put( face.m_pRecord->Base(), face.m_pRecord->TellPut() );
+		}
+		else if ( face.m_nOffset >= 0 && !face.m_bDirty )
+		{
+			buf.PutInt( face.m_nSize );
+			buf.Put( (byte const *)m_File.Base() + face.m_nOffset, face.m_nSize );
+		}
+		else
+		{
+			buf.PutInt( 0 );
+		}
+	}
+
+	if ( !g_pFileSystem->WriteFile( m_szFilename, NULL, buf ) )
+	{
+		Warning( "Lighting cache: can't write %s\n", m_szFilename );
+	}
+
+	Msg( "Lighting cache: relit %d of %d faces for %d changed lights, %s the transfers\n", nRelit, nRelit + nRestored,
+		m_nChangedLights, m_bTransfersRestored ? "reused" : ( m_bTransfersBuilt ? "built" : "skipped" ) );
+
+	if ( nRestored || m_bTransfersRestored )
+	{
+		float flSpent = m_flDirectTime + m_flTransferTime;
+		float flFull = ( nRestored ? m_flFullDirectTime : m_flDirectTime ) + ( m_bTransfersRestored ? m_flFullTransferTime : m_flTransferTime );
+		Msg( "Lighting cache: direct lighting and transfers took %.1f seconds, %.1f in a full compile, %.1f seconds saved\n",
+			flSpent, flFull, flFull - flSpent );
+	}
+
+	Term();
+}
@@ -0,0 +1,115 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Lighting cache for relighting a map after its lights change,
+//			see CVRadLightingCache
+//
+//=============================================================================//
+
+#ifndef LIGHTCACHE_H
+#define LIGHTCACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+#include "utlvector.h"
+#include "utlbuffer.h"
+#include "checksum_crc.h"
+
+
+struct SSE_SampleInfo_t;
+
+
+#define LIGHTCACHE_VERSION	1
+
+
+//-----------------------------------------------------------------------------
+// CVRadLightingCache
+//
+// Purpose: Keeps what a compile worked out from the geometry of a map in
+//			<map>.vrc (<map>_hdr.vrc for HDR): the samples and direct lighting
+//			of every face, the patch transfers, and a hash and PVS of every
+//			direct light. When the next compile finds the same geometry it
+//			reuses the transfers and only relights faces with a sample in
+//			the PVS of a light that was added, removed or changed. A light
+//			outside a face's PVS never reaches it, so every other face comes
+//			out the same as in a full compile. Bounces and everything after
+//			them always run.
+//-----------------------------------------------------------------------------
+class CVRadLightingCache
+{
+public:
+	CVRadLightingCache();
+	~CVRadLightingCache();
+
+	// Loads the cache and works out which faces the light changes reach. Call
+	// once the direct lights exist, before BuildFacelights.
+	void		Init( char const *pBSPFilename );
+	bool		IsActive() const		{ return m_bActive; }
+
+	// Called from BuildFacelights. Restore returns false for faces that need
+	// to be lit, Store keeps their result before the patch lights are added.
+	bool		RestoreFace( int facenum );
+	void		StoreFace( int facenum, SSE_SampleInfo_t const &info );
+
+	// Returns false when the transfers have to be built
+	bool		RestoreTransfers();
+
+	void		SetDirectLightingTime( float flSeconds );
+	void		SetTransferTime( float flSeconds );
+
+	// Writes the cache and reports the time saved against a full compile
+	void		Save();
+
+private:
+	struct CachedFace_t
+	{
+		int			m_nOffset;		// record in m_File, -1 if it has none
+		int			m_nSize;
+		bool		m_bDirty;		// reached by a changed light
+		CUtlBuffer	*m_pRecord;		// record made by this compile
+	};
+
+	struct CachedLight_t
+	{
+		CRC32_t		m_Hash;
+		int			m_nPVSOffset;
+		bool		m_bMatched;
+	};
+
+	bool		Load();
+	void		FindDirtyFaces();
+	void		ResetFaces();
+	void		Term();
+
+	char		m_szFilename[MAX_PATH];
+	bool		m_bActive;
+
+	CRC32_t		m_GeometryHash;
+	CRC32_t		m_SettingsHash;
+	int			m_nPVSBytes;
+	CUtlVector<CRC32_t>			m_LightHashes;	// in activelights order
+
+	// The cache as loaded
+	CUtlBuffer	m_File;
+	bool		m_bLoaded;
+	CUtlVector<CachedLight_t>	m_CachedLights;
+	int			m_nTransferOffset;	// -1 if it has none
+	int			m_nTransferSize;
+	float		m_flFullDirectTime;
+	float		m_flFullTransferTime;
+
+	CUtlVector<CachedFace_t>	m_Faces;
+	int			m_nChangedLights;
+
+	float		m_flDirectTime;
+	float		m_flTransferTime;
+	bool		m_bTransfersBuilt;
+	bool		m_bTransfersRestored;
+};
+
+
+CVRadLightingCache *LightingCache();
+
+
+#endif // LIGHTCACHE_H
@@ -16,6 +16,7 @@
 #include "map_utils.h"
 #include "mathlib/halton.h"
 #include "imagepacker.h"
+#include "lightcache.h"
 #include "tier1/utlrbtree.h"
 #include "tier1/utlbuffer.h"
 #include "bitmap/tgawriter.h"
@@ -2431,6 +2432,29 @@ static int FindOrAllocateLightstyleSamples( dface_t* f, facelight_t	*fl, int lig
 }
 
 
+//-----------------------------------------------------------------------------
+// Keeps the clusters the samples of a face fall in, for the lighting cache
+//-----------------------------------------------------------------------------
+static void AddFaceCluster( SSE_SampleInfo_t* pInfo, int cluster )
+{
+	if ( pInfo->m_NumFaceClusters > MAX_FACE_CLUSTERS )
+		return;
+
+	for ( int i = 0; i < pInfo->m_NumFaceClusters; ++i )
+	{
+		if ( pInfo->m_FaceClusters[i] == cluster )
+			return;
+	}
+
+	if ( pInfo->m_NumFaceClusters == MAX_FACE_CLUSTERS )
+	{
+		++pInfo->m_NumFaceClusters;
+		return;
+	}
+
+	pInfo->m_FaceClusters[pInfo->m_NumFaceClusters++] = cluster;
+}
+
 //-----------------------------------------------------------------------------
 // Compute the illumination point + normal for the sample
 //-----------------------------------------------------------------------------
@@ -2483,6 +2507,9 @@ static void ComputeIlluminationPointAndNormalsSSE( lightinfo_t const& l, FourVec
 	// TODO: this may slow things down a bit ( using Vec )
 	for ( int i = 0; i < 4; ++i )
 		pInfo->m_Clusters[i] = ClusterFromPoint( pos.Vec( i ) );
+
+	for ( int i = 0; i < numSamples; ++i )
+		AddFaceCluster( pInfo, pInfo->m_Clusters[i] );
 }
 
 //-----------------------------------------------------------------------------
@@ -3031,6 +3058,7 @@ static void InitSampleInfo( lightinfo_t const& l, int iThread, SSE_SampleInfo_t&
 	info.m_IsDispFace = ValidDispFace( info.m_pFace );
 	info.m_iThread = iThread;
 	info.m_WarnFace = -1;
+	info.m_NumFaceClusters = 0;
 
 	info.m_NumSamples = info.m_pFaceLight->numsamples;
 	info.m_NumSampleGroups = ( info.m_NumSamples & 0x3) ? ( info.m_NumSamples / 4 ) + 1 : ( info.m_NumSamples / 4 );
@@ -3102,6 +3130,13 @@ void BuildFacelights (int iThread, int facenum)
 
 	fl = &facelight[facenum];
 
+	// Nothing that reaches this face changed since the cached compile
+	if ( g_bLightingCache && LightingCache()->RestoreFace( facenum ) )
+	{
+		BuildPatchLights( facenum );
+		return;
+	}
+
 	InitLightinfo( &l, facenum );
 	CalcPoints( &l, fl, facenum );
 	InitSampleInfo( l, iThread, sampleInfo );
@@ -3174,6 +3209,11 @@ void BuildFacelights (int iThread, int facenum)
 		}
 	}
 
+	if ( g_bLightingCache )
+	{
+		LightingCache()->StoreFace( facenum, sampleInfo );
+	}
+
 	if (!g_bUseMPI) 
 	{
 		//
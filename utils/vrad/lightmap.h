@@ -110,6 +110,9 @@ struct lightinfo_t
 	int		hasbumpmap;
 };
 
+// Clusters a face's samples fall in, for the lighting cache
+#define MAX_FACE_CLUSTERS	32
+
 struct SSE_SampleInfo_t
 {
 	int		m_FaceNum;
@@ -129,6 +132,9 @@ struct SSE_SampleInfo_t
 	int	        m_Clusters[4];
 	FourVectors	m_Points;
 	FourVectors	m_PointNormals[ NUM_BUMP_VECTS + 1 ];
+
+	int			m_FaceClusters[MAX_FACE_CLUSTERS];
+	int			m_NumFaceClusters;		// more than MAX_FACE_CLUSTERS once they overflow
 };
 
 extern void InitLightinfo( lightinfo_t *l, int facenum );
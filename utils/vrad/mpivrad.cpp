@@ -9,8 +9,10 @@
 // mpivrad.cpp
 //
 
+#ifdef _WIN32
 #include <windows.h>
 #include <conio.h>
+#endif
 #include "vrad.h"
 #include "physdll.h"
 #include "lightmap.h"
@@ -29,6 +31,7 @@
 #include "mpi_stats.h"
 #include "vmpi_distribute_work.h"
 #include "vmpi_tools_shared.h"
+#include "distwork.h"
 
 
 
@@ -66,6 +69,15 @@ CDispatchReg g_DistributeWorkReg( VMPI_DISTRIBUTEWORK_PACKETID, DistributeWorkDi
 
 void VRAD_SetupMPI( int &argc, char **&argv )
 {
+	// Local worker processes instead of VMPI?
+	if ( DistWork_Init( argc, argv ) )
+	{
+		g_bUseMPI = true;
+		g_bMPIMaster = g_bDistWorkMaster;
+		CmdLib_AtCleanup( DistWork_Term );
+		return;
+	}
+
 	CmdLib_AtCleanup( VMPI_Stats_Term );
 
 	//
@@ -102,6 +114,15 @@ void VRAD_SetupMPI( int &argc, char **&argv )
 }
 
 
+double VRAD_DistributeWork( uint64 nWorkUnits, ProcessWorkUnitFn processFn, ReceiveWorkUnitFn receiveFn )
+{
+	if ( g_bDistWork )
+		return DistWork_Run( nWorkUnits, processFn, receiveFn );
+
+	return DistributeWork( nWorkUnits, VMPI_DISTRIBUTEWORK_PACKETID, processFn, receiveFn );
+}
+
+
 //-----------------------------------------
 //
 // Run BuildFaceLights across all available processing nodes
@@ -236,9 +257,8 @@ void RunMPIBuildFacelights()
 	}
 
 	VMPI_SetCurrentStage( "RunMPIBuildFaceLights" );
-	double elapsed = DistributeWork( 
+	double elapsed = VRAD_DistributeWork( 
 		numfaces, 
-		VMPI_DISTRIBUTEWORK_PACKETID,
 		MPI_ProcessFaces, 
 		MPI_ReceiveFaceResults );
 
@@ -294,7 +314,7 @@ void MPI_ReceiveVisLeafsResults( uint64 iWorkUnit, MessageBuffer *pBuf, int iWor
 		patch->numtransfers = numtransfers;
 		if (numtransfers) 
 		{
-			patch->transfers = new transfer_t[numtransfers];
+			patch->transfers = ( transfer_t* )calloc( numtransfers, sizeof( transfer_t ) );
 			pBuf->read(patch->transfers, numtransfers * sizeof(transfer_t));
 		}
 		
@@ -379,7 +399,7 @@ void RunMPIBuildVisLeafs()
 	}
 
 	memset( g_VMPIVisLeafsData, 0, sizeof( g_VMPIVisLeafsData ) );
-	if ( !g_bMPIMaster || VMPI_GetActiveWorkUnitDistributor() == k_eWorkUnitDistributor_SDK )
+	if ( !g_bMPIMaster || ( !g_bDistWork && VMPI_GetActiveWorkUnitDistributor() == k_eWorkUnitDistributor_SDK ) )
 	{
 		// Allocate space for the transfers for each thread.
 		for ( int i=0; i < numthreads; i++ )
@@ -394,9 +414,8 @@ void RunMPIBuildVisLeafs()
 	//
 	VMPI_SetCurrentStage( "RunMPIBuildVisLeafs" );
 	
-	double elapsed = DistributeWork( 
+	double elapsed = VRAD_DistributeWork( 
 		dvis->numclusters, 
-		VMPI_DISTRIBUTEWORK_PACKETID,
 		MPI_ProcessVisLeafs, 
 		MPI_ReceiveVisLeafsResults );
 
@@ -419,11 +438,50 @@ void RunMPIBuildVisLeafs()
 	}
 }
 
+// The dist workers get the same data in one broadcast.
+static void DistWork_DistributeLightData()
+{
+	MessageBuffer mb;
+	if ( g_bMPIMaster )
+	{
+		int lightSize = pdlightdata->Count();
+		mb.write( &lightSize, sizeof( lightSize ) );
+		mb.write( pdlightdata->Base(), lightSize );
+		for ( int i = 0; i < numfaces; i++ )
+		{
+			mb.write( g_pFaces[i].styles, MAXLIGHTMAPS );
+			mb.write( &g_pFaces[i].lightofs, sizeof( g_pFaces[i].lightofs ) );
+		}
+		DistWork_Broadcast( &mb );
+	}
+	else
+	{
+		VMPI_SetCurrentStage( "VMPI_DistributeLightData" );
+		DistWork_Broadcast( &mb );
+
+		int lightSize;
+		mb.read( &lightSize, sizeof( lightSize ) );
+		pdlightdata->EnsureCount( lightSize );
+		mb.read( pdlightdata->Base(), lightSize );
+		for ( int i = 0; i < numfaces; i++ )
+		{
+			mb.read( g_pFaces[i].styles, MAXLIGHTMAPS );
+			mb.read( &g_pFaces[i].lightofs, sizeof( g_pFaces[i].lightofs ) );
+		}
+	}
+}
+
 void VMPI_DistributeLightData()
 {
 	if ( !g_bUseMPI )
 		return;
 
+	if ( g_bDistWork )
+	{
+		DistWork_DistributeLightData();
+		return;
+	}
+
 	if ( g_bMPIMaster )
 	{
 		const char *pVirtualFilename = "--plightdata--";
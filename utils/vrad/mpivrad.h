@@ -12,6 +12,9 @@
 #endif
 
 
+#include "vmpi_distribute_work.h"
+
+
 #define VMPI_VRAD_PACKET_ID						1
 	// Sub packet IDs.
 	#define VMPI_SUBPACKETID_VIS_LEAFS			0
@@ -25,6 +28,9 @@
 // Called first thing in the exe.
 void		VRAD_SetupMPI( int &argc, char **&argv );
 
+// DistributeWork on VMPI, or on the local worker processes with -dist.
+double		VRAD_DistributeWork( uint64 nWorkUnits, ProcessWorkUnitFn processFn, ReceiveWorkUnitFn receiveFn );
+
 void		RunMPIBuildFacelights(void);
 void		RunMPIBuildVisLeafs(void);
 void		VMPI_DistributeLightData();
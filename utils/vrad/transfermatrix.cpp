@@ -0,0 +1,203 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Patch to patch transfers in compressed sparse rows
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "transfermatrix.h"
+
+
+CTransferMatrix *TransferMatrix()
+{
+	static CTransferMatrix s_TransferMatrix;
+	return &s_TransferMatrix;
+}
+
+
+// Rows per band are added until the band holds this many transfers
+#define TRANSFER_BAND_SIZE	( 1 << 20 )
+
+
+CTransferMatrix::CTransferMatrix()
+{
+	m_bQuantized = false;
+	m_nTransfers = 0;
+	m_iBuildFirstPatch = 0;
+	m_nListBytes = 0;
+	m_nPeakBytes = 0;
+}
+
+void CTransferMatrix::Purge()
+{
+	m_RowStart.Purge();
+	m_RowBand.Purge();
+	m_Bands.Purge();
+	m_RowScale.Purge();
+	m_bQuantized = false;
+	m_nTransfers = 0;
+	m_nListBytes = 0;
+	m_nPeakBytes = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Build
+//-----------------------------------------------------------------------------
+static int __cdecl CompareTransfers( const void *a, const void *b )
+{
+	return ( (transfer_t const *)a )->patch - ( (transfer_t const *)b )->patch;
+}
+
+void CTransferMatrix::BuildRow( int iThread, int iRow )
+{
+	CTransferMatrix *pMatrix = TransferMatrix();
+	int iPatch = pMatrix->m_iBuildFirstPatch + iRow;
+	CPatch *patch = &g_Patches[iPatch];
+	if ( !patch->transfers )
+		return;
+
+	qsort( patch->transfers, patch->numtransfers, sizeof( transfer_t ), CompareTransfers );
+
+	Band_t &band = pMatrix->m_Bands[pMatrix->m_RowBand[iPatch]];
+	int iFirst = pMatrix->m_RowStart[iPatch] - band.m_iFirstTransfer;
+	for ( int i = 0; i < patch->numtransfers; i++ )
+	{
+		band.m_Patches[iFirst + i] = patch->transfers[i].patch;
+	}
+
+	if ( pMatrix->m_bQuantized )
+	{
+		float flMax = 0.0f;
+		for ( int i = 0; i < patch->numtransfers; i++ )
+		{
+			flMax = max( flMax, patch->transfers[i].transfer );
+		}
+
+		float flScale = ( flMax > 0.0f ) ? 65535.0f / flMax : 0.0f;
+		for ( int i = 0; i < patch->numtransfers; i++ )
+		{
+			band.m_QuantizedTransfers[iFirst + i] = (unsigned short)( patch->transfers[i].transfer * flScale + 0.5f );
+		}
+		pMatrix->m_RowScale[iPatch] = flMax / 65535.0f;
+	}
+	else
+	{
+		for ( int i = 0; i < patch->numtransfers; i++ )
+		{
+			band.m_Transfers[iFirst + i] = patch->transfers[i].transfer;
+		}
+	}
+
+	free( patch->transfers );
+	patch->transfers = NULL;
+}
+
+void CTransferMatrix::Build( bool bQuantize )
+{
+	Purge();
+
+	int nPatches = g_Patches.Count();
+	m_bQuantized = bQuantize;
+
+	// Lay the rows out and split them in bands
+	CUtlVector<int> bandFirstPatch;
+	m_RowStart.SetCount( nPatches + 1 );
+	m_RowBand.SetCount( nPatches );
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		CPatch *patch = &g_Patches[i];
+		int nRow = patch->transfers ? patch->numtransfers : 0;
+		if ( !bandFirstPatch.Count() || ( m_nTransfers - m_RowStart[bandFirstPatch.Tail()] + nRow > TRANSFER_BAND_SIZE && i != bandFirstPatch.Tail() ) )
+		{
+			bandFirstPatch.AddToTail( i );
+		}
+
+		m_RowStart[i] = m_nTransfers;
+		m_RowBand[i] = bandFirstPatch.Count() - 1;
+		m_nTransfers += nRow;
+		m_nListBytes += sizeof( transfer_t ) * nRow;
+	}
+	m_RowStart[nPatches] = m_nTransfers;
+	m_nListBytes += nPatches * sizeof( transfer_t* );
+
+	if ( m_bQuantized )
+	{
+		m_RowScale.SetCount( nPatches );
+		memset( m_RowScale.Base(), 0, nPatches * sizeof( float ) );
+	}
+
+	// Fill one band at a time, freeing its rows' lists before the next one is allocated
+	size_t nListBytes = m_nListBytes;
+	m_Bands.SetCount( bandFirstPatch.Count() );
+	for ( int iBand = 0; iBand < m_Bands.Count(); iBand++ )
+	{
+		m_iBuildFirstPatch = bandFirstPatch[iBand];
+		int iEndPatch = ( iBand + 1 < bandFirstPatch.Count() ) ? bandFirstPatch[iBand + 1] : nPatches;
+
+		Band_t &band = m_Bands[iBand];
+		band.m_iFirstTransfer = m_RowStart[m_iBuildFirstPatch];
+		int nBandTransfers = m_RowStart[iEndPatch] - band.m_iFirstTransfer;
+		band.m_Patches.SetCount( nBandTransfers );
+		if ( m_bQuantized )
+		{
+			band.m_QuantizedTransfers.SetCount( nBandTransfers );
+		}
+		else
+		{
+			band.m_Transfers.SetCount( nBandTransfers );
+		}
+
+		m_nPeakBytes = max( m_nPeakBytes, MemoryUsed() + nListBytes );
+
+		RunThreadsOnIndividual( iEndPatch - m_iBuildFirstPatch, false, BuildRow );
+		nListBytes -= sizeof( transfer_t ) * nBandTransfers;
+	}
+
+	qprintf( "transfer matrix: %5.1f megs, %5.1f megs as transfer lists, %5.1f megs peak while building\n",
+		(float)MemoryUsed() / ( 1024 * 1024 ), (float)ListMemoryUsed() / ( 1024 * 1024 ), (float)PeakMemoryUsed() / ( 1024 * 1024 ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Rows
+//-----------------------------------------------------------------------------
+int const *CTransferMatrix::RowPatches( int iPatch ) const
+{
+	Band_t const &band = m_Bands[m_RowBand[iPatch]];
+	return band.m_Patches.Base() + m_RowStart[iPatch] - band.m_iFirstTransfer;
+}
+
+float const *CTransferMatrix::RowTransfers( int iPatch, CUtlVector<float> &scratch ) const
+{
+	Band_t const &band = m_Bands[m_RowBand[iPatch]];
+	int iFirst = m_RowStart[iPatch] - band.m_iFirstTransfer;
+	if ( !m_bQuantized )
+		return band.m_Transfers.Base() + iFirst;
+
+	int nCount = m_RowStart[iPatch + 1] - m_RowStart[iPatch];
+	if ( scratch.Count() < nCount )
+	{
+		scratch.SetCount( nCount );
+	}
+
+	float flScale = m_RowScale[iPatch];
+	unsigned short const *pQuantized = band.m_QuantizedTransfers.Base() + iFirst;
+	float *pOut = scratch.Base();
+	for ( int i = 0; i < nCount; i++ )
+	{
+		pOut[i] = pQuantized[i] * flScale;
+	}
+	return pOut;
+}
+
+size_t CTransferMatrix::MemoryUsed() const
+{
+	size_t nBytes = m_RowStart.Count() * sizeof( int ) + m_RowBand.Count() * sizeof( int ) + m_RowScale.Count() * sizeof( float );
+	for ( int i = 0; i < m_Bands.Count(); i++ )
+	{
+		nBytes += m_Bands[i].m_Patches.Count() * sizeof( int ) + m_Bands[i].m_Transfers.Count() * sizeof( float ) +
+			m_Bands[i].m_QuantizedTransfers.Count() * sizeof( unsigned short );
+	}
+	return nBytes;
+}
@@ -0,0 +1,80 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Patch to patch transfers in compressed sparse rows, see CTransferMatrix
+//
+//=============================================================================//
+
+#ifndef TRANSFERMATRIX_H
+#define TRANSFERMATRIX_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+#include "utlvector.h"
+
+
+//-----------------------------------------------------------------------------
+// CTransferMatrix
+//
+// Purpose: Holds every patch's transfers in flat arrays instead of one
+//			allocation per patch: where each patch's row starts, the patches
+//			it gathers from, and the form factors. Rows are sorted by patch
+//			so a bounce walks the emitted light in order. Quantized form
+//			factors take 16 bits each, a fraction of their row's largest.
+//			The arrays are split in bands of consecutive rows, so Build only
+//			holds one band on top of the per-patch lists it hasn't freed yet.
+//-----------------------------------------------------------------------------
+class CTransferMatrix
+{
+public:
+	CTransferMatrix();
+
+	// Moves the transfers MakeScales left on each patch into the matrix and
+	// frees them. patch->numtransfers is kept.
+	void			Build( bool bQuantize );
+	void			Purge();
+
+	bool			IsBuilt() const						{ return m_RowStart.Count() != 0; }
+	bool			IsQuantized() const					{ return m_bQuantized; }
+	int				TransferCount() const				{ return m_nTransfers; }
+
+	int				RowCount( int iPatch ) const		{ return m_RowStart[iPatch + 1] - m_RowStart[iPatch]; }
+	int const		*RowPatches( int iPatch ) const;
+
+	// Form factors of a row. Quantized rows are decoded into scratch.
+	float const		*RowTransfers( int iPatch, CUtlVector<float> &scratch ) const;
+
+	// Bytes used by the matrix, by the per-patch lists it was built from,
+	// and by both together at the worst point of Build
+	size_t			MemoryUsed() const;
+	size_t			ListMemoryUsed() const				{ return m_nListBytes; }
+	size_t			PeakMemoryUsed() const				{ return m_nPeakBytes; }
+
+private:
+	struct Band_t
+	{
+		int							m_iFirstTransfer;
+		CUtlVector<int>				m_Patches;
+		CUtlVector<float>			m_Transfers;
+		CUtlVector<unsigned short>	m_QuantizedTransfers;
+	};
+
+	static void		BuildRow( int iThread, int iPatch );
+
+	CUtlVector<int>				m_RowStart;			// one more than there are patches
+	CUtlVector<int>				m_RowBand;
+	CUtlVector<Band_t>			m_Bands;
+	CUtlVector<float>			m_RowScale;			// quantized to float per row
+	bool			m_bQuantized;
+	int				m_nTransfers;
+	int				m_iBuildFirstPatch;			// of the band BuildRow is filling
+	size_t			m_nListBytes;
+	size_t			m_nPeakBytes;
+};
+
+
+CTransferMatrix *TransferMatrix();
+
+
+#endif // TRANSFERMATRIX_H
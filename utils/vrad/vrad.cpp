@@ -15,10 +15,14 @@
 #include "vmpi.h"
 #include "macro_texture.h"
 #include "vmpi_tools_shared.h"
+#include "distwork.h"
 #include "leaf_ambient_lighting.h"
 #include "tools_minidump.h"
 #include "loadcmdline.h"
 #include "byteswap.h"
+#include "vstdlib/jobthread.h"
+#include "lightcache.h"
+#include "transfermatrix.h"
 
 #define ALLOWDEBUGOPTIONS (0 || _DEBUG)
 
@@ -57,10 +61,13 @@ float		g_MaxDispPatchRadius = 1500.0f;			// Maximum radius allowed for displacem
 qboolean	g_bDumpPatches;
 bool	    bDumpNormals = false;
 bool		g_bDumpRtEnv = false;
+bool		g_bFastKDTree = false;
 bool		bRed2Black = true;
 bool		g_bFastAmbient = false;
 bool        g_bNoSkyRecurse = false;
 bool		g_bDumpPropLightmaps = false;
+bool		g_bLightingCache = false;
+bool		g_bQuantizeTransfers = false;
 
 
 int			junk;
@@ -1532,110 +1539,120 @@ void PreGetBumpNormalsForDisp( texinfo_t *pTexinfo, Vector &vecU, Vector &vecV,
 	vecV = vecTexV;
 }
 
+// Rows of the transfer matrix handed to a thread at a time
+#define GATHER_PATCHES_PER_WORK	64
+
+// Per bounce, the light each patch sends out (emitlight times reflectivity),
+// and the patch origins packed for the bumped gather
+static CUtlVector<Vector>	shootlight;
+static CUtlVector<Vector>	shootorigin;
+
 void GatherLight (int threadnum, void *pUserData)
 {
 	int			i, j, k;
-	transfer_t	*trans;
 	int			num;
 	CPatch		*patch;
 	Vector		sum, v;
+	CUtlVector<float>	scratch;
+
+	CTransferMatrix const *pMatrix = TransferMatrix();
+	Vector const *pShootLight = shootlight.Base();
+	Vector const *pShootOrigin = shootorigin.Base();
+	int nPatches = g_Patches.Count();
 
 	while (1)
 	{
-		j = GetThreadWork ();
-		if (j == -1)
+		int work = GetThreadWork ();
+		if (work == -1)
 			break;
 
-		patch = &g_Patches[j];
-
-		trans = patch->transfers;
-		num = patch->numtransfers;
-		if ( patch->needsBumpmap )
+		int jEnd = min( nPatches, ( work + 1 ) * GATHER_PATCHES_PER_WORK );
+		for ( j = work * GATHER_PATCHES_PER_WORK; j < jEnd; j++ )
 		{
-			Vector delta;
-			Vector bumpSum[NUM_BUMP_VECTS+1];
-			Vector normals[NUM_BUMP_VECTS+1];
+			patch = &g_Patches[j];
 
-			// Disps
-			bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 ); 
-			if ( bDisp )
-			{
-				normals[0] = patch->normal;
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				Vector vecTexU, vecTexV;
-				PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
+			num = pMatrix->RowCount( j );
+			int const *pRowPatches = pMatrix->RowPatches( j );
+			float const *pRowTransfers = num ? pMatrix->RowTransfers( j, scratch ) : NULL;
 
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] ); 
-			}
-			else
+			if ( patch->needsBumpmap )
 			{
-				GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
+				Vector delta;
+				Vector bumpSum[NUM_BUMP_VECTS+1];
+				Vector normals[NUM_BUMP_VECTS+1];
 
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0], 
-					pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal, 
-					normals[0], &normals[1] );
-			}
+				// Disps
+				bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 ); 
+				if ( bDisp )
+				{
+					normals[0] = patch->normal;
+					texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+					Vector vecTexU, vecTexV;
+					PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
 
-			// force the base lightmap to use the flat normal instead of the phong normal
-			// FIXME: why does the patch not use the phong normal?
-			normals[0] = patch->normal;
+					// use facenormal along with the smooth normal to build the three bump map vectors
+					GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] ); 
+				}
+				else
+				{
+					GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
 
-			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
-			{
-				VectorFill( bumpSum[i], 0 );
-			}
+					texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+					// use facenormal along with the smooth normal to build the three bump map vectors
+					GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0], 
+						pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal, 
+						normals[0], &normals[1] );
+				}
 
-			float dot;
-			for (k=0 ; k<num ; k++, trans++)
-			{
-				CPatch *patch2 = &g_Patches[trans->patch];
+				// force the base lightmap to use the flat normal instead of the phong normal
+				// FIXME: why does the patch not use the phong normal?
+				normals[0] = patch->normal;
 
-				// get vector to other patch
-				VectorSubtract (patch2->origin, patch->origin, delta);
-				VectorNormalize (delta);
-				// find light emitted from other patch
-				for(i=0; i<3; i++)
+				for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 				{
-					v[i] = emitlight[trans->patch][i] * patch2->reflectivity[i];
+					VectorFill( bumpSum[i], 0 );
 				}
-				// remove normal already factored into transfer steradian
-				float scale = 1.0f / DotProduct (delta, patch->normal);
-				VectorScale( v, trans->transfer * scale, v );
-				
-				Vector bumpTransfer;
-				for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
+
+				float dot;
+				for (k=0 ; k<num ; k++)
 				{
-					dot = DotProduct( delta, normals[i] );
-					if ( dot <= 0 )
+					int ndxPatch2 = pRowPatches[k];
+
+					// get vector to other patch
+					VectorSubtract (pShootOrigin[ndxPatch2], patch->origin, delta);
+					VectorNormalize (delta);
+					// remove normal already factored into transfer steradian
+					float scale = 1.0f / DotProduct (delta, patch->normal);
+					// find light emitted from other patch
+					VectorScale( pShootLight[ndxPatch2], pRowTransfers[k] * scale, v );
+					
+					Vector bumpTransfer;
+					for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 					{
-//						Assert( i > 0 ); // if this hits, then the transfer shouldn't be here.  It doesn't face the flat normal of this face!
-						continue;
+						dot = DotProduct( delta, normals[i] );
+						if ( dot <= 0 )
+						{
+//							Assert( i > 0 ); // if this hits, then the transfer shouldn't be here.  It doesn't face the flat normal of this face!
+							continue;
+						}
+						bumpTransfer = v * dot;
+						VectorAdd( bumpSum[i], bumpTransfer, bumpSum[i] );
 					}
-					bumpTransfer = v * dot;
-					VectorAdd( bumpSum[i], bumpTransfer, bumpSum[i] );
+				}
+				for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
+				{
+					VectorCopy( bumpSum[i], addlight[j].light[i] );
 				}
 			}
-			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
-			{
-				VectorCopy( bumpSum[i], addlight[j].light[i] );
-			}
-		}
-		else
-		{
-			VectorFill( sum, 0 );
-			for (k=0 ; k<num ; k++, trans++)
+			else
 			{
-				for(i=0; i<3; i++)
+				VectorFill( sum, 0 );
+				for (k=0 ; k<num ; k++)
 				{
-					v[i] = emitlight[trans->patch][i] * g_Patches[trans->patch].reflectivity[i];
+					VectorMA( sum, pRowTransfers[k], pShootLight[pRowPatches[k]], sum );
 				}
-				VectorScale( v, trans->transfer, v );
-				VectorAdd( sum, v, sum );
+				VectorCopy( sum, addlight[j].light[0] );
 			}
-			VectorCopy( sum, addlight[j].light[0] );
 		}
 	}
 }
@@ -1700,13 +1717,31 @@ void BounceLight (void)
 	}
 #endif
 
+	shootlight.SetCount( uiPatchCount );
+	shootorigin.SetCount( uiPatchCount );
+	for (i=0 ; i<uiPatchCount; i++)
+	{
+		shootorigin[i] = g_Patches[i].origin;
+	}
+
+	double flStart = Plat_FloatTime();
+
 	i = 0;
 	while ( bouncing )
 	{
+		for (unsigned int iPatch=0 ; iPatch<uiPatchCount; iPatch++)
+		{
+			CPatch *patch = &g_Patches[iPatch];
+			for (int iColor=0 ; iColor<3 ; iColor++)
+			{
+				shootlight[iPatch][iColor] = emitlight[iPatch][iColor] * patch->reflectivity[iColor];
+			}
+		}
+
 		// transfer light from to the leaf patches from other patches via transfers
 		// this moves shooter->emitlight to receiver->addlight
-		unsigned int uiPatchCount = g_Patches.Size();
-		RunThreadsOn (uiPatchCount, true, GatherLight);
+		unsigned int uiWorkCount = ( uiPatchCount + GATHER_PATCHES_PER_WORK - 1 ) / GATHER_PATCHES_PER_WORK;
+		RunThreadsOn (uiWorkCount, true, GatherLight);
 		// move newly received light (addlight) to light to be sent out (emitlight)
 		// start at children and pull light up to parents
 		// light is always received to leaf patches
@@ -1724,6 +1759,15 @@ void BounceLight (void)
 			WriteWorld (name, 0);
 		}
 	}
+
+	if ( i )
+	{
+		float flBounceTime = Plat_FloatTime() - flStart;
+		qprintf( "%d bounces in %.1f seconds, %.2f each\n", i, flBounceTime, flBounceTime / i );
+	}
+
+	shootlight.Purge();
+	shootorigin.Purge();
 }
 
 
@@ -2019,6 +2063,11 @@ bool RadWorld_Go()
 		BuildFacesVisibleToLights( true );
 	}
 
+	if ( g_bLightingCache && !g_pIncremental )
+	{
+		LightingCache()->Init( source );
+	}
+
 	// build initial facelights
 	if (g_bUseMPI) 
 	{
@@ -2027,7 +2076,12 @@ bool RadWorld_Go()
 	}
 	else 
 	{
+		double flStart = Plat_FloatTime();
 		RunThreadsOnIndividual (numfaces, true, BuildFacelights);
+		if ( g_bLightingCache )
+		{
+			LightingCache()->SetDirectLightingTime( Plat_FloatTime() - flStart );
+		}
 	}
 
 	// Was the process interrupted?
@@ -2057,18 +2111,37 @@ bool RadWorld_Go()
 			}
 		}
 
-		if (numbounce > 0)
+		// MPI workers take their share of the vis leafs, but they get the final lightmaps from the master, only it bounces
+		if ( numbounce > 0 )
 		{
-			// allocate memory for emitlight/addlight
-			emitlight.SetSize( g_Patches.Size() );
-			memset( emitlight.Base(), 0, g_Patches.Size() * sizeof( Vector ) );
-			addlight.SetSize( g_Patches.Size() );
-			memset( addlight.Base(), 0, g_Patches.Size() * sizeof( bumplights_t ) );
+			bool bBounce = !g_bUseMPI || g_bMPIMaster;
+			if ( bBounce )
+			{
+				// allocate memory for emitlight/addlight
+				emitlight.SetSize( g_Patches.Size() );
+				memset( emitlight.Base(), 0, g_Patches.Size() * sizeof( Vector ) );
+				addlight.SetSize( g_Patches.Size() );
+				memset( addlight.Base(), 0, g_Patches.Size() * sizeof( bumplights_t ) );
+			}
+
+			if ( !g_bLightingCache || !LightingCache()->RestoreTransfers() )
+			{
+				double flStart = Plat_FloatTime();
+				MakeAllScales ();
+				if ( g_bLightingCache )
+				{
+					LightingCache()->SetTransferTime( Plat_FloatTime() - flStart );
+				}
+			}
 
-			MakeAllScales ();
+			if ( bBounce )
+			{
+				// pack the transfers into rows for the bounces
+				TransferMatrix()->Build( g_bQuantizeTransfers );
 
-			// spread light around
-			BounceLight ();
+				// spread light around
+				BounceLight ();
+			}
 		}
 
 		//
@@ -2088,6 +2161,11 @@ bool RadWorld_Go()
 		VMPI_DistributeLightData();
 			
 		Msg("FinalLightFace Done\n"); fflush(stdout);
+
+		if ( g_bLightingCache && ( !g_bUseMPI || g_bMPIMaster ) )
+		{
+			LightingCache()->Save();
+		}
 	}
 
 	return true;
@@ -2143,7 +2221,7 @@ void VRAD_LoadBSP( char const *pFilename )
 	// so we prepend qdir here.
 	strcpy( source, ExpandPath( source ) );
 
-	if ( !g_bUseMPI )
+	if ( !g_bUseMPI || g_bDistWorkMaster )
 	{
 		// Setup the logfile.
 		char logFile[512];
@@ -2185,15 +2263,15 @@ void VRAD_LoadBSP( char const *pFilename )
 	LoadBSPFile (source);
 
 	// Add this bsp to our search path so embedded resources can be found
-	if ( g_bUseMPI && g_bMPIMaster )
+	if ( g_bUseMPI && g_bMPIMaster && !g_bDistWork )
 	{
 		// MPI Master, MPI workers don't need to do anything
 		g_pOriginalPassThruFileSystem->AddSearchPath(source, "GAME", PATH_ADD_TO_HEAD);
 		g_pOriginalPassThruFileSystem->AddSearchPath(source, "MOD", PATH_ADD_TO_HEAD);
 	}
-	else if ( !g_bUseMPI )
+	else if ( !g_bUseMPI || g_bDistWork )
 	{
-		// Non-MPI
+		// Non-MPI, or -dist where everyone reads the same disk
 		g_pFullFileSystem->AddSearchPath(source, "GAME", PATH_ADD_TO_HEAD);
 		g_pFullFileSystem->AddSearchPath(source, "MOD", PATH_ADD_TO_HEAD);
 	}
@@ -2271,7 +2349,19 @@ void VRAD_LoadBSP( char const *pFilename )
 	// Build acceleration structure
 	printf ( "Setting up ray-trace acceleration structure... ");
 	float start = Plat_FloatTime();
+	if ( g_bFastKDTree )
+		g_RtEnv.Flags |= RTE_FLAGS_FAST_TREE_GENERATION;
+	// the tree is refined on the job pool next to this thread. Nothing else uses the pool.
+	bool bThreadPool = ( numthreads > 1 );
+	if ( bThreadPool )
+	{
+		ThreadPoolStartParams_t startParams;
+		startParams.nThreads = numthreads - 1;
+		g_pThreadPool->Start( startParams, "VRADTree" );
+	}
 	g_RtEnv.SetupAccelerationStructure();
+	if ( bThreadPool )
+		g_pThreadPool->Stop();
 	float end = Plat_FloatTime();
 	printf ( "Done (%.2f seconds)\n", end-start );
 
@@ -2483,6 +2573,14 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			debug_extra = true;
 		}
+		else if ( !Q_stricmp(argv[i], "-quantizetransfers") )
+		{
+			g_bQuantizeTransfers = true;
+		}
+		else if ( !Q_stricmp(argv[i], "-lightcache") )
+		{
+			g_bLightingCache = true;
+		}
 		else if ( !Q_stricmp(argv[i], "-fastambient") )
 		{
 			g_bFastAmbient = true;
@@ -2491,6 +2589,10 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			do_fast = true;
 		}
+		else if (!Q_stricmp(argv[i],"-fastkdtree"))
+		{
+			g_bFastKDTree = true;
+		}
 		else if (!Q_stricmp(argv[i],"-noskyboxrecurse"))
 		{
 			g_bNoSkyRecurse = true;
@@ -2802,6 +2904,8 @@ void PrintUsage( int argc, char **argv )
 		"  -bounce #       : Set max number of bounces (default: 100).\n"
 		"  -fast           : Quick and dirty lighting.\n"
 		"  -fastambient    : Per-leaf ambient sampling is lower quality to save compute time.\n"
+		"  -lightcache     : Keep the map's lighting in a .vrc file next to the .bsp and only\n"
+		"                    relight faces reached by lights that changed since the last compile.\n"
 		"  -final          : High quality processing. equivalent to -extrasky 16.\n"
 		"  -extrasky n     : trace N times as many rays for indirect light and sky ambient.\n"
 		"  -low            : Run as an idle-priority process.\n"
@@ -2816,6 +2920,8 @@ void PrintUsage( int argc, char **argv )
 		"  -dump           : Write debugging .txt files.\n"
 		"  -dumpnormals    : Write normals to debug files.\n"
 		"  -dumptrace      : Write ray-tracing environment to debug files.\n"
+		"  -fastkdtree     : Build the ray-trace tree from binned splits. Builds\n"
+		"                    faster, traces a little slower, same lighting.\n"
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
 		"  -lights <file>  : Load a lights file in addition to lights.rad and the\n"
@@ -2829,6 +2935,9 @@ void PrintUsage( int argc, char **argv )
 		"                    radiosity.\n"
 		"  -stoponexit	   : Wait for a keypress on exit.\n"
 		"  -mpi_pw <pw>    : Use a password to choose a specific set of VMPI workers.\n"
+		"  -dist #         : Linux: run on # local worker processes instead of VMPI.\n"
+		"  -distaddr <addr>: Listen for -dist workers on host:port instead of a\n"
+		"                    Unix socket, more can join with -distworker <addr>.\n"
 		"  -nodetaillight  : Don't light detail props.\n"
 		"  -centersamples  : Move sample centers.\n"
 		"  -luxeldensity # : Rescale all luxels by the specified amount (default: 1.0).\n"
@@ -2843,6 +2952,10 @@ void PrintUsage( int argc, char **argv )
 		"  -FullMinidumps  : Write large minidumps on crash.\n"
 		"  -chop           : Smallest number of luxel widths for a bounce patch, used on edges\n"
 		"  -maxchop		   : Coarsest allowed number of luxel widths for a patch, used in face interiors\n"
+		"  -quantizetransfers : Store each bounce form factor as a 16 bit fraction of the\n"
+		"                    largest one of its patch instead of a float. Takes 6 bytes\n"
+		"                    per transfer instead of 8, and bounced light loses a little\n"
+		"                    precision.\n"
 		"\n"
 		"  -LargeDispSampleRadius: This can be used if there are splotches of bounced light\n"
 		"                          on terrain. The compile will take longer, but it will gather\n"
@@ -2920,6 +3033,12 @@ int RunVRAD( int argc, char **argv )
 
 	VRAD_ComputeOtherLighting();
 
+	// -dist workers share the coordinator's disk, leave the bsp to it.
+	if ( g_bDistWork && !g_bDistWorkMaster )
+	{
+		CmdLib_Exit( 0 );
+	}
+
 	VRAD_Finish();
 
 	VMPI_SetCurrentStage( "master done" );
@@ -2940,7 +3059,7 @@ int VRAD_Main(int argc, char **argv)
 	VRAD_SetupMPI( argc, argv );
 
 #if !defined( _DEBUG )
-	if ( g_bUseMPI && !g_bMPIMaster )
+	if ( g_bUseMPI && !g_bMPIMaster && !g_bDistWork )
 	{
 		SetupToolsMinidumpHandler( VMPI_ExceptionFilter );
 	}
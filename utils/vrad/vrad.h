@@ -271,6 +271,8 @@ extern float		lightscale;
 extern float		dlight_threshold;
 extern float		coring;
 extern qboolean		g_bDumpPatches;
+extern bool			g_bLightingCache;
+extern bool			g_bQuantizeTransfers;
 extern bool			bRed2Black;
 extern bool         g_bNoSkyRecurse;
 extern bool			bDumpNormals;
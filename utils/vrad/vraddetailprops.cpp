@@ -155,39 +155,74 @@ static void ComputeWorldCenter( DetailObjectLump_t& prop, Vector& center, Vector
 
 
 //-----------------------------------------------------------------------------
-// Computes max direct lighting for a single detal prop
+// Computes max direct lighting for up to four detail props. Each light is
+// gathered for all of them in one GatherSampleLightSSE.
 //-----------------------------------------------------------------------------
-static void ComputeMaxDirectLighting( DetailObjectLump_t& prop, Vector* maxcolor, int iThread )
+static void ComputeMaxDirectLighting( DetailObjectLump_t *pProps, int nProps, Vector maxcolor[][MAX_LIGHTSTYLES], int iThread )
 {
 	// The max direct lighting must be along the direction to one
 	// of the static lights....
+	Assert( nProps > 0 && nProps <= 4 );
 
-	Vector origin, normal;
-	ComputeWorldCenter( prop, origin, normal );
-
-	if ( !origin.IsValid() || !normal.IsValid() )
+	int props[4];
+	Vector origins[4], normals[4];
+	int clusters[4];
+	int nValid = 0;
+	for ( int i = 0; i < nProps; ++i )
 	{
-		static bool s_Warned = false;
-		if ( !s_Warned )
+		Vector origin, normal;
+		ComputeWorldCenter( pProps[i], origin, normal );
+
+		if ( !origin.IsValid() || !normal.IsValid() )
 		{
-			Warning("WARNING: Bogus detail props encountered!\n" );
-			s_Warned = true;
+			static bool s_Warned = false;
+			if ( !s_Warned )
+			{
+				Warning("WARNING: Bogus detail props encountered!\n" );
+				s_Warned = true;
+			}
+
+			// fill with debug color
+			for ( int j = 0; j < MAX_LIGHTSTYLES; ++j)
+			{
+				maxcolor[i][j].Init(1,0,0);
+			}
+			continue;
 		}
 
-		// fill with debug color
-		for ( int i = 0; i < MAX_LIGHTSTYLES; ++i)
+		// Find the max illumination
+		for ( int j = 0; j < MAX_LIGHTSTYLES; ++j)
 		{
-			maxcolor[i].Init(1,0,0);
+			maxcolor[i][j].Init(0,0,0);
 		}
-		return;
+
+		props[nValid] = i;
+		origins[nValid] = origin;
+		normals[nValid] = normal;
+		clusters[nValid] = ClusterFromPoint( origin );
+		++nValid;
 	}
 
-	int cluster = ClusterFromPoint(origin);
+	if ( !nValid )
+		return;
 
-	Vector delta;
-	CUtlVector< directlight_t* >	lights;
-	CUtlVector< Vector >			directions;
+	// Pad with the last prop, its lanes are dropped
+	FourVectors origin4;
+	FourVectors normal4;
+	for ( int i = 0; i < 4; ++i )
+	{
+		int iLane = MIN( i, nValid - 1 );
+		origin4.X( i ) = origins[iLane].x;
+		origin4.Y( i ) = origins[iLane].y;
+		origin4.Z( i ) = origins[iLane].z;
+		normal4.X( i ) = normals[iLane].x;
+		normal4.Y( i ) = normals[iLane].y;
+		normal4.Z( i ) = normals[iLane].z;
+	}
 
+	// NOTE: See version 10 for a method where we choose a normal based on whichever
+	// one produces the maximum possible illumination. This appeared to work better on
+	// e3_town, so I'm trying it now; hopefully it'll be good for all cases.
 	directlight_t* dl;
 	for (dl = activelights; dl != 0; dl = dl->next)
 	{
@@ -196,38 +231,27 @@ static void ComputeMaxDirectLighting( DetailObjectLump_t& prop, Vector* maxcolor
 			continue;
 
 		// is this lights cluster visible?
-		if ( PVSCheck( dl->pvs, cluster ) )
+		bool bVisible[4];
+		bool bAny = false;
+		for ( int i = 0; i < nValid; ++i )
 		{
-			lights.AddToTail(dl);
-			VectorSubtract( dl->light.origin, origin, delta );
-			VectorNormalize( delta );
-			directions.AddToTail( delta );
+			bVisible[i] = PVSCheck( dl->pvs, clusters[i] ) != 0;
+			bAny = bAny || bVisible[i];
 		}
-	}
-
-	// Find the max illumination
-	int i;
-	for ( i = 0; i < MAX_LIGHTSTYLES; ++i)
-	{
-		maxcolor[i].Init(0,0,0);
-	}
-
-	// NOTE: See version 10 for a method where we choose a normal based on whichever
-	// one produces the maximum possible illumination. This appeared to work better on
-	// e3_town, so I'm trying it now; hopefully it'll be good for all cases.
-	int j;
-	for ( j = 0; j < lights.Count(); ++j)
-	{
-		dl = lights[j];
+		if ( !bAny )
+			continue;
 
 		SSE_sampleLightOutput_t out;
-		FourVectors origin4;
-		FourVectors normal4;
-		origin4.DuplicateVector( origin );
-		normal4.DuplicateVector( normal );
-
 		GatherSampleLightSSE ( out, dl, -1, origin4, &normal4, 1, iThread );
-		VectorMA( maxcolor[dl->light.style], out.m_flFalloff.m128_f32[0] * out.m_flDot[0].m128_f32[0], dl->light.intensity, maxcolor[dl->light.style] );
+
+		for ( int i = 0; i < nValid; ++i )
+		{
+			if ( bVisible[i] )
+			{
+				Vector &color = maxcolor[props[i]][dl->light.style];
+				VectorMA( color, SubFloat( out.m_flFalloff, i ) * SubFloat( out.m_flDot[0], i ), dl->light.intensity, color );
+			}
+		}
 	}
 }
 
@@ -777,24 +801,15 @@ static void ComputeAmbientLighting( int iThread, DetailObjectLump_t& prop, Vecto
 
 
 //-----------------------------------------------------------------------------
-// Computes lighting for a single detal prop
+// Adds the lightstyles of a single detal prop to the lump
 //-----------------------------------------------------------------------------
 
-static void ComputeLighting( DetailObjectLump_t& prop, int iThread )
+static void ApplyLighting( DetailObjectLump_t& prop, Vector const directColor[MAX_LIGHTSTYLES], Vector const ambColor[MAX_LIGHTSTYLES] )
 {
 	// We're going to take the maximum of the ambient lighting and 
 	// the strongest directional light. This works because we're assuming
 	// the props will have built-in faked lighting.
 
-	Vector directColor[MAX_LIGHTSTYLES];
-	Vector ambColor[MAX_LIGHTSTYLES];
-
-	// Get the max influence of all direct lights
-	ComputeMaxDirectLighting( prop, directColor, iThread );
-
-	// Get the ambient lighting + lightstyles	  
-	ComputeAmbientLighting( iThread, prop, ambColor );
-
 	// Base lighting
 	Vector totalColor;
 	VectorAdd( directColor[0], ambColor[0], totalColor );
@@ -826,6 +841,24 @@ static void ComputeLighting( DetailObjectLump_t& prop, int iThread )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Computes lighting for a single detal prop
+//-----------------------------------------------------------------------------
+
+static void ComputeLighting( DetailObjectLump_t& prop, int iThread )
+{
+	Vector directColor[1][MAX_LIGHTSTYLES];
+	Vector ambColor[MAX_LIGHTSTYLES];
+
+	// Get the max influence of all direct lights
+	ComputeMaxDirectLighting( &prop, 1, directColor, iThread );
+
+	// Get the ambient lighting + lightstyles	  
+	ComputeAmbientLighting( iThread, prop, ambColor );
+
+	ApplyLighting( prop, directColor[0], ambColor );
+}
+
 
 //-----------------------------------------------------------------------------
 // Unserialization
@@ -1001,6 +1034,29 @@ void VMPI_ReceiveDetailPropWU( int iWorkUnit, MessageBuffer *pBuf, int iWorker )
 	}
 }
 	
+//-----------------------------------------------------------------------------
+// Computes the direct and ambient colors of four detail props on a thread.
+// They go into the lump afterwards, in order.
+//-----------------------------------------------------------------------------
+static DetailObjectLump_t *s_pDetailPropsToLight;
+static int s_nDetailPropsToLight;
+static CUtlVector<Vector> s_DetailPropDirectColors;
+static CUtlVector<Vector> s_DetailPropAmbientColors;
+
+static void ComputeDetailPropBatch( int iThread, int iBatch )
+{
+	int iFirst = iBatch * 4;
+	int nProps = MIN( 4, s_nDetailPropsToLight - iFirst );
+
+	Vector (*pDirectColors)[MAX_LIGHTSTYLES] = (Vector (*)[MAX_LIGHTSTYLES])&s_DetailPropDirectColors[iFirst * MAX_LIGHTSTYLES];
+	ComputeMaxDirectLighting( &s_pDetailPropsToLight[iFirst], nProps, pDirectColors, iThread );
+
+	for ( int i = 0; i < nProps; ++i )
+	{
+		ComputeAmbientLighting( iThread, s_pDetailPropsToLight[iFirst + i], &s_DetailPropAmbientColors[( iFirst + i ) * MAX_LIGHTSTYLES] );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Computes lighting for the detail props
 //-----------------------------------------------------------------------------
@@ -1023,14 +1079,26 @@ void ComputeDetailPropLighting( int iThread )
 	}
 
 	StartPacifier("Computing detail prop lighting : ");
+	double flStartTime = Plat_FloatTime();
+
+	s_pDetailPropsToLight = pProps;
+	s_nDetailPropsToLight = count;
+	s_DetailPropDirectColors.SetCount( count * MAX_LIGHTSTYLES );
+	s_DetailPropAmbientColors.SetCount( count * MAX_LIGHTSTYLES );
+
+	RunThreadsOnIndividual( ( count + 3 ) / 4, true, ComputeDetailPropBatch );
 
 	for (int i = 0; i < count; ++i)
 	{
-		UpdatePacifier( (float)i / (float)count );
-		ComputeLighting( pProps[i], iThread );
+		ApplyLighting( pProps[i], &s_DetailPropDirectColors[i * MAX_LIGHTSTYLES], &s_DetailPropAmbientColors[i * MAX_LIGHTSTYLES] );
 	}
 
+	s_DetailPropDirectColors.Purge();
+	s_DetailPropAmbientColors.Purge();
+
 	// Write detail prop lightstyle lump...
 	WriteDetailLightingLumps();
 	EndPacifier( true );
+
+	Msg( "Detail prop lighting: %d props in %.1f seconds\n", count, Plat_FloatTime() - flStartTime );
 }
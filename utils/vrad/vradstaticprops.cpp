@@ -1145,66 +1145,178 @@ bool PositionInSolid( Vector &position )
 }
 
 //-----------------------------------------------------------------------------
-// Trace from a vertex to each direct light source, accumulating its contribution.
+// Unstyled lights whose pvs has the last cluster a thread asked for. The
+// samples of a prop are mostly in one cluster, so they share the list.
 //-----------------------------------------------------------------------------
-void ComputeDirectLightingAtPoint( Vector &position, Vector &normal, Vector &outColor, int iThread,
-								   int static_prop_id_to_skip=-1, int nLFlags = 0)
+struct PropLightCache_t
+{
+	PropLightCache_t() : m_iCluster( -2 ) {}
+
+	int		m_iCluster;
+	CUtlVector<directlight_t *>	m_Lights;
+	CUtlVector<directlight_t *>	m_AllLights;		// for samples in several clusters
+};
+
+static PropLightCache_t s_PropLightCache[MAX_TOOL_THREADS+1];
+
+static CUtlVector<directlight_t *> const &VisibleLightsFromCluster( int cluster, int iThread )
+{
+	PropLightCache_t &cache = s_PropLightCache[iThread];
+	if ( cache.m_iCluster != cluster )
+	{
+		cache.m_iCluster = cluster;
+		cache.m_Lights.RemoveAll();
+		for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+		{
+			if ( !dl->light.style && PVSCheck( dl->pvs, cluster ) )
+			{
+				cache.m_Lights.AddToTail( dl );
+			}
+		}
+	}
+	return cache.m_Lights;
+}
+
+//-----------------------------------------------------------------------------
+// Per thread time spent in each part of static prop lighting
+//-----------------------------------------------------------------------------
+struct PropLightingStats_t
+{
+	PropLightingStats_t() : m_nVertices( 0 ), m_nTexels( 0 ) {}
+
+	CCycleCount	m_Direct;
+	CCycleCount	m_Indirect;
+	int			m_nVertices;
+	int			m_nTexels;
+};
+
+static PropLightingStats_t s_PropLightingStats[MAX_TOOL_THREADS+1];
+
+//-----------------------------------------------------------------------------
+// Trace from up to four points to each direct light source, accumulating its
+// contribution. All points go through one GatherSampleLightSSE per light.
+//-----------------------------------------------------------------------------
+static void ComputeDirectLightingAtPoints( int nPoints, Vector const *pPositions, Vector const *pNormals, Vector *pOutColors,
+										   int iThread, int static_prop_id_to_skip, int nLFlags )
 {
+	Assert( nPoints > 0 && nPoints <= 4 );
+	CTimeAdder adder( &s_PropLightingStats[iThread].m_Direct );
+
 	SSE_sampleLightOutput_t	sampleOutput;
 
-	outColor.Init();
+	// Pad with the last point, its lanes are dropped
+	int clusters[4];
+	bool bOneCluster = true;
+	for ( int i = 0; i < 4; i++ )
+	{
+		if ( i < nPoints )
+		{
+			pOutColors[i].Init();
+			clusters[i] = ClusterFromPoint( pPositions[i] );
+		}
+		else
+		{
+			clusters[i] = clusters[nPoints - 1];
+		}
+		bOneCluster = bOneCluster && clusters[i] == clusters[0];
+	}
+
+	FourVectors normal4;
+	for ( int i = 0; i < 4; i++ )
+	{
+		Vector const &normal = pNormals[MIN( i, nPoints - 1 )];
+		normal4.X( i ) = normal.x;
+		normal4.Y( i ) = normal.y;
+		normal4.Z( i ) = normal.z;
+	}
 
 	// Iterate over all direct lights and accumulate their contribution
-	int cluster = ClusterFromPoint( position );
-	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	CUtlVector<directlight_t *> const &lights = bOneCluster ? VisibleLightsFromCluster( clusters[0], iThread ) : s_PropLightCache[iThread].m_AllLights;
+	if ( !bOneCluster && lights.Count() == 0 )
 	{
-		if ( dl->light.style )
+		for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
 		{
-			// skip lights with style
-			continue;
+			if ( !dl->light.style )
+			{
+				s_PropLightCache[iThread].m_AllLights.AddToTail( dl );
+			}
 		}
+	}
+
+	for ( int iLight = 0; iLight < lights.Count(); iLight++ )
+	{
+		directlight_t *dl = lights[iLight];
 
 		// is this lights cluster visible?
-		if ( !PVSCheck( dl->pvs, cluster ) )
+		bool bVisible[4];
+		bool bAny = false;
+		for ( int i = 0; i < nPoints; i++ )
+		{
+			bVisible[i] = bOneCluster || PVSCheck( dl->pvs, clusters[i] );
+			bAny = bAny || bVisible[i];
+		}
+		if ( !bAny )
 			continue;
 
 		// push the vertex towards the light to avoid surface acne
-		Vector adjusted_pos = position;
+		FourVectors adjusted_pos4;
 		float flEpsilon = 0.0;
-
-		if  (dl->light.type != emit_skyambient)
+		for ( int i = 0; i < 4; i++ )
 		{
-			// push towards the light
-			Vector fudge;
-			if ( dl->light.type == emit_skylight )
-				fudge = -( dl->light.normal);
-			else
+			Vector const &position = pPositions[MIN( i, nPoints - 1 )];
+			Vector adjusted_pos = position;
+			if  (dl->light.type != emit_skyambient)
 			{
-				fudge = dl->light.origin-position;
-				VectorNormalize( fudge );
+				// push towards the light
+				Vector fudge;
+				if ( dl->light.type == emit_skylight )
+					fudge = -( dl->light.normal);
+				else
+				{
+					fudge = dl->light.origin-position;
+					VectorNormalize( fudge );
+				}
+				fudge *= 4.0;
+				adjusted_pos += fudge;
 			}
-			fudge *= 4.0;
-			adjusted_pos += fudge;
-		}
-		else 
-		{
-			// push out along normal
-			adjusted_pos += 4.0 * normal;
-//			flEpsilon = 1.0;
+			else 
+			{
+				// push out along normal
+				adjusted_pos += 4.0 * pNormals[MIN( i, nPoints - 1 )];
+			}
+			adjusted_pos4.X( i ) = adjusted_pos.x;
+			adjusted_pos4.Y( i ) = adjusted_pos.y;
+			adjusted_pos4.Z( i ) = adjusted_pos.z;
 		}
 
-		FourVectors adjusted_pos4;
-		FourVectors normal4;
-		adjusted_pos4.DuplicateVector( adjusted_pos );
-		normal4.DuplicateVector( normal );
-
 		GatherSampleLightSSE( sampleOutput, dl, -1, adjusted_pos4, &normal4, 1, iThread, nLFlags | GATHERLFLAGS_FORCE_FAST,
 		                      static_prop_id_to_skip, flEpsilon );
-		
-		VectorMA( outColor, sampleOutput.m_flFalloff.m128_f32[0] * sampleOutput.m_flDot[0].m128_f32[0], dl->light.intensity, outColor );
+
+		for ( int i = 0; i < nPoints; i++ )
+		{
+			if ( bVisible[i] )
+			{
+				VectorMA( pOutColors[i], SubFloat( sampleOutput.m_flFalloff, i ) * SubFloat( sampleOutput.m_flDot[0], i ), dl->light.intensity, pOutColors[i] );
+			}
+		}
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Trace from a vertex to each direct light source, accumulating its contribution.
+//-----------------------------------------------------------------------------
+void ComputeDirectLightingAtPoint( Vector &position, Vector &normal, Vector &outColor, int iThread,
+								   int static_prop_id_to_skip=-1, int nLFlags = 0)
+{
+	ComputeDirectLightingAtPoints( 1, &position, &normal, &outColor, iThread, static_prop_id_to_skip, nLFlags );
+}
+
+static void ComputeIndirectLightingAtPropPoint( Vector &position, Vector &normal, Vector &outColor, int iThread, bool bIgnoreNormals )
+{
+	CTimeAdder adder( &s_PropLightingStats[iThread].m_Indirect );
+	ComputeIndirectLightingAtPoint( position, normal, outColor, iThread, true, bIgnoreNormals );
+}
+
 //-----------------------------------------------------------------------------
 // Takes the results from a ComputeLighting call and applies it to the static prop in question.
 //-----------------------------------------------------------------------------
@@ -1301,6 +1413,43 @@ void CVradStaticPropMgr::ApplyLightingToStaticProp( int iStaticProp, CStaticProp
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Lights up to four vertices that are not in solid
+//-----------------------------------------------------------------------------
+static void LightPropVertexBatch( int nVerts, Vector *pPositions, Vector *pNormals, int const *pColorVerts,
+								  CUtlVector<colorVertex_t> &colorVerts, int iThread, int skip_prop, int nFlags )
+{
+	Vector directColors[4];
+	ComputeDirectLightingAtPoints( nVerts, pPositions, pNormals, directColors, iThread, skip_prop, nFlags );
+	s_PropLightingStats[iThread].m_nVertices += nVerts;
+
+	for ( int i = 0; i < nVerts; i++ )
+	{
+		Vector directColor = directColors[i];
+		Vector indirectColor(0,0,0);
+
+		if (g_bShowStaticPropNormals)
+		{
+			directColor= pNormals[i];
+			directColor += Vector(1.0,1.0,1.0);
+			directColor *= 50.0;
+		}
+		else
+		{
+			if (numbounce >= 1)
+				ComputeIndirectLightingAtPropPoint( 
+					pPositions[i], pNormals[i], 
+					indirectColor, iThread,
+					( nFlags & GATHERLFLAGS_IGNORE_NORMALS ) != 0 );
+		}
+
+		colorVertex_t &colorVert = colorVerts[pColorVerts[i]];
+		colorVert.m_bValid = true;
+		colorVert.m_Position = pPositions[i];
+		VectorAdd( directColor, indirectColor, colorVert.m_Color );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Trace rays from each unique vertex, accumulating direct and indirect
 // sources at each ray termination. Use the winding data to distribute the unique vertexes
@@ -1360,6 +1509,9 @@ void CVradStaticPropMgr::ComputeLighting( CStaticProp &prop, int iThread, int pr
 			memset( colorVerts.Base(), 0, colorVerts.Count() * sizeof(colorVertex_t) );
 
 			int numVertexes = 0;
+			int nBatch = 0;
+			Vector batchPositions[4], batchNormals[4];
+			int batchColorVerts[4];
 			for ( int meshID = 0; meshID < pStudioModel->nummeshes; ++meshID )
 			{
 				mstudiomesh_t *pStudioMesh = pStudioModel->pMesh( meshID );
@@ -1393,39 +1545,26 @@ void CVradStaticPropMgr::ComputeLighting( CStaticProp &prop, int iThread, int pr
 					}
 					else
 					{
-						Vector direct_pos=samplePosition;
-							
-						
-
-						Vector directColor(0,0,0);
-						ComputeDirectLightingAtPoint( direct_pos,
-														sampleNormal, directColor, iThread,
-														skip_prop, nFlags );
-						Vector indirectColor(0,0,0);
-
-						if (g_bShowStaticPropNormals)
-						{
-							directColor= sampleNormal;
-							directColor += Vector(1.0,1.0,1.0);
-							directColor *= 50.0;
-						}
-						else
+						// lit four at a time below
+						batchPositions[nBatch] = samplePosition;
+						batchNormals[nBatch] = sampleNormal;
+						batchColorVerts[nBatch] = numVertexes;
+						if ( ++nBatch == 4 )
 						{
-							if (numbounce >= 1)
-								ComputeIndirectLightingAtPoint( 
-									samplePosition, sampleNormal, 
-									indirectColor, iThread, true,
-									( prop.m_Flags & STATIC_PROP_IGNORE_NORMALS) != 0 );
+							LightPropVertexBatch( nBatch, batchPositions, batchNormals, batchColorVerts, colorVerts, iThread, skip_prop, nFlags );
+							nBatch = 0;
 						}
-						
-						colorVerts[numVertexes].m_bValid = true;
-						colorVerts[numVertexes].m_Position = samplePosition;
-						VectorAdd( directColor, indirectColor, colorVerts[numVertexes].m_Color );
 					}
 					
 					numVertexes++;
 				}
 			}
+
+			if ( nBatch )
+			{
+				LightPropVertexBatch( nBatch, batchPositions, batchNormals, batchColorVerts, colorVerts, iThread, skip_prop, nFlags );
+				nBatch = 0;
+			}
 			
 			// color in the bad vertexes
 			// when entire model has no lighting origin and no valid neighbors
@@ -1484,8 +1623,8 @@ void CVradStaticPropMgr::ComputeLighting( CStaticProp &prop, int iThread, int pr
 					ComputeDirectLightingAtPoint( bestPosition, badVerts[nBadVertex].m_Normal, directColor, iThread );
 
 					Vector indirectColor;
-					ComputeIndirectLightingAtPoint( bestPosition, badVerts[nBadVertex].m_Normal,
-													indirectColor, iThread, true );
+					ComputeIndirectLightingAtPropPoint( bestPosition, badVerts[nBadVertex].m_Normal,
+														indirectColor, iThread, false );
 
 					// save results, not changing valid status
 					// to ensure this offset position is not considered as a viable candidate
@@ -1776,6 +1915,14 @@ void CVradStaticPropMgr::ComputeLighting( int iThread )
 	}
 
 	StartPacifier( "Computing static prop lighting : " );
+	double flStartTime = Plat_FloatTime();
+
+	for ( int i = 0; i < ARRAYSIZE( s_PropLightingStats ); i++ )
+	{
+		s_PropLightingStats[i] = PropLightingStats_t();
+		s_PropLightCache[i].m_iCluster = -2;
+		s_PropLightCache[i].m_AllLights.RemoveAll();
+	}
 
 	// ensure any traces against us are ignored because we have no inherit lighting contribution
 	m_bIgnoreStaticPropTrace = true;
@@ -1785,9 +1932,8 @@ void CVradStaticPropMgr::ComputeLighting( int iThread )
 		// Distribute the work among the workers.
 		VMPI_SetCurrentStage( "CVradStaticPropMgr::ComputeLighting" );
 		
-		DistributeWork( 
+		VRAD_DistributeWork( 
 			count, 
-			VMPI_DISTRIBUTEWORK_PACKETID,
 			&CVradStaticPropMgr::VMPI_ProcessStaticProp_Static, 
 			&CVradStaticPropMgr::VMPI_ReceiveStaticPropResults_Static );
 	}
@@ -1803,6 +1949,22 @@ void CVradStaticPropMgr::ComputeLighting( int iThread )
 	SerializeLighting();
 
 	EndPacifier( true );
+
+	// Where the time went, summed over the threads. The VMPI master lights nothing itself.
+	PropLightingStats_t total;
+	for ( int i = 0; i < ARRAYSIZE( s_PropLightingStats ); i++ )
+	{
+		total.m_Direct += s_PropLightingStats[i].m_Direct;
+		total.m_Indirect += s_PropLightingStats[i].m_Indirect;
+		total.m_nVertices += s_PropLightingStats[i].m_nVertices;
+		total.m_nTexels += s_PropLightingStats[i].m_nTexels;
+	}
+	if ( total.m_nVertices || total.m_nTexels )
+	{
+		Msg( "Static prop lighting: %d vertices, %d texels in %.1f seconds (thread seconds: %.1f direct, %.1f indirect)\n",
+			total.m_nVertices, total.m_nTexels, Plat_FloatTime() - flStartTime,
+			total.m_Direct.GetSeconds(), total.m_Indirect.GetSeconds() );
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -2274,6 +2436,30 @@ inline float ComputeBarycentricDistanceToTri( Vector _barycentricCoord, Vector2D
 }
 
 // ------------------------------------------------------------------------------------------------
+// Lights up to four texels of a prop lightmap
+static void LightPropTexelBatch( int nTexels, int const *pTexels, CUtlVector<colorTexel_t> &colorTexels, int iThread, int skipProp, int flags )
+{
+	Vector positions[4], normals[4], directColors[4];
+	for ( int i = 0; i < nTexels; i++ )
+	{
+		positions[i] = colorTexels[pTexels[i]].m_WorldPosition;
+		normals[i] = colorTexels[pTexels[i]].m_WorldNormal;
+	}
+
+	ComputeDirectLightingAtPoints( nTexels, positions, normals, directColors, iThread, skipProp, flags );
+	s_PropLightingStats[iThread].m_nTexels += nTexels;
+
+	for ( int i = 0; i < nTexels; i++ )
+	{
+		Vector indirectColor(0, 0, 0);
+		if (numbounce >= 1) {
+			ComputeIndirectLightingAtPropPoint( positions[i], normals[i], indirectColor, iThread, (flags & GATHERLFLAGS_IGNORE_NORMALS) != 0 );
+		}
+
+		VectorAdd(directColors[i], indirectColor, colorTexels[pTexels[i]].m_Color);
+	}
+}
+
 static void GenerateLightmapSamplesForMesh( const matrix3x4_t& _matPos, const matrix3x4_t& _matNormal, int _iThread, int _skipProp, int _flags, int _lightmapResX, int _lightmapResY, studiohdr_t* _pStudioHdr, mstudiomodel_t* _pStudioModel, OptimizedModel::ModelHeader_t* _pVtxModel, int _meshID, CComputeStaticPropLightingResults *_outResults )
 {
 	// Could iterate and gen this if needed.
@@ -2399,6 +2585,8 @@ static void GenerateLightmapSamplesForMesh( const matrix3x4_t& _matPos, const ma
 	// First attempt: Just pretend the triangle was larger and cast a ray from this new world pos 
 	// as above.
 	int linearPos = 0;
+	int nBatch = 0;
+	int batchTexels[4];
 	for ( int j = 0; j < _lightmapResY; ++j )
 	{
 		for (int i = 0; i < _lightmapResX; ++i )
@@ -2423,22 +2611,23 @@ static void GenerateLightmapSamplesForMesh( const matrix3x4_t& _matPos, const ma
 
 			if (shouldProcess)
 			{
-				Vector directColor(0, 0, 0),
-					   indirectColor(0, 0, 0);
-
-
-				ComputeDirectLightingAtPoint( colorTexels[linearPos].m_WorldPosition, colorTexels[linearPos].m_WorldNormal, directColor, _iThread, _skipProp, _flags);
-
-				if (numbounce >= 1) {
-					ComputeIndirectLightingAtPoint( colorTexels[linearPos].m_WorldPosition, colorTexels[linearPos].m_WorldNormal, indirectColor, _iThread, true, (_flags & GATHERLFLAGS_IGNORE_NORMALS) != 0 );
+				// lit four at a time
+				batchTexels[nBatch++] = linearPos;
+				if ( nBatch == 4 )
+				{
+					LightPropTexelBatch( nBatch, batchTexels, colorTexels, _iThread, _skipProp, _flags );
+					nBatch = 0;
 				}
-
-				VectorAdd(directColor, indirectColor, colorTexels[linearPos].m_Color);
 			}
 
 			++linearPos;
 		}
 	}
+
+	if ( nBatch )
+	{
+		LightPropTexelBatch( nBatch, batchTexels, colorTexels, _iThread, _skipProp, _flags );
+	}
 }
 
 // ------------------------------------------------------------------------------------------------
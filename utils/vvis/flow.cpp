@@ -7,6 +7,8 @@
 //=============================================================================//
 #include "vis.h"
 #include "vmpi.h"
+#include "threads.h"
+#include "pacifier.h"
 
 int g_TraceClusterStart = -1;
 int g_TraceClusterStop = -1;
@@ -507,10 +509,19 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	stack.portal = NULL;
 
 	might = (long *)stack.mightsee;
-	vis = (long *)thread->base->portalvis;
+	vis = (long *)thread->portalvis;
+
+	// a split flow only leaves the base leaf through one portal
+	int firstportal = 0;
+	int lastportal = leaf->portals.Count();
+	if ( prevstack == &thread->pstack_head && thread->toplevelportal >= 0 )
+	{
+		firstportal = thread->toplevelportal;
+		lastportal = firstportal + 1;
+	}
 	
 	// check all portals for flowing into other leafs	
-	for (i=0 ; i<leaf->portals.Count() ; i++)
+	for (i=firstportal ; i<lastportal ; i++)
 	{
 
 		p = leaf->portals[i];
@@ -538,7 +549,7 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 			more |= (might[j] & ~vis[j]);
 		}
 		
-		if ( !more && CheckBit( thread->base->portalvis, pnum ) )
+		if ( !more && CheckBit( thread->portalvis, pnum ) )
 		{	// can't see anything new
 			continue;
 		}
@@ -594,7 +605,7 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		{	// the second leaf can only be blocked if coplanar
 
 			// mark the portal as visible
-			SetBit( thread->base->portalvis, pnum );
+			SetBit( thread->portalvis, pnum );
 
 			RecursiveLeafFlow (p->leaf, thread, &stack);
 			continue;
@@ -609,7 +620,7 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 			continue;
 
 		// mark the portal as visible
-		SetBit( thread->base->portalvis, pnum );
+		SetBit( thread->portalvis, pnum );
 
 		// flow through it for real
 		RecursiveLeafFlow (p->leaf, thread, &stack);
@@ -619,25 +630,20 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 
 /*
 ===============
-PortalFlow
+FlowFromPortal
 
-generates the portalvis bit vector
+Marks in portalvis the portals seen through p, returns the chain count
 ===============
 */
-void PortalFlow (int iThread, int portalnum)
+static int FlowFromPortal (portal_t *p, byte *portalvis, int toplevelportal)
 {
 	threaddata_t	data;
 	int				i;
-	portal_t		*p;
-	int				c_might, c_can;
-
-	p = sorted_portals[portalnum];
-	p->status = stat_working;
-				
-	c_might = CountBits (p->portalflood, g_numportals*2);
 
 	memset (&data, 0, sizeof(data));
 	data.base = p;
+	data.portalvis = portalvis;
+	data.toplevelportal = toplevelportal;
 	
 	data.pstack_head.portal = p;
 	data.pstack_head.source = p->winding;
@@ -647,13 +653,363 @@ void PortalFlow (int iThread, int portalnum)
 
 	RecursiveLeafFlow (p->leaf, &data, &data.pstack_head);
 
+	return data.c_chains;
+}
+
+
+/*
+===============
+PortalFlow
+
+generates the portalvis bit vector
+===============
+*/
+void PortalFlow (int iThread, int portalnum)
+{
+	portal_t		*p;
+	int				c_might, c_can, c_chains;
+
+	p = sorted_portals[portalnum];
+	p->status = stat_working;
+				
+	c_might = CountBits (p->portalflood, g_numportals*2);
+
+	c_chains = FlowFromPortal (p, p->portalvis, -1);
 
 	p->status = stat_done;
 
 	c_can = CountBits (p->portalvis, g_numportals*2);
 
 	qprintf ("portal:%4i  mightsee:%4i  cansee:%4i (%i chains)\n", 
-		(int)(p - portals),	c_might, c_can, data.c_chains);
+		(int)(p - portals),	c_might, c_can, c_chains);
+}
+
+
+/*
+===============================================================================
+
+Work stealing portal flow
+
+Portals are dealt round robin into a queue per thread in sorted order, so
+every thread starts on cheap portals whose results the expensive ones can
+reuse. A thread that runs out steals the most expensive task left in the
+fullest queue. The most expensive portals are split into a task per portal
+of their leaf, each marking a private vector that is or'ed in when done.
+Since the flow can only mark portals that are visible, the result is the
+same however the work is divided.
+
+===============================================================================
+*/
+
+// Portals per thread, from the most expensive, that are split into subtasks
+#define FLOW_SPLIT_PORTALS_PER_THREAD	4
+
+bool		g_bPortalFlowReport = false;
+
+struct flowtask_t
+{
+	int			portalnum;			// into sorted_portals
+	int			toplevelportal;		// -1 for the whole portal
+};
+
+struct flowqueue_t
+{
+	CThreadFastMutex		mutex;
+	CUtlVector<flowtask_t>	tasks;
+	int						head;	// next task for the owner
+	int						tail;	// one past the next task for a thief
+};
+
+struct portalflowstats_t
+{
+	double		start;
+	double		end;
+	float		cputime;			// summed over subtasks
+	int			chains;
+	int			subtasks;
+	int			remaining;
+};
+
+static flowqueue_t			g_FlowQueues[MAX_TOOL_THREADS];
+static int					g_nFlowQueues;
+static portalflowstats_t	*g_pFlowStats;
+static int					g_nFlowPortalsDone;
+static int					g_nFlowSteals;
+
+
+static int __cdecl CompareInts (const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static bool GetFlowTask (int iThread, flowtask_t &task)
+{
+	flowqueue_t *queue = &g_FlowQueues[iThread];
+	{
+		AUTO_LOCK( queue->mutex );
+		if ( queue->head < queue->tail )
+		{
+			task = queue->tasks[queue->head++];
+			return true;
+		}
+	}
+
+	while ( 1 )
+	{
+		// the remaining counts are only read as a hint, the steal itself is locked
+		int victim = -1;
+		int most = 0;
+		for ( int i = 0; i < g_nFlowQueues; i++ )
+		{
+			int remaining = g_FlowQueues[i].tail - g_FlowQueues[i].head;
+			if ( remaining > most )
+			{
+				most = remaining;
+				victim = i;
+			}
+		}
+
+		if ( victim < 0 )
+			return false;
+
+		flowqueue_t *victimqueue = &g_FlowQueues[victim];
+		AUTO_LOCK( victimqueue->mutex );
+		if ( victimqueue->head < victimqueue->tail )
+		{
+			task = victimqueue->tasks[--victimqueue->tail];
+			ThreadInterlockedIncrement( &g_nFlowSteals );
+			return true;
+		}
+	}
+}
+
+static void RunFlowTask (const flowtask_t &task)
+{
+	portal_t *p = sorted_portals[task.portalnum];
+	portalflowstats_t *stats = &g_pFlowStats[p - portals];
+
+	double start = Plat_FloatTime();
+
+	ThreadLock ();
+	if ( p->status == stat_none )
+	{
+		p->status = stat_working;
+		stats->start = start;
+	}
+	ThreadUnlock ();
+
+	byte *portalvis = p->portalvis;
+	if ( task.toplevelportal >= 0 )
+	{
+		portalvis = (byte *)malloc (portalbytes);
+		memset (portalvis, 0, portalbytes);
+	}
+
+	int c_chains = FlowFromPortal (p, portalvis, task.toplevelportal);
+
+	double end = Plat_FloatTime();
+
+	ThreadLock ();
+	if ( portalvis != p->portalvis )
+	{
+		for ( int i = 0; i < portallongs; i++ )
+			((long *)p->portalvis)[i] |= ((long *)portalvis)[i];
+	}
+	stats->cputime += end - start;
+	stats->chains += c_chains;
+	bool bDone = ( --stats->remaining == 0 );
+	if ( bDone )
+	{
+		stats->end = end;
+		++g_nFlowPortalsDone;
+		UpdatePacifier( (float)g_nFlowPortalsDone / (g_numportals*2) );
+	}
+	ThreadUnlock ();
+
+	if ( portalvis != p->portalvis )
+	{
+		free (portalvis);
+	}
+
+	if ( bDone )
+	{
+		p->status = stat_done;
+
+		qprintf ("portal:%4i  mightsee:%4i  cansee:%4i (%i chains, %i tasks, %.3f seconds)\n", 
+			(int)(p - portals), p->nummightsee, CountBits (p->portalvis, g_numportals*2), stats->chains,
+			stats->subtasks, stats->cputime);
+	}
+}
+
+static void PortalFlowThread (int iThread, void *pUserData)
+{
+	flowtask_t task;
+	while ( GetFlowTask( iThread, task ) )
+	{
+		RunFlowTask( task );
+	}
+}
+
+/*
+===============
+RunPortalFlow
+
+PortalFlow for every portal on the work stealing scheduler
+===============
+*/
+void RunPortalFlow (void)
+{
+	int numportals = g_numportals*2;
+
+	g_nFlowQueues = clamp( numthreads, 1, MAX_TOOL_THREADS );
+	g_pFlowStats = (portalflowstats_t *)malloc (numportals * sizeof(portalflowstats_t));
+	memset (g_pFlowStats, 0, numportals * sizeof(portalflowstats_t));
+	g_nFlowPortalsDone = 0;
+	g_nFlowSteals = 0;
+
+	// mightsee is the cost estimate, split the most expensive portals
+	int splitcost = INT_MAX;
+	int nSplitPortals = g_nFlowQueues * FLOW_SPLIT_PORTALS_PER_THREAD;
+	if ( g_nFlowQueues > 1 && numportals > nSplitPortals )
+	{
+		CUtlVector<int> costs;
+		costs.SetCount( numportals );
+		for ( int i = 0; i < numportals; i++ )
+			costs[i] = portals[i].nummightsee;
+		qsort( costs.Base(), numportals, sizeof(int), CompareInts );
+		splitcost = max( costs[numportals - nSplitPortals], 1 );
+	}
+
+	for ( int i = 0; i < g_nFlowQueues; i++ )
+	{
+		g_FlowQueues[i].tasks.RemoveAll();
+		g_FlowQueues[i].head = 0;
+	}
+
+	int queue = 0;
+	int numsplit = 0;
+	int numtasks = 0;
+	for ( int i = 0; i < numportals; i++ )
+	{
+		portal_t *p = sorted_portals[i];
+		portalflowstats_t *stats = &g_pFlowStats[p - portals];
+		leaf_t *leaf = &leafs[p->leaf];
+
+		// only the portals it might see out of its leaf are worth a task
+		int nTopLevel = 0;
+		if ( p->nummightsee >= splitcost )
+		{
+			for ( int j = 0; j < leaf->portals.Count(); j++ )
+			{
+				if ( CheckBit( p->portalflood, leaf->portals[j] - portals ) )
+					nTopLevel++;
+			}
+		}
+
+		flowtask_t task;
+		task.portalnum = i;
+		if ( nTopLevel < 2 )
+		{
+			task.toplevelportal = -1;
+			g_FlowQueues[queue].tasks.AddToTail( task );
+			queue = ( queue + 1 ) % g_nFlowQueues;
+			stats->subtasks = 1;
+		}
+		else
+		{
+			for ( int j = 0; j < leaf->portals.Count(); j++ )
+			{
+				if ( !CheckBit( p->portalflood, leaf->portals[j] - portals ) )
+					continue;
+
+				task.toplevelportal = j;
+				g_FlowQueues[queue].tasks.AddToTail( task );
+				queue = ( queue + 1 ) % g_nFlowQueues;
+			}
+			stats->subtasks = nTopLevel;
+			numsplit++;
+		}
+		stats->remaining = stats->subtasks;
+		numtasks += stats->subtasks;
+	}
+
+	for ( int i = 0; i < g_nFlowQueues; i++ )
+	{
+		g_FlowQueues[i].tail = g_FlowQueues[i].tasks.Count();
+	}
+
+	double start = Plat_FloatTime();
+	RunThreadsOn (g_nFlowQueues, true, PortalFlowThread);
+	double elapsed = Plat_FloatTime() - start;
+
+	// the portals that finished last are the ones that held up the threads
+	float cputime = 0.0f;
+	int slowest = 0;
+	for ( int i = 0; i < numportals; i++ )
+	{
+		cputime += g_pFlowStats[i].cputime;
+		if ( g_pFlowStats[i].cputime > g_pFlowStats[slowest].cputime )
+			slowest = i;
+	}
+
+	Msg ("PortalFlow: %i portals in %i tasks (%i split), %i steals, %.1f%% thread utilization\n",
+		numportals, numtasks, numsplit, g_nFlowSteals,
+		elapsed > 0.0 ? 100.0 * cputime / ( elapsed * g_nFlowQueues ) : 100.0 );
+	if ( numportals )
+	{
+		Msg ("slowest portal %i: %.2f seconds over %i tasks, %.2f from start to finish\n", slowest,
+			g_pFlowStats[slowest].cputime, g_pFlowStats[slowest].subtasks, g_pFlowStats[slowest].end - g_pFlowStats[slowest].start);
+	}
+}
+
+
+/*
+===============
+WritePortalFlowReport
+
+Writes the time PortalFlow spent on each portal, slowest first
+===============
+*/
+static int __cdecl CompareFlowTimes (const void *a, const void *b)
+{
+	float ta = g_pFlowStats[*(const int *)a].cputime;
+	float tb = g_pFlowStats[*(const int *)b].cputime;
+	return ( ta > tb ) ? -1 : ( ta < tb ) ? 1 : 0;
+}
+
+void WritePortalFlowReport( const char *source )
+{
+	FILE	*reportfile;
+	char	filename[1024];
+
+	if ( !g_pFlowStats )
+	{
+		Warning("No portal flow timing, nothing to report\n");
+		return;
+	}
+
+	int numportals = g_numportals*2;
+	CUtlVector<int> order;
+	order.SetCount( numportals );
+	for ( int i = 0; i < numportals; i++ )
+		order[i] = i;
+	qsort( order.Base(), numportals, sizeof(int), CompareFlowTimes );
+
+	sprintf (filename, "%s_flow.txt", source);
+	reportfile = fopen (filename, "w");
+	if (!reportfile)
+		Error ("Couldn't open %s\n", filename);
+
+	fprintf (reportfile, "portal  leaf  mightsee  cansee    chains  tasks  seconds  elapsed\n");
+	for ( int i = 0; i < numportals; i++ )
+	{
+		portal_t *p = &portals[order[i]];
+		portalflowstats_t *stats = &g_pFlowStats[order[i]];
+		fprintf (reportfile, "%6i %5i %9i %7i %9i %6i %8.3f %8.3f\n", order[i], p->leaf, p->nummightsee,
+			CountBits (p->portalvis, numportals), stats->chains, stats->subtasks, stats->cputime, stats->end - stats->start);
+	}
+	fclose (reportfile);
+	Msg ("Wrote %s\n", filename);
 }
 
 
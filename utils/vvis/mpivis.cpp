@@ -6,7 +6,9 @@
 //
 //=============================================================================//
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include "vis.h"
 #include "threads.h"
 #include "stdlib.h"
@@ -20,7 +22,10 @@
 #include "threadhelpers.h"
 #include "vstdlib/random.h"
 #include "vmpi_tools_shared.h"
+#include "distwork.h"
+#ifdef _WIN32
 #include <conio.h>
+#endif
 #include "scratchpad_helpers.h"
 
 
@@ -55,8 +60,8 @@ CCycleCount g_CPUTime;
 ISocket *g_pPortalMCSocket = NULL;
 CIPAddr g_PortalMCAddr;
 bool g_bGotMCAddr = false;
-HANDLE g_hMCThread = NULL;
-CEvent g_MCThreadExitEvent;
+ThreadHandle_t g_hMCThread = NULL;
+CThreadEvent g_MCThreadExitEvent;
 unsigned long g_PortalMCThreadUniqueID = 0;
 int g_nMulticastPortalsReceived = 0;
 
@@ -116,9 +121,9 @@ void VMPI_DeletePortalMCSocket()
 	// Stop the thread if it exists.
 	if ( g_hMCThread )
 	{
-		g_MCThreadExitEvent.SetEvent();
-		WaitForSingleObject( g_hMCThread, INFINITE );
-		CloseHandle( g_hMCThread );
+		g_MCThreadExitEvent.Set();
+		ThreadJoin( g_hMCThread );
+		ReleaseThreadHandle( g_hMCThread );
 		g_hMCThread = NULL;
 	}
 
@@ -132,6 +137,15 @@ void VMPI_DeletePortalMCSocket()
 
 void VVIS_SetupMPI( int &argc, char **&argv )
 {
+	// Local worker processes instead of VMPI?
+	if ( DistWork_Init( argc, argv ) )
+	{
+		g_bUseMPI = true;
+		g_bMPIMaster = g_bDistWorkMaster;
+		CmdLib_AtCleanup( DistWork_Term );
+		return;
+	}
+
 	if ( !VMPI_FindArg( argc, argv, "-mpi", "" ) && !VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_Worker ), "" ) )
 		return;
 
@@ -160,6 +174,16 @@ void VVIS_SetupMPI( int &argc, char **&argv )
 }
 
 
+// DistributeWork on VMPI, or on the local worker processes with -dist.
+static double VVIS_DistributeWork( uint64 nWorkUnits, ProcessWorkUnitFn processFn, ReceiveWorkUnitFn receiveFn )
+{
+	if ( g_bDistWork )
+		return DistWork_Run( nWorkUnits, processFn, receiveFn );
+
+	return DistributeWork( nWorkUnits, VMPI_DISTRIBUTEWORK_PACKETID, processFn, receiveFn );
+}
+
+
 void ProcessBasePortalVis( int iThread, uint64 iPortal, MessageBuffer *pBuf )
 {
 	CTimeAdder adder( &g_CPUTime );
@@ -222,9 +246,8 @@ void RunMPIBasePortalVis()
 
 	// Note: we're aiming for about 1500 portals in a map, so about 3000 work units.
 	g_CPUTime.Init();
-	double elapsed = DistributeWork( 
+	double elapsed = VVIS_DistributeWork( 
 		g_numportals * 2,		// # work units
-		VMPI_DISTRIBUTEWORK_PACKETID,	// packet ID
 		ProcessBasePortalVis,	// Worker function to process work units
 		ReceiveBasePortalVis	// Master function to receive work results
 		);
@@ -244,6 +267,18 @@ void RunMPIBasePortalVis()
 		{
 			VMPI_SetCurrentStage( "SendPortalResults" );
 
+			if ( g_bDistWork )
+			{
+				MessageBuffer mb;
+				for ( i=0; i < g_numportals * 2; i++ )
+				{
+					mb.write( portals[i].portalfront, portalbytes );
+					mb.write( portals[i].portalflood, portalbytes );
+				}
+				DistWork_Broadcast( &mb );
+				return;
+			}
+
 			// Store all the portal results in a temp file and multicast that to the workers.
 			CUtlVector<char> allPortalData;
 			allPortalData.SetSize( g_numportals * 2 * portalbytes * 2 );
@@ -267,6 +302,29 @@ void RunMPIBasePortalVis()
 			VMPI_Send2Chunks( cPacketID, sizeof( cPacketID ), pVirtualFilename, strlen( pVirtualFilename ) + 1, VMPI_PERSISTENT );
 		}
 	}
+	else if ( g_bDistWork )
+	{
+		VMPI_SetCurrentStage( "RecvPortalResults" );
+
+		MessageBuffer mb;
+		DistWork_Broadcast( &mb );
+
+		for ( i=0; i < g_numportals * 2; i++ )
+		{
+			portal_t *p = &portals[i];
+
+			p->portalfront = (byte*)malloc (portalbytes);
+			mb.read( p->portalfront, portalbytes );
+
+			p->portalflood = (byte*)malloc (portalbytes);
+			mb.read( p->portalflood, portalbytes );
+
+			p->portalvis = (byte*)malloc (portalbytes);
+			memset (p->portalvis, 0, portalbytes);
+
+			p->nummightsee = CountBits (p->portalflood, g_numportals*2);
+		}
+	}
 	else
 	{
 		VMPI_SetCurrentStage( "RecvPortalResults" );
@@ -352,13 +410,13 @@ void ReceivePortalFlow( uint64 iWorkUnit, MessageBuffer *pBuf, int iWorker )
 }
 
 
-DWORD WINAPI PortalMCThreadFn( LPVOID p )
+uintp PortalMCThreadFn( void *p )
 {
 	CUtlVector<char> data;
 	data.SetSize( portalbytes + 128 );
 
-	DWORD waitTime = 0;
-	while ( WaitForSingleObject( g_MCThreadExitEvent.GetEventHandle(), waitTime ) != WAIT_OBJECT_0 )
+	uint32 waitTime = 0;
+	while ( !g_MCThreadExitEvent.Wait( waitTime ) )
 	{
 		CIPAddr ipFrom;
 		int len = g_pPortalMCSocket->RecvFrom( data.Base(), data.Count(), &ipFrom );
@@ -400,7 +458,7 @@ DWORD WINAPI PortalMCThreadFn( LPVOID p )
 
 void MCThreadCleanupFn()
 {
-	g_MCThreadExitEvent.SetEvent();
+	g_MCThreadExitEvent.Set();
 }
 		
 
@@ -420,6 +478,7 @@ public:
 	
 	virtual bool Update()
 	{
+#ifdef _WIN32
 		if ( kbhit() )
 		{
 			int key = toupper( getch() );
@@ -479,6 +538,7 @@ public:
 				}
 			}
 		}
+#endif
 		
 		return false;
 	}
@@ -530,7 +590,11 @@ void RunMPIPortalFlow()
 
 	// Workers wait until we get the MC socket address.
 	g_PortalMCThreadUniqueID = StatsDB_GetUniqueJobID();
-	if ( g_bMPIMaster )
+	if ( g_bDistWork )
+	{
+		// -dist workers only run the portals they are handed, no multicast sharing.
+	}
+	else if ( g_bMPIMaster )
 	{
 		CCycleCount cnt;
 		cnt.Sample();
@@ -577,19 +641,12 @@ void RunMPIPortalFlow()
 		}
 
 		// Make a thread to listen for the data on the multicast socket.
-		DWORD dwDummy = 0;
-		g_MCThreadExitEvent.Init( false, false );
+		g_MCThreadExitEvent.Reset();
 
 		// Make sure we kill the MC thread if the app exits ungracefully.
 		CmdLib_AtCleanup( MCThreadCleanupFn );
 		
-		g_hMCThread = CreateThread( 
-			NULL,
-			0,
-			PortalMCThreadFn,
-			NULL,
-			0,
-			&dwDummy );
+		g_hMCThread = CreateSimpleThread( PortalMCThreadFn, NULL );
 
 		if ( !g_hMCThread )
 		{
@@ -603,9 +660,8 @@ void RunMPIPortalFlow()
 	g_pDistributeWorkCallbacks = &g_VisDistributeWorkCallbacks;
 
 	g_CPUTime.Init();
-	double elapsed = DistributeWork( 
+	double elapsed = VVIS_DistributeWork( 
 		g_numportals * 2,		// # work units
-		VMPI_DISTRIBUTEWORK_PACKETID,	// packet ID
 		ProcessPortalFlow,		// Worker function to process work units
 		ReceivePortalFlow		// Master function to receive work results
 		);
@@ -82,6 +82,8 @@ struct pstack_t
 struct threaddata_t
 {
 	portal_t	*base;
+	byte		*portalvis;			// where visible portals are marked, base->portalvis unless the flow is split
+	int			toplevelportal;		// only flow out through this portal of the base leaf, -1 for all of them
 	int			c_chains;
 	pstack_t	pstack_head;
 };
@@ -113,9 +115,12 @@ void LeafFlow (int leafnum);
 void BasePortalVis (int iThread, int portalnum);
 void BetterPortalVis (int portalnum);
 void PortalFlow (int iThread, int portalnum);
+void RunPortalFlow (void);
 void WritePortalTrace( const char *source );
+void WritePortalFlowReport( const char *source );
 
 extern	portal_t	*sorted_portals[MAX_MAP_PORTALS*2];
+extern	bool		g_bPortalFlowReport;
 extern int g_TraceClusterStart, g_TraceClusterStop;
 
 int CountBits (byte *bits, int numbits);
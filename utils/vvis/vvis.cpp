@@ -18,6 +18,7 @@
 #include "collisionutils.h"
 #include "tier0/icommandline.h"
 #include "vmpi_tools_shared.h"
+#include "distwork.h"
 #include "ilaunchabledll.h"
 #include "tools_minidump.h"
 #include "loadcmdline.h"
@@ -308,7 +309,7 @@ void CalcPortalVis (void)
 	}
 	else 
 	{
-		RunThreadsOnIndividual (g_numportals*2, true, PortalFlow);
+		RunPortalFlow ();
 	}
 }
 
@@ -413,8 +414,8 @@ void LoadPortals (char *name)
 
 	FILE *f;
 
-	// Open the portal file.
-	if ( g_bUseMPI )
+	// Open the portal file. -dist workers read it from the same disk.
+	if ( g_bUseMPI && !g_bDistWork )
 	{
 		// If we're using MPI, copy off the file to a temporary first. This will download the file
 		// from the MPI master, then we get to use nice functions like fscanf on it.
@@ -947,6 +948,10 @@ int ParseCommandLine( int argc, char **argv )
 			Msg ("nosort = true\n");
 			nosort = true;
 		}
+		else if (!Q_stricmp (argv[i],"-flowreport"))
+		{
+			g_bPortalFlowReport = true;
+		}
 		else if (!Q_stricmp (argv[i],"-tmpin"))
 			strcpy (inbase, "/tmp");
 		else if( !Q_stricmp( argv[i], "-low" ) )
@@ -1027,9 +1032,13 @@ void PrintUsage( int argc, char **argv )
 		"  -novconfig      : Don't bring up graphical UI on vproject errors.\n"
 		"  -radius_override: Force a vis radius, regardless of whether an\n"
 		"  -mpi_pw <pw>    : Use a password to choose a specific set of VMPI workers.\n"
+		"  -dist #         : Linux: run on # local worker processes instead of VMPI.\n"
+		"  -distaddr <addr>: Listen for -dist workers on host:port instead of a\n"
+		"                    Unix socket, more can join with -distworker <addr>.\n"
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
 		"  -nosort         : Don't sort portals (sorting is an optimization).\n"
+		"  -flowreport     : Write the time spent on each portal to <mapname>_flow.txt.\n"
 		"  -tmpin          : Make portals come from \\tmp\\<mapname>.\n"
 		"  -tmpout         : Make portals come from \\tmp\\<mapname>.\n"
 		"  -trace <start cluster> <end cluster> : Writes a linefile that traces the vis from one cluster to another for debugging map vis.\n"
@@ -1110,7 +1119,7 @@ int RunVVis( int argc, char **argv )
 	start = Plat_FloatTime();
 
 
-	if (!g_bUseMPI)
+	if ( !g_bUseMPI || g_bDistWorkMaster )
 	{
 		// Setup the logfile.
 		char logFile[512];
@@ -1168,6 +1177,11 @@ int RunVVis( int argc, char **argv )
 		CalcVis ();
 		CalcPAS ();
 
+		if ( g_bPortalFlowReport )
+		{
+			WritePortalFlowReport( source );
+		}
+
 		// We need a mapping from cluster to leaves, since the PVS
 		// deals with clusters for both CalcVisibleFogVolumes and
 		BuildClusterTable();
@@ -1224,7 +1238,7 @@ int main (int argc, char **argv)
 	VVIS_SetupMPI( argc, argv );
 
 	// Install an exception handler.
-	if ( g_bUseMPI && !g_bMPIMaster )
+	if ( g_bUseMPI && !g_bMPIMaster && !g_bDistWork )
 		SetupToolsMinidumpHandler( VMPI_ExceptionFilter );
 	else
 		SetupDefaultToolsMinidumpHandler();
@@ -126,6 +126,13 @@ static CPhysicsInterface g_MainDLLInterface;
 IPhysics *g_PhysicsInternal = &g_MainDLLInterface;
 EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CPhysicsInterface, IPhysics, VPHYSICS_INTERFACE_VERSION, g_MainDLLInterface );
 
+// 032 only appended methods to IPhysicsEnvironment, so the same object still serves callers built against 031
+static void *CreatePhysicsInterface031()
+{
+	return static_cast<IPhysics *>( &g_MainDLLInterface );
+}
+EXPOSE_INTERFACE_FN( CreatePhysicsInterface031, IPhysics031, "VPhysics031" );
+
 
 //-----------------------------------------------------------------------------
 // Query interface
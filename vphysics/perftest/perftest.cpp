@@ -11,6 +11,7 @@
 #include "physdll.h"
 #include "materialsystem/imesh.h"
 #include "utlvector.h"
+#include "vstdlib/jobthread.h"
 
 char g_szAppName[] = "VPhysics perf test";
 bool g_bCaptureOnFocus = false;
@@ -248,6 +249,155 @@ struct physicstest_t
 
 physicstest_t staticTest;
 
+//-----------------------------------------------------------------------------
+// Friction benchmark: drops the same pile of boxes in two environments, one that
+// always scrapes serially and one that scrapes on the job pool, and checks that
+// the game sees the same friction events and the boxes come to rest in the
+// same place. The pool is restarted with more threads each pass.
+//-----------------------------------------------------------------------------
+struct frictionrecord_t
+{
+	int		object;
+	float	energy;
+	int		surfaceProps;
+	int		surfacePropsHit;
+};
+
+class CFrictionRecorder : public IPhysicsCollisionEvent
+{
+public:
+	virtual void PreCollision( vcollisionevent_t *pEvent ) {}
+	virtual void PostCollision( vcollisionevent_t *pEvent ) {}
+
+	virtual void Friction( IPhysicsObject *pObject, float energy, int surfaceProps, int surfacePropsHit, IPhysicsCollisionData *pData )
+	{
+		frictionrecord_t &record = m_records[m_records.AddToTail()];
+		record.object = pObject->GetGameIndex();
+		record.energy = energy;
+		record.surfaceProps = surfaceProps;
+		record.surfacePropsHit = surfacePropsHit;
+	}
+
+	virtual void StartTouch( IPhysicsObject *pObject1, IPhysicsObject *pObject2, IPhysicsCollisionData *pTouchData ) {}
+	virtual void EndTouch( IPhysicsObject *pObject1, IPhysicsObject *pObject2, IPhysicsCollisionData *pTouchData ) {}
+	virtual void FluidStartTouch( IPhysicsObject *pObject, IPhysicsFluidController *pFluid ) {}
+	virtual void FluidEndTouch( IPhysicsObject *pObject, IPhysicsFluidController *pFluid ) {}
+	virtual void PostSimulationFrame() {}
+
+	CUtlVector<frictionrecord_t> m_records;
+};
+
+#define FRICTION_BENCHMARK_BOXES	1024
+#define FRICTION_BENCHMARK_TICKS	600
+
+struct frictionbenchmark_t
+{
+	physicstest_t		test;
+	CFrictionRecorder	recorder;
+	double				simulateTime;
+
+	void Init( int minParallelObjects )
+	{
+		test.InitEnvironment();
+		test.physenv->SetCollisionEventHandler( &recorder );
+
+		test.physenv->SetMinParallelFrictionObjects( minParallelObjects );
+
+		CPhysCollide *pGroundCollide = physcollision->BBoxToCollide( Vector(-2048,-2048,-24), Vector(2048,2048,0) );
+		objectparams_t params = g_PhysDefaultObjectParams;
+		test.AddObject( test.physenv->CreatePolyObjectStatic( pGroundCollide, physprops->GetSurfaceIndex( "default" ), vec3_origin, vec3_angle, &params ) );
+
+		// a few tall stacks, so there are many separate piles rubbing against each other and the ground
+		for ( int i = 0; i < FRICTION_BENCHMARK_BOXES; i++ )
+		{
+			CPhysCollide *pCollide = physcollision->BBoxToCollide( Vector(-12,-12,-12), Vector(12,12,12) );
+			params.mass = 50.0f;
+			Vector origin( 96 * (i % 16) - 768 + (i / 256) * 4, 96 * ((i / 16) % 16) - 768, 16 + 26 * (i / 256) );
+			QAngle angles( 0, (i * 37) % 90, 0 );
+			IPhysicsObject *pObject = test.physenv->CreatePolyObject( pCollide, physprops->GetSurfaceIndex( "default" ), origin, angles, &params );
+			pObject->SetGameIndex( i );
+			pObject->Wake();
+			test.AddObject( pObject );
+		}
+		simulateTime = 0;
+	}
+
+	void Run()
+	{
+		for ( int i = 0; i < FRICTION_BENCHMARK_TICKS; i++ )
+		{
+			// give the boxes a shove every second so they keep scraping
+			if ( ( i % 66 ) == 0 )
+			{
+				test.Explode( Vector( 0, 0, -64 ), 50 * 100 );
+			}
+			double start = Plat_FloatTime();
+			test.Simulate( DEFAULT_TICK_INTERVAL );
+			simulateTime += Plat_FloatTime() - start;
+		}
+	}
+
+	bool Matches( frictionbenchmark_t &other )
+	{
+		if ( recorder.m_records.Count() != other.recorder.m_records.Count() )
+		{
+			Msg( "    %d friction events, expected %d\n", other.recorder.m_records.Count(), recorder.m_records.Count() );
+			return false;
+		}
+
+		for ( int i = 0; i < recorder.m_records.Count(); i++ )
+		{
+			if ( memcmp( &recorder.m_records[i], &other.recorder.m_records[i], sizeof(frictionrecord_t) ) )
+			{
+				Msg( "    friction event %d differs\n", i );
+				return false;
+			}
+		}
+
+		for ( int i = 0; i < test.list.Count(); i++ )
+		{
+			Vector pos, otherPos;
+			test.list[i].pPhysics->GetPosition( &pos, NULL );
+			other.test.list[i].pPhysics->GetPosition( &otherPos, NULL );
+			if ( pos != otherPos )
+			{
+				Msg( "    object %d ended up at (%.2f %.2f %.2f), expected (%.2f %.2f %.2f)\n", i, otherPos.x, otherPos.y, otherPos.z, pos.x, pos.y, pos.z );
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+void RunFrictionBenchmark()
+{
+	Msg( "Friction benchmark: %d boxes, %d ticks\n", FRICTION_BENCHMARK_BOXES, FRICTION_BENCHMARK_TICKS );
+
+	frictionbenchmark_t *pSerial = new frictionbenchmark_t;
+	pSerial->Init( 0 );
+	pSerial->Run();
+	Msg( "  serial: %.2f ms/tick, %d friction events\n", pSerial->simulateTime * 1000 / FRICTION_BENCHMARK_TICKS, pSerial->recorder.m_records.Count() );
+
+	int maxThreads = GetCPUInformation()->m_nLogicalProcessors;
+	for ( int threads = 1; threads <= maxThreads; threads *= 2 )
+	{
+		g_pThreadPool->Stop();
+		ThreadPoolStartParams_t startParams;
+		startParams.nThreads = threads - 1;	// the main thread takes part too
+		g_pThreadPool->Start( startParams );
+
+		frictionbenchmark_t *pParallel = new frictionbenchmark_t;
+		pParallel->Init( 1 );
+		pParallel->Run();
+		Msg( "  %d threads: %.2f ms/tick, %s\n", threads, pParallel->simulateTime * 1000 / FRICTION_BENCHMARK_TICKS, pSerial->Matches( *pParallel ) ? "deterministic" : "MISMATCH" );
+		pParallel->test.Clear();
+		delete pParallel;
+	}
+
+	pSerial->test.Clear();
+	delete pSerial;
+}
+
 void AppInit( void )
 {
 	memset( gKeys, 0, sizeof(gKeys) );
@@ -338,5 +488,9 @@ void AppChar( int key )
 	{
 		staticTest.Explode( cameraPosition, 150 * 100 );
 	}
+	else if ( key == 'b' || key == 'B' )
+	{
+		RunFrictionBenchmark();
+	}
 }
 
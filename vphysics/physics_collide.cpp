@@ -28,7 +28,11 @@
 #include "physics_virtualmesh.h"
 
 #include "mathlib/polyhedron.h"
+#include "tier0/fasttimer.h"
+#include "tier0/threadtools.h"
 #include "tier1/byteswap.h"
+#include "tier1/utlrbtree.h"
+#include "tier1/utllinkedlist.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -96,6 +100,7 @@ public:
 	void TraceBox( const Vector &start, const Vector &end, const Vector &mins, const Vector &maxs, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *ptr );
 	void TraceBox( const Ray_t &ray, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *ptr );
 	void TraceBox( const Ray_t &ray, unsigned int contentsMask, IConvexInfo *pConvexInfo, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *ptr );
+	virtual void TraceBoxBatch( const Ray_t *pRays, int rayCount, unsigned int contentsMask, IConvexInfo *pConvexInfo, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *pTraces );
 	// Trace one collide against another
 	void TraceCollide( const Vector &start, const Vector &end, const CPhysCollide *pSweepCollide, const QAngle &sweepAngles, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *ptr );
 	bool IsBoxIntersectingCone( const Vector &boxAbsMins, const Vector &boxAbsMaxs, const truncatedcone_t &cone );
@@ -117,7 +122,7 @@ public:
 
 	virtual IPhysicsCollision *ThreadContextCreate( void );
 	virtual void			ThreadContextDestroy( IPhysicsCollision *pThreadContex );
-	virtual unsigned int	ReadStat( int statID ) { return 0; }
+	virtual unsigned int	ReadStat( int statID );
 	virtual void			CollideGetMassCenter( CPhysCollide *pCollide, Vector *pOutMassCenter );
 	virtual void			CollideSetMassCenter( CPhysCollide *pCollide, const Vector &massCenter );
 
@@ -149,6 +154,13 @@ CPhysicsCollision g_PhysicsCollision;
 IPhysicsCollision *physcollision = &g_PhysicsCollision;
 EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CPhysicsCollision, IPhysicsCollision, VPHYSICS_COLLISION_INTERFACE_VERSION, g_PhysicsCollision );
 
+// 008 only appended TraceBoxBatch, so the same object still serves callers built against 007
+static void *CreatePhysicsCollision007()
+{
+	return static_cast<IPhysicsCollision *>( &g_PhysicsCollision );
+}
+EXPOSE_INTERFACE_FN( CreatePhysicsCollision007, IPhysicsCollision007, "VPhysicsCollision007" );
+
 
 //-----------------------------------------------------------------------------
 // Abstract compact_surface vs. compact_mopp
@@ -243,6 +255,8 @@ private:
 };
 #endif
 
+struct sharedsurface_t;
+
 class CPhysCollideCompactSurface : public CPhysCollide
 {
 public:
@@ -268,6 +282,7 @@ public:
 
 	const IVP_Compact_Surface		*GetCompactSurface() const { return m_pCompactSurface; }
 	virtual const collidemap_t *GetCollideMap() const { return m_pCollideMap; }
+	virtual void DetachSharedData();
 
 private:
 
@@ -288,9 +303,311 @@ private:
 	IVP_Compact_Surface		*m_pCompactSurface;
 	Vector					m_orthoAreas;
 	collidemap_t			*m_pCollideMap;
+	sharedsurface_t			*m_pShared;			// owns m_pCompactSurface and m_pCollideMap if set and not detached
+	bool					m_bDetached;		// has its own copy, m_pShared only stays referenced for objects created before
 };
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Converted compact surfaces, shared by every collide unserialized
+//			from the same bytes.  The server and client copies of a model and
+//			models that ship identical solids reference one surface and collide
+//			map.  Surfaces nobody references any more are kept around (up to
+//			g_CollideSurfaceRetainSize bytes) so that the next map's loads of
+//			the same models don't have to convert them again.
+//-----------------------------------------------------------------------------
+const int g_CollideSurfaceRetainSize = (4 * 1024 * 1024);
+
+struct sharedsurface_t
+{
+	unsigned int			size;
+	int						index;
+	IVP_Compact_Surface		*pSurface;
+	collidemap_t			*pCollideMap;
+	int						refCount;
+	int						detachedCount;	// references held by collides that made their own copy since
+	int						retainedIndex;	// into the retained list while nothing references it
+
+	unsigned int MemorySize() const;
+	unsigned int SavedSize() const;
+};
+
+class CCollideSurfaceCache
+{
+public:
+	CCollideSurfaceCache();
+	~CCollideSurfaceCache();
+
+	// Returns a reference to the surface converted from pBuffer, NULL if there isn't one yet
+	sharedsurface_t *Acquire( const char *pBuffer, unsigned int size, int index );
+	// Takes over a freshly converted surface and returns a reference to it.  If the same surface got
+	// added in the meantime the new one is freed and the existing one returned.
+	sharedsurface_t *Add( unsigned int size, int index, IVP_Compact_Surface *pSurface, collidemap_t *pCollideMap );
+	void Release( sharedsurface_t *pShared, bool bDetached );
+	// Returns a copy of the surface that belongs to the caller.  The only reference hands over the
+	// shared copy itself and is released (*pDetached is false then).  Otherwise the caller keeps its
+	// reference until it releases it as detached, objects created from the collide still use the surface.
+	IVP_Compact_Surface *Unshare( sharedsurface_t *pShared, collidemap_t **ppCollideMap, bool *pDetached );
+
+	void AddLoadTime( const CCycleCount &loadTime );
+	unsigned int ReadStat( int statID );
+
+	static unsigned int CollideMapSize( const collidemap_t *pCollideMap );
+
+private:
+	static bool SurfaceLessFunc( sharedsurface_t * const &pLeft, sharedsurface_t * const &pRight );
+	static int CompareSurfaceBytes( const char *pLeft, const char *pRight, unsigned int size );
+	void AddRef( sharedsurface_t *pShared );
+	void Free( sharedsurface_t *pShared );
+
+	CThreadFastMutex						m_lock;
+	CUtlRBTree<sharedsurface_t *, int>		m_surfaces;
+	CUtlLinkedList<sharedsurface_t *, int>	m_retained;		// least recently released first
+	unsigned int							m_residentSize;
+	unsigned int							m_retainedSize;
+	unsigned int							m_savedSize;
+	unsigned int							m_loadCount;
+	unsigned int							m_sharedCount;
+	CCycleCount								m_loadTime;
+};
+
+static CCollideSurfaceCache g_CollideSurfaceCache;
+
+unsigned int sharedsurface_t::MemorySize() const
+{
+	return size + CCollideSurfaceCache::CollideMapSize( pCollideMap );
+}
+
+// every reference but one that still uses the shared copy would need its own
+unsigned int sharedsurface_t::SavedSize() const
+{
+	int sharing = refCount - detachedCount;
+	return ( sharing > 1 ) ? ( sharing - 1 ) * MemorySize() : 0;
+}
+
+CCollideSurfaceCache::CCollideSurfaceCache() : m_surfaces( 0, 0, SurfaceLessFunc )
+{
+	m_residentSize = 0;
+	m_retainedSize = 0;
+	m_savedSize = 0;
+	m_loadCount = 0;
+	m_sharedCount = 0;
+	m_loadTime.Init();
+}
+
+CCollideSurfaceCache::~CCollideSurfaceCache()
+{
+	// anything still referenced belongs to a collide that was never freed
+	while ( m_retained.Count() )
+	{
+		int head = m_retained.Head();
+		sharedsurface_t *pShared = m_retained[head];
+		m_retained.Remove( head );
+		Free( pShared );
+	}
+}
+
+// Sorted by size and index first, so the surface bytes only get compared when those match
+bool CCollideSurfaceCache::SurfaceLessFunc( sharedsurface_t * const &pLeft, sharedsurface_t * const &pRight )
+{
+	if ( pLeft->size != pRight->size )
+		return pLeft->size < pRight->size;
+	if ( pLeft->index != pRight->index )
+		return pLeft->index < pRight->index;
+	return CompareSurfaceBytes( (const char *)pLeft->pSurface, (const char *)pRight->pSurface, pLeft->size ) < 0;
+}
+
+unsigned int CCollideSurfaceCache::CollideMapSize( const collidemap_t *pCollideMap )
+{
+	if ( !pCollideMap )
+		return 0;
+	return sizeof(collidemap_t) + ((pCollideMap->leafCount-1) * sizeof(leafmap_t));
+}
+
+// Converting a native endian surface only writes the index to dummy[0], which is part of the key already
+int CCollideSurfaceCache::CompareSurfaceBytes( const char *pLeft, const char *pRight, unsigned int size )
+{
+	const IVP_Compact_Surface *pSurface = (const IVP_Compact_Surface *)pLeft;
+	unsigned int indexStart = (const char *)&pSurface->dummy[0] - pLeft;
+	unsigned int indexEnd = indexStart + sizeof(pSurface->dummy[0]);
+	int cmp = memcmp( pLeft, pRight, indexStart );
+	if ( cmp )
+		return cmp;
+	return memcmp( pLeft + indexEnd, pRight + indexEnd, size - indexEnd );
+}
+
+void CCollideSurfaceCache::AddRef( sharedsurface_t *pShared )
+{
+	if ( pShared->refCount )
+	{
+		m_savedSize -= pShared->SavedSize();
+	}
+	else
+	{
+		m_retained.Remove( pShared->retainedIndex );
+		pShared->retainedIndex = m_retained.InvalidIndex();
+		m_retainedSize -= pShared->MemorySize();
+	}
+	pShared->refCount++;
+	m_savedSize += pShared->SavedSize();
+	m_sharedCount++;
+}
+
+sharedsurface_t *CCollideSurfaceCache::Acquire( const char *pBuffer, unsigned int size, int index )
+{
+	AUTO_LOCK( m_lock );
+	m_loadCount++;
+
+	sharedsurface_t key;
+	key.size = size;
+	key.index = index;
+	key.pSurface = (IVP_Compact_Surface *)pBuffer;
+	sharedsurface_t *pKey = &key;
+	int i = m_surfaces.Find( pKey );
+	if ( i == m_surfaces.InvalidIndex() )
+		return NULL;
+
+	AddRef( m_surfaces[i] );
+	return m_surfaces[i];
+}
+
+sharedsurface_t *CCollideSurfaceCache::Add( unsigned int size, int index, IVP_Compact_Surface *pSurface, collidemap_t *pCollideMap )
+{
+	AUTO_LOCK( m_lock );
+
+	sharedsurface_t key;
+	key.size = size;
+	key.index = index;
+	key.pSurface = pSurface;
+	sharedsurface_t *pKey = &key;
+	int i = m_surfaces.Find( pKey );
+	if ( i != m_surfaces.InvalidIndex() )
+	{
+		sharedsurface_t *pShared = m_surfaces[i];
+
+		// another thread loaded the same solid
+		ivp_free_aligned( pSurface );
+		if ( pCollideMap )
+		{
+			free( pCollideMap );
+		}
+		AddRef( pShared );
+		return pShared;
+	}
+
+	sharedsurface_t *pShared = new sharedsurface_t;
+	*pShared = key;
+	pShared->pSurface = pSurface;
+	pShared->pCollideMap = pCollideMap;
+	pShared->refCount = 1;
+	pShared->detachedCount = 0;
+	pShared->retainedIndex = m_retained.InvalidIndex();
+	m_surfaces.Insert( pShared );
+	m_residentSize += pShared->MemorySize();
+	return pShared;
+}
+
+void CCollideSurfaceCache::Release( sharedsurface_t *pShared, bool bDetached )
+{
+	AUTO_LOCK( m_lock );
+	Assert( pShared->refCount > 0 );
+	m_savedSize -= pShared->SavedSize();
+	pShared->refCount--;
+	if ( bDetached )
+	{
+		Assert( pShared->detachedCount > 0 );
+		pShared->detachedCount--;
+	}
+	if ( pShared->refCount )
+	{
+		m_savedSize += pShared->SavedSize();
+		return;
+	}
+
+	pShared->retainedIndex = m_retained.AddToTail( pShared );
+	m_retainedSize += pShared->MemorySize();
+	while ( m_retainedSize > (unsigned int)g_CollideSurfaceRetainSize )
+	{
+		int head = m_retained.Head();
+		sharedsurface_t *pOldest = m_retained[head];
+		m_retained.Remove( head );
+		m_retainedSize -= pOldest->MemorySize();
+		Free( pOldest );
+	}
+}
+
+IVP_Compact_Surface *CCollideSurfaceCache::Unshare( sharedsurface_t *pShared, collidemap_t **ppCollideMap, bool *pDetached )
+{
+	AUTO_LOCK( m_lock );
+	Assert( pShared->refCount > pShared->detachedCount );
+	IVP_Compact_Surface *pSurface;
+	if ( pShared->refCount == 1 )
+	{
+		// The only reference: hand over the shared copy itself, objects already created from the collide use it
+		pSurface = pShared->pSurface;
+		*ppCollideMap = pShared->pCollideMap;
+		m_surfaces.Remove( pShared );
+		m_residentSize -= pShared->MemorySize();
+		delete pShared;
+		*pDetached = false;
+		return pSurface;
+	}
+
+	// Objects created from the collide keep the shared surface, so the reference has to stay until the collide goes away
+	m_savedSize -= pShared->SavedSize();
+	pShared->detachedCount++;
+	m_savedSize += pShared->SavedSize();
+	*pDetached = true;
+	pSurface = (IVP_Compact_Surface *)ivp_malloc_aligned( pShared->size, 32 );
+	memcpy( pSurface, pShared->pSurface, pShared->size );
+	*ppCollideMap = NULL;
+	if ( pShared->pCollideMap )
+	{
+		unsigned int collideMapSize = CollideMapSize( pShared->pCollideMap );
+		*ppCollideMap = (collidemap_t *)malloc( collideMapSize );
+		memcpy( *ppCollideMap, pShared->pCollideMap, collideMapSize );
+	}
+	return pSurface;
+}
+
+void CCollideSurfaceCache::Free( sharedsurface_t *pShared )
+{
+	m_surfaces.Remove( pShared );
+	m_residentSize -= pShared->MemorySize();
+	ivp_free_aligned( pShared->pSurface );
+	if ( pShared->pCollideMap )
+	{
+		free( pShared->pCollideMap );
+	}
+	delete pShared;
+}
+
+void CCollideSurfaceCache::AddLoadTime( const CCycleCount &loadTime )
+{
+	AUTO_LOCK( m_lock );
+	m_loadTime += loadTime;
+}
+
+unsigned int CCollideSurfaceCache::ReadStat( int statID )
+{
+	AUTO_LOCK( m_lock );
+	switch( statID )
+	{
+	case VCOLLIDE_STAT_LOADED_SOLIDS:
+		return m_loadCount;
+	case VCOLLIDE_STAT_SHARED_SOLIDS:
+		return m_sharedCount;
+	case VCOLLIDE_STAT_LOAD_USEC:
+		return m_loadTime.GetMicroseconds();
+	case VCOLLIDE_STAT_RESIDENT_BYTES:
+		return m_residentSize;
+	case VCOLLIDE_STAT_SAVED_BYTES:
+		return m_savedSize;
+	}
+	return 0;
+}
+
+
 static const IVP_Compact_Surface *ConvertPhysCollideToCompactSurface( const CPhysCollide *pCollide )
 {
 	return pCollide->GetCompactSurface();
@@ -450,6 +767,22 @@ void CPhysCollideCompactSurface::InitCollideMap()
 
 void CPhysCollideCompactSurface::Init( const char *pBuffer, unsigned int size, int index, bool bSwap )
 {
+	m_orthoAreas.Init(1,1,1);
+	m_pShared = NULL;
+	m_bDetached = false;
+
+	// byte swapped data only gets loaded by the conversion tools, don't bother sharing it
+	if ( !bSwap )
+	{
+		m_pShared = g_CollideSurfaceCache.Acquire( pBuffer, size, index );
+		if ( m_pShared )
+		{
+			m_pCompactSurface = m_pShared->pSurface;
+			m_pCollideMap = m_pShared->pCollideMap;
+			return;
+		}
+	}
+
 	m_pCompactSurface = (IVP_Compact_Surface *)ivp_malloc_aligned( size, 32 );
 	memcpy( m_pCompactSurface, pBuffer, size );
 	if ( bSwap )
@@ -457,8 +790,14 @@ void CPhysCollideCompactSurface::Init( const char *pBuffer, unsigned int size, i
 		m_pCompactSurface->byte_swap_all();
 	}
 	m_pCompactSurface->dummy[0] = index;
-	m_orthoAreas.Init(1,1,1);
 	InitCollideMap();
+
+	if ( !bSwap )
+	{
+		m_pShared = g_CollideSurfaceCache.Add( size, index, m_pCompactSurface, m_pCollideMap );
+		m_pCompactSurface = m_pShared->pSurface;
+		m_pCollideMap = m_pShared->pCollideMap;
+	}
 }
 
 CPhysCollideCompactSurface::CPhysCollideCompactSurface( const char *pBuffer, unsigned int size, int index, bool swap )
@@ -477,11 +816,19 @@ CPhysCollideCompactSurface::CPhysCollideCompactSurface( IVP_Compact_Surface *pSu
 	pSurface->dummy[2] = IVP_COMPACT_SURFACE_ID;
 	m_pCompactSurface->dummy[0] = 0;
 	m_orthoAreas.Init(1,1,1);
+	m_pShared = NULL;
+	m_bDetached = false;
 	InitCollideMap();
 }
 
 CPhysCollideCompactSurface::~CPhysCollideCompactSurface()
 {
+	if ( m_pShared )
+	{
+		g_CollideSurfaceCache.Release( m_pShared, m_bDetached );
+		if ( !m_bDetached )
+			return;
+	}
 	ivp_free_aligned(m_pCompactSurface);
 	if ( m_pCollideMap )
 	{
@@ -489,6 +836,17 @@ CPhysCollideCompactSurface::~CPhysCollideCompactSurface()
 	}
 }
 
+void CPhysCollideCompactSurface::DetachSharedData()
+{
+	if ( !m_pShared || m_bDetached )
+		return;
+	m_pCompactSurface = g_CollideSurfaceCache.Unshare( m_pShared, &m_pCollideMap, &m_bDetached );
+	if ( !m_bDetached )
+	{
+		m_pShared = NULL;
+	}
+}
+
 IVP_SurfaceManager *CPhysCollideCompactSurface::CreateSurfaceManager( short &collideType ) const
 {
 	collideType = COLLIDE_POLY;
@@ -521,6 +879,8 @@ unsigned int CPhysCollideCompactSurface::SerializeToBuffer( char *pDest, bool bS
 	int serializationSize = GetSerializationSize();
 	if ( bSwap )
 	{
+		// UNDONE: This swaps the surface in place, so at least keep it from swapping everyone else's
+		const_cast<CPhysCollideCompactSurface *>(this)->DetachSharedData();
 		m_pCompactSurface->byte_swap_all();
 	}
 	memcpy( pDest, m_pCompactSurface, surfaceSize );
@@ -536,6 +896,7 @@ Vector CPhysCollideCompactSurface::GetMassCenter() const
 
 void CPhysCollideCompactSurface::SetMassCenter( const Vector &massCenterHL )
 {
+	DetachSharedData();
 	ConvertPositionToIVP( massCenterHL, m_pCompactSurface->mass_center );
 }
 
@@ -1559,6 +1920,11 @@ void CPhysicsCollision::TraceBox( const Ray_t &ray, unsigned int contentsMask, I
 	m_traceapi.SweepBoxIVP( ray, contentsMask, pConvexInfo, pCollide, collideOrigin, collideAngles, ptr );
 }
 
+void CPhysicsCollision::TraceBoxBatch( const Ray_t *pRays, int rayCount, unsigned int contentsMask, IConvexInfo *pConvexInfo, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *pTraces )
+{
+	m_traceapi.SweepBoxIVPBatch( pRays, rayCount, contentsMask, pConvexInfo, pCollide, collideOrigin, collideAngles, pTraces );
+}
+
 // Trace one collide against another
 void CPhysicsCollision::TraceCollide( const Vector &start, const Vector &end, const CPhysCollide *pSweepCollide, const QAngle &sweepAngles, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *ptr )
 {
@@ -1627,6 +1993,9 @@ float CPhysicsCollision::CollideSurfaceArea( CPhysCollide *pCollide )
 // loads a set of solids into a vcollide_t
 void CPhysicsCollision::VCollideLoad( vcollide_t *pOutput, int solidCount, const char *pBuffer, int bufferSize, bool swap )
 {
+	CFastTimer loadTimer;
+	loadTimer.Start();
+
 	memset( pOutput, 0, sizeof(*pOutput) );
 	int position = 0;
 
@@ -1641,13 +2010,21 @@ void CPhysicsCollision::VCollideLoad( vcollide_t *pOutput, int solidCount, const
 		memcpy( &size, pBuffer + position, sizeof(int) );
 		position += sizeof(int);
 
-		char *tmpbuf = new char[size];
-		memcpy(tmpbuf, pBuffer + position, size);
+		// Only copy solids that aren't aligned for reading the headers.  Shared solids don't get copied at all.
+		if ( (intp(pBuffer + position) & 3) == 0 )
+		{
+			pOutput->solids[i] = CPhysCollide::UnserializeFromBuffer( pBuffer + position, size, i, swap );
+		}
+		else
+		{
+			char *tmpbuf = new char[size];
+			memcpy(tmpbuf, pBuffer + position, size);
 
-		pOutput->solids[i] = CPhysCollide::UnserializeFromBuffer( tmpbuf, size, i, swap );
-		position += size;
+			pOutput->solids[i] = CPhysCollide::UnserializeFromBuffer( tmpbuf, size, i, swap );
 
-		delete[] tmpbuf;
+			delete[] tmpbuf;
+		}
+		position += size;
 	}
 
 	END_IVP_ALLOCATION();
@@ -1656,6 +2033,9 @@ void CPhysicsCollision::VCollideLoad( vcollide_t *pOutput, int solidCount, const
 	pOutput->pKeyValues = new char[keySize];
 	memcpy( pOutput->pKeyValues, pBuffer + position, keySize );
 	pOutput->descSize = 0;
+
+	loadTimer.End();
+	g_CollideSurfaceCache.AddLoadTime( loadTimer.GetDuration() );
 }
 
 // destroys the set of solids created by VCollideCreateCPhysCollide
@@ -1709,6 +2089,11 @@ void CPhysicsCollision::ThreadContextDestroy( IPhysicsCollision *pThreadContext
 {
 }
 
+unsigned int CPhysicsCollision::ReadStat( int statID )
+{
+	return g_CollideSurfaceCache.ReadStat( statID );
+}
+
 
 void CPhysicsCollision::CollideGetMassCenter( CPhysCollide *pCollide, Vector *pOutMassCenter )
 {
@@ -1785,7 +2170,11 @@ public:
 private:
 	IVP_Compact_Triangle *Triangle( IVP_Compact_Ledge *pLedge, int triangleIndex );
 
-	IVP_U_BigVector <IVP_Compact_Ledge> m_ledges;
+	void GetLedges();
+
+	CUtlVector<IVP_Compact_Ledge *>	m_ledges;
+	CPhysCollide	*m_pCollide;
+	bool			m_bDetached;
 };
 
 
@@ -1804,20 +2193,33 @@ void CPhysicsCollision::DestroyQueryModel( ICollisionQuery *pQuery )
 
 CCollisionQuery::CCollisionQuery( CPhysCollide *pCollide )
 {
-	pCollide->GetAllLedges( m_ledges );
+	m_pCollide = pCollide;
+	m_bDetached = false;
+	GetLedges();
+}
+
+void CCollisionQuery::GetLedges()
+{
+	IVP_U_BigVector<IVP_Compact_Ledge> ledges;
+	m_pCollide->GetAllLedges( ledges );
+	m_ledges.SetCount( ledges.len() );
+	for ( int i = 0; i < ledges.len(); i++ )
+	{
+		m_ledges[i] = ledges.element_at(i);
+	}
 }
 
 
 	// number of convex pieces in the whole solid
 int	CCollisionQuery::ConvexCount( void )
 {
-	return m_ledges.len();
+	return m_ledges.Count();
 }
 
 	// triangle count for this convex piece
 int CCollisionQuery::TriangleCount( int convexIndex )
 {
-	IVP_Compact_Ledge *pLedge = m_ledges.element_at(convexIndex);
+	IVP_Compact_Ledge *pLedge = m_ledges[convexIndex];
 	if ( pLedge )
 	{
 		return pLedge->get_n_triangles();
@@ -1829,7 +2231,7 @@ int CCollisionQuery::TriangleCount( int convexIndex )
 
 unsigned int CCollisionQuery::GetGameData( int convexIndex )
 {
-	IVP_Compact_Ledge *pLedge = m_ledges.element_at( convexIndex );
+	IVP_Compact_Ledge *pLedge = m_ledges[convexIndex];
 	if ( pLedge )
 		return pLedge->get_client_data();
 	return 0;
@@ -1838,7 +2240,7 @@ unsigned int CCollisionQuery::GetGameData( int convexIndex )
 	// Gets the triangle's verts to an array
 void CCollisionQuery::GetTriangleVerts( int convexIndex, int triangleIndex, Vector *verts )
 {
-	IVP_Compact_Ledge *pLedge = m_ledges.element_at( convexIndex );
+	IVP_Compact_Ledge *pLedge = m_ledges[convexIndex];
 	IVP_Compact_Triangle *pTriangle = Triangle( pLedge, triangleIndex );
 
 	int vertIndex = 0;
@@ -1856,14 +2258,14 @@ void CCollisionQuery::GetTriangleVerts( int convexIndex, int triangleIndex, Vect
 // UNDONE: This doesn't work!!!
 void CCollisionQuery::SetTriangleVerts( int convexIndex, int triangleIndex, const Vector *verts )
 {
-	IVP_Compact_Ledge *pLedge = m_ledges.element_at( convexIndex );
+	IVP_Compact_Ledge *pLedge = m_ledges[convexIndex];
 	Triangle( pLedge, triangleIndex );
 }
 
 	
 int CCollisionQuery::GetTriangleMaterialIndex( int convexIndex, int triangleIndex )
 {
-	IVP_Compact_Ledge *pLedge = m_ledges.element_at( convexIndex );
+	IVP_Compact_Ledge *pLedge = m_ledges[convexIndex];
 	IVP_Compact_Triangle *pTriangle = Triangle( pLedge, triangleIndex );
 
 	return pTriangle->get_material_index();
@@ -1871,7 +2273,14 @@ int CCollisionQuery::GetTriangleMaterialIndex( int convexIndex, int triangleInde
 
 void CCollisionQuery::SetTriangleMaterialIndex( int convexIndex, int triangleIndex, int index7bits )
 {
-	IVP_Compact_Ledge *pLedge = m_ledges.element_at( convexIndex );
+	if ( !m_bDetached )
+	{
+		// don't change the materials of every other collide loaded from the same data
+		m_pCollide->DetachSharedData();
+		GetLedges();
+		m_bDetached = true;
+	}
+	IVP_Compact_Ledge *pLedge = m_ledges[convexIndex];
 	IVP_Compact_Triangle *pTriangle = Triangle( pLedge, triangleIndex );
 
 	pTriangle->set_material_index( index7bits );
@@ -6,6 +6,7 @@
 //=============================================================================//
 #include "cbase.h"
 #include "tier0/threadtools.h"
+#include "vstdlib/jobthread.h"
 #include "physics_constraint.h"
 #include "physics_spring.h"
 #include "physics_fluid.h"
@@ -189,6 +190,8 @@ public:
 	{
 		m_pCallback = NULL;
 		m_lastScrapeTime = 0.0f;
+		m_scrapeScale = 0.0f;
+		m_minParallelFrictionObjects = 0;	// serial until the job pool friction pass is benchmarked in game
 	}
 
 	void SetHandler( IPhysicsObjectEvent *pListener )
@@ -300,66 +303,40 @@ public:
 		}
 
 		m_lastScrapeTime = nextTime;
+		m_scrapeScale = t;
 
 		// UNDONE: This only calls friciton for one object in each pair.
 		// UNDONE: Split energy in half and call for both objects?
 		// UNDONE: Don't split/call if one object is static (like the world)?
+		if ( m_minParallelFrictionObjects > 0 && m_activeObjects.Count() >= m_minParallelFrictionObjects )
+		{
+			ProcessFrictionBatches( pEvent );
+			return;
+		}
+
+		CUtlVector<frictionevent_t> &events = m_serialFrictionEvents;
 		for ( int i = 0; i < m_activeObjects.Count(); i++ )
 		{
-			CPhysicsObject *pObject = m_activeObjects[i];
-			IVP_Real_Object *ivpObject = pObject->GetObject();
-			
-			// no friction callbacks for this object
-			if ( ! (pObject->CallbackFlags() & CALLBACK_GLOBAL_FRICTION) )
-				continue;
-
-			// UNDONE: IVP_Synapse_Friction is supposed to be opaque.  Is there a better way
-			// to implement this?  Using the friction listener is much more work for the CPU
-			// and considers sleeping objects.
-			IVP_Synapse_Friction *pfriction = ivpObject->get_first_friction_synapse();
-			while ( pfriction )
+			events.RemoveAll();
+			ComputeFriction( i, events );
+			for ( int j = 0; j < events.Count(); j++ )
 			{
-				IVP_Contact_Point *contact = pfriction->get_contact_point();
-				IVP_Synapse_Friction *pOpposite = GetOppositeSynapse( pfriction );
-				IVP_Real_Object *pobj = pOpposite->get_object();
-				CPhysicsObject *pScrape = (CPhysicsObject *)pobj->client_data;
-
-				// friction callbacks for this object?
-				if ( pScrape->CallbackFlags() & CALLBACK_GLOBAL_FRICTION )
-				{
-					float energy = IVP_Contact_Point_API::get_eliminated_energy( contact );
-					if ( energy ) 
-					{
-						// scrape with an estimate for the energy per unit mass
-						// This assumes that the game is interested in some measure of vibration
-						// for sound effects.  This also assumes that more massive objects require
-						// more energy to vibrate.
-						energy = energy * t * ivpObject->get_core()->get_inv_mass();
-
-						if ( energy > 0.05f )
-						{
-							int hitSurface = pScrape->GetMaterialIndexInternal();
-
-							int materialIndex = pOpposite->get_material_index();
-							if ( materialIndex )
-							{
-								// use the per-triangle material if it has one
-								hitSurface = physprops->RemapIVPMaterialIndex( materialIndex );
-							}
-
-							float sign = (pfriction == contact->get_synapse(0)) ? 1 : -1;
-
-							CPhysicsFrictionData data(pfriction, sign);
-
-							pEvent->Friction( pObject, ConvertEnergyToHL(energy), pObject->GetMaterialIndexInternal(), hitSurface, &data );
-						}
-						IVP_Contact_Point_API::reset_eliminated_energy( contact );
-					}
-				}
-				pfriction = pfriction->get_next();
+				DeliverFriction( events[j], pEvent );
 			}
 		}
 	}
+
+	// With at least this many active objects, the scraping is done on the job pool.
+	// 0 always scrapes serially.
+	void SetMinParallelFrictionObjects( int count )
+	{
+		m_minParallelFrictionObjects = count;
+	}
+	int GetMinParallelFrictionObjects() const
+	{
+		return m_minParallelFrictionObjects;
+	}
+
 	void DebugCheckContacts( IVP_Environment *pEnvironment )
 	{
 		IVP_Mindist_Manager *pManager = pEnvironment->get_mindist_manager();
@@ -414,9 +391,149 @@ public:
 	}
 
 private:
+	enum
+	{
+		FRICTION_BATCH_SIZE = 32,
+	};
+
+	struct frictionevent_t
+	{
+		CPhysicsObject			*pObject;	// not an active index, game callbacks can reorder the active list before delivery
+		IVP_Synapse_Friction	*pFriction;
+		float					energy;
+		int						surfacePropsHit;
+		float					sign;
+	};
+
+	// A run of the active list scraped by one job
+	struct frictionbatch_t
+	{
+		int								firstObject;
+		int								objectCount;
+		CUtlVector<frictionevent_t>		events;
+	};
+
+	//-----------------------------------------------------------------------------
+	// Purpose: Consumes the scrape energy of the contacts of one active object and
+	//			records a friction event for each one that scraped hard enough.
+	//			A contact between two active objects that both want friction belongs
+	//			to the one earlier in the active list; the serial walk has always
+	//			consumed its energy there first. So every contact is read and reset
+	//			by exactly one object, and objects can be scraped on any thread.
+	//-----------------------------------------------------------------------------
+	void ComputeFriction( int index, CUtlVector<frictionevent_t> &events )
+	{
+		CPhysicsObject *pObject = m_activeObjects[index];
+		IVP_Real_Object *ivpObject = pObject->GetObject();
+		
+		// no friction callbacks for this object
+		if ( ! (pObject->CallbackFlags() & CALLBACK_GLOBAL_FRICTION) )
+			return;
+
+		// UNDONE: IVP_Synapse_Friction is supposed to be opaque.  Is there a better way
+		// to implement this?  Using the friction listener is much more work for the CPU
+		// and considers sleeping objects.
+		IVP_Synapse_Friction *pfriction = ivpObject->get_first_friction_synapse();
+		while ( pfriction )
+		{
+			IVP_Contact_Point *contact = pfriction->get_contact_point();
+			IVP_Synapse_Friction *pOpposite = GetOppositeSynapse( pfriction );
+			IVP_Real_Object *pobj = pOpposite->get_object();
+			CPhysicsObject *pScrape = (CPhysicsObject *)pobj->client_data;
+
+			// friction callbacks for this object? (and not a contact an earlier object scrapes)
+			if ( (pScrape->CallbackFlags() & CALLBACK_GLOBAL_FRICTION) && pScrape->GetActiveIndex() >= index )
+			{
+				float energy = IVP_Contact_Point_API::get_eliminated_energy( contact );
+				if ( energy ) 
+				{
+					// scrape with an estimate for the energy per unit mass
+					// This assumes that the game is interested in some measure of vibration
+					// for sound effects.  This also assumes that more massive objects require
+					// more energy to vibrate.
+					energy = energy * m_scrapeScale * ivpObject->get_core()->get_inv_mass();
+
+					if ( energy > 0.05f )
+					{
+						int hitSurface = pScrape->GetMaterialIndexInternal();
+
+						int materialIndex = pOpposite->get_material_index();
+						if ( materialIndex )
+						{
+							// use the per-triangle material if it has one
+							hitSurface = physprops->RemapIVPMaterialIndex( materialIndex );
+						}
+
+						frictionevent_t &event = events[events.AddToTail()];
+						event.pObject = pObject;
+						event.pFriction = pfriction;
+						event.energy = energy;
+						event.surfacePropsHit = hitSurface;
+						event.sign = (pfriction == contact->get_synapse(0)) ? 1 : -1;
+					}
+					IVP_Contact_Point_API::reset_eliminated_energy( contact );
+				}
+			}
+			pfriction = pfriction->get_next();
+		}
+	}
+
+	void DeliverFriction( const frictionevent_t &event, IPhysicsCollisionEvent *pEvent )
+	{
+		CPhysicsObject *pObject = event.pObject;
+		CPhysicsFrictionData data( event.pFriction, event.sign );
+		pEvent->Friction( pObject, ConvertEnergyToHL(event.energy), pObject->GetMaterialIndexInternal(), event.surfacePropsHit, &data );
+	}
+
+	void ScrapeBatch( frictionbatch_t &batch )
+	{
+		batch.events.RemoveAll();
+		for ( int i = 0; i < batch.objectCount; i++ )
+		{
+			ComputeFriction( batch.firstObject + i, batch.events );
+		}
+	}
+
+	//-----------------------------------------------------------------------------
+	// Purpose: Scrapes fixed size runs of the active list on the job pool, then
+	//			calls the game in the order the serial walk would. The batches
+	//			don't depend on the thread count, so neither do the events.
+	//-----------------------------------------------------------------------------
+	void ProcessFrictionBatches( IPhysicsCollisionEvent *pEvent )
+	{
+		int count = m_activeObjects.Count();
+		int batchCount = ( count + FRICTION_BATCH_SIZE - 1 ) / FRICTION_BATCH_SIZE;
+		while ( m_frictionBatches.Count() < batchCount )
+		{
+			m_frictionBatches.AddToTail();
+		}
+
+		for ( int i = 0; i < batchCount; i++ )
+		{
+			m_frictionBatches[i].firstObject = i * FRICTION_BATCH_SIZE;
+			m_frictionBatches[i].objectCount = MIN( count - i * FRICTION_BATCH_SIZE, FRICTION_BATCH_SIZE );
+		}
+
+		ParallelProcess( "CSleepObjects::ScrapeBatch", m_frictionBatches.Base(), batchCount, this, &CSleepObjects::ScrapeBatch );
+
+		for ( int i = 0; i < batchCount; i++ )
+		{
+			const CUtlVector<frictionevent_t> &events = m_frictionBatches[i].events;
+			for ( int j = 0; j < events.Count(); j++ )
+			{
+				DeliverFriction( events[j], pEvent );
+			}
+		}
+	}
+
 	CUtlVector<CPhysicsObject *>	m_activeObjects;
 	float							m_lastScrapeTime;
+	float							m_scrapeScale;
 	IPhysicsObjectEvent				*m_pCallback;
+
+	int								m_minParallelFrictionObjects;
+	CUtlVector<frictionbatch_t>		m_frictionBatches;
+	CUtlVector<frictionevent_t>		m_serialFrictionEvents;
 };
 
 class CEmptyCollisionListener : public IPhysicsCollisionEvent
@@ -1942,6 +2059,16 @@ void CPhysicsEnvironment::SetPerformanceSettings( const physics_performanceparam
 	}
 }
 
+void CPhysicsEnvironment::SetMinParallelFrictionObjects( int count )
+{
+	m_pSleepEvents->SetMinParallelFrictionObjects( MAX( count, 0 ) );
+}
+
+int CPhysicsEnvironment::GetMinParallelFrictionObjects() const
+{
+	return m_pSleepEvents->GetMinParallelFrictionObjects();
+}
+
 
 // perf/cost statistics
 void CPhysicsEnvironment::ReadStats( physics_stats_t *pOutput )
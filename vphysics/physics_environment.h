@@ -121,6 +121,8 @@ public:
 	// performance tuning
 	virtual void GetPerformanceSettings( physics_performanceparams_t *pOutput ) const;
 	virtual void SetPerformanceSettings( const physics_performanceparams_t *pSettings );
+	virtual void SetMinParallelFrictionObjects( int count );
+	virtual int GetMinParallelFrictionObjects() const;
 
 	// perf/cost statistics
 	virtual void ReadStats( physics_stats_t *pOutput );
@@ -138,6 +138,8 @@ public:
 	virtual void ComputeOrthographicAreas( float epsilon ) {}
 	virtual void SetOrthographicAreas( const Vector &areas ) {}
 	virtual const collidemap_t *GetCollideMap() const { return NULL; }
+	// Gives this collide its own copy of any data it shares with other collides, before modifying it
+	virtual void DetachSharedData() {}
 };
 
 class ITraceObject
@@ -161,6 +163,8 @@ public:
 	// Calculate the intersection of a swept box (mins/maxs) against an IVP object.  All coords are in HL space.
 	void SweepBoxIVP( const Vector &start, const Vector &end, const Vector &mins, const Vector &maxs, const CPhysCollide *pSurface, const Vector &surfaceOrigin, const QAngle &surfaceAngles, trace_t *ptr );
 	void SweepBoxIVP( const Ray_t &raySrc, unsigned int contentsMask, IConvexInfo *pConvexInfo, const CPhysCollide *pSurface, const Vector &surfaceOrigin, const QAngle &surfaceAngles, trace_t *ptr );
+	// Same as SweepBoxIVP for each ray, but the rays share the setup and the walk of the surface's ledge tree
+	void SweepBoxIVPBatch( const Ray_t *pRays, int rayCount, unsigned int contentsMask, IConvexInfo *pConvexInfo, const CPhysCollide *pSurface, const Vector &surfaceOrigin, const QAngle &surfaceAngles, trace_t *pTraces );
 
 	// Calculate the intersection of a swept compact surface against another compact surface.  All coords are in HL space.
 	// NOTE: BUGBUG: swept surface must be single convex!!!
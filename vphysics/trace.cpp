@@ -862,7 +862,9 @@ Vector CTraceIVP::GetVertByIndex( int index ) const
 class CTraceAABB : public ITraceObject
 {
 public:
+	CTraceAABB() {}
 	CTraceAABB( const Vector &hlmins, const Vector &hlmaxs, bool isPoint );
+	void Init( const Vector &hlmins, const Vector &hlmaxs, bool isPoint );
 	virtual int SupportMap( const Vector &dir, Vector *pOut ) const;
 	virtual Vector GetVertByIndex( int index ) const;
 	virtual float Radius( void ) const { return m_radius; }
@@ -877,6 +879,11 @@ private:
 
 
 CTraceAABB::CTraceAABB( const Vector &hlmins, const Vector &hlmaxs, bool isPoint )
+{
+	Init( hlmins, hlmaxs, isPoint );
+}
+
+void CTraceAABB::Init( const Vector &hlmins, const Vector &hlmaxs, bool isPoint )
 {
 	if ( isPoint )
 	{
@@ -936,6 +943,7 @@ Vector CTraceAABB::GetVertByIndex( int index ) const
 class CTraceRay
 {
 public:
+	CTraceRay() {}
 	CTraceRay( const Vector &hlstart, const Vector &hlend );
 	CTraceRay( const Ray_t &ray );
 	CTraceRay( const Ray_t &ray, const Vector &offset );
@@ -1033,7 +1041,13 @@ public:
 class CTraceSolver
 {
 public:
+	CTraceSolver() {}
 	CTraceSolver( trace_t *ptr, ITraceObject *sweepobject, CTraceRay *ray, ITraceObject *obstacle, const Vector &axis )
+	{
+		Init( ptr, sweepobject, ray, obstacle, axis );
+	}
+
+	void Init( trace_t *ptr, ITraceObject *sweepobject, CTraceRay *ray, ITraceObject *obstacle, const Vector &axis )
 	{
 		m_pTotalTrace = ptr;
 		m_sweepObject = sweepobject;
@@ -1079,14 +1093,19 @@ private:
 
 class CTraceSolverSweptObject : public CTraceSolver
 {
+	friend class CTraceSolverPacket;
 public:
+	CTraceSolverSweptObject() {}
 	CTraceSolverSweptObject( trace_t *ptr, ITraceObject *sweepobject, CTraceRay *ray, CTraceIVP *obstacle, const Vector &axis, unsigned int contentsMask, IConvexInfo *pConvexInfo );
+	void Init( trace_t *ptr, ITraceObject *sweepobject, CTraceRay *ray, CTraceIVP *obstacle, const Vector &axis, unsigned int contentsMask, IConvexInfo *pConvexInfo );
 
 	void InitOSRay( void );
 	void SweepLedgeTree_r( const IVP_Compact_Ledgetree_Node *node );
 	inline bool SweepHitsSphereOS( const IVP_U_Float_Point *sphereCenter, float radius );
 	virtual void DoSweep( void );
 	inline void SweepAgainstNode( const IVP_Compact_Ledgetree_Node *node );
+	// The obstacle's ledge must already be set
+	inline void SweepAgainstLedge( unsigned int ledgeContents );
 
 	CTraceIVP			*m_obstacleIVP;
 	IConvexInfo			*m_pConvexInfo;
@@ -1105,8 +1124,13 @@ private:
 };
 
 CTraceSolverSweptObject::CTraceSolverSweptObject( trace_t *ptr, ITraceObject *sweepobject, CTraceRay *ray, CTraceIVP *obstacle, const Vector &axis, unsigned int contentsMask, IConvexInfo *pConvexInfo )
-: CTraceSolver( ptr, sweepobject, ray, obstacle, axis )
 {
+	Init( ptr, sweepobject, ray, obstacle, axis, contentsMask, pConvexInfo );
+}
+
+void CTraceSolverSweptObject::Init( trace_t *ptr, ITraceObject *sweepobject, CTraceRay *ray, CTraceIVP *obstacle, const Vector &axis, unsigned int contentsMask, IConvexInfo *pConvexInfo )
+{
+	CTraceSolver::Init( ptr, sweepobject, ray, obstacle, axis );
 	m_obstacleIVP = obstacle;
 	m_contentsMask = contentsMask;
 	m_pConvexInfo = (pConvexInfo != NULL) ? pConvexInfo : m_fakeConvexInfo.GetPtr();
@@ -1166,30 +1190,35 @@ inline void CTraceSolverSweptObject::SweepAgainstNode(const IVP_Compact_Ledgetre
 	if (m_contentsMask & ledgeContents)
 	{
 		m_obstacleIVP->SetLedge( ledge );
-		if ( SweepSingleConvex() )
+		SweepAgainstLedge( ledgeContents );
+	}
+}
+
+inline void CTraceSolverSweptObject::SweepAgainstLedge( unsigned int ledgeContents )
+{
+	if ( SweepSingleConvex() )
+	{
+		if ( m_traceLength < m_totalTraceLength )
 		{
-			if ( m_traceLength < m_totalTraceLength )
-			{
-				m_pTotalTrace->plane.normal = m_trace.plane.normal;
-				m_pTotalTrace->startsolid = m_trace.startsolid;
-				m_pTotalTrace->allsolid = m_trace.allsolid;
-				m_totalTraceLength = m_traceLength;
-				m_pTotalTrace->fraction = m_traceLength * m_ray->m_ooBaseLength;
-				Assert(m_pTotalTrace->fraction >= 0 && m_pTotalTrace->fraction <= 1.0f);
+			m_pTotalTrace->plane.normal = m_trace.plane.normal;
+			m_pTotalTrace->startsolid = m_trace.startsolid;
+			m_pTotalTrace->allsolid = m_trace.allsolid;
+			m_totalTraceLength = m_traceLength;
+			m_pTotalTrace->fraction = m_traceLength * m_ray->m_ooBaseLength;
+			Assert(m_pTotalTrace->fraction >= 0 && m_pTotalTrace->fraction <= 1.0f);
 #if !DEBUG_KEEP_FULL_RAY
-				// shrink the ray to the shortened length, but leave a buffer of collisionSweepEpsilon units
-				// at the end to make sure that precision doesn't make you miss something slightly closer
-				float testFraction = (m_traceLength + m_epsilon*2) * m_ray->m_ooBaseLength;
-				if ( testFraction < 1.0f )
-				{
-					m_ray->Reset( testFraction );
-					// Update OS ray to limit tests
-					m_rayLengthOS = m_obstacleIVP->TransformLengthToLocal( m_ray->m_length );
-					m_rayCenterOS.add_multiple( &m_rayStartOS, &m_rayDeltaOS, 0.5f * testFraction );
-				}
-#endif
-				m_pTotalTrace->contents = ledgeContents;
+			// shrink the ray to the shortened length, but leave a buffer of collisionSweepEpsilon units
+			// at the end to make sure that precision doesn't make you miss something slightly closer
+			float testFraction = (m_traceLength + m_epsilon*2) * m_ray->m_ooBaseLength;
+			if ( testFraction < 1.0f )
+			{
+				m_ray->Reset( testFraction );
+				// Update OS ray to limit tests
+				m_rayLengthOS = m_obstacleIVP->TransformLengthToLocal( m_ray->m_length );
+				m_rayCenterOS.add_multiple( &m_rayStartOS, &m_rayDeltaOS, 0.5f * testFraction );
 			}
+#endif
+			m_pTotalTrace->contents = ledgeContents;
 		}
 	}
 }
@@ -1310,6 +1339,206 @@ void CTraceSolverSweptObject::DoSweep( void )
 	SweepLedgeTree_r( lt_node_root );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Sweeps up to four rays against the same obstacle with one walk of its
+//			ledge tree. Each node's sphere is tested against all of the rays at
+//			once, and each ledge is set up (verts transformed into the cache) once
+//			for every ray that reaches it instead of once per ray. Children are
+//			visited closest first to the first ray that reached the parent, so a
+//			packet of one walks the tree exactly like SweepLedgeTree_r.
+//-----------------------------------------------------------------------------
+#define TRACE_PACKET_SIZE	4
+
+class CTraceSolverPacket
+{
+public:
+	CTraceSolverPacket( CTraceSolverSweptObject *pSolvers, int solverCount );
+	void DoSweep( void );
+
+private:
+	inline int SweepHitsSphereOS( const IVP_Compact_Ledgetree_Node *node, int mask ) const;
+	inline void SweepAgainstNode( const IVP_Compact_Ledgetree_Node *node, int mask );
+	inline const IVP_U_Float_Point &FirstRayStartOS( int mask ) const;
+
+	CTraceSolverSweptObject	*m_pSolvers;
+	int						m_solverCount;
+	FourVectors				m_rayCenterOS;
+	FourVectors				m_rayDirOS;
+	fltx4					m_sweepObjectRadius;
+	fltx4					m_hasLength;		// lanes with m_rayLengthOS > 0
+};
+
+CTraceSolverPacket::CTraceSolverPacket( CTraceSolverSweptObject *pSolvers, int solverCount )
+{
+	Assert( solverCount > 0 && solverCount <= TRACE_PACKET_SIZE );
+	m_pSolvers = pSolvers;
+	m_solverCount = solverCount;
+
+	for ( int i = 0; i < solverCount; i++ )
+	{
+		m_pSolvers[i].InitOSRay();
+	}
+
+	// unused lanes copy the first ray, they're never in the mask
+	for ( int i = 0; i < TRACE_PACKET_SIZE; i++ )
+	{
+		const CTraceSolverSweptObject &solver = m_pSolvers[ ( i < solverCount ) ? i : 0 ];
+		m_rayCenterOS.X(i) = solver.m_rayCenterOS.k[0];
+		m_rayCenterOS.Y(i) = solver.m_rayCenterOS.k[1];
+		m_rayCenterOS.Z(i) = solver.m_rayCenterOS.k[2];
+		m_rayDirOS.X(i) = solver.m_rayDirOS.k[0];
+		m_rayDirOS.Y(i) = solver.m_rayDirOS.k[1];
+		m_rayDirOS.Z(i) = solver.m_rayDirOS.k[2];
+		SubFloat( m_sweepObjectRadius, i ) = solver.m_sweepObjectRadius;
+		SubInt( m_hasLength, i ) = ( solver.m_rayLengthOS > 0 ) ? 0xFFFFFFFF : 0;
+	}
+}
+
+// Same test as CTraceSolverSweptObject::SweepHitsSphereOS, for each ray in mask
+inline int CTraceSolverPacket::SweepHitsSphereOS( const IVP_Compact_Ledgetree_Node *node, int mask ) const
+{
+#if DEBUG_TEST_ALL_LEDGES
+	return mask;
+#endif
+	FourVectors delta;
+	delta.DuplicateVector( Vector( node->center.k[0], node->center.k[1], node->center.k[2] ) );
+	delta -= m_rayCenterOS;
+	fltx4 radius = AddSIMD( ReplicateX4( node->radius ), m_sweepObjectRadius );
+	fltx4 quadRadius = MulSIMD( radius, radius );
+
+	// rays with length test the perpendicular distance, points the distance to the center
+	FourVectors h = m_rayDirOS ^ delta;
+	fltx4 hitsLine = CmpLtSIMD( h * h, quadRadius );
+	fltx4 hitsCenter = CmpLtSIMD( delta * delta, quadRadius );
+	fltx4 hits = OrSIMD( AndSIMD( m_hasLength, hitsLine ), AndNotSIMD( m_hasLength, hitsCenter ) );
+	return mask & TestSignSIMD( hits );
+}
+
+inline const IVP_U_Float_Point &CTraceSolverPacket::FirstRayStartOS( int mask ) const
+{
+	int i = 0;
+	while ( !( mask & ( 1 << i ) ) )
+	{
+		i++;
+	}
+	return m_pSolvers[i].m_rayStartOS;
+}
+
+inline void CTraceSolverPacket::SweepAgainstNode( const IVP_Compact_Ledgetree_Node *node, int mask )
+{
+	// every solver in the packet has the same contents mask and convex info
+	CTraceSolverSweptObject &first = m_pSolvers[0];
+	const IVP_Compact_Ledge *ledge = node->get_compact_ledge();
+	unsigned int ledgeContents = first.m_pConvexInfo->GetContents( ledge->get_client_data() );
+	if ( !(first.m_contentsMask & ledgeContents) )
+		return;
+
+	first.m_obstacleIVP->SetLedge( ledge );
+	for ( int i = 0; i < m_solverCount; i++ )
+	{
+		if ( !( mask & ( 1 << i ) ) )
+			continue;
+
+		CTraceSolverSweptObject &solver = m_pSolvers[i];
+		solver.SweepAgainstLedge( ledgeContents );
+		// the ray may have been shortened
+		m_rayCenterOS.X(i) = solver.m_rayCenterOS.k[0];
+		m_rayCenterOS.Y(i) = solver.m_rayCenterOS.k[1];
+		m_rayCenterOS.Z(i) = solver.m_rayCenterOS.k[2];
+	}
+}
+
+void CTraceSolverPacket::DoSweep( void )
+{
+	VPROF("TraceSolverPacket::DoSweep");
+
+	const IVP_Compact_Ledgetree_Node *node = m_pSolvers[0].m_obstacleIVP->m_pSurface->get_compact_ledge_tree_root();
+	int mask = SweepHitsSphereOS( node, ( 1 << m_solverCount ) - 1 );
+	if ( !mask )
+		return;
+
+	struct packetnode_t
+	{
+		const IVP_Compact_Ledgetree_Node	*node;
+		int									mask;
+	};
+	CUtlVectorFixedGrowable<packetnode_t, 64> list;
+
+	// see CTraceSolverSweptObject::SweepLedgeTree_r
+	while ( 1 )
+	{
+loop_without_store:
+		if ( node->is_terminal() == IVP_TRUE )
+		{
+			SweepAgainstNode( node, mask );
+		}
+		else
+		{
+			const IVP_Compact_Ledgetree_Node *node0 = node->left_son();
+			const IVP_Compact_Ledgetree_Node *node1 = node->right_son();
+			int mask0 = SweepHitsSphereOS( node0, mask );
+			int mask1 = SweepHitsSphereOS( node1, mask );
+			if ( mask1 )
+			{
+				if ( mask0 )
+				{
+					const IVP_U_Float_Point &rayStartOS = FirstRayStartOS( mask );
+					IVP_U_Float_Point center0, center1;
+					center0.set( node0->center.k );
+					center1.set( node1->center.k );
+
+					// can hit, push on stack
+					int index = list.AddToTail();
+					if ( rayStartOS.quad_distance_to( &center0 ) < rayStartOS.quad_distance_to( &center1 ) )
+					{
+						node = node0;
+						mask = mask0;
+						list[index].node = node1;
+						list[index].mask = mask1;
+					}
+					else
+					{
+						node = node1;
+						mask = mask1;
+						list[index].node = node0;
+						list[index].mask = mask0;
+					}
+				}
+				else
+				{
+					node = node1;
+					mask = mask1;
+				}
+				goto loop_without_store;
+			}
+			if ( mask0 )
+			{
+				node = node0;
+				mask = mask0;
+				goto loop_without_store;
+			}
+		}
+		int last = list.Count()-1;
+		if ( last < 0 )
+			break;
+		node = list[last].node;
+		mask = list[last].mask;
+		list.FastRemove(last);
+	}
+}
+
+// Fills in the parts of a box trace that are the same however it was swept
+static void FinishSweepBox( const Ray_t &raySrc, trace_t *ptr )
+{
+	VectorAdd( raySrc.m_Start, raySrc.m_StartOffset, ptr->startpos );
+	VectorMA( ptr->startpos, ptr->fraction, raySrc.m_Delta, ptr->endpos );
+	// The plane was shifted because we shifted everything over by surfaceOrigin, shift it back
+	if ( ptr->DidHit() )
+	{
+		ptr->plane.dist = DotProduct( ptr->endpos, ptr->plane.normal );
+	}
+}
+
 void CPhysicsTrace::SweepBoxIVP( const Vector &start, const Vector &end, const Vector &mins, const Vector &maxs, const CPhysCollide *pCollide, const Vector &surfaceOrigin, const QAngle &surfaceAngles, trace_t *ptr )
 {
 	Ray_t ray;
@@ -1330,12 +1559,44 @@ void CPhysicsTrace::SweepBoxIVP( const Ray_t &raySrc, unsigned int contentsMask,
 	CTraceSolverSweptObject solver( ptr, &box, &ray, &ivp, ray.m_start, contentsMask, pConvexInfo );
 	solver.DoSweep();
 
-	VectorAdd( raySrc.m_Start, raySrc.m_StartOffset, ptr->startpos );
-	VectorMA( ptr->startpos, ptr->fraction, raySrc.m_Delta, ptr->endpos );
-	// The plane was shifted because we shifted everything over by surfaceOrigin, shift it back
-	if ( ptr->DidHit() )
+	FinishSweepBox( raySrc, ptr );
+}
+
+void CPhysicsTrace::SweepBoxIVPBatch( const Ray_t *pRays, int rayCount, unsigned int contentsMask, IConvexInfo *pConvexInfo, const CPhysCollide *pCollide, const Vector &surfaceOrigin, const QAngle &surfaceAngles, trace_t *pTraces )
+{
+	VPROF("CPhysicsTrace::SweepBoxIVPBatch");
+
+	// the obstacle's transform is built once for the whole batch
+	CTraceIVP ivp( pCollide, vec3_origin, surfaceAngles );
+
+	CTraceAABB boxes[TRACE_PACKET_SIZE];
+	CTraceRay rays[TRACE_PACKET_SIZE];
+	CTraceSolverSweptObject solvers[TRACE_PACKET_SIZE];
+
+	for ( int first = 0; first < rayCount; first += TRACE_PACKET_SIZE )
 	{
-		ptr->plane.dist = DotProduct( ptr->endpos, ptr->plane.normal );
+		int count = MIN( rayCount - first, TRACE_PACKET_SIZE );
+		for ( int i = 0; i < count; i++ )
+		{
+			const Ray_t &raySrc = pRays[first + i];
+			trace_t *ptr = &pTraces[first + i];
+			CM_ClearTrace( ptr );
+
+			boxes[i].Init( -raySrc.m_Extents, raySrc.m_Extents, raySrc.m_IsRay );
+			// offset the space of this sweep so that the surface is at the origin of the solution space
+			Vector start;
+			VectorAdd( raySrc.m_Start, -surfaceOrigin, start );
+			rays[i].Init( start, raySrc.m_Delta );
+			solvers[i].Init( ptr, &boxes[i], &rays[i], &ivp, rays[i].m_start, contentsMask, pConvexInfo );
+		}
+
+		CTraceSolverPacket packet( solvers, count );
+		packet.DoSweep();
+
+		for ( int i = 0; i < count; i++ )
+		{
+			FinishSweepBox( pRays[first + i], &pTraces[first + i] );
+		}
 	}
 }
 
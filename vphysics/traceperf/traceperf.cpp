@@ -44,6 +44,7 @@ struct testlist_t
 	Vector end;
 	Vector normal;
 	bool hit;
+	float fraction[2];		// of the ray and the box trace, to check the batched traces against
 };
 
 struct benchresults_t
@@ -53,9 +54,43 @@ struct benchresults_t
 	float	totalTime;
 	float	rayTime;
 	float	boxTime;
+	float	batchRayTime;
+	float	batchBoxTime;
+	int		batchMismatches;
 };
 
 testlist_t g_Traces[NUM_COLLISION_TESTS];
+Ray_t g_BatchRays[NUM_COLLISION_TESTS];
+trace_t g_BatchTraces[NUM_COLLISION_TESTS];
+
+// batched traces may shorten their rays in a different order than single traces, so allow for the sweep epsilon
+#define BATCH_TRACE_TOLERANCE	0.1f
+
+//-----------------------------------------------------------------------------
+// Traces the same rays as the single trace loops through TraceBoxBatch and
+// counts the traces that don't end up in the same place
+//-----------------------------------------------------------------------------
+float Benchmark_PHYBatch( const CPhysCollide *pCollide, const Vector &end, const Vector &size, int sizeIndex, int *pMismatches )
+{
+	for ( int i = 0; i < NUM_COLLISION_TESTS; i++ )
+	{
+		g_BatchRays[i].Init( g_Traces[i].start, end, -size, size );
+	}
+
+	double startTime = Plat_FloatTime();
+	physcollision->TraceBoxBatch( g_BatchRays, NUM_COLLISION_TESTS, MASK_ALL, NULL, pCollide, vec3_origin, vec3_angle, g_BatchTraces );
+	double endTime = Plat_FloatTime();
+
+	for ( int i = 0; i < NUM_COLLISION_TESTS; i++ )
+	{
+		float length = g_BatchRays[i].m_Delta.Length();
+		if ( fabs( g_BatchTraces[i].fraction - g_Traces[i].fraction[sizeIndex] ) * length > BATCH_TRACE_TOLERANCE )
+		{
+			(*pMismatches)++;
+		}
+	}
+	return (endTime - startTime) * 1000.0f;
+}
 void Benchmark_PHY( const CPhysCollide *pCollide, benchresults_t *pOut )
 {
 	int i;
@@ -146,6 +181,7 @@ void Benchmark_PHY( const CPhysCollide *pCollide, benchresults_t *pOut )
 	for ( i = 0; i < NUM_COLLISION_TESTS; i++ )
 	{
 		physcollision->TraceBox( g_Traces[i].start, start, -size[0], size[0], pCollide, vec3_origin, vec3_angle, &tr );
+		g_Traces[i].fraction[0] = tr.fraction;
 		if ( tr.DidHit() )
 		{
 			g_Traces[i].end = tr.endpos;
@@ -165,6 +201,7 @@ void Benchmark_PHY( const CPhysCollide *pCollide, benchresults_t *pOut )
 	for ( i = 0; i < NUM_COLLISION_TESTS; i++ )
 	{
 		physcollision->TraceBox( g_Traces[i].start, start, -size[1], size[1], pCollide, vec3_origin, vec3_angle, &tr );
+		g_Traces[i].fraction[1] = tr.fraction;
 #if VPROF_LEVEL > 0 
 		g_VProfCurrentProfile.MarkFrame();
 #endif
@@ -177,6 +214,10 @@ void Benchmark_PHY( const CPhysCollide *pCollide, benchresults_t *pOut )
 	pOut->rayTime = (midTime - startTime) * 1000.0f;
 	pOut->boxTime = (endTime - midTime)*1000.0f;
 
+	pOut->batchMismatches = 0;
+	pOut->batchRayTime = Benchmark_PHYBatch( pCollide, start, size[0], 0, &pOut->batchMismatches );
+	pOut->batchBoxTime = Benchmark_PHYBatch( pCollide, start, size[1], 1, &pOut->batchMismatches );
+
 #if VPROF_LEVEL > 0 
 	g_VProfCurrentProfile.Stop();
 	g_VProfCurrentProfile.OutputReport( VPRT_FULL & ~VPRT_HIERARCHY, NULL );
@@ -364,9 +405,31 @@ int CBenchmarkApp::Main()
 	{
 		ReadPHYFile( pFileNames[i], testModels[i] );
 	}
+	// Load everything again, like the client does in a listen server.  The second copies share the solids of the first.
+	unsigned int firstLoadTime = physcollision->ReadStat( VCOLLIDE_STAT_LOAD_USEC );
+	vcollide_t sharedModels[ARRAYSIZE(pFileNames)];
+	memset( sharedModels, 0, sizeof(sharedModels) );
+	for ( int i = 0; i < ARRAYSIZE(pFileNames); i++ )
+	{
+		ReadPHYFile( pFileNames[i], sharedModels[i] );
+	}
+	unsigned int secondLoadTime = physcollision->ReadStat( VCOLLIDE_STAT_LOAD_USEC ) - firstLoadTime;
+	Msg("vcollide load: %.2f ms, %.2f ms again, %u/%u solids shared, %u bytes resident, %u bytes saved\n\n",
+		firstLoadTime * 0.001f, secondLoadTime * 0.001f, 
+		physcollision->ReadStat( VCOLLIDE_STAT_SHARED_SOLIDS ), physcollision->ReadStat( VCOLLIDE_STAT_LOADED_SOLIDS ),
+		physcollision->ReadStat( VCOLLIDE_STAT_RESIDENT_BYTES ), physcollision->ReadStat( VCOLLIDE_STAT_SAVED_BYTES ) );
+	for ( int i = 0; i < ARRAYSIZE(pFileNames); i++ )
+	{
+		if ( sharedModels[i].solidCount )
+		{
+			physcollision->VCollideUnload( &sharedModels[i] );
+		}
+	}
 	SetPriorityClass( GetCurrentProcess(), REALTIME_PRIORITY_CLASS );
 	SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_HIGHEST );
 	float totalTime = 0.0f;
+	float totalBatchTime = 0.0f;
+	int totalMismatches = 0;
 	int loopCount = ARRAYSIZE(pFileNames);
 #if VPROF_LEVEL > 0
 //	loopCount = 3;
@@ -394,11 +457,22 @@ int CBenchmarkApp::Main()
 		Msg("%.2f ms rays \t[%.2f X] \t%.2f ms boxes [%.2f X]\n", 
 			results.rayTime, IMPROVEMENT_FACTOR(results.rayTime, g_Baselines[i].ray), 
 			results.boxTime, IMPROVEMENT_FACTOR(results.boxTime, g_Baselines[i].box));
+		Msg("%.2f ms batched rays \t[%.2f X] \t%.2f ms batched boxes [%.2f X] \t%d mismatches\n", 
+			results.batchRayTime, IMPROVEMENT_FACTOR(results.batchRayTime, results.rayTime), 
+			results.batchBoxTime, IMPROVEMENT_FACTOR(results.batchBoxTime, results.boxTime), results.batchMismatches);
 		totalTime += results.totalTime;
+		totalBatchTime += results.batchRayTime + results.batchBoxTime;
+		totalMismatches += results.batchMismatches;
 	}
 	SetPriorityClass( GetCurrentProcess(), NORMAL_PRIORITY_CLASS );
 
 	Msg("\n%.2fs total \t[%.2f X]!\n", totalTime, IMPROVEMENT_FACTOR(totalTime, g_TotalBaseline) );
+	Msg("%.2fs batched \t[%.2f X]!\n", totalBatchTime, IMPROVEMENT_FACTOR(totalBatchTime, totalTime) );
+	if ( totalMismatches )
+	{
+		Warning("%d batched traces don't match TraceBox!\n", totalMismatches );
+		return 1;
+	}
 	return 0;
 }
 
@@ -13,6 +13,7 @@
 #include "tier1/utldict.h"
 #include "tier2/fileutils.h"
 #include "tier1/utlbuffer.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef VPK_ENABLE_SIGNING
 	#include "crypto.h"
@@ -1302,41 +1303,87 @@ void CPackedStore::DiscardChunkHashes( int iChunkFileIndex )
 	}
 }
 
-void CPackedStore::HashChunkFile( int iChunkFileIndex )
+void CPackedStore::ComputeChunkFileHashes( ChunkHashJob_t &job )
 {
-	AUTO_LOCK( m_Mutex );
-	static const int k_nFileFractionSize = 0x00100000; // 1 MB
+	job.m_vecFractions.RemoveAll();
 
-	// Purge any hashes we already have for this chunk.
-	DiscardChunkHashes( iChunkFileIndex );
+	char szDataFileName[MAX_PATH];
+	GetDataFileName( szDataFileName, sizeof(szDataFileName), job.m_iChunkFileIndex );
 
-	CPackedStoreFileHandle VPKHandle = GetHandleForHashingFiles();
-	VPKHandle.m_nFileNumber = iChunkFileIndex;
+	// Our own handle, the shared ones are serialized by their mutex
+	FileHandle_t hFile = m_pFileSystem->Open( szDataFileName, "rb" );
+	int64 nFileSize = hFile ? m_pFileSystem->Size( hFile ) : 0;
+
+	CUtlVector<uint8> tempBuf;
+	tempBuf.SetCount( k_nVPKFileFractionSize );
 
 	int nFileFraction = 0;
 	while ( 1 )
 	{
-		FileHash_t filehash;
+		int nFractionLength = (int)MIN( (int64)k_nVPKFileFractionSize, nFileSize - nFileFraction );
+		int nRead = ( hFile && nFractionLength > 0 ) ? m_pFileSystem->Read( tempBuf.Base(), nFractionLength, hFile ) : 0;
 
-		// VPKHandle.m_nFileNumber;
-		// nFileFraction;
-		int64 fileSize = 0;
-		// if we have never hashed this before - do it now
-		HashEntirePackFile( VPKHandle, fileSize, nFileFraction, k_nFileFractionSize, filehash );
-		ChunkHashFraction_t fileHashFraction;
-		fileHashFraction.m_cbChunkLen = filehash.m_cbFileLen;
-		fileHashFraction.m_nPackFileNumber = VPKHandle.m_nFileNumber;
+		ChunkHashFraction_t &fileHashFraction = job.m_vecFractions[ job.m_vecFractions.AddToTail() ];
+		fileHashFraction.m_cbChunkLen = nFractionLength;
+		fileHashFraction.m_nPackFileNumber = job.m_iChunkFileIndex;
 		fileHashFraction.m_nFileFraction = nFileFraction;
-		Q_memcpy( fileHashFraction.m_md5contents.bits, filehash.m_md5contents.bits, sizeof(fileHashFraction.m_md5contents) );
-		m_vecChunkHashFraction.Insert( fileHashFraction );
+		MD5_ProcessSingleBuffer( tempBuf.Base(), MAX( nRead, 0 ), fileHashFraction.m_md5contents );
+
 		// move to next section
-		nFileFraction += k_nFileFractionSize;
+		nFileFraction += k_nVPKFileFractionSize;
 		// if we are at EOF we are done
-		if ( nFileFraction > fileSize )
+		if ( nFileFraction > nFileSize )
 			break;
 	}
+
+	if ( hFile )
+		m_pFileSystem->Close( hFile );
+}
+
+void CPackedStore::HashChunkFile( int iChunkFileIndex )
+{
+	ChunkHashJob_t job;
+	job.m_iChunkFileIndex = iChunkFileIndex;
+	ComputeChunkFileHashes( job );
+	SetChunkHashes( iChunkFileIndex, job.m_vecFractions );
+}
+
+void CPackedStore::SetChunkHashes( int iChunkFileIndex, const CUtlVector<ChunkHashFraction_t> &vecFractions )
+{
+	AUTO_LOCK( m_Mutex );
+
+	// Purge any hashes we already have for this chunk.
+	DiscardChunkHashes( iChunkFileIndex );
+
+	FOR_EACH_VEC( vecFractions, i )
+	{
+		Assert( vecFractions[i].m_nPackFileNumber == iChunkFileIndex );
+		m_vecChunkHashFraction.Insert( vecFractions[i] );
+	}
 }
 
+bool CPackedStore::ChunkHashesMatch( int iChunkFileIndex, const CUtlVector<ChunkHashFraction_t> &vecFractions )
+{
+	AUTO_LOCK( m_Mutex );
+
+	// The list is sorted by chunk and then fraction, so ours are contiguous and in order
+	int nMatched = 0;
+	FOR_EACH_VEC( m_vecChunkHashFraction, i )
+	{
+		const ChunkHashFraction_t &have = m_vecChunkHashFraction[i];
+		if ( have.m_nPackFileNumber != iChunkFileIndex )
+			continue;
+
+		if ( nMatched >= vecFractions.Count() )
+			return false;
+
+		const ChunkHashFraction_t &want = vecFractions[nMatched++];
+		if ( have.m_nFileFraction != want.m_nFileFraction || have.m_cbChunkLen != want.m_cbChunkLen || have.m_md5contents != want.m_md5contents )
+			return false;
+	}
+
+	return nMatched > 0 && nMatched == vecFractions.Count();
+}
 
 void CPackedStore::HashAllChunkFiles()
 {
@@ -1345,10 +1392,177 @@ void CPackedStore::HashAllChunkFiles()
 	// been removed.
 	BuildHashTables();
 
-	// make brand new hashes
+	// make brand new hashes, one chunk file per job
 	m_vecChunkHashFraction.Purge();
-	for ( int iChunkFileIndex = 0 ; iChunkFileIndex <= GetHighestChunkFileIndex() ; ++iChunkFileIndex )
-		HashChunkFile( iChunkFileIndex );
+
+	CUtlVector<ChunkHashJob_t> vecJobs;
+	vecJobs.SetCount( GetHighestChunkFileIndex() + 1 );
+	FOR_EACH_VEC( vecJobs, i )
+	{
+		vecJobs[i].m_iChunkFileIndex = i;
+	}
+
+	ParallelProcess( "CPackedStore::HashAllChunkFiles", vecJobs.Base(), vecJobs.Count(), this, &CPackedStore::ComputeChunkFileHashes );
+
+	FOR_EACH_VEC( vecJobs, i )
+	{
+		SetChunkHashes( i, vecJobs[i].m_vecFractions );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// CPackedStoreChunkWriter
+//-----------------------------------------------------------------------------
+CPackedStoreChunkWriter::CPackedStoreChunkWriter( CPackedStore *pStore, int iChunkFileIndex, bool bKeepIfUnchanged )
+{
+	m_pStore = pStore;
+	m_iChunkFileIndex = iChunkFileIndex;
+	m_bKeepIfUnchanged = bKeepIfUnchanged;
+	m_bUnchanged = false;
+	m_bWriteError = false;
+	m_szFileName[0] = '\0';
+	m_szWriteFileName[0] = '\0';
+	m_hFile = FILESYSTEM_INVALID_HANDLE;
+	m_iFillBuffer = 0;
+	m_nFill = 0;
+	m_nWriteSize = 0;
+	m_pWriteJob = NULL;
+	m_nBytesWritten = 0;
+}
+
+CPackedStoreChunkWriter::~CPackedStoreChunkWriter()
+{
+	// Abandoned without Close
+	if ( m_hFile != FILESYSTEM_INVALID_HANDLE )
+	{
+		WaitForWrite();
+		g_pFullFileSystem->Close( m_hFile );
+		if ( V_strcmp( m_szWriteFileName, m_szFileName ) )
+			g_pFullFileSystem->RemoveFile( m_szWriteFileName );
+	}
+}
+
+bool CPackedStoreChunkWriter::Open()
+{
+	m_pStore->GetDataFileName( m_szFileName, sizeof(m_szFileName), m_iChunkFileIndex );
+
+	// Only worth writing to the side if there is something to keep
+	if ( m_bKeepIfUnchanged && g_pFullFileSystem->FileExists( m_szFileName ) )
+		V_sprintf_safe( m_szWriteFileName, "%s.tmp", m_szFileName );
+	else
+		V_strcpy_safe( m_szWriteFileName, m_szFileName );
+
+	m_hFile = g_pFullFileSystem->Open( m_szWriteFileName, "wb" );
+	if ( m_hFile == FILESYSTEM_INVALID_HANDLE )
+		return false;
+
+	for ( int i = 0; i < ARRAYSIZE( m_Buffer ); i++ )
+		m_Buffer[i].SetCount( k_nVPKFileFractionSize );
+	return true;
+}
+
+bool CPackedStoreChunkWriter::Write( const void *pData, int nBytes )
+{
+	Assert( m_hFile != FILESYSTEM_INVALID_HANDLE );
+
+	const uint8 *pSrc = (const uint8 *)pData;
+	while ( nBytes > 0 )
+	{
+		int nCopy = MIN( nBytes, k_nVPKFileFractionSize - m_nFill );
+		V_memcpy( m_Buffer[m_iFillBuffer].Base() + m_nFill, pSrc, nCopy );
+		m_nFill += nCopy;
+		pSrc += nCopy;
+		nBytes -= nCopy;
+
+		if ( m_nFill == k_nVPKFileFractionSize )
+			FlushBuffer( false );
+	}
+
+	return !m_bWriteError;
+}
+
+void CPackedStoreChunkWriter::FlushBuffer( bool bFinal )
+{
+	// Each full buffer is exactly one fraction.  Like HashChunkFile, the final
+	// fraction is always emitted, even when it is empty.
+	Assert( bFinal || m_nFill == k_nVPKFileFractionSize );
+	ChunkHashFraction_t &fileHashFraction = m_vecFractions[ m_vecFractions.AddToTail() ];
+	fileHashFraction.m_cbChunkLen = m_nFill;
+	fileHashFraction.m_nPackFileNumber = m_iChunkFileIndex;
+	fileHashFraction.m_nFileFraction = (int)m_nBytesWritten;
+	MD5_ProcessSingleBuffer( m_Buffer[m_iFillBuffer].Base(), m_nFill, fileHashFraction.m_md5contents );
+
+	// Hand this buffer to the writer once the other one is done
+	WaitForWrite();
+	m_nWriteSize = m_nFill;
+	m_nBytesWritten += m_nFill;
+	if ( m_nFill > 0 )
+	{
+		if ( g_pThreadPool && g_pThreadPool->NumThreads() > 0 )
+			m_pWriteJob = g_pThreadPool->QueueCall( this, &CPackedStoreChunkWriter::WriteBuffer, m_iFillBuffer );
+		else
+			WriteBuffer( m_iFillBuffer );
+	}
+
+	m_iFillBuffer ^= 1;
+	m_nFill = 0;
+}
+
+void CPackedStoreChunkWriter::WriteBuffer( int iBuffer )
+{
+	int nWritten = g_pFullFileSystem->Write( m_Buffer[iBuffer].Base(), m_nWriteSize, m_hFile );
+	if ( nWritten != m_nWriteSize )
+		m_bWriteError = true;
+}
+
+bool CPackedStoreChunkWriter::WaitForWrite()
+{
+	if ( m_pWriteJob )
+	{
+		m_pWriteJob->WaitForFinishAndRelease();
+		m_pWriteJob = NULL;
+	}
+	return !m_bWriteError;
+}
+
+bool CPackedStoreChunkWriter::Close()
+{
+	Assert( m_hFile != FILESYSTEM_INVALID_HANDLE );
+
+	FlushBuffer( true );
+	WaitForWrite();
+	g_pFullFileSystem->Close( m_hFile );
+	m_hFile = FILESYSTEM_INVALID_HANDLE;
+
+	bool bWroteToTemp = V_strcmp( m_szWriteFileName, m_szFileName ) != 0;
+	if ( m_bWriteError )
+	{
+		if ( bWroteToTemp )
+			g_pFullFileSystem->RemoveFile( m_szWriteFileName );
+		return false;
+	}
+
+	if ( bWroteToTemp )
+	{
+		// Same content as the chunk we already have?  Then leave that file alone,
+		// so anything diffing by file time or size doesn't see a change.
+		m_bUnchanged = m_pStore->ChunkHashesMatch( m_iChunkFileIndex, m_vecFractions );
+		if ( m_bUnchanged )
+		{
+			g_pFullFileSystem->RemoveFile( m_szWriteFileName );
+		}
+		else
+		{
+			g_pFullFileSystem->RemoveFile( m_szFileName );
+			if ( !g_pFullFileSystem->RenameFile( m_szWriteFileName, m_szFileName ) )
+				return false;
+		}
+	}
+
+	m_pStore->SetChunkHashes( m_iChunkFileIndex, m_vecFractions );
+	for ( int i = 0; i < ARRAYSIZE( m_Buffer ); i++ )
+		m_Buffer[i].Purge();
+	return true;
 }
 
 void CPackedStore::ComputeDirectoryHash( MD5Value_t &md5Directory )
@@ -1425,6 +1639,19 @@ void CPackedStore::GetPackFileName( CPackedStoreFileHandle &handle, char *pchFil
 	GetDataFileName( pchFileNameOut, cchFileNameOut, handle.m_nFileNumber );
 }
 
+void CPackedStore::GetDataFileLocation( const CPackedStoreFileHandle &handle, char *pchFileNameOut, int cchFileNameOut, int64 &nOffsetOut, int &nSizeOut ) const
+{
+	GetDataFileName( pchFileNameOut, cchFileNameOut, handle.m_nFileNumber );
+
+	nOffsetOut = handle.m_nFileOffset;
+	if ( handle.m_nFileNumber == VPKFILENUMBER_EMBEDDED_IN_DIR_FILE )
+	{
+		// for file data in the directory header, all offsets are relative to the size of the dir header.
+		nOffsetOut += m_nDirectoryDataSize + sizeof( VPKDirHeader_t );
+	}
+	nSizeOut = MAX( 0, handle.m_nFileSize - handle.m_nMetaDataSize );
+}
+
 FileHandleTracker_t & CPackedStore::GetFileHandle( int nFileNumber )
 {
 	AUTO_LOCK( m_Mutex );